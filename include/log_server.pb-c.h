@@ -79,10 +79,14 @@ struct  _ClientMessage
     CommandSuspend *suspend_event;
     ClientHello *hello_msg;
   } u;
+  /*
+   * multiplexed session, 0 if not multiplexed 
+   */
+  uint32_t session_id;
 };
 #define CLIENT_MESSAGE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&client_message__descriptor) \
-    , CLIENT_MESSAGE__TYPE__NOT_SET, {0} }
+    , CLIENT_MESSAGE__TYPE__NOT_SET, {0}, 0 }
 
 
 /*
@@ -404,10 +408,14 @@ struct  _ServerMessage
      */
     char *abort;
   } u;
+  /*
+   * session the message is for, if multiplexed 
+   */
+  uint32_t session_id;
 };
 #define SERVER_MESSAGE__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&server_message__descriptor) \
-    , SERVER_MESSAGE__TYPE__NOT_SET, {0} }
+    , SERVER_MESSAGE__TYPE__NOT_SET, {0}, 0 }
 
 
 /*
@@ -429,10 +437,14 @@ struct  _ServerHello
    */
   size_t n_servers;
   char **servers;
+  /*
+   * server supports multiplexed sessions 
+   */
+  protobuf_c_boolean multiplex;
 };
 #define SERVER_HELLO__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&server_hello__descriptor) \
-    , (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0,NULL }
+    , (char *)protobuf_c_empty_string, (char *)protobuf_c_empty_string, 0,NULL, 0 }
 
 
 /* ClientMessage methods */
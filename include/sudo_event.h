@@ -78,6 +78,9 @@ struct sudo_event {
     short revents;		/* SUDO_EV_* flags (out) */
     short flags;		/* internal event flags */
     short pfd_idx;		/* index into pfds array (XXX) */
+#ifdef HAVE_EPOLL
+    struct sudo_event *fd_next;	/* next event on the same fd (epoll) */
+#endif
     sudo_ev_callback_t callback;/* user-provided callback */
     struct timespec timeout;	/* for SUDO_EV_TIMEOUT */
     void *closure;		/* user-provided data pointer */
@@ -101,6 +104,15 @@ struct sudo_event_base {
     int pfd_max;		/* size of the pfds array */
     int pfd_high;		/* highest slot used */
     int pfd_free;		/* idx of next free entry or pfd_max if full */
+#ifdef HAVE_EPOLL
+    struct sudo_ev_epoll_fd *epfds; /* per-fd event lists, indexed by fd */
+    struct epoll_event *epevents; /* array of struct epoll_event (out) */
+    int epfd;			/* epoll instance */
+    int epfd_max;		/* size of the epfds array */
+    int epevent_max;		/* size of the epevents array */
+    int epfd_nregular;		/* fds epoll can't watch (always ready) */
+    pid_t epoll_pid;		/* process that created the epoll instance */
+#endif /* HAVE_EPOLL */
 #else
     fd_set *readfds_in;		/* read I/O descriptor set (in) */
     fd_set *writefds_in;	/* write I/O descriptor set (in) */
@@ -56,6 +56,15 @@
 #define IOFD_TIMING	5
 #define IOFD_MAX	6
 
+/*
+ * Compression codecs for I/O log files.
+ * Only gzip is always available (when sudo is built with zlib).
+ */
+#define IOLOG_CODEC_NONE	0
+#define IOLOG_CODEC_GZIP	1
+#define IOLOG_CODEC_LZ4		2
+#define IOLOG_CODEC_ZSTD	3
+
 struct timing_closure {
     struct timespec delay;
     const char *decimal;
@@ -75,15 +84,37 @@ struct iolog_file {
     bool enabled;
     bool compressed;
     bool writable;
+    int fdnum;
+    bool blocked;	/* compressed in independently seekable blocks */
+    int codec;		/* IOLOG_CODEC_* */
+    off_t nbytes;	/* uncompressed bytes written */
     union {
 	FILE *f;
 #ifdef HAVE_ZLIB_H
 	gzFile g;
+	struct iolog_block_file *b;
 #endif
 	void *v;
     } fd;
 };
 
+/*
+ * An entry in the I/O log index ("timing.idx").  Each entry records
+ * the uncompressed offset of every I/O log file at a point where all
+ * the files were committed.  For compressed files, the compressed
+ * offset of the block boundary is also stored so the log can be
+ * truncated and appended to without decompressing it.  An offset
+ * of -1 means the file did not exist at that point.
+ */
+struct iolog_index_entry {
+    struct timespec elapsed;
+    off_t end;			/* offset just past this entry in the index */
+    struct iolog_index_file {
+	off_t offset;
+	off_t zoffset;
+    } files[IOFD_MAX];
+};
+
 struct iolog_path_escape {
     const char *name;
     size_t (*copy_fn)(char *, size_t, void *);
@@ -95,6 +126,12 @@ bool iolog_parse_host_port(char *str, char **hostp, char **portp, bool *tlsp, ch
 /* iolog_path.c */
 bool expand_iolog_path(const char *inpath, char *path, size_t pathlen, const struct iolog_path_escape *escapes, void *closure);
 
+/* iolog_index.c */
+#define IOLOG_INDEX_NAME	"timing.idx"
+bool iolog_index_lookup(int dfd, const struct timespec *target, struct iolog_index_entry *entry);
+bool iolog_index_restore(int dfd, const struct iolog_index_entry *entry, struct iolog_file *iolog_files, int *index_fdp);
+bool iolog_index_write(int fd, struct iolog_file *iolog_files, const struct timespec *elapsed, bool sync, const char **errstr);
+
 /* iolog_util.c */
 bool iolog_parse_timing(const char *line, struct timing_closure *timing);
 char *iolog_parse_delay(const char *cp, struct timespec *delay, const char *decimal_point);
@@ -107,15 +144,19 @@ void iolog_adjust_delay(struct timespec *delay, struct timespec *max_delay, doub
 struct passwd;
 struct group;
 bool iolog_close(struct iolog_file *iol, const char **errstr);
+bool iolog_commit(struct iolog_file *iol, bool sync, const char **errstr);
 bool iolog_eof(struct iolog_file *iol);
 bool iolog_mkdtemp(char *path);
 bool iolog_mkpath(char *path);
 bool iolog_nextid(char *iolog_dir, char sessid[7]);
 bool iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode);
 bool iolog_rename(const char *from, const char *to);
+bool iolog_set_codec(const char *name);
+bool iolog_truncate(struct iolog_file *iol, const char **errstr);
 bool iolog_write_info_file(int dfd, struct eventlog *evlog);
 char *iolog_gets(struct iolog_file *iol, char *buf, size_t nbytes, const char **errsttr);
 const char *iolog_fd_to_name(int iofd);
+int iolog_index_open(int dfd, bool create);
 int iolog_openat(int fdf, const char *path, int flags);
 off_t iolog_seek(struct iolog_file *iol, off_t offset, int whence);
 ssize_t iolog_read(struct iolog_file *iol, void *buf, size_t nbytes, const char **errstr);
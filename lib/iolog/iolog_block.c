@@ -0,0 +1,1481 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Seekable compressed I/O log files.
+ *
+ * The data is split into blocks of at most IOLOG_BLOCK_SIZE bytes,
+ * each of which is compressed as a separate gzip member.  Since a
+ * multi-member file is still a valid gzip file, the logs can be read
+ * with gzip or zcat as before.  Each member header has an extra field
+ * containing the compressed size of the member and the uncompressed
+ * size of the block:
+ *
+ *   1f 8b 08 04 00000000 00 ff | XLEN=12 | 'S' 'B' LEN=8 | csize | usize
+ *
+ * When lz4 or zstd is used instead of gzip, each block is a standard
+ * lz4 or zstd frame preceded by a skippable frame holding the sizes:
+ *
+ *   magic 0x184d2a53 | LEN=8 | csize | usize
+ *
+ * so the files can still be read with the lz4 and zstd utilities.
+ * In both cases csize includes the block header.
+ *
+ * Readers hop from header to header to build a block index without
+ * decompressing anything, so a seek only needs to inflate one block.
+ *
+ * When the log is flushed after each write, the data is added to the
+ * last block using a sync flush instead of starting a new block.  The
+ * compressed stream is followed by a temporary end marker (an empty
+ * final deflate block, lz4 end mark or empty last zstd block) and the
+ * trailer, both of which are overwritten by the next flush, and the
+ * header is updated with the new sizes.  A block is ended when it is
+ * full or when the log is committed, so a committed block is never
+ * written to again.  Only the open block can be left inconsistent by
+ * a crash (or be seen that way by a reader while it is being flushed).
+ * Readers treat an invalid last block as the end of the file and it
+ * is discarded when the log is reopened for appending.
+ */
+
+#include <config.h>
+
+#ifdef HAVE_ZLIB_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_iolog.h"
+#include "sudo_util.h"
+#include "iolog_block.h"
+
+#ifdef HAVE_LZ4FRAME_H
+# include <lz4frame.h>
+#endif
+#ifdef HAVE_ZSTD_H
+# include <zstd.h>
+#endif
+
+/* Enough to hold the header of any codec. */
+#define BLOCK_HDR_LEN		24
+
+/* gzip member header and trailer. */
+#define GZIP_HDR_LEN		24
+#define GZIP_TRAILER_LEN	8
+#define GZIP_XLEN		12
+#define GZIP_SI1		'S'
+#define GZIP_SI2		'B'
+
+/* Skippable frame header used by lz4 and zstd blocks. */
+#define SKIP_HDR_LEN		16
+#define SKIP_MAGIC		0x184d2a53U
+#define LZ4_FRAME_MAGIC		0x184d2204U
+#define ZSTD_FRAME_MAGIC	0xfd2fb528U
+
+/* Temporary end of an lz4 or zstd frame after a sync flush. */
+#define LZ4_ENDMARK_LEN		4
+#define ZSTD_BLOCKHDR_LEN	3
+#ifndef LZ4F_HEADER_SIZE_MAX
+# define LZ4F_HEADER_SIZE_MAX	19
+#endif
+
+/* Upper bound on a block's uncompressed size when reading. */
+#define BLOCK_MAX_USIZE		(16 * 1024 * 1024)
+
+struct iolog_block_entry {
+    off_t coff;			/* compressed offset of the block */
+    off_t uoff;			/* uncompressed offset of the block */
+};
+
+struct iolog_block_file;
+
+/*
+ * Compression codec operations.  A whole block is compressed into
+ * or decompressed from cbuf in a single call.  The sync operation
+ * instead compresses the data added to a partial block since the last
+ * sync using the block file's own stream, see sync_block().
+ */
+struct block_codec {
+    int codec;
+    const char *name;
+    size_t hdr_len;
+    bool (*parse_header)(const unsigned char *hdr, size_t *csizep, size_t *usizep);
+    bool (*compress)(const unsigned char *src, size_t ulen, size_t *csizep);
+    bool (*decompress)(size_t csize, unsigned char *dst, size_t usize);
+    bool (*sync)(struct iolog_block_file *b, bool finish, size_t *newp, size_t *tailp);
+    void (*sync_free)(void *strm);
+};
+
+struct iolog_block_file {
+    const struct block_codec *codec;
+    int fd;
+    bool writing;
+    bool eof;
+    unsigned char *ubuf;	/* uncompressed block data */
+    size_t ubufsize;
+    size_t ulen;		/* bytes of data in ubuf */
+    size_t upos;		/* read position in ubuf */
+    off_t ustart;		/* uncompressed offset of ubuf[0] */
+    off_t coff;			/* compressed offset of the block in ubuf */
+    off_t cnext;		/* compressed offset of the next block */
+    struct iolog_block_entry *index;
+    size_t nindex;
+    size_t index_size;
+    off_t index_cnext;		/* compressed offset of first unindexed block */
+    off_t index_unext;		/* uncompressed offset of first unindexed block */
+    void *strm;			/* codec stream used for sync flushes */
+    unsigned long crc;		/* crc32 of the synced data (gzip) */
+    size_t usync;		/* bytes of ubuf compressed by sync flushes */
+    size_t csync;		/* compressed bytes written after the header */
+};
+
+/*
+ * Compression state is shared by all block files since a block is
+ * always compressed or decompressed in a single call.  Sync flushes
+ * use a stream that belongs to the block file.
+ */
+static z_stream deflate_strm;
+static z_stream inflate_strm;
+static bool deflate_initialized;
+static bool inflate_initialized;
+#ifdef HAVE_LZ4FRAME_H
+static LZ4F_dctx *lz4_dctx;
+#endif
+#ifdef HAVE_ZSTD_H
+static ZSTD_CCtx *zstd_cctx;
+static ZSTD_DCtx *zstd_dctx;
+#endif
+static unsigned char *cbuf;
+static size_t cbufsize;
+
+static void
+put_le32(unsigned char *cp, unsigned int val)
+{
+    cp[0] = val & 0xff;
+    cp[1] = (val >> 8) & 0xff;
+    cp[2] = (val >> 16) & 0xff;
+    cp[3] = (val >> 24) & 0xff;
+}
+
+static unsigned int
+get_le32(const unsigned char *cp)
+{
+    return (unsigned int)cp[0] | ((unsigned int)cp[1] << 8) |
+	((unsigned int)cp[2] << 16) | ((unsigned int)cp[3] << 24);
+}
+
+static bool
+cbuf_reserve(size_t size)
+{
+    unsigned char *newbuf;
+    debug_decl(cbuf_reserve, SUDO_DEBUG_UTIL);
+
+    if (size <= cbufsize)
+	debug_return_bool(true);
+    if ((newbuf = realloc(cbuf, size)) == NULL)
+	debug_return_bool(false);
+    cbuf = newbuf;
+    cbufsize = size;
+    debug_return_bool(true);
+}
+
+/*
+ * Parse a gzip member header, storing the compressed and uncompressed sizes.
+ */
+static bool
+gzip_parse_header(const unsigned char *hdr, size_t *csizep, size_t *usizep)
+{
+    if (hdr[0] != 0x1f || hdr[1] != 0x8b || hdr[2] != Z_DEFLATED ||
+	    hdr[3] != 0x04)
+	return false;
+    if (hdr[10] != GZIP_XLEN || hdr[11] != 0)
+	return false;
+    if (hdr[12] != GZIP_SI1 || hdr[13] != GZIP_SI2 || hdr[14] != 8 ||
+	    hdr[15] != 0)
+	return false;
+    *csizep = get_le32(hdr + 16);
+    *usizep = get_le32(hdr + 20);
+    return *csizep >= GZIP_HDR_LEN + GZIP_TRAILER_LEN;
+}
+
+/*
+ * gzip header with the block sizes in an extra field.
+ */
+static void
+gzip_fill_header(size_t csize, size_t ulen)
+{
+    memset(cbuf, 0, GZIP_HDR_LEN);
+    cbuf[0] = 0x1f;
+    cbuf[1] = 0x8b;
+    cbuf[2] = Z_DEFLATED;
+    cbuf[3] = 0x04;		/* FEXTRA */
+    cbuf[9] = 0xff;		/* unknown OS */
+    cbuf[10] = GZIP_XLEN;
+    cbuf[12] = GZIP_SI1;
+    cbuf[13] = GZIP_SI2;
+    cbuf[14] = 8;
+    put_le32(cbuf + 16, (unsigned int)csize);
+    put_le32(cbuf + 20, (unsigned int)ulen);
+}
+
+static bool
+gzip_compress(const unsigned char *src, size_t ulen, size_t *csizep)
+{
+    size_t csize;
+    debug_decl(gzip_compress, SUDO_DEBUG_UTIL);
+
+    if (!deflate_initialized) {
+	if (deflateInit2(&deflate_strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+		-MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	    debug_return_bool(false);
+	deflate_initialized = true;
+    } else if (deflateReset(&deflate_strm) != Z_OK) {
+	debug_return_bool(false);
+    }
+    csize = deflateBound(&deflate_strm, ulen) + GZIP_HDR_LEN +
+	GZIP_TRAILER_LEN;
+    if (!cbuf_reserve(csize))
+	debug_return_bool(false);
+    deflate_strm.next_in = src;
+    deflate_strm.avail_in = ulen;
+    deflate_strm.next_out = cbuf + GZIP_HDR_LEN;
+    deflate_strm.avail_out = csize - GZIP_HDR_LEN - GZIP_TRAILER_LEN;
+    if (deflate(&deflate_strm, Z_FINISH) != Z_STREAM_END)
+	debug_return_bool(false);
+    csize = GZIP_HDR_LEN + deflate_strm.total_out + GZIP_TRAILER_LEN;
+    gzip_fill_header(csize, ulen);
+
+    /* gzip trailer. */
+    put_le32(cbuf + csize - 8, crc32(0, src, ulen));
+    put_le32(cbuf + csize - 4, (unsigned int)ulen);
+
+    *csizep = csize;
+    debug_return_bool(true);
+}
+
+static bool
+gzip_decompress(size_t csize, unsigned char *dst, size_t usize)
+{
+    debug_decl(gzip_decompress, SUDO_DEBUG_UTIL);
+
+    if (!inflate_initialized) {
+	if (inflateInit2(&inflate_strm, -MAX_WBITS) != Z_OK)
+	    debug_return_bool(false);
+	inflate_initialized = true;
+    } else if (inflateReset(&inflate_strm) != Z_OK) {
+	debug_return_bool(false);
+    }
+    inflate_strm.next_in = cbuf + GZIP_HDR_LEN;
+    inflate_strm.avail_in = csize - GZIP_HDR_LEN - GZIP_TRAILER_LEN;
+    inflate_strm.next_out = dst;
+    inflate_strm.avail_out = usize;
+    if (inflate(&inflate_strm, Z_FINISH) != Z_STREAM_END ||
+	    inflate_strm.total_out != usize)
+	debug_return_bool(false);
+    if (get_le32(cbuf + csize - 8) != crc32(0, dst, usize) ||
+	    get_le32(cbuf + csize - 4) != (unsigned int)usize)
+	debug_return_bool(false);
+    debug_return_bool(true);
+}
+
+/*
+ * Compress the data added to the block since the last sync, leaving
+ * the deflate stream open unless finish is set.  The block is ended
+ * for now by an empty final deflate block and the gzip trailer.
+ */
+static bool
+gzip_sync(struct iolog_block_file *b, bool finish, size_t *newp, size_t *tailp)
+{
+    z_stream *strm = b->strm;
+    const size_t len = b->ulen - b->usync;
+    size_t csize, nout = 0;
+    int rc;
+    debug_decl(gzip_sync, SUDO_DEBUG_UTIL);
+
+    if (strm == NULL) {
+	if ((strm = calloc(1, sizeof(*strm))) == NULL)
+	    debug_return_bool(false);
+	if (deflateInit2(strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+		-MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+	    free(strm);
+	    debug_return_bool(false);
+	}
+	b->strm = strm;
+    } else if (b->usync == 0) {
+	if (deflateReset(strm) != Z_OK)
+	    debug_return_bool(false);
+    }
+    if (b->usync == 0)
+	b->crc = crc32(0, Z_NULL, 0);
+
+    /* Room for the sync marker, end marker and trailer. */
+    csize = GZIP_HDR_LEN + deflateBound(strm, len) + 16 + GZIP_TRAILER_LEN;
+    strm->next_in = b->ubuf + b->usync;
+    strm->avail_in = len;
+    for (;;) {
+	if (!cbuf_reserve(csize))
+	    debug_return_bool(false);
+	strm->next_out = cbuf + GZIP_HDR_LEN + nout;
+	strm->avail_out = csize - GZIP_HDR_LEN - GZIP_TRAILER_LEN - 2 - nout;
+	rc = deflate(strm, finish ? Z_FINISH : Z_SYNC_FLUSH);
+	nout = csize - GZIP_HDR_LEN - GZIP_TRAILER_LEN - 2 - strm->avail_out;
+	if (rc == Z_STREAM_ERROR || strm->avail_out != 0)
+	    break;
+	/* Out of space, there may be more output pending. */
+	csize *= 2;
+    }
+    if (rc != (finish ? Z_STREAM_END : Z_OK))
+	debug_return_bool(false);
+    b->crc = crc32(b->crc, b->ubuf + b->usync, len);
+    *newp = nout;
+
+    if (!finish) {
+	/* Empty final block with fixed codes; the stream is byte aligned. */
+	cbuf[GZIP_HDR_LEN + nout++] = 0x03;
+	cbuf[GZIP_HDR_LEN + nout++] = 0x00;
+    }
+    put_le32(cbuf + GZIP_HDR_LEN + nout, (unsigned int)b->crc);
+    put_le32(cbuf + GZIP_HDR_LEN + nout + 4, (unsigned int)b->ulen);
+    nout += GZIP_TRAILER_LEN;
+    *tailp = nout - *newp;
+
+    gzip_fill_header(GZIP_HDR_LEN + b->csync + nout, b->ulen);
+    debug_return_bool(true);
+}
+
+static void
+gzip_sync_free(void *strm)
+{
+    deflateEnd(strm);
+    free(strm);
+}
+
+#if defined(HAVE_LZ4FRAME_H) || defined(HAVE_ZSTD_H)
+/*
+ * Parse the skippable frame that precedes an lz4 or zstd frame.
+ */
+static bool
+skip_parse_header(const unsigned char *hdr, unsigned int frame_magic,
+    size_t *csizep, size_t *usizep)
+{
+    if (get_le32(hdr) != SKIP_MAGIC || get_le32(hdr + 4) != 8)
+	return false;
+    if (get_le32(hdr + SKIP_HDR_LEN) != frame_magic)
+	return false;
+    *csizep = get_le32(hdr + 8);
+    *usizep = get_le32(hdr + 12);
+    return *csizep > SKIP_HDR_LEN + 4;
+}
+
+static void
+skip_fill_header(size_t csize, size_t ulen)
+{
+    put_le32(cbuf, SKIP_MAGIC);
+    put_le32(cbuf + 4, 8);
+    put_le32(cbuf + 8, (unsigned int)csize);
+    put_le32(cbuf + 12, (unsigned int)ulen);
+}
+#endif /* HAVE_LZ4FRAME_H || HAVE_ZSTD_H */
+
+#ifdef HAVE_LZ4FRAME_H
+static bool
+lz4_parse_header(const unsigned char *hdr, size_t *csizep, size_t *usizep)
+{
+    return skip_parse_header(hdr, LZ4_FRAME_MAGIC, csizep, usizep);
+}
+
+static bool
+lz4_compress(const unsigned char *src, size_t ulen, size_t *csizep)
+{
+    LZ4F_preferences_t prefs;
+    size_t csize;
+    debug_decl(lz4_compress, SUDO_DEBUG_UTIL);
+
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    prefs.frameInfo.contentSize = ulen;
+
+    csize = SKIP_HDR_LEN + LZ4F_compressFrameBound(ulen, &prefs);
+    if (!cbuf_reserve(csize))
+	debug_return_bool(false);
+    csize = LZ4F_compressFrame(cbuf + SKIP_HDR_LEN, csize - SKIP_HDR_LEN,
+	src, ulen, &prefs);
+    if (LZ4F_isError(csize)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "LZ4F_compressFrame: %s", LZ4F_getErrorName(csize));
+	debug_return_bool(false);
+    }
+    csize += SKIP_HDR_LEN;
+    skip_fill_header(csize, ulen);
+
+    *csizep = csize;
+    debug_return_bool(true);
+}
+
+static bool
+lz4_decompress(size_t csize, unsigned char *dst, size_t usize)
+{
+    const unsigned char *src = cbuf + SKIP_HDR_LEN;
+    size_t dlen, slen, ret, dpos = 0, spos = 0;
+    const size_t srclen = csize - SKIP_HDR_LEN;
+    debug_decl(lz4_decompress, SUDO_DEBUG_UTIL);
+
+    if (lz4_dctx == NULL) {
+	ret = LZ4F_createDecompressionContext(&lz4_dctx, LZ4F_VERSION);
+	if (LZ4F_isError(ret)) {
+	    lz4_dctx = NULL;
+	    debug_return_bool(false);
+	}
+    }
+    do {
+	dlen = usize - dpos;
+	slen = srclen - spos;
+	ret = LZ4F_decompress(lz4_dctx, dst + dpos, &dlen, src + spos, &slen,
+	    NULL);
+	if (LZ4F_isError(ret) || (dlen == 0 && slen == 0))
+	    break;
+	dpos += dlen;
+	spos += slen;
+    } while (ret != 0 && spos < srclen);
+
+    if (ret != 0 || dpos != usize || spos != srclen) {
+	/* Start over with a fresh context for the next block. */
+	LZ4F_freeDecompressionContext(lz4_dctx);
+	lz4_dctx = NULL;
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+/*
+ * Compress the data added to the block since the last sync, leaving
+ * the frame open unless finish is set.  The frame is ended for now
+ * by a bare end mark, so no content checksum is used.
+ */
+static bool
+lz4_sync(struct iolog_block_file *b, bool finish, size_t *newp, size_t *tailp)
+{
+    LZ4F_cctx *cctx = b->strm;
+    LZ4F_preferences_t prefs;
+    const size_t len = b->ulen - b->usync;
+    size_t csize, ret, nout = 0;
+    unsigned char *dst;
+    debug_decl(lz4_sync, SUDO_DEBUG_UTIL);
+
+    if (cctx == NULL) {
+	ret = LZ4F_createCompressionContext(&cctx, LZ4F_VERSION);
+	if (LZ4F_isError(ret))
+	    debug_return_bool(false);
+	b->strm = cctx;
+    }
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockSizeID = LZ4F_max64KB;
+
+    csize = SKIP_HDR_LEN + LZ4F_HEADER_SIZE_MAX +
+	LZ4F_compressBound(len, &prefs) + LZ4_ENDMARK_LEN;
+    if (!cbuf_reserve(csize))
+	debug_return_bool(false);
+    dst = cbuf + SKIP_HDR_LEN;
+    csize -= SKIP_HDR_LEN + LZ4_ENDMARK_LEN;
+
+    if (b->usync == 0) {
+	ret = LZ4F_compressBegin(cctx, dst, csize, &prefs);
+	if (LZ4F_isError(ret))
+	    goto bad;
+	nout = ret;
+    }
+    ret = LZ4F_compressUpdate(cctx, dst + nout, csize - nout,
+	b->ubuf + b->usync, len, NULL);
+    if (LZ4F_isError(ret))
+	goto bad;
+    nout += ret;
+    if (finish)
+	ret = LZ4F_compressEnd(cctx, dst + nout, csize - nout, NULL);
+    else
+	ret = LZ4F_flush(cctx, dst + nout, csize - nout, NULL);
+    if (LZ4F_isError(ret))
+	goto bad;
+    nout += ret;
+    *newp = nout;
+
+    if (!finish) {
+	put_le32(dst + nout, 0);
+	nout += LZ4_ENDMARK_LEN;
+    }
+    *tailp = nout - *newp;
+
+    skip_fill_header(SKIP_HDR_LEN + b->csync + nout, b->ulen);
+    debug_return_bool(true);
+bad:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	"lz4 sync: %s", LZ4F_getErrorName(ret));
+    debug_return_bool(false);
+}
+
+static void
+lz4_sync_free(void *strm)
+{
+    LZ4F_freeCompressionContext(strm);
+}
+
+#endif /* HAVE_LZ4FRAME_H */
+
+#ifdef HAVE_ZSTD_H
+# ifndef ZSTD_CLEVEL_DEFAULT
+#  define ZSTD_CLEVEL_DEFAULT 3
+# endif
+
+static bool
+zstd_parse_header(const unsigned char *hdr, size_t *csizep, size_t *usizep)
+{
+    return skip_parse_header(hdr, ZSTD_FRAME_MAGIC, csizep, usizep);
+}
+
+static bool
+zstd_compress(const unsigned char *src, size_t ulen, size_t *csizep)
+{
+    size_t csize;
+    debug_decl(zstd_compress, SUDO_DEBUG_UTIL);
+
+    if (zstd_cctx == NULL) {
+	if ((zstd_cctx = ZSTD_createCCtx()) == NULL)
+	    debug_return_bool(false);
+    }
+    csize = SKIP_HDR_LEN + ZSTD_compressBound(ulen);
+    if (!cbuf_reserve(csize))
+	debug_return_bool(false);
+    csize = ZSTD_compressCCtx(zstd_cctx, cbuf + SKIP_HDR_LEN,
+	csize - SKIP_HDR_LEN, src, ulen, ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(csize)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "ZSTD_compressCCtx: %s", ZSTD_getErrorName(csize));
+	debug_return_bool(false);
+    }
+    csize += SKIP_HDR_LEN;
+    skip_fill_header(csize, ulen);
+
+    *csizep = csize;
+    debug_return_bool(true);
+}
+
+static bool
+zstd_decompress(size_t csize, unsigned char *dst, size_t usize)
+{
+    size_t ret;
+    debug_decl(zstd_decompress, SUDO_DEBUG_UTIL);
+
+    if (zstd_dctx == NULL) {
+	if ((zstd_dctx = ZSTD_createDCtx()) == NULL)
+	    debug_return_bool(false);
+    }
+    ret = ZSTD_decompressDCtx(zstd_dctx, dst, usize, cbuf + SKIP_HDR_LEN,
+	csize - SKIP_HDR_LEN);
+    if (ZSTD_isError(ret) || ret != usize)
+	debug_return_bool(false);
+    debug_return_bool(true);
+}
+/*
+ * Compress the data added to the block since the last sync, leaving
+ * the frame open unless finish is set.  The frame is ended for now
+ * by an empty last block.
+ */
+static bool
+zstd_sync(struct iolog_block_file *b, bool finish, size_t *newp, size_t *tailp)
+{
+    ZSTD_CCtx *cctx = b->strm;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    size_t csize, ret, nout;
+    debug_decl(zstd_sync, SUDO_DEBUG_UTIL);
+
+    if (cctx == NULL) {
+	if ((cctx = ZSTD_createCCtx()) == NULL)
+	    debug_return_bool(false);
+	b->strm = cctx;
+    } else if (b->usync == 0) {
+	ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+    }
+
+    in.src = b->ubuf + b->usync;
+    in.size = b->ulen - b->usync;
+    in.pos = 0;
+    out.pos = 0;
+    csize = SKIP_HDR_LEN + ZSTD_compressBound(in.size) + ZSTD_BLOCKHDR_LEN;
+    for (;;) {
+	if (!cbuf_reserve(csize))
+	    debug_return_bool(false);
+	out.dst = cbuf + SKIP_HDR_LEN;
+	out.size = csize - SKIP_HDR_LEN - ZSTD_BLOCKHDR_LEN;
+	ret = ZSTD_compressStream2(cctx, &out, &in,
+	    finish ? ZSTD_e_end : ZSTD_e_flush);
+	if (ZSTD_isError(ret)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"ZSTD_compressStream2: %s", ZSTD_getErrorName(ret));
+	    debug_return_bool(false);
+	}
+	if (ret == 0)
+	    break;
+	/* Out of space, there is more output pending. */
+	csize *= 2;
+    }
+    nout = out.pos;
+    *newp = nout;
+
+    if (!finish) {
+	/* Empty raw block with the Last_Block bit set. */
+	cbuf[SKIP_HDR_LEN + nout++] = 0x01;
+	cbuf[SKIP_HDR_LEN + nout++] = 0x00;
+	cbuf[SKIP_HDR_LEN + nout++] = 0x00;
+    }
+    *tailp = nout - *newp;
+
+    skip_fill_header(SKIP_HDR_LEN + b->csync + nout, b->ulen);
+    debug_return_bool(true);
+}
+
+static void
+zstd_sync_free(void *strm)
+{
+    ZSTD_freeCCtx(strm);
+}
+
+#endif /* HAVE_ZSTD_H */
+
+static const struct block_codec block_codecs[] = {
+    { IOLOG_CODEC_GZIP, "gzip", GZIP_HDR_LEN, gzip_parse_header,
+	gzip_compress, gzip_decompress, gzip_sync, gzip_sync_free },
+#ifdef HAVE_LZ4FRAME_H
+    { IOLOG_CODEC_LZ4, "lz4", SKIP_HDR_LEN, lz4_parse_header,
+	lz4_compress, lz4_decompress, lz4_sync, lz4_sync_free },
+#endif
+#ifdef HAVE_ZSTD_H
+    { IOLOG_CODEC_ZSTD, "zstd", SKIP_HDR_LEN, zstd_parse_header,
+	zstd_compress, zstd_decompress, zstd_sync, zstd_sync_free },
+#endif
+};
+
+static const struct block_codec *
+find_codec(int codec)
+{
+    size_t i;
+
+    for (i = 0; i < nitems(block_codecs); i++) {
+	if (block_codecs[i].codec == codec)
+	    return &block_codecs[i];
+    }
+    return NULL;
+}
+
+/*
+ * Parse a block header using the specified codec, or any codec if NULL.
+ */
+static const struct block_codec *
+parse_header(const struct block_codec *codec, const unsigned char *hdr,
+    size_t *csizep, size_t *usizep)
+{
+    size_t i;
+
+    for (i = 0; i < nitems(block_codecs); i++) {
+	if (codec != NULL && codec != &block_codecs[i])
+	    continue;
+	if (block_codecs[i].parse_header(hdr, csizep, usizep)) {
+	    if (*csizep < BLOCK_HDR_LEN || *usizep > BLOCK_MAX_USIZE)
+		return NULL;
+	    return &block_codecs[i];
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Read the block header at coff.
+ * Returns 1 on success, 0 at end of file (or on a partial header
+ * left by an interrupted write) and -1 on error.
+ */
+static int
+read_header(struct iolog_block_file *b, off_t coff, size_t *csizep,
+    size_t *usizep)
+{
+    unsigned char hdr[BLOCK_HDR_LEN];
+    ssize_t nread;
+    debug_decl(read_header, SUDO_DEBUG_UTIL);
+
+    nread = pread(b->fd, hdr, sizeof(hdr), coff);
+    if (nread == -1)
+	debug_return_int(-1);
+    if (nread != ssizeof(hdr))
+	debug_return_int(0);
+    if (parse_header(b->codec, hdr, csizep, usizep) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "invalid block header at offset %lld", (long long)coff);
+	errno = EINVAL;
+	debug_return_int(-1);
+    }
+    debug_return_int(1);
+}
+
+/*
+ * Make sure the block index covers the block at coff, if it is next.
+ */
+static bool
+index_add(struct iolog_block_file *b, off_t coff, off_t uoff, size_t csize,
+    size_t usize)
+{
+    debug_decl(index_add, SUDO_DEBUG_UTIL);
+
+    if (b->nindex > 0 && coff == b->index[b->nindex - 1].coff) {
+	/* The last block may have grown since it was indexed. */
+	b->index_cnext = coff + csize;
+	b->index_unext = uoff + usize;
+	debug_return_bool(true);
+    }
+    if (coff != b->index_cnext)
+	debug_return_bool(true);
+
+    if (b->nindex == b->index_size) {
+	size_t newsize = b->index_size ? b->index_size * 2 : 64;
+	struct iolog_block_entry *newindex =
+	    reallocarray(b->index, newsize, sizeof(*newindex));
+	if (newindex == NULL)
+	    debug_return_bool(false);
+	b->index = newindex;
+	b->index_size = newsize;
+    }
+    b->index[b->nindex].coff = coff;
+    b->index[b->nindex].uoff = uoff;
+    b->nindex++;
+    b->index_cnext = coff + csize;
+    b->index_unext = uoff + usize;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Extend the block index until it covers target or reaches the end
+ * of the file (if target is -1).  Only the block headers are read.
+ */
+static bool
+index_extend(struct iolog_block_file *b, off_t target)
+{
+    size_t csize, usize;
+    int rc;
+    debug_decl(index_extend, SUDO_DEBUG_UTIL);
+
+    while (target == -1 || b->index_unext <= target) {
+	rc = read_header(b, b->index_cnext, &csize, &usize);
+	if (rc == -1 && errno != EINVAL)
+	    debug_return_bool(false);
+	if (rc != 1 && b->nindex > 0) {
+	    /* Check whether the last block has grown, see sync_block(). */
+	    struct iolog_block_entry *last = &b->index[b->nindex - 1];
+	    if (read_header(b, last->coff, &csize, &usize) == 1 &&
+		    last->coff + (off_t)csize > b->index_cnext) {
+		if (!index_add(b, last->coff, last->uoff, csize, usize))
+		    debug_return_bool(false);
+		continue;
+	    }
+	}
+	if (rc != 1) {
+	    /* End of file or an incomplete write after the last block. */
+	    break;
+	}
+	if (!index_add(b, b->index_cnext, b->index_unext, csize, usize))
+	    debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+static bool
+ubuf_reserve(struct iolog_block_file *b, size_t size)
+{
+    unsigned char *newbuf;
+    size_t newsize;
+    debug_decl(ubuf_reserve, SUDO_DEBUG_UTIL);
+
+    if (size <= b->ubufsize)
+	debug_return_bool(true);
+
+    /* Most log files are small, grow the buffer as needed. */
+    newsize = b->ubufsize ? b->ubufsize : 1024;
+    while (newsize < size)
+	newsize *= 2;
+    if ((newbuf = realloc(b->ubuf, newsize)) == NULL)
+	debug_return_bool(false);
+    b->ubuf = newbuf;
+    b->ubufsize = newsize;
+    debug_return_bool(true);
+}
+
+/*
+ * Read and decompress the block at coff into ubuf.
+ * Returns 1 on success, 0 at end of file and -1 on error.
+ */
+static int
+load_block(struct iolog_block_file *b, off_t coff, off_t uoff)
+{
+    size_t csize, usize;
+    ssize_t nread;
+    int rc;
+    debug_decl(load_block, SUDO_DEBUG_UTIL);
+
+    rc = read_header(b, coff, &csize, &usize);
+    if (rc != 1)
+	debug_return_int(rc);
+    if (!cbuf_reserve(csize) || !ubuf_reserve(b, usize))
+	debug_return_int(-1);
+    nread = pread(b->fd, cbuf, csize, coff);
+    if (nread == -1)
+	debug_return_int(-1);
+    if ((size_t)nread != csize) {
+	/* Partial block from an interrupted write, treat as EOF. */
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "short block at offset %lld", (long long)coff);
+	debug_return_int(0);
+    }
+
+    if (!b->codec->decompress(csize, b->ubuf, usize)) {
+	size_t ncsize, nusize;
+
+	/* An open block being flushed or left torn by a crash is last. */
+	if (read_header(b, coff + csize, &ncsize, &nusize) != 1) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"incomplete last block at offset %lld", (long long)coff);
+	    debug_return_int(0);
+	}
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "corrupt block at offset %lld", (long long)coff);
+	errno = EINVAL;
+	debug_return_int(-1);
+    }
+
+    if (!index_add(b, coff, uoff, csize, usize))
+	debug_return_int(-1);
+    b->coff = coff;
+    b->cnext = coff + csize;
+    b->ustart = uoff;
+    b->ulen = usize;
+    b->upos = 0;
+    debug_return_int(1);
+}
+
+/*
+ * Load the block following the current one.  If the current block
+ * has grown since it was loaded, it is reloaded instead.
+ * Returns 1 on success, 0 at end of file and -1 on error.
+ */
+static int
+next_block(struct iolog_block_file *b)
+{
+    const off_t uoff = b->ustart + b->ulen;
+    const size_t upos = b->upos;
+    size_t csize, usize;
+    int rc;
+    debug_decl(next_block, SUDO_DEBUG_UTIL);
+
+    if (b->cnext > b->coff) {
+	rc = read_header(b, b->coff, &csize, &usize);
+	if (rc == 1 && usize > b->ulen) {
+	    rc = load_block(b, b->coff, b->ustart);
+	    if (rc == 1)
+		b->upos = upos;
+	    debug_return_int(rc);
+	}
+    }
+
+    rc = load_block(b, b->cnext, uoff);
+    if (rc == 0) {
+	/* Stay positioned at the end of the current block. */
+	b->eof = true;
+    }
+    debug_return_int(rc);
+}
+
+/*
+ * Write len bytes from buf at the specified file offset.
+ */
+static bool
+write_at(struct iolog_block_file *b, const unsigned char *buf, size_t len,
+    off_t off, const char **errstr)
+{
+    ssize_t nwritten;
+    debug_decl(write_at, SUDO_DEBUG_UTIL);
+
+    while (len > 0) {
+	nwritten = pwrite(b->fd, buf, len, off);
+	if (nwritten == -1) {
+	    if (errno == EINTR)
+		continue;
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    debug_return_bool(false);
+	}
+	buf += nwritten;
+	len -= nwritten;
+	off += nwritten;
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Advance past the block just written.  The file offset is left at
+ * the end of the last complete block, which is what the I/O log
+ * index records as the compressed offset.
+ */
+static bool
+end_block(struct iolog_block_file *b, size_t csize, const char **errstr)
+{
+    debug_decl(end_block, SUDO_DEBUG_UTIL);
+
+    b->coff = b->cnext;
+    b->cnext += csize;
+    b->ustart += b->ulen;
+    b->ulen = 0;
+    b->usync = 0;
+    b->csync = 0;
+    if (lseek(b->fd, b->cnext, SEEK_SET) == -1) {
+	if (errstr != NULL)
+	    *errstr = strerror(errno);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Compress the data added since the last sync and write it to the
+ * end of the current block, followed by a temporary end marker and
+ * trailer.  The header is rewritten last so it never covers data that
+ * has not been written yet.  If finish is set, the block is ended.
+ */
+static bool
+sync_block(struct iolog_block_file *b, bool finish, const char **errstr)
+{
+    const size_t hdr_len = b->codec->hdr_len;
+    size_t nnew, ntail;
+    debug_decl(sync_block, SUDO_DEBUG_UTIL);
+
+    if (!b->codec->sync(b, finish, &nnew, &ntail)) {
+	if (errstr != NULL)
+	    *errstr = "compression error";
+	debug_return_bool(false);
+    }
+    if (b->usync == 0) {
+	/* New block, write the header along with the data. */
+	if (!write_at(b, cbuf, hdr_len + nnew + ntail, b->cnext, errstr))
+	    debug_return_bool(false);
+    } else {
+	if (!write_at(b, cbuf + hdr_len, nnew + ntail,
+		b->cnext + hdr_len + b->csync, errstr))
+	    debug_return_bool(false);
+	if (!write_at(b, cbuf, hdr_len, b->cnext, errstr))
+	    debug_return_bool(false);
+    }
+    b->csync += nnew;
+    b->usync = b->ulen;
+
+    if (finish)
+	debug_return_bool(end_block(b, hdr_len + b->csync + ntail, errstr));
+    debug_return_bool(true);
+}
+
+/*
+ * Compress and write any buffered data as a complete block.
+ */
+static bool
+write_block(struct iolog_block_file *b, const char **errstr)
+{
+    size_t csize;
+    debug_decl(write_block, SUDO_DEBUG_UTIL);
+
+    if (b->usync != 0) {
+	/* Finish the partial block written by sync flushes. */
+	debug_return_bool(sync_block(b, true, errstr));
+    }
+    if (b->ulen == 0)
+	debug_return_bool(true);
+
+    if (!b->codec->compress(b->ubuf, b->ulen, &csize)) {
+	if (errstr != NULL)
+	    *errstr = "compression error";
+	debug_return_bool(false);
+    }
+    if (!write_at(b, cbuf, csize, b->cnext, errstr))
+	debug_return_bool(false);
+    debug_return_bool(end_block(b, csize, errstr));
+}
+
+/*
+ * Find the end of the valid data in a file opened for appending.
+ * Only the block headers are read, except for the last block which
+ * must decompress.  Anything after the last valid block was left by
+ * an interrupted write; it was never committed and is discarded.
+ */
+static bool
+find_end(struct iolog_block_file *b)
+{
+    struct iolog_block_entry *last;
+    size_t csize, usize;
+    struct stat sb;
+    int rc;
+    debug_decl(find_end, SUDO_DEBUG_UTIL);
+
+    if (fstat(b->fd, &sb) == -1)
+	debug_return_bool(false);
+    for (;;) {
+	rc = read_header(b, b->index_cnext, &csize, &usize);
+	if (rc == -1 && errno != EINVAL)
+	    debug_return_bool(false);
+	if (rc != 1 || b->index_cnext + (off_t)csize > sb.st_size)
+	    break;
+	if (!index_add(b, b->index_cnext, b->index_unext, csize, usize))
+	    debug_return_bool(false);
+    }
+
+    if (b->nindex > 0) {
+	last = &b->index[b->nindex - 1];
+	rc = load_block(b, last->coff, last->uoff);
+	if (rc == -1 && errno != EINVAL)
+	    debug_return_bool(false);
+	if (rc != 1) {
+	    /* Torn write in the last block. */
+	    b->index_cnext = last->coff;
+	    b->index_unext = last->uoff;
+	    b->nindex--;
+	}
+    }
+    if (b->index_cnext != sb.st_size) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "discarding %lld bytes of incomplete data at offset %lld",
+	    (long long)(sb.st_size - b->index_cnext),
+	    (long long)b->index_cnext);
+    }
+    b->coff = b->index_cnext;
+    b->cnext = b->index_cnext;
+    b->ustart = b->index_unext;
+    b->ulen = 0;
+    b->upos = 0;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Map a codec name to its IOLOG_CODEC_* value.
+ * Returns -1 if the codec is unknown or not supported by this build.
+ */
+int
+iolog_block_codec(const char *name)
+{
+    size_t i;
+    debug_decl(iolog_block_codec, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < nitems(block_codecs); i++) {
+	if (strcmp(name, block_codecs[i].name) == 0)
+	    debug_return_int(block_codecs[i].codec);
+    }
+    debug_return_int(-1);
+}
+
+/*
+ * If the file descriptor refers to a block compressed file,
+ * returns its IOLOG_CODEC_* value, else IOLOG_CODEC_NONE.
+ * lz4 and zstd files are recognized even when this build does not
+ * support the codec so they are not mistaken for uncompressed logs;
+ * iolog_block_open() will reject them.
+ */
+int
+iolog_block_detect(int fd)
+{
+    unsigned char hdr[BLOCK_HDR_LEN];
+    const struct block_codec *codec;
+    size_t csize, usize;
+    debug_decl(iolog_block_detect, SUDO_DEBUG_UTIL);
+
+    if (pread(fd, hdr, sizeof(hdr), 0) != ssizeof(hdr))
+	debug_return_int(IOLOG_CODEC_NONE);
+    codec = parse_header(NULL, hdr, &csize, &usize);
+    if (codec != NULL)
+	debug_return_int(codec->codec);
+
+    if (get_le32(hdr) == SKIP_MAGIC && get_le32(hdr + 4) == 8) {
+	switch (get_le32(hdr + SKIP_HDR_LEN)) {
+	case LZ4_FRAME_MAGIC:
+	    debug_return_int(IOLOG_CODEC_LZ4);
+	case ZSTD_FRAME_MAGIC:
+	    debug_return_int(IOLOG_CODEC_ZSTD);
+	}
+    }
+    debug_return_int(IOLOG_CODEC_NONE);
+}
+
+/*
+ * Open a block compressed file using an existing file descriptor.
+ * Mode "w" starts a new file, "a" appends to an existing one
+ * and "r" or "r+" open the file for reading.  An existing file
+ * must use the specified codec.  Fails with errno set to ENOTSUP
+ * if the codec is not supported by this build.
+ */
+struct iolog_block_file *
+iolog_block_open(int fd, const char *mode, int codec)
+{
+    const struct block_codec *ops = find_codec(codec);
+    struct iolog_block_file *b;
+    debug_decl(iolog_block_open, SUDO_DEBUG_UTIL);
+
+    if (ops == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR,
+	    "%s: codec %d not supported", __func__, codec);
+	errno = ENOTSUP;
+	debug_return_ptr(NULL);
+    }
+    if ((b = calloc(1, sizeof(*b))) == NULL)
+	debug_return_ptr(NULL);
+    b->codec = ops;
+    b->fd = fd;
+
+    if (mode[0] == 'a') {
+	if (!find_end(b) || lseek(fd, b->cnext, SEEK_SET) == -1 ||
+		ftruncate(fd, b->cnext) == -1) {
+	    free(b->ubuf);
+	    free(b->index);
+	    free(b);
+	    debug_return_ptr(NULL);
+	}
+    }
+    if (mode[0] != 'r') {
+	/* Blocks are written at explicit offsets, see sync_block(). */
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags != -1 && ISSET(flags, O_APPEND))
+	    (void)fcntl(fd, F_SETFL, flags & ~O_APPEND);
+    }
+    b->writing = mode[0] != 'r';
+
+    debug_return_ptr(b);
+}
+
+/*
+ * Write out any buffered data and free the block file.
+ * The file descriptor is closed too.
+ */
+bool
+iolog_block_close(struct iolog_block_file *b, const char **errstr)
+{
+    bool ret = true;
+    debug_decl(iolog_block_close, SUDO_DEBUG_UTIL);
+
+    if (b->writing)
+	ret = write_block(b, errstr);
+    if (close(b->fd) == -1 && ret) {
+	if (errstr != NULL)
+	    *errstr = strerror(errno);
+	ret = false;
+    }
+    if (b->strm != NULL)
+	b->codec->sync_free(b->strm);
+    free(b->ubuf);
+    free(b->index);
+    free(b);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Write any buffered data to the file as a complete block.
+ */
+bool
+iolog_block_flush(struct iolog_block_file *b, const char **errstr)
+{
+    debug_decl(iolog_block_flush, SUDO_DEBUG_UTIL);
+
+    if (!b->writing)
+	debug_return_bool(true);
+    debug_return_bool(write_block(b, errstr));
+}
+
+/*
+ * Discard everything after the current read position and switch to
+ * writing.  Only the block containing the current position needs to
+ * be recompressed, and only if the position is in the middle of it.
+ */
+bool
+iolog_block_truncate(struct iolog_block_file *b, const char **errstr)
+{
+    off_t cend;
+    debug_decl(iolog_block_truncate, SUDO_DEBUG_UTIL);
+
+    if (b->writing)
+	debug_return_bool(true);
+
+    if (b->upos == b->ulen) {
+	/* At a block boundary, keep the current block as is. */
+	cend = b->cnext;
+	b->ustart += b->ulen;
+	b->ulen = 0;
+    } else {
+	/* Rewrite the start of the current block. */
+	cend = b->coff;
+	b->ulen = b->upos;
+    }
+    if (ftruncate(b->fd, cend) == -1 || lseek(b->fd, cend, SEEK_SET) == -1) {
+	if (errstr != NULL)
+	    *errstr = strerror(errno);
+	debug_return_bool(false);
+    }
+    b->cnext = cend;
+    b->upos = 0;
+    b->eof = false;
+    b->writing = true;
+
+    /* The index is not used when writing. */
+    b->nindex = 0;
+    b->index_cnext = 0;
+    b->index_unext = 0;
+
+    debug_return_bool(true);
+}
+
+bool
+iolog_block_eof(struct iolog_block_file *b)
+{
+    return b->eof;
+}
+
+void
+iolog_block_clearerr(struct iolog_block_file *b)
+{
+    b->eof = false;
+}
+
+/*
+ * Seek to the specified uncompressed offset.
+ * Returns the new offset or -1 on error.
+ */
+off_t
+iolog_block_seek(struct iolog_block_file *b, off_t offset, int whence)
+{
+    size_t lo, hi, mid;
+    off_t target;
+    int rc;
+
+    if (b->writing) {
+	/* Can only report the current position when writing. */
+	if (whence != SEEK_CUR || offset != 0) {
+	    errno = EINVAL;
+	    return -1;
+	}
+	return b->ustart + b->ulen;
+    }
+
+    switch (whence) {
+    case SEEK_SET:
+	target = offset;
+	break;
+    case SEEK_CUR:
+	target = b->ustart + b->upos + offset;
+	break;
+    default:
+	errno = EINVAL;
+	return -1;
+    }
+    if (target < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    /* Common case: seeking within the current block. */
+    if (target >= b->ustart && target <= b->ustart + (off_t)b->ulen) {
+	b->upos = target - b->ustart;
+	b->eof = false;
+	return target;
+    }
+
+    if (!index_extend(b, target))
+	return -1;
+    if (b->nindex == 0 || target > b->index_unext) {
+	/* Seeking past the end of the data is not supported. */
+	errno = EINVAL;
+	return -1;
+    }
+
+    /* Binary search for the last block starting at or before target. */
+    lo = 0;
+    hi = b->nindex;
+    while (hi - lo > 1) {
+	mid = lo + (hi - lo) / 2;
+	if (b->index[mid].uoff <= target)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    rc = load_block(b, b->index[lo].coff, b->index[lo].uoff);
+    if (rc != 1) {
+	if (rc == 0)
+	    errno = EINVAL;
+	return -1;
+    }
+    b->upos = target - b->ustart;
+    b->eof = false;
+
+    return target;
+}
+
+/*
+ * Read up to nbytes of uncompressed data.
+ */
+ssize_t
+iolog_block_read(struct iolog_block_file *b, void *vbuf, size_t nbytes,
+    const char **errstr)
+{
+    unsigned char *buf = vbuf;
+    size_t len, nread = 0;
+    int rc;
+    debug_decl(iolog_block_read, SUDO_DEBUG_UTIL);
+
+    if (b->writing) {
+	errno = EBADF;
+	goto bad;
+    }
+
+    while (nread < nbytes) {
+	if (b->upos == b->ulen) {
+	    rc = next_block(b);
+	    if (rc == -1)
+		goto bad;
+	    if (rc == 0)
+		break;
+	}
+	len = MIN(nbytes - nread, b->ulen - b->upos);
+	memcpy(buf + nread, b->ubuf + b->upos, len);
+	b->upos += len;
+	nread += len;
+    }
+    debug_return_ssize_t(nread);
+bad:
+    if (errstr != NULL)
+	*errstr = strerror(errno);
+    debug_return_ssize_t(-1);
+}
+
+/*
+ * Like fgets() but for block files.
+ */
+char *
+iolog_block_gets(struct iolog_block_file *b, char *buf, size_t nbytes,
+    const char **errstr)
+{
+    size_t len, nread = 0;
+    unsigned char *nl;
+    int rc;
+    debug_decl(iolog_block_gets, SUDO_DEBUG_UTIL);
+
+    if (nbytes == 0 || b->writing) {
+	errno = EINVAL;
+	goto bad;
+    }
+
+    while (nread < nbytes - 1) {
+	if (b->upos == b->ulen) {
+	    rc = next_block(b);
+	    if (rc == -1)
+		goto bad;
+	    if (rc == 0)
+		break;
+	}
+	len = MIN(nbytes - 1 - nread, b->ulen - b->upos);
+	nl = memchr(b->ubuf + b->upos, '\n', len);
+	if (nl != NULL)
+	    len = (size_t)(nl - (b->ubuf + b->upos)) + 1;
+	memcpy(buf + nread, b->ubuf + b->upos, len);
+	b->upos += len;
+	nread += len;
+	if (nl != NULL)
+	    break;
+    }
+    if (nread == 0) {
+	if (errstr != NULL)
+	    *errstr = "end of file";
+	debug_return_str(NULL);
+    }
+    buf[nread] = '\0';
+    debug_return_str(buf);
+bad:
+    if (errstr != NULL)
+	*errstr = strerror(errno);
+    debug_return_str(NULL);
+}
+
+/*
+ * Buffer data for writing, a block is written each time the buffer
+ * fills up.  If flush is set, buffered data is written immediately
+ * as part of the current block, which stays open.
+ */
+ssize_t
+iolog_block_write(struct iolog_block_file *b, const void *vbuf, size_t len,
+    bool flush, const char **errstr)
+{
+    const unsigned char *buf = vbuf;
+    size_t n, nwritten = 0;
+    debug_decl(iolog_block_write, SUDO_DEBUG_UTIL);
+
+    /* Switching from reading to writing discards the rest of the file. */
+    if (!b->writing) {
+	if (!iolog_block_truncate(b, errstr))
+	    debug_return_ssize_t(-1);
+    }
+
+    while (nwritten < len) {
+	n = MIN(len - nwritten, IOLOG_BLOCK_SIZE - b->ulen);
+	if (!ubuf_reserve(b, b->ulen + n)) {
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    debug_return_ssize_t(-1);
+	}
+	memcpy(b->ubuf + b->ulen, buf + nwritten, n);
+	b->ulen += n;
+	nwritten += n;
+	if (b->ulen == IOLOG_BLOCK_SIZE) {
+	    if (!write_block(b, errstr))
+		debug_return_ssize_t(-1);
+	}
+    }
+    if (flush && b->ulen > b->usync) {
+	/* Add the data to the current block without ending it. */
+	if (!sync_block(b, false, errstr))
+	    debug_return_ssize_t(-1);
+    }
+
+    debug_return_ssize_t(nwritten);
+}
+
+#endif /* HAVE_ZLIB_H */
@@ -0,0 +1,40 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef IOLOG_BLOCK_H
+#define IOLOG_BLOCK_H
+
+/* Maximum amount of uncompressed data in a single block. */
+#define IOLOG_BLOCK_SIZE	(64 * 1024)
+
+struct iolog_block_file;
+
+int iolog_block_codec(const char *name);
+int iolog_block_detect(int fd);
+struct iolog_block_file *iolog_block_open(int fd, const char *mode, int codec);
+bool iolog_block_close(struct iolog_block_file *b, const char **errstr);
+bool iolog_block_flush(struct iolog_block_file *b, const char **errstr);
+bool iolog_block_truncate(struct iolog_block_file *b, const char **errstr);
+bool iolog_block_eof(struct iolog_block_file *b);
+void iolog_block_clearerr(struct iolog_block_file *b);
+char *iolog_block_gets(struct iolog_block_file *b, char *buf, size_t nbytes, const char **errstr);
+off_t iolog_block_seek(struct iolog_block_file *b, off_t offset, int whence);
+ssize_t iolog_block_read(struct iolog_block_file *b, void *buf, size_t nbytes, const char **errstr);
+ssize_t iolog_block_write(struct iolog_block_file *b, const void *buf, size_t len, bool flush, const char **errstr);
+
+#endif /* IOLOG_BLOCK_H */
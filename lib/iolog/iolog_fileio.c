@@ -48,6 +48,7 @@
 #include "sudo_json.h"
 #include "sudo_queue.h"
 #include "sudo_util.h"
+#include "iolog_block.h"
 
 static unsigned char const gzip_magic[2] = {0x1f, 0x8b};
 static unsigned int sessid_max = SESSID_MAX;
@@ -57,6 +58,11 @@ static uid_t iolog_uid = ROOT_UID;
 static gid_t iolog_gid = ROOT_GID;
 static bool iolog_gid_set;
 static bool iolog_compress;
+#ifdef HAVE_ZLIB_H
+static int iolog_codec = IOLOG_CODEC_GZIP;
+#else
+static int iolog_codec = IOLOG_CODEC_NONE;
+#endif
 static bool iolog_flush;
 
 /*
@@ -281,6 +287,9 @@ iolog_set_defaults(void)
     iolog_gid = ROOT_GID;
     iolog_gid_set = false;
     iolog_compress = false;
+#ifdef HAVE_ZLIB_H
+    iolog_codec = IOLOG_CODEC_GZIP;
+#endif
     iolog_flush = false;
 }
 
@@ -364,6 +373,28 @@ iolog_set_compress(bool newval)
     debug_return;
 }
 
+/*
+ * Set the codec used when iolog_compress is enabled.
+ * Returns false if the codec is not supported.
+ */
+bool
+iolog_set_codec(const char *name)
+{
+    int codec = -1;
+    debug_decl(iolog_set_codec, SUDO_DEBUG_UTIL);
+
+#ifdef HAVE_ZLIB_H
+    codec = iolog_block_codec(name);
+#endif
+    if (codec != -1) {
+	iolog_codec = codec;
+	debug_return_bool(true);
+    }
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"unsupported I/O log codec %s", name);
+    debug_return_bool(false);
+}
+
 /*
  * Set iolog_flush
  */
@@ -420,6 +451,35 @@ iolog_openat(int dfd, const char *path, int flags)
     debug_return_int(fd);
 }
 
+/*
+ * Open the I/O log index file for appending, creating it if create is set.
+ * Returns the file descriptor on success, else -1.
+ */
+int
+iolog_index_open(int dfd, bool create)
+{
+    int fd, flags = O_RDWR|O_APPEND;
+    debug_decl(iolog_index_open, SUDO_DEBUG_UTIL);
+
+    if (create)
+	flags |= O_CREAT|O_TRUNC;
+    fd = iolog_openat(dfd, IOLOG_INDEX_NAME, flags);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to open %s", __func__, IOLOG_INDEX_NAME);
+	debug_return_int(-1);
+    }
+    if (create) {
+	if (fchown(fd, iolog_uid, iolog_gid) != 0) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+		"%s: unable to fchown %d:%d %s", __func__,
+		(int)iolog_uid, (int)iolog_gid, IOLOG_INDEX_NAME);
+	}
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    debug_return_int(fd);
+}
+
 /*
  * Read the on-disk sequence number, set sessid to the next
  * number, and update the on-disk copy.
@@ -551,6 +611,10 @@ iolog_mkpath(char *path)
  * Append suffix to pathbuf after len chars and open the resulting file.
  * Note that the size of pathbuf is assumed to be PATH_MAX.
  * Stores the open file handle which has the close-on-exec flag set.
+ * Mode "a" opens an existing file for appending, a compressed file
+ * is appended to by adding new blocks.  New compressed files are
+ * written as a series of independently compressed blocks so they
+ * can be seeked in and truncated efficiently.
  * XXX - move enabled logic into caller?
  */
 bool
@@ -563,6 +627,9 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
 
     if (mode[0] == 'r') {
 	flags = mode[1] == '+' ? O_RDWR : O_RDONLY;
+    } else if (mode[0] == 'a') {
+	/* Need read access to check for gzip magic number. */
+	flags = O_RDWR|O_APPEND;
     } else if (mode[0] == 'w') {
 	flags = O_CREAT|O_TRUNC;
 	flags |= mode[1] == '+' ? O_RDWR : O_WRONLY;
@@ -579,6 +646,10 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
 
     iol->writable = false;
     iol->compressed = false;
+    iol->blocked = false;
+    iol->codec = IOLOG_CODEC_NONE;
+    iol->fdnum = -1;
+    iol->nbytes = 0;
     if (iol->enabled) {
 	int fd = iolog_openat(dfd, file, flags);
 	if (fd != -1) {
@@ -588,23 +659,46 @@ iolog_open(struct iolog_file *iol, int dfd, int iofd, const char *mode)
 			"%s: unable to fchown %d:%d %s", __func__,
 			(int)iolog_uid, (int)iolog_gid, file);
 		}
-		iol->compressed = iolog_compress;
+		if (iolog_compress) {
+		    iol->codec = iolog_codec;
+		    iol->blocked = true;
+		}
 	    } else {
-		/* check for gzip magic number */
+#ifdef HAVE_ZLIB_H
+		/* Check for block compression, then the gzip magic number. */
+		iol->codec = iolog_block_detect(fd);
+		if (iol->codec != IOLOG_CODEC_NONE) {
+		    iol->blocked = true;
+		} else
+#endif
 		if (pread(fd, magic, sizeof(magic), 0) == ssizeof(magic)) {
+		    /* Written by an older version as a single gzip stream. */
 		    if (magic[0] == gzip_magic[0] && magic[1] == gzip_magic[1])
-			iol->compressed = true;
+			iol->codec = IOLOG_CODEC_GZIP;
+		} else if (*mode == 'a' && iolog_compress) {
+		    /* Empty file, use the default. */
+		    iol->codec = iolog_codec;
+		    iol->blocked = true;
 		}
 	    }
+	    iol->compressed = iol->codec != IOLOG_CODEC_NONE;
 	    if (fcntl(fd, F_SETFD, FD_CLOEXEC) != -1) {
 #ifdef HAVE_ZLIB_H
-		if (iol->compressed)
+		if (iol->blocked) {
+		    iol->fd.b = iolog_block_open(fd, mode, iol->codec);
+		} else if (iol->compressed) {
+		    /* zlib cannot read and write the same stream. */
+		    if (mode[0] == 'r') {
+			flags = O_RDONLY;
+			mode = "r";
+		    }
 		    iol->fd.g = gzdopen(fd, mode);
-		else
+		} else
 #endif
 		    iol->fd.f = fdopen(fd, mode);
 	    }
 	    if (iol->fd.v != NULL) {
+		iol->fdnum = fd;
 		switch ((flags & O_ACCMODE)) {
 		case O_WRONLY:
 		case O_RDWR:
@@ -656,7 +750,9 @@ iolog_close(struct iolog_file *iol, const char **errstr)
     debug_decl(iolog_close, SUDO_DEBUG_UTIL);
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed) {
+    if (iol->blocked) {
+	ret = iolog_block_close(iol->fd.b, errstr);
+    } else if (iol->compressed) {
 	int errnum;
 
 	/* Must check error indicator before closing. */
@@ -686,6 +782,7 @@ iolog_close(struct iolog_file *iol, const char **errstr)
 
 /*
  * I/O log wrapper for fseek/gzseek.
+ * Returns the resulting (uncompressed) offset, or -1 on error.
  */
 off_t
 iolog_seek(struct iolog_file *iol, off_t offset, int whence)
@@ -694,11 +791,17 @@ iolog_seek(struct iolog_file *iol, off_t offset, int whence)
     //debug_decl(iolog_seek, SUDO_DEBUG_UTIL);
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed)
+    if (iol->blocked)
+	ret = iolog_block_seek(iol->fd.b, offset, whence);
+    else if (iol->compressed)
 	ret = gzseek(iol->fd.g, offset, whence);
     else
 #endif
+    {
 	ret = fseeko(iol->fd.f, offset, whence);
+	if (ret != -1)
+	    ret = ftello(iol->fd.f);
+    }
 
     //debug_return_off_t(ret);
     return ret;
@@ -713,7 +816,9 @@ iolog_rewind(struct iolog_file *iol)
     debug_decl(iolog_rewind, SUDO_DEBUG_UTIL);
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed)
+    if (iol->blocked)
+	(void)iolog_block_seek(iol->fd.b, 0, SEEK_SET);
+    else if (iol->compressed)
 	(void)gzrewind(iol->fd.g);
     else
 #endif
@@ -740,7 +845,9 @@ iolog_read(struct iolog_file *iol, void *buf, size_t nbytes,
     }
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed) {
+    if (iol->blocked) {
+	nread = iolog_block_read(iol->fd.b, buf, nbytes, errstr);
+    } else if (iol->compressed) {
 	if ((nread = gzread(iol->fd.g, buf, nbytes)) == -1) {
 	    if (errstr != NULL)
 		*errstr = gzstrerror(iol->fd.g);
@@ -776,7 +883,11 @@ iolog_write(struct iolog_file *iol, const void *buf, size_t len,
     }
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed) {
+    if (iol->blocked) {
+	ret = iolog_block_write(iol->fd.b, buf, len, iolog_flush, errstr);
+	if (ret == -1)
+	    goto done;
+    } else if (iol->compressed) {
 	ret = gzwrite(iol->fd.g, (const voidp)buf, len);
 	if (ret == 0) {
 	    ret = -1;
@@ -811,11 +922,58 @@ iolog_write(struct iolog_file *iol, const void *buf, size_t len,
 	    }
 	}
     }
+    iol->nbytes += ret;
 
 done:
     debug_return_ssize_t(ret);
 }
 
+/*
+ * Flush any buffered I/O log data to the kernel.
+ * If sync is true, also wait for the data to reach stable storage.
+ * For compressed logs, any buffered data is written as a complete
+ * block so the commit point can be recorded in the I/O log index.
+ */
+bool
+iolog_commit(struct iolog_file *iol, bool sync, const char **errstr)
+{
+    debug_decl(iolog_commit, SUDO_DEBUG_UTIL);
+
+#ifdef HAVE_ZLIB_H
+    if (iol->blocked) {
+	if (!iolog_block_flush(iol->fd.b, errstr))
+	    debug_return_bool(false);
+    } else if (iol->compressed) {
+	if (gzflush(iol->fd.g, Z_SYNC_FLUSH) != Z_OK) {
+	    if (errstr != NULL)
+		*errstr = gzstrerror(iol->fd.g);
+	    debug_return_bool(false);
+	}
+    } else
+#endif
+    {
+	if (fflush(iol->fd.f) != 0) {
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    debug_return_bool(false);
+	}
+    }
+
+    if (sync && iol->fdnum != -1) {
+#ifdef HAVE_FDATASYNC
+	if (fdatasync(iol->fdnum) == -1) {
+#else
+	if (fsync(iol->fdnum) == -1) {
+#endif
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    debug_return_bool(false);
+	}
+    }
+
+    debug_return_bool(true);
+}
+
 /*
  * Returns true if at end of I/O log file, else false.
  */
@@ -826,7 +984,9 @@ iolog_eof(struct iolog_file *iol)
     debug_decl(iolog_eof, SUDO_DEBUG_UTIL);
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed)
+    if (iol->blocked)
+	ret = iolog_block_eof(iol->fd.b);
+    else if (iol->compressed)
 	ret = gzeof(iol->fd.g) == 1;
     else
 #endif
@@ -840,7 +1000,9 @@ iolog_clearerr(struct iolog_file *iol)
     debug_decl(iolog_eof, SUDO_DEBUG_UTIL);
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed)
+    if (iol->blocked)
+	iolog_block_clearerr(iol->fd.b);
+    else if (iol->compressed)
 	gzclearerr(iol->fd.g);
     else
 #endif
@@ -866,7 +1028,9 @@ iolog_gets(struct iolog_file *iol, char *buf, size_t nbytes,
     }
 
 #ifdef HAVE_ZLIB_H
-    if (iol->compressed) {
+    if (iol->blocked) {
+	str = iolog_block_gets(iol->fd.b, buf, nbytes, errstr);
+    } else if (iol->compressed) {
 	if ((str = gzgets(iol->fd.g, buf, nbytes)) == NULL) {
 	    if (errstr != NULL)
 		*errstr = gzstrerror(iol->fd.g);
@@ -882,6 +1046,38 @@ iolog_gets(struct iolog_file *iol, char *buf, size_t nbytes,
     debug_return_str(str);
 }
 
+/*
+ * Discard everything after the current position of a log opened for
+ * reading and writing.  Subsequent writes are appended at that point.
+ * Compressed files written by older versions of sudo (a single gzip
+ * stream) cannot be truncated.
+ */
+bool
+iolog_truncate(struct iolog_file *iol, const char **errstr)
+{
+    off_t offset;
+    debug_decl(iolog_truncate, SUDO_DEBUG_UTIL);
+
+#ifdef HAVE_ZLIB_H
+    if (iol->blocked) {
+	debug_return_bool(iolog_block_truncate(iol->fd.b, errstr));
+    } else if (iol->compressed) {
+	if (errstr != NULL)
+	    *errstr = strerror(EOPNOTSUPP);
+	debug_return_bool(false);
+    } else
+#endif
+    {
+	if ((offset = ftello(iol->fd.f)) == -1 || fflush(iol->fd.f) != 0 ||
+		ftruncate(iol->fdnum, offset) == -1) {
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
 /*
  * Write the legacy I/O log file that contains the user and command info.
  * This file is not compressed.
@@ -0,0 +1,335 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * The I/O log index is a sidecar to the timing file that maps elapsed
+ * time to the offsets of each I/O log file.  It consists of fixed-size
+ * text records so it can be binary searched without being parsed in
+ * its entirety:
+ *
+ *   elapsed_sec.elapsed_nsec [offset zoffset] * IOFD_MAX
+ *
+ * Records are only appended at commit points, after the I/O log files
+ * have been flushed, so every offset refers to data on disk.
+ * For compressed files, zoffset is the block boundary in the file.
+ * A partial record at the end of the file (e.g. after a crash) is ignored.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "sudo_compat.h"
+#include "sudo_debug.h"
+#include "sudo_iolog.h"
+#include "sudo_util.h"
+
+/* Width of the elapsed time field, followed by each of the file fields. */
+#define INDEX_TIME_LEN	(19 + 1 + 9)
+#define INDEX_FILE_LEN	(1 + 19 + 1 + 19)
+#define INDEX_REC_LEN	(INDEX_TIME_LEN + (IOFD_MAX * INDEX_FILE_LEN) + 1)
+
+/*
+ * Parse a fixed-width signed decimal number terminated by endch.
+ */
+static bool
+parse_number(const char *cp, size_t len, int endch, long long *valp)
+{
+    char *ep;
+
+    if (cp[len] != endch)
+	return false;
+    errno = 0;
+    *valp = strtoll(cp, &ep, 10);
+    if (ep != cp + len || errno == ERANGE)
+	return false;
+    return true;
+}
+
+/*
+ * Read and parse index record number recno.
+ */
+static bool
+iolog_index_read(int fd, off_t recno, struct iolog_index_entry *entry)
+{
+    char buf[INDEX_REC_LEN + 1];
+    const char *cp = buf;
+    long long llval;
+    int iofd;
+    debug_decl(iolog_index_read, SUDO_DEBUG_UTIL);
+
+    if (pread(fd, buf, INDEX_REC_LEN, recno * INDEX_REC_LEN) != INDEX_REC_LEN) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to read index record %lld", (long long)recno);
+	debug_return_bool(false);
+    }
+    buf[INDEX_REC_LEN] = '\0';
+
+    if (!parse_number(cp, 19, '.', &llval) || llval < 0)
+	goto bad;
+    entry->elapsed.tv_sec = (time_t)llval;
+    cp += 20;
+    if (!parse_number(cp, 9, ' ', &llval) || llval < 0 || llval > 999999999)
+	goto bad;
+    entry->elapsed.tv_nsec = (long)llval;
+    cp += 9;
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_index_file *file = &entry->files[iofd];
+	const int endch = iofd + 1 == IOFD_MAX ? '\n' : ' ';
+
+	if (!parse_number(cp + 1, 19, ' ', &llval) || llval < -1)
+	    goto bad;
+	file->offset = (off_t)llval;
+	cp += 20;
+	if (!parse_number(cp + 1, 19, endch, &llval) || llval < -1)
+	    goto bad;
+	file->zoffset = (off_t)llval;
+	cp += 20;
+    }
+    entry->end = (recno + 1) * INDEX_REC_LEN;
+
+    debug_return_bool(true);
+bad:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	"invalid index record %lld", (long long)recno);
+    debug_return_bool(false);
+}
+
+/*
+ * Find the last index entry whose elapsed time is not greater than target.
+ * Returns true if an entry was found, else false.
+ */
+bool
+iolog_index_lookup(int dfd, const struct timespec *target,
+    struct iolog_index_entry *entry)
+{
+    struct iolog_index_entry cur;
+    off_t lo, hi, mid;
+    struct stat sb;
+    bool ret = false;
+    int fd;
+    debug_decl(iolog_index_lookup, SUDO_DEBUG_UTIL);
+
+    fd = openat(dfd, IOLOG_INDEX_NAME, O_RDONLY);
+    if (fd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to open %s", __func__, IOLOG_INDEX_NAME);
+	debug_return_bool(false);
+    }
+    if (fstat(fd, &sb) == -1)
+	goto done;
+
+    /* Binary search for the last entry <= target. */
+    lo = 0;
+    hi = sb.st_size / INDEX_REC_LEN;
+    while (lo < hi) {
+	mid = lo + (hi - lo) / 2;
+	if (!iolog_index_read(fd, mid, &cur))
+	    goto done;
+	if (sudo_timespeccmp(&cur.elapsed, target, <=)) {
+	    *entry = cur;
+	    ret = true;
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    if (ret) {
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "%s: target [%lld, %ld], found [%lld, %ld]", __func__,
+	    (long long)target->tv_sec, target->tv_nsec,
+	    (long long)entry->elapsed.tv_sec, entry->elapsed.tv_nsec);
+    }
+done:
+    close(fd);
+    debug_return_bool(ret);
+}
+
+/*
+ * Append an index entry for the current state of iolog_files.
+ * The files must have been committed via iolog_commit() first.
+ */
+bool
+iolog_index_write(int fd, struct iolog_file *iolog_files,
+    const struct timespec *elapsed, bool sync, const char **errstr)
+{
+    char buf[INDEX_REC_LEN + 1], *cp = buf;
+    int iofd, len;
+    debug_decl(iolog_index_write, SUDO_DEBUG_UTIL);
+
+    len = snprintf(cp, sizeof(buf), "%019lld.%09ld",
+	(long long)elapsed->tv_sec, elapsed->tv_nsec);
+    if (len != INDEX_TIME_LEN)
+	goto overflow;
+    cp += len;
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_file *iol = &iolog_files[iofd];
+	off_t offset = -1, zoffset = -1;
+
+	if (iol->enabled) {
+	    offset = iol->nbytes;
+	    if (iol->compressed) {
+		/* Only block compressed files can be truncated. */
+		if (!iol->blocked) {
+		    if (errstr != NULL)
+			*errstr = strerror(EOPNOTSUPP);
+		    debug_return_bool(false);
+		}
+		zoffset = lseek(iol->fdnum, 0, SEEK_CUR);
+		if (zoffset == -1) {
+		    if (errstr != NULL)
+			*errstr = strerror(errno);
+		    debug_return_bool(false);
+		}
+	    }
+	}
+	len = snprintf(cp, sizeof(buf) - (cp - buf), " %019lld %019lld",
+	    (long long)offset, (long long)zoffset);
+	if (len != INDEX_FILE_LEN)
+	    goto overflow;
+	cp += len;
+    }
+    *cp++ = '\n';
+
+    if (write(fd, buf, INDEX_REC_LEN) != INDEX_REC_LEN) {
+	if (errstr != NULL)
+	    *errstr = strerror(errno);
+	debug_return_bool(false);
+    }
+    if (sync) {
+#ifdef HAVE_FDATASYNC
+	if (fdatasync(fd) == -1) {
+#else
+	if (fsync(fd) == -1) {
+#endif
+	    if (errstr != NULL)
+		*errstr = strerror(errno);
+	    debug_return_bool(false);
+	}
+    }
+
+    debug_return_bool(true);
+overflow:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	"index record field overflow");
+    if (errstr != NULL)
+	*errstr = strerror(EOVERFLOW);
+    debug_return_bool(false);
+}
+
+/*
+ * Restore the I/O log files to the state recorded in entry.
+ * Data past the entry is discarded and each file is opened for appending.
+ * Compressed files are truncated at the recorded block boundary so
+ * new data can be appended as new blocks without rewriting the file.
+ * The index itself is truncated after entry and its file descriptor
+ * is stored in index_fdp.
+ */
+bool
+iolog_index_restore(int dfd, const struct iolog_index_entry *entry,
+    struct iolog_file *iolog_files, int *index_fdp)
+{
+    int iofd, fd;
+    debug_decl(iolog_index_restore, SUDO_DEBUG_UTIL);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	const struct iolog_index_file *file = &entry->files[iofd];
+	const char *name = iolog_fd_to_name(iofd);
+	struct iolog_file *iol = &iolog_files[iofd];
+
+	if (file->offset == -1) {
+	    /* File did not exist at this point, will be created on demand. */
+	    (void)unlinkat(dfd, name, 0);
+	    iol->enabled = false;
+	    continue;
+	}
+
+	fd = iolog_openat(dfd, name, O_RDWR);
+	if (fd == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+		"unable to open %s", name);
+	    debug_return_bool(false);
+	}
+	if (file->zoffset != -1) {
+	    if (ftruncate(fd, file->zoffset) == -1) {
+		sudo_debug_printf(
+		    SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+		    "unable to truncate %s to %lld", name,
+		    (long long)file->zoffset);
+		close(fd);
+		debug_return_bool(false);
+	    }
+	} else {
+	    if (ftruncate(fd, file->offset) == -1) {
+		sudo_debug_printf(
+		    SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+		    "unable to truncate %s to %lld", name,
+		    (long long)file->offset);
+		close(fd);
+		debug_return_bool(false);
+	    }
+	}
+	close(fd);
+
+	iol->enabled = true;
+	if (!iolog_open(iol, dfd, iofd, "a")) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+		"unable to open %s", name);
+	    debug_return_bool(false);
+	}
+	if (iol->blocked != (file->zoffset != -1)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"%s: compression mismatch with index", name);
+	    debug_return_bool(false);
+	}
+	iol->nbytes = file->offset;
+    }
+
+    /* Discard index entries past the restore point. */
+    fd = iolog_index_open(dfd, false);
+    if (fd == -1 || ftruncate(fd, entry->end) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to truncate %s", IOLOG_INDEX_NAME);
+	if (fd != -1)
+	    close(fd);
+	debug_return_bool(false);
+    }
+    *index_fdp = fd;
+
+    debug_return_bool(true);
+}
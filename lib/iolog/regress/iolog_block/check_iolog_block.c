@@ -0,0 +1,731 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_iolog.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+#ifdef HAVE_ZLIB_H
+
+/* Enough data for several blocks. */
+#define LOG_SIZE	300000
+
+/* Truncation point in the middle of the second block. */
+#define TRUNC_OFF	100000
+#define APPEND_SIZE	500
+
+/* Timing lines written by the flush test. */
+#define FLUSH_LINES	2000
+
+/* Smallest block header of any codec. */
+#define FLUSH_HDR_LEN	16
+
+/* Committed data written before the torn tail, and the largest header. */
+#define TORN_OFF	3000
+#define TORN_HDR_LEN	24
+
+/* Ways in which a crash can leave the open block. */
+#define TORN_STALE_HDR	0	/* new data, header not yet updated */
+#define TORN_SHORT	1	/* new block only partly written */
+#define TORN_GARBAGE	2	/* partial header after the last block */
+
+/*
+ * Expected byte at offset off; lines are 61 bytes long.
+ * Once the log has been truncated, the appended data is all 'Z'.
+ */
+static int
+byte_at(off_t off, bool truncated)
+{
+    if (truncated && off >= TRUNC_OFF)
+	return 'Z';
+    return off % 61 == 60 ? '\n' : 'a' + ((off * 7) % 26);
+}
+
+static bool
+compare(const char *buf, off_t off, size_t len, bool truncated)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+	if (buf[i] != byte_at(off + i, truncated)) {
+	    sudo_warnx("mismatch at offset %lld", (long long)(off + i));
+	    return false;
+	}
+    }
+    return true;
+}
+
+/*
+ * Write LOG_SIZE bytes in writes of varying size, committing part way.
+ */
+static bool
+write_log(int dfd, int codec)
+{
+    struct iolog_file iol = { true };
+    char buf[8192];
+    const char *errstr;
+    off_t off = 0;
+    size_t i, len = 1;
+    bool ret = true;
+
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "w")) {
+	sudo_warn("unable to create ttyout");
+	return false;
+    }
+    if (!iol.blocked || iol.codec != codec) {
+	sudo_warnx("new compressed log is not block compressed");
+	ret = false;
+    }
+    while (ret && off < LOG_SIZE) {
+	len = (len * 31 + 7) % sizeof(buf);
+	if (len > (size_t)(LOG_SIZE - off))
+	    len = LOG_SIZE - off;
+	for (i = 0; i < len; i++)
+	    buf[i] = byte_at(off + i, false);
+	if (iolog_write(&iol, buf, len, &errstr) != (ssize_t)len) {
+	    sudo_warnx("unable to write ttyout: %s", errstr);
+	    ret = false;
+	}
+	off += len;
+	if (off > 1000 && off - len <= 1000) {
+	    /* Short block in the middle of the file. */
+	    if (!iolog_commit(&iol, false, &errstr)) {
+		sudo_warnx("unable to commit ttyout: %s", errstr);
+		ret = false;
+	    }
+	}
+    }
+    if (!iolog_close(&iol, &errstr)) {
+	sudo_warnx("unable to close ttyout: %s", errstr);
+	ret = false;
+    }
+    return ret;
+}
+
+/*
+ * Read the whole log sequentially and check its size.
+ */
+static bool
+read_log(int dfd, off_t size, bool truncated)
+{
+    struct iolog_file iol = { true };
+    char buf[1000];
+    const char *errstr;
+    off_t off = 0;
+    ssize_t nread;
+    bool ret = true;
+
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "r")) {
+	sudo_warn("unable to open ttyout");
+	return false;
+    }
+    while ((nread = iolog_read(&iol, buf, sizeof(buf), &errstr)) > 0) {
+	if (!compare(buf, off, nread, truncated)) {
+	    ret = false;
+	    break;
+	}
+	off += nread;
+    }
+    if (nread == -1) {
+	sudo_warnx("unable to read ttyout: %s", errstr);
+	ret = false;
+    }
+    if (ret && off != size) {
+	sudo_warnx("read %lld bytes, expected %lld", (long long)off,
+	    (long long)size);
+	ret = false;
+    }
+    if (ret && !iolog_eof(&iol)) {
+	sudo_warnx("expected EOF at offset %lld", (long long)off);
+	ret = false;
+    }
+    iolog_close(&iol, &errstr);
+    return ret;
+}
+
+/*
+ * Seek to a number of offsets and check the data there.
+ */
+static bool
+seek_log(int dfd)
+{
+    const off_t offsets[] = {
+	200000, 0, 65535, 65536, 1500, 299990, 131072, 12345, 250000
+    };
+    struct iolog_file iol = { true };
+    char buf[100];
+    const char *errstr;
+    off_t off;
+    size_t i;
+    ssize_t nread;
+    bool ret = true;
+
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "r")) {
+	sudo_warn("unable to open ttyout");
+	return false;
+    }
+    for (i = 0; i < nitems(offsets); i++) {
+	off = iolog_seek(&iol, offsets[i], SEEK_SET);
+	if (off != offsets[i]) {
+	    sudo_warnx("seek to %lld returned %lld", (long long)offsets[i],
+		(long long)off);
+	    ret = false;
+	    break;
+	}
+	nread = iolog_read(&iol, buf, sizeof(buf), &errstr);
+	if (nread != (ssize_t)MIN(sizeof(buf), LOG_SIZE - offsets[i]) ||
+		!compare(buf, off, nread, false)) {
+	    sudo_warnx("bad read at offset %lld", (long long)off);
+	    ret = false;
+	    break;
+	}
+    }
+
+    /* Relative seek, then read a line. */
+    if (ret) {
+	char line[128];
+
+	off = iolog_seek(&iol, 1000, SEEK_CUR);
+	if (off != offsets[i - 1] + (off_t)sizeof(buf) + 1000) {
+	    sudo_warnx("relative seek returned %lld", (long long)off);
+	    ret = false;
+	} else if (iolog_gets(&iol, line, sizeof(line), &errstr) == NULL) {
+	    sudo_warnx("unable to read line: %s", errstr);
+	    ret = false;
+	} else if (line[strlen(line) - 1] != '\n' ||
+		(off + (off_t)strlen(line)) % 61 != 0 ||
+		!compare(line, off, strlen(line), false)) {
+	    sudo_warnx("bad line at offset %lld", (long long)off);
+	    ret = false;
+	}
+    }
+
+    /* Seeking past the end is not supported. */
+    if (ret && iolog_seek(&iol, LOG_SIZE + 1, SEEK_SET) != -1) {
+	sudo_warnx("able to seek past end of file");
+	ret = false;
+    }
+
+    iolog_close(&iol, &errstr);
+    return ret;
+}
+
+/*
+ * Truncate the log in the middle of a block and append to it.
+ */
+static bool
+truncate_log(int dfd)
+{
+    struct iolog_file iol = { true };
+    char buf[APPEND_SIZE];
+    const char *errstr;
+    bool ret = true;
+
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "r+")) {
+	sudo_warn("unable to open ttyout");
+	return false;
+    }
+    if (iolog_seek(&iol, TRUNC_OFF, SEEK_SET) != TRUNC_OFF) {
+	sudo_warnx("unable to seek to %d", TRUNC_OFF);
+	ret = false;
+    } else if (!iolog_truncate(&iol, &errstr)) {
+	sudo_warnx("unable to truncate ttyout: %s", errstr);
+	ret = false;
+    } else {
+	memset(buf, 'Z', sizeof(buf));
+	if (iolog_write(&iol, buf, sizeof(buf), &errstr) != sizeof(buf)) {
+	    sudo_warnx("unable to write ttyout: %s", errstr);
+	    ret = false;
+	}
+    }
+    if (!iolog_close(&iol, &errstr)) {
+	sudo_warnx("unable to close ttyout: %s", errstr);
+	ret = false;
+    }
+    return ret;
+}
+
+/*
+ * The log must still be readable as a regular gzip file.
+ */
+static bool
+gzread_log(const char *testdir, off_t size, bool truncated)
+{
+    char path[PATH_MAX], buf[4096];
+    off_t off = 0;
+    gzFile gz;
+    int nread;
+    bool ret = true;
+
+    snprintf(path, sizeof(path), "%s/ttyout", testdir);
+    if ((gz = gzopen(path, "r")) == NULL) {
+	sudo_warn("unable to open %s", path);
+	return false;
+    }
+    while ((nread = gzread(gz, buf, sizeof(buf))) > 0) {
+	if (!compare(buf, off, nread, truncated)) {
+	    ret = false;
+	    break;
+	}
+	off += nread;
+    }
+    if (ret && (nread == -1 || off != size)) {
+	sudo_warnx("gzread: read %lld bytes, expected %lld", (long long)off,
+	    (long long)size);
+	ret = false;
+    }
+    gzclose(gz);
+    return ret;
+}
+
+/*
+ * Read the whole file at dfd/name into a malloc()ed buffer.
+ */
+static unsigned char *
+slurp(int dfd, const char *name, off_t *sizep)
+{
+    unsigned char *buf;
+    struct stat sb;
+    int fd;
+
+    if ((fd = openat(dfd, name, O_RDONLY)) == -1)
+	return NULL;
+    if (fstat(fd, &sb) == -1 || (buf = malloc(sb.st_size + 1)) == NULL) {
+	close(fd);
+	return NULL;
+    }
+    if (pread(fd, buf, sb.st_size, 0) != sb.st_size) {
+	free(buf);
+	buf = NULL;
+    }
+    close(fd);
+    *sizep = sb.st_size;
+    return buf;
+}
+
+/*
+ * Commit TORN_OFF bytes, then flush a few more writes into the open
+ * block and leave the file as a crash part way through the next
+ * write would.  Readers must see the committed data and appending
+ * must discard the rest.
+ */
+static bool
+torn_log(int dfd, int how)
+{
+    struct iolog_file iol = { true };
+    unsigned char *old = NULL, *cur = NULL;
+    char buf[TORN_OFF];
+    const char *errstr;
+    off_t coff, oldsize, cursize, off;
+    size_t i;
+    int fd = -1;
+    bool ret = false;
+
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "w")) {
+	sudo_warn("unable to create ttyout");
+	return false;
+    }
+    for (i = 0; i < TORN_OFF; i++)
+	buf[i] = byte_at(i, false);
+    if (iolog_write(&iol, buf, TORN_OFF, &errstr) != TORN_OFF ||
+	    !iolog_commit(&iol, true, &errstr)) {
+	sudo_warnx("unable to write ttyout: %s", errstr);
+	iolog_close(&iol, &errstr);
+	return false;
+    }
+    old = slurp(dfd, "ttyout", &coff);
+
+    /* Data flushed to the open block is not committed. */
+    iolog_set_flush(true);
+    for (i = 0; i < 10; i++) {
+	if (iolog_write(&iol, buf, 100 + i, &errstr) != (ssize_t)(100 + i))
+	    break;
+	if (i == 8) {
+	    free(old);
+	    old = slurp(dfd, "ttyout", &oldsize);
+	}
+    }
+    iolog_set_flush(false);
+    cur = slurp(dfd, "ttyout", &cursize);
+    iolog_close(&iol, &errstr);
+    if (i != 10 || old == NULL || cur == NULL ||
+	    oldsize < coff + TORN_HDR_LEN) {
+	sudo_warnx("unable to write flushed data");
+	goto done;
+    }
+
+    /* Rewrite the file as a crash would have left it. */
+    if ((fd = openat(dfd, "ttyout", O_WRONLY|O_TRUNC)) == -1) {
+	sudo_warn("unable to open ttyout");
+	goto done;
+    }
+    switch (how) {
+    case TORN_STALE_HDR:
+	memcpy(cur + coff, old + coff, TORN_HDR_LEN);
+	break;
+    case TORN_SHORT:
+	cursize = coff + (cursize - coff) / 2;
+	break;
+    case TORN_GARBAGE:
+	memset(cur + coff, 0x5a, TORN_HDR_LEN);
+	cursize = coff + TORN_HDR_LEN / 2;
+	break;
+    }
+    if (write(fd, cur, cursize) != cursize) {
+	sudo_warn("unable to write ttyout");
+	goto done;
+    }
+    close(fd);
+    fd = -1;
+
+    /* Only the committed data can be read. */
+    if (!read_log(dfd, TORN_OFF, false))
+	goto done;
+
+    /* Appending starts right after the committed data. */
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "a")) {
+	sudo_warn("unable to append to torn ttyout");
+	goto done;
+    }
+    memset(buf, 'Z', APPEND_SIZE);
+    off = iolog_write(&iol, buf, APPEND_SIZE, &errstr);
+    if (!iolog_close(&iol, &errstr) || off != APPEND_SIZE) {
+	sudo_warnx("unable to append to ttyout: %s", errstr);
+	goto done;
+    }
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "r")) {
+	sudo_warn("unable to open ttyout");
+	goto done;
+    }
+    off = iolog_read(&iol, buf, sizeof(buf), &errstr);
+    if (off != TORN_OFF || !compare(buf, 0, TORN_OFF, false) ||
+	    iolog_read(&iol, buf, sizeof(buf), &errstr) != APPEND_SIZE ||
+	    buf[0] != 'Z' || buf[APPEND_SIZE - 1] != 'Z' ||
+	    iolog_read(&iol, buf, sizeof(buf), &errstr) != 0) {
+	sudo_warnx("torn ttyout: bad data after append");
+	iolog_close(&iol, &errstr);
+	goto done;
+    }
+    iolog_close(&iol, &errstr);
+    ret = true;
+
+done:
+    if (fd != -1)
+	close(fd);
+    free(old);
+    free(cur);
+    return ret;
+}
+
+/*
+ * Timing line number n, as written by the flush test.
+ */
+static int
+timing_line(char *buf, size_t bufsize, int n)
+{
+    return snprintf(buf, bufsize, "%d %d.%09d %d\n", IO_EVENT_TTYOUT,
+	n % 3, (n * 7919) % 1000000000, 1 + (n * 13) % 200);
+}
+
+/*
+ * Write timing lines with the log flushed after each write, reading
+ * them back part way through as a follower would.
+ * Returns the compressed size or -1 on error.
+ */
+static off_t
+flush_log(int dfd, size_t *usizep)
+{
+    struct iolog_file iol = { true }, rd = { true };
+    char line[64], buf[64];
+    const char *errstr;
+    struct stat sb;
+    size_t usize = 0;
+    int len, n, nread = 0;
+    bool ret = true;
+
+    iolog_set_flush(true);
+    if (!iolog_open(&iol, dfd, IOFD_TIMING, "w")) {
+	sudo_warn("unable to create timing");
+	iolog_set_flush(false);
+	return -1;
+    }
+    for (n = 0; ret && n < FLUSH_LINES; n++) {
+	len = timing_line(line, sizeof(line), n);
+	if (iolog_write(&iol, line, len, &errstr) != len) {
+	    sudo_warnx("unable to write timing: %s", errstr);
+	    ret = false;
+	}
+	usize += len;
+	if (n % 500 != 499)
+	    continue;
+
+	/* Everything written so far must be readable. */
+	if (!rd.enabled || rd.fd.v == NULL) {
+	    if (!iolog_open(&rd, dfd, IOFD_TIMING, "r")) {
+		sudo_warn("unable to open timing");
+		ret = false;
+		break;
+	    }
+	}
+	iolog_clearerr(&rd);
+	while (iolog_gets(&rd, buf, sizeof(buf), &errstr) != NULL) {
+	    timing_line(line, sizeof(line), nread);
+	    if (strcmp(buf, line) != 0) {
+		sudo_warnx("timing line %d mismatch", nread);
+		ret = false;
+		break;
+	    }
+	    nread++;
+	}
+	if (ret && nread != n + 1) {
+	    sudo_warnx("read %d timing lines, expected %d", nread, n + 1);
+	    ret = false;
+	}
+    }
+    if (rd.fd.v != NULL)
+	iolog_close(&rd, &errstr);
+    if (!iolog_close(&iol, &errstr)) {
+	sudo_warnx("unable to close timing: %s", errstr);
+	ret = false;
+    }
+    iolog_set_flush(false);
+    if (!ret)
+	return -1;
+    if (fstatat(dfd, "timing", &sb, 0) == -1) {
+	sudo_warn("unable to stat timing");
+	return -1;
+    }
+    *usizep = usize;
+    return sb.st_size;
+}
+
+/*
+ * Since flushed data is added to the current block, each write costs
+ * a few bytes, not a whole block.  For gzip, the log must still be
+ * smaller than the uncompressed data.
+ */
+static bool
+flush_size(int dfd, const char *name, int codec)
+{
+    off_t csize;
+    size_t usize;
+
+    if ((csize = flush_log(dfd, &usize)) == -1)
+	return false;
+    if (csize >= (off_t)(usize + FLUSH_LINES * FLUSH_HDR_LEN) ||
+	    (codec == IOLOG_CODEC_GZIP && csize >= (off_t)usize)) {
+	sudo_warnx("%s: flushed log is %lld bytes for %zu bytes of data",
+	    name, (long long)csize, usize);
+	return false;
+    }
+    return true;
+}
+
+/*
+ * Write the start of an lz4 or zstd block file for a codec that this
+ * build does not support.  It must not be opened as an uncompressed
+ * log, for reading or for appending.
+ */
+static bool
+unsupported_log(int dfd, unsigned int frame_magic)
+{
+    struct iolog_file iol = { true };
+    unsigned char hdr[32];
+    const char *mode[] = { "r", "a" };
+    struct stat sb;
+    size_t i;
+    int fd;
+    bool ret = true;
+
+    /* Skippable frame with the block sizes, then the frame magic. */
+    memset(hdr, 0, sizeof(hdr));
+    hdr[0] = 0x53; hdr[1] = 0x2a; hdr[2] = 0x4d; hdr[3] = 0x18;
+    hdr[4] = 8;
+    hdr[8] = sizeof(hdr);
+    hdr[12] = 100;
+    for (i = 0; i < 4; i++)
+	hdr[16 + i] = (frame_magic >> (i * 8)) & 0xff;
+
+    fd = openat(dfd, "ttyout", O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+    if (fd == -1 || write(fd, hdr, sizeof(hdr)) != ssizeof(hdr)) {
+	sudo_warn("unable to write ttyout");
+	if (fd != -1)
+	    close(fd);
+	return false;
+    }
+    close(fd);
+
+    for (i = 0; i < nitems(mode); i++) {
+	errno = 0;
+	if (iolog_open(&iol, dfd, IOFD_TTYOUT, mode[i])) {
+	    sudo_warnx("opened unsupported codec with mode %s", mode[i]);
+	    iolog_close(&iol, NULL);
+	    ret = false;
+	} else if (errno != ENOTSUP) {
+	    sudo_warn("unexpected error for mode %s", mode[i]);
+	    ret = false;
+	}
+	iol.enabled = true;
+    }
+    if (fstatat(dfd, "ttyout", &sb, 0) == -1 || sb.st_size != ssizeof(hdr)) {
+	sudo_warnx("unsupported log was modified");
+	ret = false;
+    }
+    return ret;
+}
+
+static void
+test_codec(const char *testdir, int dfd, const char *name, int codec,
+    unsigned int frame_magic, int *ntests, int *nerrors)
+{
+    int tests = 0, errors = 0;
+
+    if (!iolog_set_codec(name)) {
+	/* Not supported by this build, existing logs are rejected. */
+	tests++;
+	if (!unsupported_log(dfd, frame_magic))
+	    errors++;
+	goto done;
+    }
+
+    tests++;
+    if (!write_log(dfd, codec))
+	errors++;
+    tests++;
+    if (!read_log(dfd, LOG_SIZE, false))
+	errors++;
+    tests++;
+    if (!seek_log(dfd))
+	errors++;
+    if (codec == IOLOG_CODEC_GZIP) {
+	tests++;
+	if (!gzread_log(testdir, LOG_SIZE, false))
+	    errors++;
+    }
+
+    /* After truncation, data past TRUNC_OFF is all 'Z'. */
+    tests++;
+    if (!truncate_log(dfd))
+	errors++;
+    tests++;
+    if (!read_log(dfd, TRUNC_OFF + APPEND_SIZE, true))
+	errors++;
+    if (codec == IOLOG_CODEC_GZIP) {
+	tests++;
+	if (!gzread_log(testdir, TRUNC_OFF + APPEND_SIZE, true))
+	    errors++;
+    }
+
+    /* Flushing after each write must not end the block. */
+    tests++;
+    if (!flush_size(dfd, name, codec))
+	errors++;
+
+    /* A torn write in the open block loses only uncommitted data. */
+    tests++;
+    if (!torn_log(dfd, TORN_STALE_HDR))
+	errors++;
+    tests++;
+    if (!torn_log(dfd, TORN_SHORT))
+	errors++;
+    tests++;
+    if (!torn_log(dfd, TORN_GARBAGE))
+	errors++;
+
+done:
+    if (errors != 0)
+	sudo_warnx("%s: %d of %d tests failed", name, errors, tests);
+    *ntests += tests;
+    *nerrors += errors;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char testdir[] = "block.XXXXXX";
+    char *rmargs[] = { "rm", "-rf", NULL, NULL };
+    int dfd, status, tests = 0, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_iolog_block");
+
+    if (mkdtemp(testdir) == NULL)
+	sudo_fatal("unable to create test dir");
+    rmargs[2] = testdir;
+    if ((dfd = open(testdir, O_RDONLY)) == -1)
+	sudo_fatal("unable to open %s", testdir);
+
+    iolog_set_owner(geteuid(), getegid());
+    iolog_set_compress(true);
+
+    test_codec(testdir, dfd, "gzip", IOLOG_CODEC_GZIP, 0, &tests, &errors);
+    test_codec(testdir, dfd, "lz4", IOLOG_CODEC_LZ4, 0x184d2204U, &tests,
+	&errors);
+    test_codec(testdir, dfd, "zstd", IOLOG_CODEC_ZSTD, 0xfd2fb528U, &tests,
+	&errors);
+
+    /* Unknown codecs are rejected. */
+    tests++;
+    if (iolog_set_codec("bogus")) {
+	sudo_warnx("able to set unknown codec");
+	errors++;
+    }
+
+    close(dfd);
+
+    printf("iolog_block: %d test%s run, %d errors, %d%% success rate\n",
+	tests, tests == 1 ? "" : "s", errors, (tests - errors) * 100 / tests);
+
+    /* Clean up (avoid running via shell) */
+    fflush(stdout);
+    if (fork() == 0) {
+	execvp("rm", rmargs);
+	_exit(127);
+    }
+    wait(&status);
+
+    exit(errors);
+}
+#else
+int
+main(int argc, char *argv[])
+{
+    /* Block compression requires zlib. */
+    return 0;
+}
+#endif /* HAVE_ZLIB_H */
@@ -0,0 +1,281 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_iolog.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+#define NCHECKPOINTS	8
+#define CHUNK_SIZE	1000
+
+/*
+ * Fill buf with data that depends on the chunk number.
+ */
+static void
+fill_chunk(char *buf, int chunk)
+{
+    int i;
+
+    for (i = 0; i < CHUNK_SIZE; i++)
+	buf[i] = 'a' + ((chunk * 7 + i) % 26);
+}
+
+/*
+ * Write NCHECKPOINTS chunks to ttyout, indexing after each.
+ */
+static bool
+write_log(int dfd, struct iolog_file *iolog_files, int index_fd)
+{
+    char buf[CHUNK_SIZE], tbuf[64];
+    struct timespec elapsed = { 0, 0 };
+    const char *errstr;
+    int chunk, iofd, len;
+
+    for (chunk = 0; chunk < NCHECKPOINTS; chunk++) {
+	fill_chunk(buf, chunk);
+	if (iolog_write(&iolog_files[IOFD_TTYOUT], buf, sizeof(buf), &errstr) == -1) {
+	    sudo_warnx("unable to write ttyout: %s", errstr);
+	    return false;
+	}
+	len = snprintf(tbuf, sizeof(tbuf), "%d 1.500000000 %d\n",
+	    IO_EVENT_TTYOUT, CHUNK_SIZE);
+	if (iolog_write(&iolog_files[IOFD_TIMING], tbuf, len, &errstr) == -1) {
+	    sudo_warnx("unable to write timing: %s", errstr);
+	    return false;
+	}
+	elapsed.tv_sec++;
+	elapsed.tv_nsec += 500000000;
+	if (elapsed.tv_nsec >= 1000000000) {
+	    elapsed.tv_sec++;
+	    elapsed.tv_nsec -= 1000000000;
+	}
+	for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	    if (!iolog_files[iofd].enabled)
+		continue;
+	    if (!iolog_commit(&iolog_files[iofd], false, &errstr)) {
+		sudo_warnx("unable to commit %s: %s",
+		    iolog_fd_to_name(iofd), errstr);
+		return false;
+	    }
+	}
+	if (!iolog_index_write(index_fd, iolog_files, &elapsed, false, &errstr)) {
+	    sudo_warnx("unable to write index: %s", errstr);
+	    return false;
+	}
+    }
+    return true;
+}
+
+/*
+ * Check that ttyout contains chunks [0, nchunks) and chunk extra.
+ */
+static bool
+verify_log(int dfd, int nchunks, int extra)
+{
+    struct iolog_file iol = { true };
+    char buf[CHUNK_SIZE], expected[CHUNK_SIZE];
+    const char *errstr;
+    int chunk;
+    bool ret = true;
+
+    if (!iolog_open(&iol, dfd, IOFD_TTYOUT, "r")) {
+	sudo_warn("unable to open ttyout");
+	return false;
+    }
+    for (chunk = 0; chunk <= nchunks; chunk++) {
+	fill_chunk(expected, chunk == nchunks ? extra : chunk);
+	if (iolog_read(&iol, buf, sizeof(buf), &errstr) != sizeof(buf)) {
+	    sudo_warnx("short read of chunk %d", chunk);
+	    ret = false;
+	    break;
+	}
+	if (memcmp(buf, expected, sizeof(buf)) != 0) {
+	    sudo_warnx("chunk %d mismatch", chunk);
+	    ret = false;
+	    break;
+	}
+    }
+    if (ret && iolog_read(&iol, buf, 1, &errstr) != 0) {
+	sudo_warnx("trailing data after chunk %d", nchunks);
+	ret = false;
+    }
+    iolog_close(&iol, &errstr);
+    return ret;
+}
+
+static void
+test_iolog_index(const char *testdir, bool compress, int *ntests, int *nerrors)
+{
+    struct iolog_file iolog_files[IOFD_MAX];
+    struct iolog_index_entry entry;
+    struct timespec target;
+    char buf[CHUNK_SIZE];
+    const char *errstr;
+    int dfd, iofd, index_fd = -1;
+
+    iolog_set_compress(compress);
+    dfd = open(testdir, O_RDONLY);
+    if (dfd == -1)
+	sudo_fatal("unable to open %s", testdir);
+
+    memset(iolog_files, 0, sizeof(iolog_files));
+    iolog_files[IOFD_TIMING].enabled = true;
+    iolog_files[IOFD_TTYOUT].enabled = true;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (!iolog_open(&iolog_files[iofd], dfd, iofd, "w"))
+	    sudo_fatal("unable to create %s", iolog_fd_to_name(iofd));
+    }
+    if ((index_fd = iolog_index_open(dfd, true)) == -1)
+	sudo_fatal("unable to create index");
+
+    (*ntests)++;
+    if (!write_log(dfd, iolog_files, index_fd))
+	(*nerrors)++;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iolog_files[iofd].enabled)
+	    iolog_close(&iolog_files[iofd], &errstr);
+    }
+    close(index_fd);
+    index_fd = -1;
+
+    /* Lookup before the first entry. */
+    (*ntests)++;
+    target.tv_sec = 1;
+    target.tv_nsec = 0;
+    if (iolog_index_lookup(dfd, &target, &entry)) {
+	sudo_warnx("%s: unexpected index entry for [1, 0]",
+	    compress ? "gzip" : "plain");
+	(*nerrors)++;
+    }
+
+    /* Lookup between entries, should find the previous one. */
+    (*ntests)++;
+    target.tv_sec = 7;
+    target.tv_nsec = 0;
+    if (!iolog_index_lookup(dfd, &target, &entry) ||
+	    entry.elapsed.tv_sec != 6 || entry.elapsed.tv_nsec != 0 ||
+	    entry.files[IOFD_TTYOUT].offset != 4 * CHUNK_SIZE ||
+	    entry.files[IOFD_STDIN].offset != -1) {
+	sudo_warnx("%s: bad index entry for [7, 0]",
+	    compress ? "gzip" : "plain");
+	(*nerrors)++;
+    }
+
+    /* Exact lookup of the third entry. */
+    (*ntests)++;
+    target.tv_sec = 4;
+    target.tv_nsec = 500000000;
+    if (!iolog_index_lookup(dfd, &target, &entry) ||
+	    sudo_timespeccmp(&entry.elapsed, &target, !=) ||
+	    entry.files[IOFD_TTYOUT].offset != 3 * CHUNK_SIZE ||
+	    (entry.files[IOFD_TTYOUT].zoffset != -1) != compress) {
+	sudo_warnx("%s: bad index entry for [4, 500000000]",
+	    compress ? "gzip" : "plain");
+	(*nerrors)++;
+    }
+
+    /* Restore to the third entry and append a different chunk. */
+    (*ntests)++;
+    memset(iolog_files, 0, sizeof(iolog_files));
+    if (!iolog_index_restore(dfd, &entry, iolog_files, &index_fd)) {
+	sudo_warnx("%s: unable to restore index", compress ? "gzip" : "plain");
+	(*nerrors)++;
+    } else {
+	fill_chunk(buf, 42);
+	if (iolog_write(&iolog_files[IOFD_TTYOUT], buf, sizeof(buf), &errstr) == -1) {
+	    sudo_warnx("unable to write ttyout: %s", errstr);
+	    (*nerrors)++;
+	}
+	for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	    if (iolog_files[iofd].enabled)
+		iolog_close(&iolog_files[iofd], &errstr);
+	}
+	close(index_fd);
+	if (!verify_log(dfd, 3, 42)) {
+	    sudo_warnx("%s: bad data after restore",
+		compress ? "gzip" : "plain");
+	    (*nerrors)++;
+	}
+
+	/* Entries past the restore point must be gone. */
+	(*ntests)++;
+	target.tv_sec = 100;
+	target.tv_nsec = 0;
+	if (!iolog_index_lookup(dfd, &target, &entry) ||
+		entry.elapsed.tv_sec != 4) {
+	    sudo_warnx("%s: index not truncated", compress ? "gzip" : "plain");
+	    (*nerrors)++;
+	}
+    }
+
+    close(dfd);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char testdir[] = "index.XXXXXX";
+    char *rmargs[] = { "rm", "-rf", NULL, NULL };
+    int status, tests = 0, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_iolog_index");
+
+    if (mkdtemp(testdir) == NULL)
+	sudo_fatal("unable to create test dir");
+    rmargs[2] = testdir;
+
+    iolog_set_owner(geteuid(), getegid());
+
+    test_iolog_index(testdir, false, &tests, &errors);
+#ifdef HAVE_ZLIB_H
+    test_iolog_index(testdir, true, &tests, &errors);
+#endif
+
+    if (tests != 0) {
+	printf("iolog_index: %d test%s run, %d errors, %d%% success rate\n",
+	    tests, tests == 1 ? "" : "s", errors,
+	    (tests - errors) * 100 / tests);
+    }
+
+    /* Clean up (avoid running via shell) */
+    fflush(stdout);
+    execvp("rm", rmargs);
+    wait(&status);
+
+    exit(errors);
+}
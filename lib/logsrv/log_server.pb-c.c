@@ -649,7 +649,7 @@ void   server_hello__free_unpacked
   assert(message->base.descriptor == &server_hello__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
-static const ProtobufCFieldDescriptor client_message__field_descriptors[13] =
+static const ProtobufCFieldDescriptor client_message__field_descriptors[14] =
 {
   {
     "accept_msg",
@@ -807,6 +807,18 @@ static const ProtobufCFieldDescriptor client_message__field_descriptors[13] =
     0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "session_id",
+    14,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ClientMessage, session_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned client_message__field_indices_by_name[] = {
   0,   /* field[0] = accept_msg */
@@ -815,6 +827,7 @@ static const unsigned client_message__field_indices_by_name[] = {
   12,   /* field[12] = hello_msg */
   1,   /* field[1] = reject_msg */
   3,   /* field[3] = restart_msg */
+  13,   /* field[13] = session_id */
   9,   /* field[9] = stderr_buf */
   7,   /* field[7] = stdin_buf */
   8,   /* field[8] = stdout_buf */
@@ -826,7 +839,7 @@ static const unsigned client_message__field_indices_by_name[] = {
 static const ProtobufCIntRange client_message__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 13 }
+  { 0, 14 }
 };
 const ProtobufCMessageDescriptor client_message__descriptor =
 {
@@ -836,7 +849,7 @@ const ProtobufCMessageDescriptor client_message__descriptor =
   "ClientMessage",
   "",
   sizeof(ClientMessage),
-  13,
+  14,
   client_message__field_descriptors,
   client_message__field_indices_by_name,
   1,  client_message__number_ranges,
@@ -1597,7 +1610,7 @@ const ProtobufCMessageDescriptor client_hello__descriptor =
   (ProtobufCMessageInit) client_hello__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor server_message__field_descriptors[5] =
+static const ProtobufCFieldDescriptor server_message__field_descriptors[6] =
 {
   {
     "hello",
@@ -1659,6 +1672,18 @@ static const ProtobufCFieldDescriptor server_message__field_descriptors[5] =
     0 | PROTOBUF_C_FIELD_FLAG_ONEOF,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "session_id",
+    6,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_UINT32,
+    0,   /* quantifier_offset */
+    offsetof(ServerMessage, session_id),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned server_message__field_indices_by_name[] = {
   4,   /* field[4] = abort */
@@ -1666,11 +1691,12 @@ static const unsigned server_message__field_indices_by_name[] = {
   3,   /* field[3] = error */
   0,   /* field[0] = hello */
   2,   /* field[2] = log_id */
+  5,   /* field[5] = session_id */
 };
 static const ProtobufCIntRange server_message__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 5 }
+  { 0, 6 }
 };
 const ProtobufCMessageDescriptor server_message__descriptor =
 {
@@ -1680,14 +1706,14 @@ const ProtobufCMessageDescriptor server_message__descriptor =
   "ServerMessage",
   "",
   sizeof(ServerMessage),
-  5,
+  6,
   server_message__field_descriptors,
   server_message__field_indices_by_name,
   1,  server_message__number_ranges,
   (ProtobufCMessageInit) server_message__init,
   NULL,NULL,NULL    /* reserved[123] */
 };
-static const ProtobufCFieldDescriptor server_hello__field_descriptors[3] =
+static const ProtobufCFieldDescriptor server_hello__field_descriptors[4] =
 {
   {
     "server_id",
@@ -1725,8 +1751,21 @@ static const ProtobufCFieldDescriptor server_hello__field_descriptors[3] =
     0,             /* flags */
     0,NULL,NULL    /* reserved1,reserved2, etc */
   },
+  {
+    "multiplex",
+    4,
+    PROTOBUF_C_LABEL_NONE,
+    PROTOBUF_C_TYPE_BOOL,
+    0,   /* quantifier_offset */
+    offsetof(ServerHello, multiplex),
+    NULL,
+    NULL,
+    0,             /* flags */
+    0,NULL,NULL    /* reserved1,reserved2, etc */
+  },
 };
 static const unsigned server_hello__field_indices_by_name[] = {
+  3,   /* field[3] = multiplex */
   1,   /* field[1] = redirect */
   0,   /* field[0] = server_id */
   2,   /* field[2] = servers */
@@ -1734,7 +1773,7 @@ static const unsigned server_hello__field_indices_by_name[] = {
 static const ProtobufCIntRange server_hello__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 3 }
+  { 0, 4 }
 };
 const ProtobufCMessageDescriptor server_hello__descriptor =
 {
@@ -1744,7 +1783,7 @@ const ProtobufCMessageDescriptor server_hello__descriptor =
   "ServerHello",
   "",
   sizeof(ServerHello),
-  3,
+  4,
   server_hello__field_descriptors,
   server_hello__field_indices_by_name,
   1,  server_hello__number_ranges,
@@ -23,6 +23,12 @@
 
 #include <config.h>
 
+/* Built with -DSUDO_EVENT_SELECT for event_select_test, see Makefile.in. */
+#ifdef SUDO_EVENT_SELECT
+# undef HAVE_POLL
+# undef HAVE_PPOLL
+#endif
+
 #include <sys/types.h>
 #include <sys/time.h>
 #include <stdio.h>
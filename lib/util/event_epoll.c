@@ -0,0 +1,422 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+#include <config.h>
+
+#include <sys/epoll.h>
+
+#include <stdlib.h>
+#include <limits.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+
+/*
+ * The epoll backend uses level-triggered notification so that, like
+ * poll(2), an fd that is still readable or writable is reported again
+ * on the next pass through the event loop.  Only one epoll registration
+ * is possible per fd so events that share an fd (e.g. separate read and
+ * write events on a socket) are chained together and the registered
+ * interest set is the union of their events.
+ */
+struct sudo_ev_epoll_fd {
+    struct sudo_event *events;	/* events for this fd, linked via fd_next */
+    bool regular;		/* not supported by epoll, always ready */
+};
+
+/*
+ * Return the epoll interest set for all the events on an fd.
+ */
+static unsigned int
+sudo_ev_epoll_mask(struct sudo_ev_epoll_fd *epfd)
+{
+    struct sudo_event *ev;
+    unsigned int mask = 0;
+
+    for (ev = epfd->events; ev != NULL; ev = ev->fd_next) {
+	if (ISSET(ev->events, SUDO_EV_READ))
+	    mask |= EPOLLIN;
+	if (ISSET(ev->events, SUDO_EV_WRITE))
+	    mask |= EPOLLOUT;
+    }
+    return mask;
+}
+
+/*
+ * Register, modify or remove the interest set for fd with the kernel.
+ * An fd that epoll doesn't support (regular files and directories)
+ * is marked as always ready, which matches poll(2) semantics.
+ * The kernel is always updated, even if the mask is unchanged, since
+ * the fd may have been closed and reused since it was registered.
+ * Removing interest in a closed fd always succeeds; the kernel has
+ * already dropped it and it is re-registered by the next add.
+ */
+static int
+sudo_ev_epoll_update(struct sudo_event_base *base, int fd,
+    unsigned int oldmask, unsigned int newmask)
+{
+    struct sudo_ev_epoll_fd *epfd = &base->epfds[fd];
+    struct epoll_event epev;
+    int op;
+    debug_decl(sudo_ev_epoll_update, SUDO_DEBUG_EVENT);
+
+    if (epfd->regular) {
+	if (newmask == 0) {
+	    epfd->regular = false;
+	    base->epfd_nregular--;
+	}
+	debug_return_int(0);
+    }
+
+    memset(&epev, 0, sizeof(epev));
+    epev.events = newmask;
+    epev.data.fd = fd;
+    if (newmask == 0) {
+	/* The fd may already have been closed, ignore ENOENT and EBADF. */
+	if (epoll_ctl(base->epfd, EPOLL_CTL_DEL, fd, &epev) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_ERRNO,
+		"%s: unable to remove fd %d from epoll set", __func__, fd);
+	}
+	debug_return_int(0);
+    }
+
+    op = oldmask ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(base->epfd, op, fd, &epev) == -1) {
+	/*
+	 * The kernel drops the fd from the set when it is closed.
+	 * Only a delete narrows the mask, there is nothing to remove.
+	 */
+	if (op == EPOLL_CTL_MOD && (errno == ENOENT || errno == EBADF) &&
+		newmask != oldmask && (newmask & ~oldmask) == 0) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_ERRNO,
+		"%s: fd %d no longer in epoll set", __func__, fd);
+	    debug_return_int(0);
+	}
+	if (op == EPOLL_CTL_MOD && errno == ENOENT)
+	    op = EPOLL_CTL_ADD;
+	if (op != EPOLL_CTL_ADD || epoll_ctl(base->epfd, op, fd, &epev) == -1) {
+	    if (errno != EPERM) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+		    "%s: unable to add fd %d to epoll set", __func__, fd);
+		debug_return_int(-1);
+	    }
+	    sudo_debug_printf(SUDO_DEBUG_INFO,
+		"%s: fd %d not supported by epoll, treating as ready",
+		__func__, fd);
+	    epfd->regular = true;
+	    base->epfd_nregular++;
+	}
+    }
+
+    debug_return_int(0);
+}
+
+/*
+ * The epoll instance is shared with any child process we fork.
+ * If we are no longer the process that created it, replace it with
+ * a new one and re-register all fds so the parent is not affected.
+ */
+static int
+sudo_ev_epoll_check_fork(struct sudo_event_base *base)
+{
+    pid_t pid = getpid();
+    int fd;
+    debug_decl(sudo_ev_epoll_check_fork, SUDO_DEBUG_EVENT);
+
+    if (base->epoll_pid == pid)
+	debug_return_int(0);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"%s: re-creating epoll instance after fork", __func__);
+    close(base->epfd);
+    base->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (base->epfd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to create epoll instance", __func__);
+	debug_return_int(-1);
+    }
+    base->epoll_pid = pid;
+    base->epfd_nregular = 0;
+    for (fd = 0; fd < base->epfd_max; fd++) {
+	struct sudo_ev_epoll_fd *epfd = &base->epfds[fd];
+
+	epfd->regular = false;
+	if (epfd->events != NULL) {
+	    if (sudo_ev_epoll_update(base, fd, 0, sudo_ev_epoll_mask(epfd)) == -1)
+		debug_return_int(-1);
+	}
+    }
+    debug_return_int(0);
+}
+
+int
+sudo_ev_base_alloc_impl(struct sudo_event_base *base)
+{
+    debug_decl(sudo_ev_base_alloc_impl, SUDO_DEBUG_EVENT);
+
+    base->epfd = -1;
+    base->epfd_max = 32;
+    base->epfds = calloc(base->epfd_max, sizeof(struct sudo_ev_epoll_fd));
+    if (base->epfds == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to allocate %d epoll fds", __func__, base->epfd_max);
+	base->epfd_max = 0;
+	debug_return_int(-1);
+    }
+    base->epevent_max = 32;
+    base->epevents = reallocarray(NULL, base->epevent_max,
+	sizeof(struct epoll_event));
+    if (base->epevents == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: unable to allocate %d epoll events", __func__,
+	    base->epevent_max);
+	base->epevent_max = 0;
+	debug_return_int(-1);
+    }
+    base->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (base->epfd == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "%s: unable to create epoll instance", __func__);
+	debug_return_int(-1);
+    }
+    base->epoll_pid = getpid();
+
+    debug_return_int(0);
+}
+
+void
+sudo_ev_base_free_impl(struct sudo_event_base *base)
+{
+    debug_decl(sudo_ev_base_free_impl, SUDO_DEBUG_EVENT);
+    if (base->epfd != -1)
+	close(base->epfd);
+    free(base->epfds);
+    free(base->epevents);
+    debug_return;
+}
+
+int
+sudo_ev_add_impl(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    struct sudo_ev_epoll_fd *epfd;
+    unsigned int oldmask;
+    debug_decl(sudo_ev_add_impl, SUDO_DEBUG_EVENT);
+
+    if (ev->fd < 0) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "%s: invalid fd %d", __func__, ev->fd);
+	debug_return_int(-1);
+    }
+    if (sudo_ev_epoll_check_fork(base) == -1)
+	debug_return_int(-1);
+
+    /* If fd is beyond the end of the epfds array, realloc. */
+    if (ev->fd >= base->epfd_max) {
+	struct sudo_ev_epoll_fd *epfds;
+	int new_max = base->epfd_max * 2;
+
+	while (ev->fd >= new_max)
+	    new_max *= 2;
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "%s: epfd_max %d -> %d", __func__, base->epfd_max, new_max);
+	epfds = reallocarray(base->epfds, new_max,
+	    sizeof(struct sudo_ev_epoll_fd));
+	if (epfds == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"%s: unable to allocate %d epoll fds", __func__, new_max);
+	    debug_return_int(-1);
+	}
+	memset(epfds + base->epfd_max, 0,
+	    (new_max - base->epfd_max) * sizeof(struct sudo_ev_epoll_fd));
+	base->epfds = epfds;
+	base->epfd_max = new_max;
+    }
+
+    /* Link event into the per-fd list and update the interest set. */
+    epfd = &base->epfds[ev->fd];
+    oldmask = sudo_ev_epoll_mask(epfd);
+    ev->fd_next = epfd->events;
+    epfd->events = ev;
+    if (sudo_ev_epoll_update(base, ev->fd, oldmask, sudo_ev_epoll_mask(epfd)) == -1) {
+	epfd->events = ev->fd_next;
+	ev->fd_next = NULL;
+	debug_return_int(-1);
+    }
+
+    /* Grow the result array as needed, one slot per fd is sufficient. */
+    if (ev->fd >= base->epevent_max && base->epevent_max < base->epfd_max) {
+	struct epoll_event *epevents;
+
+	epevents = reallocarray(base->epevents, base->epfd_max,
+	    sizeof(struct epoll_event));
+	if (epevents != NULL) {
+	    base->epevents = epevents;
+	    base->epevent_max = base->epfd_max;
+	}
+    }
+
+    debug_return_int(0);
+}
+
+int
+sudo_ev_del_impl(struct sudo_event_base *base, struct sudo_event *ev)
+{
+    struct sudo_ev_epoll_fd *epfd;
+    struct sudo_event **evp;
+    unsigned int oldmask, newmask;
+    debug_decl(sudo_ev_del_impl, SUDO_DEBUG_EVENT);
+
+    if (ev->fd < 0 || ev->fd >= base->epfd_max)
+	debug_return_int(0);
+    if (sudo_ev_epoll_check_fork(base) == -1)
+	debug_return_int(-1);
+
+    /* Unlink event from the per-fd list and update the interest set. */
+    epfd = &base->epfds[ev->fd];
+    oldmask = sudo_ev_epoll_mask(epfd);
+    for (evp = &epfd->events; *evp != NULL; evp = &(*evp)->fd_next) {
+	if (*evp == ev) {
+	    *evp = ev->fd_next;
+	    break;
+	}
+    }
+    ev->fd_next = NULL;
+    newmask = sudo_ev_epoll_mask(epfd);
+    if (newmask != oldmask) {
+	/* The event is already unlinked, a kernel error is not fatal. */
+	(void)sudo_ev_epoll_update(base, ev->fd, oldmask, newmask);
+    }
+
+    debug_return_int(0);
+}
+
+/*
+ * Activate the events for fd that match the epoll events in revents.
+ * The internal signal pipe event always goes to the head of the queue
+ * so signals are processed before other I/O, as they are with poll.
+ */
+static void
+sudo_ev_epoll_activate(struct sudo_event_base *base, int fd,
+    unsigned int revents)
+{
+    struct sudo_event *ev;
+    debug_decl(sudo_ev_epoll_activate, SUDO_DEBUG_EVENT);
+
+    for (ev = base->epfds[fd].events; ev != NULL; ev = ev->fd_next) {
+	int what = 0;
+
+	if (revents & (EPOLLIN|EPOLLHUP|EPOLLERR))
+	    what |= (ev->events & SUDO_EV_READ);
+	if (revents & (EPOLLOUT|EPOLLHUP|EPOLLERR))
+	    what |= (ev->events & SUDO_EV_WRITE);
+	if (what == 0 || ISSET(ev->flags, SUDO_EVQ_ACTIVE))
+	    continue;
+
+	/* Make event active. */
+	sudo_debug_printf(SUDO_DEBUG_DEBUG,
+	    "%s: polled fd %d, events %d, activating %p",
+	    __func__, ev->fd, what, ev);
+	ev->revents = what;
+	if (ev == &base->signal_event) {
+	    TAILQ_INSERT_HEAD(&base->active, ev, active_entries);
+	    SET(ev->flags, SUDO_EVQ_ACTIVE);
+	} else {
+	    sudo_ev_activate(base, ev);
+	}
+    }
+    debug_return;
+}
+
+int
+sudo_ev_scan_impl(struct sudo_event_base *base, int flags)
+{
+    struct timespec now, ts;
+    struct sudo_event *ev;
+    int i, nready, timeout;
+    debug_decl(sudo_ev_scan_impl, SUDO_DEBUG_EVENT);
+
+    if (sudo_ev_epoll_check_fork(base) == -1)
+	debug_return_int(-1);
+
+    if (base->epfd_nregular > 0) {
+	/* Regular files are always ready, don't block. */
+	timeout = 0;
+    } else if ((ev = TAILQ_FIRST(&base->timeouts)) != NULL) {
+	sudo_gettime_mono(&now);
+	sudo_timespecsub(&ev->timeout, &now, &ts);
+	if (ts.tv_sec < 0)
+	    sudo_timespecclear(&ts);
+	/* Round up to the next millisecond to avoid spinning. */
+	if (ts.tv_sec >= INT_MAX / 1000)
+	    timeout = INT_MAX;
+	else
+	    timeout = (ts.tv_sec * 1000) + ((ts.tv_nsec + 999999) / 1000000);
+    } else {
+	timeout = ISSET(flags, SUDO_EVLOOP_NONBLOCK) ? 0 : -1;
+    }
+
+    nready = epoll_wait(base->epfd, base->epevents, base->epevent_max,
+	timeout);
+    switch (nready) {
+    case -1:
+	/* Error: EINTR (signal) or EINVAL */
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "epoll_wait");
+	break;
+    default:
+	/* Activate each I/O event that fired. */
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: %d fds ready", __func__,
+	    nready);
+	for (i = 0; i < nready; i++) {
+	    sudo_ev_epoll_activate(base, base->epevents[i].data.fd,
+		base->epevents[i].events);
+	}
+	if (base->epfd_nregular > 0) {
+	    /* Regular files are not in the epoll set, activate them too. */
+	    for (i = 0; i < base->epfd_max; i++) {
+		if (base->epfds[i].regular) {
+		    sudo_ev_epoll_activate(base, i, EPOLLIN|EPOLLOUT);
+		    nready++;
+		}
+	    }
+	}
+	if (nready == 0) {
+	    /* Front end will activate timeout events. */
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: timeout", __func__);
+	}
+	break;
+    }
+    debug_return_int(nready);
+}
@@ -23,6 +23,10 @@
 
 #include <config.h>
 
+/* Always use the select() layout of struct sudo_event_base. */
+#undef HAVE_POLL
+#undef HAVE_PPOLL
+
 #include <sys/param.h>		/* for howmany() on Linux */
 #include <sys/time.h>
 #ifdef HAVE_SYS_SYSMACROS_H
@@ -136,6 +140,7 @@ sudo_ev_add_impl(struct sudo_event_base *base, struct sudo_event *ev)
 int
 sudo_ev_del_impl(struct sudo_event_base *base, struct sudo_event *ev)
 {
+    struct sudo_event *evtmp;
     debug_decl(sudo_ev_del_impl, SUDO_DEBUG_EVENT);
 
     /* Remove from readfds and writefds and adjust high fd. */
@@ -149,6 +154,17 @@ sudo_ev_del_impl(struct sudo_event_base *base, struct sudo_event *ev)
 	    __func__, ev->fd);
 	FD_CLR(ev->fd, base->writefds_in);
     }
+
+    /* The fd may have been closed and reused by another event. */
+    TAILQ_FOREACH(evtmp, &base->events, entries) {
+	if (evtmp == ev || evtmp->fd != ev->fd)
+	    continue;
+	if (ISSET(evtmp->events, SUDO_EV_READ))
+	    FD_SET(ev->fd, base->readfds_in);
+	if (ISSET(evtmp->events, SUDO_EV_WRITE))
+	    FD_SET(ev->fd, base->writefds_in);
+    }
+
     if (base->highfd == ev->fd) {
 	for (;;) {
 	    if (FD_ISSET(base->highfd, base->readfds_in) ||
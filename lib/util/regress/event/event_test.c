@@ -0,0 +1,386 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sudo_compat.h"
+#include "sudo_fatal.h"
+#include "sudo_event.h"
+#include "sudo_util.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/*
+ * Run the same event scenarios against whichever event backend
+ * (epoll, poll or select) this binary was linked with.
+ */
+
+struct ev_count {
+    struct sudo_event *other;	/* event to delete from the callback */
+    int calls;			/* number of times the callback ran */
+    int what;			/* events from the most recent call */
+    bool drain;			/* read from the fd in the callback */
+};
+
+static int ntests, errors;
+
+static void
+check(bool cond, const char *desc)
+{
+    ntests++;
+    if (!cond) {
+	sudo_warnx_nodebug("failed test #%d: %s", ntests, desc);
+	errors++;
+    }
+}
+
+static void
+count_cb(int fd, int what, void *v)
+{
+    struct ev_count *cnt = v;
+    char buf[64];
+
+    cnt->calls++;
+    cnt->what = what;
+    if (cnt->drain && (what & SUDO_EV_READ))
+	(void)read(fd, buf, sizeof(buf));
+    if (cnt->other != NULL)
+	sudo_ev_del(NULL, cnt->other);
+}
+
+static void
+new_pipe(int fds[2])
+{
+    if (pipe(fds) == -1)
+	sudo_fatal_nodebug("pipe");
+    (void)fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    (void)fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+}
+
+static struct sudo_event *
+new_event(struct sudo_event_base *base, int fd, short events,
+    struct ev_count *cnt, const struct timespec *timo)
+{
+    struct sudo_event *ev;
+
+    memset(cnt, 0, sizeof(*cnt));
+    if ((ev = sudo_ev_alloc(fd, events, count_cb, cnt)) == NULL)
+	sudo_fatal_nodebug("sudo_ev_alloc");
+    if (sudo_ev_add(base, ev, timo, false) == -1)
+	sudo_fatal_nodebug("sudo_ev_add");
+    return ev;
+}
+
+/* A one-shot read event fires once and is then removed from the base. */
+static void
+test_oneshot(struct sudo_event_base *base)
+{
+    struct sudo_event *ev;
+    struct ev_count cnt;
+    int fds[2];
+
+    new_pipe(fds);
+    ev = new_event(base, fds[0], SUDO_EV_READ, &cnt, NULL);
+    (void)write(fds[1], "x", 1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 1 && cnt.what == SUDO_EV_READ, "one-shot read");
+    check(sudo_ev_pending(ev, SUDO_EV_READ, NULL) == 0, "one-shot removed");
+    sudo_ev_free(ev);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* A persistent event fires again while the fd is still readable. */
+static void
+test_level_triggered(struct sudo_event_base *base)
+{
+    struct sudo_event *ev;
+    struct ev_count cnt;
+    int fds[2];
+
+    new_pipe(fds);
+    ev = new_event(base, fds[0], SUDO_EV_READ|SUDO_EV_PERSIST, &cnt, NULL);
+    (void)write(fds[1], "x", 1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 2, "level-triggered read");
+    cnt.drain = true;
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    sudo_ev_loop(base, SUDO_EVLOOP_NONBLOCK|SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 3, "drained fd not reported");
+    sudo_ev_free(ev);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* Separate read and write events may share the same fd. */
+static void
+test_shared_fd(struct sudo_event_base *base)
+{
+    struct sudo_event *rev, *wev;
+    struct ev_count rcnt, wcnt;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	sudo_fatal_nodebug("socketpair");
+    rev = new_event(base, sv[0], SUDO_EV_READ|SUDO_EV_PERSIST, &rcnt, NULL);
+    wev = new_event(base, sv[0], SUDO_EV_WRITE|SUDO_EV_PERSIST, &wcnt, NULL);
+    rcnt.drain = true;
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(rcnt.calls == 0 && wcnt.calls == 1 && wcnt.what == SUDO_EV_WRITE,
+	"shared fd: write only");
+    (void)write(sv[1], "x", 1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(rcnt.calls == 1 && wcnt.calls == 2, "shared fd: read and write");
+    sudo_ev_del(base, wev);
+    (void)write(sv[1], "x", 1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(rcnt.calls == 2 && wcnt.calls == 2, "shared fd: write removed");
+    sudo_ev_free(rev);
+    sudo_ev_free(wev);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/* Events sharing an fd may be deleted after the fd is closed. */
+static void
+test_shared_fd_closed(struct sudo_event_base *base)
+{
+    struct sudo_event *rev, *wev;
+    struct ev_count rcnt, wcnt;
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+	sudo_fatal_nodebug("socketpair");
+    rev = new_event(base, sv[0], SUDO_EV_READ|SUDO_EV_PERSIST, &rcnt, NULL);
+    wev = new_event(base, sv[0], SUDO_EV_WRITE|SUDO_EV_PERSIST, &wcnt, NULL);
+    close(sv[0]);
+    check(sudo_ev_del(base, rev) == 0, "shared fd closed: delete read");
+    check(sudo_ev_del(base, wev) == 0, "shared fd closed: delete write");
+    check(sudo_ev_pending(rev, SUDO_EV_READ, NULL) == 0 &&
+	sudo_ev_pending(wev, SUDO_EV_WRITE, NULL) == 0,
+	"shared fd closed: events removed");
+    sudo_ev_free(rev);
+    sudo_ev_free(wev);
+    close(sv[1]);
+}
+
+/* An I/O event with a timeout fires with SUDO_EV_TIMEOUT if idle. */
+static void
+test_timeout(struct sudo_event_base *base)
+{
+    struct timespec timo = { 0, 10000000 };
+    struct sudo_event *ev;
+    struct ev_count cnt;
+    int fds[2];
+
+    new_pipe(fds);
+    ev = new_event(base, fds[0], SUDO_EV_READ, &cnt, &timo);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 1 && cnt.what == SUDO_EV_TIMEOUT, "timeout");
+    sudo_ev_free(ev);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* Deleting an active event from a callback prevents it from running. */
+static void
+test_del_active(struct sudo_event_base *base)
+{
+    struct sudo_event *ev1, *ev2;
+    struct ev_count cnt1, cnt2;
+    int fds1[2], fds2[2];
+
+    new_pipe(fds1);
+    new_pipe(fds2);
+    ev1 = new_event(base, fds1[0], SUDO_EV_READ|SUDO_EV_PERSIST, &cnt1, NULL);
+    ev2 = new_event(base, fds2[0], SUDO_EV_READ|SUDO_EV_PERSIST, &cnt2, NULL);
+    cnt1.other = ev2;
+    cnt2.other = ev1;
+    (void)write(fds1[1], "x", 1);
+    (void)write(fds2[1], "x", 1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt1.calls + cnt2.calls == 1, "delete active event");
+    sudo_ev_free(ev1);
+    sudo_ev_free(ev2);
+    close(fds1[0]);
+    close(fds1[1]);
+    close(fds2[0]);
+    close(fds2[1]);
+}
+
+/* EOF on a pipe is reported as readable. */
+static void
+test_eof(struct sudo_event_base *base)
+{
+    struct sudo_event *ev;
+    struct ev_count cnt;
+    int fds[2];
+
+    new_pipe(fds);
+    ev = new_event(base, fds[0], SUDO_EV_READ, &cnt, NULL);
+    close(fds[1]);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 1 && cnt.what == SUDO_EV_READ, "eof");
+    sudo_ev_free(ev);
+    close(fds[0]);
+}
+
+/* Regular files are always ready. */
+static void
+test_regular_file(struct sudo_event_base *base)
+{
+    char path[] = "/tmp/event_test.XXXXXX";
+    struct sudo_event *ev;
+    struct ev_count cnt;
+    int fd;
+
+    if ((fd = mkstemp(path)) == -1)
+	sudo_fatal_nodebug("mkstemp");
+    unlink(path);
+    ev = new_event(base, fd, SUDO_EV_WRITE|SUDO_EV_PERSIST, &cnt, NULL);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 1 && cnt.what == SUDO_EV_WRITE, "regular file");
+    sudo_ev_free(ev);
+    close(fd);
+}
+
+/* The fd of a closed event may be reused before the event is deleted. */
+static void
+test_fd_reuse(struct sudo_event_base *base)
+{
+    struct sudo_event *ev1, *ev2;
+    struct ev_count cnt1, cnt2;
+    int fds[2], fd;
+
+    new_pipe(fds);
+    ev1 = new_event(base, fds[0], SUDO_EV_READ|SUDO_EV_PERSIST, &cnt1, NULL);
+    fd = fds[0];
+    close(fds[0]);
+    close(fds[1]);
+    new_pipe(fds);
+    if (fds[0] != fd) {
+	/* Did not get the same fd back, nothing to test. */
+	sudo_ev_free(ev1);
+	close(fds[0]);
+	close(fds[1]);
+	return;
+    }
+    ev2 = new_event(base, fds[0], SUDO_EV_READ|SUDO_EV_PERSIST, &cnt2, NULL);
+    sudo_ev_free(ev1);
+    cnt2.drain = true;
+    (void)write(fds[1], "x", 1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt2.calls == 1, "fd reuse");
+    sudo_ev_free(ev2);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* Changes to the base in a child process must not affect the parent. */
+static void
+test_fork(struct sudo_event_base *base)
+{
+    struct sudo_event *ev;
+    struct ev_count cnt;
+    int fds[2], status;
+    pid_t child;
+
+    new_pipe(fds);
+    ev = new_event(base, fds[0], SUDO_EV_READ|SUDO_EV_PERSIST, &cnt, NULL);
+    cnt.drain = true;
+    switch (child = fork()) {
+    case -1:
+	sudo_fatal_nodebug("fork");
+	break;
+    case 0:
+	sudo_ev_del(base, ev);
+	_exit(0);
+    default:
+	while (waitpid(child, &status, 0) == -1)
+	    continue;
+	break;
+    }
+    (void)write(fds[1], "x", 1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 1, "event survives fork");
+    sudo_ev_free(ev);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/* Signal events are delivered via the internal signal pipe. */
+static void
+test_signal(struct sudo_event_base *base)
+{
+    struct sudo_event *ev;
+    struct ev_count cnt;
+
+    ev = new_event(base, SIGUSR1, SUDO_EV_SIGNAL, &cnt, NULL);
+    kill(getpid(), SIGUSR1);
+    sudo_ev_loop(base, SUDO_EVLOOP_ONCE);
+    check(cnt.calls == 1 && cnt.what == SUDO_EV_SIGNAL, "signal");
+    sudo_ev_free(ev);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct sudo_event_base *base;
+
+    initprogname(argc > 0 ? argv[0] : "event_test");
+
+    if ((base = sudo_ev_base_alloc()) == NULL)
+	sudo_fatal_nodebug("sudo_ev_base_alloc");
+
+    test_oneshot(base);
+    test_level_triggered(base);
+    test_shared_fd(base);
+    test_shared_fd_closed(base);
+    test_timeout(base);
+    test_del_active(base);
+    test_eof(base);
+    test_regular_file(base);
+    test_fd_reuse(base);
+    test_fork(base);
+    test_signal(base);
+
+    sudo_ev_base_free(base);
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    exit(errors);
+}
@@ -0,0 +1,154 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for the SHA-256 block transform.  The same data is
+ * hashed with the generic transform and with the accelerated one
+ * selected for this CPU, if any, in both large buffers (as when
+ * hashing a command for a sudoers Digest) and in small messages.
+ * Both transforms must produce the same digest.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+
+#include "sudo_compat.h"
+#include "sudo_fatal.h"
+#include "sudo_util.h"
+#include "compat/sha2.h"
+#include "sha2_private.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-m megabytes] [-s bufsize]\n",
+	getprogname());
+    exit(EXIT_FAILURE);
+}
+
+static double
+cpu_time(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+	sudo_fatal_nodebug("getrusage");
+    return (double)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+/*
+ * Hash total bytes of buf, bufsize bytes per message, and report the
+ * throughput.  The digest of the last message is stored in digest.
+ */
+static double
+bench(const char *name, const uint8_t *buf, size_t bufsize,
+    unsigned long long total, uint8_t digest[SHA256_DIGEST_LENGTH])
+{
+    unsigned long long done;
+    double start, elapsed;
+    SHA2_CTX ctx;
+
+    start = cpu_time();
+    for (done = 0; done < total; done += bufsize) {
+	SHA256Init(&ctx);
+	SHA256Update(&ctx, buf, bufsize);
+	SHA256Final(digest, &ctx);
+    }
+    elapsed = cpu_time() - start;
+    if (elapsed <= 0)
+	elapsed = 0.000001;
+
+    printf("%-10s %8zu byte messages %8.3fs cpu %10.1f MB/sec\n", name,
+	bufsize, elapsed, (double)done / elapsed / (1024 * 1024));
+    return elapsed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint8_t digest[SHA256_DIGEST_LENGTH], digest2[SHA256_DIGEST_LENGTH];
+    size_t sizes[] = { 64, 0 };
+    unsigned long long total = 256ULL * 1024 * 1024;
+    size_t i, buflen, bufsize = 256 * 1024;
+    double generic, accel;
+    const char *impl;
+    const char *errstr;
+    uint8_t *buf;
+    int ch;
+
+    initprogname(argc > 0 ? argv[0] : "sha2_bench");
+
+    while ((ch = getopt(argc, argv, "m:s:")) != -1) {
+	switch (ch) {
+	case 'm':
+	    total = sudo_strtonum(optarg, 1, 1024 * 1024, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx_nodebug("megabytes %s: %s", optarg, errstr);
+	    total *= 1024 * 1024;
+	    break;
+	case 's':
+	    bufsize = sudo_strtonum(optarg, 1, 64 * 1024 * 1024, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx_nodebug("buffer size %s: %s", optarg, errstr);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    sizes[1] = bufsize;
+
+    buflen = MAX(bufsize, sizes[0]);
+    if ((buf = malloc(buflen)) == NULL)
+	sudo_fatal_nodebug(NULL);
+    for (i = 0; i < buflen; i++)
+	buf[i] = (uint8_t)(i * 167 + (i >> 8));
+
+    impl = sudo_SHA256SetImpl(1);
+    for (i = 0; i < nitems(sizes); i++) {
+	sudo_SHA256SetImpl(0);
+	generic = bench("generic", buf, sizes[i], total / (i ? 1 : 8), digest);
+	if (strcmp(impl, "generic") == 0)
+	    continue;
+	sudo_SHA256SetImpl(1);
+	accel = bench(impl, buf, sizes[i], total / (i ? 1 : 8), digest2);
+	if (memcmp(digest, digest2, sizeof(digest)) != 0)
+	    sudo_fatalx_nodebug("%s and generic digests differ", impl);
+	printf("%-10s %8zu byte messages %7.2fx speedup\n", impl, sizes[i],
+	    generic / accel);
+    }
+    if (strcmp(impl, "generic") == 0)
+	printf("no accelerated SHA-256 transform available\n");
+
+    free(buf);
+    exit(EXIT_SUCCESS);
+}
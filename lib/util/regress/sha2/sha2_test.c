@@ -0,0 +1,207 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+
+#include "sudo_compat.h"
+#include "sudo_fatal.h"
+#include "sudo_util.h"
+#include "compat/sha2.h"
+#include "sha2_private.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/*
+ * Test the SHA-2 implementations against the FIPS 180-4 examples,
+ * using both the generic and accelerated SHA-256 block transforms.
+ */
+
+struct sha2_test {
+    int bits;
+    const char *input;
+    size_t repeat;
+    const char *digest;
+};
+
+static const char msg448[] =
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+static struct sha2_test test_data[] = {
+    { 224, "abc", 1,
+	"23097d223405d8228642a477bda255b32aadbce4bda0b3f7e36c9da7" },
+    { 224, "", 1,
+	"d14a028c2a3a2bc9476102bb288234c415a2b01f828ea62ac5b3e42f" },
+    { 224, msg448, 1,
+	"75388b16512776cc5dba5da1fd890150b0c6455cb4f58b1952522525" },
+    { 224, "aaaaaaaaaa", 100000,
+	"20794655980c91d8bbb4c1ea97618a4bf03f42581948b2ee4ee7ad67" },
+    { 256, "abc", 1,
+	"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+    { 256, "", 1,
+	"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+    { 256, msg448, 1,
+	"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+    { 256, "aaaaaaaaaa", 100000,
+	"cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+    { 384, "abc", 1,
+	"cb00753f45a35e8bb5a03d699ac65007272c32ab0eded163"
+	"1a8b605a43ff5bed8086072ba1e7cc2358baeca134c825a7" },
+    { 384, msg448, 1,
+	"3391fdddfc8dc7393707a65b1b4709397cf8b1d162af05ab"
+	"fe8f450de5f36bc6b0455a8520bc4e6f5fe95b1fe3c8452b" },
+    { 512, "abc", 1,
+	"ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+	"2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" },
+    { 512, "", 1,
+	"cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+	"47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e" },
+    { 512, "aaaaaaaaaa", 100000,
+	"e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+	"de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b" },
+    { 0, NULL, 0, NULL }
+};
+
+static void
+digest_hex(const unsigned char *digest, size_t len, char *buf)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+	snprintf(buf + (i * 2), 3, "%02x", digest[i]);
+}
+
+/*
+ * Hash len bytes of data in chunks of at most chunk bytes.
+ */
+static void
+sha256_chunked(const uint8_t *data, size_t len, size_t chunk,
+    uint8_t digest[SHA256_DIGEST_LENGTH])
+{
+    SHA2_CTX ctx;
+    size_t n;
+
+    SHA256Init(&ctx);
+    while (len > 0) {
+	n = len < chunk ? len : chunk;
+	SHA256Update(&ctx, data, n);
+	data += n;
+	len -= n;
+    }
+    SHA256Final(digest, &ctx);
+}
+
+int
+main(int argc, char *argv[])
+{
+    uint8_t digest[SHA512_DIGEST_LENGTH], digest2[SHA256_DIGEST_LENGTH];
+    char hex[SHA512_DIGEST_STRING_LENGTH];
+    static uint8_t buf[4096];
+    int accel, errors = 0, ntests = 0;
+    size_t i, len, chunk;
+    const char *impl;
+    SHA2_CTX ctx;
+    initprogname(argc > 0 ? argv[0] : "sha2_test");
+
+    for (accel = 0; accel < 2; accel++) {
+	impl = sudo_SHA256SetImpl(accel);
+	for (i = 0; test_data[i].input != NULL; i++) {
+	    struct sha2_test *td = &test_data[i];
+	    size_t dlen, n;
+
+	    ntests++;
+	    switch (td->bits) {
+		case 224:
+		    SHA224Init(&ctx);
+		    for (n = 0; n < td->repeat; n++)
+			SHA224Update(&ctx, (uint8_t *)td->input,
+			    strlen(td->input));
+		    SHA224Final(digest, &ctx);
+		    dlen = SHA224_DIGEST_LENGTH;
+		    break;
+		case 256:
+		    SHA256Init(&ctx);
+		    for (n = 0; n < td->repeat; n++)
+			SHA256Update(&ctx, (uint8_t *)td->input,
+			    strlen(td->input));
+		    SHA256Final(digest, &ctx);
+		    dlen = SHA256_DIGEST_LENGTH;
+		    break;
+		case 384:
+		    SHA384Init(&ctx);
+		    for (n = 0; n < td->repeat; n++)
+			SHA384Update(&ctx, (uint8_t *)td->input,
+			    strlen(td->input));
+		    SHA384Final(digest, &ctx);
+		    dlen = SHA384_DIGEST_LENGTH;
+		    break;
+		default:
+		    SHA512Init(&ctx);
+		    for (n = 0; n < td->repeat; n++)
+			SHA512Update(&ctx, (uint8_t *)td->input,
+			    strlen(td->input));
+		    SHA512Final(digest, &ctx);
+		    dlen = SHA512_DIGEST_LENGTH;
+		    break;
+	    }
+	    digest_hex(digest, dlen, hex);
+	    if (strcmp(hex, td->digest) != 0) {
+		sudo_warnx_nodebug("failed test #%d (%s): SHA-%d of \"%s\" x %zu: "
+		    "expected %s, got %s", ntests, impl, td->bits,
+		    td->input, td->repeat, td->digest, hex);
+		errors++;
+	    }
+	}
+    }
+
+    /*
+     * Compare the accelerated transform (if any) with the generic one
+     * for all lengths up to 1024 bytes, hashed in different chunk sizes.
+     */
+    for (i = 0; i < sizeof(buf); i++)
+	buf[i] = (uint8_t)(i * 167 + (i >> 8));
+    for (len = 0; len <= 1024; len++) {
+	for (chunk = 1; chunk <= 4096; chunk *= 8) {
+	    ntests++;
+	    sudo_SHA256SetImpl(0);
+	    sha256_chunked(buf + (len & 7), len, chunk, digest);
+	    impl = sudo_SHA256SetImpl(1);
+	    sha256_chunked(buf + (len & 7), len, chunk, digest2);
+	    if (memcmp(digest, digest2, sizeof(digest2)) != 0) {
+		sudo_warnx_nodebug("failed test #%d: %s and generic SHA-256 "
+		    "differ for length %zu, chunk size %zu", ntests, impl,
+		    len, chunk);
+		errors++;
+	    }
+	}
+    }
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, errors, (ntests - errors) * 100 / ntests);
+    }
+    exit(errors);
+}
@@ -28,6 +28,10 @@
  *
  * Derived from the public domain SHA-1 and SHA-2 implementations
  * by Steve Reid and Wei Dai respectively.
+ *
+ * The SHA-256 block transform uses the x86 SHA extensions or the
+ * ARMv8 SHA-2 instructions when the compiler supports them and the
+ * CPU they run on does.  The implementation is chosen on first use.
  */
 
 #include <config.h>
@@ -49,6 +53,34 @@
 
 #include "sudo_compat.h"
 #include "compat/sha2.h"
+#include "sha2_private.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__clang__) && __clang_major__ >= 4) || \
+    (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 5))
+# define SHA2_X86_SHA
+# include <cpuid.h>
+# include <immintrin.h>
+# ifndef bit_SHA
+#  define bit_SHA (1 << 29)
+# endif
+#elif defined(__aarch64__) && \
+    (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+/* SHA-2 instructions are always available. */
+# define SHA2_ARMV8_SHA2
+# define SHA2_ARMV8_TARGET
+# include <arm_neon.h>
+#elif defined(__aarch64__) && defined(HAVE_GETAUXVAL) && \
+    defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 6
+# define SHA2_ARMV8_SHA2
+# define SHA2_ARMV8_TARGET	__attribute__((target("+crypto")))
+# define SHA2_ARMV8_HWCAP
+# include <sys/auxv.h>
+# include <arm_neon.h>
+# ifndef HWCAP_SHA2
+#  define HWCAP_SHA2 (1 << 6)
+# endif
+#endif
 
 /*
  * SHA-2 operates on 32-bit and 64-bit words in big endian byte order.
@@ -98,6 +130,9 @@
 #define Ch(x,y,z) (z^(x&(y^z)))
 #define Maj(x,y,z) (y^((x^y)&(y^z)))
 
+/* A '1' bit followed by zeros, enough to pad a SHA-512 block. */
+static const uint8_t sha2_padding[SHA512_BLOCK_LENGTH] = { 0x80 };
+
 #define a(i) T[(0-i)&7]
 #define b(i) T[(1-i)&7]
 #define c(i) T[(2-i)&7]
@@ -201,41 +236,44 @@ SHA256Init(SHA2_CTX *ctx)
 #define s0(x) (rotrFixed(x,7)^rotrFixed(x,18)^(x>>3))
 #define s1(x) (rotrFixed(x,17)^rotrFixed(x,19)^(x>>10))
 
-void
-SHA256Transform(uint32_t state[8], const uint8_t data[SHA256_BLOCK_LENGTH])
+static void
+SHA256Transform_generic(uint32_t state[8], const uint8_t *data, size_t nblocks)
 {
 	uint32_t W[16];
 	uint32_t T[8];
 	unsigned int j;
 
-	/* Copy context state to working vars. */
-	memcpy(T, state, sizeof(T));
-	/* Copy data to W in big endian format. */
+	while (nblocks--) {
+		/* Copy context state to working vars. */
+		memcpy(T, state, sizeof(T));
+		/* Copy data to W in big endian format. */
 #if BYTE_ORDER == BIG_ENDIAN
-	memcpy(W, data, sizeof(W));
+		memcpy(W, data, sizeof(W));
+		data += sizeof(W);
 #else
-	for (j = 0; j < 16; j++) {
-	    BE8TO32(W[j], data);
-	    data += 4;
-	}
+		for (j = 0; j < 16; j++) {
+		    BE8TO32(W[j], data);
+		    data += 4;
+		}
 #endif
-	/* 64 operations, partially loop unrolled. */
-	for (j = 0; j < 64; j += 16)
-	{
-		R( 0); R( 1); R( 2); R( 3);
-		R( 4); R( 5); R( 6); R( 7);
-		R( 8); R( 9); R(10); R(11);
-		R(12); R(13); R(14); R(15);
+		/* 64 operations, partially loop unrolled. */
+		for (j = 0; j < 64; j += 16)
+		{
+			R( 0); R( 1); R( 2); R( 3);
+			R( 4); R( 5); R( 6); R( 7);
+			R( 8); R( 9); R(10); R(11);
+			R(12); R(13); R(14); R(15);
+		}
+		/* Add the working vars back into context state. */
+		state[0] += a(0);
+		state[1] += b(0);
+		state[2] += c(0);
+		state[3] += d(0);
+		state[4] += e(0);
+		state[5] += f(0);
+		state[6] += g(0);
+		state[7] += h(0);
 	}
-	/* Add the working vars back into context state. */
-	state[0] += a(0);
-	state[1] += b(0);
-	state[2] += c(0);
-	state[3] += d(0);
-	state[4] += e(0);
-	state[5] += f(0);
-	state[6] += g(0);
-	state[7] += h(0);
 	/* Cleanup */
 	explicit_bzero(T, sizeof(T));
 	explicit_bzero(W, sizeof(W));
@@ -247,6 +285,218 @@ SHA256Transform(uint32_t state[8], const uint8_t data[SHA256_BLOCK_LENGTH])
 #undef s1
 #undef R
 
+#ifdef SHA2_X86_SHA
+/*
+ * Message schedule and rounds for the x86 SHA extensions.
+ * The state is kept as ABEF and CDGH, as sha256rnds2 expects.
+ */
+#define SCHED(w0, w1, w2, w3) do {					\
+	w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1), \
+	    _mm_alignr_epi8(w3, w2, 4)), w3);				\
+} while (0)
+#define LOAD(p)	_mm_loadu_si128((const __m128i *)(p))
+#define ROUNDS(w, k) do {						\
+	MSG = _mm_add_epi32(w, LOAD(&SHA256_K[k]));			\
+	STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);		\
+	MSG = _mm_shuffle_epi32(MSG, 0x0E);				\
+	STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);		\
+} while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void
+SHA256Transform_x86(uint32_t state[8], const uint8_t *data, size_t nblocks)
+{
+	const __m128i MASK =
+	    _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i STATE0, STATE1, ABEF, CDGH, MSG, TMP;
+	__m128i W0, W1, W2, W3;
+	unsigned int j;
+
+	/* Convert state from ABCD EFGH to ABEF CDGH. */
+	TMP = _mm_shuffle_epi32(LOAD(&state[0]), 0xB1);
+	STATE1 = _mm_shuffle_epi32(LOAD(&state[4]), 0x1B);
+	STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);
+	STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);
+
+	while (nblocks--) {
+		ABEF = STATE0;
+		CDGH = STATE1;
+
+		/* Load data in big endian format. */
+		W0 = _mm_shuffle_epi8(LOAD(data + 0), MASK);
+		W1 = _mm_shuffle_epi8(LOAD(data + 16), MASK);
+		W2 = _mm_shuffle_epi8(LOAD(data + 32), MASK);
+		W3 = _mm_shuffle_epi8(LOAD(data + 48), MASK);
+		data += SHA256_BLOCK_LENGTH;
+
+		/* 64 rounds, four at a time. */
+		ROUNDS(W0, 0);
+		ROUNDS(W1, 4);
+		ROUNDS(W2, 8);
+		ROUNDS(W3, 12);
+		for (j = 16; j < 64; j += 16) {
+			SCHED(W0, W1, W2, W3); ROUNDS(W0, j);
+			SCHED(W1, W2, W3, W0); ROUNDS(W1, j + 4);
+			SCHED(W2, W3, W0, W1); ROUNDS(W2, j + 8);
+			SCHED(W3, W0, W1, W2); ROUNDS(W3, j + 12);
+		}
+
+		STATE0 = _mm_add_epi32(STATE0, ABEF);
+		STATE1 = _mm_add_epi32(STATE1, CDGH);
+	}
+
+	/* Convert state back to ABCD EFGH. */
+	TMP = _mm_shuffle_epi32(STATE0, 0x1B);
+	STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);
+	STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);
+	STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);
+	_mm_storeu_si128((__m128i *)&state[0], STATE0);
+	_mm_storeu_si128((__m128i *)&state[4], STATE1);
+}
+
+#undef SCHED
+#undef LOAD
+#undef ROUNDS
+
+/*
+ * Check for the SHA extensions and SSE4.1 (which implies SSSE3).
+ */
+static int
+sha2_have_x86_sha(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid(1, eax, ebx, ecx, edx);
+	if ((ecx & bit_SSE4_1) == 0)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return (ebx & bit_SHA) != 0;
+}
+#endif /* SHA2_X86_SHA */
+
+#ifdef SHA2_ARMV8_SHA2
+/*
+ * Message schedule and rounds for the ARMv8 SHA-2 instructions.
+ */
+#define SCHED(w0, w1, w2, w3) do {					\
+	w0 = vsha256su1q_u32(vsha256su0q_u32(w0, w1), w2, w3);		\
+} while (0)
+#define ROUNDS(w, k) do {						\
+	MSG = vaddq_u32(w, vld1q_u32(&SHA256_K[k]));			\
+	TMP = STATE0;							\
+	STATE0 = vsha256hq_u32(STATE0, STATE1, MSG);			\
+	STATE1 = vsha256h2q_u32(STATE1, TMP, MSG);			\
+} while (0)
+
+SHA2_ARMV8_TARGET
+static void
+SHA256Transform_armv8(uint32_t state[8], const uint8_t *data, size_t nblocks)
+{
+	uint32x4_t STATE0, STATE1, ABCD, EFGH, MSG, TMP;
+	uint32x4_t W0, W1, W2, W3;
+	unsigned int j;
+
+	STATE0 = vld1q_u32(&state[0]);
+	STATE1 = vld1q_u32(&state[4]);
+
+	while (nblocks--) {
+		ABCD = STATE0;
+		EFGH = STATE1;
+
+		/* Load data in big endian format. */
+		W0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+		W1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+		W2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+		W3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+		data += SHA256_BLOCK_LENGTH;
+
+		/* 64 rounds, four at a time. */
+		ROUNDS(W0, 0);
+		ROUNDS(W1, 4);
+		ROUNDS(W2, 8);
+		ROUNDS(W3, 12);
+		for (j = 16; j < 64; j += 16) {
+			SCHED(W0, W1, W2, W3); ROUNDS(W0, j);
+			SCHED(W1, W2, W3, W0); ROUNDS(W1, j + 4);
+			SCHED(W2, W3, W0, W1); ROUNDS(W2, j + 8);
+			SCHED(W3, W0, W1, W2); ROUNDS(W3, j + 12);
+		}
+
+		STATE0 = vaddq_u32(STATE0, ABCD);
+		STATE1 = vaddq_u32(STATE1, EFGH);
+	}
+
+	vst1q_u32(&state[0], STATE0);
+	vst1q_u32(&state[4], STATE1);
+}
+
+#undef SCHED
+#undef ROUNDS
+
+/*
+ * Check for the SHA-2 instructions.
+ */
+static int
+sha2_have_armv8_sha2(void)
+{
+#ifdef SHA2_ARMV8_HWCAP
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#else
+	return 1;
+#endif
+}
+#endif /* SHA2_ARMV8_SHA2 */
+
+static void SHA256Transform_resolve(uint32_t state[8], const uint8_t *data,
+    size_t nblocks);
+
+static void (*sha256_transform)(uint32_t state[8], const uint8_t *data,
+    size_t nblocks) = SHA256Transform_resolve;
+
+/*
+ * Select the SHA-256 transform to use; if accel is zero, the
+ * generic version is always used.
+ * Returns the name of the selected implementation.
+ */
+const char *
+sudo_SHA256SetImpl(int accel)
+{
+	if (accel) {
+#ifdef SHA2_X86_SHA
+		if (sha2_have_x86_sha()) {
+			sha256_transform = SHA256Transform_x86;
+			return "x86-sha";
+		}
+#endif
+#ifdef SHA2_ARMV8_SHA2
+		if (sha2_have_armv8_sha2()) {
+			sha256_transform = SHA256Transform_armv8;
+			return "armv8-sha2";
+		}
+#endif
+	}
+	sha256_transform = SHA256Transform_generic;
+	return "generic";
+}
+
+/*
+ * Pick the best transform on first use.
+ */
+static void
+SHA256Transform_resolve(uint32_t state[8], const uint8_t *data, size_t nblocks)
+{
+	sudo_SHA256SetImpl(1);
+	sha256_transform(state, data, nblocks);
+}
+
+void
+SHA256Transform(uint32_t state[8], const uint8_t data[SHA256_BLOCK_LENGTH])
+{
+	sha256_transform(state, data, 1);
+}
+
 void
 SHA256Update(SHA2_CTX *ctx, const uint8_t *data, size_t len)
 {
@@ -256,9 +506,13 @@ SHA256Update(SHA2_CTX *ctx, const uint8_t *data, size_t len)
 	ctx->count[0] += ((uint64_t)len << 3);
 	if ((j + len) > SHA256_BLOCK_LENGTH - 1) {
 		memcpy(&ctx->buffer[j], data, (i = SHA256_BLOCK_LENGTH - j));
-		SHA256Transform(ctx->state.st32, ctx->buffer);
-		for ( ; i + SHA256_BLOCK_LENGTH - 1 < len; i += SHA256_BLOCK_LENGTH)
-			SHA256Transform(ctx->state.st32, (uint8_t *)&data[i]);
+		sha256_transform(ctx->state.st32, ctx->buffer, 1);
+		/* Hash all remaining whole blocks in a single call. */
+		if (len - i >= SHA256_BLOCK_LENGTH) {
+			size_t nblocks = (len - i) / SHA256_BLOCK_LENGTH;
+			sha256_transform(ctx->state.st32, &data[i], nblocks);
+			i += nblocks * SHA256_BLOCK_LENGTH;
+		}
 		j = 0;
 	}
 	memcpy(&ctx->buffer[j], &data[i], len - i);
@@ -268,16 +522,17 @@ void
 SHA256Pad(SHA2_CTX *ctx)
 {
 	uint8_t finalcount[8];
+	size_t used;
 
 	/* Store unpadded message length in bits in big endian format. */
 	BE64TO8(finalcount, ctx->count[0]);
 
-	/* Append a '1' bit (0x80) to the message. */
-	SHA256Update(ctx, (uint8_t *)"\200", 1);
-
-	/* Pad message such that the resulting length modulo 512 is 448. */
-	while ((ctx->count[0] & 504) != 448)
-		SHA256Update(ctx, (uint8_t *)"\0", 1);
+	/*
+	 * Append a '1' bit (0x80) to the message, then pad message such
+	 * that the resulting length modulo 512 is 448.
+	 */
+	used = (size_t)((ctx->count[0] >> 3) & (SHA256_BLOCK_LENGTH - 1));
+	SHA256Update(ctx, sha2_padding, (used < 56 ? 56 : 120) - used);
 
 	/* Append length of message in bits and do final SHA256Transform(). */
 	SHA256Update(ctx, finalcount, sizeof(finalcount));
@@ -481,17 +736,18 @@ void
 SHA512Pad(SHA2_CTX *ctx)
 {
 	uint8_t finalcount[16];
+	size_t used;
 
 	/* Store unpadded message length in bits in big endian format. */
 	BE64TO8(finalcount, ctx->count[1]);
 	BE64TO8(finalcount + 8, ctx->count[0]);
 
-	/* Append a '1' bit (0x80) to the message. */
-	SHA512Update(ctx, (uint8_t *)"\200", 1);
-
-	/* Pad message such that the resulting length modulo 1024 is 896. */
-	while ((ctx->count[0] & 1008) != 896)
-		SHA512Update(ctx, (uint8_t *)"\0", 1);
+	/*
+	 * Append a '1' bit (0x80) to the message, then pad message such
+	 * that the resulting length modulo 1024 is 896.
+	 */
+	used = (size_t)((ctx->count[0] >> 3) & (SHA512_BLOCK_LENGTH - 1));
+	SHA512Update(ctx, sha2_padding, (used < 112 ? 112 : 240) - used);
 
 	/* Append length of message in bits and do final SHA512Transform(). */
 	SHA512Update(ctx, finalcount, sizeof(finalcount));
@@ -662,12 +662,60 @@ iolog_close_all(struct connection_closure *closure)
 		"error closing iofd %d: %s", i, errstr);
 	}
     }
+    if (closure->iolog_index_fd != -1)
+	close(closure->iolog_index_fd);
     if (closure->iolog_dir_fd != -1)
 	close(closure->iolog_dir_fd);
 
     debug_return;
 }
 
+/*
+ * Flush all open I/O log files and, if sync is set, wait for them to
+ * reach stable storage.  The timing file is committed last so it never
+ * refers to data that has not been committed.
+ * If the last timing record advanced the elapsed time, the commit
+ * point is also recorded in the I/O log index.
+ */
+bool
+iolog_commit_all(struct connection_closure *closure, bool sync)
+{
+    const char *errstr;
+    int i;
+    debug_decl(iolog_commit_all, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < IOFD_MAX; i++) {
+	if (!closure->iolog_files[i].enabled)
+	    continue;
+	if (!iolog_commit(&closure->iolog_files[i], sync, &errstr)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to commit %s/%s: %s", closure->evlog->iolog_path,
+		iolog_fd_to_name(i), errstr);
+	    debug_return_bool(false);
+	}
+    }
+
+    /*
+     * Only index the first record to reach a given elapsed time, which
+     * is where iolog_seekto() stops when searching for a resume point.
+     */
+    if (closure->iolog_index_fd != -1 && closure->index_point) {
+	if (!iolog_index_write(closure->iolog_index_fd, closure->iolog_files,
+		&closure->elapsed_time, sync, &errstr)) {
+	    /* The index is optional but a partial record would corrupt it. */
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to write %s/%s: %s", closure->evlog->iolog_path,
+		IOLOG_INDEX_NAME, errstr);
+	    close(closure->iolog_index_fd);
+	    closure->iolog_index_fd = -1;
+	    (void)unlinkat(closure->iolog_dir_fd, IOLOG_INDEX_NAME, 0);
+	}
+	closure->index_point = false;
+    }
+
+    debug_return_bool(true);
+}
+
 bool
 iolog_init(AcceptMessage *msg, struct connection_closure *closure)
 {
@@ -692,6 +740,9 @@ iolog_init(AcceptMessage *msg, struct connection_closure *closure)
 	!iolog_create(IOFD_TTYOUT, closure))
 	debug_return_bool(false);
 
+    /* The index is not required, we can restart without it. */
+    closure->iolog_index_fd = iolog_index_open(closure->iolog_dir_fd, true);
+
     /* Ready to log I/O buffers. */
     debug_return_bool(true);
 }
@@ -727,23 +778,41 @@ iolog_copy(struct iolog_file *src, struct iolog_file *dst, off_t remainder,
     debug_return_bool(true);
 }
 
-/* Compressed logs don't support random access, need to rewrite them. */
+/* Old-style compressed logs don't support random access, rewrite them. */
 static bool
 iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 {
     const struct eventlog *evlog = closure->evlog;
     struct iolog_file new_iolog_files[IOFD_MAX];
     off_t iolog_file_sizes[IOFD_MAX] = { 0 };
+    struct iolog_index_entry entry;
     struct timing_closure timing;
     int iofd, len, tmpdir_fd = -1;
     const char *name, *errstr;
     char tmpdir[PATH_MAX];
+    bool indexed = false;
     bool ret = false;
     debug_decl(iolog_rewrite, SUDO_DEBUG_UTIL);
 
+    /* Start from the closest indexed point, if any. */
+    if (iolog_index_lookup(closure->iolog_dir_fd, target, &entry)) {
+	off_t timing_offset = entry.files[IOFD_TIMING].offset;
+
+	if (timing_offset != -1 && iolog_seek(&closure->iolog_files[IOFD_TIMING],
+		timing_offset, SEEK_SET) == timing_offset) {
+	    for (iofd = 0; iofd < IOFD_TIMING; iofd++) {
+		if (entry.files[iofd].offset != -1)
+		    iolog_file_sizes[iofd] = entry.files[iofd].offset;
+	    }
+	    closure->elapsed_time = entry.elapsed;
+	    indexed = sudo_timespeccmp(&entry.elapsed, target, ==);
+	} else {
+	    iolog_rewind(&closure->iolog_files[IOFD_TIMING]);
+	}
+    }
+
     /* Parse timing file until we reach the target point. */
-    /* TODO: use iolog_seekto with a callback? */
-    for (;;) {
+    while (!indexed) {
 	/* Read next record from timing file. */
 	if (iolog_read_timing_record(&closure->iolog_files[IOFD_TIMING], &timing) != 0)
 	    goto done;
@@ -862,6 +931,9 @@ iolog_rewrite(const struct timespec *target, struct connection_closure *closure)
 	new_iolog_files[iofd].enabled = false;
     }
 
+    /* Compressed offsets in the old index no longer apply. */
+    closure->iolog_index_fd = iolog_index_open(closure->iolog_dir_fd, true);
+
     /* Ready to log I/O buffers. */
     ret = true;
 done:
@@ -884,7 +956,9 @@ bool
 iolog_restart(RestartMessage *msg, struct connection_closure *closure)
 {
     struct eventlog *evlog = closure->evlog;
+    struct iolog_index_entry entry;
     struct timespec target;
+    const char *errstr;
     struct stat sb;
     int iofd;
     debug_decl(iolog_restart, SUDO_DEBUG_UTIL);
@@ -920,14 +994,33 @@ iolog_restart(RestartMessage *msg, struct connection_closure *closure)
 	goto bad;
     }
 
+    /*
+     * If the resume point is in the index we can truncate the logs
+     * there and append to them without reading the timing file.
+     */
+    if (iolog_index_lookup(closure->iolog_dir_fd, &target, &entry) &&
+	    sudo_timespeccmp(&entry.elapsed, &target, ==)) {
+	if (!iolog_index_restore(closure->iolog_dir_fd, &entry,
+		closure->iolog_files, &closure->iolog_index_fd))
+	    goto bad;
+	closure->elapsed_time = target;
+
+	/* Ready to log I/O buffers. */
+	debug_return_bool(true);
+    }
+
     /* Open existing I/O log files. */
     if (!iolog_open_all(closure->iolog_dir_fd, evlog->iolog_path,
 	    closure->iolog_files, "r+"))
 	goto bad;
 
-    /* Compressed logs don't support random access, so rewrite them. */
+    /*
+     * Compressed logs written by older versions of sudo are a single
+     * gzip stream that doesn't support random access, so rewrite them.
+     */
     for (iofd = 0; iofd < IOFD_MAX; iofd++) {
-	if (closure->iolog_files[iofd].compressed)
+	struct iolog_file *iol = &closure->iolog_files[iofd];
+	if (iol->compressed && !iol->blocked)
 	    debug_return_bool(iolog_rewrite(&target, closure));
     }
 
@@ -937,12 +1030,28 @@ iolog_restart(RestartMessage *msg, struct connection_closure *closure)
 	goto bad;
 
     /* Must seek or flush before switching from read -> write. */
-    if (iolog_seek(&closure->iolog_files[IOFD_TIMING], 0, SEEK_CUR) == -1) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
-	    "lseek(IOFD_TIMING, 0, SEEK_CUR)");
-	goto bad;
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	struct iolog_file *iol = &closure->iolog_files[iofd];
+
+	if (!iol->enabled)
+	    continue;
+	if ((iol->nbytes = iolog_seek(iol, 0, SEEK_CUR)) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"lseek(%s, 0, SEEK_CUR)", iolog_fd_to_name(iofd));
+	    goto bad;
+	}
+	/* Discard stale data past the resume point. */
+	if (!iolog_truncate(iol, &errstr)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to truncate %s at %lld: %s", iolog_fd_to_name(iofd),
+		(long long)iol->nbytes, errstr);
+	    goto bad;
+	}
     }
 
+    /* Index entries past the resume point are stale. */
+    closure->iolog_index_fd = iolog_index_open(closure->iolog_dir_fd, true);
+
     /* Ready to log I/O buffers. */
     debug_return_bool(true);
 bad:
@@ -954,12 +1063,16 @@ bad:
 /*
  * Add given delta to elapsed time.
  * We cannot use timespecadd here since delta is not struct timespec.
+ * A record that advances the elapsed time may be indexed.
  */
 static void
-update_elapsed_time(TimeSpec *delta, struct timespec *elapsed)
+update_elapsed_time(TimeSpec *delta, struct connection_closure *closure)
 {
+    struct timespec *elapsed = &closure->elapsed_time;
     debug_decl(update_elapsed_time, SUDO_DEBUG_UTIL);
 
+    closure->index_point = delta->tv_sec != 0 || delta->tv_nsec != 0;
+
     /* Cannot use timespecadd since msg doesn't use struct timespec. */
     elapsed->tv_sec += delta->tv_sec;
     elapsed->tv_nsec += delta->tv_nsec;
@@ -1015,7 +1128,7 @@ store_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure)
 	debug_return_int(-1);
     }
 
-    update_elapsed_time(msg->delay, &closure->elapsed_time);
+    update_elapsed_time(msg->delay, closure);
 
     debug_return_int(0);
 }
@@ -1049,7 +1162,7 @@ store_suspend(CommandSuspend *msg, struct connection_closure *closure)
 	debug_return_int(-1);
     }
 
-    update_elapsed_time(msg->delay, &closure->elapsed_time);
+    update_elapsed_time(msg->delay, closure);
 
     debug_return_int(0);
 }
@@ -1082,7 +1195,7 @@ store_winsize(ChangeWindowSize *msg, struct connection_closure *closure)
 	debug_return_int(-1);
     }
 
-    update_elapsed_time(msg->delay, &closure->elapsed_time);
+    update_elapsed_time(msg->delay, closure);
 
     debug_return_int(0);
 }
@@ -0,0 +1,1436 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Local log server multiplexer.
+ *
+ * Accepts log server protocol connections from sudo on a local socket
+ * and forwards them as sessions over a single persistent connection
+ * to the log server.  Client messages are passed through unchanged
+ * except for the addition of the session ID; server messages are
+ * routed back to the local client based on their session ID.
+ */
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <signal.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifndef HAVE_GETADDRINFO
+# include "compat/getaddrinfo.h"
+#endif
+#ifdef HAVE_GETOPT_LONG
+# include <getopt.h>
+# else
+# include "compat/getopt.h"
+#endif /* HAVE_GETOPT_LONG */
+
+#if defined(HAVE_OPENSSL)
+# include <openssl/ssl.h>
+# include <openssl/err.h>
+#endif
+
+#include "pathnames.h"
+#include "sudo_compat.h"
+#include "sudo_conf.h"
+#include "sudo_debug.h"
+#include "sudo_event.h"
+#include "sudo_fatal.h"
+#include "sudo_gettext.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+
+#include "hostcheck.h"
+#include "log_server.pb-c.h"
+#include "logmuxd.h"
+
+/* Wire format tag of the ClientMessage session_id field (varint). */
+#define SESSION_ID_TAG	((14 << 3) | 0)
+
+static struct logmux_conn_list sessions = TAILQ_HEAD_INITIALIZER(sessions);
+static struct connection_buffer_list free_bufs =
+    TAILQ_HEAD_INITIALIZER(free_bufs);
+static struct logmux_conn *upstream;
+static struct sudo_event *listen_ev;
+static uint32_t next_session_id;
+static char *upstream_server_id;
+static const char client_id[] = "Sudo Log Multiplexer " PACKAGE_VERSION;
+static const char *socket_path = _PATH_SUDO_LOGMUXD_SOCK;
+static const char *server_name = "localhost";
+static const char *server_port;
+#if defined(HAVE_STRUCT_IN6_ADDR)
+static char server_ip[INET6_ADDRSTRLEN];
+#else
+static char server_ip[INET_ADDRSTRLEN];
+#endif
+
+#if defined(HAVE_OPENSSL)
+static SSL_CTX *ssl_ctx = NULL;
+static const char *ca_bundle = NULL;
+static const char *cert = NULL;
+static const char *key = NULL;
+static bool verify_server = true;
+#endif
+
+static void conn_read_cb(int fd, int what, void *v);
+static void conn_write_cb(int fd, int what, void *v);
+
+static void
+usage(bool fatal)
+{
+#if defined(HAVE_OPENSSL)
+    fprintf(stderr, "usage: %s [-nV] [-b ca_bundle] [-c cert_file] [-h host] "
+	"[-k key_file] [-p port] [-s socket]\n",
+#else
+    fprintf(stderr, "usage: %s [-V] [-h host] [-p port] [-s socket]\n",
+#endif
+        getprogname());
+    if (fatal)
+	exit(EXIT_FAILURE);
+}
+
+static void
+help(void)
+{
+    printf("%s - %s\n\n", getprogname(),
+	_("multiplex local sudo log connections to a log server"));
+    usage(false);
+    printf("\n%s\n", _("Options:"));
+    printf("      --help            %s\n",
+	_("display help message and exit"));
+#if defined(HAVE_OPENSSL)
+    printf("  -b, --ca-bundle       %s\n",
+	_("certificate bundle file to verify server's cert against"));
+    printf("  -c, --cert            %s\n",
+	_("certificate file for TLS handshake"));
+#endif
+    printf("  -h, --host            %s\n",
+	_("host to send logs to"));
+#if defined(HAVE_OPENSSL)
+    printf("  -k, --key             %s\n",
+	_("private key file"));
+    printf("  -n, --no-verify       %s\n",
+	_("do not verify server certificate"));
+#endif
+    printf("  -p, --port            %s\n",
+	_("port to use when connecting to host"));
+    printf("  -s, --socket          %s\n",
+	_("path of the local socket to listen on"));
+    printf("  -V, --version         %s\n",
+	_("display version information and exit"));
+    putchar('\n');
+    exit(EXIT_SUCCESS);
+}
+
+static struct connection_buffer *
+get_free_buf(void)
+{
+    struct connection_buffer *buf;
+    debug_decl(get_free_buf, SUDO_DEBUG_UTIL);
+
+    buf = TAILQ_FIRST(&free_bufs);
+    if (buf != NULL)
+	TAILQ_REMOVE(&free_bufs, buf, entries);
+    else
+	buf = calloc(1, sizeof(*buf));
+
+    debug_return_ptr(buf);
+}
+
+/*
+ * Free a connection and its contents.
+ * Write buffers are returned to the free list for reuse.
+ */
+static void
+logmux_conn_free(struct logmux_conn *conn)
+{
+    struct connection_buffer *buf;
+    debug_decl(logmux_conn_free, SUDO_DEBUG_UTIL);
+
+    if (conn == NULL)
+	debug_return;
+
+    if (conn->upstream) {
+	upstream = NULL;
+    } else {
+	TAILQ_REMOVE(&sessions, conn, entries);
+    }
+#if defined(HAVE_OPENSSL)
+    if (conn->ssl != NULL) {
+	SSL_shutdown(conn->ssl);
+	SSL_free(conn->ssl);
+    }
+#endif
+    if (conn->sock != -1)
+	close(conn->sock);
+    sudo_ev_free(conn->read_ev);
+    sudo_ev_free(conn->write_ev);
+    free(conn->read_buf.data);
+    while ((buf = TAILQ_FIRST(&conn->write_bufs)) != NULL) {
+	TAILQ_REMOVE(&conn->write_bufs, buf, entries);
+	buf->len = 0;
+	buf->off = 0;
+	TAILQ_INSERT_TAIL(&free_bufs, buf, entries);
+    }
+    free(conn);
+
+    debug_return;
+}
+
+static struct logmux_conn *
+logmux_conn_alloc(int sock, bool is_upstream, struct sudo_event_base *base)
+{
+    struct logmux_conn *conn;
+    debug_decl(logmux_conn_alloc, SUDO_DEBUG_UTIL);
+
+    if ((conn = calloc(1, sizeof(*conn))) == NULL)
+	debug_return_ptr(NULL);
+
+    conn->sock = sock;
+    conn->upstream = is_upstream;
+    conn->evbase = base;
+    TAILQ_INIT(&conn->write_bufs);
+    if (is_upstream)
+	upstream = conn;
+    else
+	TAILQ_INSERT_TAIL(&sessions, conn, entries);
+
+    conn->read_buf.size = 64 * 1024;
+    conn->read_buf.data = malloc(conn->read_buf.size);
+    if (conn->read_buf.data == NULL)
+	goto bad;
+
+    conn->read_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	conn_read_cb, conn);
+    if (conn->read_ev == NULL)
+	goto bad;
+
+    conn->write_ev = sudo_ev_alloc(sock, SUDO_EV_WRITE|SUDO_EV_PERSIST,
+	conn_write_cb, conn);
+    if (conn->write_ev == NULL)
+	goto bad;
+
+    debug_return_ptr(conn);
+bad:
+    logmux_conn_free(conn);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Append a wire message to the connection's write queue.
+ * If session_id is non-zero, it is appended to the message as the
+ * ClientMessage session_id field.  Since protobuf fields may appear
+ * in any order, the message does not need to be unpacked.
+ */
+static bool
+queue_message(struct logmux_conn *conn, const uint8_t *data, size_t len,
+    uint32_t session_id)
+{
+    struct connection_buffer *buf;
+    uint8_t idbuf[1 + 5];
+    size_t idlen = 0;
+    uint32_t msg_len;
+    debug_decl(queue_message, SUDO_DEBUG_UTIL);
+
+    if (session_id != 0) {
+	idbuf[idlen++] = SESSION_ID_TAG;
+	do {
+	    idbuf[idlen] = session_id & 0x7f;
+	    session_id >>= 7;
+	    if (session_id != 0)
+		idbuf[idlen] |= 0x80;
+	    idlen++;
+	} while (session_id != 0);
+    }
+
+    if (len + idlen > MESSAGE_SIZE_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "message too large: %zu", len + idlen);
+	debug_return_bool(false);
+    }
+
+    if ((buf = get_free_buf()) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    if (!expand_buf(buf, sizeof(msg_len) + len + idlen)) {
+	TAILQ_INSERT_TAIL(&free_bufs, buf, entries);
+	debug_return_bool(false);
+    }
+
+    /* Wire message size is used for length encoding, precedes message. */
+    msg_len = htonl((uint32_t)(len + idlen));
+    memcpy(buf->data, &msg_len, sizeof(msg_len));
+    if (len != 0)
+	memcpy(buf->data + sizeof(msg_len), data, len);
+    if (idlen != 0)
+	memcpy(buf->data + sizeof(msg_len) + len, idbuf, idlen);
+    buf->len = sizeof(msg_len) + len + idlen;
+    buf->off = 0;
+    TAILQ_INSERT_TAIL(&conn->write_bufs, buf, entries);
+
+    /* Schedule a write if one is not already pending. */
+    conn->temporary_write_event = false;
+    if (!sudo_ev_pending(conn->write_ev, SUDO_EV_WRITE, NULL)) {
+	if (sudo_ev_add(conn->evbase, conn->write_ev, NULL, false) == -1) {
+	    sudo_warnx("%s", U_("unable to add event to queue"));
+	    debug_return_bool(false);
+	}
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Pack a ServerMessage and queue it for a local client.
+ */
+static bool
+queue_server_message(struct logmux_conn *conn, ServerMessage *msg)
+{
+    uint8_t *data;
+    size_t len;
+    bool ret;
+    debug_decl(queue_server_message, SUDO_DEBUG_UTIL);
+
+    len = server_message__get_packed_size(msg);
+    if ((data = malloc(len ? len : 1)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    server_message__pack(msg, data);
+    ret = queue_message(conn, data, len, 0);
+    free(data);
+
+    debug_return_bool(ret);
+}
+
+static bool
+queue_error_message(struct logmux_conn *conn, const char *errstr)
+{
+    ServerMessage msg = SERVER_MESSAGE__INIT;
+    debug_decl(queue_error_message, SUDO_DEBUG_UTIL);
+
+    msg.u.error = (char *)errstr;
+    msg.type_case = SERVER_MESSAGE__TYPE_ERROR;
+
+    debug_return_bool(queue_server_message(conn, &msg));
+}
+
+/*
+ * Close a local session once its pending messages have been written.
+ */
+static void
+session_close(struct logmux_conn *conn)
+{
+    debug_decl(session_close, SUDO_DEBUG_UTIL);
+
+    conn->closing = true;
+    sudo_ev_del(conn->evbase, conn->read_ev);
+    if (TAILQ_EMPTY(&conn->write_bufs))
+	logmux_conn_free(conn);
+
+    debug_return;
+}
+
+/*
+ * The upstream connection is gone, fail all active sessions.
+ * A new connection will be made for the next local client.
+ */
+static void
+upstream_lost(const char *errstr)
+{
+    struct logmux_conn *conn, *next;
+    debug_decl(upstream_lost, SUDO_DEBUG_UTIL);
+
+    sudo_warnx(U_("lost connection to log server: %s"), errstr);
+    logmux_conn_free(upstream);
+
+    TAILQ_FOREACH_SAFE(conn, &sessions, entries, next) {
+	if (conn->closing)
+	    continue;
+	if (!queue_error_message(conn, errstr)) {
+	    logmux_conn_free(conn);
+	    continue;
+	}
+	session_close(conn);
+    }
+
+    debug_return;
+}
+
+/*
+ * Connect to specified host:port
+ * If host has multiple addresses, the first one that connects is used.
+ * Returns open socket or -1 on error.
+ */
+static int
+connect_server(const char *host, const char *port)
+{
+    struct addrinfo hints, *res, *res0;
+    const char *addr, *cause = "getaddrinfo";
+    int error, sock, save_errno;
+    debug_decl(connect_server, SUDO_DEBUG_UTIL);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    error = getaddrinfo(host, port, &hints, &res0);
+    if (error != 0) {
+	sudo_warnx(U_("unable to look up %s:%s: %s"), host, port,
+	    gai_strerror(error));
+	debug_return_int(-1);
+    }
+
+    sock = -1;
+    for (res = res0; res; res = res->ai_next) {
+	sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (sock == -1) {
+	    cause = "socket";
+	    continue;
+	}
+	if (connect(sock, res->ai_addr, res->ai_addrlen) == -1) {
+	    cause = "connect";
+	    save_errno = errno;
+	    close(sock);
+	    errno = save_errno;
+	    sock = -1;
+	    continue;
+	}
+	switch (res->ai_family) {
+	case AF_INET:
+	    addr = (char *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
+	    break;
+	case AF_INET6:
+	    addr = (char *)&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
+	    break;
+	default:
+	    cause = "ai_family";
+	    save_errno = EAFNOSUPPORT;
+	    close(sock);
+	    errno = save_errno;
+	    sock = -1;
+	    continue;
+	}
+	if (inet_ntop(res->ai_family, addr, server_ip,
+		sizeof(server_ip)) == NULL) {
+	    sudo_warnx("%s", U_("unable to get server IP addr"));
+	}
+	break;	/* success */
+    }
+    freeaddrinfo(res0);
+
+    if (sock == -1)
+	sudo_warn("%s", cause);
+
+    debug_return_int(sock);
+}
+
+#if defined(HAVE_OPENSSL)
+/*
+ * Check that the server's certificate is valid and that it contains
+ * the server name or IP address.
+ * Returns 0 if the cert is invalid, else 1.
+ */
+static int
+verify_peer_identity(int preverify_ok, X509_STORE_CTX *ctx)
+{
+    X509 *current_cert;
+    X509 *peer_cert;
+    debug_decl(verify_peer_identity, SUDO_DEBUG_UTIL);
+
+    /* if pre-verification of the cert failed, just propagate that result back */
+    if (preverify_ok != 1) {
+        debug_return_int(0);
+    }
+
+    /* since this callback is called for each cert in the chain,
+     * check that current cert is the peer's certificate
+     */
+    current_cert = X509_STORE_CTX_get_current_cert(ctx);
+    peer_cert = X509_STORE_CTX_get0_cert(ctx);
+    if (current_cert != peer_cert) {
+        debug_return_int(1);
+    }
+
+    if (validate_hostname(peer_cert, server_name, server_ip, 0) == MatchFound) {
+        debug_return_int(1);
+    }
+
+    debug_return_int(0);
+}
+
+static SSL_CTX *
+init_tls_client_context(const char *ca_bundle_file, const char *cert_file, const char *key_file)
+{
+    const SSL_METHOD *method;
+    SSL_CTX *ctx = NULL;
+    debug_decl(init_tls_client_context, SUDO_DEBUG_UTIL);
+
+    SSL_library_init();
+    OpenSSL_add_all_algorithms();
+    SSL_load_error_strings();
+
+    if ((method = TLS_client_method()) == NULL) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "creation of SSL_METHOD failed: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+    if ((ctx = SSL_CTX_new(method)) == NULL) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "creation of new SSL_CTX object failed: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+#ifdef HAVE_SSL_CTX_SET_MIN_PROTO_VERSION
+    if (!SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION)) {
+        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+            "unable to restrict min. protocol version: %s",
+            ERR_error_string(ERR_get_error(), NULL));
+        goto bad;
+    }
+#else
+    SSL_CTX_set_options(ctx,
+        SSL_OP_NO_SSLv2|SSL_OP_NO_SSLv3|SSL_OP_NO_TLSv1|SSL_OP_NO_TLSv1_1);
+#endif
+
+    if (cert_file) {
+        if (!SSL_CTX_use_certificate_chain_file(ctx, cert_file)) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "unable to load cert to the ssl context: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+        if (!SSL_CTX_use_PrivateKey_file(ctx, key_file, X509_FILETYPE_PEM)) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "unable to load key to the ssl context: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+    }
+
+    if (ca_bundle_file != NULL) {
+        /* sets the location of the CA bundle file for verification purposes */
+        if (SSL_CTX_load_verify_locations(ctx, ca_bundle_file, NULL) <= 0) {
+            sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+                "calling SSL_CTX_load_verify_locations() failed: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+            goto bad;
+        }
+    }
+
+    if (verify_server) {
+        /* verify server cert during the handshake */
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_peer_identity);
+    }
+
+    goto done;
+
+bad:
+    SSL_CTX_free(ctx);
+    ctx = NULL;
+
+done:
+    debug_return_ptr(ctx);
+}
+#endif /* HAVE_OPENSSL */
+
+/*
+ * Blocking send of len bytes to the upstream server.
+ * Only used while setting up the connection.
+ */
+static bool
+upstream_send_all(struct logmux_conn *conn, const uint8_t *data, size_t len)
+{
+    ssize_t nwritten;
+    debug_decl(upstream_send_all, SUDO_DEBUG_UTIL);
+
+    while (len > 0) {
+#if defined(HAVE_OPENSSL)
+	if (conn->ssl != NULL) {
+	    nwritten = SSL_write(conn->ssl, data, len);
+	    if (nwritten <= 0) {
+		sudo_warnx("send: %s",
+		    ERR_reason_error_string(ERR_get_error()));
+		debug_return_bool(false);
+	    }
+	} else
+#endif
+	{
+	    nwritten = send(conn->sock, data, len, 0);
+	    if (nwritten == -1) {
+		if (errno == EINTR)
+		    continue;
+		sudo_warn("send");
+		debug_return_bool(false);
+	    }
+	}
+	data += nwritten;
+	len -= nwritten;
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Blocking receive of exactly len bytes from the upstream server.
+ * Only used while setting up the connection.
+ */
+static bool
+upstream_recv_all(struct logmux_conn *conn, uint8_t *data, size_t len)
+{
+    ssize_t nread;
+    debug_decl(upstream_recv_all, SUDO_DEBUG_UTIL);
+
+    while (len > 0) {
+#if defined(HAVE_OPENSSL)
+	if (conn->ssl != NULL) {
+	    nread = SSL_read(conn->ssl, data, len);
+	    if (nread <= 0) {
+		sudo_warnx("recv: %s",
+		    ERR_reason_error_string(ERR_get_error()));
+		debug_return_bool(false);
+	    }
+	} else
+#endif
+	{
+	    nread = recv(conn->sock, data, len, 0);
+	    if (nread == -1 && errno == EINTR)
+		continue;
+	    if (nread <= 0) {
+		if (nread == 0)
+		    sudo_warnx("%s", U_("premature EOF"));
+		else
+		    sudo_warn("recv");
+		debug_return_bool(false);
+	    }
+	}
+	data += nread;
+	len -= nread;
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Exchange hello messages with the server and make sure it
+ * supports multiplexed sessions.
+ */
+static bool
+upstream_hello(struct logmux_conn *conn)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    ClientHello hello = CLIENT_HELLO__INIT;
+    ServerMessage *msg = NULL;
+    uint8_t *data = NULL;
+    uint32_t msg_len;
+    size_t len;
+    bool ret = false;
+    debug_decl(upstream_hello, SUDO_DEBUG_UTIL);
+
+    hello.client_id = (char *)client_id;
+    client_msg.u.hello_msg = &hello;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
+
+    len = client_message__get_packed_size(&client_msg);
+    if ((data = malloc(sizeof(msg_len) + len)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    msg_len = htonl((uint32_t)len);
+    memcpy(data, &msg_len, sizeof(msg_len));
+    client_message__pack(&client_msg, data + sizeof(msg_len));
+    if (!upstream_send_all(conn, data, sizeof(msg_len) + len))
+	goto done;
+    free(data);
+    data = NULL;
+
+    /* The ServerHello is the first message the server sends. */
+    if (!upstream_recv_all(conn, (uint8_t *)&msg_len, sizeof(msg_len)))
+	goto done;
+    msg_len = ntohl(msg_len);
+    if (msg_len > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("server message too large: %u"), msg_len);
+	goto done;
+    }
+    if ((data = malloc(msg_len ? msg_len : 1)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    if (!upstream_recv_all(conn, data, msg_len))
+	goto done;
+    msg = server_message__unpack(NULL, msg_len, data);
+    if (msg == NULL || msg->type_case != SERVER_MESSAGE__TYPE_HELLO) {
+	sudo_warnx("%s", U_("unable to unpack ServerHello"));
+	goto done;
+    }
+    if (!msg->u.hello->multiplex) {
+	sudo_warnx(U_("%s: server does not support multiplexed sessions"),
+	    msg->u.hello->server_id);
+	goto done;
+    }
+
+    free(upstream_server_id);
+    if ((upstream_server_id = strdup(msg->u.hello->server_id)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: server ID: %s", __func__,
+	upstream_server_id);
+    ret = true;
+
+done:
+    server_message__free_unpacked(msg, NULL);
+    free(data);
+    debug_return_bool(ret);
+}
+
+/*
+ * Connect to the log server and perform the TLS handshake (if enabled)
+ * and hello exchange.  This is done synchronously since no sessions
+ * can make progress until the connection is up.
+ */
+static bool
+upstream_connect(struct sudo_event_base *evbase)
+{
+    struct timeval tv = { LOGMUXD_CONNECT_TIMEO, 0 };
+    struct logmux_conn *conn;
+    int flags, sock;
+    debug_decl(upstream_connect, SUDO_DEBUG_UTIL);
+
+    if ((sock = connect_server(server_name, server_port)) == -1)
+	debug_return_bool(false);
+    (void)setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    (void)setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    flags = 1;
+    (void)setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &flags, sizeof(flags));
+
+    /* The socket is closed by logmux_conn_alloc() on failure. */
+    if ((conn = logmux_conn_alloc(sock, true, evbase)) == NULL)
+	debug_return_bool(false);
+
+#if defined(HAVE_OPENSSL)
+    if (ssl_ctx != NULL) {
+	if ((conn->ssl = SSL_new(ssl_ctx)) == NULL ||
+		SSL_set_fd(conn->ssl, sock) <= 0) {
+	    sudo_warnx(U_("Unable to allocate ssl object: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	    goto bad;
+	}
+	if (SSL_connect(conn->ssl) != 1) {
+	    sudo_warnx(U_("TLS connection failed: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	    goto bad;
+	}
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "TLS version: %s, negotiated cipher suite: %s",
+	    SSL_get_version(conn->ssl), SSL_get_cipher(conn->ssl));
+    }
+#endif
+
+    if (!upstream_hello(conn))
+	goto bad;
+
+    /* Connection is ready, switch to non-blocking I/O. */
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	sudo_warn("fcntl(O_NONBLOCK)");
+	goto bad;
+    }
+    if (sudo_ev_add(evbase, conn->read_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	goto bad;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: connected to %s:%s", __func__,
+	server_name, server_port);
+
+    debug_return_bool(true);
+bad:
+    logmux_conn_free(conn);
+    debug_return_bool(false);
+}
+
+/*
+ * Handle a ServerMessage from the log server.
+ * The session ID is stripped before passing it to the local client.
+ */
+static bool
+handle_upstream_message(uint8_t *data, size_t len)
+{
+    struct logmux_conn *conn;
+    ServerMessage *msg;
+    bool ret = true;
+    debug_decl(handle_upstream_message, SUDO_DEBUG_UTIL);
+
+    msg = server_message__unpack(NULL, len, data);
+    if (msg == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to unpack ServerMessage size %zu", len);
+	upstream_lost(U_("unable to unpack ServerMessage"));
+	debug_return_bool(false);
+    }
+
+    if (msg->session_id == 0) {
+	/* Connection-level error from the server. */
+	switch (msg->type_case) {
+	case SERVER_MESSAGE__TYPE_ERROR:
+	    upstream_lost(msg->u.error);
+	    ret = false;
+	    break;
+	case SERVER_MESSAGE__TYPE_ABORT:
+	    upstream_lost(msg->u.abort);
+	    ret = false;
+	    break;
+	default:
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"ignoring ServerMessage type %d without a session",
+		msg->type_case);
+	    break;
+	}
+	goto done;
+    }
+
+    TAILQ_FOREACH(conn, &sessions, entries) {
+	if (conn->session_id == msg->session_id)
+	    break;
+    }
+    if (conn == NULL || conn->closing) {
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "%s: dropping ServerMessage for closed session %u",
+	    __func__, msg->session_id);
+	goto done;
+    }
+
+    if (msg->type_case == SERVER_MESSAGE__TYPE__NOT_SET) {
+	/* Server is done with the session. */
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: session %u finished",
+	    __func__, conn->session_id);
+	session_close(conn);
+	goto done;
+    }
+
+    msg->session_id = 0;
+    if (!queue_server_message(conn, msg))
+	logmux_conn_free(conn);
+
+done:
+    server_message__free_unpacked(msg, NULL);
+    debug_return_bool(ret);
+}
+
+/*
+ * Forward a ClientMessage from a local client to the log server.
+ */
+static bool
+handle_session_message(struct logmux_conn *conn, uint8_t *data, size_t len)
+{
+    debug_decl(handle_session_message, SUDO_DEBUG_UTIL);
+
+    if (upstream == NULL)
+	debug_return_bool(false);
+    if (!queue_message(upstream, data, len, conn->session_id)) {
+	sudo_warnx(U_("session %u: unable to send message to log server"),
+	    conn->session_id);
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * A local client went away, tell the server the session is done.
+ */
+static void
+session_finished(struct logmux_conn *conn)
+{
+    bool lost = false;
+    debug_decl(session_finished, SUDO_DEBUG_UTIL);
+
+    if (upstream != NULL && !conn->closing) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: closing session %u",
+	    __func__, conn->session_id);
+	if (!queue_message(upstream, NULL, 0, conn->session_id))
+	    lost = true;
+    }
+    logmux_conn_free(conn);
+    if (lost)
+	upstream_lost(U_("unable to send message to log server"));
+
+    debug_return;
+}
+
+/*
+ * The connection is broken, clean up.
+ */
+static void
+conn_error(struct logmux_conn *conn)
+{
+    debug_decl(conn_error, SUDO_DEBUG_UTIL);
+
+    if (conn->upstream)
+	upstream_lost(U_("connection to log server closed"));
+    else
+	session_finished(conn);
+
+    debug_return;
+}
+
+/*
+ * Read wire messages from a connection and dispatch them.
+ */
+static void
+conn_read_cb(int fd, int what, void *v)
+{
+    struct logmux_conn *conn = v;
+    struct connection_buffer *buf = &conn->read_buf;
+    uint32_t msg_len;
+    ssize_t nread;
+    debug_decl(conn_read_cb, SUDO_DEBUG_UTIL);
+
+    /* For TLS we may need to read as part of SSL_write(). */
+    if (conn->write_instead_of_read) {
+	conn->write_instead_of_read = false;
+	conn_write_cb(fd, what, v);
+	debug_return;
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (conn->ssl != NULL) {
+	nread = SSL_read(conn->ssl, buf->data + buf->len, buf->size - buf->len);
+	if (nread <= 0) {
+	    int err = SSL_get_error(conn->ssl, nread);
+	    switch (err) {
+		case SSL_ERROR_ZERO_RETURN:
+		    /* ssl connection shutdown cleanly */
+		    nread = 0;
+		    break;
+		case SSL_ERROR_WANT_READ:
+		    /* ssl wants to read more, read event is always active */
+		    sudo_debug_printf(SUDO_DEBUG_NOTICE|SUDO_DEBUG_LINENO,
+			"SSL_read returns SSL_ERROR_WANT_READ");
+		    debug_return;
+		case SSL_ERROR_WANT_WRITE:
+		    /* ssl wants to write, schedule a write if not pending */
+		    sudo_debug_printf(SUDO_DEBUG_NOTICE|SUDO_DEBUG_LINENO,
+			"SSL_read returns SSL_ERROR_WANT_WRITE");
+		    if (!sudo_ev_pending(conn->write_ev, SUDO_EV_WRITE, NULL)) {
+			/* Enable a temporary write event. */
+			if (sudo_ev_add(conn->evbase, conn->write_ev, NULL, false) == -1) {
+			    sudo_warnx("%s", U_("unable to add event to queue"));
+			    goto bad;
+			}
+			conn->temporary_write_event = true;
+		    }
+		    /* Redirect write event to finish SSL_read() */
+		    conn->read_instead_of_write = true;
+		    debug_return;
+		case SSL_ERROR_SYSCALL:
+		    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+			"unexpected error during SSL_read(): %d (%s)",
+			err, strerror(errno));
+		    goto bad;
+		default:
+		    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+			"unexpected error during SSL_read(): %d (%s)",
+			err, ERR_error_string(ERR_get_error(), NULL));
+		    goto bad;
+	    }
+	}
+    } else
+#endif
+    {
+	nread = recv(fd, buf->data + buf->len, buf->size - buf->len, 0);
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received %zd bytes from %s",
+	__func__, nread, conn->upstream ? "server" : "client");
+    switch (nread) {
+    case -1:
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to receive %u bytes", buf->size - buf->len);
+	goto bad;
+    case 0:
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO, "EOF");
+	goto bad;
+    default:
+	break;
+    }
+    buf->len += nread;
+
+    while (buf->len - buf->off >= sizeof(msg_len)) {
+	/* Read wire message size (uint32_t in network byte order). */
+	memcpy(&msg_len, buf->data + buf->off, sizeof(msg_len));
+	msg_len = ntohl(msg_len);
+
+	if (msg_len > MESSAGE_SIZE_MAX) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"message too large: %u", msg_len);
+	    goto bad;
+	}
+
+	if (msg_len + sizeof(msg_len) > buf->len - buf->off) {
+	    /* Incomplete message, we'll read the rest next time. */
+	    if (!expand_buf(buf, msg_len + sizeof(msg_len)))
+		goto bad;
+	    debug_return;
+	}
+
+	buf->off += sizeof(msg_len);
+	if (conn->upstream) {
+	    /* Upstream is freed on error. */
+	    if (!handle_upstream_message(buf->data + buf->off, msg_len))
+		debug_return;
+	} else {
+	    if (!handle_session_message(conn, buf->data + buf->off, msg_len))
+		goto bad;
+	}
+	buf->off += msg_len;
+    }
+    buf->len -= buf->off;
+    buf->off = 0;
+
+    debug_return;
+bad:
+    conn_error(conn);
+    debug_return;
+}
+
+/*
+ * Write the next queued message to a connection.
+ */
+static void
+conn_write_cb(int fd, int what, void *v)
+{
+    struct logmux_conn *conn = v;
+    struct connection_buffer *buf;
+    ssize_t nwritten;
+    debug_decl(conn_write_cb, SUDO_DEBUG_UTIL);
+
+    /* For TLS we may need to write as part of SSL_read(). */
+    if (conn->read_instead_of_write) {
+	conn->read_instead_of_write = false;
+	/* Delete write event if it was only due to SSL_read(). */
+	if (conn->temporary_write_event) {
+	    conn->temporary_write_event = false;
+	    sudo_ev_del(conn->evbase, conn->write_ev);
+	}
+	conn_read_cb(fd, what, v);
+	debug_return;
+    }
+
+    if ((buf = TAILQ_FIRST(&conn->write_bufs)) == NULL) {
+	sudo_ev_del(conn->evbase, conn->write_ev);
+	debug_return;
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (conn->ssl != NULL) {
+	nwritten = SSL_write(conn->ssl, buf->data + buf->off,
+	    buf->len - buf->off);
+	if (nwritten <= 0) {
+	    int err = SSL_get_error(conn->ssl, nwritten);
+	    switch (err) {
+		case SSL_ERROR_WANT_READ:
+		    /* ssl wants to read, read event always active */
+		    sudo_debug_printf(SUDO_DEBUG_NOTICE|SUDO_DEBUG_LINENO,
+			"SSL_write returns SSL_ERROR_WANT_READ");
+		    /* Redirect persistent read event to finish SSL_write() */
+		    conn->write_instead_of_read = true;
+		    debug_return;
+		case SSL_ERROR_WANT_WRITE:
+		    /* ssl wants to write more, write event remains active */
+		    sudo_debug_printf(SUDO_DEBUG_NOTICE|SUDO_DEBUG_LINENO,
+			"SSL_write returns SSL_ERROR_WANT_WRITE");
+		    debug_return;
+		case SSL_ERROR_SYSCALL:
+		    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+			"unexpected error during SSL_write(): %d (%s)",
+			err, strerror(errno));
+		    goto bad;
+		default:
+		    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+			"unexpected error during SSL_write(): %d (%s)",
+			err, ERR_error_string(ERR_get_error(), NULL));
+		    goto bad;
+	    }
+	}
+    } else
+#endif
+    {
+	nwritten = send(fd, buf->data + buf->off, buf->len - buf->off, 0);
+	if (nwritten == -1) {
+	    if (errno == EAGAIN || errno == EINTR)
+		debug_return;
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to send %u bytes", buf->len - buf->off);
+	    goto bad;
+	}
+    }
+    buf->off += nwritten;
+
+    if (buf->off == buf->len) {
+	/* sent entire message */
+	buf->off = 0;
+	buf->len = 0;
+	TAILQ_REMOVE(&conn->write_bufs, buf, entries);
+	TAILQ_INSERT_TAIL(&free_bufs, buf, entries);
+	if (TAILQ_EMPTY(&conn->write_bufs)) {
+	    sudo_ev_del(conn->evbase, conn->write_ev);
+	    if (conn->closing)
+		logmux_conn_free(conn);
+	}
+    }
+    debug_return;
+
+bad:
+    if (conn->closing)
+	logmux_conn_free(conn);
+    else
+	conn_error(conn);
+    debug_return;
+}
+
+/*
+ * Assign a session ID that is not currently in use.
+ * Zero is reserved for messages that are not part of a session.
+ */
+static void
+new_session_id(struct logmux_conn *new_conn)
+{
+    struct logmux_conn *conn;
+    debug_decl(new_session_id, SUDO_DEBUG_UTIL);
+
+again:
+    if (++next_session_id == 0)
+	next_session_id = 1;
+    TAILQ_FOREACH(conn, &sessions, entries) {
+	if (conn->session_id == next_session_id)
+	    goto again;
+    }
+    new_conn->session_id = next_session_id;
+
+    debug_return;
+}
+
+/*
+ * Accept a new local client and start a session for it.
+ * The ServerHello is answered locally using the server's ID.
+ */
+static void
+listener_cb(int fd, int what, void *v)
+{
+    struct sudo_event_base *evbase = v;
+    ServerMessage msg = SERVER_MESSAGE__INIT;
+    ServerHello hello = SERVER_HELLO__INIT;
+    struct logmux_conn *conn;
+    int flags, sock;
+    debug_decl(listener_cb, SUDO_DEBUG_UTIL);
+
+    sock = accept(fd, NULL, NULL);
+    if (sock == -1) {
+	if (errno != EAGAIN && errno != EINTR)
+	    sudo_warn("accept");
+	debug_return;
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	sudo_warn("fcntl(O_NONBLOCK)");
+	close(sock);
+	debug_return;
+    }
+
+    if ((conn = logmux_conn_alloc(sock, false, evbase)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return;
+    }
+    new_session_id(conn);
+
+    if (upstream == NULL && !upstream_connect(evbase)) {
+	if (queue_error_message(conn, U_("unable to connect to log server")))
+	    session_close(conn);
+	else
+	    logmux_conn_free(conn);
+	debug_return;
+    }
+
+    hello.server_id = upstream_server_id;
+    msg.u.hello = &hello;
+    msg.type_case = SERVER_MESSAGE__TYPE_HELLO;
+    if (!queue_server_message(conn, &msg)) {
+	logmux_conn_free(conn);
+	debug_return;
+    }
+    if (sudo_ev_add(evbase, conn->read_ev, NULL, false) == -1) {
+	sudo_warnx("%s", U_("unable to add event to queue"));
+	logmux_conn_free(conn);
+	debug_return;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: new session %u", __func__,
+	conn->session_id);
+
+    debug_return;
+}
+
+/*
+ * Create the local socket that sudo connects to.
+ * Only root may connect to it.
+ */
+static int
+create_listener(const char *path)
+{
+    struct sockaddr_un sun;
+    mode_t omask;
+    int flags, sock;
+    debug_decl(create_listener, SUDO_DEBUG_UTIL);
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >= sizeof(sun.sun_path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s", path);
+	debug_return_int(-1);
+    }
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+	sudo_warn("socket");
+	debug_return_int(-1);
+    }
+    (void)unlink(path);
+    omask = umask(S_IRWXG|S_IRWXO);
+    if (bind(sock, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+	sudo_warn("%s", path);
+	umask(omask);
+	goto bad;
+    }
+    umask(omask);
+    if (listen(sock, SOMAXCONN) == -1) {
+	sudo_warn("listen");
+	goto bad;
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	sudo_warn("fcntl(O_NONBLOCK)");
+	goto bad;
+    }
+
+    debug_return_int(sock);
+bad:
+    close(sock);
+    debug_return_int(-1);
+}
+
+static void
+signal_cb(int signo, int what, void *v)
+{
+    struct sudo_event_base *base = v;
+    debug_decl(signal_cb, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received signal %d, exiting",
+	__func__, signo);
+    sudo_ev_loopbreak(base);
+
+    debug_return;
+}
+
+static void
+register_signal(int signo, struct sudo_event_base *base)
+{
+    struct sudo_event *ev;
+    debug_decl(register_signal, SUDO_DEBUG_UTIL);
+
+    ev = sudo_ev_alloc(signo, SUDO_EV_SIGNAL, signal_cb, base);
+    if (ev == NULL)
+	sudo_fatal(NULL);
+    if (sudo_ev_add(base, ev, NULL, false) == -1)
+	sudo_fatal("%s", U_("unable to add event to queue"));
+
+    debug_return;
+}
+
+#if defined(HAVE_OPENSSL)
+static const char short_opts[] = "b:c:h:k:np:s:V";
+#else
+static const char short_opts[] = "h:p:s:V";
+#endif
+static struct option long_opts[] = {
+    { "help",		no_argument,		NULL,	1 },
+#if defined(HAVE_OPENSSL)
+    { "ca-bundle",	required_argument,	NULL,	'b' },
+    { "cert",		required_argument,	NULL,	'c' },
+#endif
+    { "host",		required_argument,	NULL,	'h' },
+#if defined(HAVE_OPENSSL)
+    { "key",		required_argument,	NULL,	'k' },
+    { "no-verify",	no_argument,		NULL,	'n' },
+#endif
+    { "port",		required_argument,	NULL,	'p' },
+    { "socket",		required_argument,	NULL,	's' },
+    { "version",	no_argument,		NULL,	'V' },
+    { NULL,		no_argument,		NULL,	0 },
+};
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+int
+main(int argc, char *argv[])
+{
+    struct sudo_event_base *evbase;
+    struct logmux_conn *conn;
+    int ch, sock;
+    debug_decl_vars(main, SUDO_DEBUG_MAIN);
+
+#if defined(SUDO_DEVEL) && defined(__OpenBSD__)
+    {
+	extern char *malloc_options;
+	malloc_options = "S";
+    }
+#endif
+
+    signal(SIGPIPE, SIG_IGN);
+
+    initprogname(argc > 0 ? argv[0] : "sudo_logmuxd");
+    setlocale(LC_ALL, "");
+    bindtextdomain("sudo", LOCALEDIR); /* XXX - add logsrvd domain */
+    textdomain("sudo");
+
+    /* Read sudo.conf and initialize the debug subsystem. */
+    if (sudo_conf_read(NULL, SUDO_CONF_DEBUG) == -1)
+        exit(EXIT_FAILURE);
+    sudo_debug_register(getprogname(), NULL, NULL,
+        sudo_conf_debug_files(getprogname()));
+
+    if (protobuf_c_version_number() < 1003000)
+	sudo_fatalx("%s", U_("Protobuf-C version 1.3 or higher required"));
+
+    while ((ch = getopt_long(argc, argv, short_opts, long_opts, NULL)) != -1) {
+	switch (ch) {
+	case 'h':
+	    server_name = optarg;
+	    break;
+	case 'p':
+	    server_port = optarg;
+	    break;
+	case 's':
+	    socket_path = optarg;
+	    break;
+	case 1:
+	    help();
+	    break;
+#if defined(HAVE_OPENSSL)
+	case 'b':
+	    ca_bundle = optarg;
+	    break;
+	case 'c':
+	    cert = optarg;
+	    break;
+	case 'k':
+	    key = optarg;
+	    break;
+	case 'n':
+	    verify_server = false;
+	    break;
+#endif
+	case 'V':
+	    (void)printf(_("%s version %s\n"), getprogname(),
+		PACKAGE_VERSION);
+	    return 0;
+	default:
+	    usage(true);
+	}
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 0)
+	usage(true);
+
+#if defined(HAVE_OPENSSL)
+    /* if no key file is given explicitly, try to load the key from the cert */
+    if (cert != NULL) {
+	if (key == NULL)
+	    key = cert;
+	if (server_port == NULL)
+	    server_port = DEFAULT_PORT_TLS;
+	if ((ssl_ctx = init_tls_client_context(ca_bundle, cert, key)) == NULL) {
+	    sudo_fatalx(U_("Unable to initialize ssl context: %s"),
+		ERR_reason_error_string(ERR_get_error()));
+	}
+    }
+#endif
+    if (server_port == NULL)
+	server_port = DEFAULT_PORT;
+
+    if ((evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatal(NULL);
+
+    if ((sock = create_listener(socket_path)) == -1)
+	exit(EXIT_FAILURE);
+    listen_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST,
+	listener_cb, evbase);
+    if (listen_ev == NULL)
+	sudo_fatal(NULL);
+    if (sudo_ev_add(evbase, listen_ev, NULL, false) == -1)
+	sudo_fatal("%s", U_("unable to add event to queue"));
+
+    register_signal(SIGHUP, evbase);
+    register_signal(SIGINT, evbase);
+    register_signal(SIGTERM, evbase);
+
+    sudo_ev_dispatch(evbase);
+
+    /* Clean up. */
+    while ((conn = TAILQ_FIRST(&sessions)) != NULL)
+	session_finished(conn);
+    logmux_conn_free(upstream);
+    sudo_ev_free(listen_ev);
+    close(sock);
+    (void)unlink(socket_path);
+    sudo_ev_base_free(evbase);
+#if defined(HAVE_OPENSSL)
+    SSL_CTX_free(ssl_ctx);
+#endif
+
+    debug_return_int(EXIT_SUCCESS);
+}
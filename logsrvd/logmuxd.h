@@ -0,0 +1,61 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SUDO_LOGMUXD_H
+#define SUDO_LOGMUXD_H
+
+#if PROTOBUF_C_VERSION_NUMBER < 1003000
+# error protobuf-c version 1.30 or higher required
+#endif
+
+#include "config.h"
+
+#if defined(HAVE_OPENSSL)
+# include <openssl/ssl.h>
+#endif
+
+#include "logsrv_util.h"
+
+/* Timeout (in seconds) when connecting to the log server. */
+#define LOGMUXD_CONNECT_TIMEO	30
+
+/*
+ * A connection to either a local client or the upstream log server.
+ * Local clients each get their own session ID on the upstream connection.
+ */
+struct logmux_conn {
+    TAILQ_ENTRY(logmux_conn) entries;
+    struct sudo_event_base *evbase;
+    struct sudo_event *read_ev;
+    struct sudo_event *write_ev;
+    struct connection_buffer read_buf;
+    struct connection_buffer_list write_bufs;
+#if defined(HAVE_OPENSSL)
+    SSL *ssl;
+#endif
+    bool upstream;
+    bool closing;
+    bool read_instead_of_write;
+    bool write_instead_of_read;
+    bool temporary_write_event;
+    uint32_t session_id;
+    int sock;
+};
+TAILQ_HEAD(logmux_conn_list, logmux_conn);
+
+#endif /* SUDO_LOGMUXD_H */
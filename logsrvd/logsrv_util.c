@@ -44,8 +44,34 @@
 #include "sudo_iolog.h"
 #include "sudo_util.h"
 
+#include "protobuf-c/protobuf-c.h"
 #include "logsrv_util.h"
 
+/*
+ * Arena allocations are rounded up to this size, which is
+ * sufficient alignment for any of the protobuf-c message types.
+ */
+#define ARENA_ALIGN		16
+#define ARENA_ROUNDUP(_n)	(((_n) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* Maximum number of standard-sized chunks kept by logsrv_arena_reset(). */
+#define ARENA_MAX_CHUNKS	4
+
+struct logsrv_arena_chunk {
+    struct logsrv_arena_chunk *next;
+    size_t size;
+    size_t used;
+};
+#define ARENA_CHUNK_HDR	ARENA_ROUNDUP(sizeof(struct logsrv_arena_chunk))
+
+struct logsrv_arena {
+    ProtobufCAllocator allocator;
+    struct logsrv_arena_chunk *chunks;	/* standard-sized chunks */
+    struct logsrv_arena_chunk *cur;	/* chunk currently being carved */
+    struct logsrv_arena_chunk *large;	/* oversized, one per allocation */
+    size_t chunk_size;
+};
+
 /*
  * Expand buf as needed or just reset it.
  */
@@ -81,6 +107,249 @@ expand_buf(struct connection_buffer *buf, unsigned int needed)
     debug_return_bool(true);
 }
 
+/*
+ * Get a buffer from the pool, or allocate a new one if the pool is empty.
+ * If size is non-zero, the buffer will be able to hold at least size bytes.
+ * Returns NULL on allocation failure.
+ */
+struct connection_buffer *
+bufpool_get(struct connection_buffer_pool *pool, unsigned int size)
+{
+    struct connection_buffer *buf;
+    debug_decl(bufpool_get, SUDO_DEBUG_UTIL);
+
+    buf = TAILQ_FIRST(&pool->bufs);
+    if (buf != NULL) {
+	TAILQ_REMOVE(&pool->bufs, buf, entries);
+	pool->count--;
+    } else {
+	if ((buf = calloc(1, sizeof(*buf))) == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+		"%s: unable to calloc %zu", __func__, sizeof(*buf));
+	    debug_return_ptr(NULL);
+	}
+    }
+
+    if (size > buf->size) {
+	if (!expand_buf(buf, size)) {
+	    bufpool_put(pool, buf);
+	    debug_return_ptr(NULL);
+	}
+    }
+
+    debug_return_ptr(buf);
+}
+
+/*
+ * Return a buffer to the pool for reuse.
+ * The buffer is freed instead if the pool is full or the buffer
+ * has grown larger than the pool's maximum buffer size.
+ */
+void
+bufpool_put(struct connection_buffer_pool *pool, struct connection_buffer *buf)
+{
+    debug_decl(bufpool_put, SUDO_DEBUG_UTIL);
+
+    if (buf == NULL)
+	debug_return;
+
+    if (pool->count >= pool->max_count || buf->size > pool->max_size) {
+	free(buf->data);
+	free(buf);
+	debug_return;
+    }
+
+    /* Most recently used buffers are reused first. */
+    buf->len = 0;
+    buf->off = 0;
+    TAILQ_INSERT_HEAD(&pool->bufs, buf, entries);
+    pool->count++;
+
+    debug_return;
+}
+
+/*
+ * Free all buffers in the pool.
+ */
+void
+bufpool_clear(struct connection_buffer_pool *pool)
+{
+    struct connection_buffer *buf;
+    debug_decl(bufpool_clear, SUDO_DEBUG_UTIL);
+
+    while ((buf = TAILQ_FIRST(&pool->bufs)) != NULL) {
+	TAILQ_REMOVE(&pool->bufs, buf, entries);
+	free(buf->data);
+	free(buf);
+    }
+    pool->count = 0;
+
+    debug_return;
+}
+
+/*
+ * Allocate a new arena chunk able to hold size bytes.
+ */
+static struct logsrv_arena_chunk *
+logsrv_arena_chunk_alloc(size_t size)
+{
+    struct logsrv_arena_chunk *chunk;
+    debug_decl(logsrv_arena_chunk_alloc, SUDO_DEBUG_UTIL);
+
+    if ((chunk = malloc(ARENA_CHUNK_HDR + size)) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to malloc %zu", __func__, ARENA_CHUNK_HDR + size);
+	debug_return_ptr(NULL);
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    debug_return_ptr(chunk);
+}
+
+/*
+ * ProtobufCAllocator alloc function.
+ * Small requests are carved out of the current chunk, moving on to
+ * the next chunk (allocating it if needed) when the current one is full.
+ * Large requests get a chunk of their own that is freed on reset.
+ */
+static void *
+logsrv_arena_protobuf_alloc(void *v, size_t size)
+{
+    struct logsrv_arena *arena = v;
+    struct logsrv_arena_chunk *chunk;
+    void *ret;
+
+    size = ARENA_ROUNDUP(size);
+    if (size > arena->chunk_size / 4) {
+	if ((chunk = logsrv_arena_chunk_alloc(size)) == NULL)
+	    return NULL;
+	chunk->next = arena->large;
+	arena->large = chunk;
+	return (char *)chunk + ARENA_CHUNK_HDR;
+    }
+
+    chunk = arena->cur;
+    while (chunk->size - chunk->used < size) {
+	if (chunk->next == NULL) {
+	    chunk->next = logsrv_arena_chunk_alloc(arena->chunk_size);
+	    if (chunk->next == NULL)
+		return NULL;
+	}
+	chunk = chunk->next;
+	chunk->used = 0;
+    }
+    arena->cur = chunk;
+
+    ret = (char *)chunk + ARENA_CHUNK_HDR + chunk->used;
+    chunk->used += size;
+    return ret;
+}
+
+/*
+ * ProtobufCAllocator free function.
+ * Arena memory is only released by logsrv_arena_reset().
+ */
+static void
+logsrv_arena_protobuf_free(void *v, void *ptr)
+{
+    return;
+}
+
+/*
+ * Allocate an arena that hands out memory in chunks of chunk_size bytes.
+ * Used to unpack protobuf-c messages without a malloc()/free() pair
+ * for each message member.
+ */
+struct logsrv_arena *
+logsrv_arena_alloc(size_t chunk_size)
+{
+    struct logsrv_arena *arena;
+    debug_decl(logsrv_arena_alloc, SUDO_DEBUG_UTIL);
+
+    if ((arena = calloc(1, sizeof(*arena))) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "%s: unable to calloc %zu", __func__, sizeof(*arena));
+	debug_return_ptr(NULL);
+    }
+    arena->chunk_size = ARENA_ROUNDUP(chunk_size);
+    arena->chunks = logsrv_arena_chunk_alloc(arena->chunk_size);
+    if (arena->chunks == NULL) {
+	free(arena);
+	debug_return_ptr(NULL);
+    }
+    arena->cur = arena->chunks;
+    arena->allocator.alloc = logsrv_arena_protobuf_alloc;
+    arena->allocator.free = logsrv_arena_protobuf_free;
+    arena->allocator.allocator_data = arena;
+
+    debug_return_ptr(arena);
+}
+
+/*
+ * Release everything allocated from the arena since the last reset.
+ * Oversized chunks are freed, standard chunks are kept for reuse
+ * (up to ARENA_MAX_CHUNKS of them).
+ */
+void
+logsrv_arena_reset(struct logsrv_arena *arena)
+{
+    struct logsrv_arena_chunk *chunk, *next;
+    unsigned int n = 0;
+    debug_decl(logsrv_arena_reset, SUDO_DEBUG_UTIL);
+
+    for (chunk = arena->large; chunk != NULL; chunk = next) {
+	next = chunk->next;
+	free(chunk);
+    }
+    arena->large = NULL;
+
+    for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+	chunk->used = 0;
+	if (++n == ARENA_MAX_CHUNKS) {
+	    while ((next = chunk->next) != NULL) {
+		chunk->next = next->next;
+		free(next);
+	    }
+	    break;
+	}
+    }
+    arena->cur = arena->chunks;
+
+    debug_return;
+}
+
+/*
+ * Free an arena and all memory allocated from it.
+ */
+void
+logsrv_arena_free(struct logsrv_arena *arena)
+{
+    struct logsrv_arena_chunk *chunk, *next;
+    debug_decl(logsrv_arena_free, SUDO_DEBUG_UTIL);
+
+    if (arena != NULL) {
+	logsrv_arena_reset(arena);
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+	    next = chunk->next;
+	    free(chunk);
+	}
+	free(arena);
+    }
+
+    debug_return;
+}
+
+/*
+ * Returns a protobuf-c allocator that allocates from the arena.
+ */
+ProtobufCAllocator *
+logsrv_arena_allocator(struct logsrv_arena *arena)
+{
+    return &arena->allocator;
+}
+
 /*
  * Open any I/O log files that are present.
  * The timing file must always exist.
@@ -110,8 +379,48 @@ iolog_open_all(int dfd, const char *iolog_dir, struct iolog_file *iolog_files,
     debug_return_bool(true);
 }
 
+/*
+ * Seek to the closest point before target that is in the I/O log index.
+ * Returns true if the logs were positioned at an index entry, else false.
+ */
+static bool
+iolog_seekto_index(int iolog_dir_fd, struct iolog_file *iolog_files,
+    struct timespec *elapsed_time, const struct timespec *target)
+{
+    struct iolog_index_entry entry;
+    int iofd;
+    debug_decl(iolog_seekto_index, SUDO_DEBUG_UTIL);
+
+    if (!iolog_index_lookup(iolog_dir_fd, target, &entry))
+	debug_return_bool(false);
+
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	off_t offset = entry.files[iofd].offset;
+
+	if (!iolog_files[iofd].enabled)
+	    continue;
+	if (offset == -1)
+	    offset = 0;
+	if (iolog_seek(&iolog_files[iofd], offset, SEEK_SET) != offset) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to seek %s to %lld, ignoring index",
+		iolog_fd_to_name(iofd), (long long)offset);
+	    goto bad;
+	}
+    }
+    *elapsed_time = entry.elapsed;
+    debug_return_bool(true);
+bad:
+    for (iofd = 0; iofd < IOFD_MAX; iofd++) {
+	if (iolog_files[iofd].enabled)
+	    iolog_rewind(&iolog_files[iofd]);
+    }
+    debug_return_bool(false);
+}
+
 /*
  * Seek to the specified point in time in the I/O logs.
+ * If an index is present, parsing starts at the closest indexed point.
  */
 bool
 iolog_seekto(int iolog_dir_fd, const char *iolog_path,
@@ -122,6 +431,12 @@ iolog_seekto(int iolog_dir_fd, const char *iolog_path,
     off_t pos;
     debug_decl(iolog_seekto, SUDO_DEBUG_UTIL);
 
+    if (iolog_seekto_index(iolog_dir_fd, iolog_files, elapsed_time, target)) {
+	/* Index entries are only written at the first record for a time. */
+	if (sudo_timespeccmp(elapsed_time, target, ==))
+	    debug_return_bool(true);
+    }
+
     /* Parse timing file until we reach the target point. */
     for (;;) {
 	if (iolog_read_timing_record(&iolog_files[IOFD_TIMING], &timing) != 0)
@@ -27,15 +27,36 @@
 #define MESSAGE_SIZE_MAX	(2 * 1024 * 1024)
 
 struct connection_buffer {
+    TAILQ_ENTRY(connection_buffer) entries;
     uint8_t *data;
     unsigned int size;
     unsigned int len;
     unsigned int off;
 };
+TAILQ_HEAD(connection_buffer_list, connection_buffer);
+
+/* Cache of free connection buffers, see bufpool_get() and bufpool_put(). */
+struct connection_buffer_pool {
+    struct connection_buffer_list bufs;
+    unsigned int count;
+    unsigned int max_count;
+    unsigned int max_size;
+};
+#define CONNECTION_BUFFER_POOL_INITIALIZER(_pool, _count, _size) \
+    { TAILQ_HEAD_INITIALIZER((_pool).bufs), 0, (_count), (_size) }
 
 /* logsrv_util.c */
 struct iolog_file;
+struct logsrv_arena;
+struct ProtobufCAllocator;
 bool expand_buf(struct connection_buffer *buf, unsigned int needed);
+struct connection_buffer *bufpool_get(struct connection_buffer_pool *pool, unsigned int size);
+void bufpool_put(struct connection_buffer_pool *pool, struct connection_buffer *buf);
+void bufpool_clear(struct connection_buffer_pool *pool);
+struct logsrv_arena *logsrv_arena_alloc(size_t chunk_size);
+void logsrv_arena_reset(struct logsrv_arena *arena);
+void logsrv_arena_free(struct logsrv_arena *arena);
+struct ProtobufCAllocator *logsrv_arena_allocator(struct logsrv_arena *arena);
 bool iolog_open_all(int dfd, const char *iolog_dir, struct iolog_file *iolog_files, const char *mode);
 bool iolog_seekto(int iolog_dir_fd, const char *iolog_path, struct iolog_file *iolog_files, struct timespec *elapsed_time, const struct timespec *target);
 
@@ -21,6 +21,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -28,6 +29,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <signal.h>
 #ifdef HAVE_STDBOOL_H
 # include <stdbool.h>
 #else
@@ -87,15 +89,42 @@
  * Sudo I/O audit server.
  */
 static int logsrvd_debug_instance = SUDO_DEBUG_INSTANCE_INITIALIZER;
-TAILQ_HEAD(connection_list, connection_closure);
 static struct connection_list connections = TAILQ_HEAD_INITIALIZER(connections);
 static struct listener_list listeners = TAILQ_HEAD_INITIALIZER(listeners);
+static struct logsrvd_worker_list workers = TAILQ_HEAD_INITIALIZER(workers);
+static struct logsrvd_worker_list retired_workers =
+    TAILQ_HEAD_INITIALIZER(retired_workers);
+static struct sudo_event *worker_ev;
+static unsigned int nchildren;
+static bool supervisor;
+static bool supervisor_shutting_down;
+static bool worker_retiring;
 static const char server_id[] = "Sudo Audit Server " PACKAGE_VERSION;
 static const char *conf_file = _PATH_SUDO_LOGSRVD_CONF;
 static double random_drop;
 
+/* Buffers are shared by all connections, messages are unpacked in an arena. */
+static struct connection_buffer_pool free_bufs =
+    CONNECTION_BUFFER_POOL_INITIALIZER(free_bufs, BUFPOOL_MAX_COUNT,
+	BUFPOOL_MAX_SIZE);
+static struct logsrv_arena *msg_arena;
+
+/* I/O logs with uncommitted data, flushed together by group_commit_cb(). */
+static struct connection_list commit_list = TAILQ_HEAD_INITIALIZER(commit_list);
+static struct sudo_event *group_commit_ev;
+static struct timespec commit_deadline;
+static size_t uncommitted_bytes;
+static bool commit_now;
+
 /* Server callback may redirect to client callback for TLS. */
 static void client_msg_cb(int fd, int what, void *v);
+static void server_commit_cb(int fd, int what, void *v);
+static void group_commit_cb(int fd, int what, void *v);
+
+/* Worker processes are (re)started on reload. */
+static void register_signal(int signo, struct sudo_event_base *base);
+static int start_workers(struct sudo_event_base *base, unsigned int count);
+static void retire_workers(void);
 
 /*
  * Free a struct connection_closure container and its contents.
@@ -108,6 +137,30 @@ connection_closure_free(struct connection_closure *closure)
     if (closure != NULL) {
 	bool shutting_down = closure->state == SHUTDOWN;
 	struct sudo_event_base *evbase = closure->evbase;
+	struct connection_closure *session;
+	struct connection_buffer *buf;
+
+	if (closure->commit_pending)
+	    TAILQ_REMOVE(&commit_list, closure, commit_entries);
+
+	if (closure->parent != NULL) {
+	    /* Multiplexed session, the parent owns the socket. */
+	    struct connection_closure *parent = closure->parent;
+
+	    TAILQ_REMOVE(&parent->sessions, closure, entries);
+	    TAILQ_REMOVE(&parent->session_hash[closure->session_id %
+		SESSION_HASH_SIZE], closure, hash_entries);
+	    parent->nsessions--;
+	    iolog_close_all(closure);
+	    sudo_ev_free(closure->commit_ev);
+	    eventlog_free(closure->evlog);
+	    free(closure);
+	    debug_return;
+	}
+
+	while ((session = TAILQ_FIRST(&closure->sessions)) != NULL)
+	    connection_closure_free(session);
+	free(closure->session_hash);
 
 	TAILQ_REMOVE(&connections, closure, entries);
 #if defined(HAVE_OPENSSL)
@@ -125,29 +178,96 @@ connection_closure_free(struct connection_closure *closure)
 	sudo_ev_free(closure->ssl_accept_ev);
 #endif
 	eventlog_free(closure->evlog);
-	free(closure->read_buf.data);
-	free(closure->write_buf.data);
+	bufpool_put(&free_bufs, closure->read_buf);
+	while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	    TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+	    bufpool_put(&free_bufs, buf);
+	}
 	free(closure);
 
-	if (shutting_down && TAILQ_EMPTY(&connections))
+	/*
+	 * A supervisor also waits for its workers to finish.
+	 * A retired worker exits once its last connection is done.
+	 */
+	if ((shutting_down || worker_retiring) && TAILQ_EMPTY(&connections) &&
+		(!supervisor || nchildren == 0))
 	    sudo_ev_loopbreak(evbase);
     }
 
     debug_return;
 }
 
+/*
+ * Point a connection's open I/O log files at devnull so that closing
+ * them does not write out data that is still buffered.
+ */
+static void
+iolog_discard_all(struct connection_closure *closure, int devnull)
+{
+    int i;
+    debug_decl(iolog_discard_all, SUDO_DEBUG_UTIL);
+
+    for (i = 0; i < IOFD_MAX; i++) {
+	struct iolog_file *iol = &closure->iolog_files[i];
+
+	if (iol->enabled && iol->fdnum != -1) {
+	    if (dup2(devnull, iol->fdnum) == -1)
+		sudo_fatal("dup2");
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Free a connection that a new worker inherited from the supervisor.
+ * The supervisor is still serving it, so nothing may be sent to the
+ * client or written to its I/O logs.
+ */
+static void
+connection_closure_discard(struct connection_closure *closure, int devnull)
+{
+    struct connection_closure *session;
+    debug_decl(connection_closure_discard, SUDO_DEBUG_UTIL);
+
+    TAILQ_FOREACH(session, &closure->sessions, entries)
+	iolog_discard_all(session, devnull);
+    iolog_discard_all(closure, devnull);
+#if defined(HAVE_OPENSSL)
+    /* Don't send a close_notify alert. */
+    if (closure->tls)
+	SSL_set_quiet_shutdown(closure->ssl, 1);
+#endif
+    connection_closure_free(closure);
+
+    debug_return;
+}
+
+/*
+ * Format a ServerMessage and append it to the connection's write queue.
+ * Messages for a multiplexed session are tagged with the session ID
+ * and queued on the parent connection.
+ * Returns true on success, false on failure.
+ */
 static bool
-fmt_server_message(struct connection_buffer *buf, ServerMessage *msg)
+fmt_server_message(struct connection_closure *closure, ServerMessage *msg)
 {
+    struct connection_closure *conn = closure;
+    struct connection_buffer *buf = NULL;
     uint32_t msg_len;
     bool ret = false;
     size_t len;
     debug_decl(fmt_server_message, SUDO_DEBUG_UTIL);
 
-    if (buf->len != 0) {
+    if (closure->parent != NULL) {
+	conn = closure->parent;
+	msg->session_id = closure->session_id;
+    }
+
+    if ((buf = bufpool_get(&free_bufs, 0)) == NULL) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "pending write, unable to format ServerMessage");
-	debug_return_bool(false);
+	    "unable to allocate connection_buffer");
+	goto done;
     }
 
     len = server_message__get_packed_size(msg);
@@ -162,30 +282,37 @@ fmt_server_message(struct connection_buffer *buf, ServerMessage *msg)
     len += sizeof(msg_len);
 
     /* Resize buffer as needed. */
-    if (len > buf->size) {
-	free(buf->data);
-	buf->size = sudo_pow2_roundup(len);
-	if ((buf->data = malloc(buf->size)) == NULL) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to malloc %u", buf->size);
-	    buf->size = 0;
-	    goto done;
-	}
-    }
+    if (!expand_buf(buf, len))
+	goto done;
     sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
 	"size + server message %zu bytes", len);
 
     memcpy(buf->data, &msg_len, sizeof(msg_len));
     server_message__pack(msg, buf->data + sizeof(msg_len));
     buf->len = len;
+    buf->off = 0;
+    TAILQ_INSERT_TAIL(&conn->write_bufs, buf, entries);
+    buf = NULL;
+
+    /* Schedule a write if one is not already pending. */
+    conn->temporary_write_event = false;
+    if (!sudo_ev_pending(conn->write_ev, SUDO_EV_WRITE, NULL)) {
+	if (sudo_ev_add(conn->evbase, conn->write_ev,
+		logsrvd_conf_get_sock_timeout(), false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add server write event");
+	    goto done;
+	}
+    }
     ret = true;
 
 done:
+    bufpool_put(&free_bufs, buf);
     debug_return_bool(ret);
 }
 
 static bool
-fmt_hello_message(struct connection_buffer *buf, bool tls)
+fmt_hello_message(struct connection_closure *closure)
 {
     ServerMessage msg = SERVER_MESSAGE__INIT;
     ServerHello hello = SERVER_HELLO__INIT;
@@ -193,14 +320,15 @@ fmt_hello_message(struct connection_buffer *buf, bool tls)
 
     /* TODO: implement redirect and servers array.  */
     hello.server_id = (char *)server_id;
+    hello.multiplex = true;
     msg.u.hello = &hello;
     msg.type_case = SERVER_MESSAGE__TYPE_HELLO;
 
-    debug_return_bool(fmt_server_message(buf, &msg));
+    debug_return_bool(fmt_server_message(closure, &msg));
 }
 
 static bool
-fmt_log_id_message(const char *id, struct connection_buffer *buf)
+fmt_log_id_message(const char *id, struct connection_closure *closure)
 {
     ServerMessage msg = SERVER_MESSAGE__INIT;
     debug_decl(fmt_log_id_message, SUDO_DEBUG_UTIL);
@@ -208,11 +336,11 @@ fmt_log_id_message(const char *id, struct connection_buffer *buf)
     msg.u.log_id = (char *)id;
     msg.type_case = SERVER_MESSAGE__TYPE_LOG_ID;
 
-    debug_return_bool(fmt_server_message(buf, &msg));
+    debug_return_bool(fmt_server_message(closure, &msg));
 }
 
 static bool
-fmt_error_message(const char *errstr, struct connection_buffer *buf)
+fmt_error_message(const char *errstr, struct connection_closure *closure)
 {
     ServerMessage msg = SERVER_MESSAGE__INIT;
     debug_decl(fmt_error_message, SUDO_DEBUG_UTIL);
@@ -220,7 +348,20 @@ fmt_error_message(const char *errstr, struct connection_buffer *buf)
     msg.u.error = (char *)errstr;
     msg.type_case = SERVER_MESSAGE__TYPE_ERROR;
 
-    debug_return_bool(fmt_server_message(buf, &msg));
+    debug_return_bool(fmt_server_message(closure, &msg));
+}
+
+/*
+ * A ServerMessage with a session ID but no type tells the client
+ * that a multiplexed session is complete.
+ */
+static bool
+fmt_session_end_message(struct connection_closure *closure)
+{
+    ServerMessage msg = SERVER_MESSAGE__INIT;
+    debug_decl(fmt_session_end_message, SUDO_DEBUG_UTIL);
+
+    debug_return_bool(fmt_server_message(closure, &msg));
 }
 
 struct logsrvd_info_closure {
@@ -328,14 +469,8 @@ handle_accept(AcceptMessage *msg, struct connection_closure *closure)
 
     if (msg->expect_iobufs) {
 	/* Send log ID to client for restarting connections. */
-	if (!fmt_log_id_message(closure->evlog->iolog_path, &closure->write_buf))
+	if (!fmt_log_id_message(closure->evlog->iolog_path, closure))
 	    debug_return_bool(false);
-	if (sudo_ev_add(closure->evbase, closure->write_ev,
-		logsrvd_conf_get_sock_timeout(), false) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to add server write event");
-	    debug_return_bool(false);
-	}
     }
 
     closure->state = RUNNING;
@@ -414,7 +549,8 @@ handle_exit(ExitMessage *msg, struct connection_closure *closure)
     if (closure->log_io) {
 	/* No more data, command exited. */
 	closure->state = EXITED;
-	sudo_ev_del(closure->evbase, closure->read_ev);
+	if (closure->parent == NULL)
+	    sudo_ev_del(closure->evbase, closure->read_ev);
 
 	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: elapsed time: %lld, %ld",
 	    __func__, (long long)closure->elapsed_time.tv_sec,
@@ -456,22 +592,24 @@ handle_restart(RestartMessage *msg, struct connection_closure *closure)
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: received RestartMessage for %s",
 	__func__, msg->log_id);
 
+    /* There is no AcceptMessage on restart, only the I/O log path is used. */
+    if ((closure->evlog = calloc(1, sizeof(*closure->evlog))) == NULL) {
+	closure->errstr = _("unable to allocate memory");
+	debug_return_bool(false);
+    }
+
     if (!iolog_restart(msg, closure)) {
 	sudo_debug_printf(SUDO_DEBUG_WARN, "%s: unable to restart I/O log", __func__);
 	/* XXX - structured error message so client can send from beginning */
-	if (!fmt_error_message(closure->errstr, &closure->write_buf))
+	if (!fmt_error_message(closure->errstr, closure))
 	    debug_return_bool(false);
-	sudo_ev_del(closure->evbase, closure->read_ev);
-	if (sudo_ev_add(closure->evbase, closure->write_ev,
-		logsrvd_conf_get_sock_timeout(), false) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to add server write event");
-	    debug_return_bool(false);
-	}
+	if (closure->parent == NULL)
+	    sudo_ev_del(closure->evbase, closure->read_ev);
 	closure->state = ERROR;
 	debug_return_bool(true);
     }
 
+    closure->log_io = true;
     closure->state = RUNNING;
     debug_return_bool(true);
 }
@@ -510,6 +648,73 @@ handle_alert(AlertMessage *msg, struct connection_closure *closure)
     debug_return_bool(true);
 }
 
+/*
+ * Add closure to the list of I/O logs to be committed by the next group
+ * commit.  The group commit runs iolog_commit_interval after the first
+ * uncommitted write, or once iolog_commit_bytes have been written across
+ * all connections, whichever comes first.
+ */
+static bool
+schedule_commit(struct connection_closure *closure, size_t len)
+{
+    const size_t commit_bytes = logsrvd_conf_iolog_commit_bytes();
+    struct timespec *interval = logsrvd_conf_iolog_commit_interval();
+    debug_decl(schedule_commit, SUDO_DEBUG_UTIL);
+
+    if (!closure->commit_pending) {
+	TAILQ_INSERT_TAIL(&commit_list, closure, commit_entries);
+	closure->commit_pending = true;
+    }
+    uncommitted_bytes += len;
+    if (commit_bytes != 0 && uncommitted_bytes >= commit_bytes)
+	commit_now = true;
+
+    if (group_commit_ev == NULL) {
+	group_commit_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
+	    group_commit_cb, NULL);
+	if (group_commit_ev == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to allocate group commit event");
+	    debug_return_bool(false);
+	}
+    }
+    if (!ISSET(group_commit_ev->flags, SUDO_EVQ_INSERTED)) {
+	if (sudo_ev_add(closure->evbase, group_commit_ev, interval, false) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to add group commit event");
+	    debug_return_bool(false);
+	}
+	sudo_gettime_mono(&commit_deadline);
+	sudo_timespecadd(&commit_deadline, interval, &commit_deadline);
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Run the group commit if it is due.
+ * Timeout events only fire when the event loop is otherwise idle,
+ * so this is also checked after each batch of client messages.
+ */
+static void
+group_commit_check(void)
+{
+    struct timespec now;
+    debug_decl(group_commit_check, SUDO_DEBUG_UTIL);
+
+    if (TAILQ_EMPTY(&commit_list))
+	debug_return;
+
+    if (!commit_now) {
+	sudo_gettime_mono(&now);
+	if (sudo_timespeccmp(&now, &commit_deadline, <))
+	    debug_return;
+    }
+    group_commit_cb(-1, SUDO_EV_TIMEOUT, NULL);
+
+    debug_return;
+}
+
 static bool
 handle_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure)
 {
@@ -548,15 +753,9 @@ handle_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure)
 	}
     }
 
-    /* Schedule a commit point in 10 sec if one is not already pending. */
-    if (!ISSET(closure->commit_ev->flags, SUDO_EVQ_INSERTED)) {
-	struct timespec tv = { ACK_FREQUENCY, 0 };
-	if (sudo_ev_add(closure->evbase, closure->commit_ev, &tv, false) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to add commit point event");
-	    debug_return_bool(false);
-	}
-    }
+    /* The data will be acknowledged after the next group commit. */
+    if (!schedule_commit(closure, msg->data.len))
+	debug_return_bool(false);
 
     debug_return_bool(true);
 }
@@ -646,19 +845,10 @@ handle_client_hello(ClientHello *msg, struct connection_closure *closure)
 }
 
 static bool
-handle_client_message(uint8_t *buf, size_t len,
-    struct connection_closure *closure)
+dispatch_client_message(ClientMessage *msg, struct connection_closure *closure)
 {
-    ClientMessage *msg;
     bool ret = false;
-    debug_decl(handle_client_message, SUDO_DEBUG_UTIL);
-
-    msg = client_message__unpack(NULL, len, buf);
-    if (msg == NULL) {
-	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-	    "unable to unpack ClientMessage size %zu", len);
-	debug_return_bool(false);
-    }
+    debug_decl(dispatch_client_message, SUDO_DEBUG_UTIL);
 
     switch (msg->type_case) {
     case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
@@ -706,7 +896,215 @@ handle_client_message(uint8_t *buf, size_t len,
 	closure->errstr = _("unrecognized ClientMessage type");
 	break;
     }
-    client_message__free_unpacked(msg, NULL);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Allocate a closure for a new multiplexed session on the connection.
+ * Sessions share the parent's socket and write queue.
+ */
+static struct connection_closure *
+session_closure_alloc(struct connection_closure *parent, uint32_t session_id)
+{
+    struct connection_closure *closure;
+    debug_decl(session_closure_alloc, SUDO_DEBUG_UTIL);
+
+    if ((closure = calloc(1, sizeof(*closure))) == NULL)
+	debug_return_ptr(NULL);
+
+    closure->parent = parent;
+    closure->session_id = session_id;
+    closure->iolog_dir_fd = -1;
+    closure->iolog_index_fd = -1;
+    closure->sock = -1;
+    closure->tls = parent->tls;
+    closure->evbase = parent->evbase;
+    memcpy(closure->ipaddr, parent->ipaddr, sizeof(closure->ipaddr));
+    TAILQ_INIT(&closure->sessions);
+    TAILQ_INIT(&closure->write_bufs);
+    TAILQ_INSERT_TAIL(&parent->sessions, closure, entries);
+    TAILQ_INSERT_TAIL(&parent->session_hash[session_id % SESSION_HASH_SIZE],
+	closure, hash_entries);
+    parent->nsessions++;
+
+    closure->commit_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
+	server_commit_cb, closure);
+    if (closure->commit_ev == NULL) {
+	connection_closure_free(closure);
+	debug_return_ptr(NULL);
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: new session %u from %s",
+	__func__, session_id, parent->ipaddr);
+
+    debug_return_ptr(closure);
+}
+
+/*
+ * Tell the client that a multiplexed session is complete and free it.
+ * Returns false if the end of session message could not be queued.
+ */
+static bool
+session_finish(struct connection_closure *closure)
+{
+    bool ret;
+    debug_decl(session_finish, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: session %u finished",
+	__func__, closure->session_id);
+
+    ret = fmt_session_end_message(closure);
+    connection_closure_free(closure);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Refuse a new session on a connection that already has the maximum
+ * number of sessions open.  The client is sent an error message for
+ * the session followed by an end of session message.
+ * Returns false if the messages could not be queued.
+ */
+static bool
+reject_session(struct connection_closure *parent, uint32_t session_id)
+{
+    ServerMessage errmsg = SERVER_MESSAGE__INIT;
+    ServerMessage endmsg = SERVER_MESSAGE__INIT;
+    debug_decl(reject_session, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"%s: rejecting session %u from %s, %u sessions already open",
+	__func__, session_id, parent->ipaddr, parent->nsessions);
+
+    errmsg.u.error = (char *)_("too many sessions");
+    errmsg.type_case = SERVER_MESSAGE__TYPE_ERROR;
+    errmsg.session_id = session_id;
+    if (!fmt_server_message(parent, &errmsg))
+	debug_return_bool(false);
+
+    endmsg.session_id = session_id;
+    debug_return_bool(fmt_server_message(parent, &endmsg));
+}
+
+/*
+ * Route a ClientMessage for a multiplexed session to its closure,
+ * creating the session on first use.  A message with a session ID
+ * but no type closes the session.  Errors only affect the session
+ * they occur in, the connection itself stays open.
+ */
+static bool
+handle_session_message(ClientMessage *msg, struct connection_closure *parent)
+{
+    struct connection_closure *closure;
+    struct connection_list *bucket;
+    int i;
+    debug_decl(handle_session_message, SUDO_DEBUG_UTIL);
+
+    if (!parent->multiplexed) {
+	if (parent->state != INITIAL || parent->evlog != NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"session %u on non-multiplexed connection", msg->session_id);
+	    parent->errstr = _("state machine error");
+	    debug_return_bool(false);
+	}
+	parent->session_hash =
+	    calloc(SESSION_HASH_SIZE, sizeof(*parent->session_hash));
+	if (parent->session_hash == NULL) {
+	    parent->errstr = _("unable to allocate memory");
+	    debug_return_bool(false);
+	}
+	for (i = 0; i < SESSION_HASH_SIZE; i++)
+	    TAILQ_INIT(&parent->session_hash[i]);
+	parent->multiplexed = true;
+    }
+
+    bucket = &parent->session_hash[msg->session_id % SESSION_HASH_SIZE];
+    TAILQ_FOREACH(closure, bucket, hash_entries) {
+	if (closure->session_id == msg->session_id)
+	    break;
+    }
+
+    if (msg->type_case == CLIENT_MESSAGE__TYPE__NOT_SET) {
+	/* Client is done with the session. */
+	if (closure != NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: client closed session %u",
+		__func__, msg->session_id);
+	    connection_closure_free(closure);
+	}
+	debug_return_bool(true);
+    }
+
+    if (closure == NULL) {
+	if (parent->nsessions >= logsrvd_conf_server_max_sessions())
+	    debug_return_bool(reject_session(parent, msg->session_id));
+	closure = session_closure_alloc(parent, msg->session_id);
+	if (closure == NULL) {
+	    parent->errstr = _("unable to allocate memory");
+	    debug_return_bool(false);
+	}
+    }
+
+    if (!dispatch_client_message(msg, closure)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "session %u: unable to handle ClientMessage", closure->session_id);
+	if (closure->errstr != NULL) {
+	    if (!fmt_error_message(closure->errstr, closure))
+		debug_return_bool(false);
+	}
+	debug_return_bool(session_finish(closure));
+    }
+
+    switch (closure->state) {
+    case FINISHED:
+    case ERROR:
+	debug_return_bool(session_finish(closure));
+    default:
+	break;
+    }
+
+    debug_return_bool(true);
+}
+
+static bool
+handle_client_message(uint8_t *buf, size_t len,
+    struct connection_closure *closure)
+{
+    ProtobufCAllocator *allocator = NULL;
+    ClientMessage *msg;
+    bool ret;
+    debug_decl(handle_client_message, SUDO_DEBUG_UTIL);
+
+    /*
+     * Unpack into the message arena, which is reset once the whole
+     * read buffer has been processed.  If the arena cannot be allocated
+     * we fall back on the default protobuf-c allocator.
+     */
+    if (msg_arena == NULL)
+	msg_arena = logsrv_arena_alloc(MSG_ARENA_CHUNK_SIZE);
+    if (msg_arena != NULL)
+	allocator = logsrv_arena_allocator(msg_arena);
+
+    msg = client_message__unpack(allocator, len, buf);
+    if (msg == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to unpack ClientMessage size %zu", len);
+	debug_return_bool(false);
+    }
+
+    if (msg->session_id != 0) {
+	ret = handle_session_message(msg, closure);
+    } else if (closure->multiplexed &&
+	    msg->type_case != CLIENT_MESSAGE__TYPE_HELLO_MSG) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "missing session ID on multiplexed connection");
+	closure->errstr = _("state machine error");
+	ret = false;
+    } else {
+	ret = dispatch_client_message(msg, closure);
+    }
+    if (allocator == NULL)
+	client_message__free_unpacked(msg, NULL);
 
     debug_return_bool(ret);
 }
@@ -736,10 +1134,18 @@ static void
 server_shutdown(struct sudo_event_base *base)
 {
     struct connection_closure *closure, *next;
+    struct listener *l;
     struct sudo_event *ev;
     struct timespec tv = { 0, 0 };
     debug_decl(server_shutdown, SUDO_DEBUG_UTIL);
 
+    /* Stop accepting new connections. */
+    TAILQ_FOREACH(l, &listeners, entries) {
+	sudo_ev_del(base, l->ev);
+    }
+    if (worker_ev != NULL)
+	sudo_ev_del(base, worker_ev);
+
     if (TAILQ_EMPTY(&connections)) {
 	sudo_ev_loopbreak(base);
 	debug_return;
@@ -748,7 +1154,28 @@ server_shutdown(struct sudo_event_base *base)
     TAILQ_FOREACH_SAFE(closure, &connections, entries, next) {
 	closure->state = SHUTDOWN;
 	sudo_ev_del(base, closure->read_ev);
-	if (closure->log_io) {
+	if (closure->multiplexed) {
+	    struct connection_closure *session, *session_next;
+
+	    TAILQ_FOREACH_SAFE(session, &closure->sessions, entries, session_next) {
+		session->state = SHUTDOWN;
+		if (session->log_io) {
+		    /* Schedule final commit point for the session. */
+		    if (sudo_ev_add(base, session->commit_ev, &tv, false) == -1) {
+			sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+			    "unable to add commit point event");
+		    }
+		} else {
+		    session_finish(session);
+		}
+	    }
+	    /* Connection is closed once the queue drains and sessions end. */
+	    if (TAILQ_EMPTY(&closure->sessions) &&
+		    TAILQ_EMPTY(&closure->write_bufs)) {
+		sudo_ev_del(closure->evbase, closure->write_ev);
+		connection_closure_free(closure);
+	    }
+	} else if (closure->log_io) {
 	    /* Schedule final commit point for the connection. */
 	    if (sudo_ev_add(base, closure->commit_ev, &tv, false) == -1) {
 		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
@@ -783,7 +1210,7 @@ static void
 server_msg_cb(int fd, int what, void *v)
 {
     struct connection_closure *closure = v;
-    struct connection_buffer *buf = &closure->write_buf;
+    struct connection_buffer *buf;
     ssize_t nwritten;
     debug_decl(server_msg_cb, SUDO_DEBUG_UTIL);
 
@@ -805,6 +1232,12 @@ server_msg_cb(int fd, int what, void *v)
         goto finished;
     }
 
+    if ((buf = TAILQ_FIRST(&closure->write_bufs)) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "missing write buffer");
+	goto finished;
+    }
+
     sudo_debug_printf(SUDO_DEBUG_INFO, "%s: sending %u bytes to client",
 	__func__, buf->len - buf->off);
 
@@ -858,10 +1291,17 @@ server_msg_cb(int fd, int what, void *v)
 	    "%s: finished sending %u bytes to client", __func__, buf->len);
 	buf->off = 0;
 	buf->len = 0;
-	sudo_ev_del(closure->evbase, closure->write_ev);
-	if (closure->state == FINISHED || closure->state == SHUTDOWN ||
-		closure->state == ERROR)
-	    goto finished;
+	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+	bufpool_put(&free_bufs, buf);
+	if (TAILQ_EMPTY(&closure->write_bufs)) {
+	    sudo_ev_del(closure->evbase, closure->write_ev);
+	    if (closure->state == FINISHED || closure->state == SHUTDOWN ||
+		    closure->state == ERROR) {
+		/* Wait for multiplexed sessions to send their final message. */
+		if (TAILQ_EMPTY(&closure->sessions))
+		    goto finished;
+	    }
+	}
     }
     debug_return;
 
@@ -877,7 +1317,7 @@ static void
 client_msg_cb(int fd, int what, void *v)
 {
     struct connection_closure *closure = v;
-    struct connection_buffer *buf = &closure->read_buf;
+    struct connection_buffer *buf = closure->read_buf;
     uint32_t msg_len;
     ssize_t nread;
     debug_decl(client_msg_cb, SUDO_DEBUG_UTIL);
@@ -897,7 +1337,8 @@ client_msg_cb(int fd, int what, void *v)
 
 #if defined(HAVE_OPENSSL)
     if (closure->tls) {
-       nread = SSL_read(closure->ssl, buf->data + buf->len, buf->size);
+       nread = SSL_read(closure->ssl, buf->data + buf->len,
+	    buf->size - buf->len);
         if (nread <= 0) {
             int err = SSL_get_error(closure->ssl, nread);
             switch (err) {
@@ -982,7 +1423,7 @@ client_msg_cb(int fd, int what, void *v)
 	    /* Incomplete message, we'll read the rest next time. */
 	    if (!expand_buf(buf, msg_len + sizeof(msg_len)))
 		goto finished;
-	    debug_return;
+	    goto done;
 	}
 
 	/* Parse ClientMessage, could be zero bytes. */
@@ -996,25 +1437,31 @@ client_msg_cb(int fd, int what, void *v)
 	}
 	buf->off += msg_len;
     }
+    /* Move a partial message length, if any, to the start of the buffer. */
+    if (buf->off != buf->len)
+	memmove(buf->data, buf->data + buf->off, buf->len - buf->off);
     buf->len -= buf->off;
     buf->off = 0;
 
     if (closure->state == FINISHED)
 	goto finished;
 
+done:
+    /* All messages in this batch have been handled, release them at once. */
+    if (msg_arena != NULL)
+	logsrv_arena_reset(msg_arena);
+
+    /* May free closure. */
+    group_commit_check();
     debug_return;
 send_error:
     if (closure->errstr == NULL)
 	goto finished;
-    if (fmt_error_message(closure->errstr, &closure->write_buf)) {
+    if (fmt_error_message(closure->errstr, closure))
 	sudo_ev_del(closure->evbase, closure->read_ev);
-	if (sudo_ev_add(closure->evbase, closure->write_ev,
-		logsrvd_conf_get_sock_timeout(), false) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-		"unable to add server write event");
-	}
-    }
 finished:
+    if (msg_arena != NULL)
+	logsrv_arena_reset(msg_arena);
     connection_closure_free(closure);
     debug_return;
 }
@@ -1031,6 +1478,17 @@ server_commit_cb(int unused, int what, void *v)
 
     debug_decl(server_commit_cb, SUDO_DEBUG_UTIL);
 
+    /* This commit covers any pending periodic or final commit. */
+    if (closure->commit_pending) {
+	TAILQ_REMOVE(&commit_list, closure, commit_entries);
+	closure->commit_pending = false;
+    }
+    sudo_ev_del(closure->evbase, closure->commit_ev);
+
+    /* Only acknowledge data that has actually been committed. */
+    if (!iolog_commit_all(closure, logsrvd_conf_iolog_sync()))
+	goto bad;
+
     /* Send the client an acknowledgement of what has been committed to disk. */
     commit_point.tv_sec = closure->elapsed_time.tv_sec;
     commit_point.tv_nsec = closure->elapsed_time.tv_nsec;
@@ -1041,27 +1499,55 @@ server_commit_cb(int unused, int what, void *v)
 	__func__, (long long)closure->elapsed_time.tv_sec,
 	closure->elapsed_time.tv_nsec);
 
-    /* XXX - assumes no other server message pending, use a queue instead? */
-    if (!fmt_server_message(&closure->write_buf, &msg)) {
+    if (!fmt_server_message(closure, &msg)) {
 	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 	    "unable to format ServerMessage (commit point)");
 	goto bad;
     }
-    if (sudo_ev_add(closure->evbase, closure->write_ev,
-        logsrvd_conf_get_sock_timeout(), false) == -1) {
-        sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
-            "unable to add server write event");
-        goto bad;
-    }
 
     if (closure->state == EXITED)
 	closure->state = FINISHED;
+
+    /* The final commit point ends a multiplexed session. */
+    if (closure->parent != NULL) {
+	if (closure->state == FINISHED || closure->state == SHUTDOWN)
+	    session_finish(closure);
+    }
     debug_return;
 bad:
+    if (closure->parent != NULL)
+	closure = closure->parent;
     connection_closure_free(closure);
     debug_return;
 }
 
+/*
+ * Commit all I/O logs with pending data and send their commit points.
+ * Each log file is still flushed (and synced if iolog_sync is set) on
+ * its own; batching only limits that to once per file per commit
+ * instead of once per write.
+ */
+static void
+group_commit_cb(int unused, int what, void *v)
+{
+    struct connection_closure *closure;
+    debug_decl(group_commit_cb, SUDO_DEBUG_UTIL);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "%s: committing %zu bytes",
+	__func__, uncommitted_bytes);
+
+    uncommitted_bytes = 0;
+    commit_now = false;
+    if (group_commit_ev != NULL)
+	sudo_ev_del(NULL, group_commit_ev);
+
+    /* server_commit_cb() removes the closure from the list (or frees it). */
+    while ((closure = TAILQ_FIRST(&commit_list)) != NULL)
+	server_commit_cb(-1, SUDO_EV_TIMEOUT, closure);
+
+    debug_return;
+}
+
 /*
  * Begin the sudo logserver protocol.
  * When we enter the event loop the ServerHello message will be written
@@ -1070,13 +1556,9 @@ bad:
 static bool
 start_protocol(struct connection_closure *closure)
 {
-    const struct timespec *timeout = logsrvd_conf_get_sock_timeout();
     debug_decl(start_protocol, SUDO_DEBUG_UTIL);
 
-    if (!fmt_hello_message(&closure->write_buf, closure->tls))
-	debug_return_bool(false);
-
-    if (sudo_ev_add(closure->evbase, closure->write_ev, timeout, false) == -1)
+    if (!fmt_hello_message(closure))
 	debug_return_bool(false);
 
     /* No read timeout, client messages may happen at arbitrary times. */
@@ -1503,15 +1985,17 @@ connection_closure_alloc(int sock, bool tls, struct sudo_event_base *base)
 	debug_return_ptr(NULL);
 
     closure->iolog_dir_fd = -1;
+    closure->iolog_index_fd = -1;
     closure->sock = sock;
     closure->tls = tls;
     closure->evbase = base;
+    TAILQ_INIT(&closure->sessions);
+    TAILQ_INIT(&closure->write_bufs);
 
     TAILQ_INSERT_TAIL(&connections, closure, entries);
 
-    closure->read_buf.size = 64 * 1024;
-    closure->read_buf.data = malloc(closure->read_buf.size);
-    if (closure->read_buf.data == NULL)
+    closure->read_buf = bufpool_get(&free_bufs, READ_BUF_SIZE);
+    if (closure->read_buf == NULL)
 	goto bad;
 
     closure->commit_ev = sudo_ev_alloc(-1, SUDO_EV_TIMEOUT,
@@ -1671,6 +2155,147 @@ bad:
     debug_return_int(-1);
 }
 
+/*
+ * Message sent from the supervisor to a worker along with the
+ * file descriptor of a newly-accepted connection.
+ */
+struct worker_handoff {
+    union sockaddr_union sa_un;
+    bool tls;
+};
+
+/*
+ * Send a newly-accepted socket to the next worker, round-robin.
+ * If a worker's channel is full or broken, try the next one.
+ * The socket is closed on success.
+ */
+static bool
+handoff_connection(int sock, bool tls, union sockaddr_union *sa_un)
+{
+    struct logsrvd_worker *worker;
+    struct worker_handoff handoff;
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(sizeof(int))];
+    } cmsgbuf;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov[1];
+    unsigned int tries = nchildren;
+    debug_decl(handoff_connection, SUDO_DEBUG_UTIL);
+
+    memset(&handoff, 0, sizeof(handoff));
+    handoff.sa_un = *sa_un;
+    handoff.tls = tls;
+
+    while (tries-- > 0 && (worker = TAILQ_FIRST(&workers)) != NULL) {
+	/* Rotate the worker to the end of the list. */
+	TAILQ_REMOVE(&workers, worker, entries);
+	TAILQ_INSERT_TAIL(&workers, worker, entries);
+
+	memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+	memset(&msg, 0, sizeof(msg));
+	iov[0].iov_base = &handoff;
+	iov[0].iov_len = sizeof(handoff);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &sock, sizeof(int));
+
+	if (sendmsg(worker->sock, &msg, 0) == (ssize_t)sizeof(handoff)) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"passed connection to worker %d", (int)worker->pid);
+	    close(sock);
+	    debug_return_bool(true);
+	}
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to pass connection to worker %d", (int)worker->pid);
+    }
+
+    debug_return_bool(false);
+}
+
+/*
+ * Receive a connection from the supervisor.
+ * On EOF, the supervisor has retired us; stop accepting connections
+ * but keep serving the existing ones, exiting when they are done.
+ */
+static void
+worker_cb(int fd, int what, void *v)
+{
+    struct sudo_event_base *evbase = v;
+    struct worker_handoff handoff;
+    union {
+	struct cmsghdr hdr;
+	char buf[CMSG_SPACE(sizeof(int))];
+    } cmsgbuf;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov[1];
+    ssize_t nread;
+    int sock = -1;
+    debug_decl(worker_cb, SUDO_DEBUG_UTIL);
+
+    memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+    memset(&msg, 0, sizeof(msg));
+    iov[0].iov_base = &handoff;
+    iov[0].iov_len = sizeof(handoff);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsgbuf.buf;
+    msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+    nread = recvmsg(fd, &msg, 0);
+    switch (nread) {
+    case -1:
+	if (errno == EAGAIN || errno == EINTR)
+	    debug_return;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to receive connection from supervisor");
+	FALLTHROUGH;
+    case 0:
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "supervisor closed channel, retiring");
+	sudo_ev_free(worker_ev);
+	worker_ev = NULL;
+	close(fd);
+	worker_retiring = true;
+	if (TAILQ_EMPTY(&connections))
+	    sudo_ev_loopbreak(evbase);
+	debug_return;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+	    cmsg->cmsg_type == SCM_RIGHTS &&
+	    cmsg->cmsg_len == CMSG_LEN(sizeof(int))) {
+	memcpy(&sock, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (sock == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "missing file descriptor in message from supervisor");
+	debug_return;
+    }
+    if (nread != (ssize_t)sizeof(handoff) || ISSET(msg.msg_flags, MSG_CTRUNC)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "short message from supervisor: %zd bytes", nread);
+	close(sock);
+	debug_return;
+    }
+
+    if (!new_connection(sock, handoff.tls, &handoff.sa_un.sa, evbase)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to start new connection");
+    }
+
+    debug_return;
+}
+
 static void
 listener_cb(int fd, int what, void *v)
 {
@@ -1692,7 +2317,14 @@ listener_cb(int fd, int what, void *v)
 		    "unable to set SO_KEEPALIVE option");
 	    }
 	}
-	if (!new_connection(sock, l->tls, &s_un.sa, evbase)) {
+	if (supervisor) {
+	    /* Pass the connection to a worker process. */
+	    if (!handoff_connection(sock, l->tls, &s_un)) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to pass connection to a worker");
+		close(sock);
+	    }
+	} else if (!new_connection(sock, l->tls, &s_un.sa, evbase)) {
 	    /* TODO: pause accepting on ENOMEM */
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
 		"unable to start new connection");
@@ -1734,6 +2366,25 @@ register_listener(struct listen_address *addr, struct sudo_event_base *evbase)
     debug_return_bool(true);
 }
 
+/*
+ * Close and free all listeners.
+ */
+static void
+free_listeners(void)
+{
+    struct listener *l;
+    debug_decl(free_listeners, SUDO_DEBUG_UTIL);
+
+    while ((l = TAILQ_FIRST(&listeners)) != NULL) {
+	TAILQ_REMOVE(&listeners, l, entries);
+	sudo_ev_free(l->ev);
+	close(l->sock);
+	free(l);
+    }
+
+    debug_return;
+}
+
 /*
  * Register listeners and init the TLS context.
  */
@@ -1741,18 +2392,12 @@ static bool
 server_setup(struct sudo_event_base *base)
 {
     struct listen_address *addr;
-    struct listener *l;
     int nlisteners = 0;
     bool ret, config_tls = false;
     debug_decl(server_setup, SUDO_DEBUG_UTIL);
 
     /* Free old listeners (if any) and register new ones. */
-    while ((l = TAILQ_FIRST(&listeners)) != NULL) {
-	TAILQ_REMOVE(&listeners, l, entries);
-	sudo_ev_free(l->ev);
-	close(l->sock);
-	free(l);
-    }
+    free_listeners();
     TAILQ_FOREACH(addr, logsrvd_conf_listen_address(), entries) {
 	nlisteners += register_listener(addr, base);
 	if (addr->tls)
@@ -1784,6 +2429,23 @@ server_reload(struct sudo_event_base *base)
 	if (!server_setup(base))
 	    sudo_fatalx("%s", U_("unable setup listen socket"));
 
+	/*
+	 * Replace workers so they pick up the new configuration.
+	 * Existing connections are finished by whichever process has them.
+	 */
+	if (supervisor)
+	    retire_workers();
+	if (logsrvd_conf_server_workers() > 1) {
+	    supervisor =
+		start_workers(base, logsrvd_conf_server_workers()) > 0;
+	    if (!supervisor) {
+		sudo_warnx("%s", U_("unable to start worker processes"));
+	    }
+	} else if (supervisor) {
+	    /* Accept connections in this process again. */
+	    supervisor = false;
+	}
+
 	/* Re-read sudo.conf and re-initialize debugging. */
 	sudo_debug_deregister(logsrvd_debug_instance);
 	logsrvd_debug_instance = SUDO_DEBUG_INSTANCE_INITIALIZER;
@@ -1796,6 +2458,240 @@ server_reload(struct sudo_event_base *base)
     debug_return;
 }
 
+/*
+ * Worker process main loop.  The worker gets a new event base so that
+ * it does not share the supervisor's signal pipe.  Connections are
+ * received from the supervisor over sock.  Does not return.
+ */
+static void
+worker_main(struct sudo_event_base *parent_base, int sock)
+{
+    struct connection_closure *closure;
+    struct sudo_event_base *evbase;
+    struct logsrvd_worker *worker;
+    int devnull;
+    debug_decl(worker_main, SUDO_DEBUG_UTIL);
+
+    supervisor = false;
+    nchildren = 0;
+
+    /* Close the supervisor's end of the other workers' channels. */
+    while ((worker = TAILQ_FIRST(&workers)) != NULL) {
+	TAILQ_REMOVE(&workers, worker, entries);
+	close(worker->sock);
+	free(worker);
+    }
+    while ((worker = TAILQ_FIRST(&retired_workers)) != NULL) {
+	TAILQ_REMOVE(&retired_workers, worker, entries);
+	free(worker);
+    }
+
+    /* Only the supervisor accepts connections. */
+    free_listeners();
+
+    /*
+     * Connections the supervisor accepted before workers were started
+     * on reload stay with the supervisor.  Our copy of the socket must
+     * be closed or the client would never see the connection end.
+     */
+    if (!TAILQ_EMPTY(&connections)) {
+	if ((devnull = open(_PATH_DEVNULL, O_RDWR)) == -1)
+	    sudo_fatal(U_("unable to open %s"), _PATH_DEVNULL);
+	while ((closure = TAILQ_FIRST(&connections)) != NULL)
+	    connection_closure_discard(closure, devnull);
+	close(devnull);
+    }
+    TAILQ_INIT(&connections);
+
+    sudo_ev_free(group_commit_ev);
+    group_commit_ev = NULL;
+    TAILQ_INIT(&commit_list);
+    uncommitted_bytes = 0;
+    commit_now = false;
+    sudo_ev_base_free(parent_base);
+
+    if ((evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatal(NULL);
+    worker_ev = sudo_ev_alloc(sock, SUDO_EV_READ|SUDO_EV_PERSIST, worker_cb,
+	evbase);
+    if (worker_ev == NULL)
+	sudo_fatal(NULL);
+    if (sudo_ev_add(evbase, worker_ev, NULL, false) == -1)
+	sudo_fatal("%s", U_("unable to add event to queue"));
+
+    /* Only the supervisor reloads the configuration. */
+    signal(SIGHUP, SIG_IGN);
+    register_signal(SIGINT, evbase);
+    register_signal(SIGTERM, evbase);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "worker %d started", (int)getpid());
+    sudo_ev_dispatch(evbase);
+    sudo_debug_printf(SUDO_DEBUG_INFO, "worker %d exiting", (int)getpid());
+
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Fork a new worker process connected to the supervisor via a socketpair.
+ */
+static bool
+spawn_worker(struct sudo_event_base *base)
+{
+    struct logsrvd_worker *worker;
+    int flags, sv[2];
+    debug_decl(spawn_worker, SUDO_DEBUG_UTIL);
+
+    if ((worker = malloc(sizeof(*worker))) == NULL) {
+	sudo_warn(NULL);
+	debug_return_bool(false);
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+	sudo_warn("socketpair");
+	free(worker);
+	debug_return_bool(false);
+    }
+
+    switch (worker->pid = fork()) {
+    case -1:
+	sudo_warn("fork");
+	close(sv[0]);
+	close(sv[1]);
+	free(worker);
+	debug_return_bool(false);
+    case 0:
+	/* child */
+	free(worker);
+	close(sv[0]);
+	worker_main(base, sv[1]);
+	/* NOTREACHED */
+    }
+
+    /* parent */
+    close(sv[1]);
+    worker->sock = sv[0];
+    flags = fcntl(worker->sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(worker->sock, F_SETFL, flags | O_NONBLOCK) == -1)
+	sudo_warn("fcntl(O_NONBLOCK)");
+    (void)fcntl(worker->sock, F_SETFD, FD_CLOEXEC);
+    TAILQ_INSERT_TAIL(&workers, worker, entries);
+    nchildren++;
+    sudo_debug_printf(SUDO_DEBUG_INFO, "started worker %d", (int)worker->pid);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Start up to count workers, returns the number actually started.
+ */
+static int
+start_workers(struct sudo_event_base *base, unsigned int count)
+{
+    int started = 0;
+    debug_decl(start_workers, SUDO_DEBUG_UTIL);
+
+    while ((unsigned int)started < count && spawn_worker(base))
+	started++;
+
+    debug_return_int(started);
+}
+
+/*
+ * Close the channels to all current workers.  Each worker will
+ * finish its active connections and exit; they are not replaced.
+ */
+static void
+retire_workers(void)
+{
+    struct logsrvd_worker *worker;
+    debug_decl(retire_workers, SUDO_DEBUG_UTIL);
+
+    while ((worker = TAILQ_FIRST(&workers)) != NULL) {
+	TAILQ_REMOVE(&workers, worker, entries);
+	sudo_debug_printf(SUDO_DEBUG_INFO, "retiring worker %d",
+	    (int)worker->pid);
+	close(worker->sock);
+	worker->sock = -1;
+	TAILQ_INSERT_TAIL(&retired_workers, worker, entries);
+    }
+
+    debug_return;
+}
+
+/*
+ * Reap exited workers, replacing any that were still active.
+ */
+static void
+reap_workers(struct sudo_event_base *base)
+{
+    struct logsrvd_worker *worker;
+    int status;
+    pid_t pid;
+    debug_decl(reap_workers, SUDO_DEBUG_UTIL);
+
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+	nchildren--;
+	TAILQ_FOREACH(worker, &workers, entries) {
+	    if (worker->pid == pid)
+		break;
+	}
+	if (worker == NULL) {
+	    /* A retired worker, nothing to replace. */
+	    TAILQ_FOREACH(worker, &retired_workers, entries) {
+		if (worker->pid == pid) {
+		    TAILQ_REMOVE(&retired_workers, worker, entries);
+		    free(worker);
+		    break;
+		}
+	    }
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "worker %d exited", (int)pid);
+	    continue;
+	}
+	sudo_warnx(U_("worker process %d exited unexpectedly"), (int)pid);
+	TAILQ_REMOVE(&workers, worker, entries);
+	close(worker->sock);
+	free(worker);
+	if (!supervisor_shutting_down)
+	    start_workers(base, 1);
+    }
+
+    if (supervisor_shutting_down && nchildren == 0 &&
+	    TAILQ_EMPTY(&connections))
+	sudo_ev_loopbreak(base);
+
+    debug_return;
+}
+
+/*
+ * Stop accepting connections and shut down all workers.
+ * We exit once all the workers have finished.
+ */
+static void
+supervisor_shutdown(struct sudo_event_base *base, int signo)
+{
+    struct logsrvd_worker *worker;
+    debug_decl(supervisor_shutdown, SUDO_DEBUG_UTIL);
+
+    /* Workers, retired or not, shut down their active connections too. */
+    supervisor_shutting_down = true;
+    retire_workers();
+    TAILQ_FOREACH(worker, &retired_workers, entries) {
+	if (kill(worker->pid, signo) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to send signal %d to worker %d", signo,
+		(int)worker->pid);
+	}
+    }
+    if (!TAILQ_EMPTY(&connections)) {
+	/* Connections accepted before the workers were started on reload. */
+	server_shutdown(base);
+    } else if (nchildren == 0) {
+	sudo_ev_loopbreak(base);
+    }
+    free_listeners();
+
+    debug_return;
+}
+
 static void
 signal_cb(int signo, int what, void *v)
 {
@@ -1804,12 +2700,22 @@ signal_cb(int signo, int what, void *v)
 
     switch (signo) {
 	case SIGHUP:
+	    if (supervisor_shutting_down)
+		break;
 	    server_reload(base);
 	    break;
+	case SIGCHLD:
+	    reap_workers(base);
+	    break;
 	case SIGINT:
 	case SIGTERM:
-	    /* Shut down active connections. */
-	    server_shutdown(base);
+	    if (supervisor) {
+		/* Shut down the workers and wait for them to exit. */
+		supervisor_shutdown(base, signo);
+	    } else {
+		/* Shut down active connections. */
+		server_shutdown(base);
+	    }
 	    break;
 	default:
 	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
@@ -2031,6 +2937,7 @@ main(int argc, char *argv[])
     if (!server_setup(evbase))
 	sudo_fatalx("%s", U_("unable setup listen socket"));
 
+    register_signal(SIGCHLD, evbase);
     register_signal(SIGHUP, evbase);
     register_signal(SIGINT, evbase);
     register_signal(SIGTERM, evbase);
@@ -2039,6 +2946,13 @@ main(int argc, char *argv[])
     daemonize(nofork);
     signal(SIGPIPE, SIG_IGN);
 
+    /* Hand off connections to worker processes if configured. */
+    if (logsrvd_conf_server_workers() > 1) {
+	supervisor = true;
+	if (start_workers(evbase, logsrvd_conf_server_workers()) == 0)
+	    sudo_fatalx("%s", U_("unable to start worker processes"));
+    }
+
     sudo_ev_dispatch(evbase);
     if (!nofork && logsrvd_conf_pid_file() != NULL)
 	unlink(logsrvd_conf_pid_file());
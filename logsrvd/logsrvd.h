@@ -34,12 +34,22 @@
 /* Default timeout value for server socket */
 #define DEFAULT_SOCKET_TIMEOUT_SEC 30
 
-/* How often to send an ACK to the client (commit point) in seconds */
+/* Default interval between commit points (sent to the client) in seconds */
 #define ACK_FREQUENCY	10
 
 /* Shutdown timeout (in seconds) in case client connections time out. */
 #define SHUTDOWN_TIMEO	10
 
+/* Initial size of a connection's read buffer. */
+#define READ_BUF_SIZE	(64 * 1024)
+
+/* Free connection buffers are cached for reuse, up to this many and size. */
+#define BUFPOOL_MAX_COUNT	128
+#define BUFPOOL_MAX_SIZE	(256 * 1024)
+
+/* Size of the arena chunks ClientMessages are unpacked into. */
+#define MSG_ARENA_CHUNK_SIZE	(64 * 1024)
+
 /*
  * Connection status.
  * In the RUNNING state we expect I/O log buffers.
@@ -55,13 +65,25 @@ enum connection_status {
 
 /*
  * Per-connection state.
+ * When a client multiplexes sessions over a single connection, each
+ * session gets its own closure that is linked to the parent connection.
+ * Sessions are also hashed by ID so messages can be routed quickly.
  */
+#define LOGSRVD_SESSIONS_MAX	65536
+#define SESSION_HASH_SIZE	64
+TAILQ_HEAD(connection_list, connection_closure);
 struct connection_closure {
     TAILQ_ENTRY(connection_closure) entries;
+    TAILQ_ENTRY(connection_closure) commit_entries;
+    TAILQ_ENTRY(connection_closure) hash_entries;
+    struct connection_closure *parent;
+    struct connection_list sessions;
+    struct connection_list *session_hash;
+    unsigned int nsessions;
     struct eventlog *evlog;
     struct timespec elapsed_time;
-    struct connection_buffer read_buf;
-    struct connection_buffer write_buf;
+    struct connection_buffer *read_buf;
+    struct connection_buffer_list write_bufs;
     struct sudo_event_base *evbase;
     struct sudo_event *commit_ev;
     struct sudo_event *read_ev;
@@ -77,8 +99,13 @@ struct connection_closure {
     bool read_instead_of_write;
     bool write_instead_of_read;
     bool temporary_write_event;
+    bool multiplexed;
+    bool commit_pending;
+    bool index_point;
     int iolog_dir_fd;
+    int iolog_index_fd;
     int sock;
+    uint32_t session_id;
 #ifdef HAVE_STRUCT_IN6_ADDR
     char ipaddr[INET6_ADDRSTRLEN];
 #else
@@ -118,6 +145,18 @@ struct listener {
 };
 TAILQ_HEAD(listener_list, listener);
 
+/*
+ * Worker processes that connections are handed off to when the
+ * server is configured with more than one worker.
+ */
+#define LOGSRVD_WORKERS_MAX	256
+struct logsrvd_worker {
+    TAILQ_ENTRY(logsrvd_worker) entries;
+    pid_t pid;
+    int sock;
+};
+TAILQ_HEAD(logsrvd_worker_list, logsrvd_worker);
+
 #if defined(HAVE_OPENSSL)
 /* parameters to configure tls */
 struct logsrvd_tls_config {
@@ -140,6 +179,7 @@ struct logsrvd_tls_runtime {
 struct eventlog *evlog_new(TimeSpec *submit_time, InfoMessage **info_msgs, size_t infolen);
 bool iolog_init(AcceptMessage *msg, struct connection_closure *closure);
 bool iolog_restart(RestartMessage *msg, struct connection_closure *closure);
+bool iolog_commit_all(struct connection_closure *closure, bool sync);
 int store_iobuf(int iofd, IoBuffer *msg, struct connection_closure *closure);
 int store_suspend(CommandSuspend *msg, struct connection_closure *closure);
 int store_winsize(ChangeWindowSize *msg, struct connection_closure *closure);
@@ -149,8 +189,13 @@ void iolog_close_all(struct connection_closure *closure);
 bool logsrvd_conf_read(const char *path);
 const char *logsrvd_conf_iolog_dir(void);
 const char *logsrvd_conf_iolog_file(void);
+struct timespec *logsrvd_conf_iolog_commit_interval(void);
+size_t logsrvd_conf_iolog_commit_bytes(void);
+bool logsrvd_conf_iolog_sync(void);
 struct listen_address_list *logsrvd_conf_listen_address(void);
 bool logsrvd_conf_tcp_keepalive(void);
+unsigned int logsrvd_conf_server_workers(void);
+unsigned int logsrvd_conf_server_max_sessions(void);
 const char *logsrvd_conf_pid_file(void);
 struct timespec *logsrvd_conf_get_sock_timeout(void);
 #if defined(HAVE_OPENSSL)
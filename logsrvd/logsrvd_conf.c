@@ -80,6 +80,8 @@ static struct logsrvd_config {
         struct listen_address_list addresses;
         struct timespec timeout;
         bool tcp_keepalive;
+	unsigned int workers;
+	unsigned int max_sessions;
 	char *pid_file;
 #if defined(HAVE_OPENSSL)
         bool tls;
@@ -90,11 +92,15 @@ static struct logsrvd_config {
     struct logsrvd_config_iolog {
 	bool compress;
 	bool flush;
+	bool sync;
 	bool gid_set;
 	uid_t uid;
 	gid_t gid;
 	mode_t mode;
 	unsigned int maxseq;
+	size_t commit_bytes;
+	struct timespec commit_interval;
+	char *codec;
 	char *iolog_dir;
 	char *iolog_file;
     } iolog;
@@ -135,6 +141,24 @@ logsrvd_conf_iolog_file(void)
     return logsrvd_config->iolog.iolog_file;
 }
 
+struct timespec *
+logsrvd_conf_iolog_commit_interval(void)
+{
+    return &logsrvd_config->iolog.commit_interval;
+}
+
+size_t
+logsrvd_conf_iolog_commit_bytes(void)
+{
+    return logsrvd_config->iolog.commit_bytes;
+}
+
+bool
+logsrvd_conf_iolog_sync(void)
+{
+    return logsrvd_config->iolog.sync;
+}
+
 /* server getters */
 struct listen_address_list *
 logsrvd_conf_listen_address(void)
@@ -148,6 +172,18 @@ logsrvd_conf_tcp_keepalive(void)
     return logsrvd_config->server.tcp_keepalive;
 }
 
+unsigned int
+logsrvd_conf_server_workers(void)
+{
+    return logsrvd_config->server.workers;
+}
+
+unsigned int
+logsrvd_conf_server_max_sessions(void)
+{
+    return logsrvd_config->server.max_sessions;
+}
+
 const char *
 logsrvd_conf_pid_file(void)
 {
@@ -218,6 +254,23 @@ cb_iolog_compress(struct logsrvd_config *config, const char *str)
     debug_return_bool(true);
 }
 
+static bool
+cb_iolog_codec(struct logsrvd_config *config, const char *str)
+{
+    debug_decl(cb_iolog_codec, SUDO_DEBUG_UTIL);
+
+    /* Make sure the codec is supported by this build. */
+    if (!iolog_set_codec(str))
+	debug_return_bool(false);
+
+    free(config->iolog.codec);
+    if ((config->iolog.codec = strdup(str)) == NULL) {
+	sudo_warn(NULL);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
 static bool
 cb_iolog_flush(struct logsrvd_config *config, const char *str)
 {
@@ -231,6 +284,63 @@ cb_iolog_flush(struct logsrvd_config *config, const char *str)
     debug_return_bool(true);
 }
 
+static bool
+cb_iolog_sync(struct logsrvd_config *config, const char *str)
+{
+    int val;
+    debug_decl(cb_iolog_sync, SUDO_DEBUG_UTIL);
+
+    if ((val = sudo_strtobool(str)) == -1)
+	debug_return_bool(false);
+
+    config->iolog.sync = val;
+    debug_return_bool(true);
+}
+
+/*
+ * Commit interval in seconds, may include a fractional part.
+ */
+static bool
+cb_iolog_commit_interval(struct logsrvd_config *config, const char *str)
+{
+    struct timespec ts;
+    char *ep;
+    double d;
+    debug_decl(cb_iolog_commit_interval, SUDO_DEBUG_UTIL);
+
+    errno = 0;
+    d = strtod(str, &ep);
+    if (*str == '\0' || *ep != '\0' || errno == ERANGE || d < 0.001 ||
+	    d > UINT_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "invalid iolog_commit_interval: %s", str);
+	debug_return_bool(false);
+    }
+    ts.tv_sec = (time_t)d;
+    ts.tv_nsec = (long)((d - ts.tv_sec) * 1000000000.0);
+    config->iolog.commit_interval = ts;
+
+    debug_return_bool(true);
+}
+
+static bool
+cb_iolog_commit_bytes(struct logsrvd_config *config, const char *str)
+{
+    const char *errstr;
+    unsigned int value;
+    debug_decl(cb_iolog_commit_bytes, SUDO_DEBUG_UTIL);
+
+    value = sudo_strtonum(str, 0, UINT_MAX, &errstr);
+    if (errstr != NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "bad iolog_commit_bytes: %s: %s", str, errstr);
+	debug_return_bool(false);
+    }
+    config->iolog.commit_bytes = value;
+
+    debug_return_bool(true);
+}
+
 static bool
 cb_iolog_user(struct logsrvd_config *config, const char *user)
 {
@@ -398,6 +508,36 @@ cb_keepalive(struct logsrvd_config *config, const char *str)
     debug_return_bool(true);
 }
 
+static bool
+cb_workers(struct logsrvd_config *config, const char *str)
+{
+    unsigned int workers;
+    const char *errstr;
+    debug_decl(cb_workers, SUDO_DEBUG_UTIL);
+
+    workers = sudo_strtonum(str, 1, LOGSRVD_WORKERS_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.workers = workers;
+    debug_return_bool(true);
+}
+
+static bool
+cb_max_sessions(struct logsrvd_config *config, const char *str)
+{
+    unsigned int max_sessions;
+    const char *errstr;
+    debug_decl(cb_max_sessions, SUDO_DEBUG_UTIL);
+
+    max_sessions = sudo_strtonum(str, 1, LOGSRVD_SESSIONS_MAX, &errstr);
+    if (errstr != NULL)
+	debug_return_bool(false);
+
+    config->server.max_sessions = max_sessions;
+    debug_return_bool(true);
+}
+
 static bool
 cb_pid_file(struct logsrvd_config *config, const char *str)
 {
@@ -687,6 +827,8 @@ static struct logsrvd_config_entry server_conf_entries[] = {
     { "listen_address", cb_listen_address },
     { "timeout", cb_timeout },
     { "tcp_keepalive", cb_keepalive },
+    { "workers", cb_workers },
+    { "max_sessions", cb_max_sessions },
     { "pid_file", cb_pid_file },
 #if defined(HAVE_OPENSSL)
     { "tls_key", cb_tls_key },
@@ -705,7 +847,11 @@ static struct logsrvd_config_entry iolog_conf_entries[] = {
     { "iolog_dir", cb_iolog_dir },
     { "iolog_file", cb_iolog_file },
     { "iolog_flush", cb_iolog_flush },
+    { "iolog_sync", cb_iolog_sync },
+    { "iolog_commit_interval", cb_iolog_commit_interval },
+    { "iolog_commit_bytes", cb_iolog_commit_bytes },
     { "iolog_compress", cb_iolog_compress },
+    { "iolog_codec", cb_iolog_codec },
     { "iolog_user", cb_iolog_user },
     { "iolog_group", cb_iolog_group },
     { "iolog_mode", cb_iolog_mode },
@@ -906,6 +1052,7 @@ logsrvd_conf_free(struct logsrvd_config *config)
     free(config->server.pid_file);
 
     /* struct logsrvd_config_iolog */
+    free(config->iolog.codec);
     free(config->iolog.iolog_dir);
     free(config->iolog.iolog_file);
 
@@ -948,6 +1095,8 @@ logsrvd_conf_alloc(void)
     TAILQ_INIT(&config->server.addresses);
     config->server.timeout.tv_sec = DEFAULT_SOCKET_TIMEOUT_SEC;
     config->server.tcp_keepalive = true;
+    config->server.workers = 1;
+    config->server.max_sessions = 1024;
     config->server.pid_file = strdup(_PATH_SUDO_LOGSRVD_PID);
     if (config->server.pid_file == NULL) {
 	sudo_warn(NULL);
@@ -985,6 +1134,10 @@ logsrvd_conf_alloc(void)
     /* I/O log defaults */
     config->iolog.compress = false;
     config->iolog.flush = true;
+    config->iolog.sync = false;
+    config->iolog.commit_interval.tv_sec = ACK_FREQUENCY;
+    config->iolog.commit_interval.tv_nsec = 0;
+    config->iolog.commit_bytes = 0;
     config->iolog.mode = S_IRUSR|S_IWUSR;
     config->iolog.maxseq = SESSID_MAX;
     if (!cb_iolog_dir(config, _PATH_SUDO_IO_LOGDIR))
@@ -1091,6 +1244,8 @@ logsrvd_conf_apply(struct logsrvd_config *config)
     /* Set I/O log library settings */
     iolog_set_defaults();
     iolog_set_compress(config->iolog.compress);
+    if (config->iolog.codec != NULL)
+	iolog_set_codec(config->iolog.codec);
     iolog_set_flush(config->iolog.flush);
     iolog_set_owner(config->iolog.uid, config->iolog.gid);
     iolog_set_mode(config->iolog.mode);
@@ -0,0 +1,216 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for ClientMessage decoding in sudo_logsrvd.
+ * A read buffer full of framed IoBuffer messages is decoded repeatedly,
+ * once using the default protobuf-c allocator and once using the
+ * message arena, and the number of messages per CPU second is reported.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "log_server.pb-c.h"
+#include "sudo_compat.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+
+#include "logsrv_util.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Same size as sudo_logsrvd's initial read buffer. */
+#define BATCH_SIZE	(64 * 1024)
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-n iterations] [-s payload_size]\n",
+	getprogname());
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Fill buf with as many framed ttyout IoBuffer messages of the given
+ * payload size as will fit, like a full read from a busy client.
+ * Returns the number of bytes used.
+ */
+static size_t
+fill_batch(uint8_t *buf, size_t bufsize, size_t payload_size,
+    unsigned int *nmsgs)
+{
+    ClientMessage msg = CLIENT_MESSAGE__INIT;
+    IoBuffer iobuf = IO_BUFFER__INIT;
+    TimeSpec delay = TIME_SPEC__INIT;
+    uint8_t *payload;
+    uint32_t msg_len;
+    size_t len, used = 0;
+
+    if ((payload = malloc(payload_size)) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    memset(payload, 'x', payload_size);
+
+    delay.tv_nsec = 1234567;
+    iobuf.delay = &delay;
+    iobuf.data.data = payload;
+    iobuf.data.len = payload_size;
+    msg.u.ttyout_buf = &iobuf;
+    msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+
+    len = client_message__get_packed_size(&msg);
+    *nmsgs = 0;
+    while (used + sizeof(msg_len) + len <= bufsize) {
+	msg_len = htonl((uint32_t)len);
+	memcpy(buf + used, &msg_len, sizeof(msg_len));
+	used += sizeof(msg_len);
+	client_message__pack(&msg, buf + used);
+	used += len;
+	(*nmsgs)++;
+    }
+    free(payload);
+
+    return used;
+}
+
+/*
+ * Decode every message in the batch, freeing them the way sudo_logsrvd does.
+ * Returns a checksum so the work cannot be optimized away.
+ */
+static size_t
+decode_batch(const uint8_t *buf, size_t len, struct logsrv_arena *arena)
+{
+    ProtobufCAllocator *allocator = NULL;
+    ClientMessage *msg;
+    uint32_t msg_len;
+    size_t off = 0, sum = 0;
+
+    if (arena != NULL)
+	allocator = logsrv_arena_allocator(arena);
+
+    while (off + sizeof(msg_len) <= len) {
+	memcpy(&msg_len, buf + off, sizeof(msg_len));
+	msg_len = ntohl(msg_len);
+	off += sizeof(msg_len);
+	msg = client_message__unpack(allocator, msg_len, buf + off);
+	if (msg == NULL)
+	    sudo_fatalx("unable to unpack ClientMessage");
+	sum += msg->u.ttyout_buf->data.len;
+	if (arena == NULL)
+	    client_message__free_unpacked(msg, NULL);
+	off += msg_len;
+    }
+    if (arena != NULL)
+	logsrv_arena_reset(arena);
+
+    return sum;
+}
+
+static double
+cpu_time(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+	sudo_fatal("getrusage");
+    return (double)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+static void
+run(const char *name, const uint8_t *buf, size_t len, unsigned int nmsgs,
+    unsigned int iterations, struct logsrv_arena *arena)
+{
+    volatile size_t sum = 0;
+    double start, elapsed;
+    unsigned int i;
+
+    start = cpu_time();
+    for (i = 0; i < iterations; i++)
+	sum += decode_batch(buf, len, arena);
+    elapsed = cpu_time() - start;
+    if (elapsed <= 0)
+	elapsed = 0.000001;
+
+    printf("%-8s %10llu messages %8.3fs cpu %12.0f msgs/sec\n", name,
+	(unsigned long long)nmsgs * iterations, elapsed,
+	(double)nmsgs * iterations / elapsed);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int iterations = 2000, nmsgs;
+    size_t payload_size = 256, len;
+    struct logsrv_arena *arena;
+    const char *errstr;
+    uint8_t *buf;
+    int ch;
+
+    initprogname(argc > 0 ? argv[0] : "bench_client_msg");
+
+    while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+	switch (ch) {
+	case 'n':
+	    iterations = sudo_strtonum(optarg, 1, UINT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("iterations %s: %s", optarg, errstr);
+	    break;
+	case 's':
+	    payload_size = sudo_strtonum(optarg, 1, BATCH_SIZE / 2, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("payload size %s: %s", optarg, errstr);
+	    break;
+	default:
+	    usage();
+	}
+    }
+
+    if ((buf = malloc(BATCH_SIZE)) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    len = fill_batch(buf, BATCH_SIZE, payload_size, &nmsgs);
+    if ((arena = logsrv_arena_alloc(64 * 1024)) == NULL)
+	sudo_fatalx("unable to allocate arena");
+
+    printf("%u messages of %zu bytes per batch, %u batches\n", nmsgs,
+	payload_size, iterations);
+    run("malloc", buf, len, nmsgs, iterations, NULL);
+    run("arena", buf, len, nmsgs, iterations, arena);
+
+    logsrv_arena_free(arena);
+    free(buf);
+    exit(EXIT_SUCCESS);
+}
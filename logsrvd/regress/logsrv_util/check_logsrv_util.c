@@ -0,0 +1,197 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "log_server.pb-c.h"
+#include "sudo_compat.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+
+#include "logsrv_util.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+static int ntests, nerrors;
+
+#define CHECK(_expr, _msg) do {						\
+    ntests++;								\
+    if (!(_expr)) {							\
+	sudo_warnx("%s:%d: %s", __FILE__, __LINE__, (_msg));	\
+	nerrors++;							\
+    }									\
+} while (0)
+
+static void
+test_bufpool(void)
+{
+    struct connection_buffer_pool pool =
+	CONNECTION_BUFFER_POOL_INITIALIZER(pool, 2, 4096);
+    struct connection_buffer *buf1, *buf2, *buf3;
+
+    buf1 = bufpool_get(&pool, 1000);
+    CHECK(buf1 != NULL && buf1->size >= 1000, "bufpool_get: short buffer");
+    buf1->len = 10;
+    bufpool_put(&pool, buf1);
+    CHECK(pool.count == 1, "bufpool_put: buffer not cached");
+
+    /* Cached buffer is reused and reset. */
+    buf2 = bufpool_get(&pool, 0);
+    CHECK(buf2 == buf1, "bufpool_get: cached buffer not reused");
+    CHECK(buf2->len == 0 && buf2->off == 0, "bufpool_get: buffer not reset");
+    CHECK(pool.count == 0, "bufpool_get: bad count");
+
+    /* Buffers larger than max_size are not cached. */
+    CHECK(expand_buf(buf2, 8192), "expand_buf failed");
+    bufpool_put(&pool, buf2);
+    CHECK(pool.count == 0, "bufpool_put: oversized buffer cached");
+
+    /* No more than max_count buffers are cached. */
+    buf1 = bufpool_get(&pool, 0);
+    buf2 = bufpool_get(&pool, 0);
+    buf3 = bufpool_get(&pool, 0);
+    CHECK(buf1 != NULL && buf2 != NULL && buf3 != NULL,
+	"bufpool_get: allocation failed");
+    bufpool_put(&pool, buf1);
+    bufpool_put(&pool, buf2);
+    bufpool_put(&pool, buf3);
+    CHECK(pool.count == 2, "bufpool_put: max_count exceeded");
+
+    bufpool_clear(&pool);
+    CHECK(pool.count == 0 && TAILQ_EMPTY(&pool.bufs), "bufpool_clear failed");
+}
+
+static void
+test_arena(void)
+{
+    struct logsrv_arena *arena;
+    ProtobufCAllocator *allocator;
+    void *first, *ptr, *large;
+    int i;
+
+    arena = logsrv_arena_alloc(1024);
+    if (arena == NULL)
+	sudo_fatalx("unable to allocate arena");
+    allocator = logsrv_arena_allocator(arena);
+
+    first = allocator->alloc(allocator->allocator_data, 1);
+    CHECK(first != NULL, "arena alloc failed");
+    for (i = 0; i < 1000; i++) {
+	/* Enough to span multiple chunks. */
+	ptr = allocator->alloc(allocator->allocator_data, (i % 200) + 1);
+	CHECK(ptr != NULL, "arena alloc failed");
+	CHECK(((uintptr_t)ptr & 15) == 0, "arena alloc misaligned");
+	memset(ptr, 'x', (i % 200) + 1);
+    }
+
+    /* Requests larger than a quarter chunk get their own chunk. */
+    large = allocator->alloc(allocator->allocator_data, 4096);
+    CHECK(large != NULL, "arena large alloc failed");
+    memset(large, 'x', 4096);
+    allocator->free(allocator->allocator_data, large);
+
+    /* After a reset, allocation starts over at the first chunk. */
+    logsrv_arena_reset(arena);
+    ptr = allocator->alloc(allocator->allocator_data, 1);
+    CHECK(ptr == first, "arena memory not reused after reset");
+
+    logsrv_arena_free(arena);
+}
+
+static void
+test_arena_unpack(void)
+{
+    ClientMessage msg = CLIENT_MESSAGE__INIT;
+    IoBuffer iobuf = IO_BUFFER__INIT;
+    TimeSpec delay = TIME_SPEC__INIT;
+    struct logsrv_arena *arena;
+    ClientMessage *msg2;
+    uint8_t data[3000], *packed;
+    size_t len;
+    int i;
+
+    for (i = 0; i < ssizeof(data); i++)
+	data[i] = (uint8_t)i;
+    delay.tv_sec = 1;
+    delay.tv_nsec = 500;
+    iobuf.delay = &delay;
+    iobuf.data.data = data;
+    iobuf.data.len = sizeof(data);
+    msg.u.ttyout_buf = &iobuf;
+    msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+    msg.session_id = 42;
+
+    len = client_message__get_packed_size(&msg);
+    if ((packed = malloc(len)) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    client_message__pack(&msg, packed);
+
+    if ((arena = logsrv_arena_alloc(1024)) == NULL)
+	sudo_fatalx("unable to allocate arena");
+    for (i = 0; i < 3; i++) {
+	msg2 = client_message__unpack(logsrv_arena_allocator(arena), len,
+	    packed);
+	CHECK(msg2 != NULL, "unable to unpack ClientMessage");
+	if (msg2 != NULL) {
+	    CHECK(msg2->type_case == CLIENT_MESSAGE__TYPE_TTYOUT_BUF,
+		"unpacked ClientMessage has wrong type");
+	    CHECK(msg2->session_id == 42,
+		"unpacked ClientMessage has wrong session ID");
+	    CHECK(msg2->u.ttyout_buf->delay->tv_sec == 1 &&
+		msg2->u.ttyout_buf->delay->tv_nsec == 500,
+		"unpacked IoBuffer has wrong delay");
+	    CHECK(msg2->u.ttyout_buf->data.len == sizeof(data) &&
+		memcmp(msg2->u.ttyout_buf->data.data, data, sizeof(data)) == 0,
+		"unpacked IoBuffer has wrong data");
+	}
+	logsrv_arena_reset(arena);
+    }
+    logsrv_arena_free(arena);
+    free(packed);
+}
+
+int
+main(int argc, char *argv[])
+{
+    initprogname(argc > 0 ? argv[0] : "check_logsrv_util");
+
+    test_bufpool();
+    test_arena();
+    test_arena_unpack();
+
+    if (ntests != 0) {
+	printf("%s: %d tests run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, nerrors, (ntests - nerrors) * 100 / ntests);
+    }
+    exit(nerrors);
+}
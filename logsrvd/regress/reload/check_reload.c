@@ -0,0 +1,534 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Start sudo_logsrvd with multiple workers, open a session and
+ * reload the server while the session is still running.  The
+ * session must be able to finish normally on the retired worker.
+ * Also switch from a single process to multiple workers while a
+ * session is open; the supervisor finishes it without the new
+ * workers holding on to the client's socket.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pwd.h>
+#include <grp.h>
+#include <signal.h>
+#ifdef HAVE_STDBOOL_H
+# include <stdbool.h>
+#else
+# include "compat/stdbool.h"
+#endif /* HAVE_STDBOOL_H */
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "log_server.pb-c.h"
+#include "sudo_compat.h"
+#include "sudo_queue.h"
+#include "sudo_util.h"
+#include "sudo_fatal.h"
+
+#include "logsrv_util.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Elapsed time of the only I/O buffer in the session. */
+#define SESSION_SEC	1
+#define SESSION_NSEC	500000000
+
+static int ntests, nerrors;
+
+#define CHECK(_expr, _msg) do {						\
+    ntests++;								\
+    if (!(_expr)) {							\
+	sudo_warnx("%s:%d: %s", __FILE__, __LINE__, (_msg));	\
+	nerrors++;							\
+    }									\
+} while (0)
+
+/*
+ * Find an unused port on the loopback interface.
+ */
+static int
+unused_port(void)
+{
+    struct sockaddr_in sin;
+    socklen_t sinlen = sizeof(sin);
+    int port = -1, sock;
+
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+	return -1;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == 0 &&
+	    getsockname(sock, (struct sockaddr *)&sin, &sinlen) == 0)
+	port = ntohs(sin.sin_port);
+    close(sock);
+    return port;
+}
+
+static bool
+write_conf(const char *path, const char *iolog_dir, int port,
+    int workers)
+{
+    struct passwd *pw = getpwuid(geteuid());
+    struct group *gr = getgrgid(getegid());
+    FILE *fp;
+
+    if (pw == NULL || gr == NULL) {
+	sudo_warnx("unable to look up user and group");
+	return false;
+    }
+    if ((fp = fopen(path, "w")) == NULL) {
+	sudo_warn("%s", path);
+	return false;
+    }
+    fprintf(fp, "[server]\nlisten_address = 127.0.0.1:%d\nworkers = %d\n\n",
+	port, workers);
+    fprintf(fp, "[iolog]\niolog_dir = %s\niolog_file = session\n", iolog_dir);
+    fprintf(fp, "iolog_user = %s\niolog_group = %s\n\n", pw->pw_name,
+	gr->gr_name);
+    fprintf(fp, "[eventlog]\nlog_type = none\n");
+    if (fclose(fp) != 0) {
+	sudo_warn("%s", path);
+	return false;
+    }
+    return true;
+}
+
+static pid_t
+start_server(const char *conf_file)
+{
+    char *argv[] = { "./sudo_logsrvd", "-n", "-f", NULL, NULL };
+    pid_t pid;
+
+    argv[3] = (char *)conf_file;
+    switch (pid = fork()) {
+    case -1:
+	sudo_warn("fork");
+	break;
+    case 0:
+	execv(argv[0], argv);
+	sudo_warn("%s", argv[0]);
+	_exit(127);
+    }
+    return pid;
+}
+
+/*
+ * Stop the server and wait up to ten seconds for it to exit.
+ * The supervisor only exits once all of its workers are gone.
+ */
+static bool
+stop_server(pid_t pid)
+{
+    int i, status;
+
+    (void)kill(pid, SIGTERM);
+    for (i = 0; i < 100; i++) {
+	switch (waitpid(pid, &status, WNOHANG)) {
+	case -1:
+	    return false;
+	case 0:
+	    usleep(100000);
+	    break;
+	default:
+	    return WIFEXITED(status);
+	}
+    }
+    (void)kill(pid, SIGKILL);
+    (void)waitpid(pid, &status, 0);
+    return false;
+}
+
+/*
+ * Connect to the server, retrying while it starts up.
+ */
+static int
+connect_server(int port)
+{
+    struct sockaddr_in sin;
+    int i, sock;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sin.sin_port = htons(port);
+
+    for (i = 0; i < 50; i++) {
+	if ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+	    return -1;
+	if (connect(sock, (struct sockaddr *)&sin, sizeof(sin)) == 0)
+	    return sock;
+	close(sock);
+	usleep(100000);
+    }
+    sudo_warnx("unable to connect to server on port %d", port);
+    return -1;
+}
+
+static bool
+send_message(int sock, ClientMessage *msg)
+{
+    struct connection_buffer buf = { { NULL, NULL }, NULL, 0, 0, 0 };
+    uint32_t msg_len;
+    size_t len, off;
+    ssize_t nwritten;
+    bool ret = false;
+
+    len = client_message__get_packed_size(msg);
+    if (!expand_buf(&buf, len + sizeof(msg_len)))
+	return false;
+    msg_len = htonl((uint32_t)len);
+    memcpy(buf.data, &msg_len, sizeof(msg_len));
+    client_message__pack(msg, buf.data + sizeof(msg_len));
+    len += sizeof(msg_len);
+
+    for (off = 0; off < len; off += nwritten) {
+	nwritten = send(sock, buf.data + off, len - off, 0);
+	if (nwritten == -1)
+	    goto done;
+    }
+    ret = true;
+done:
+    free(buf.data);
+    return ret;
+}
+
+/*
+ * Read a single ServerMessage.  Returns NULL on EOF or error.
+ */
+static ServerMessage *
+recv_message(int sock)
+{
+    ServerMessage *msg = NULL;
+    uint8_t *data = NULL;
+    uint32_t msg_len;
+    size_t off;
+    ssize_t nread;
+
+    for (off = 0; off < sizeof(msg_len); off += nread) {
+	nread = recv(sock, (char *)&msg_len + off, sizeof(msg_len) - off, 0);
+	if (nread <= 0)
+	    return NULL;
+    }
+    msg_len = ntohl(msg_len);
+    if (msg_len > MESSAGE_SIZE_MAX || (data = malloc(msg_len + 1)) == NULL)
+	return NULL;
+    for (off = 0; off < msg_len; off += nread) {
+	nread = recv(sock, data + off, msg_len - off, 0);
+	if (nread <= 0)
+	    goto done;
+    }
+    msg = server_message__unpack(NULL, msg_len, data);
+done:
+    free(data);
+    return msg;
+}
+
+static bool
+send_hello(int sock)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    ClientHello hello_msg = CLIENT_HELLO__INIT;
+
+    hello_msg.client_id = "check_reload";
+    client_msg.u.hello_msg = &hello_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_HELLO_MSG;
+    return send_message(sock, &client_msg);
+}
+
+static bool
+send_accept(int sock)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    AcceptMessage accept_msg = ACCEPT_MESSAGE__INIT;
+    InfoMessage__StringList runargv = INFO_MESSAGE__STRING_LIST__INIT;
+    TimeSpec tv = TIME_SPEC__INIT;
+    InfoMessage info[5], *infop[5];
+    static const char *keys[] = { "submituser", "submithost", "runuser",
+	"command" };
+    static const char *values[] = { "nobody", "localhost", "root",
+	"/bin/true" };
+    char *argv[] = { "/bin/true" };
+    size_t i;
+
+    for (i = 0; i < 4; i++) {
+	info_message__init(&info[i]);
+	info[i].key = (char *)keys[i];
+	info[i].u.strval = (char *)values[i];
+	info[i].value_case = INFO_MESSAGE__VALUE_STRVAL;
+	infop[i] = &info[i];
+    }
+    runargv.strings = argv;
+    runargv.n_strings = 1;
+    info_message__init(&info[i]);
+    info[i].key = "runargv";
+    info[i].u.strlistval = &runargv;
+    info[i].value_case = INFO_MESSAGE__VALUE_STRLISTVAL;
+    infop[i] = &info[i];
+
+    tv.tv_sec = time(NULL);
+    accept_msg.submit_time = &tv;
+    accept_msg.expect_iobufs = true;
+    accept_msg.info_msgs = infop;
+    accept_msg.n_info_msgs = 5;
+    client_msg.u.accept_msg = &accept_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_ACCEPT_MSG;
+    return send_message(sock, &client_msg);
+}
+
+static bool
+send_ttyout(int sock)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    IoBuffer iobuf_msg = IO_BUFFER__INIT;
+    TimeSpec delay = TIME_SPEC__INIT;
+
+    delay.tv_sec = SESSION_SEC;
+    delay.tv_nsec = SESSION_NSEC;
+    iobuf_msg.delay = &delay;
+    iobuf_msg.data.data = (uint8_t *)"hello\n";
+    iobuf_msg.data.len = 6;
+    client_msg.u.ttyout_buf = &iobuf_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_TTYOUT_BUF;
+    return send_message(sock, &client_msg);
+}
+
+static bool
+send_exit(int sock)
+{
+    ClientMessage client_msg = CLIENT_MESSAGE__INIT;
+    ExitMessage exit_msg = EXIT_MESSAGE__INIT;
+
+    client_msg.u.exit_msg = &exit_msg;
+    client_msg.type_case = CLIENT_MESSAGE__TYPE_EXIT_MSG;
+    return send_message(sock, &client_msg);
+}
+
+/*
+ * Wait for a message of the specified type, remembering the
+ * last commit point seen.  Returns false on EOF or error.
+ */
+static bool
+wait_for(int sock, int type, struct timespec *commit)
+{
+    ServerMessage *msg;
+    bool found = false;
+
+    while (!found && (msg = recv_message(sock)) != NULL) {
+	if (msg->type_case == SERVER_MESSAGE__TYPE_COMMIT_POINT) {
+	    commit->tv_sec = msg->u.commit_point->tv_sec;
+	    commit->tv_nsec = msg->u.commit_point->tv_nsec;
+	}
+	if (msg->type_case == SERVER_MESSAGE__TYPE_ERROR ||
+		msg->type_case == SERVER_MESSAGE__TYPE_ABORT) {
+	    sudo_warnx("server error: %s", msg->u.error);
+	    server_message__free_unpacked(msg, NULL);
+	    return false;
+	}
+	found = msg->type_case == type;
+	server_message__free_unpacked(msg, NULL);
+    }
+    return found;
+}
+
+/*
+ * Read messages until the server closes the connection.
+ * Returns false if it is still open after five seconds.
+ */
+static bool
+wait_for_eof(int sock, struct timespec *commit)
+{
+    struct timeval tv = { 5, 0 };
+    char ch;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+	return false;
+    (void)wait_for(sock, SERVER_MESSAGE__TYPE__NOT_SET, commit);
+    return recv(sock, &ch, 1, 0) == 0;
+}
+
+static void
+test_reload(const char *testdir)
+{
+    struct timespec commit = { 0, 0 };
+    char cwd[PATH_MAX], conf_file[PATH_MAX], iolog_dir[PATH_MAX];
+    int port, sock = -1;
+    pid_t pid;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+	sudo_fatal("getcwd");
+    (void)snprintf(conf_file, sizeof(conf_file), "%s/%s/logsrvd.conf", cwd,
+	testdir);
+    (void)snprintf(iolog_dir, sizeof(iolog_dir), "%s/%s/reload", cwd,
+	testdir);
+
+    ntests++;
+    if ((port = unused_port()) == -1 ||
+	    !write_conf(conf_file, iolog_dir, port, 2) ||
+	    (pid = start_server(conf_file)) == -1) {
+	nerrors++;
+	return;
+    }
+
+    if ((sock = connect_server(port)) == -1) {
+	nerrors++;
+	goto done;
+    }
+    CHECK(send_hello(sock) && wait_for(sock, SERVER_MESSAGE__TYPE_HELLO,
+	&commit), "no ServerHello");
+    CHECK(send_accept(sock) && wait_for(sock, SERVER_MESSAGE__TYPE_LOG_ID,
+	&commit), "no log ID");
+
+    /* Reload while the session is in progress. */
+    CHECK(kill(pid, SIGHUP) == 0, "unable to send SIGHUP");
+    sleep(1);
+
+    /* The session finishes with a commit point for all of its I/O. */
+    CHECK(send_ttyout(sock) && send_exit(sock), "unable to send session");
+    (void)wait_for(sock, SERVER_MESSAGE__TYPE__NOT_SET, &commit);
+    CHECK(commit.tv_sec == SESSION_SEC && commit.tv_nsec == SESSION_NSEC,
+	"session not committed after reload");
+
+    /* A new session is handled by the new workers. */
+    close(sock);
+    sock = connect_server(port);
+    CHECK(sock != -1 && send_hello(sock) &&
+	wait_for(sock, SERVER_MESSAGE__TYPE_HELLO, &commit),
+	"no ServerHello after reload");
+
+done:
+    if (sock != -1)
+	close(sock);
+    CHECK(stop_server(pid), "server did not exit cleanly");
+}
+
+static void
+test_add_workers(const char *testdir)
+{
+    struct timespec commit = { 0, 0 };
+    char cwd[PATH_MAX], conf_file[PATH_MAX], iolog_dir[PATH_MAX];
+    int port, sock = -1;
+    pid_t pid;
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+	sudo_fatal("getcwd");
+    (void)snprintf(conf_file, sizeof(conf_file), "%s/%s/logsrvd.conf", cwd,
+	testdir);
+    (void)snprintf(iolog_dir, sizeof(iolog_dir), "%s/%s/add_workers", cwd,
+	testdir);
+
+    ntests++;
+    if ((port = unused_port()) == -1 ||
+	    !write_conf(conf_file, iolog_dir, port, 1) ||
+	    (pid = start_server(conf_file)) == -1) {
+	nerrors++;
+	return;
+    }
+
+    if ((sock = connect_server(port)) == -1) {
+	nerrors++;
+	goto done;
+    }
+    CHECK(send_hello(sock) && wait_for(sock, SERVER_MESSAGE__TYPE_HELLO,
+	&commit), "no ServerHello");
+    CHECK(send_accept(sock) && wait_for(sock, SERVER_MESSAGE__TYPE_LOG_ID,
+	&commit), "no log ID");
+
+    /* Start workers while the supervisor has a session in progress. */
+    CHECK(write_conf(conf_file, iolog_dir, port, 2) && kill(pid, SIGHUP) == 0,
+	"unable to reload with workers");
+    sleep(1);
+
+    /* The supervisor finishes the session, the workers let it go. */
+    CHECK(send_ttyout(sock) && send_exit(sock), "unable to send session");
+    CHECK(wait_for_eof(sock, &commit), "connection not closed after reload");
+    CHECK(commit.tv_sec == SESSION_SEC && commit.tv_nsec == SESSION_NSEC,
+	"session not committed after reload");
+
+    /* Retire those workers; they have no connections and exit. */
+    CHECK(kill(pid, SIGHUP) == 0, "unable to send SIGHUP");
+    sleep(1);
+    close(sock);
+    sock = connect_server(port);
+    CHECK(sock != -1 && send_hello(sock) &&
+	wait_for(sock, SERVER_MESSAGE__TYPE_HELLO, &commit),
+	"no ServerHello after reload");
+
+done:
+    if (sock != -1)
+	close(sock);
+    CHECK(stop_server(pid), "server did not exit cleanly");
+}
+
+int
+main(int argc, char *argv[])
+{
+    char testdir[] = "reload.XXXXXX";
+    char *rmargs[] = { "rm", "-rf", NULL, NULL };
+    int status;
+
+    initprogname(argc > 0 ? argv[0] : "check_reload");
+    signal(SIGPIPE, SIG_IGN);
+
+    if (mkdtemp(testdir) == NULL)
+	sudo_fatal("unable to create test dir");
+    rmargs[2] = testdir;
+
+    test_reload(testdir);
+    test_add_workers(testdir);
+
+    if (ntests != 0) {
+	printf("%s: %d test%s run, %d errors, %d%% success rate\n",
+	    getprogname(), ntests, ntests == 1 ? "" : "s", nerrors,
+	    (ntests - nerrors) * 100 / ntests);
+    }
+
+    /* Clean up (avoid running via shell) */
+    fflush(stdout);
+    if (fork() == 0) {
+	execvp("rm", rmargs);
+	_exit(127);
+    }
+    wait(&status);
+
+    exit(nerrors);
+}
@@ -26,6 +26,7 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -114,6 +115,13 @@ usage(bool fatal)
 #endif
 	"[-r restart-point] [-R reject-reason] [-t number] /path/to/iolog\n",
         getprogname());
+#if defined(HAVE_OPENSSL)
+    fprintf(stderr, "       %s -s [-nV] [-b ca_bundle] [-c cert_file] [-h host] "
+	"[-k key_file] [-p port] /path/to/spool\n",
+#else
+    fprintf(stderr, "       %s -s [-V] [-h host] [-p port] /path/to/spool\n",
+#endif
+        getprogname());
     if (fatal)
 	exit(EXIT_FAILURE);
 }
@@ -151,6 +159,8 @@ help(void)
 	_("restart previous I/O log transfer"));
     printf("  -R, --reject          %s\n",
 	_("reject the command with the given reason"));
+    printf("  -s, --spool           %s\n",
+	_("forward messages spooled by sudoers when the server was down"));
     printf("  -t, --test            %s\n",
 	_("test audit server by sending selected I/O log n times in parallel"));
     printf("  -V, --version         %s\n",
@@ -882,6 +892,167 @@ again:
     debug_return_bool(ret);
 }
 
+/*
+ * Handle a spool file that ends early, usually because sudo was killed
+ * while writing to it.  A truncated final record is ignored.
+ * Returns true on success, false on failure.
+ */
+static bool
+fmt_spool_eof(struct client_closure *closure)
+{
+    debug_decl(fmt_spool_eof, SUDO_DEBUG_UTIL);
+
+    if (closure->state < SEND_ACCEPT || closure->state > SEND_IO) {
+	/* No accept or reject message, there is nothing to send. */
+	sudo_warnx(U_("%s: unexpected end of spool file"), iolog_dir);
+	closure->spool_truncated = true;
+	debug_return_bool(false);
+    }
+
+    /*
+     * sudo did not finish writing the spool file so we don't know
+     * how the command exited; send a zero-sized ExitMessage.
+     */
+    closure->state = SEND_EXIT;
+    debug_return_bool(fmt_exit_message(closure));
+}
+
+/*
+ * Read the next ClientMessage from the spool file into the closure's
+ * write buffer.  Spool files written by the sudoers plugin contain
+ * ClientMessages in wire format, starting with the message that follows
+ * the ClientHello.  Sets the state based on the message type.
+ * Returns true on success, false on failure.
+ */
+static bool
+fmt_next_spool(struct client_closure *closure)
+{
+    struct connection_buffer *buf = &closure->write_buf;
+    ClientMessage *msg = NULL;
+    TimeSpec *delay = NULL;
+    uint32_t msg_len;
+    size_t nread;
+    bool ret = false;
+    debug_decl(fmt_next_spool, SUDO_DEBUG_UTIL);
+
+    if (buf->len != 0) {
+	sudo_warnx(U_("%s: write buffer already in use"), __func__);
+	debug_return_bool(false);
+    }
+
+again:
+    nread = fread(&msg_len, 1, sizeof(msg_len), closure->spool_fp);
+    if (nread != sizeof(msg_len)) {
+	if (ferror(closure->spool_fp)) {
+	    sudo_warn(U_("unable to read %s"), iolog_dir);
+	    debug_return_bool(false);
+	}
+	debug_return_bool(fmt_spool_eof(closure));
+    }
+    msg_len = ntohl(msg_len);
+    if (msg_len > MESSAGE_SIZE_MAX) {
+	sudo_warnx(U_("client message too large: %zu"), (size_t)msg_len);
+	debug_return_bool(false);
+    }
+
+    /* Resize buffer as needed. */
+    if (msg_len + sizeof(msg_len) > buf->size) {
+	free(buf->data);
+	buf->size = sudo_pow2_roundup(msg_len + sizeof(msg_len));
+	if ((buf->data = malloc(buf->size)) == NULL) {
+	    sudo_warn(NULL);
+	    buf->size = 0;
+	    debug_return_bool(false);
+	}
+    }
+    if (fread(buf->data + sizeof(msg_len), 1, msg_len, closure->spool_fp) != msg_len) {
+	if (ferror(closure->spool_fp)) {
+	    sudo_warn(U_("unable to read %s"), iolog_dir);
+	    debug_return_bool(false);
+	}
+	debug_return_bool(fmt_spool_eof(closure));
+    }
+
+    /* Unpack the message to check its type and delay. */
+    msg = client_message__unpack(NULL, msg_len, buf->data + sizeof(msg_len));
+    if (msg == NULL) {
+	sudo_warnx(U_("%s: unable to unpack ClientMessage"), iolog_dir);
+	debug_return_bool(false);
+    }
+    switch (msg->type_case) {
+    case CLIENT_MESSAGE__TYPE_ACCEPT_MSG:
+	if (sudo_timespecisset(&closure->restart)) {
+	    /* Already sent before the restart. */
+	    client_message__free_unpacked(msg, NULL);
+	    goto again;
+	}
+	closure->accept_only = !msg->u.accept_msg->expect_iobufs;
+	closure->state = SEND_ACCEPT;
+	break;
+    case CLIENT_MESSAGE__TYPE_REJECT_MSG:
+    case CLIENT_MESSAGE__TYPE_ALERT_MSG:
+	closure->state = SEND_REJECT;
+	break;
+    case CLIENT_MESSAGE__TYPE_EXIT_MSG:
+	closure->state = SEND_EXIT;
+	break;
+    case CLIENT_MESSAGE__TYPE_TTYIN_BUF:
+	delay = msg->u.ttyin_buf->delay;
+	break;
+    case CLIENT_MESSAGE__TYPE_TTYOUT_BUF:
+	delay = msg->u.ttyout_buf->delay;
+	break;
+    case CLIENT_MESSAGE__TYPE_STDIN_BUF:
+	delay = msg->u.stdin_buf->delay;
+	break;
+    case CLIENT_MESSAGE__TYPE_STDOUT_BUF:
+	delay = msg->u.stdout_buf->delay;
+	break;
+    case CLIENT_MESSAGE__TYPE_STDERR_BUF:
+	delay = msg->u.stderr_buf->delay;
+	break;
+    case CLIENT_MESSAGE__TYPE_WINSIZE_EVENT:
+	delay = msg->u.winsize_event->delay;
+	break;
+    case CLIENT_MESSAGE__TYPE_SUSPEND_EVENT:
+	delay = msg->u.suspend_event->delay;
+	break;
+    default:
+	sudo_warnx(U_("%s: unexpected type_case value %d"),
+	    iolog_dir, msg->type_case);
+	goto done;
+    }
+
+    if (delay != NULL) {
+	struct timespec ts;
+
+	/* Track elapsed time for comparison with commit points. */
+	ts.tv_sec = delay->tv_sec;
+	ts.tv_nsec = delay->tv_nsec;
+	sudo_timespecadd(&ts, &closure->elapsed, &closure->elapsed);
+
+	/* If we have a restart point, ignore records until we hit it. */
+	if (sudo_timespecisset(&closure->restart)) {
+	    if (sudo_timespeccmp(&closure->restart, &closure->elapsed, >=)) {
+		client_message__free_unpacked(msg, NULL);
+		goto again;
+	    }
+	    sudo_timespecclear(&closure->restart);	/* caught up */
+	}
+	closure->state = SEND_IO;
+    }
+
+    /* The spooled message is already in wire format. */
+    msg_len = htonl(msg_len);
+    memcpy(buf->data, &msg_len, sizeof(msg_len));
+    buf->len = ntohl(msg_len) + sizeof(msg_len);
+    ret = true;
+
+done:
+    client_message__free_unpacked(msg, NULL);
+    debug_return_bool(ret);
+}
+
 /*
  * Additional work to do after a ClientMessage was sent to the server.
  * Advances state and formats the next ClientMessage (if any).
@@ -897,7 +1068,7 @@ client_message_completion(struct client_closure *closure)
 	sudo_ev_del(closure->evbase, closure->write_ev);
 	break;
     case SEND_ACCEPT:
-	if (closure->accept_only) {
+	if (closure->accept_only && closure->spool_fp == NULL) {
 	    closure->state = SEND_EXIT;
 	    debug_return_bool(fmt_exit_message(closure));
 	}
@@ -906,6 +1077,12 @@ client_message_completion(struct client_closure *closure)
 	closure->state = SEND_IO;
 	FALLTHROUGH;
     case SEND_IO:
+	if (closure->spool_fp != NULL) {
+	    /* fmt_next_spool() sets the state based on the message type. */
+	    if (!fmt_next_spool(closure))
+		debug_return_bool(false);
+	    break;
+	}
 	/* fmt_next_iolog() will advance state on EOF. */
 	if (!fmt_next_iolog(closure))
 	    debug_return_bool(false);
@@ -996,6 +1173,15 @@ handle_log_id(char *id, struct client_closure *closure)
     if (!testrun)
         printf("Remote log ID: %s\n", id);
 
+    /* Needed to restart a spooled transfer. */
+    if (closure->spool_fp != NULL) {
+	free(closure->spool_log_id);
+	if ((closure->spool_log_id = strdup(id)) == NULL) {
+	    sudo_warn(NULL);
+	    debug_return_bool(false);
+	}
+    }
+
     debug_return_bool(true);
 }
 
@@ -1050,6 +1236,11 @@ handle_server_message(uint8_t *buf, size_t len,
 	    if (sudo_timespecisset(&closure->restart)) {
 		closure->state = SEND_RESTART;
 		ret = fmt_restart_message(closure);
+	    } else if (closure->spool_fp != NULL) {
+		ret = fmt_next_spool(closure);
+		if (ret && sudo_ev_add(closure->evbase, closure->write_ev,
+			NULL, false) == -1)
+		    ret = false;
 	    } else if (closure->reject_reason != NULL) {
 		closure->state = SEND_REJECT;
 		ret = fmt_reject_message(closure);
@@ -1061,7 +1252,8 @@ handle_server_message(uint8_t *buf, size_t len,
 	break;
     case SERVER_MESSAGE__TYPE_COMMIT_POINT:
 	ret = handle_commit_point(msg->u.commit_point, closure);
-	if (sudo_timespeccmp(&closure->elapsed, &closure->committed, ==)) {
+	if (closure->state == CLOSING &&
+		sudo_timespeccmp(&closure->elapsed, &closure->committed, ==)) {
 	    sudo_ev_del(closure->evbase, closure->read_ev);
 	    closure->state = FINISHED;
 	    if (++finished_transmissions == nr_of_conns)
@@ -1600,6 +1792,7 @@ client_closure_free(struct client_closure *closure)
         free(closure->read_buf.data);
         free(closure->write_buf.data);
         free(closure->buf);
+        free(closure->spool_log_id);
         close(closure->sock);
         free(closure);
     }
@@ -1668,10 +1861,267 @@ bad:
     debug_return_ptr(NULL);
 }
 
+/*
+ * Read the restart state for a partially-sent spool file, if any.
+ * The file contains the remote log ID and the last commit point.
+ * Returns true on success or if there is no restart file, else false.
+ */
+static bool
+read_spool_restart(const char *path, char **log_id, struct timespec *restart)
+{
+    char *line = NULL;
+    size_t linesize = 0;
+    ssize_t len;
+    bool ret = false;
+    FILE *fp;
+    debug_decl(read_spool_restart, SUDO_DEBUG_UTIL);
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	if (errno == ENOENT)
+	    debug_return_bool(true);
+	sudo_warn("%s", path);
+	debug_return_bool(false);
+    }
+    if ((len = getdelim(&line, &linesize, '\n', fp)) <= 1)
+	goto bad;
+    line[len - 1] = '\0';
+    if ((*log_id = strdup(line)) == NULL) {
+	sudo_warn(NULL);
+	goto done;
+    }
+    if ((len = getdelim(&line, &linesize, '\n', fp)) <= 1)
+	goto bad;
+    line[len - 1] = '\0';
+    if (!parse_timespec(restart, line))
+	goto bad;
+    ret = true;
+    goto done;
+
+bad:
+    sudo_warnx(U_("%s: invalid restart file"), path);
+done:
+    free(line);
+    fclose(fp);
+    debug_return_bool(ret);
+}
+
+/*
+ * Record the remote log ID and last commit point of a partially-sent
+ * spool file so the transfer can be restarted next time.
+ */
+static void
+write_spool_restart(const char *path, struct client_closure *closure)
+{
+    FILE *fp;
+    debug_decl(write_spool_restart, SUDO_DEBUG_UTIL);
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sudo_warn("%s", path);
+	debug_return;
+    }
+    fprintf(fp, "%s\n%lld,%ld\n", closure->spool_log_id,
+	(long long)closure->committed.tv_sec, closure->committed.tv_nsec);
+    if (fclose(fp) != 0)
+	sudo_warn("%s", path);
+
+    debug_return;
+}
+
+/*
+ * Forward a single spool file to the log server.
+ * Spool files still being written by sudo are locked and skipped.
+ * The spool file is removed once the server has committed all of it.
+ * Returns true on success or if the file was skipped, else false.
+ */
+static bool
+send_spool_file(const char *spool_dir, const char *name, const char *port)
+{
+    struct client_closure *closure = NULL;
+    struct sudo_event_base *evbase = NULL;
+    struct timespec restart = { 0, 0 };
+    struct timespec elapsed = { 0, 0 };
+    char path[PATH_MAX], restart_path[PATH_MAX];
+    char *log_id = NULL;
+    struct stat sb;
+    bool ret = false;
+    int len, fd, sock;
+    debug_decl(send_spool_file, SUDO_DEBUG_UTIL);
+
+    len = snprintf(path, sizeof(path), "%s/%s", spool_dir, name);
+    if (len < 0 || len >= ssizeof(path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s/%s", spool_dir, name);
+	debug_return_bool(false);
+    }
+    len = snprintf(restart_path, sizeof(restart_path), "%s.restart", path);
+    if (len < 0 || len >= ssizeof(restart_path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s.restart", path);
+	debug_return_bool(false);
+    }
+    iolog_dir = path;
+
+    if ((fd = open(path, O_RDWR|O_NOFOLLOW)) == -1) {
+	sudo_warn("%s", path);
+	debug_return_bool(false);
+    }
+    if (!sudo_lock_file(fd, SUDO_TLOCK)) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: %s in use, skipping",
+	    __func__, path);
+	close(fd);
+	debug_return_bool(true);
+    }
+    if (fstat(fd, &sb) == -1) {
+	sudo_warn("%s", path);
+	close(fd);
+	debug_return_bool(false);
+    }
+    if (sb.st_size == 0) {
+	/* Nothing was spooled. */
+	unlink(path);
+	close(fd);
+	debug_return_bool(true);
+    }
+    if (!read_spool_restart(restart_path, &log_id, &restart)) {
+	close(fd);
+	debug_return_bool(false);
+    }
+
+    if ((evbase = sudo_ev_base_alloc()) == NULL)
+	sudo_fatal(NULL);
+    if ((sock = connect_server(server_name, port)) == -1)
+	goto done;
+    if (!testrun)
+	printf("Connected to %s:%s\n", server_name, port);
+    closure = client_closure_alloc(sock, evbase, &elapsed, &restart,
+	log_id, NULL, false, NULL);
+    if (closure == NULL)
+	goto done;
+    if ((closure->spool_fp = fdopen(fd, "r")) == NULL) {
+	sudo_warn("%s", path);
+	goto done;
+    }
+    fd = -1;
+    if (log_id != NULL) {
+	if ((closure->spool_log_id = strdup(log_id)) == NULL) {
+	    sudo_warn(NULL);
+	    goto done;
+	}
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (cert != NULL) {
+	if (!tls_setup(closure))
+	    goto done;
+    } else
+#endif
+    {
+	/* No TLS, send ClientHello */
+	if (!fmt_client_hello(closure))
+	    goto done;
+    }
+
+    finished_transmissions = 0;
+    sudo_ev_dispatch(evbase);
+
+    if (closure->state == FINISHED) {
+	/* Server has everything, remove the spool file. */
+	if (unlink(path) == -1)
+	    sudo_warn("%s", path);
+	if (unlink(restart_path) == -1 && errno != ENOENT)
+	    sudo_warn("%s", restart_path);
+	ret = true;
+    } else if (closure->spool_truncated) {
+	/* Nothing usable was spooled, retrying won't help. */
+	if (unlink(path) == -1)
+	    sudo_warn("%s", path);
+	if (unlink(restart_path) == -1 && errno != ENOENT)
+	    sudo_warn("%s", restart_path);
+    } else {
+	sudo_warnx(U_("%s: exited prematurely with state %d"), path,
+	    closure->state);
+	/* Resume from the last commit point next time. */
+	if (closure->spool_log_id != NULL && !closure->accept_only &&
+		sudo_timespecisset(&closure->committed))
+	    write_spool_restart(restart_path, closure);
+    }
+
+done:
+    if (closure != NULL) {
+	if (closure->spool_fp != NULL)
+	    fclose(closure->spool_fp);	/* also drops the lock */
+	client_closure_free(closure);
+    }
+    if (fd != -1)
+	close(fd);
+    sudo_ev_base_free(evbase);
+    free(log_id);
+    debug_return_bool(ret);
+}
+
+static int
+spool_name_cmp(const void *a, const void *b)
+{
+    return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/*
+ * Forward all completed spool files in spool_dir to the log server,
+ * oldest first.
+ * Returns true if all spool files were sent, else false.
+ */
+static bool
+send_spool_dir(const char *spool_dir, const char *port)
+{
+    struct dirent *dent;
+    char **names = NULL;
+    size_t i, nnames = 0, names_max = 0;
+    bool ret = true;
+    DIR *dirp;
+    debug_decl(send_spool_dir, SUDO_DEBUG_UTIL);
+
+    if ((dirp = opendir(spool_dir)) == NULL) {
+	sudo_warn("%s", spool_dir);
+	debug_return_bool(false);
+    }
+    while ((dent = readdir(dirp)) != NULL) {
+	size_t namelen = strlen(dent->d_name);
+
+	/* Skip temporary and restart files. */
+	if (strncmp(dent->d_name, "spool.", 6) != 0)
+	    continue;
+	if (namelen > 8 && strcmp(dent->d_name + namelen - 8, ".restart") == 0)
+	    continue;
+	if (nnames == names_max) {
+	    char **tmp;
+
+	    names_max = names_max ? names_max * 2 : 32;
+	    tmp = reallocarray(names, names_max, sizeof(char *));
+	    if (tmp == NULL)
+		sudo_fatal(NULL);
+	    names = tmp;
+	}
+	if ((names[nnames++] = strdup(dent->d_name)) == NULL)
+	    sudo_fatal(NULL);
+    }
+    closedir(dirp);
+
+    if (nnames > 1)
+	qsort(names, nnames, sizeof(char *), spool_name_cmp);
+    for (i = 0; i < nnames; i++) {
+	if (!send_spool_file(spool_dir, names[i], port))
+	    ret = false;
+	free(names[i]);
+    }
+    free(names);
+
+    debug_return_bool(ret);
+}
+
 #if defined(HAVE_OPENSSL)
-static const char short_opts[] = "Ah:i:np:r:R:t:b:c:k:V";
+static const char short_opts[] = "Ah:i:np:r:R:st:b:c:k:V";
 #else
-static const char short_opts[] = "Ah:i:Ip:r:R:t:V";
+static const char short_opts[] = "Ah:i:Ip:r:R:st:V";
 #endif
 static struct option long_opts[] = {
     { "accept",		no_argument,		NULL,	'A' },
@@ -1681,6 +2131,7 @@ static struct option long_opts[] = {
     { "port",		required_argument,	NULL,	'p' },
     { "restart",	required_argument,	NULL,	'r' },
     { "reject",		required_argument,	NULL,	'R' },
+    { "spool",		no_argument,		NULL,	's' },
     { "test",	    	optional_argument,	NULL,	't' },
 #if defined(HAVE_OPENSSL)
     { "ca-bundle",	required_argument,	NULL,	'b' },
@@ -1704,6 +2155,7 @@ main(int argc, char *argv[])
     struct timespec restart = { 0, 0 };
     struct timespec elapsed = { 0, 0 };
     bool accept_only = false;
+    bool spool = false;
     char *reject_reason = NULL;
     const char *iolog_id = NULL;
     const char *open_mode = "r";
@@ -1751,6 +2203,9 @@ main(int argc, char *argv[])
 	case 'p':
 	    port = optarg;
 	    break;
+	case 's':
+	    spool = true;
+	    break;
 	case 'r':
 	    if (!parse_timespec(&restart, optarg))
 		goto bad;
@@ -1816,6 +2271,21 @@ main(int argc, char *argv[])
     /* Remaining arg should be to I/O log dir to send. */
     if (argc != 1)
 	usage(true);
+
+    /* Forward messages spooled by sudoers when no server was reachable. */
+    if (spool) {
+	if (accept_only || reject_reason || iolog_id != NULL || testrun) {
+	    sudo_warnx("%s",
+		U_("only the host, port and TLS options may be used with a spool directory"));
+	    usage(true);
+	}
+	if (!send_spool_dir(argv[0], port))
+	    goto bad;
+#if defined(HAVE_OPENSSL)
+	SSL_CTX_free(ssl_ctx);
+#endif
+	debug_return_int(EXIT_SUCCESS);
+    }
     iolog_dir = argv[0];
     if ((iolog_dir_fd = open(iolog_dir, O_RDONLY)) == -1) {
 	sudo_warn("%s", iolog_dir);
@@ -68,6 +68,9 @@ struct client_closure {
     struct iolog_file iolog_files[IOFD_MAX];
     const char *iolog_id;
     char *reject_reason;
+    FILE *spool_fp;
+    char *spool_log_id;
+    bool spool_truncated;
     char *buf; /* XXX */
     size_t bufsize; /* XXX */
     enum client_state state;
@@ -76,15 +76,20 @@ alias_get(struct sudoers_parse_tree *parse_tree, const char *name, int type)
     if (parse_tree->aliases == NULL)
 	debug_return_ptr(NULL);
 
-    key.name = (char *)name;
-    key.type = type;
-    if ((node = rbfind(parse_tree->aliases, &key)) != NULL) {
+    if (parse_tree->aindex != NULL) {
+	a = alias_index_lookup(parse_tree, name, type);
+    } else {
+	key.name = (char *)name;
+	key.type = type;
+	if ((node = rbfind(parse_tree->aliases, &key)) != NULL)
+	    a = node->data;
+    }
+    if (a != NULL) {
 	/*
 	 * Check whether this alias is already in use.
 	 * If so, we've detected a loop.  If not, set the flag,
 	 * which the caller should clear with a call to alias_put().
 	 */
-	a = node->data;
 	if (a->used) {
 	    errno = ELOOP;
 	    debug_return_ptr(NULL);
@@ -124,6 +129,10 @@ alias_add(struct sudoers_parse_tree *parse_tree, char *name, int type,
 	    debug_return_bool(false);
     }
 
+    /* The alias index, if any, is now out of date. */
+    alias_index_free(parse_tree->aindex);
+    parse_tree->aindex = NULL;
+
     a = calloc(1, sizeof(*a));
     if (a == NULL)
 	debug_return_bool(false);
@@ -226,6 +235,10 @@ alias_remove(struct sudoers_parse_tree *parse_tree, char *name, int type)
     struct alias key;
     debug_decl(alias_remove, SUDOERS_DEBUG_ALIAS);
 
+    /* The alias index, if any, is now out of date. */
+    alias_index_free(parse_tree->aindex);
+    parse_tree->aindex = NULL;
+
     if (parse_tree->aliases != NULL) {
 	key.name = name;
 	key.type = type;
@@ -0,0 +1,423 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Index of the aliases in a parse tree, built once after parsing.
+ *
+ * Each alias is given an id and a hash table maps the alias name and
+ * type to that id.  User, host and command aliases are also flattened:
+ * nested aliases are replaced by their members, with the negation of
+ * the reference applied to each.  Since a member list is checked in
+ * reverse and the last matching member wins, the flattened list gives
+ * the same result as checking the nested aliases recursively.  A
+ * reference that cannot be resolved, because the alias does not exist
+ * or would form a loop, is kept as a literal name, as when matching.
+ * Runas aliases are not flattened since runaslist_matches() also
+ * checks the runas group when an alias is used.
+ *
+ * While a policy check is in progress (see alias_memo_begin()), the
+ * result of matching each alias is saved along with the request data
+ * it depends on and reused when the same alias is referenced again.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sudoers.h"
+#include <gram.h>
+
+/* Limit on the size of a flattened alias, larger ones are not flattened. */
+#define ALIAS_FLATTEN_MAX	4096
+
+struct alias_memo {
+    unsigned int generation;	/* matches alias_index generation if valid */
+    const void *key[3];		/* request data the result depends on */
+    int result;
+    struct member *matched;	/* matching runas member, if any */
+};
+
+struct alias_index_entry {
+    struct alias *a;
+    struct alias_member *members; /* flattened members or NULL */
+    size_t nmembers;
+    struct alias_memo memo[2];
+};
+
+struct alias_index {
+    struct alias_index_entry *entries; /* indexed by alias id */
+    unsigned int nentries;
+    unsigned int *buckets;	/* alias id + 1, or 0 if empty */
+    unsigned int nbuckets;	/* a power of 2 */
+    unsigned int generation;
+    bool memo_active;
+};
+
+/*
+ * FNV-1a hash of an alias name and type.
+ */
+static unsigned int
+alias_index_hash(const char *name, int type)
+{
+    unsigned int h = 2166136261U;
+
+    while (*name != '\0') {
+	h ^= (unsigned char)*name++;
+	h *= 16777619U;
+    }
+    h ^= (unsigned int)type;
+    h *= 16777619U;
+    return h;
+}
+
+/*
+ * Find the id of the alias with the given name and type.
+ * Returns the id or -1 if not found.
+ */
+static int
+alias_index_find_id(struct alias_index *aidx, const char *name, int type)
+{
+    unsigned int h, id;
+
+    h = alias_index_hash(name, type) & (aidx->nbuckets - 1);
+    while ((id = aidx->buckets[h]) != 0) {
+	struct alias *a = aidx->entries[id - 1].a;
+	if (a->type == type && strcmp(a->name, name) == 0)
+	    return id - 1;
+	h = (h + 1) & (aidx->nbuckets - 1);
+    }
+    return -1;
+}
+
+/*
+ * Closure for alias_index_add().
+ */
+struct alias_index_closure {
+    struct alias_index *aidx;
+    unsigned int count;
+};
+
+static int
+alias_index_add(struct sudoers_parse_tree *parse_tree, struct alias *a,
+    void *v)
+{
+    struct alias_index_closure *closure = v;
+    struct alias_index *aidx = closure->aidx;
+    unsigned int h;
+
+    if (aidx == NULL) {
+	/* Counting pass. */
+	closure->count++;
+	return 0;
+    }
+
+    a->id = aidx->nentries++;
+    aidx->entries[a->id].a = a;
+    h = alias_index_hash(a->name, a->type) & (aidx->nbuckets - 1);
+    while (aidx->buckets[h] != 0)
+	h = (h + 1) & (aidx->nbuckets - 1);
+    aidx->buckets[h] = a->id + 1;
+    return 0;
+}
+
+/*
+ * State for flattening a single alias.
+ */
+struct alias_flatten_state {
+    struct alias_member *members;
+    size_t nmembers;
+    size_t members_size;
+};
+
+/*
+ * Append the members of alias a, recursively, to the flattened member
+ * list.  The "used" flag of each alias being expanded is set to detect
+ * loops, as alias_get() does.
+ * Returns true on success or false on error or if the list is too large.
+ */
+static bool
+alias_flatten(struct alias_index *aidx, struct alias *a, bool negated,
+    struct alias_flatten_state *state)
+{
+    struct member *m;
+    bool ret = true;
+    int id;
+    debug_decl(alias_flatten, SUDOERS_DEBUG_ALIAS);
+
+    a->used = true;
+    TAILQ_FOREACH(m, &a->members, entries) {
+	const bool m_negated = m->negated != negated;
+	bool literal = false;
+
+	if (m->type == ALIAS) {
+	    id = alias_index_find_id(aidx, m->name, a->type);
+	    if (id != -1 && !aidx->entries[id].a->used) {
+		if (!alias_flatten(aidx, aidx->entries[id].a, m_negated, state)) {
+		    ret = false;
+		    break;
+		}
+		continue;
+	    }
+	    /* A command alias that cannot be resolved never matches. */
+	    if (a->type == CMNDALIAS)
+		continue;
+	    literal = true;
+	}
+	if (state->nmembers == state->members_size) {
+	    struct alias_member *members;
+	    size_t new_size;
+
+	    if (state->members_size >= ALIAS_FLATTEN_MAX) {
+		ret = false;
+		break;
+	    }
+	    new_size = state->members_size ? state->members_size * 2 : 8;
+	    members = reallocarray(state->members, new_size,
+		sizeof(*members));
+	    if (members == NULL) {
+		ret = false;
+		break;
+	    }
+	    state->members = members;
+	    state->members_size = new_size;
+	}
+	state->members[state->nmembers].m = m;
+	state->members[state->nmembers].negated = m_negated;
+	state->members[state->nmembers].literal = literal;
+	state->nmembers++;
+    }
+    a->used = false;
+
+    debug_return_bool(ret);
+}
+
+void
+alias_index_free(struct alias_index *aidx)
+{
+    unsigned int i;
+    debug_decl(alias_index_free, SUDOERS_DEBUG_ALIAS);
+
+    if (aidx != NULL) {
+	for (i = 0; i < aidx->nentries; i++)
+	    free(aidx->entries[i].members);
+	free(aidx->entries);
+	free(aidx->buckets);
+	free(aidx);
+    }
+
+    debug_return;
+}
+
+/*
+ * Build the alias index for parse_tree, replacing any existing one.
+ * Returns true on success, else false.  If the index cannot be built
+ * aliases are looked up in the parse tree's red-black tree instead.
+ */
+bool
+alias_index_build(struct sudoers_parse_tree *parse_tree)
+{
+    struct alias_index_closure closure = { NULL, 0 };
+    struct alias_flatten_state state;
+    struct alias_index *aidx;
+    unsigned int i;
+    debug_decl(alias_index_build, SUDOERS_DEBUG_ALIAS);
+
+    alias_index_free(parse_tree->aindex);
+    parse_tree->aindex = NULL;
+
+    alias_apply(parse_tree, alias_index_add, &closure);
+    if (closure.count == 0)
+	debug_return_bool(true);
+
+    if ((aidx = calloc(1, sizeof(*aidx))) == NULL)
+	goto oom;
+    aidx->nbuckets = 16;
+    while (aidx->nbuckets < closure.count * 2)
+	aidx->nbuckets <<= 1;
+    aidx->entries = calloc(closure.count, sizeof(*aidx->entries));
+    aidx->buckets = calloc(aidx->nbuckets, sizeof(*aidx->buckets));
+    if (aidx->entries == NULL || aidx->buckets == NULL)
+	goto oom;
+    closure.aidx = aidx;
+    alias_apply(parse_tree, alias_index_add, &closure);
+
+    for (i = 0; i < aidx->nentries; i++) {
+	struct alias_index_entry *entry = &aidx->entries[i];
+
+	if (entry->a->type == RUNASALIAS)
+	    continue;
+	memset(&state, 0, sizeof(state));
+	if (!alias_flatten(aidx, entry->a, false, &state)) {
+	    /* Too large, match recursively. */
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"unable to flatten %s %s", alias_type_to_string(entry->a->type),
+		entry->a->name);
+	    free(state.members);
+	    continue;
+	}
+	if (state.members == NULL) {
+	    /* Non-NULL so an empty list can be told from an unflattened one. */
+	    if ((state.members = malloc(sizeof(*state.members))) == NULL)
+		goto oom;
+	}
+	entry->members = state.members;
+	entry->nmembers = state.nmembers;
+    }
+
+    parse_tree->aindex = aidx;
+    sudo_debug_printf(SUDO_DEBUG_INFO, "indexed %u aliases", aidx->nentries);
+    debug_return_bool(true);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    alias_index_free(aidx);
+    debug_return_bool(false);
+}
+
+/*
+ * Find the alias with the specified name and type in the index.
+ * Returns the alias or NULL if not found.
+ */
+struct alias *
+alias_index_lookup(struct sudoers_parse_tree *parse_tree, const char *name,
+    int type)
+{
+    int id;
+    debug_decl(alias_index_lookup, SUDOERS_DEBUG_ALIAS);
+
+    id = alias_index_find_id(parse_tree->aindex, name, type);
+    debug_return_ptr(id == -1 ? NULL : parse_tree->aindex->entries[id].a);
+}
+
+/*
+ * Return the index entry for alias a or NULL if it is not indexed.
+ */
+static struct alias_index_entry *
+alias_index_entry(struct sudoers_parse_tree *parse_tree, const struct alias *a)
+{
+    struct alias_index *aidx = parse_tree->aindex;
+
+    if (aidx == NULL || a->id >= aidx->nentries || aidx->entries[a->id].a != a)
+	return NULL;
+    return &aidx->entries[a->id];
+}
+
+/*
+ * Return the flattened members of alias a, storing the number of
+ * members in nmembers, or NULL if the alias has not been flattened.
+ */
+const struct alias_member *
+alias_index_members(struct sudoers_parse_tree *parse_tree,
+    const struct alias *a, size_t *nmembers)
+{
+    struct alias_index_entry *entry = alias_index_entry(parse_tree, a);
+
+    if (entry == NULL || entry->members == NULL)
+	return NULL;
+    *nmembers = entry->nmembers;
+    return entry->members;
+}
+
+/*
+ * Start a policy check; alias match results are memoized until
+ * alias_memo_end() is called.  The request data used as memo keys
+ * must not change or be freed while the check is in progress.
+ */
+void
+alias_memo_begin(struct sudoers_parse_tree *parse_tree)
+{
+    struct alias_index *aidx = parse_tree->aindex;
+
+    if (aidx != NULL) {
+	if (++aidx->generation == 0) {
+	    /* Wrapped, invalidate all memoized results. */
+	    unsigned int i;
+
+	    for (i = 0; i < aidx->nentries; i++) {
+		aidx->entries[i].memo[0].generation = 0;
+		aidx->entries[i].memo[1].generation = 0;
+	    }
+	    aidx->generation = 1;
+	}
+	aidx->memo_active = true;
+    }
+}
+
+/*
+ * End a policy check started by alias_memo_begin().
+ */
+void
+alias_memo_end(struct sudoers_parse_tree *parse_tree)
+{
+    if (parse_tree->aindex != NULL)
+	parse_tree->aindex->memo_active = false;
+}
+
+/*
+ * Look up the memoized result for alias a in the specified slot (0 or 1).
+ * The keys are the request data the result depends on.
+ * Returns true if found, storing the result and matching member.
+ */
+bool
+alias_memo_lookup(struct sudoers_parse_tree *parse_tree, const struct alias *a,
+    int slot, const void *key0, const void *key1, const void *key2,
+    int *result, struct member **matched)
+{
+    struct alias_index_entry *entry = alias_index_entry(parse_tree, a);
+    struct alias_memo *memo;
+
+    if (entry == NULL || !parse_tree->aindex->memo_active)
+	return false;
+    memo = &entry->memo[slot];
+    if (memo->generation != parse_tree->aindex->generation ||
+	    memo->key[0] != key0 || memo->key[1] != key1 || memo->key[2] != key2)
+	return false;
+    *result = memo->result;
+    if (matched != NULL && memo->matched != NULL)
+	*matched = memo->matched;
+    return true;
+}
+
+/*
+ * Memoize the result of matching alias a in the specified slot (0 or 1).
+ */
+void
+alias_memo_store(struct sudoers_parse_tree *parse_tree, const struct alias *a,
+    int slot, const void *key0, const void *key1, const void *key2,
+    int result, struct member *matched)
+{
+    struct alias_index_entry *entry = alias_index_entry(parse_tree, a);
+    struct alias_memo *memo;
+
+    if (entry == NULL || !parse_tree->aindex->memo_active)
+	return;
+    memo = &entry->memo[slot];
+    memo->generation = parse_tree->aindex->generation;
+    memo->key[0] = key0;
+    memo->key[1] = key1;
+    memo->key[2] = key2;
+    memo->result = result;
+    memo->matched = matched;
+}
@@ -35,10 +35,14 @@
  * Time stamps are now stored in a single file which contains multiple
  * records.  Each record starts with a 16-bit version number and a 16-bit
  * record size.  Multiple record types can coexist in the same file.
+ *
+ * Version 3 files start with a header record followed by a hash table
+ * of record-sized slots, records that don't fit are appended after it.
  */
-#define	TS_VERSION		2
+#define	TS_VERSION		3
 
 /* Time stamp entry types */
+#define TS_UNUSED		0x00	/* empty hash table slot */
 #define TS_GLOBAL		0x01	/* not restricted by tty or ppid */
 #define TS_TTY			0x02	/* restricted by tty */
 #define TS_PPID			0x03	/* restricted by ppid */
@@ -62,6 +66,7 @@ struct timestamp_entry_v1 {
     } u;
 };
 
+/* Version 2 and 3 records have the same layout. */
 struct timestamp_entry {
     unsigned short version;	/* version number */
     unsigned short size;	/* entry size */
@@ -77,6 +82,18 @@ struct timestamp_entry {
     } u;
 };
 
+/*
+ * Header at the start of a version 3 file, also used as the lock record.
+ * It occupies the space of a struct timestamp_entry.
+ */
+struct timestamp_header {
+    unsigned short version;	/* version number */
+    unsigned short size;	/* sizeof(struct timestamp_entry) */
+    unsigned short type;	/* TS_LOCKEXCL */
+    unsigned short flags;	/* unused */
+    unsigned int nslots;	/* number of hash table slots */
+};
+
 void *timestamp_open(const char *user, pid_t sid);
 void  timestamp_close(void *vcookie);
 bool  timestamp_lock(void *vcookie, struct passwd *pw);
@@ -0,0 +1,371 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Index of the cmndspecs in a parse tree by the commands they can match.
+ *
+ * A sudoers command that is not a directory and whose base name has no
+ * glob characters can only match a command with the same base name,
+ * see command_matches_normal() and command_matches_glob().  Such
+ * cmndspecs are filed under the base name of each of their commands,
+ * following Cmnd_Aliases.  Directories, ALL and patterns with glob
+ * characters in the base name are candidates for every command.
+ *
+ * A lookup returns the cmndspecs that may match user_base, in sudoers
+ * order, along with the privilege and userspec they belong to.  The
+ * caller must still check the user, host, runas and command, so the
+ * result is the same as checking every cmndspec in sudoers.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sudoers.h"
+#include "redblack.h"
+#include <gram.h>
+
+struct cmnd_index_entry {
+    char *key;			/* command base name */
+    unsigned int *refs;		/* cmndspec numbers, in ascending order */
+    unsigned int nrefs;
+    unsigned int refs_size;
+};
+
+struct cmnd_index {
+    struct cmndspec_ref *refs;	/* cmndspecs in sudoers order */
+    unsigned int nrefs;
+    struct rbtree *bases;	/* command base name -> cmndspecs */
+    struct cmnd_index_entry wild; /* directories, patterns and ALL */
+};
+
+static int
+cmnd_index_compare(const void *v1, const void *v2)
+{
+    const struct cmnd_index_entry *e1 = v1;
+    const struct cmnd_index_entry *e2 = v2;
+
+    return strcmp(e1->key, e2->key);
+}
+
+static void
+cmnd_index_entry_free(void *v)
+{
+    struct cmnd_index_entry *entry = v;
+
+    free(entry->key);
+    free(entry->refs);
+    free(entry);
+}
+
+/*
+ * Append cmndspec number n to entry, ignoring duplicates.
+ */
+static bool
+cmnd_index_entry_add(struct cmnd_index_entry *entry, unsigned int n)
+{
+    debug_decl(cmnd_index_entry_add, SUDOERS_DEBUG_PARSER);
+
+    if (entry->nrefs != 0 && entry->refs[entry->nrefs - 1] == n)
+	debug_return_bool(true);
+    if (entry->nrefs == entry->refs_size) {
+	unsigned int new_size = entry->refs_size ? entry->refs_size * 2 : 4;
+	unsigned int *refs;
+
+	refs = reallocarray(entry->refs, new_size, sizeof(*refs));
+	if (refs == NULL)
+	    debug_return_bool(false);
+	entry->refs = refs;
+	entry->refs_size = new_size;
+    }
+    entry->refs[entry->nrefs++] = n;
+    debug_return_bool(true);
+}
+
+/*
+ * File cmndspec number n under the command base name, creating the
+ * entry as needed.
+ */
+static bool
+cmnd_index_add(struct cmnd_index *cidx, const char *base, unsigned int n)
+{
+    struct cmnd_index_entry *entry, ekey;
+    struct rbnode *node;
+    debug_decl(cmnd_index_add, SUDOERS_DEBUG_PARSER);
+
+    ekey.key = (char *)base;
+    if ((node = rbfind(cidx->bases, &ekey)) != NULL) {
+	entry = node->data;
+    } else {
+	if ((entry = calloc(1, sizeof(*entry))) == NULL)
+	    debug_return_bool(false);
+	if ((entry->key = strdup(base)) == NULL) {
+	    free(entry);
+	    debug_return_bool(false);
+	}
+	if (rbinsert(cidx->bases, entry, NULL) != 0) {
+	    cmnd_index_entry_free(entry);
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(cmnd_index_entry_add(entry, n));
+}
+
+/*
+ * Add the command(s) m refers to for cmndspec number n.
+ * Negated commands are indexed too since they can cause a DENY.
+ */
+static bool
+cmnd_index_add_member(struct sudoers_parse_tree *parse_tree,
+    struct cmnd_index *cidx, struct member *m, unsigned int n)
+{
+    struct sudo_command *c;
+    struct member *am;
+    struct alias *a;
+    const char *base;
+    bool ret = true;
+    size_t len;
+    debug_decl(cmnd_index_add_member, SUDOERS_DEBUG_PARSER);
+
+    switch (m->type) {
+	case ALL:
+	    ret = cmnd_index_entry_add(&cidx->wild, n);
+	    break;
+	case COMMAND:
+	    c = (struct sudo_command *)m->name;
+	    if (c->cmnd == NULL) {
+		/* Only happens for ALL with a digest. */
+		ret = cmnd_index_entry_add(&cidx->wild, n);
+		break;
+	    }
+	    if (c->cmnd[0] != '/') {
+		/* Pseudo-command like sudoedit, matched by name. */
+		ret = cmnd_index_add(cidx, c->cmnd, n);
+		break;
+	    }
+	    len = strlen(c->cmnd);
+	    base = strrchr(c->cmnd, '/') + 1;
+	    if (c->cmnd[len - 1] == '/' || has_meta(base)) {
+		/* Directory or a pattern that may match any base name. */
+		ret = cmnd_index_entry_add(&cidx->wild, n);
+	    } else {
+		ret = cmnd_index_add(cidx, base, n);
+	    }
+	    break;
+	case ALIAS:
+	    /* A missing alias never matches, see cmnd_matches(). */
+	    if ((a = alias_get(parse_tree, m->name, CMNDALIAS)) != NULL) {
+		TAILQ_FOREACH(am, &a->members, entries) {
+		    ret = cmnd_index_add_member(parse_tree, cidx, am, n);
+		    if (!ret)
+			break;
+		}
+		alias_put(a);
+	    }
+	    break;
+	default:
+	    /* Not a valid command, always check it. */
+	    ret = cmnd_index_entry_add(&cidx->wild, n);
+	    break;
+    }
+    debug_return_bool(ret);
+}
+
+/*
+ * Free a command index.
+ */
+void
+cmnd_index_free(struct cmnd_index *cidx)
+{
+    debug_decl(cmnd_index_free, SUDOERS_DEBUG_PARSER);
+
+    if (cidx != NULL) {
+	if (cidx->bases != NULL)
+	    rbdestroy(cidx->bases, cmnd_index_entry_free);
+	free(cidx->wild.refs);
+	free(cidx->refs);
+	free(cidx);
+    }
+
+    debug_return;
+}
+
+/*
+ * Build an index of the cmndspecs in parse_tree, replacing any existing one.
+ * The parse tree must not be modified while the index is in use.
+ * Returns true on success, else false.
+ */
+bool
+cmnd_index_build(struct sudoers_parse_tree *parse_tree)
+{
+    struct cmnd_index *cidx;
+    struct userspec *us;
+    struct privilege *priv;
+    struct cmndspec *cs;
+    unsigned int n = 0;
+    debug_decl(cmnd_index_build, SUDOERS_DEBUG_PARSER);
+
+    cmnd_index_free(parse_tree->cindex);
+    parse_tree->cindex = NULL;
+
+    if ((cidx = calloc(1, sizeof(*cidx))) == NULL)
+	goto oom;
+    if ((cidx->bases = rbcreate(cmnd_index_compare)) == NULL)
+	goto oom;
+
+    TAILQ_FOREACH(us, &parse_tree->userspecs, entries) {
+	TAILQ_FOREACH(priv, &us->privileges, entries) {
+	    TAILQ_FOREACH(cs, &priv->cmndlist, entries)
+		cidx->nrefs++;
+	}
+    }
+    cidx->refs = reallocarray(NULL, cidx->nrefs ? cidx->nrefs : 1,
+	sizeof(struct cmndspec_ref));
+    if (cidx->refs == NULL)
+	goto oom;
+
+    TAILQ_FOREACH(us, &parse_tree->userspecs, entries) {
+	TAILQ_FOREACH(priv, &us->privileges, entries) {
+	    TAILQ_FOREACH(cs, &priv->cmndlist, entries) {
+		cidx->refs[n].us = us;
+		cidx->refs[n].priv = priv;
+		cidx->refs[n].cs = cs;
+		if (!cmnd_index_add_member(parse_tree, cidx, cs->cmnd, n))
+		    goto oom;
+		n++;
+	    }
+	}
+    }
+    parse_tree->cindex = cidx;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"indexed %u cmndspecs, %u match any command", cidx->nrefs,
+	cidx->wild.nrefs);
+    debug_return_bool(true);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    cmnd_index_free(cidx);
+    debug_return_bool(false);
+}
+
+/*
+ * Return all the cmndspecs in parse_tree, in sudoers order.
+ */
+static struct cmndspec_ref *
+cmnd_index_all(struct sudoers_parse_tree *parse_tree, size_t *nrefs)
+{
+    struct cmndspec_ref *refs;
+    struct userspec *us;
+    struct privilege *priv;
+    struct cmndspec *cs;
+    size_t n = 0;
+    debug_decl(cmnd_index_all, SUDOERS_DEBUG_PARSER);
+
+    TAILQ_FOREACH(us, &parse_tree->userspecs, entries) {
+	TAILQ_FOREACH(priv, &us->privileges, entries) {
+	    TAILQ_FOREACH(cs, &priv->cmndlist, entries)
+		n++;
+	}
+    }
+    refs = reallocarray(NULL, n ? n : 1, sizeof(*refs));
+    if (refs == NULL)
+	debug_return_ptr(NULL);
+
+    n = 0;
+    TAILQ_FOREACH(us, &parse_tree->userspecs, entries) {
+	TAILQ_FOREACH(priv, &us->privileges, entries) {
+	    TAILQ_FOREACH(cs, &priv->cmndlist, entries) {
+		refs[n].us = us;
+		refs[n].priv = priv;
+		refs[n].cs = cs;
+		n++;
+	    }
+	}
+    }
+    *nrefs = n;
+    debug_return_ptr(refs);
+}
+
+/*
+ * Return the cmndspecs in parse_tree that may match a command with the
+ * given base name, in sudoers order.  If there is no index, all
+ * cmndspecs are returned.  The number of entries is stored in nrefs.
+ * Returns an array the caller must free, or NULL on allocation failure.
+ */
+struct cmndspec_ref *
+cmnd_index_lookup(struct sudoers_parse_tree *parse_tree, const char *base,
+    size_t *nrefs)
+{
+    struct cmnd_index *cidx = parse_tree->cindex;
+    struct cmnd_index_entry *entry = NULL, ekey;
+    struct cmndspec_ref *refs;
+    struct rbnode *node;
+    unsigned int i = 0, j = 0, nbase = 0;
+    size_t n = 0;
+    debug_decl(cmnd_index_lookup, SUDOERS_DEBUG_PARSER);
+
+    if (cidx == NULL) {
+	refs = cmnd_index_all(parse_tree, nrefs);
+	if (refs == NULL)
+	    goto oom;
+	debug_return_ptr(refs);
+    }
+
+    if (base != NULL) {
+	ekey.key = (char *)base;
+	if ((node = rbfind(cidx->bases, &ekey)) != NULL) {
+	    entry = node->data;
+	    nbase = entry->nrefs;
+	}
+    }
+    refs = reallocarray(NULL, nbase + cidx->wild.nrefs + 1, sizeof(*refs));
+    if (refs == NULL)
+	goto oom;
+
+    /* Merge the two sorted lists, a cmndspec may be in both. */
+    while (i < nbase || j < cidx->wild.nrefs) {
+	unsigned int ref;
+
+	if (j == cidx->wild.nrefs ||
+		(i < nbase && entry->refs[i] < cidx->wild.refs[j])) {
+	    ref = entry->refs[i++];
+	} else if (i == nbase || cidx->wild.refs[j] < entry->refs[i]) {
+	    ref = cidx->wild.refs[j++];
+	} else {
+	    ref = entry->refs[i++];
+	    j++;
+	}
+	refs[n++] = cidx->refs[ref];
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_DEBUG,
+	"%zu of %u cmndspecs are candidates for command %s", n, cidx->nrefs,
+	base ? base : "(none)");
+    *nrefs = n;
+    debug_return_ptr(refs);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    debug_return_ptr(NULL);
+}
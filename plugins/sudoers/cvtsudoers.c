@@ -35,6 +35,7 @@
 #endif /* HAVE_STRINGS_H */
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <unistd.h>
 #ifdef HAVE_GETOPT_LONG
@@ -80,7 +81,9 @@ static struct option long_opts[] = {
 sudo_dso_public int main(int argc, char *argv[]);
 static void help(void) __attribute__((__noreturn__));
 static void usage(int);
+static bool convert_sudoers_image(struct sudoers_parse_tree *parse_tree, const char *input_file, const char *output_file);
 static bool convert_sudoers_sudoers(struct sudoers_parse_tree *parse_tree, const char *output_file, struct cvtsudoers_config *conf);
+static bool parse_image(struct sudoers_parse_tree *parse_tree, const char *input_file);
 static bool parse_sudoers(const char *input_file, struct cvtsudoers_config *conf);
 static bool parse_ldif(struct sudoers_parse_tree *parse_tree, const char *input_file, struct cvtsudoers_config *conf);
 static bool cvtsudoers_parse_filter(char *expression);
@@ -239,7 +242,9 @@ main(int argc, char *argv[])
     argv += optind;
 
     if (conf->input_format != NULL) {
-	if (strcasecmp(conf->input_format, "ldif") == 0) {
+	if (strcasecmp(conf->input_format, "image") == 0) {
+	    input_format = format_image;
+	} else if (strcasecmp(conf->input_format, "ldif") == 0) {
 	    input_format = format_ldif;
 	} else if (strcasecmp(conf->input_format, "sudoers") == 0) {
 	    input_format = format_sudoers;
@@ -249,7 +254,10 @@ main(int argc, char *argv[])
 	}
     }
     if (conf->output_format != NULL) {
-	if (strcasecmp(conf->output_format, "json") == 0) {
+	if (strcasecmp(conf->output_format, "image") == 0) {
+	    output_format = format_image;
+	    conf->store_options = false;
+	} else if (strcasecmp(conf->output_format, "json") == 0) {
 	    output_format = format_json;
 	    conf->store_options = true;
 	} else if (strcasecmp(conf->output_format, "ldif") == 0) {
@@ -309,6 +317,29 @@ main(int argc, char *argv[])
 	input_file = argv[0];
     }
 
+    /*
+     * A policy image must be an exact copy of a sudoers file on disk.
+     * Its sources are checked by path so the input must be fully-qualified.
+     */
+    if (output_format == format_image) {
+	if (input_format != format_sudoers || conf->filter != NULL ||
+		conf->defstr != NULL || conf->supstr != NULL) {
+	    sudo_warnx("%s",
+		U_("image output requires unfiltered sudoers input"));
+	    usage(1);
+	}
+	if (input_file[0] != '/') {
+	    sudo_fatalx(U_("%s: sudoers path must be fully-qualified"),
+		input_file);
+	}
+	if (strcmp(output_file, "-") == 0) {
+	    if ((output_file = sudoers_image_path(input_file)) == NULL) {
+		sudo_fatalx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+	    }
+	}
+    }
+
     if (strcmp(input_file, "-") != 0) {
 	if (strcmp(input_file, output_file) == 0) {
 	    sudo_fatalx(U_("%s: input and output files must be different"),
@@ -330,6 +361,10 @@ main(int argc, char *argv[])
 	sudo_fatalx("%s", U_("unable to initialize sudoers default values"));
 
     switch (input_format) {
+    case format_image:
+	if (!parse_image(&parsed_policy, input_file))
+	    goto done;
+	break;
     case format_ldif:
 	if (!parse_ldif(&parsed_policy, input_file, conf))
 	    goto done;
@@ -352,6 +387,10 @@ main(int argc, char *argv[])
     }
 
     switch (output_format) {
+    case format_image:
+	exitcode = !convert_sudoers_image(&parsed_policy, input_file,
+	    output_file);
+	break;
     case format_json:
 	exitcode = !convert_sudoers_json(&parsed_policy, output_file, conf);
 	break;
@@ -621,9 +660,31 @@ parse_ldif(struct sudoers_parse_tree *parse_tree, const char *input_file,
 	conf->store_options));
 }
 
+static bool
+parse_image(struct sudoers_parse_tree *parse_tree, const char *input_file)
+{
+    bool ret;
+    int fd;
+    debug_decl(parse_image, SUDOERS_DEBUG_UTIL);
+
+    /* The image is loaded as-is, even if its sources have changed. */
+    if (strcmp(input_file, "-") == 0)
+	fd = STDIN_FILENO;
+    else if ((fd = open(input_file, O_RDONLY)) == -1)
+	sudo_fatal(U_("unable to open %s"), input_file);
+    ret = sudoers_image_read(fd, NULL, parse_tree);
+    if (!ret)
+	sudo_warnx(U_("%s: invalid sudoers image"), input_file);
+    if (fd != STDIN_FILENO)
+	close(fd);
+
+    debug_return_bool(ret);
+}
+
 static bool
 parse_sudoers(const char *input_file, struct cvtsudoers_config *conf)
 {
+    struct stat sb;
     debug_decl(parse_sudoers, SUDOERS_DEBUG_UTIL);
 
     /* Open sudoers file and parse it. */
@@ -633,6 +694,8 @@ parse_sudoers(const char *input_file, struct cvtsudoers_config *conf)
     } else if ((sudoersin = fopen(input_file, "r")) == NULL)
 	sudo_fatal(U_("unable to open %s"), input_file);
     init_parser(input_file, false, true);
+    if (fstat(fileno(sudoersin), &sb) == 0)
+	(void)sudoers_image_add_source(input_file, &sb);
     if (sudoersparse() && !parse_error) {
 	sudo_warnx(U_("failed to parse %s file, unknown error"), input_file);
 	parse_error = true;
@@ -1297,6 +1360,26 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Write a compiled image of the parsed sudoers file.
+ */
+static bool
+convert_sudoers_image(struct sudoers_parse_tree *parse_tree,
+    const char *input_file, const char *output_file)
+{
+    uid_t uid = (uid_t)-1;
+    gid_t gid = (gid_t)-1;
+    debug_decl(convert_sudoers_image, SUDOERS_DEBUG_UTIL);
+
+    /* sudo will only use an image with the same owner as sudoers. */
+    if (geteuid() == ROOT_UID) {
+	uid = sudoers_uid;
+	gid = sudoers_gid;
+    }
+    debug_return_bool(sudoers_image_write(parse_tree, output_file, uid, gid,
+	sudoers_mode));
+}
+
 static void
 usage(int fatal)
 {
@@ -1318,8 +1401,8 @@ help(void)
 	"  -c, --config=conf_file     the path to the configuration file\n"
 	"  -d, --defaults=deftypes    only convert Defaults of the specified types\n"
 	"  -e, --expand-aliases       expand aliases when converting\n"
-	"  -f, --output-format=format set output format: JSON, LDIF or sudoers\n"
-	"  -i, --input-format=format  set input format: LDIF or sudoers\n"
+	"  -f, --output-format=format set output format: image, JSON, LDIF or sudoers\n"
+	"  -i, --input-format=format  set input format: image, LDIF or sudoers\n"
 	"  -I, --increment=num        amount to increase each sudoOrder by\n"
 	"  -h, --help                 display help message and exit\n"
 	"  -m, --match=filter         only convert entries that match the filter\n"
@@ -23,6 +23,7 @@
 
 /* Supported input/output formats. */
 enum sudoers_formats {
+    format_image,
     format_json,
     format_ldif,
     format_sudoers
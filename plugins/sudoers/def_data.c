@@ -541,6 +541,14 @@ struct sudo_defs_types sudo_defs_table[] = {
 	"log_server_verify", T_FLAG,
 	N_("Verify that the log server's certificate is valid"),
 	NULL,
+    }, {
+	"log_server_spool", T_STR|T_BOOL|T_PATH,
+	N_("Directory to store log server messages in when no server is reachable: %s"),
+	NULL,
+    }, {
+	"log_server_async", T_FLAG,
+	N_("Run the command without waiting for the log server connection to be established"),
+	NULL,
     }, {
 	"runas_allow_unknown_id", T_FLAG,
 	N_("Allow the use of unknown runas user and/or group ID"),
@@ -573,7 +581,55 @@ struct sudo_defs_types sudo_defs_table[] = {
 	"selinux", T_FLAG,
 	N_("Enable SELinux RBAC support"),
 	NULL,
+    }, {
+	"iolog_codec", T_STR,
+	N_("Compression codec to use for I/O logs: %s"),
+	NULL,
+    }, {
+	"digest_cache", T_STR|T_BOOL|T_PATH,
+	N_("Path to the command digest cache: %s"),
+	NULL,
     }, {
 	NULL, 0, NULL
     }
 };
+
+/* Perfect hash of the names in sudo_defs_table, see find_default(). */
+#define SUDO_DEFS_HASH_PRIME	1048573
+#define SUDO_DEFS_HASH_MULT	31
+
+static const unsigned short sudo_defs_hash_mult[35] = {
+    41, 37, 39, 37, 51, 35, 37, 33, 33, 37,
+    39, 33, 41, 37, 39, 33, 37, 47, 35, 37,
+    37, 35, 57, 33, 41, 37, 53, 41, 37, 35,
+    41, 41, 33, 33, 33
+};
+
+static const short sudo_defs_hash_index[256] = {
+    122, 115, -1, -1, -1, 125, 59, 45, -1, 108,
+    -1, -1, 98, 10, -1, -1, 53, -1, 17, -1,
+    96, 61, -1, -1, 26, 32, -1, -1, -1, 4,
+    -1, -1, -1, 89, 65, 78, -1, 7, -1, 90,
+    119, -1, 50, -1, -1, -1, -1, 19, -1, 64,
+    106, -1, -1, 97, 76, 2, 30, 68, 131, -1,
+    92, 67, 87, -1, 34, 118, 44, 83, -1, 94,
+    -1, -1, 22, -1, 121, 95, -1, -1, -1, 117,
+    -1, 29, 24, -1, 127, 110, -1, 12, -1, -1,
+    -1, 134, 103, 63, -1, -1, -1, 62, -1, -1,
+    -1, 58, 109, -1, 133, 112, 135, 126, -1, -1,
+    -1, -1, -1, 101, -1, 9, 33, 31, -1, -1,
+    72, 36, 42, 40, 75, 85, 66, -1, -1, 132,
+    74, 23, 86, 79, -1, 60, -1, 56, -1, -1,
+    -1, -1, 6, -1, -1, 91, 81, -1, 13, -1,
+    0, -1, -1, -1, -1, -1, -1, 73, 48, 52,
+    21, -1, 37, 11, -1, 116, 93, -1, -1, 14,
+    -1, 113, -1, 107, -1, 15, -1, 111, -1, 128,
+    123, -1, 82, -1, -1, 8, -1, -1, -1, 114,
+    38, 105, -1, -1, -1, -1, 102, -1, 55, -1,
+    3, 1, -1, -1, 41, 84, 35, -1, 124, 39,
+    -1, 20, 28, -1, -1, -1, 130, -1, 57, -1,
+    69, -1, 16, 27, -1, 43, 129, 88, -1, -1,
+    104, -1, -1, -1, 99, 70, 54, 46, -1, -1,
+    100, 80, 120, 49, -1, 25, -1, -1, 5, -1,
+    18, -1, 71, 47, 51, 77
+};
@@ -248,22 +248,30 @@
 #define def_log_server_peer_key (sudo_defs_table[I_LOG_SERVER_PEER_KEY].sd_un.str)
 #define I_LOG_SERVER_VERIFY     123
 #define def_log_server_verify   (sudo_defs_table[I_LOG_SERVER_VERIFY].sd_un.flag)
-#define I_RUNAS_ALLOW_UNKNOWN_ID 124
+#define I_LOG_SERVER_SPOOL      124
+#define def_log_server_spool    (sudo_defs_table[I_LOG_SERVER_SPOOL].sd_un.str)
+#define I_LOG_SERVER_ASYNC      125
+#define def_log_server_async    (sudo_defs_table[I_LOG_SERVER_ASYNC].sd_un.flag)
+#define I_RUNAS_ALLOW_UNKNOWN_ID 126
 #define def_runas_allow_unknown_id (sudo_defs_table[I_RUNAS_ALLOW_UNKNOWN_ID].sd_un.flag)
-#define I_RUNAS_CHECK_SHELL     125
+#define I_RUNAS_CHECK_SHELL     127
 #define def_runas_check_shell   (sudo_defs_table[I_RUNAS_CHECK_SHELL].sd_un.flag)
-#define I_PAM_RUSER             126
+#define I_PAM_RUSER             128
 #define def_pam_ruser           (sudo_defs_table[I_PAM_RUSER].sd_un.flag)
-#define I_PAM_RHOST             127
+#define I_PAM_RHOST             129
 #define def_pam_rhost           (sudo_defs_table[I_PAM_RHOST].sd_un.flag)
-#define I_RUNCWD                128
+#define I_RUNCWD                130
 #define def_runcwd              (sudo_defs_table[I_RUNCWD].sd_un.str)
-#define I_RUNCHROOT             129
+#define I_RUNCHROOT             131
 #define def_runchroot           (sudo_defs_table[I_RUNCHROOT].sd_un.str)
-#define I_LOG_FORMAT            130
+#define I_LOG_FORMAT            132
 #define def_log_format          (sudo_defs_table[I_LOG_FORMAT].sd_un.tuple)
-#define I_SELINUX               131
+#define I_SELINUX               133
 #define def_selinux             (sudo_defs_table[I_SELINUX].sd_un.flag)
+#define I_IOLOG_CODEC           134
+#define def_iolog_codec         (sudo_defs_table[I_IOLOG_CODEC].sd_un.str)
+#define I_DIGEST_CACHE          135
+#define def_digest_cache        (sudo_defs_table[I_DIGEST_CACHE].sd_un.str)
 
 enum def_tuple {
     never,
@@ -33,6 +33,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
 #include <ctype.h>
 #include <syslog.h>
 
@@ -166,6 +171,20 @@ dump_defaults(void)
     debug_return;
 }
 
+/*
+ * Hash function for the perfect hash generated by mkdefaults.
+ * Must match name_hash() in mkdefaults.
+ */
+static unsigned int
+defs_hash(const char *name, unsigned int mult)
+{
+    uint64_t h = 0;
+
+    while (*name != '\0')
+	h = (h * mult + (unsigned char)*name++) % SUDO_DEFS_HASH_PRIME;
+    return (unsigned int)h;
+}
+
 /*
  * Find the index of the specified Defaults name in sudo_defs_table[]
  * On success, returns the matching index or -1 on failure.
@@ -173,13 +192,17 @@ dump_defaults(void)
 static int
 find_default(const char *name, const char *file, int line, int column, bool quiet)
 {
+    unsigned int mult;
     int i;
     debug_decl(find_default, SUDOERS_DEBUG_DEFAULTS);
 
-    for (i = 0; sudo_defs_table[i].name != NULL; i++) {
-	if (strcmp(name, sudo_defs_table[i].name) == 0)
-	    debug_return_int(i);
-    }
+    /* The name can only be in the one slot of sudo_defs_hash_index[]. */
+    mult = sudo_defs_hash_mult[defs_hash(name, SUDO_DEFS_HASH_MULT) %
+	nitems(sudo_defs_hash_mult)];
+    i = sudo_defs_hash_index[defs_hash(name, mult) %
+	nitems(sudo_defs_hash_index)];
+    if (i != -1 && strcmp(name, sudo_defs_table[i].name) == 0)
+	debug_return_int(i);
     if (!quiet && !def_ignore_unknown_defaults) {
 	if (line > 0) {
 	    sudo_warnx(U_("%s:%d:%d: unknown defaults entry \"%s\""),
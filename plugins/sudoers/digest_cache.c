@@ -0,0 +1,211 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Persistent cache of command digests, enabled by the "digest_cache"
+ * Defaults setting.  This is a slot cache (see root_cache.c) keyed
+ * by a file's device, inode and the digest type.
+ *
+ * An entry is only used if the device, inode, size, mtime and ctime
+ * of the file all still match.  Any change to a file's contents or
+ * metadata updates its ctime, which cannot be set from user space.
+ * To avoid caching a digest of contents that change within the same
+ * second, files whose ctime is less than DIGEST_CACHE_MIN_AGE seconds
+ * old are not cached.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include "sudoers.h"
+#include "sudo_digest.h"
+
+#define DIGEST_CACHE_MAGIC	0x44435344	/* "DSCD" little endian */
+#define DIGEST_CACHE_VERSION	1
+#define DIGEST_CACHE_SLOTS	1024
+#define DIGEST_CACHE_MIN_AGE	2
+#define DIGEST_CACHE_MAX_LEN	64		/* SHA-512 */
+
+struct digest_cache_slot {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t ctime_sec;
+    int32_t mtime_nsec;
+    uint32_t digest_type;
+    uint32_t digest_len;
+    uint32_t pad;
+    unsigned char digest[DIGEST_CACHE_MAX_LEN];
+};
+
+/*
+ * Fill in the key fields of slot from sb and digest_type.
+ */
+static void
+digest_cache_fill_key(struct digest_cache_slot *slot, const struct stat *sb,
+    int digest_type)
+{
+    struct timespec mtime;
+
+    memset(slot, 0, sizeof(*slot));
+    mtim_get(sb, mtime);
+    slot->dev = sb->st_dev;
+    slot->ino = sb->st_ino;
+    slot->size = sb->st_size;
+    slot->mtime_sec = mtime.tv_sec;
+    slot->mtime_nsec = mtime.tv_nsec;
+    slot->ctime_sec = sb->st_ctime;
+    slot->digest_type = digest_type;
+}
+
+/*
+ * Return the offset of the slot for the given key.
+ */
+static off_t
+digest_cache_slot_offset(const struct digest_cache_slot *key)
+{
+    uint64_t h;
+
+    h = key->dev * 0x9e3779b97f4a7c15ULL;
+    h ^= key->ino + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    h ^= key->digest_type;
+    return SLOT_CACHE_HDR_LEN +
+	(off_t)(h % DIGEST_CACHE_SLOTS) * sizeof(struct digest_cache_slot);
+}
+
+/*
+ * Open and lock the digest cache, creating or resetting it as needed.
+ * Returns the file descriptor, or -1 if the cache is disabled or
+ * cannot be used securely.
+ */
+static int
+digest_cache_open(void)
+{
+    debug_decl(digest_cache_open, SUDOERS_DEBUG_MATCH);
+
+    if (def_digest_cache == NULL)
+	debug_return_int(-1);
+    debug_return_int(sudo_open_slot_cache(def_digest_cache,
+	DIGEST_CACHE_MAGIC, DIGEST_CACHE_VERSION, DIGEST_CACHE_SLOTS,
+	sizeof(struct digest_cache_slot)));
+}
+
+/*
+ * Look up the digest of the file described by sb in the cache.
+ * Returns the digest, which the caller must free, or NULL if not found.
+ * The length is stored in digest_len.
+ */
+unsigned char *
+digest_cache_lookup(const struct stat *sb, int digest_type,
+    size_t *digest_len)
+{
+    struct digest_cache_slot key, slot;
+    unsigned char *digest = NULL;
+    size_t len;
+    int fd;
+    debug_decl(digest_cache_lookup, SUDOERS_DEBUG_MATCH);
+
+    len = sudo_digest_getlen(digest_type);
+    if (len == (size_t)-1 || len > DIGEST_CACHE_MAX_LEN)
+	debug_return_ptr(NULL);
+    if ((fd = digest_cache_open()) == -1)
+	debug_return_ptr(NULL);
+
+    digest_cache_fill_key(&key, sb, digest_type);
+    if (pread(fd, &slot, sizeof(slot), digest_cache_slot_offset(&key)) !=
+	    sizeof(slot))
+	goto done;
+    if (slot.dev != key.dev || slot.ino != key.ino ||
+	    slot.size != key.size || slot.mtime_sec != key.mtime_sec ||
+	    slot.mtime_nsec != key.mtime_nsec ||
+	    slot.ctime_sec != key.ctime_sec ||
+	    slot.digest_type != key.digest_type || slot.digest_len != len)
+	goto done;
+
+    if ((digest = malloc(len)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    memcpy(digest, slot.digest, len);
+    *digest_len = len;
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"found %s digest for dev %lld, inode %lld in cache",
+	digest_type_to_name(digest_type), (long long)sb->st_dev,
+	(long long)sb->st_ino);
+
+done:
+    close(fd);
+    debug_return_ptr(digest);
+}
+
+/*
+ * Store the digest of the file described by sb in the cache.
+ * The sb must be from before the digest was computed.
+ */
+void
+digest_cache_store(const struct stat *sb, int digest_type,
+    const unsigned char *digest, size_t digest_len)
+{
+    struct digest_cache_slot slot;
+    int fd;
+    debug_decl(digest_cache_store, SUDOERS_DEBUG_MATCH);
+
+    if (!S_ISREG(sb->st_mode) || digest_len > DIGEST_CACHE_MAX_LEN)
+	debug_return;
+
+    /* Don't cache a file that may still be changing in this second. */
+    if (sb->st_ctime > time(NULL) - DIGEST_CACHE_MIN_AGE) {
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "not caching digest for recently changed dev %lld, inode %lld",
+	    (long long)sb->st_dev, (long long)sb->st_ino);
+	debug_return;
+    }
+
+    if ((fd = digest_cache_open()) == -1)
+	debug_return;
+    digest_cache_fill_key(&slot, sb, digest_type);
+    slot.digest_len = digest_len;
+    memcpy(slot.digest, digest, digest_len);
+    if (pwrite(fd, &slot, sizeof(slot), digest_cache_slot_offset(&slot)) !=
+	    sizeof(slot)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write to %s", def_digest_cache);
+    }
+    close(fd);
+
+    debug_return;
+}
@@ -23,8 +23,11 @@
 
 #include <config.h>
 
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "sudoers.h"
 #include "parse.h"
@@ -83,6 +86,59 @@ sudo_file_open(struct sudo_nss *nss)
     debug_return_int(nss->handle ? 0 : -1);
 }
 
+/*
+ * Load the compiled policy image for sudoers_file if there is one
+ * and none of the files it was compiled from have changed.
+ * The image must pass the same ownership and mode checks as sudoers.
+ * Returns true if the image was loaded, else false.
+ */
+static bool
+sudo_file_load_image(struct sudo_file_handle *handle)
+{
+    struct stat sb;
+    char *path;
+    bool ret = false;
+    int fd = -1;
+    debug_decl(sudo_file_load_image, SUDOERS_DEBUG_NSS);
+
+    if ((path = sudoers_image_path(sudoers_file)) == NULL)
+	debug_return_bool(false);
+    if (!set_perms(PERM_SUDOERS)) {
+	free(path);
+	debug_return_bool(false);
+    }
+    switch (sudo_secure_file(path, sudoers_uid, sudoers_gid, &sb)) {
+    case SUDO_PATH_SECURE:
+	fd = open(path, O_RDONLY|O_NONBLOCK);
+	if (fd == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+		"unable to open %s", path);
+	}
+	break;
+    case SUDO_PATH_MISSING:
+	break;
+    default:
+	sudo_debug_printf(SUDO_DEBUG_WARN, "ignoring insecure image %s", path);
+	break;
+    }
+    if (fd != -1) {
+	ret = sudoers_image_read(fd, sudoers_file, &handle->parse_tree);
+	close(fd);
+    }
+    if (!restore_perms()) {
+	/* unable to change back to root */
+	if (ret)
+	    free_parse_tree(&handle->parse_tree);
+	ret = false;
+    }
+    if (ret) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "using compiled sudoers image %s",
+	    path);
+    }
+    free(path);
+    debug_return_bool(ret);
+}
+
 /*
  * Parse and return the specified sudoers file.
  */
@@ -99,6 +155,10 @@ sudo_file_parse(struct sudo_nss *nss)
 	debug_return_ptr(NULL);
     }
 
+    /* Skip the parser entirely if there is a current compiled image. */
+    if (sudo_file_load_image(handle))
+	goto done;
+
     sudoersin = handle->fp;
     error = sudoersparse();
     if (error || parse_error) {
@@ -118,6 +178,12 @@ sudo_file_parse(struct sudo_nss *nss)
     /* Move parsed sudoers policy to nss handle. */
     reparent_parse_tree(&handle->parse_tree);
 
+done:
+    /* Index userspecs, commands and aliases, used as a speedup only. */
+    (void)userspec_index_build(&handle->parse_tree);
+    (void)cmnd_index_build(&handle->parse_tree);
+    (void)alias_index_build(&handle->parse_tree);
+
     debug_return_ptr(&handle->parse_tree);
 }
 
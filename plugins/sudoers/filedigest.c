@@ -23,6 +23,8 @@
 
 #include <config.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,15 +35,19 @@
 #include "sudoers.h"
 #include "sudo_digest.h"
 
+/* Read size when the file cannot be mapped. */
+#define FILEDIGEST_BUFSIZ	(256 * 1024)
+
 unsigned char *
 sudo_filedigest(int fd, const char *file, int digest_type, size_t *digest_len)
 {
     unsigned char *file_digest = NULL;
-    unsigned char buf[32 * 1024];
+    unsigned char *buf = NULL;
     struct sudo_digest *dig = NULL;
-    FILE *fp = NULL;
-    size_t nread;
-    int fd2;
+    void *map = MAP_FAILED;
+    struct stat sb;
+    ssize_t nread;
+    off_t off = 0;
     debug_decl(sudo_filedigest, SUDOERS_DEBUG_UTIL);
 
     *digest_len = sudo_digest_getlen(digest_type);
@@ -55,38 +61,58 @@ sudo_filedigest(int fd, const char *file, int digest_type, size_t *digest_len)
 	goto bad;
     }
 
-    if ((fd2 = dup(fd)) == -1) {
-	sudo_debug_printf(SUDO_DEBUG_INFO, "unable to dup %s: %s",
+    if (fstat(fd, &sb) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "unable to stat %s: %s",
 	    file, strerror(errno));
 	goto bad;
     }
-    if ((fp = fdopen(fd2, "r")) == NULL) {
-	sudo_debug_printf(SUDO_DEBUG_INFO, "unable to fdopen %s: %s",
-	    file, strerror(errno));
-	close(fd2);
-	goto bad;
-    }
     if ((file_digest = malloc(*digest_len)) == NULL) {
 	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
 	goto bad;
     }
 
-    while ((nread = fread(buf, 1, sizeof(buf), fp)) != 0) {
-	sudo_digest_update(dig, buf, nread);
+    /*
+     * Map the file instead of copying it if only root can modify it.
+     * A file truncated while it is mapped would raise SIGBUS.
+     */
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0 && sb.st_uid == ROOT_UID &&
+	    !ISSET(sb.st_mode, S_IWGRP|S_IWOTH) &&
+	    (off_t)(size_t)sb.st_size == sb.st_size) {
+	map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     }
-    if (ferror(fp)) {
-	sudo_warnx(U_("%s: read error"), file);
-	goto bad;
+    if (map != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+	(void)madvise(map, (size_t)sb.st_size, MADV_SEQUENTIAL);
+#endif
+	sudo_digest_update(dig, map, (size_t)sb.st_size);
+	munmap(map, (size_t)sb.st_size);
+    } else {
+	if ((buf = malloc(FILEDIGEST_BUFSIZ)) == NULL) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    goto bad;
+	}
+	for (;;) {
+	    nread = pread(fd, buf, FILEDIGEST_BUFSIZ, off);
+	    if (nread == -1) {
+		if (errno == EINTR)
+		    continue;
+		sudo_warnx(U_("%s: read error"), file);
+		goto bad;
+	    }
+	    if (nread == 0)
+		break;
+	    sudo_digest_update(dig, buf, nread);
+	    off += nread;
+	}
+	free(buf);
     }
     sudo_digest_final(dig, file_digest);
     sudo_digest_free(dig);
-    fclose(fp);
 
     debug_return_ptr(file_digest);
 bad:
     sudo_digest_free(dig);
     free(file_digest);
-    if (fp != NULL)
-	fclose(fp);
+    free(buf);
     debug_return_ptr(NULL);
 }
@@ -0,0 +1,290 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Cache of glob(3) expansions and directory listings used when matching
+ * sudoers commands.  The same pattern or directory is often referenced
+ * by many privileges; without the cache each reference rescans the file
+ * system.  Keys are the paths passed to glob(3) or opendir(3), which
+ * already include the runchroot, if any.  The cache is only valid for a
+ * single policy check and must be freed with glob_cache_free() when the
+ * check is complete.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_GLOB
+# include <glob.h>
+#else
+# include "compat/glob.h"
+#endif /* HAVE_GLOB */
+#include <dirent.h>
+
+#include "sudoers.h"
+#include "redblack.h"
+
+struct glob_cache_item {
+    char *key;			/* pattern or directory */
+    char **paths;		/* glob results or sorted directory entries */
+    size_t npaths;
+    glob_t gl;			/* for glob(3) results */
+    bool is_glob;
+};
+
+static struct rbtree *glob_cache, *dir_cache;
+
+/* Last glob result that could not be cached, freed on the next call. */
+static struct glob_cache_item *glob_uncached;
+
+static int
+glob_cache_compare(const void *v1, const void *v2)
+{
+    const struct glob_cache_item *item1 = v1;
+    const struct glob_cache_item *item2 = v2;
+
+    return strcmp(item1->key, item2->key);
+}
+
+static int
+glob_cache_name_compare(const void *v1, const void *v2)
+{
+    return strcmp(*(char * const *)v1, *(char * const *)v2);
+}
+
+static void
+glob_cache_item_free(void *v)
+{
+    struct glob_cache_item *item = v;
+    size_t i;
+
+    if (item->is_glob) {
+	globfree(&item->gl);
+    } else {
+	for (i = 0; i < item->npaths; i++)
+	    free(item->paths[i]);
+	free(item->paths);
+    }
+    free(item->key);
+    free(item);
+}
+
+/*
+ * Find key in the specified cache, creating the cache as needed.
+ * Returns the cached item, or NULL if not found or on error.
+ */
+static struct glob_cache_item *
+glob_cache_find(struct rbtree **cachep, const char *key)
+{
+    struct glob_cache_item ikey;
+    struct rbnode *node;
+    debug_decl(glob_cache_find, SUDOERS_DEBUG_MATCH);
+
+    if (*cachep == NULL) {
+	if ((*cachep = rbcreate(glob_cache_compare)) == NULL)
+	    debug_return_ptr(NULL);
+    }
+    ikey.key = (char *)key;
+    if ((node = rbfind(*cachep, &ikey)) == NULL)
+	debug_return_ptr(NULL);
+    debug_return_ptr(node->data);
+}
+
+/*
+ * Insert item into the cache.  On failure, the caller still owns
+ * item and must use it as an uncached result.
+ */
+static bool
+glob_cache_insert(struct rbtree *cache, struct glob_cache_item *item)
+{
+    debug_decl(glob_cache_insert, SUDOERS_DEBUG_MATCH);
+
+    if (cache == NULL || rbinsert(cache, item, NULL) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_WARN, "%s: unable to cache", item->key);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Expand pattern using glob(3) with GLOB_NOSORT, caching the result.
+ * Returns the matching paths, with the count stored in npaths, or
+ * NULL on error.  A pattern with no matches has npaths set to 0.
+ * A result that could not be cached is only valid until the next call.
+ */
+char * const *
+glob_cache_glob(const char *pattern, size_t *npaths)
+{
+    struct glob_cache_item *item;
+    int rc;
+    debug_decl(glob_cache_glob, SUDOERS_DEBUG_MATCH);
+
+    if (glob_uncached != NULL) {
+	glob_cache_item_free(glob_uncached);
+	glob_uncached = NULL;
+    }
+    if ((item = glob_cache_find(&glob_cache, pattern)) != NULL) {
+	sudo_debug_printf(SUDO_DEBUG_DEBUG, "%s: cached, %zu paths",
+	    pattern, item->npaths);
+	goto done;
+    }
+
+    if ((item = calloc(1, sizeof(*item))) == NULL)
+	goto oom;
+    if ((item->key = strdup(pattern)) == NULL) {
+	free(item);
+	goto oom;
+    }
+    item->is_glob = true;
+    rc = glob(pattern, GLOB_NOSORT, NULL, &item->gl);
+    switch (rc) {
+	case 0:
+	    item->paths = item->gl.gl_pathv;
+	    item->npaths = item->gl.gl_pathc;
+	    break;
+	case GLOB_NOMATCH:
+	    break;
+	default:
+	    /* Do not cache errors. */
+	    sudo_debug_printf(SUDO_DEBUG_WARN, "%s: glob error %d",
+		pattern, rc);
+	    glob_cache_item_free(item);
+	    debug_return_ptr(NULL);
+    }
+    if (!glob_cache_insert(glob_cache, item)) {
+	/* The caller needs the result until the next call. */
+	glob_uncached = item;
+    }
+
+done:
+    *npaths = item->npaths;
+    debug_return_ptr(item->paths);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Read the entries in directory dir, sorted, into a new cache item.
+ * A directory that cannot be read has no entries.
+ */
+static struct glob_cache_item *
+glob_cache_read_dir(const char *dir)
+{
+    struct glob_cache_item *item;
+    struct dirent *dent;
+    size_t paths_size = 0;
+    DIR *dirp;
+    debug_decl(glob_cache_read_dir, SUDOERS_DEBUG_MATCH);
+
+    if ((item = calloc(1, sizeof(*item))) == NULL)
+	debug_return_ptr(NULL);
+    if ((item->key = strdup(dir)) == NULL) {
+	free(item);
+	debug_return_ptr(NULL);
+    }
+
+    if ((dirp = opendir(dir)) == NULL)
+	debug_return_ptr(item);
+    while ((dent = readdir(dirp)) != NULL) {
+	if (item->npaths == paths_size) {
+	    size_t new_size = paths_size ? paths_size * 2 : 64;
+	    char **paths = reallocarray(item->paths, new_size, sizeof(char *));
+	    if (paths == NULL)
+		goto bad;
+	    item->paths = paths;
+	    paths_size = new_size;
+	}
+	if ((item->paths[item->npaths] = strdup(dent->d_name)) == NULL)
+	    goto bad;
+	item->npaths++;
+    }
+    closedir(dirp);
+    if (item->npaths > 1)
+	qsort(item->paths, item->npaths, sizeof(char *), glob_cache_name_compare);
+
+    debug_return_ptr(item);
+bad:
+    closedir(dirp);
+    glob_cache_item_free(item);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Check whether directory dir contains an entry called name, caching
+ * the directory contents.
+ * Returns true if found, false if not or -1 on error.
+ */
+int
+glob_cache_dir_contains(const char *dir, const char *name)
+{
+    struct glob_cache_item *item;
+    int ret;
+    debug_decl(glob_cache_dir_contains, SUDOERS_DEBUG_MATCH);
+
+    if ((item = glob_cache_find(&dir_cache, dir)) == NULL) {
+	if ((item = glob_cache_read_dir(dir)) == NULL)
+	    goto oom;
+	sudo_debug_printf(SUDO_DEBUG_DEBUG, "%s: read %zu entries",
+	    dir, item->npaths);
+	if (!glob_cache_insert(dir_cache, item)) {
+	    /* Use the entries just read without caching them. */
+	    ret = bsearch(&name, item->paths, item->npaths, sizeof(char *),
+		glob_cache_name_compare) != NULL;
+	    glob_cache_item_free(item);
+	    debug_return_int(ret);
+	}
+    }
+    ret = bsearch(&name, item->paths, item->npaths, sizeof(char *),
+	glob_cache_name_compare) != NULL;
+    debug_return_int(ret);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    debug_return_int(-1);
+}
+
+/*
+ * Free the cached glob results and directory entries.
+ */
+void
+glob_cache_free(void)
+{
+    debug_decl(glob_cache_free, SUDOERS_DEBUG_MATCH);
+
+    if (glob_cache != NULL) {
+	rbdestroy(glob_cache, glob_cache_item_free);
+	glob_cache = NULL;
+    }
+    if (dir_cache != NULL) {
+	rbdestroy(dir_cache, glob_cache_item_free);
+	dir_cache = NULL;
+    }
+    if (glob_uncached != NULL) {
+	glob_cache_item_free(glob_uncached);
+	glob_uncached = NULL;
+    }
+
+    debug_return;
+}
@@ -1487,6 +1487,9 @@ init_parse_tree(struct sudoers_parse_tree *parse_tree, const char *lhost,
     TAILQ_INIT(&parse_tree->userspecs);
     TAILQ_INIT(&parse_tree->defaults);
     parse_tree->aliases = NULL;
+    parse_tree->uindex = NULL;
+    parse_tree->cindex = NULL;
+    parse_tree->aindex = NULL;
     parse_tree->shost = shost;
     parse_tree->lhost = lhost;
 }
@@ -1501,6 +1504,12 @@ reparent_parse_tree(struct sudoers_parse_tree *new_tree)
     TAILQ_CONCAT(&new_tree->defaults, &parsed_policy.defaults, entries);
     new_tree->aliases = parsed_policy.aliases;
     parsed_policy.aliases = NULL;
+    userspec_index_free(new_tree->uindex);
+    new_tree->uindex = NULL;
+    cmnd_index_free(new_tree->cindex);
+    new_tree->cindex = NULL;
+    alias_index_free(new_tree->aindex);
+    new_tree->aindex = NULL;
 }
 
 /*
@@ -1513,6 +1522,12 @@ free_parse_tree(struct sudoers_parse_tree *parse_tree)
     free_defaults(&parse_tree->defaults);
     free_aliases(parse_tree->aliases);
     parse_tree->aliases = NULL;
+    userspec_index_free(parse_tree->uindex);
+    parse_tree->uindex = NULL;
+    cmnd_index_free(parse_tree->cindex);
+    parse_tree->cindex = NULL;
+    alias_index_free(parse_tree->aindex);
+    parse_tree->aindex = NULL;
 }
 
 /*
@@ -0,0 +1,1445 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * A compiled sudoers policy image is a flattened copy of a parsed
+ * sudoers file and everything it includes.  Loading an image avoids
+ * running the lexer and parser at all.
+ *
+ * All references inside the image are 32-bit offsets from the start
+ * of the file, so it can be mapped at any address without relocation.
+ * Offset 0 (the header) doubles as the NULL pointer.  Records are
+ * 8-byte aligned; strings are stored once, NUL-terminated and unaligned.
+ *
+ * The image also records the device, inode, size and timestamps of
+ * every file and include directory that was read to produce it.
+ * An image is only used if all of its sources are unchanged.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+
+#include "sudoers.h"
+#include "redblack.h"
+#include <gram.h>
+
+#define IMAGE_MAGIC		"SUDOIMG"
+#define IMAGE_BYTEORDER		0x01020304
+#define IMAGE_ALIGN		8
+
+struct image_header {
+    char magic[8];		/* IMAGE_MAGIC */
+    char version[32];		/* PACKAGE_VERSION of the writer */
+    uint32_t byteorder;		/* IMAGE_BYTEORDER in writer byte order */
+    uint32_t size;		/* total size of the image */
+    uint32_t sources;		/* array of struct image_source */
+    uint32_t host;		/* short host name used for %h, if any */
+    uint32_t userspecs;		/* array of struct image_userspec */
+    uint32_t defaults;		/* array of struct image_defaults */
+    uint32_t aliases;		/* array of struct image_alias */
+    uint32_t pad;
+};
+
+/*
+ * An array is a uint32_t count followed by count offsets.
+ */
+
+struct image_source {
+    int64_t dev;
+    int64_t ino;
+    int64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t ctime;
+    uint32_t path;
+    uint32_t mode;		/* file type bits, 0 if missing */
+};
+
+struct image_member {
+    uint32_t name;		/* string, or image_command for commands */
+    int16_t type;
+    int16_t negated;
+};
+
+struct image_command {
+    uint32_t cmnd;
+    uint32_t args;
+    uint32_t digests;		/* array of struct image_digest */
+    uint32_t pad;
+};
+
+struct image_digest {
+    uint32_t type;
+    uint32_t str;
+};
+
+struct image_userspec {
+    uint32_t users;		/* array of struct image_member */
+    uint32_t privileges;	/* array of struct image_privilege */
+    uint32_t file;
+    int32_t line;
+    int32_t column;
+    uint32_t pad;
+};
+
+struct image_privilege {
+    uint32_t ldap_role;
+    uint32_t hostlist;		/* array of struct image_member */
+    uint32_t cmndlist;		/* array of struct image_cmndspec */
+    uint32_t defaults;		/* array of struct image_defaults */
+};
+
+struct image_cmndspec {
+    int64_t notbefore;
+    int64_t notafter;
+    uint32_t runasuserlist;	/* array of struct image_member */
+    uint32_t runasgrouplist;	/* array of struct image_member */
+    uint32_t cmnd;		/* struct image_member */
+    int32_t timeout;
+    uint32_t runcwd;
+    uint32_t runchroot;
+    uint32_t role;
+    uint32_t type;
+    uint32_t privs;
+    uint32_t limitprivs;
+    int8_t tags[8];		/* nopasswd, noexec, setenv, log_input,
+				   log_output, send_mail, follow */
+};
+
+struct image_defaults {
+    uint32_t var;
+    uint32_t val;
+    uint32_t binding;		/* array of struct image_member */
+    uint32_t file;
+    int32_t line;
+    int32_t column;
+    int16_t type;
+    int8_t op;
+    int8_t error;
+    uint32_t pad;
+};
+
+struct image_alias {
+    uint32_t name;
+    uint32_t members;		/* array of struct image_member */
+    uint32_t file;
+    int32_t line;
+    int32_t column;
+    uint16_t type;
+    uint16_t pad;
+};
+
+/*
+ * Files and directories read by the parser since init_lexer().
+ */
+struct image_src {
+    STAILQ_ENTRY(image_src) entries;
+    char *path;
+    struct stat sb;
+    bool missing;
+};
+STAILQ_HEAD(image_src_list, image_src);
+
+static struct image_src_list image_sources =
+    STAILQ_HEAD_INITIALIZER(image_sources);
+static char *image_host;
+static bool image_sources_incomplete;
+
+/*
+ * Forget the sources of the previous parse.
+ */
+void
+sudoers_image_reset(void)
+{
+    struct image_src *src;
+    debug_decl(sudoers_image_reset, SUDOERS_DEBUG_PARSER);
+
+    while ((src = STAILQ_FIRST(&image_sources)) != NULL) {
+	STAILQ_REMOVE_HEAD(&image_sources, entries);
+	free(src->path);
+	free(src);
+    }
+    free(image_host);
+    image_host = NULL;
+    image_sources_incomplete = false;
+
+    debug_return;
+}
+
+/*
+ * Record a file or directory read by the parser.
+ * If sb is NULL, the path did not exist.
+ */
+bool
+sudoers_image_add_source(const char *path, const struct stat *sb)
+{
+    struct image_src *src;
+    debug_decl(sudoers_image_add_source, SUDOERS_DEBUG_PARSER);
+
+    if ((src = calloc(1, sizeof(*src))) == NULL)
+	goto oom;
+    if ((src->path = strdup(path)) == NULL) {
+	free(src);
+	goto oom;
+    }
+    if (sb != NULL)
+	src->sb = *sb;
+    else
+	src->missing = true;
+    STAILQ_INSERT_TAIL(&image_sources, src, entries);
+    debug_return_bool(true);
+oom:
+    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	"unable to allocate memory");
+    image_sources_incomplete = true;
+    debug_return_bool(false);
+}
+
+/*
+ * Record the short host name substituted for a %h escape in an include.
+ */
+bool
+sudoers_image_set_host(const char *shost)
+{
+    debug_decl(sudoers_image_set_host, SUDOERS_DEBUG_PARSER);
+
+    if (image_host == NULL) {
+	if ((image_host = strdup(shost)) == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to allocate memory");
+	    image_sources_incomplete = true;
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Returns the path of the image that corresponds to the given sudoers file.
+ * The caller is responsible for freeing the returned string.
+ */
+char *
+sudoers_image_path(const char *sudoers_path)
+{
+    char *path;
+    debug_decl(sudoers_image_path, SUDOERS_DEBUG_PARSER);
+
+    if (asprintf(&path, "%s%s", sudoers_path, SUDOERS_IMAGE_SUFFIX) == -1)
+	path = NULL;
+    debug_return_str(path);
+}
+
+/*
+ * Image writer.
+ */
+struct image_writer {
+    unsigned char *buf;
+    size_t len;
+    size_t size;
+    uint32_t *strtab;		/* hash table of string offsets */
+    size_t strtab_size;
+    size_t strtab_used;
+    bool error;
+};
+
+#define IMAGE_REC(w, off, type)	((type *)((w)->buf + (off)))
+#define IMAGE_ARRAY_SET(w, arr, idx, val) do {				\
+    if (!(w)->error)							\
+	IMAGE_REC(w, arr, uint32_t)[(idx) + 1] = (val);			\
+} while (0)
+
+/*
+ * Allocate len zeroed bytes in the image with the specified alignment.
+ * Returns the offset of the new space or 0 on error.
+ */
+static uint32_t
+image_alloc(struct image_writer *w, size_t len, size_t align)
+{
+    size_t off;
+    debug_decl(image_alloc, SUDOERS_DEBUG_PARSER);
+
+    if (w->error)
+	debug_return_int(0);
+
+    off = (w->len + align - 1) & ~(align - 1);
+    if (off + len > UINT32_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "image too large");
+	w->error = true;
+	debug_return_int(0);
+    }
+    if (off + len > w->size) {
+	size_t newsize = w->size ? w->size : 64 * 1024;
+	unsigned char *newbuf;
+
+	while (newsize < off + len)
+	    newsize *= 2;
+	if ((newbuf = realloc(w->buf, newsize)) == NULL) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to allocate memory");
+	    w->error = true;
+	    debug_return_int(0);
+	}
+	w->buf = newbuf;
+	w->size = newsize;
+    }
+    memset(w->buf + w->len, 0, off + len - w->len);
+    w->len = off + len;
+
+    debug_return_int((uint32_t)off);
+}
+
+static uint32_t
+image_new_array(struct image_writer *w, size_t count)
+{
+    uint32_t arr;
+
+    arr = image_alloc(w, (count + 1) * sizeof(uint32_t), IMAGE_ALIGN);
+    if (arr != 0)
+	IMAGE_REC(w, arr, uint32_t)[0] = (uint32_t)count;
+    return arr;
+}
+
+/* FNV-1a hash of a string. */
+static size_t
+image_hash(const char *str)
+{
+    size_t h = 2166136261U;
+
+    while (*str != '\0') {
+	h ^= (unsigned char)*str++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+/*
+ * Grow the string table, rehashing the existing entries.
+ */
+static bool
+image_strtab_grow(struct image_writer *w)
+{
+    size_t i, h, newsize = w->strtab_size ? w->strtab_size * 2 : 4096;
+    uint32_t *newtab;
+
+    if ((newtab = calloc(newsize, sizeof(uint32_t))) == NULL) {
+	w->error = true;
+	return false;
+    }
+    for (i = 0; i < w->strtab_size; i++) {
+	if (w->strtab[i] == 0)
+	    continue;
+	h = image_hash((char *)w->buf + w->strtab[i]) & (newsize - 1);
+	while (newtab[h] != 0)
+	    h = (h + 1) & (newsize - 1);
+	newtab[h] = w->strtab[i];
+    }
+    free(w->strtab);
+    w->strtab = newtab;
+    w->strtab_size = newsize;
+    return true;
+}
+
+/*
+ * Store a string in the image.  Identical strings are only stored once.
+ */
+static uint32_t
+image_write_string(struct image_writer *w, const char *str)
+{
+    size_t h, len;
+    uint32_t off;
+
+    if (str == NULL || w->error)
+	return 0;
+    if (w->strtab_used * 2 >= w->strtab_size) {
+	if (!image_strtab_grow(w))
+	    return 0;
+    }
+    h = image_hash(str) & (w->strtab_size - 1);
+    while (w->strtab[h] != 0) {
+	if (strcmp((char *)w->buf + w->strtab[h], str) == 0)
+	    return w->strtab[h];
+	h = (h + 1) & (w->strtab_size - 1);
+    }
+
+    len = strlen(str) + 1;
+    if ((off = image_alloc(w, len, 1)) != 0) {
+	memcpy(w->buf + off, str, len);
+	w->strtab[h] = off;
+	w->strtab_used++;
+    }
+    return off;
+}
+
+static uint32_t
+image_write_command(struct image_writer *w, struct sudo_command *c)
+{
+    struct command_digest *digest;
+    uint32_t off, arr, str;
+    size_t count = 0;
+
+    TAILQ_FOREACH(digest, &c->digests, entries)
+	count++;
+    arr = image_new_array(w, count);
+    count = 0;
+    TAILQ_FOREACH(digest, &c->digests, entries) {
+	str = image_write_string(w, digest->digest_str);
+	if ((off = image_alloc(w, sizeof(struct image_digest), IMAGE_ALIGN)) == 0)
+	    return 0;
+	IMAGE_REC(w, off, struct image_digest)->type = digest->digest_type;
+	IMAGE_REC(w, off, struct image_digest)->str = str;
+	IMAGE_ARRAY_SET(w, arr, count, off);
+	count++;
+    }
+
+    if ((off = image_alloc(w, sizeof(struct image_command), IMAGE_ALIGN)) == 0)
+	return 0;
+    IMAGE_REC(w, off, struct image_command)->digests = arr;
+    str = image_write_string(w, c->cmnd);
+    IMAGE_REC(w, off, struct image_command)->cmnd = str;
+    str = image_write_string(w, c->args);
+    IMAGE_REC(w, off, struct image_command)->args = str;
+    return off;
+}
+
+static uint32_t
+image_write_member(struct image_writer *w, struct member *m)
+{
+    uint32_t off, name;
+
+    if (m->type == COMMAND || (m->type == ALL && m->name != NULL))
+	name = image_write_command(w, (struct sudo_command *)m->name);
+    else
+	name = image_write_string(w, m->name);
+
+    if ((off = image_alloc(w, sizeof(struct image_member), IMAGE_ALIGN)) == 0)
+	return 0;
+    IMAGE_REC(w, off, struct image_member)->name = name;
+    IMAGE_REC(w, off, struct image_member)->type = m->type;
+    IMAGE_REC(w, off, struct image_member)->negated = m->negated;
+    return off;
+}
+
+static uint32_t
+image_write_members(struct image_writer *w, struct member_list *members)
+{
+    struct member *m;
+    uint32_t arr, off;
+    size_t count = 0;
+
+    if (members == NULL)
+	return 0;
+
+    TAILQ_FOREACH(m, members, entries)
+	count++;
+    arr = image_new_array(w, count);
+    count = 0;
+    TAILQ_FOREACH(m, members, entries) {
+	if ((off = image_write_member(w, m)) == 0)
+	    return 0;
+	IMAGE_ARRAY_SET(w, arr, count, off);
+	count++;
+    }
+    return arr;
+}
+
+static uint32_t
+image_write_defaults(struct image_writer *w, struct defaults_list *defs)
+{
+    struct member_list *prev_binding = NULL;
+    struct defaults *def;
+    uint32_t arr, off, str, binding = 0;
+    size_t count = 0;
+
+    TAILQ_FOREACH(def, defs, entries)
+	count++;
+    arr = image_new_array(w, count);
+    count = 0;
+    TAILQ_FOREACH(def, defs, entries) {
+	/* Consecutive entries may share the same binding. */
+	if (def->binding != prev_binding || count == 0) {
+	    prev_binding = def->binding;
+	    binding = image_write_members(w, def->binding);
+	}
+	if ((off = image_alloc(w, sizeof(struct image_defaults), IMAGE_ALIGN)) == 0)
+	    return 0;
+	IMAGE_REC(w, off, struct image_defaults)->binding = binding;
+	str = image_write_string(w, def->var);
+	IMAGE_REC(w, off, struct image_defaults)->var = str;
+	str = image_write_string(w, def->val);
+	IMAGE_REC(w, off, struct image_defaults)->val = str;
+	str = image_write_string(w, def->file);
+	IMAGE_REC(w, off, struct image_defaults)->file = str;
+	IMAGE_REC(w, off, struct image_defaults)->line = def->line;
+	IMAGE_REC(w, off, struct image_defaults)->column = def->column;
+	IMAGE_REC(w, off, struct image_defaults)->type = def->type;
+	IMAGE_REC(w, off, struct image_defaults)->op = def->op;
+	IMAGE_REC(w, off, struct image_defaults)->error = def->error;
+	IMAGE_ARRAY_SET(w, arr, count, off);
+	count++;
+    }
+    return arr;
+}
+
+/*
+ * Write a string that consecutive cmndspecs may share.
+ */
+static uint32_t
+image_write_shared(struct image_writer *w, char *str, char **prev,
+    uint32_t *prev_off)
+{
+    if (str != *prev) {
+	*prev = str;
+	*prev_off = image_write_string(w, str);
+    }
+    return *prev_off;
+}
+
+static uint32_t
+image_write_privilege(struct image_writer *w, struct privilege *priv)
+{
+    struct member_list *runasuserlist = NULL, *runasgrouplist = NULL;
+    char *runcwd = NULL, *runchroot = NULL;
+    uint32_t runcwd_off = 0, runchroot_off = 0;
+    uint32_t runasuser_off = 0, runasgroup_off = 0;
+#ifdef HAVE_SELINUX
+    char *role = NULL, *type = NULL;
+    uint32_t role_off = 0, type_off = 0;
+#endif
+#ifdef HAVE_PRIV_SET
+    char *privs = NULL, *limitprivs = NULL;
+    uint32_t privs_off = 0, limitprivs_off = 0;
+#endif
+    struct image_cmndspec *ics;
+    struct cmndspec *cs;
+    uint32_t arr, off, cmnd, tmp;
+    size_t count = 0;
+
+    TAILQ_FOREACH(cs, &priv->cmndlist, entries)
+	count++;
+    arr = image_new_array(w, count);
+    count = 0;
+    TAILQ_FOREACH(cs, &priv->cmndlist, entries) {
+	/* Runas lists are shared by consecutive entries. */
+	if (cs->runasuserlist != runasuserlist) {
+	    runasuserlist = cs->runasuserlist;
+	    runasuser_off = image_write_members(w, runasuserlist);
+	}
+	if (cs->runasgrouplist != runasgrouplist) {
+	    runasgrouplist = cs->runasgrouplist;
+	    runasgroup_off = image_write_members(w, runasgrouplist);
+	}
+	if ((cmnd = image_write_member(w, cs->cmnd)) == 0)
+	    return 0;
+	if ((off = image_alloc(w, sizeof(*ics), IMAGE_ALIGN)) == 0)
+	    return 0;
+	IMAGE_REC(w, off, struct image_cmndspec)->runasuserlist = runasuser_off;
+	IMAGE_REC(w, off, struct image_cmndspec)->runasgrouplist = runasgroup_off;
+	IMAGE_REC(w, off, struct image_cmndspec)->cmnd = cmnd;
+	tmp = image_write_shared(w, cs->runcwd, &runcwd, &runcwd_off);
+	IMAGE_REC(w, off, struct image_cmndspec)->runcwd = tmp;
+	tmp = image_write_shared(w, cs->runchroot, &runchroot, &runchroot_off);
+	IMAGE_REC(w, off, struct image_cmndspec)->runchroot = tmp;
+#ifdef HAVE_SELINUX
+	tmp = image_write_shared(w, cs->role, &role, &role_off);
+	IMAGE_REC(w, off, struct image_cmndspec)->role = tmp;
+	tmp = image_write_shared(w, cs->type, &type, &type_off);
+	IMAGE_REC(w, off, struct image_cmndspec)->type = tmp;
+#endif
+#ifdef HAVE_PRIV_SET
+	tmp = image_write_shared(w, cs->privs, &privs, &privs_off);
+	IMAGE_REC(w, off, struct image_cmndspec)->privs = tmp;
+	tmp = image_write_shared(w, cs->limitprivs, &limitprivs,
+	    &limitprivs_off);
+	IMAGE_REC(w, off, struct image_cmndspec)->limitprivs = tmp;
+#endif
+	if (w->error)
+	    return 0;
+	ics = IMAGE_REC(w, off, struct image_cmndspec);
+	ics->notbefore = cs->notbefore;
+	ics->notafter = cs->notafter;
+	ics->timeout = cs->timeout;
+	ics->tags[0] = cs->tags.nopasswd;
+	ics->tags[1] = cs->tags.noexec;
+	ics->tags[2] = cs->tags.setenv;
+	ics->tags[3] = cs->tags.log_input;
+	ics->tags[4] = cs->tags.log_output;
+	ics->tags[5] = cs->tags.send_mail;
+	ics->tags[6] = cs->tags.follow;
+	IMAGE_ARRAY_SET(w, arr, count, off);
+	count++;
+    }
+
+    if ((off = image_alloc(w, sizeof(struct image_privilege), IMAGE_ALIGN)) == 0)
+	return 0;
+    IMAGE_REC(w, off, struct image_privilege)->cmndlist = arr;
+    tmp = image_write_string(w, priv->ldap_role);
+    IMAGE_REC(w, off, struct image_privilege)->ldap_role = tmp;
+    tmp = image_write_members(w, &priv->hostlist);
+    IMAGE_REC(w, off, struct image_privilege)->hostlist = tmp;
+    tmp = image_write_defaults(w, &priv->defaults);
+    IMAGE_REC(w, off, struct image_privilege)->defaults = tmp;
+    return off;
+}
+
+static uint32_t
+image_write_userspecs(struct image_writer *w, struct userspec_list *usl)
+{
+    struct privilege *priv;
+    struct userspec *us;
+    uint32_t arr, privs, off, tmp;
+    size_t count = 0, npriv;
+
+    TAILQ_FOREACH(us, usl, entries)
+	count++;
+    arr = image_new_array(w, count);
+    count = 0;
+    TAILQ_FOREACH(us, usl, entries) {
+	npriv = 0;
+	TAILQ_FOREACH(priv, &us->privileges, entries)
+	    npriv++;
+	privs = image_new_array(w, npriv);
+	npriv = 0;
+	TAILQ_FOREACH(priv, &us->privileges, entries) {
+	    if ((off = image_write_privilege(w, priv)) == 0)
+		return 0;
+	    IMAGE_ARRAY_SET(w, privs, npriv, off);
+	    npriv++;
+	}
+	if ((off = image_alloc(w, sizeof(struct image_userspec), IMAGE_ALIGN)) == 0)
+	    return 0;
+	IMAGE_REC(w, off, struct image_userspec)->privileges = privs;
+	tmp = image_write_members(w, &us->users);
+	IMAGE_REC(w, off, struct image_userspec)->users = tmp;
+	tmp = image_write_string(w, us->file);
+	IMAGE_REC(w, off, struct image_userspec)->file = tmp;
+	IMAGE_REC(w, off, struct image_userspec)->line = us->line;
+	IMAGE_REC(w, off, struct image_userspec)->column = us->column;
+	IMAGE_ARRAY_SET(w, arr, count, off);
+	count++;
+    }
+    return arr;
+}
+
+struct image_alias_closure {
+    struct image_writer *w;
+    uint32_t *offsets;
+    size_t count;
+    size_t size;
+};
+
+static int
+image_write_alias(struct sudoers_parse_tree *parse_tree, struct alias *a,
+    void *v)
+{
+    struct image_alias_closure *closure = v;
+    struct image_writer *w = closure->w;
+    uint32_t off, tmp;
+
+    if (closure->count == closure->size) {
+	size_t newsize = closure->size ? closure->size * 2 : 64;
+	uint32_t *tmp_offsets;
+
+	tmp_offsets = reallocarray(closure->offsets, newsize, sizeof(uint32_t));
+	if (tmp_offsets == NULL) {
+	    w->error = true;
+	    return -1;
+	}
+	closure->offsets = tmp_offsets;
+	closure->size = newsize;
+    }
+
+    if ((off = image_alloc(w, sizeof(struct image_alias), IMAGE_ALIGN)) == 0)
+	return -1;
+    tmp = image_write_string(w, a->name);
+    IMAGE_REC(w, off, struct image_alias)->name = tmp;
+    tmp = image_write_members(w, &a->members);
+    IMAGE_REC(w, off, struct image_alias)->members = tmp;
+    tmp = image_write_string(w, a->file);
+    IMAGE_REC(w, off, struct image_alias)->file = tmp;
+    IMAGE_REC(w, off, struct image_alias)->line = a->line;
+    IMAGE_REC(w, off, struct image_alias)->column = a->column;
+    IMAGE_REC(w, off, struct image_alias)->type = a->type;
+    closure->offsets[closure->count++] = off;
+    return w->error ? -1 : 0;
+}
+
+static uint32_t
+image_write_aliases(struct image_writer *w,
+    struct sudoers_parse_tree *parse_tree)
+{
+    struct image_alias_closure closure = { w };
+    uint32_t arr;
+    size_t i;
+
+    if (parse_tree->aliases != NULL)
+	alias_apply(parse_tree, image_write_alias, &closure);
+    arr = image_new_array(w, closure.count);
+    if (arr != 0) {
+	for (i = 0; i < closure.count; i++)
+	    IMAGE_ARRAY_SET(w, arr, i, closure.offsets[i]);
+    }
+    free(closure.offsets);
+    return arr;
+}
+
+static uint32_t
+image_write_sources(struct image_writer *w)
+{
+    struct image_source *isrc;
+    struct image_src *src;
+    struct timespec ts;
+    uint32_t arr, off, path;
+    size_t count = 0;
+
+    STAILQ_FOREACH(src, &image_sources, entries)
+	count++;
+    arr = image_new_array(w, count);
+    count = 0;
+    STAILQ_FOREACH(src, &image_sources, entries) {
+	path = image_write_string(w, src->path);
+	if ((off = image_alloc(w, sizeof(*isrc), IMAGE_ALIGN)) == 0)
+	    return 0;
+	isrc = IMAGE_REC(w, off, struct image_source);
+	isrc->path = path;
+	if (!src->missing) {
+	    mtim_get(&src->sb, ts);
+	    isrc->dev = src->sb.st_dev;
+	    isrc->ino = src->sb.st_ino;
+	    isrc->size = src->sb.st_size;
+	    isrc->mtime_sec = ts.tv_sec;
+	    isrc->mtime_nsec = ts.tv_nsec;
+	    isrc->ctime = src->sb.st_ctime;
+	    isrc->mode = src->sb.st_mode & S_IFMT;
+	}
+	IMAGE_ARRAY_SET(w, arr, count, off);
+	count++;
+    }
+    return arr;
+}
+
+/*
+ * Write the parse tree along with the sources recorded by the most
+ * recent parse to a new image at path.  The image is written to a
+ * temporary file that is renamed into place when complete.
+ * If uid or gid is not -1, the image is chowned accordingly.
+ * Returns true on success, else false.
+ */
+bool
+sudoers_image_write(struct sudoers_parse_tree *parse_tree, const char *path,
+    uid_t uid, gid_t gid, mode_t mode)
+{
+    struct image_writer w = { NULL };
+    struct image_header *hdr;
+    uint32_t tmp, hdr_off;
+    char *tpath = NULL;
+    bool ret = false;
+    int fd = -1;
+    debug_decl(sudoers_image_write, SUDOERS_DEBUG_PARSER);
+
+    if (STAILQ_EMPTY(&image_sources) || image_sources_incomplete) {
+	sudo_warnx(U_("%s: unable to determine sudoers sources"), path);
+	debug_return_bool(false);
+    }
+
+    hdr_off = image_alloc(&w, sizeof(*hdr), IMAGE_ALIGN);
+    tmp = image_write_sources(&w);
+    if (!w.error)
+	IMAGE_REC(&w, hdr_off, struct image_header)->sources = tmp;
+    tmp = image_write_string(&w, image_host);
+    if (!w.error)
+	IMAGE_REC(&w, hdr_off, struct image_header)->host = tmp;
+    tmp = image_write_userspecs(&w, &parse_tree->userspecs);
+    if (!w.error)
+	IMAGE_REC(&w, hdr_off, struct image_header)->userspecs = tmp;
+    tmp = image_write_defaults(&w, &parse_tree->defaults);
+    if (!w.error)
+	IMAGE_REC(&w, hdr_off, struct image_header)->defaults = tmp;
+    tmp = image_write_aliases(&w, parse_tree);
+    if (!w.error)
+	IMAGE_REC(&w, hdr_off, struct image_header)->aliases = tmp;
+    if (w.error) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    hdr = IMAGE_REC(&w, hdr_off, struct image_header);
+    memcpy(hdr->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    strlcpy(hdr->version, PACKAGE_VERSION, sizeof(hdr->version));
+    hdr->byteorder = IMAGE_BYTEORDER;
+    hdr->size = (uint32_t)w.len;
+
+    if (asprintf(&tpath, "%s.XXXXXX", path) == -1) {
+	tpath = NULL;
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    if ((fd = mkstemp(tpath)) == -1) {
+	sudo_warn(U_("unable to create %s"), tpath);
+	goto done;
+    }
+    if (uid != (uid_t)-1 || gid != (gid_t)-1) {
+	if (fchown(fd, uid, gid) == -1) {
+	    sudo_warn(U_("unable to set (uid, gid) of %s to (%u, %u)"),
+		tpath, (unsigned int)uid, (unsigned int)gid);
+	    goto done;
+	}
+    }
+    if (fchmod(fd, mode) == -1) {
+	sudo_warn(U_("unable to change mode of %s to 0%o"), tpath,
+	    (unsigned int)mode);
+	goto done;
+    }
+    if (write(fd, w.buf, w.len) != (ssize_t)w.len) {
+	sudo_warn(U_("unable to write to %s"), tpath);
+	goto done;
+    }
+    if (close(fd) == -1) {
+	fd = -1;
+	sudo_warn(U_("unable to write to %s"), tpath);
+	goto done;
+    }
+    fd = -1;
+    if (rename(tpath, path) == -1) {
+	sudo_warn(U_("unable to rename %s to %s"), tpath, path);
+	goto done;
+    }
+    free(tpath);
+    tpath = NULL;
+    ret = true;
+
+done:
+    if (fd != -1)
+	close(fd);
+    if (tpath != NULL) {
+	unlink(tpath);
+	free(tpath);
+    }
+    free(w.strtab);
+    free(w.buf);
+    debug_return_bool(ret);
+}
+
+/*
+ * Image reader.
+ */
+struct image_reader {
+    const unsigned char *base;
+    size_t size;
+    uint32_t file_off;
+    char *file;
+};
+
+/*
+ * Return a pointer to the record of len bytes at off or NULL
+ * if off is 0 or the record would extend past the end of the image.
+ */
+static const void *
+image_rec(struct image_reader *r, uint32_t off, size_t len)
+{
+    if (off == 0 || (off & (IMAGE_ALIGN - 1)) != 0)
+	return NULL;
+    if (off > r->size || len > r->size - off)
+	return NULL;
+    return r->base + off;
+}
+#define IMAGE_GET(r, off, type)	((const type *)image_rec(r, off, sizeof(type)))
+
+/*
+ * Return the array at off and store its length in countp.
+ * An offset of 0 is treated as an empty array.
+ */
+static const uint32_t *
+image_array(struct image_reader *r, uint32_t off, uint32_t *countp)
+{
+    const uint32_t *arr;
+
+    *countp = 0;
+    if (off == 0)
+	return NULL;
+    if ((arr = image_rec(r, off, sizeof(uint32_t))) == NULL)
+	return NULL;
+    if (image_rec(r, off, ((size_t)arr[0] + 1) * sizeof(uint32_t)) == NULL)
+	return NULL;
+    *countp = arr[0];
+    return arr + 1;
+}
+
+/*
+ * Return the NUL-terminated string at off without copying it.
+ */
+static const char *
+image_str(struct image_reader *r, uint32_t off)
+{
+    if (off == 0 || off >= r->size)
+	return NULL;
+    if (memchr(r->base + off, '\0', r->size - off) == NULL)
+	return NULL;
+    return (const char *)r->base + off;
+}
+
+/*
+ * Copy the string at off into strp, which is NULL if off is 0.
+ * Returns false on error.
+ */
+static bool
+image_strdup(struct image_reader *r, uint32_t off, char **strp)
+{
+    const char *str;
+
+    *strp = NULL;
+    if (off == 0)
+	return true;
+    if ((str = image_str(r, off)) == NULL)
+	return false;
+    return (*strp = strdup(str)) != NULL;
+}
+
+/*
+ * Return a new reference to the file name at off.
+ * Consecutive entries are usually from the same file.
+ */
+static bool
+image_file(struct image_reader *r, uint32_t off, char **filep)
+{
+    const char *str;
+
+    *filep = NULL;
+    if (off == 0)
+	return true;
+    if (off != r->file_off) {
+	if ((str = image_str(r, off)) == NULL)
+	    return false;
+	rcstr_delref(r->file);
+	if ((r->file = rcstr_dup(str)) == NULL) {
+	    r->file_off = 0;
+	    return false;
+	}
+	r->file_off = off;
+    }
+    *filep = rcstr_addref(r->file);
+    return true;
+}
+
+/*
+ * Read a member and append it to members.
+ */
+static bool
+image_read_member(struct image_reader *r, uint32_t off,
+    struct member_list *members, struct member **mp)
+{
+    const struct image_member *im;
+    const struct image_command *ic;
+    const struct image_digest *id;
+    const uint32_t *digests;
+    struct command_digest *digest;
+    struct sudo_command *c;
+    struct member *m;
+    uint32_t i, count;
+
+    if ((im = IMAGE_GET(r, off, struct image_member)) == NULL)
+	return false;
+    if ((m = calloc(1, sizeof(*m))) == NULL)
+	return false;
+    m->negated = im->negated;
+    if (members != NULL)
+	TAILQ_INSERT_TAIL(members, m, entries);
+    if (mp != NULL)
+	*mp = m;
+
+    if (im->type == COMMAND || (im->type == ALL && im->name != 0)) {
+	/* Type is set last so free_member() is safe on error. */
+	if ((ic = IMAGE_GET(r, im->name, struct image_command)) == NULL)
+	    return false;
+	if ((c = calloc(1, sizeof(*c))) == NULL)
+	    return false;
+	TAILQ_INIT(&c->digests);
+	m->name = (char *)c;
+	m->type = im->type;
+	if (!image_strdup(r, ic->cmnd, &c->cmnd))
+	    return false;
+	if (!image_strdup(r, ic->args, &c->args))
+	    return false;
+	digests = image_array(r, ic->digests, &count);
+	for (i = 0; i < count; i++) {
+	    if ((id = IMAGE_GET(r, digests[i], struct image_digest)) == NULL)
+		return false;
+	    if ((digest = calloc(1, sizeof(*digest))) == NULL)
+		return false;
+	    digest->digest_type = id->type;
+	    TAILQ_INSERT_TAIL(&c->digests, digest, entries);
+	    if (!image_strdup(r, id->str, &digest->digest_str))
+		return false;
+	}
+	return true;
+    }
+    m->type = im->type;
+    return image_strdup(r, im->name, &m->name);
+}
+
+static bool
+image_read_members(struct image_reader *r, uint32_t off,
+    struct member_list *members)
+{
+    const uint32_t *arr;
+    uint32_t i, count;
+
+    arr = image_array(r, off, &count);
+    for (i = 0; i < count; i++) {
+	if (!image_read_member(r, arr[i], members, NULL))
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Read an optional member list, allocating the list head.
+ */
+static bool
+image_read_member_list(struct image_reader *r, uint32_t off,
+    struct member_list **listp)
+{
+    *listp = NULL;
+    if (off == 0)
+	return true;
+    if ((*listp = malloc(sizeof(struct member_list))) == NULL)
+	return false;
+    TAILQ_INIT(*listp);
+    return image_read_members(r, off, *listp);
+}
+
+static bool
+image_read_defaults(struct image_reader *r, uint32_t off,
+    struct defaults_list *defs)
+{
+    const struct image_defaults *idef;
+    struct member_list *binding = NULL;
+    uint32_t i, count, prev_binding = 0;
+    const uint32_t *arr;
+    struct defaults *def;
+
+    arr = image_array(r, off, &count);
+    for (i = 0; i < count; i++) {
+	if ((idef = IMAGE_GET(r, arr[i], struct image_defaults)) == NULL)
+	    return false;
+	if ((def = calloc(1, sizeof(*def))) == NULL)
+	    return false;
+	def->type = idef->type;
+	def->op = idef->op;
+	def->error = idef->error;
+	def->line = idef->line;
+	def->column = idef->column;
+	/* Binding must be shared by consecutive entries to free properly. */
+	if (i == 0 || idef->binding != prev_binding) {
+	    prev_binding = idef->binding;
+	    if (!image_read_member_list(r, idef->binding, &def->binding)) {
+		if (def->binding != NULL) {
+		    free_members(def->binding);
+		    free(def->binding);
+		}
+		free(def);
+		return false;
+	    }
+	    binding = def->binding;
+	} else {
+	    def->binding = binding;
+	}
+	TAILQ_INSERT_TAIL(defs, def, entries);
+	if (!image_strdup(r, idef->var, &def->var))
+	    return false;
+	if (!image_strdup(r, idef->val, &def->val))
+	    return false;
+	if (!image_file(r, idef->file, &def->file))
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Read a string that consecutive cmndspecs may share.
+ */
+static bool
+image_read_shared(struct image_reader *r, uint32_t off, uint32_t *prev_off,
+    char **prev, char **strp)
+{
+    if (off == 0) {
+	*strp = NULL;
+	return true;
+    }
+    if (off != *prev_off) {
+	if (!image_strdup(r, off, prev))
+	    return false;
+	*prev_off = off;
+    }
+    *strp = *prev;
+    return true;
+}
+
+static bool
+image_read_privilege(struct image_reader *r, uint32_t off,
+    struct privilege_list *privs)
+{
+    struct member_list *runasuserlist = NULL, *runasgrouplist = NULL;
+    uint32_t runasuser_off = 0, runasgroup_off = 0;
+    char *runcwd = NULL, *runchroot = NULL;
+    uint32_t runcwd_off = 0, runchroot_off = 0;
+#ifdef HAVE_SELINUX
+    char *role = NULL, *type = NULL;
+    uint32_t role_off = 0, type_off = 0;
+#endif
+#ifdef HAVE_PRIV_SET
+    char *sprivs = NULL, *limitprivs = NULL;
+    uint32_t privs_off = 0, limitprivs_off = 0;
+#endif
+    const struct image_privilege *ipriv;
+    const struct image_cmndspec *ics;
+    struct privilege *priv;
+    struct cmndspec *cs;
+    struct member *cmnd;
+    const uint32_t *arr;
+    uint32_t i, count;
+
+    if ((ipriv = IMAGE_GET(r, off, struct image_privilege)) == NULL)
+	return false;
+    if ((priv = calloc(1, sizeof(*priv))) == NULL)
+	return false;
+    TAILQ_INIT(&priv->hostlist);
+    TAILQ_INIT(&priv->cmndlist);
+    TAILQ_INIT(&priv->defaults);
+    TAILQ_INSERT_TAIL(privs, priv, entries);
+
+    if (!image_strdup(r, ipriv->ldap_role, &priv->ldap_role))
+	return false;
+    if (!image_read_members(r, ipriv->hostlist, &priv->hostlist))
+	return false;
+    if (!image_read_defaults(r, ipriv->defaults, &priv->defaults))
+	return false;
+
+    arr = image_array(r, ipriv->cmndlist, &count);
+    for (i = 0; i < count; i++) {
+	if ((ics = IMAGE_GET(r, arr[i], struct image_cmndspec)) == NULL)
+	    return false;
+	cmnd = NULL;
+	if (!image_read_member(r, ics->cmnd, NULL, &cmnd)) {
+	    if (cmnd != NULL)
+		free_member(cmnd);
+	    return false;
+	}
+	if ((cs = calloc(1, sizeof(*cs))) == NULL) {
+	    free_member(cmnd);
+	    return false;
+	}
+	cs->cmnd = cmnd;
+	cs->notbefore = ics->notbefore;
+	cs->notafter = ics->notafter;
+	cs->timeout = ics->timeout;
+	cs->tags.nopasswd = ics->tags[0];
+	cs->tags.noexec = ics->tags[1];
+	cs->tags.setenv = ics->tags[2];
+	cs->tags.log_input = ics->tags[3];
+	cs->tags.log_output = ics->tags[4];
+	cs->tags.send_mail = ics->tags[5];
+	cs->tags.follow = ics->tags[6];
+
+	/*
+	 * Runas lists and options are shared by consecutive entries.
+	 * The first entry owns the list; free_privilege() relies on this.
+	 */
+	if (ics->runasuserlist != runasuser_off) {
+	    runasuser_off = ics->runasuserlist;
+	    if (!image_read_member_list(r, runasuser_off, &runasuserlist)) {
+		cs->runasuserlist = runasuserlist;
+		TAILQ_INSERT_TAIL(&priv->cmndlist, cs, entries);
+		return false;
+	    }
+	}
+	cs->runasuserlist = runasuserlist;
+	if (ics->runasgrouplist != runasgroup_off) {
+	    runasgroup_off = ics->runasgrouplist;
+	    if (!image_read_member_list(r, runasgroup_off, &runasgrouplist)) {
+		cs->runasgrouplist = runasgrouplist;
+		TAILQ_INSERT_TAIL(&priv->cmndlist, cs, entries);
+		return false;
+	    }
+	}
+	cs->runasgrouplist = runasgrouplist;
+	TAILQ_INSERT_TAIL(&priv->cmndlist, cs, entries);
+
+	if (!image_read_shared(r, ics->runcwd, &runcwd_off, &runcwd,
+		&cs->runcwd))
+	    return false;
+	if (!image_read_shared(r, ics->runchroot, &runchroot_off, &runchroot,
+		&cs->runchroot))
+	    return false;
+#ifdef HAVE_SELINUX
+	if (!image_read_shared(r, ics->role, &role_off, &role, &cs->role))
+	    return false;
+	if (!image_read_shared(r, ics->type, &type_off, &type, &cs->type))
+	    return false;
+#endif
+#ifdef HAVE_PRIV_SET
+	if (!image_read_shared(r, ics->privs, &privs_off, &sprivs,
+		&cs->privs))
+	    return false;
+	if (!image_read_shared(r, ics->limitprivs, &limitprivs_off,
+		&limitprivs, &cs->limitprivs))
+	    return false;
+#endif
+    }
+    return true;
+}
+
+static bool
+image_read_userspecs(struct image_reader *r, uint32_t off,
+    struct userspec_list *usl)
+{
+    const struct image_userspec *ius;
+    const uint32_t *arr, *privs;
+    struct userspec *us;
+    uint32_t i, j, count, npriv;
+
+    arr = image_array(r, off, &count);
+    for (i = 0; i < count; i++) {
+	if ((ius = IMAGE_GET(r, arr[i], struct image_userspec)) == NULL)
+	    return false;
+	if ((us = calloc(1, sizeof(*us))) == NULL)
+	    return false;
+	TAILQ_INIT(&us->users);
+	TAILQ_INIT(&us->privileges);
+	STAILQ_INIT(&us->comments);
+	us->line = ius->line;
+	us->column = ius->column;
+	TAILQ_INSERT_TAIL(usl, us, entries);
+
+	if (!image_file(r, ius->file, &us->file))
+	    return false;
+	if (!image_read_members(r, ius->users, &us->users))
+	    return false;
+	privs = image_array(r, ius->privileges, &npriv);
+	for (j = 0; j < npriv; j++) {
+	    if (!image_read_privilege(r, privs[j], &us->privileges))
+		return false;
+	}
+    }
+    return true;
+}
+
+static bool
+image_read_aliases(struct image_reader *r, uint32_t off,
+    struct sudoers_parse_tree *parse_tree)
+{
+    const struct image_alias *ia;
+    const uint32_t *arr;
+    uint32_t i, count;
+    struct alias *a;
+
+    arr = image_array(r, off, &count);
+    if (count != 0 && parse_tree->aliases == NULL) {
+	if ((parse_tree->aliases = alloc_aliases()) == NULL)
+	    return false;
+    }
+    for (i = 0; i < count; i++) {
+	if ((ia = IMAGE_GET(r, arr[i], struct image_alias)) == NULL)
+	    return false;
+	if ((a = calloc(1, sizeof(*a))) == NULL)
+	    return false;
+	a->type = ia->type;
+	a->line = ia->line;
+	a->column = ia->column;
+	TAILQ_INIT(&a->members);
+	if (!image_strdup(r, ia->name, &a->name) || a->name == NULL ||
+		!image_file(r, ia->file, &a->file) ||
+		!image_read_members(r, ia->members, &a->members)) {
+	    alias_free(a);
+	    return false;
+	}
+	if (rbinsert(parse_tree->aliases, a, NULL) != 0) {
+	    alias_free(a);
+	    return false;
+	}
+    }
+    return true;
+}
+
+/*
+ * Check that an image source has not changed since the image was built.
+ */
+static bool
+image_source_current(const struct image_source *isrc, const char *path)
+{
+    struct timespec ts;
+    struct stat sb;
+    debug_decl(image_source_current, SUDOERS_DEBUG_PARSER);
+
+    if (stat(path, &sb) == -1) {
+	if (isrc->mode == 0 && errno == ENOENT)
+	    debug_return_bool(true);
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_ERRNO,
+	    "unable to stat %s", path);
+	debug_return_bool(false);
+    }
+    mtim_get(&sb, ts);
+    if (isrc->mode != (uint32_t)(sb.st_mode & S_IFMT) ||
+	    isrc->dev != (int64_t)sb.st_dev || isrc->ino != (int64_t)sb.st_ino ||
+	    isrc->size != (int64_t)sb.st_size || isrc->ctime != sb.st_ctime ||
+	    isrc->mtime_sec != ts.tv_sec || isrc->mtime_nsec != ts.tv_nsec) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s has changed", path);
+	debug_return_bool(false);
+    }
+
+    /*
+     * The parser would refuse to read an insecure sudoers file.
+     * Apply the same ownership and mode checks since the image
+     * may have been compiled by an unprivileged user.
+     */
+    if (S_ISREG(sb.st_mode)) {
+	if (sb.st_uid != sudoers_uid || ISSET(sb.st_mode, S_IWOTH) ||
+		(ISSET(sb.st_mode, S_IWGRP) && sb.st_gid != sudoers_gid)) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "%s is not secure", path);
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Check that the image was compiled from sudoers_path and that
+ * none of the files it was built from have changed.
+ */
+static bool
+image_current(struct image_reader *r, const struct image_header *hdr,
+    const char *sudoers_path)
+{
+    const struct image_source *isrc;
+    const uint32_t *arr;
+    const char *path;
+    uint32_t i, count;
+    debug_decl(image_current, SUDOERS_DEBUG_PARSER);
+
+    if (hdr->host != 0) {
+	/* An include path depended on the host name. */
+	path = image_str(r, hdr->host);
+	if (path == NULL || user_shost == NULL || strcmp(path, user_shost) != 0) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO, "host name has changed");
+	    debug_return_bool(false);
+	}
+    }
+
+    arr = image_array(r, hdr->sources, &count);
+    for (i = 0; i < count; i++) {
+	if ((isrc = IMAGE_GET(r, arr[i], struct image_source)) == NULL)
+	    debug_return_bool(false);
+	if ((path = image_str(r, isrc->path)) == NULL)
+	    debug_return_bool(false);
+	if (i == 0 && strcmp(path, sudoers_path) != 0) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO,
+		"image was compiled from %s, not %s", path, sudoers_path);
+	    debug_return_bool(false);
+	}
+	if (!image_source_current(isrc, path))
+	    debug_return_bool(false);
+    }
+    debug_return_bool(count != 0);
+}
+
+/*
+ * Load a compiled sudoers image from fd into parse_tree.
+ * If sudoers_path is not NULL, the image is only used if it was
+ * compiled from sudoers_path and none of its sources have changed.
+ * Returns true on success, else false, leaving parse_tree unchanged.
+ */
+bool
+sudoers_image_read(int fd, const char *sudoers_path,
+    struct sudoers_parse_tree *parse_tree)
+{
+    struct sudoers_parse_tree tree;
+    const struct image_header *hdr;
+    struct image_reader r = { NULL };
+    struct stat sb;
+    void *base;
+    bool ret = false;
+    debug_decl(sudoers_image_read, SUDOERS_DEBUG_PARSER);
+
+    if (fstat(fd, &sb) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "unable to stat image");
+	debug_return_bool(false);
+    }
+    if (sb.st_size < (off_t)sizeof(*hdr) || sb.st_size > UINT32_MAX) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR, "invalid image size %lld",
+	    (long long)sb.st_size);
+	debug_return_bool(false);
+    }
+    base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "unable to map image");
+	debug_return_bool(false);
+    }
+    r.base = base;
+    r.size = sb.st_size;
+
+    hdr = base;
+    if (memcmp(hdr->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+	    hdr->byteorder != IMAGE_BYTEORDER || hdr->size != r.size ||
+	    strncmp(hdr->version, PACKAGE_VERSION, sizeof(hdr->version)) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "image header mismatch");
+	goto done;
+    }
+    if (sudoers_path != NULL && !image_current(&r, hdr, sudoers_path))
+	goto done;
+
+    init_parse_tree(&tree, NULL, NULL);
+    if (!image_read_userspecs(&r, hdr->userspecs, &tree.userspecs) ||
+	    !image_read_defaults(&r, hdr->defaults, &tree.defaults) ||
+	    !image_read_aliases(&r, hdr->aliases, &tree)) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR, "corrupt or truncated image");
+	free_parse_tree(&tree);
+	goto done;
+    }
+
+    /* Move loaded policy to parse_tree. */
+    TAILQ_CONCAT(&parse_tree->userspecs, &tree.userspecs, entries);
+    TAILQ_CONCAT(&parse_tree->defaults, &tree.defaults, entries);
+    free_aliases(parse_tree->aliases);
+    parse_tree->aliases = tree.aliases;
+    ret = true;
+
+done:
+    rcstr_delref(r.file);
+    munmap(base, sb.st_size);
+    debug_return_bool(ret);
+}
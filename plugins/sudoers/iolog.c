@@ -198,6 +198,7 @@ free_iolog_details(void)
 	eventlog_free(iolog_details.evlog);
     }
     str_list_free(iolog_details.log_servers);
+    free(iolog_details.spool_dir);
 #if defined(HAVE_OPENSSL)
     free(iolog_details.ca_bundle);
     free(iolog_details.cert_file);
@@ -392,6 +393,11 @@ iolog_deserialize_info(struct log_details *details, char * const user_info[],
 		}
 		continue;
 	    }
+	    if (strncmp(*cur, "iolog_codec=", sizeof("iolog_codec=") - 1) == 0) {
+		/* Falls back to the default codec if unsupported. */
+		(void)iolog_set_codec(*cur + sizeof("iolog_codec=") - 1);
+		continue;
+	    }
 	    if (strncmp(*cur, "iolog_flush=", sizeof("iolog_flush=") - 1) == 0) {
 		int val = sudo_strtobool(*cur + sizeof("iolog_flush=") - 1);
 		if (val != -1) {
@@ -449,6 +455,22 @@ iolog_deserialize_info(struct log_details *details, char * const user_info[],
 		    TIME_T_MAX, NULL);
 		continue;
 	    }
+	    if (strncmp(*cur, "log_server_spool=", sizeof("log_server_spool=") - 1) == 0) {
+		details->spool_dir = strdup(*cur + sizeof("log_server_spool=") - 1);
+		if (details->spool_dir == NULL)
+		    goto oom;
+		continue;
+	    }
+	    if (strncmp(*cur, "log_server_async=", sizeof("log_server_async=") - 1) == 0) {
+		int val = sudo_strtobool(*cur + sizeof("log_server_async=") - 1);
+		if (val != -1) {
+		    details->async_connect = val;
+		} else {
+		    sudo_debug_printf(SUDO_DEBUG_WARN,
+			"%s: unable to parse %s", __func__, *cur);
+		}
+		continue;
+	    }
             if (strncmp(*cur, "log_server_keepalive=", sizeof("log_server_keepalive=") - 1) == 0) {
                 int val = sudo_strtobool(*cur + sizeof("log_server_keepalive=") - 1);
                 if (val != -1) {
@@ -950,10 +972,8 @@ sudoers_io_log_remote(int event, const char *buf, unsigned int len,
 	goto done;
     }
     if (fmt_io_buf(client_closure, type, buf, len, delay)) {
-	ret = client_closure->write_ev->add(client_closure->write_ev,
-	    &iolog_details.server_timeout);
-	if (ret == -1)
-	    sudo_warn("%s", U_("unable to add event to queue"));
+	if (log_server_schedule_write(client_closure))
+	    ret = 1;
     }
 
 done:
@@ -1083,10 +1103,8 @@ sudoers_io_change_winsize_remote(unsigned int lines, unsigned int cols,
     sudo_timespecadd(delay, &client_closure->elapsed, &client_closure->elapsed);
 
     if (fmt_winsize(client_closure, lines, cols, delay)) {
-	ret = client_closure->write_ev->add(client_closure->write_ev,
-	    &iolog_details.server_timeout);
-	if (ret == -1)
-	    sudo_warn("%s", U_("unable to add event to queue"));
+	if (log_server_schedule_write(client_closure))
+	    ret = 1;
     }
 
     debug_return_int(ret);
@@ -1181,10 +1199,8 @@ sudoers_io_suspend_remote(const char *signame, struct timespec *delay,
     sudo_timespecadd(delay, &client_closure->elapsed, &client_closure->elapsed);
 
     if (fmt_suspend(client_closure, signame, delay)) {
-	ret = client_closure->write_ev->add(client_closure->write_ev,
-	    &iolog_details.server_timeout);
-	if (ret == -1)
-	    sudo_warn("%s", U_("unable to add event to queue"));
+	if (log_server_schedule_write(client_closure))
+	    ret = 1;
     }
 
     debug_return_int(ret);
@@ -66,6 +66,7 @@
 #include "sudo_ldap.h"
 #include "sudo_ldap_conf.h"
 #include "sudo_dso.h"
+#include "redblack.h"
 
 #ifndef LDAP_OPT_RESULT_CODE
 # define LDAP_OPT_RESULT_CODE LDAP_OPT_ERROR_NUMBER
@@ -91,6 +92,15 @@
 #  define ldap_search_ext_s(a, b, c, d, e, f, g, h, i, j, k)		\
 	ldap_search_s(a, b, c, d, e, f, k)
 # endif
+# define ldap_search_ext(a, b, c, d, e, f, g, h, i, j, k)		\
+	((*(k) = ldap_search(a, b, c, d, e, f)) == -1 ? LDAP_OTHER : LDAP_SUCCESS)
+# define ldap_parse_result(a, b, c, d, e, f, g, h)			\
+	(*(c) = ldap_result2error(a, b, h), LDAP_SUCCESS)
+# define ldap_abandon_ext(a, b, c, d)	ldap_abandon(a, b)
+#endif
+
+#ifndef LDAP_RES_ANY
+# define LDAP_RES_ANY		(-1)
 #endif
 
 #define LDAP_FOREACH(var, ld, res)					\
@@ -141,6 +151,21 @@ struct ldap_result {
 };
 #define	ALLOCATION_INCREMENT	100
 
+/*
+ * The ldap_search_op structure holds the state of an asynchronous search.
+ * All the searches needed at a given point are sent to the server before
+ * waiting for any of them, which saves a round trip per search.
+ */
+struct ldap_search_op {
+    const char *base;
+    LDAPMessage *result;
+    struct timespec start;
+    size_t nbytes;	/* only computed when debugging */
+    int nentries;
+    int msgid;
+    int rc;
+};
+
 /*
  * The ldap_netgroup structure implements a singly-linked tail queue of
  * netgroups a user is a member of when querying netgroups directly.
@@ -160,8 +185,25 @@ struct sudo_ldap_handle {
     LDAP *ld;
     struct passwd *pw;
     struct sudoers_parse_tree parse_tree;
+    struct rbtree *group_names;	/* non-Unix sudoUser values for pass 2 */
+    bool cached;	/* parse_tree was read from the local cache */
+};
+
+/* Attributes stored in the local sudoRole cache. */
+static char *ldap_cache_attrs[] = {
+    "objectClass", "cn", "sudoUser", "sudoHost", "sudoCommand",
+    "sudoRunAs", "sudoRunAsUser", "sudoRunAsGroup", "sudoOption",
+    "sudoOrder", "sudoNotBefore", "sudoNotAfter", "modifyTimestamp",
+    NULL
 };
 
+/*
+ * When refreshing the local cache, also fetch entries modified up to
+ * this many seconds before the newest cached entry.  A change made on
+ * another server may be replicated after a newer local one.
+ */
+#define LDAP_CACHE_MARGIN	300
+
 #ifdef HAVE_LDAP_INITIALIZE
 static char *
 sudo_ldap_join_uri(struct ldap_config_str_list *uri_list)
@@ -312,6 +354,32 @@ sudo_ldap_get_values_len(LDAP *ld, LDAPMessage *entry, char *attr, int *rc)
     return bval;
 }
 
+/*
+ * Return true if pw is a member of the netgroup ("+name") or
+ * non-Unix group ("%:name") in a sudoUser value, else false.
+ */
+static bool
+sudo_ldap_check_non_unix_name(const char *val, struct passwd *pw)
+{
+    bool ret = false;
+    debug_decl(sudo_ldap_check_non_unix_name, SUDOERS_DEBUG_LDAP);
+
+    if (*val == '+') {
+	if (netgr_matches(val, def_netgroup_tuple ? user_runhost : NULL,
+	    def_netgroup_tuple ? user_srunhost : NULL, pw->pw_name))
+	    ret = true;
+	DPRINTF2("ldap sudoUser netgroup '%s' ... %s", val,
+	    ret ? "MATCH!" : "not");
+    } else {
+	if (group_plugin_query(pw->pw_name, val + 2, pw))
+	    ret = true;
+	DPRINTF2("ldap sudoUser non-Unix group '%s' ... %s", val,
+	    ret ? "MATCH!" : "not");
+    }
+
+    debug_return_bool(ret);
+}
+
 /*
  * Walk through search results and return true if we have a matching
  * non-Unix group (including netgroups), else false.
@@ -339,18 +407,7 @@ sudo_ldap_check_non_unix_group(LDAP *ld, LDAPMessage *entry, struct passwd *pw)
     /* walk through values */
     for (p = bv; *p != NULL && !ret; p++) {
 	val = (*p)->bv_val;
-	if (*val == '+') {
-	    if (netgr_matches(val, def_netgroup_tuple ? user_runhost : NULL,
-		def_netgroup_tuple ? user_srunhost : NULL, pw->pw_name))
-		ret = true;
-	    DPRINTF2("ldap sudoUser netgroup '%s' ... %s", val,
-		ret ? "MATCH!" : "not");
-	} else {
-	    if (group_plugin_query(pw->pw_name, val + 2, pw))
-		ret = true;
-	    DPRINTF2("ldap sudoUser non-Unix group '%s' ... %s", val,
-		ret ? "MATCH!" : "not");
-	}
+	ret = sudo_ldap_check_non_unix_name(val, pw);
     }
 
     ldap_value_free_len(bv);	/* cleanup */
@@ -658,96 +715,320 @@ sudo_ldap_value_dup(const char *src)
 }
 
 /*
- * Check the netgroups list beginning at "start" for nesting.
- * Parent nodes with a memberNisNetgroup that match one of the
- * netgroups are added to the list and checked for further nesting.
- * Return true on success or false if there was an internal overflow.
+ * Return the approximate size in bytes of the entries in a search
+ * result, counting each dn, attribute name and value.
  */
-static bool
-sudo_netgroup_lookup_nested(LDAP *ld, char *base, struct timeval *timeout,
-    struct ldap_netgroup_list *netgroups, struct ldap_netgroup *start)
+static size_t
+sudo_ldap_result_size(LDAP *ld, LDAPMessage *result)
 {
-    LDAPMessage *entry, *result;
-    size_t filt_len;
-    char *filt;
+    struct berval **bv, **p;
+    BerElement *ber = NULL;
+    LDAPMessage *entry;
+    char *attr, *dn;
+    size_t size = 0;
     int rc;
-    debug_decl(sudo_netgroup_lookup_nested, SUDOERS_DEBUG_LDAP);
+    debug_decl(sudo_ldap_result_size, SUDOERS_DEBUG_LDAP);
 
-    DPRINTF1("Checking for nested netgroups from netgroup_base '%s'", base);
-    do {
-	struct ldap_netgroup *ng, *old_tail;
+    LDAP_FOREACH(entry, ld, result) {
+	if ((dn = ldap_get_dn(ld, entry)) != NULL) {
+	    size += strlen(dn);
+	    ldap_memfree(dn);
+	}
+	for (attr = ldap_first_attribute(ld, entry, &ber); attr != NULL;
+		attr = ldap_next_attribute(ld, entry, ber)) {
+	    size += strlen(attr);
+	    if ((bv = sudo_ldap_get_values_len(ld, entry, attr, &rc)) != NULL) {
+		for (p = bv; *p != NULL; p++)
+		    size += (*p)->bv_len;
+		ldap_value_free_len(bv);
+	    }
+	    ldap_memfree(attr);
+	}
+	if (ber != NULL) {
+	    ber_free(ber, 0);
+	    ber = NULL;
+	}
+    }
 
-	result = NULL;
-	old_tail = STAILQ_LAST(netgroups, ldap_netgroup, entries);
-	filt_len = strlen(ldap_conf.netgroup_search_filter) + 7;
-	for (ng = start; ng != NULL; ng = STAILQ_NEXT(ng, entries)) {
-	    filt_len += sudo_ldap_value_len(ng->name) + 20;
+    debug_return_size_t(size);
+}
+
+/*
+ * Send a subtree search of base to the LDAP server without waiting
+ * for the result, which is collected by sudo_ldap_search_wait().
+ * Returns true on success, else false and op->rc is set.
+ */
+static bool
+sudo_ldap_search_start(LDAP *ld, struct ldap_search_op *op, const char *base,
+    const char *filt, char **attrs)
+{
+    struct timeval tv, *tvp = NULL;
+    debug_decl(sudo_ldap_search_start, SUDOERS_DEBUG_LDAP);
+
+    if (ldap_conf.timeout > 0) {
+	tv.tv_sec = ldap_conf.timeout;
+	tv.tv_usec = 0;
+	tvp = &tv;
+    }
+
+    op->base = base;
+    op->result = NULL;
+    op->nbytes = 0;
+    op->nentries = 0;
+    op->msgid = -1;
+    if (sudo_gettime_mono(&op->start) == -1)
+	sudo_timespecclear(&op->start);
+    op->rc = ldap_search_ext(ld, base, LDAP_SCOPE_SUBTREE, filt, attrs, 0,
+	NULL, NULL, tvp, 0, &op->msgid);
+    if (op->rc != LDAP_SUCCESS) {
+	DPRINTF1("unable to search from base '%s': %s", base,
+	    ldap_err2string(op->rc));
+	op->msgid = -1;
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Wait for the outstanding searches in ops to complete, in the order
+ * the server answers them.  The result code and results of each search
+ * are stored in its ldap_search_op.  If no search completes within the
+ * configured timeout, the remaining ones are abandoned.
+ */
+static void
+sudo_ldap_search_wait(LDAP *ld, struct ldap_search_op *ops, size_t nops)
+{
+    struct timeval tv, *tvp = NULL;
+    struct timespec now, elapsed;
+    struct ldap_search_op *op;
+    LDAPMessage *msg;
+    size_t i, outstanding = 0;
+    int errcode, msgid, rc;
+    bool measure;
+    debug_decl(sudo_ldap_search_wait, SUDOERS_DEBUG_LDAP);
+
+    /* Measuring the result size is only worthwhile when debugging. */
+    measure = ldap_conf.debug >= 1 || sudo_debug_needed(SUDO_DEBUG_DIAG);
+
+    for (i = 0; i < nops; i++) {
+	if (ops[i].msgid != -1)
+	    outstanding++;
+    }
+
+    while (outstanding > 0) {
+	if (ldap_conf.timeout > 0) {
+	    tv.tv_sec = ldap_conf.timeout;
+	    tv.tv_usec = 0;
+	    tvp = &tv;
 	}
-	if ((filt = malloc(filt_len)) == NULL)
-	    goto oom;
-	CHECK_STRLCPY(filt, "(&", filt_len);
-	CHECK_STRLCAT(filt, ldap_conf.netgroup_search_filter, filt_len);
-	CHECK_STRLCAT(filt, "(|", filt_len);
-	for (ng = start; ng != NULL; ng = STAILQ_NEXT(ng, entries)) {
-	    CHECK_STRLCAT(filt, "(memberNisNetgroup=", filt_len);
-	    CHECK_LDAP_VCAT(filt, ng->name, filt_len);
-	    CHECK_STRLCAT(filt, ")", filt_len);
-	}
-	CHECK_STRLCAT(filt, "))", filt_len);
-	DPRINTF1("ldap netgroup search filter: '%s'", filt);
-	rc = ldap_search_ext_s(ld, base, LDAP_SCOPE_SUBTREE, filt,
-	    NULL, 0, NULL, NULL, timeout, 0, &result);
-	free(filt);
-	if (rc == LDAP_SUCCESS) {
-	    LDAP_FOREACH(entry, ld, result) {
-		struct berval **bv;
-
-		bv = sudo_ldap_get_values_len(ld, entry, "cn", &rc);
-		if (bv == NULL) {
-		    if (rc == LDAP_NO_MEMORY)
-			goto oom;
-		} else {
-		    /* Don't add a netgroup twice. */
-		    STAILQ_FOREACH(ng, netgroups, entries) {
-			/* Assumes only one cn per entry. */
-			if (strcasecmp(ng->name, (*bv)->bv_val) == 0)
-			    break;
-		    }
-		    if (ng == NULL) {
-			ng = malloc(sizeof(*ng));
-			if (ng == NULL ||
-			    (ng->name = strdup((*bv)->bv_val)) == NULL) {
-			    free(ng);
-			    ldap_value_free_len(bv);
-			    goto oom;
-			}
-#ifdef __clang_analyzer__
-			/* clang analyzer false positive */
-			if (__builtin_expect(netgroups->stqh_last == NULL, 0))
-			    __builtin_trap();
-#endif
-			STAILQ_INSERT_TAIL(netgroups, ng, entries);
-			DPRINTF1("Found new netgroup %s for %s", ng->name, base);
-		    }
+	msg = NULL;
+	rc = ldap_result(ld, LDAP_RES_ANY, LDAP_MSG_ALL, tvp, &msg);
+	if (rc <= 0) {
+	    /* Timed out or lost the connection, give up on the rest. */
+	    if (rc == 0)
+		rc = LDAP_TIMEOUT;
+	    else if (ldap_get_option(ld, LDAP_OPT_RESULT_CODE, &rc) != LDAP_OPT_SUCCESS)
+		rc = LDAP_OTHER;
+	    ldap_msgfree(msg);
+	    for (i = 0; i < nops; i++) {
+		op = &ops[i];
+		if (op->msgid == -1)
+		    continue;
+		DPRINTF1("ldap search from base '%s' failed: %s", op->base,
+		    ldap_err2string(rc));
+		ldap_abandon_ext(ld, op->msgid, NULL, NULL);
+		op->msgid = -1;
+		op->rc = rc;
+	    }
+	    break;
+	}
+
+	msgid = ldap_msgid(msg);
+	for (i = 0; i < nops; i++) {
+	    if (ops[i].msgid != -1 && ops[i].msgid == msgid)
+		break;
+	}
+	if (i == nops) {
+	    /* Not one of ours, should not happen. */
+	    DPRINTF1("ignoring result for unknown search %d", msgid);
+	    ldap_msgfree(msg);
+	    continue;
+	}
+	op = &ops[i];
+	op->msgid = -1;
+	op->result = msg;
+	op->rc = ldap_parse_result(ld, msg, &errcode, NULL, NULL, NULL, NULL, 0);
+	if (op->rc == LDAP_SUCCESS)
+	    op->rc = errcode;
+	outstanding--;
+
+	if (sudo_gettime_mono(&now) == -1)
+	    sudo_timespecclear(&now);
+	sudo_timespecsub(&now, &op->start, &elapsed);
+	op->nentries = ldap_count_entries(ld, msg);
+	if (measure)
+	    op->nbytes = sudo_ldap_result_size(ld, msg);
+	DPRINTF1("ldap search from base '%s': %s, %d entries, %zu bytes "
+	    "in %lld.%06lds", op->base, ldap_err2string(op->rc), op->nentries,
+	    op->nbytes, (long long)elapsed.tv_sec, elapsed.tv_nsec / 1000);
+    }
+
+    debug_return;
+}
+
+/*
+ * Add the netgroups in a search result to the netgroups list, unless
+ * they are already present.  The first and last new netgroups are
+ * stored in firstp and lastp, or NULL if there were none.
+ * Return true on success or false if out of memory.
+ */
+static bool
+sudo_netgroup_add_result(LDAP *ld, LDAPMessage *result, const char *base,
+    struct ldap_netgroup_list *netgroups, struct ldap_netgroup **firstp,
+    struct ldap_netgroup **lastp)
+{
+    struct ldap_netgroup *ng, *old_tail;
+    LDAPMessage *entry;
+    int rc;
+    debug_decl(sudo_netgroup_add_result, SUDOERS_DEBUG_LDAP);
+
+    old_tail = STAILQ_LAST(netgroups, ldap_netgroup, entries);
+    LDAP_FOREACH(entry, ld, result) {
+	struct berval **bv;
+
+	bv = sudo_ldap_get_values_len(ld, entry, "cn", &rc);
+	if (bv == NULL) {
+	    if (rc == LDAP_NO_MEMORY)
+		debug_return_bool(false);
+	} else {
+	    /* Don't add a netgroup twice. */
+	    STAILQ_FOREACH(ng, netgroups, entries) {
+		/* Assumes only one cn per entry. */
+		if (strcasecmp(ng->name, (*bv)->bv_val) == 0)
+		    break;
+	    }
+	    if (ng == NULL) {
+		ng = malloc(sizeof(*ng));
+		if (ng == NULL ||
+		    (ng->name = strdup((*bv)->bv_val)) == NULL) {
+		    free(ng);
 		    ldap_value_free_len(bv);
+		    debug_return_bool(false);
 		}
+#ifdef __clang_analyzer__
+		/* clang analyzer false positive */
+		if (__builtin_expect(netgroups->stqh_last == NULL, 0))
+		    __builtin_trap();
+#endif
+		STAILQ_INSERT_TAIL(netgroups, ng, entries);
+		DPRINTF1("Found new netgroup %s for %s", ng->name, base);
 	    }
+	    ldap_value_free_len(bv);
 	}
-	ldap_msgfree(result);
+    }
 
-	/* Check for nested netgroups in what we added. */
-	start = old_tail ? STAILQ_NEXT(old_tail, entries) : STAILQ_FIRST(netgroups);
-    } while (start != NULL);
+    /* Any new netgroups were added after the old tail. */
+    *firstp = old_tail ? STAILQ_NEXT(old_tail, entries) : STAILQ_FIRST(netgroups);
+    *lastp = *firstp ? STAILQ_LAST(netgroups, ldap_netgroup, entries) : NULL;
 
     debug_return_bool(true);
-oom:
-    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
-    ldap_msgfree(result);
-    debug_return_bool(false);
+}
+
+/*
+ * Build a filter to find the parents of the netgroups from first
+ * through last.
+ */
+static char *
+sudo_netgroup_build_nested(struct ldap_netgroup *first,
+    struct ldap_netgroup *last)
+{
+    struct ldap_netgroup *ng;
+    size_t filt_len;
+    char *filt;
+    debug_decl(sudo_netgroup_build_nested, SUDOERS_DEBUG_LDAP);
+
+    filt_len = strlen(ldap_conf.netgroup_search_filter) + 7;
+    for (ng = first; ng != NULL; ng = STAILQ_NEXT(ng, entries)) {
+	filt_len += sudo_ldap_value_len(ng->name) + 20;
+	if (ng == last)
+	    break;
+    }
+    if ((filt = malloc(filt_len)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_str(NULL);
+    }
+    CHECK_STRLCPY(filt, "(&", filt_len);
+    CHECK_STRLCAT(filt, ldap_conf.netgroup_search_filter, filt_len);
+    CHECK_STRLCAT(filt, "(|", filt_len);
+    for (ng = first; ng != NULL; ng = STAILQ_NEXT(ng, entries)) {
+	CHECK_STRLCAT(filt, "(memberNisNetgroup=", filt_len);
+	CHECK_LDAP_VCAT(filt, ng->name, filt_len);
+	CHECK_STRLCAT(filt, ")", filt_len);
+	if (ng == last)
+	    break;
+    }
+    CHECK_STRLCAT(filt, "))", filt_len);
+    debug_return_str(filt);
 overflow:
     sudo_warnx(U_("internal error, %s overflow"), __func__);
     free(filt);
-    debug_return_bool(false);
+    debug_return_str(NULL);
+}
+
+/*
+ * Check the netgroups found in each netgroup_base for nesting.
+ * The netgroups first found in the base searched by ops[i] are
+ * first[i] through last[i].  Parent nodes with a memberNisNetgroup
+ * that match one of them are added to the list and checked for further
+ * nesting in the same base.  The searches for all bases at the same
+ * nesting level are sent to the server at once.
+ * Return true on success or false if there was an internal overflow.
+ */
+static bool
+sudo_netgroup_lookup_nested(LDAP *ld, struct ldap_search_op *ops,
+    struct ldap_netgroup **first, struct ldap_netgroup **last, size_t nbases,
+    struct ldap_netgroup_list *netgroups)
+{
+    size_t i, nsent;
+    char *filt;
+    debug_decl(sudo_netgroup_lookup_nested, SUDOERS_DEBUG_LDAP);
+
+    do {
+	nsent = 0;
+	for (i = 0; i < nbases; i++) {
+	    ops[i].msgid = -1;
+	    if (first[i] == NULL)
+		continue;
+	    DPRINTF1("Checking for nested netgroups from netgroup_base '%s'",
+		ops[i].base);
+	    if ((filt = sudo_netgroup_build_nested(first[i], last[i])) == NULL)
+		debug_return_bool(false);
+	    DPRINTF1("ldap netgroup search filter: '%s'", filt);
+	    if (sudo_ldap_search_start(ld, &ops[i], ops[i].base, filt, NULL))
+		nsent++;
+	    free(filt);
+	}
+	sudo_ldap_search_wait(ld, ops, nbases);
+
+	for (i = 0; i < nbases; i++) {
+	    if (first[i] == NULL)
+		continue;
+	    first[i] = last[i] = NULL;
+	    if (ops[i].rc == LDAP_SUCCESS) {
+		/* Check for nested netgroups in what we added. */
+		if (!sudo_netgroup_add_result(ld, ops[i].result, ops[i].base,
+			netgroups, &first[i], &last[i])) {
+		    sudo_warnx(U_("%s: %s"), __func__,
+			U_("unable to allocate memory"));
+		    debug_return_bool(false);
+		}
+	    }
+	    ldap_msgfree(ops[i].result);
+	    ops[i].result = NULL;
+	}
+    } while (nsent != 0);
+
+    debug_return_bool(true);
 }
 
 /*
@@ -760,22 +1041,16 @@ sudo_netgroup_lookup(LDAP *ld, struct passwd *pw,
     struct ldap_netgroup_list *netgroups)
 {
     struct ldap_config_str *base;
-    struct ldap_netgroup *ng, *old_tail;
-    struct timeval tv, *tvp = NULL;
-    LDAPMessage *entry, *result = NULL;
+    struct ldap_search_op *ops = NULL;
+    struct ldap_netgroup **first = NULL, **last = NULL;
     const char *domain;
     char *escaped_domain = NULL, *escaped_user = NULL;
     char *escaped_host = NULL, *escaped_shost = NULL, *filt = NULL;
-    int filt_len, rc;
+    size_t i, nbases = 0;
+    int filt_len;
     bool ret = false;
     debug_decl(sudo_netgroup_lookup, SUDOERS_DEBUG_LDAP);
 
-    if (ldap_conf.timeout > 0) {
-	tv.tv_sec = ldap_conf.timeout;
-	tv.tv_usec = 0;
-	tvp = &tv;
-    }
-
     /* Use NIS domain if set, else wildcard match. */
     domain = sudo_getdomainname();
 
@@ -851,56 +1126,37 @@ sudo_netgroup_lookup(LDAP *ld, struct passwd *pw,
     DPRINTF1("ldap netgroup search filter: '%s'", filt);
 
     STAILQ_FOREACH(base, &ldap_conf.netgroup_base, entries) {
-	DPRINTF1("searching from netgroup_base '%s'", base->val);
-	rc = ldap_search_ext_s(ld, base->val, LDAP_SCOPE_SUBTREE, filt,
-	    NULL, 0, NULL, NULL, tvp, 0, &result);
-	if (rc != LDAP_SUCCESS) {
-	    DPRINTF1("ldap netgroup search failed: %s", ldap_err2string(rc));
-	    ldap_msgfree(result);
-	    result = NULL;
-	    continue;
-	}
-
-	old_tail = STAILQ_LAST(netgroups, ldap_netgroup, entries);
-	LDAP_FOREACH(entry, ld, result) {
-	    struct berval **bv;
+	nbases++;
+    }
+    ops = calloc(nbases, sizeof(*ops));
+    first = calloc(nbases, sizeof(*first));
+    last = calloc(nbases, sizeof(*last));
+    if (ops == NULL || first == NULL || last == NULL)
+	goto oom;
 
-	    bv = sudo_ldap_get_values_len(ld, entry, "cn", &rc);
-	    if (bv == NULL) {
-		if (rc == LDAP_NO_MEMORY)
-		    goto oom;
-	    } else {
-		/* Don't add a netgroup twice. */
-		STAILQ_FOREACH(ng, netgroups, entries) {
-		    /* Assumes only one cn per entry. */
-		    if (strcasecmp(ng->name, (*bv)->bv_val) == 0)
-			break;
-		}
-		if (ng == NULL) {
-		    ng = malloc(sizeof(*ng));
-		    if (ng == NULL ||
-			(ng->name = strdup((*bv)->bv_val)) == NULL) {
-			free(ng);
-			ldap_value_free_len(bv);
-			goto oom;
-		    }
-		    STAILQ_INSERT_TAIL(netgroups, ng, entries);
-		    DPRINTF1("Found new netgroup %s for %s", ng->name,
-			base->val);
-		}
-		ldap_value_free_len(bv);
-	    }
-	}
-	ldap_msgfree(result);
-	result = NULL;
+    /* Search all the netgroup bases at once. */
+    i = 0;
+    STAILQ_FOREACH(base, &ldap_conf.netgroup_base, entries) {
+	DPRINTF1("searching from netgroup_base '%s'", base->val);
+	sudo_ldap_search_start(ld, &ops[i++], base->val, filt, NULL);
+    }
+    sudo_ldap_search_wait(ld, ops, nbases);
 
-	/* Check for nested netgroups in what we added. */
-	ng = old_tail ? STAILQ_NEXT(old_tail, entries) : STAILQ_FIRST(netgroups);
-	if (ng != NULL) {
-	    if (!sudo_netgroup_lookup_nested(ld, base->val, tvp, netgroups, ng))
-		goto done;
+    for (i = 0; i < nbases; i++) {
+	if (ops[i].rc != LDAP_SUCCESS) {
+	    DPRINTF1("ldap netgroup search failed: %s",
+		ldap_err2string(ops[i].rc));
+	} else if (!sudo_netgroup_add_result(ld, ops[i].result, ops[i].base,
+		netgroups, &first[i], &last[i])) {
+	    goto oom;
 	}
+	ldap_msgfree(ops[i].result);
+	ops[i].result = NULL;
     }
+
+    /* Check for nested netgroups in what we added. */
+    if (!sudo_netgroup_lookup_nested(ld, ops, first, last, nbases, netgroups))
+	goto done;
     ret = true;
     goto done;
 
@@ -913,7 +1169,13 @@ done:
     if (escaped_host != escaped_shost)
 	free(escaped_shost);
     free(filt);
-    ldap_msgfree(result);
+    if (ops != NULL) {
+	for (i = 0; i < nbases; i++)
+	    ldap_msgfree(ops[i].result);
+	free(ops);
+    }
+    free(first);
+    free(last);
     debug_return_bool(ret);
 }
 
@@ -1145,6 +1407,175 @@ sudo_ldap_build_pass2(void)
     debug_return_str(filt);
 }
 
+/*
+ * Compare two sudoUser values, as stored in the group_names tree.
+ */
+static int
+group_name_compare(const void *v1, const void *v2)
+{
+    return strcmp(v1, v2);
+}
+
+/*
+ * Collect the distinct netgroup and non-Unix group sudoUser values
+ * from the results of the pass 2 searches in ops, which only fetch
+ * the sudoUser attribute.  The results are freed.
+ * Returns a tree of names on success or NULL if out of memory.
+ */
+static struct rbtree *
+sudo_ldap_collect_group_names(LDAP *ld, struct ldap_search_op *ops,
+    size_t nops)
+{
+    struct berval **bv, **p;
+    struct rbtree *names;
+    LDAPMessage *entry;
+    char *name;
+    size_t i;
+    int rc;
+    debug_decl(sudo_ldap_collect_group_names, SUDOERS_DEBUG_LDAP);
+
+    if ((names = rbcreate(group_name_compare)) == NULL)
+	goto oom;
+    for (i = 0; i < nops; i++) {
+	if (ops[i].rc != LDAP_SUCCESS) {
+	    DPRINTF1("ldap search pass 2 failed: %s",
+		ldap_err2string(ops[i].rc));
+	    continue;
+	}
+	LDAP_FOREACH(entry, ld, ops[i].result) {
+	    bv = sudo_ldap_get_values_len(ld, entry, "sudoUser", &rc);
+	    if (bv == NULL) {
+		if (rc == LDAP_NO_MEMORY)
+		    goto oom;
+		continue;
+	    }
+	    for (p = bv; *p != NULL; p++) {
+		const char *val = (*p)->bv_val;
+
+		if (val[0] != '+' && (val[0] != '%' || val[1] != ':'))
+		    continue;
+		if ((name = strdup(val)) == NULL) {
+		    ldap_value_free_len(bv);
+		    goto oom;
+		}
+		switch (rbinsert(names, name, NULL)) {
+		case 0:
+		    break;
+		case 1:
+		    /* Already present. */
+		    free(name);
+		    break;
+		default:
+		    free(name);
+		    ldap_value_free_len(bv);
+		    goto oom;
+		}
+	    }
+	    ldap_value_free_len(bv);
+	}
+    }
+
+    for (i = 0; i < nops; i++) {
+	ldap_msgfree(ops[i].result);
+	ops[i].result = NULL;
+    }
+    debug_return_ptr(names);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    if (names != NULL)
+	rbdestroy(names, free);
+    debug_return_ptr(NULL);
+}
+
+struct pass2_closure {
+    struct passwd *pw;
+    struct sudo_lbuf *lbuf;
+    bool query_netgroups;
+    unsigned int count;
+    unsigned int total;
+};
+
+/*
+ * rbapply() callback to add a sudoUser value to the resolved pass 2
+ * filter if the user is a member of that netgroup or non-Unix group.
+ * Returns 0 on success or -1 if out of memory.
+ */
+static int
+sudo_ldap_pass2_add_name(void *v, void *cookie)
+{
+    struct pass2_closure *closure = cookie;
+    const char *name = v;
+    char *escaped;
+    debug_decl(sudo_ldap_pass2_add_name, SUDOERS_DEBUG_LDAP);
+
+    closure->total++;
+    if (name[0] == '+' ? !closure->query_netgroups : !def_group_plugin)
+	debug_return_int(0);
+    if (!sudo_ldap_check_non_unix_name(name, closure->pw))
+	debug_return_int(0);
+
+    if ((escaped = sudo_ldap_value_dup(name)) == NULL)
+	debug_return_int(-1);
+    sudo_lbuf_append(closure->lbuf, "(sudoUser=%s)", escaped);
+    free(escaped);
+    if (sudo_lbuf_error(closure->lbuf))
+	debug_return_int(-1);
+    closure->count++;
+
+    debug_return_int(0);
+}
+
+/*
+ * Builds up a filter that only matches entries with a sudoUser
+ * netgroup or non-Unix group in names that the user is a member of.
+ * Membership is checked locally, once per name.
+ * Returns NULL with errno set to ENOENT if there are no such groups.
+ */
+static char *
+sudo_ldap_build_pass2_resolved(struct passwd *pw, struct rbtree *names)
+{
+    char *filt = NULL, timebuffer[TIMEFILTER_LENGTH + 1];
+    struct pass2_closure closure;
+    struct sudo_lbuf lbuf;
+    debug_decl(sudo_ldap_build_pass2_resolved, SUDOERS_DEBUG_LDAP);
+
+    if (ldap_conf.timed) {
+	if (!sudo_ldap_timefilter(timebuffer, sizeof(timebuffer)))
+	    debug_return_str(NULL);
+    }
+
+    sudo_lbuf_init(&lbuf, NULL, 0, NULL, 0);
+    sudo_lbuf_append(&lbuf, "(&%s(|",
+	ldap_conf.search_filter ? ldap_conf.search_filter : "");
+
+    closure.pw = pw;
+    closure.lbuf = &lbuf;
+    closure.query_netgroups = def_use_netgroups &&
+	STAILQ_EMPTY(&ldap_conf.netgroup_base);
+    closure.count = 0;
+    closure.total = 0;
+    if (rbapply(names, sudo_ldap_pass2_add_name, &closure, inorder) != 0)
+	goto oom;
+    DPRINTF1("user %s is a member of %u of %u pass 2 groups", pw->pw_name,
+	closure.count, closure.total);
+    if (closure.count == 0) {
+	sudo_lbuf_destroy(&lbuf);
+	errno = ENOENT;
+	debug_return_str(NULL);
+    }
+
+    sudo_lbuf_append(&lbuf, ")%s)", ldap_conf.timed ? timebuffer : "");
+    if (sudo_lbuf_error(&lbuf) || (filt = strdup(lbuf.buf)) == NULL)
+	goto oom;
+    sudo_lbuf_destroy(&lbuf);
+
+    debug_return_str(filt);
+oom:
+    sudo_lbuf_destroy(&lbuf);
+    errno = ENOMEM;
+    debug_return_str(NULL);
+}
+
 static char *
 berval_iter(void **vp)
 {
@@ -1605,6 +2036,8 @@ sudo_ldap_close(struct sudo_nss *nss)
 	/* Free the handle container. */
 	if (handle->pw != NULL)
 	    sudo_pw_delref(handle->pw);
+	if (handle->group_names != NULL)
+	    rbdestroy(handle->group_names, free);
 	free_parse_tree(&handle->parse_tree);
 	free(handle);
 	nss->handle = NULL;
@@ -1612,6 +2045,316 @@ sudo_ldap_close(struct sudo_nss *nss)
     debug_return_int(0);
 }
 
+/*
+ * Return a string describing the LDAP settings that determine which
+ * sudoRole entries are stored in the local cache.
+ */
+static char *
+sudo_ldap_cache_source(void)
+{
+    struct ldap_config_str *conf_str;
+    struct sudo_lbuf lbuf;
+    char port[sizeof("-2147483648")];
+    char *source = NULL;
+    debug_decl(sudo_ldap_cache_source, SUDOERS_DEBUG_LDAP);
+
+    sudo_lbuf_init(&lbuf, NULL, 0, NULL, 0);
+    if (!STAILQ_EMPTY(&ldap_conf.uri)) {
+	STAILQ_FOREACH(conf_str, &ldap_conf.uri, entries) {
+	    sudo_lbuf_append(&lbuf, "uri=%s ", conf_str->val);
+	}
+    } else {
+	(void)snprintf(port, sizeof(port), "%d", ldap_conf.port);
+	sudo_lbuf_append(&lbuf, "host=%s port=%s ", ldap_conf.host, port);
+    }
+    STAILQ_FOREACH(conf_str, &ldap_conf.base, entries) {
+	sudo_lbuf_append(&lbuf, "base=%s ", conf_str->val);
+    }
+    sudo_lbuf_append(&lbuf, "binddn=%s filter=%s timed=%s",
+	ldap_conf.binddn ? ldap_conf.binddn : "",
+	ldap_conf.search_filter ? ldap_conf.search_filter : "",
+	ldap_conf.timed ? "yes" : "no");
+    if (!sudo_lbuf_error(&lbuf))
+	source = strdup(lbuf.buf);
+    sudo_lbuf_destroy(&lbuf);
+
+    debug_return_str(source);
+}
+
+/*
+ * Convert a sudoRole entry to an LDIF record for the local cache.
+ * The entry's dn and modifyTimestamp (if present) are stored in
+ * dnp and timestampp.  Returns the record, or NULL on memory
+ * allocation failure or if the entry is not a complete sudoRole,
+ * in which case errno is set to ENOENT.
+ */
+static char *
+sudo_ldap_cache_record(LDAP *ld, LDAPMessage *entry, char **dnp,
+    char **timestampp)
+{
+    struct berval **bv, **p;
+    struct sudo_lbuf lbuf;
+    char *dn, *ldif = NULL;
+    bool defaults = false, users = false, hosts = false, cmnds = false;
+    int i, rc, error = ENOMEM;
+    debug_decl(sudo_ldap_cache_record, SUDOERS_DEBUG_LDAP);
+
+    *dnp = NULL;
+    *timestampp = NULL;
+    if ((dn = ldap_get_dn(ld, entry)) == NULL) {
+	errno = ENOMEM;
+	debug_return_str(NULL);
+    }
+
+    sudo_lbuf_init(&lbuf, NULL, 0, NULL, 0);
+    if (!ldap_cache_append_attr(&lbuf, "dn", dn, strlen(dn)))
+	goto done;
+    for (i = 0; ldap_cache_attrs[i] != NULL; i++) {
+	char *attr = ldap_cache_attrs[i];
+
+	/* As in ldap_entry_to_priv(), time limits are optional. */
+	if (!ldap_conf.timed && strncasecmp(attr, "sudoNot", 7) == 0)
+	    continue;
+
+	bv = sudo_ldap_get_values_len(ld, entry, attr, &rc);
+	if (bv == NULL) {
+	    if (rc == LDAP_NO_MEMORY)
+		goto done;
+	    continue;
+	}
+	if (*bv == NULL) {
+	    ldap_value_free_len(bv);
+	    continue;
+	}
+
+	if (strcasecmp(attr, "modifyTimestamp") == 0) {
+	    /* Stored in the cache header, not in the record. */
+	    if (strspn((*bv)->bv_val, "0123456789.,+-Z") == (*bv)->bv_len) {
+		*timestampp = strndup((*bv)->bv_val, (*bv)->bv_len);
+		if (*timestampp == NULL) {
+		    ldap_value_free_len(bv);
+		    goto done;
+		}
+	    }
+	    ldap_value_free_len(bv);
+	    continue;
+	}
+	if (strcasecmp(attr, "cn") == 0) {
+	    if (strcasecmp((*bv)->bv_val, "defaults") == 0)
+		defaults = true;
+	} else if (strcasecmp(attr, "sudoUser") == 0) {
+	    users = true;
+	} else if (strcasecmp(attr, "sudoHost") == 0) {
+	    hosts = true;
+	} else if (strcasecmp(attr, "sudoCommand") == 0) {
+	    cmnds = true;
+	}
+	for (p = bv; *p != NULL; p++) {
+	    if (!ldap_cache_append_attr(&lbuf, attr, (*p)->bv_val,
+		    (*p)->bv_len)) {
+		ldap_value_free_len(bv);
+		goto done;
+	    }
+	}
+	ldap_value_free_len(bv);
+    }
+
+    /* Like sudoers_parse_ldif(), skip incomplete roles. */
+    if (!defaults && (!users || !hosts || !cmnds)) {
+	DPRINTF2("not caching incomplete sudoRole %s", dn);
+	error = ENOENT;
+	goto done;
+    }
+
+    if ((ldif = strdup(lbuf.buf)) != NULL) {
+	if ((*dnp = strdup(dn)) == NULL) {
+	    free(ldif);
+	    ldif = NULL;
+	}
+    }
+
+done:
+    sudo_lbuf_destroy(&lbuf);
+    ldap_memfree(dn);
+    if (ldif == NULL) {
+	free(*timestampp);
+	*timestampp = NULL;
+	errno = error;
+    }
+    debug_return_str(ldif);
+}
+
+/*
+ * Search each sudoers base for sudoRole entries matching filt.
+ * If dns_only is set, only the dn of each entry is retrieved and
+ * cached entries that are still present are marked as seen.
+ * Otherwise, the entries are added to the cache.
+ * Returns true on success, else false.
+ */
+static bool
+sudo_ldap_cache_search(LDAP *ld, struct ldap_cache *cache, const char *filt,
+    bool dns_only, unsigned int *countp)
+{
+    static char *no_attrs[] = { "1.1", NULL };
+    struct ldap_config_str *base;
+    struct timeval tv, *tvp = NULL;
+    LDAPMessage *entry, *result;
+    char *dn, *ldif, *timestamp;
+    int rc;
+    debug_decl(sudo_ldap_cache_search, SUDOERS_DEBUG_LDAP);
+
+    STAILQ_FOREACH(base, &ldap_conf.base, entries) {
+	if (ldap_conf.timeout > 0) {
+	    tv.tv_sec = ldap_conf.timeout;
+	    tv.tv_usec = 0;
+	    tvp = &tv;
+	}
+	result = NULL;
+	rc = ldap_search_ext_s(ld, base->val, LDAP_SCOPE_SUBTREE, filt,
+	    dns_only ? no_attrs : ldap_cache_attrs, 0, NULL, NULL, tvp, 0,
+	    &result);
+	if (rc != LDAP_SUCCESS) {
+	    /* A partial result cannot be cached. */
+	    DPRINTF1("ldap cache search in %s failed: %s", base->val,
+		ldap_err2string(rc));
+	    ldap_msgfree(result);
+	    debug_return_bool(false);
+	}
+	LDAP_FOREACH(entry, ld, result) {
+	    if (dns_only) {
+		if ((dn = ldap_get_dn(ld, entry)) == NULL)
+		    goto bad;
+		ldap_cache_mark(cache, dn);
+		ldap_memfree(dn);
+	    } else {
+		ldif = sudo_ldap_cache_record(ld, entry, &dn, &timestamp);
+		if (ldif == NULL) {
+		    if (errno == ENOENT)
+			continue;
+		    goto bad;
+		}
+		if (!ldap_cache_add(cache, dn, ldif, timestamp)) {
+		    free(timestamp);
+		    goto bad;
+		}
+		free(timestamp);
+	    }
+	    (*countp)++;
+	}
+	ldap_msgfree(result);
+    }
+    debug_return_bool(true);
+bad:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    ldap_msgfree(result);
+    debug_return_bool(false);
+}
+
+/*
+ * Bring the local sudoRole cache up to date.  If the cache has a
+ * modification time, only entries changed since then are fetched,
+ * along with the dn of all entries to detect deletions.
+ * Otherwise, all sudoRole entries are fetched.
+ * Returns true on success, else false.
+ */
+static bool
+sudo_ldap_cache_refresh(LDAP *ld, const char *source)
+{
+    const char *filter = ldap_conf.search_filter ?
+	ldap_conf.search_filter : "(objectClass=sudoRole)";
+    char *filt = NULL, since[sizeof("yyyymmddHHMMSSZ")];
+    unsigned int nchanged = 0, npresent = 0;
+    struct ldap_cache *cache;
+    const char *timestamp;
+    struct tm *tm = NULL;
+    time_t mtime = -1;
+    bool ret = false;
+    debug_decl(sudo_ldap_cache_refresh, SUDOERS_DEBUG_LDAP);
+
+    if ((cache = ldap_cache_read(ldap_conf.cache_file, source)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+
+    if ((timestamp = ldap_cache_timestamp(cache)) != NULL)
+	mtime = parse_gentime(timestamp);
+    if (mtime != -1) {
+	mtime -= LDAP_CACHE_MARGIN;
+	tm = gmtime(&mtime);
+    }
+    if (tm != NULL && strftime(since, sizeof(since), "%Y%m%d%H%M%SZ", tm) != 0) {
+	if (asprintf(&filt, "(&%s(modifyTimestamp>=%s))", filter, since) == -1) {
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    goto done;
+	}
+	DPRINTF1("refreshing ldap cache: %s", filt);
+	if (!sudo_ldap_cache_search(ld, cache, filt, false, &nchanged))
+	    goto done;
+
+	/* Entries no longer in the directory are removed from the cache. */
+	if (!sudo_ldap_cache_search(ld, cache, filter, true, &npresent))
+	    goto done;
+	DPRINTF1("ldap cache: %u changed entries, %u present", nchanged,
+	    npresent);
+    } else {
+	DPRINTF1("fetching all entries for ldap cache: %s", filter);
+	if (!sudo_ldap_cache_search(ld, cache, filter, false, &nchanged))
+	    goto done;
+	DPRINTF1("ldap cache: %u entries", nchanged);
+    }
+    ret = ldap_cache_write(cache, ldap_conf.cache_file, source);
+
+done:
+    free(filt);
+    ldap_cache_free(cache);
+    debug_return_bool(ret);
+}
+
+/*
+ * Fill in the handle's parse tree from the local sudoRole cache.
+ * If ld is not NULL, the cache is refreshed first, otherwise it is
+ * only used if it is fresh.  Returns true on success, else false.
+ */
+static bool
+sudo_ldap_cache_load(struct sudo_ldap_handle *handle, LDAP *ld)
+{
+    char *source;
+    bool ret = false;
+    FILE *fp;
+    debug_decl(sudo_ldap_cache_load, SUDOERS_DEBUG_LDAP);
+
+    /* Netgroups from netgroup_base can only be resolved via LDAP. */
+    if (ldap_conf.cache_file == NULL || ldap_conf.cache_timeout <= 0 ||
+	    !STAILQ_EMPTY(&ldap_conf.netgroup_base))
+	debug_return_bool(false);
+
+    if ((source = sudo_ldap_cache_source()) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    if (ld != NULL && !sudo_ldap_cache_refresh(ld, source))
+	goto done;
+    fp = ldap_cache_open_fresh(ldap_conf.cache_file, source,
+	ldap_conf.cache_timeout);
+    if (fp == NULL)
+	goto done;
+
+    /* Unlike the LDAP query results, all roles are stored. */
+    if (!sudoers_parse_ldif(&handle->parse_tree, fp, NULL, true)) {
+	free_parse_tree(&handle->parse_tree);
+	goto done;
+    }
+    (void)userspec_index_build(&handle->parse_tree);
+    (void)cmnd_index_build(&handle->parse_tree);
+    (void)alias_index_build(&handle->parse_tree);
+    handle->cached = true;
+    ret = true;
+
+done:
+    free(source);
+    debug_return_bool(ret);
+}
+
 /*
  * Open a connection to the LDAP server.
  * Returns 0 on success and non-zero on failure.
@@ -1622,7 +2365,7 @@ sudo_ldap_open(struct sudo_nss *nss)
     LDAP *ld;
     int rc = -1;
     bool ldapnoinit = false;
-    struct sudo_ldap_handle *handle;
+    struct sudo_ldap_handle *handle = NULL;
     debug_decl(sudo_ldap_open, SUDOERS_DEBUG_LDAP);
 
     if (nss->handle != NULL) {
@@ -1634,6 +2377,23 @@ sudo_ldap_open(struct sudo_nss *nss)
     if (!sudo_ldap_read_config())
 	goto done;
 
+    /* Create a handle container. */
+    handle = calloc(1, sizeof(struct sudo_ldap_handle));
+    if (handle == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    /* handle->ld = NULL; */
+    /* handle->pw = NULL; */
+    init_parse_tree(&handle->parse_tree, NULL, NULL);
+
+    /* No need to contact the server if the local cache is fresh. */
+    if (sudo_ldap_cache_load(handle, NULL)) {
+	DPRINTF1("using sudoers cache %s", ldap_conf.cache_file);
+	rc = LDAP_SUCCESS;
+	goto done;
+    }
+
     /* Prevent reading of user ldaprc and system defaults. */
     if (sudo_getenv("LDAPNOINIT") == NULL) {
 	if (sudo_setenv("LDAPNOINIT", "1", true) == 0)
@@ -1703,19 +2463,21 @@ sudo_ldap_open(struct sudo_nss *nss)
     if (rc != LDAP_SUCCESS)
 	goto done;
 
-    /* Create a handle container. */
-    handle = calloc(1, sizeof(struct sudo_ldap_handle));
-    if (handle == NULL) {
-	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
-	rc = -1;
-	goto done;
+    /* Refresh the local cache; the connection is not needed if it works. */
+    if (sudo_ldap_cache_load(handle, ld)) {
+	DPRINTF1("refreshed sudoers cache %s", ldap_conf.cache_file);
+	ldap_unbind_ext_s(ld, NULL, NULL);
+    } else {
+	handle->ld = ld;
     }
-    handle->ld = ld;
-    /* handle->pw = NULL; */
-    init_parse_tree(&handle->parse_tree, NULL, NULL);
-    nss->handle = handle;
 
 done:
+    if (rc == LDAP_SUCCESS) {
+	nss->handle = handle;
+    } else if (handle != NULL) {
+	free_parse_tree(&handle->parse_tree);
+	free(handle);
+    }
     debug_return_int(rc == LDAP_SUCCESS ? 0 : -1);
 }
 
@@ -1738,7 +2500,7 @@ sudo_ldap_getdefs(struct sudo_nss *nss)
     }
 
     /* Use cached result if present. */
-    if (cached)
+    if (cached || handle->cached)
 	debug_return_int(0);
 
     filt = sudo_ldap_build_default_filter();
@@ -1862,6 +2624,80 @@ sudo_ldap_result_add_entry(struct ldap_result *lres, LDAPMessage *entry)
     debug_return_ptr(&lres->entries[lres->nentries - 1]);
 }
 
+/*
+ * Search all the sudoers bases for filt, without waiting for the results.
+ * Returns the number of searches, which are stored in ops.
+ */
+static size_t
+sudo_ldap_search_bases(LDAP *ld, struct ldap_search_op *ops, const char *filt,
+    char **attrs)
+{
+    struct ldap_config_str *base;
+    size_t nops = 0;
+    debug_decl(sudo_ldap_search_bases, SUDOERS_DEBUG_LDAP);
+
+    DPRINTF1("ldap search '%s'", filt);
+    STAILQ_FOREACH(base, &ldap_conf.base, entries) {
+	DPRINTF1("searching from base '%s'",
+	    base->val);
+	sudo_ldap_search_start(ld, &ops[nops++], base->val, filt, attrs);
+    }
+    debug_return_size_t(nops);
+}
+
+/*
+ * Add the entries from the searches in ops to lres.  If check_groups
+ * is set, only entries with a sudoUser netgroup or non-Unix group
+ * that matches pw are added.  The search results are owned by lres.
+ * Returns false if out of memory, else true.
+ */
+static bool
+sudo_ldap_result_add_ops(struct ldap_result *lres, LDAP *ld, struct passwd *pw,
+    struct ldap_search_op *ops, size_t nops, int pass, bool check_groups)
+{
+    LDAPMessage *entry, *result;
+    unsigned int nentries = 0;
+    size_t i, nbytes = 0;
+    debug_decl(sudo_ldap_result_add_ops, SUDOERS_DEBUG_LDAP);
+
+    for (i = 0; i < nops; i++) {
+	if (ops[i].rc != LDAP_SUCCESS) {
+	    DPRINTF1("ldap search pass %d failed: %s", pass,
+		ldap_err2string(ops[i].rc));
+	    continue;
+	}
+	nentries += ops[i].nentries;
+	nbytes += ops[i].nbytes;
+
+	/* Add the search result to list of search results. */
+	DPRINTF1("adding search result");
+	if (sudo_ldap_result_add_search(lres, ld, ops[i].result) == NULL)
+	    debug_return_bool(false);
+	result = ops[i].result;
+	ops[i].result = NULL;	/* now owned by lres */
+	LDAP_FOREACH(entry, ld, result) {
+	    if (check_groups) {
+		/* Check non-unix group in 2nd pass. */
+		switch (sudo_ldap_check_non_unix_group(ld, entry, pw)) {
+		case -1:
+		    debug_return_bool(false);
+		case false:
+		    continue;
+		default:
+		    break;
+		}
+	    }
+	    if (sudo_ldap_result_add_entry(lres, entry) == NULL)
+		debug_return_bool(false);
+	}
+	DPRINTF1("result now has %d entries", lres->nentries);
+    }
+    DPRINTF1("ldap search pass %d: received %u entries, %zu bytes", pass,
+	nentries, nbytes);
+
+    debug_return_bool(true);
+}
+
 /*
  * Perform the LDAP query for the user.  The caller is responsible for
  * freeing the result with sudo_ldap_result_free().
@@ -1869,14 +2705,15 @@ sudo_ldap_result_add_entry(struct ldap_result *lres, LDAPMessage *entry)
 static struct ldap_result *
 sudo_ldap_result_get(struct sudo_nss *nss, struct passwd *pw)
 {
+    static char *group_attrs[] = { "sudoUser", NULL };
     struct sudo_ldap_handle *handle = nss->handle;
     struct ldap_config_str *base;
     struct ldap_result *lres;
-    struct timeval tv, *tvp = NULL;
-    LDAPMessage *entry, *result;
+    struct ldap_search_op *ops = NULL;
     LDAP *ld = handle->ld;
-    char *filt = NULL;
-    int pass, rc;
+    char *filt1 = NULL, *filt2 = NULL;
+    size_t i, nbases = 0, nops1 = 0, nops2 = 0;
+    bool resolve = false;
     debug_decl(sudo_ldap_result_get, SUDOERS_DEBUG_LDAP);
 
     /*
@@ -1892,6 +2729,12 @@ sudo_ldap_result_get(struct sudo_nss *nss, struct passwd *pw)
      * The second pass will return all the entries that contain non-
      * Unix groups, including netgroups.  Then we take the non-Unix
      * groups returned and try to match them against the username.
+     * With SUDOERS_RESOLVE_GROUPS, the second pass instead fetches
+     * just the sudoUser values (once per handle) to find the groups
+     * the user is a member of, then only the entries for those groups.
+     *
+     * Both passes are sent to the server for every base before waiting
+     * for any of the results, so they only cost a single round trip.
      *
      * Since we have to sort the possible entries before we make a
      * decision, we perform the queries and store all of the results in
@@ -1900,69 +2743,85 @@ sudo_ldap_result_get(struct sudo_nss *nss, struct passwd *pw)
     lres = sudo_ldap_result_alloc();
     if (lres == NULL)
 	goto oom;
-    for (pass = 0; pass < 2; pass++) {
-	filt = pass ? sudo_ldap_build_pass2() : sudo_ldap_build_pass1(ld, pw);
-	if (filt != NULL) {
-	    DPRINTF1("ldap search '%s'", filt);
-	    STAILQ_FOREACH(base, &ldap_conf.base, entries) {
-		DPRINTF1("searching from base '%s'",
-		    base->val);
-		if (ldap_conf.timeout > 0) {
-		    tv.tv_sec = ldap_conf.timeout;
-		    tv.tv_usec = 0;
-		    tvp = &tv;
-		}
-		result = NULL;
-		rc = ldap_search_ext_s(ld, base->val, LDAP_SCOPE_SUBTREE, filt,
-		    NULL, 0, NULL, NULL, tvp, 0, &result);
-		if (rc != LDAP_SUCCESS) {
-		    DPRINTF1("ldap search pass %d failed: %s", pass + 1,
-			ldap_err2string(rc));
-		    continue;
-		}
+    STAILQ_FOREACH(base, &ldap_conf.base, entries) {
+	nbases++;
+    }
+    if ((ops = calloc(nbases * 2, sizeof(*ops))) == NULL)
+	goto oom;
 
-		/* Add the search result to list of search results. */
-		DPRINTF1("adding search result");
-		if (sudo_ldap_result_add_search(lres, ld, result) == NULL)
-		    goto oom;
-		LDAP_FOREACH(entry, ld, result) {
-		    if (pass != 0) {
-			/* Check non-unix group in 2nd pass. */
-			switch (sudo_ldap_check_non_unix_group(ld, entry, pw)) {
-			case -1:
-			    goto oom;
-			case false:
-			    continue;
-			default:
-			    break;
-			}
-		    }
-		    if (sudo_ldap_result_add_entry(lres, entry) == NULL)
-			goto oom;
-		}
-		DPRINTF1("result now has %d entries", lres->nentries);
+    if ((filt1 = sudo_ldap_build_pass1(ld, pw)) != NULL) {
+	nops1 = sudo_ldap_search_bases(ld, ops, filt1, NULL);
+    } else if (errno != ENOENT) {
+	/* Out of memory? */
+	goto oom;
+    }
+    if ((filt2 = sudo_ldap_build_pass2()) != NULL) {
+	resolve = ldap_conf.resolve_groups;
+	if (!resolve || handle->group_names == NULL) {
+	    nops2 = sudo_ldap_search_bases(ld, ops + nops1, filt2,
+		resolve ? group_attrs : NULL);
+	}
+    } else if (errno != ENOENT) {
+	goto oom;
+    }
+    sudo_ldap_search_wait(ld, ops, nops1 + nops2);
+
+    if (resolve) {
+	struct rbtree *names = handle->group_names;
+
+	if (names == NULL) {
+	    bool complete = true;
+
+	    for (i = nops1; i < nops1 + nops2; i++) {
+		if (ops[i].rc != LDAP_SUCCESS)
+		    complete = false;
 	    }
-	    free(filt);
-	    filt = NULL;
+	    names = sudo_ldap_collect_group_names(ld, ops + nops1, nops2);
+	    if (names == NULL)
+		goto oom;
+	    /* The sudoUser values don't depend on the user, cache them. */
+	    if (complete)
+		handle->group_names = names;
+	}
+	free(filt2);
+	nops2 = 0;
+	filt2 = sudo_ldap_build_pass2_resolved(pw, names);
+	if (names != handle->group_names)
+	    rbdestroy(names, free);
+	if (filt2 != NULL) {
+	    nops2 = sudo_ldap_search_bases(ld, ops + nops1, filt2, NULL);
+	    sudo_ldap_search_wait(ld, ops + nops1, nops2);
 	} else if (errno != ENOENT) {
-	    /* Out of memory? */
 	    goto oom;
 	}
     }
 
+    if (!sudo_ldap_result_add_ops(lres, ld, pw, ops, nops1, 1, false))
+	goto oom;
+    if (!sudo_ldap_result_add_ops(lres, ld, pw, ops + nops1, nops2, 2, !resolve))
+	goto oom;
+
     /* Sort the entries by the sudoOrder attribute. */
     if (lres->nentries != 0) {
 	DPRINTF1("sorting remaining %d entries", lres->nentries);
 	qsort(lres->entries, lres->nentries, sizeof(lres->entries[0]),
 	    ldap_entry_compare);
     }
+    goto done;
 
-    debug_return_ptr(lres);
 oom:
     sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
-    free(filt);
     sudo_ldap_result_free(lres);
-    debug_return_ptr(NULL);
+    lres = NULL;
+done:
+    if (ops != NULL) {
+	for (i = 0; i < nops1 + nops2; i++)
+	    ldap_msgfree(ops[i].result);
+	free(ops);
+    }
+    free(filt1);
+    free(filt2);
+    debug_return_ptr(lres);
 }
 
 /*
@@ -1983,6 +2842,10 @@ sudo_ldap_query(struct sudo_nss *nss, struct passwd *pw)
 	debug_return_int(-1);
     }
 
+    /* The local cache contains all sudoRole entries. */
+    if (handle->cached)
+	debug_return_int(0);
+
     /* Use cached result if it matches pw. */
     if (handle->pw != NULL) {
 	if (pw == handle->pw) {
@@ -0,0 +1,558 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Local cache of sudoRole entries, enabled by the SUDOERS_CACHE setting
+ * in ldap.conf.  The cache is an LDIF file that can be read directly
+ * by sudoers_parse_ldif().  A short header of comment lines records
+ * the LDAP configuration the entries were fetched with and the highest
+ * modifyTimestamp seen, which is used to only fetch changed entries
+ * when the cache is refreshed.
+ *
+ * This file only deals with storing the entries, fetching them from
+ * the directory is done in ldap.c.  The file is opened via
+ * sudo_open_root_cache() and replaced atomically when written.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_STRINGS_H
+# include <strings.h>
+#endif /* HAVE_STRINGS_H */
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "sudoers.h"
+#include "sudo_lbuf.h"
+#include "sudo_ldap.h"
+#include "redblack.h"
+
+#define LDAP_CACHE_MAGIC	"# sudoers LDAP cache v1"
+#define LDAP_CACHE_SOURCE	"# source: "
+#define LDAP_CACHE_TIMESTAMP	"# modifyTimestamp: "
+
+struct ldap_cache_entry {
+    char *dn;
+    char *ldif;		/* complete LDIF record, starting with the dn */
+    bool seen;		/* added or still present in the directory */
+};
+
+struct ldap_cache {
+    struct rbtree *entries;
+    char *timestamp;	/* highest modifyTimestamp of the entries */
+    unsigned int count;
+};
+
+static int
+ldap_cache_entry_compare(const void *v1, const void *v2)
+{
+    const struct ldap_cache_entry *e1 = v1, *e2 = v2;
+
+    return strcasecmp(e1->dn, e2->dn);
+}
+
+static void
+ldap_cache_entry_free(void *v)
+{
+    struct ldap_cache_entry *entry = v;
+
+    free(entry->dn);
+    free(entry->ldif);
+    free(entry);
+}
+
+/*
+ * Open the cache file for reading and check that it is safe to use.
+ * Returns a FILE pointer on success, else NULL.
+ */
+static FILE *
+ldap_cache_fopen(const char *path, struct stat *sb)
+{
+    FILE *fp;
+    int fd;
+    debug_decl(ldap_cache_fopen, SUDOERS_DEBUG_LDAP);
+
+    fd = sudo_open_root_cache(path, O_RDONLY, S_IWGRP|S_IWOTH, sb);
+    if (fd == -1)
+	debug_return_ptr(NULL);
+    if ((fp = fdopen(fd, "r")) == NULL) {
+	close(fd);
+	debug_return_ptr(NULL);
+    }
+
+    debug_return_ptr(fp);
+}
+
+/*
+ * Read the cache header.  Returns true if it is a valid cache for
+ * the given source, filling in timestamp (which may be NULL).
+ */
+static bool
+ldap_cache_read_header(FILE *fp, const char *source, char **timestamp)
+{
+    char *line = NULL;
+    size_t linesize = 0;
+    ssize_t len;
+    bool ret = false;
+    debug_decl(ldap_cache_read_header, SUDOERS_DEBUG_LDAP);
+
+    *timestamp = NULL;
+
+    /* Magic number. */
+    if ((len = getdelim(&line, &linesize, '\n', fp)) == -1)
+	goto done;
+    if (len > 0 && line[len - 1] == '\n')
+	line[--len] = '\0';
+    if (strcmp(line, LDAP_CACHE_MAGIC) != 0)
+	goto done;
+
+    /* The LDAP configuration used when fetching the entries. */
+    if ((len = getdelim(&line, &linesize, '\n', fp)) == -1)
+	goto done;
+    if (len > 0 && line[len - 1] == '\n')
+	line[--len] = '\0';
+    if (strncmp(line, LDAP_CACHE_SOURCE, sizeof(LDAP_CACHE_SOURCE) - 1) != 0 ||
+	    strcmp(line + sizeof(LDAP_CACHE_SOURCE) - 1, source) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "LDAP cache is for a different configuration");
+	goto done;
+    }
+
+    /* Highest modifyTimestamp, may be empty. */
+    if ((len = getdelim(&line, &linesize, '\n', fp)) == -1)
+	goto done;
+    if (len > 0 && line[len - 1] == '\n')
+	line[--len] = '\0';
+    if (strncmp(line, LDAP_CACHE_TIMESTAMP,
+	    sizeof(LDAP_CACHE_TIMESTAMP) - 1) != 0)
+	goto done;
+    if (line[sizeof(LDAP_CACHE_TIMESTAMP) - 1] != '\0') {
+	*timestamp = strdup(line + sizeof(LDAP_CACHE_TIMESTAMP) - 1);
+	if (*timestamp == NULL)
+	    goto done;
+    }
+    ret = true;
+
+done:
+    free(line);
+    debug_return_bool(ret);
+}
+
+/*
+ * Open the cache file if it is valid for source and was written less
+ * than timeout seconds ago.  The returned FILE pointer is suitable
+ * for use with sudoers_parse_ldif().
+ */
+FILE *
+ldap_cache_open_fresh(const char *path, const char *source, int timeout)
+{
+    char *timestamp;
+    struct stat sb;
+    time_t now;
+    FILE *fp;
+    debug_decl(ldap_cache_open_fresh, SUDOERS_DEBUG_LDAP);
+
+    if (timeout <= 0)
+	debug_return_ptr(NULL);
+    if ((fp = ldap_cache_fopen(path, &sb)) == NULL)
+	debug_return_ptr(NULL);
+
+    now = time(NULL);
+    if (sb.st_mtime > now || now - sb.st_mtime >= timeout) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "LDAP cache %s is stale", path);
+	goto bad;
+    }
+    if (!ldap_cache_read_header(fp, source, &timestamp))
+	goto bad;
+    free(timestamp);
+    rewind(fp);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "using LDAP cache %s", path);
+    debug_return_ptr(fp);
+bad:
+    fclose(fp);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Create a new, empty, cache.
+ */
+struct ldap_cache *
+ldap_cache_alloc(void)
+{
+    struct ldap_cache *cache;
+    debug_decl(ldap_cache_alloc, SUDOERS_DEBUG_LDAP);
+
+    if ((cache = calloc(1, sizeof(*cache))) == NULL)
+	debug_return_ptr(NULL);
+    if ((cache->entries = rbcreate(ldap_cache_entry_compare)) == NULL) {
+	free(cache);
+	debug_return_ptr(NULL);
+    }
+    debug_return_ptr(cache);
+}
+
+/*
+ * Free a cache created by ldap_cache_alloc() or ldap_cache_read().
+ */
+void
+ldap_cache_free(struct ldap_cache *cache)
+{
+    debug_decl(ldap_cache_free, SUDOERS_DEBUG_LDAP);
+
+    if (cache != NULL) {
+	rbdestroy(cache->entries, ldap_cache_entry_free);
+	free(cache->timestamp);
+	free(cache);
+    }
+
+    debug_return;
+}
+
+/*
+ * Store the LDIF record for dn in the cache, replacing any existing
+ * record.  The cache takes ownership of dn and ldif, which are freed
+ * on error.  Returns true on success, false on memory allocation failure.
+ */
+static bool
+ldap_cache_insert(struct ldap_cache *cache, char *dn, char *ldif, bool seen)
+{
+    struct ldap_cache_entry *entry;
+    struct rbnode *node;
+    debug_decl(ldap_cache_insert, SUDOERS_DEBUG_LDAP);
+
+    if ((entry = malloc(sizeof(*entry))) == NULL) {
+	free(dn);
+	free(ldif);
+	debug_return_bool(false);
+    }
+    entry->dn = dn;
+    entry->ldif = ldif;
+    entry->seen = seen;
+
+    switch (rbinsert(cache->entries, entry, &node)) {
+    case 0:
+	cache->count++;
+	break;
+    case 1:
+	/* Replace the existing record. */
+	ldap_cache_entry_free(node->data);
+	node->data = entry;
+	break;
+    default:
+	ldap_cache_entry_free(entry);
+	debug_return_bool(false);
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Add the LDIF record for dn fetched from the directory, replacing
+ * any existing record.  The cache takes ownership of dn and ldif.
+ * The timestamp is the entry's modifyTimestamp, if any.
+ * Returns true on success, false on memory allocation failure.
+ */
+bool
+ldap_cache_add(struct ldap_cache *cache, char *dn, char *ldif,
+    const char *timestamp)
+{
+    debug_decl(ldap_cache_add, SUDOERS_DEBUG_LDAP);
+
+    if (!ldap_cache_insert(cache, dn, ldif, true))
+	debug_return_bool(false);
+
+    /* Generalized time values with the same format sort lexically. */
+    if (timestamp != NULL && (cache->timestamp == NULL ||
+	    strcmp(timestamp, cache->timestamp) > 0)) {
+	char *copy = strdup(timestamp);
+	if (copy == NULL)
+	    debug_return_bool(false);
+	free(cache->timestamp);
+	cache->timestamp = copy;
+    }
+
+    debug_return_bool(true);
+}
+
+/*
+ * Note that dn is still present in the directory.
+ */
+void
+ldap_cache_mark(struct ldap_cache *cache, const char *dn)
+{
+    struct ldap_cache_entry key;
+    struct rbnode *node;
+    debug_decl(ldap_cache_mark, SUDOERS_DEBUG_LDAP);
+
+    key.dn = (char *)dn;
+    if ((node = rbfind(cache->entries, &key)) != NULL) {
+	struct ldap_cache_entry *entry = node->data;
+	entry->seen = true;
+    }
+
+    debug_return;
+}
+
+/*
+ * Return the highest modifyTimestamp of the cached entries, or NULL
+ * if it is not known.
+ */
+const char *
+ldap_cache_timestamp(struct ldap_cache *cache)
+{
+    return cache->timestamp;
+}
+
+/*
+ * Append an attribute and value to an LDIF record.  Values that are
+ * not safe strings as per RFC 2849 are base64-encoded.
+ * Returns true on success, false on memory allocation failure.
+ */
+bool
+ldap_cache_append_attr(struct sudo_lbuf *lbuf, const char *name,
+    const char *value, size_t len)
+{
+    const unsigned char *cp = (const unsigned char *)value;
+    bool safe = true;
+    char *encoded;
+    size_t elen, i;
+    debug_decl(ldap_cache_append_attr, SUDOERS_DEBUG_LDAP);
+
+    if (len != 0 && (cp[0] == ' ' || cp[0] == ':' || cp[0] == '<' ||
+	    cp[len - 1] == ' '))
+	safe = false;
+    for (i = 0; safe && i < len; i++) {
+	if (cp[i] == '\0' || cp[i] == '\n' || cp[i] == '\r' || cp[i] > 127)
+	    safe = false;
+    }
+    if (safe) {
+	/* The value may not be NUL-terminated. */
+	if ((encoded = strndup(value, len)) == NULL)
+	    debug_return_bool(false);
+	sudo_lbuf_append(lbuf, "%s: %s\n", name, encoded);
+    } else {
+	elen = ((len + 2) / 3) * 4 + 1;
+	if ((encoded = malloc(elen)) == NULL)
+	    debug_return_bool(false);
+	if (base64_encode(cp, len, encoded, elen) == (size_t)-1) {
+	    free(encoded);
+	    debug_return_bool(false);
+	}
+	sudo_lbuf_append(lbuf, "%s:: %s\n", name, encoded);
+    }
+    free(encoded);
+
+    debug_return_bool(!sudo_lbuf_error(lbuf));
+}
+
+/*
+ * Extract the dn from the first line of an LDIF record.
+ */
+static char *
+ldap_cache_record_dn(const char *record)
+{
+    const char *cp = record + 3;
+    size_t len;
+    char *dn;
+    debug_decl(ldap_cache_record_dn, SUDOERS_DEBUG_LDAP);
+
+    if (strncasecmp(record, "dn:", 3) != 0)
+	debug_return_str(NULL);
+    len = strcspn(record, "\n");
+    if (*cp == ':') {
+	/* Base64-encoded. */
+	for (cp++; *cp == ' '; cp++)
+	    continue;
+	len -= cp - record;
+	if ((dn = malloc(len + 1)) == NULL)
+	    debug_return_str(NULL);
+	len = base64_decode(cp, (unsigned char *)dn, len);
+	if (len == (size_t)-1) {
+	    free(dn);
+	    debug_return_str(NULL);
+	}
+	dn[len] = '\0';
+    } else {
+	while (*cp == ' ')
+	    cp++;
+	dn = strndup(cp, len - (cp - record));
+    }
+    debug_return_str(dn);
+}
+
+/*
+ * Read the cache file for an incremental refresh.  If the file does
+ * not exist or is for a different source, an empty cache is returned.
+ * Existing entries are not marked as seen.
+ * Returns NULL on memory allocation failure.
+ */
+struct ldap_cache *
+ldap_cache_read(const char *path, const char *source)
+{
+    struct ldap_cache *cache;
+    struct sudo_lbuf lbuf;
+    char *dn, *ldif, *line = NULL;
+    size_t linesize = 0;
+    struct stat sb;
+    ssize_t len;
+    FILE *fp;
+    debug_decl(ldap_cache_read, SUDOERS_DEBUG_LDAP);
+
+    if ((cache = ldap_cache_alloc()) == NULL)
+	debug_return_ptr(NULL);
+    if ((fp = ldap_cache_fopen(path, &sb)) == NULL)
+	debug_return_ptr(cache);
+    if (!ldap_cache_read_header(fp, source, &cache->timestamp)) {
+	/* Not a usable cache, start from scratch. */
+	fclose(fp);
+	debug_return_ptr(cache);
+    }
+
+    sudo_lbuf_init(&lbuf, NULL, 0, NULL, 0);
+    for (;;) {
+	len = getdelim(&line, &linesize, '\n', fp);
+
+	/* Blank line or EOF terminates a record. */
+	if (len <= 1) {
+	    if (lbuf.len != 0) {
+		if (sudo_lbuf_error(&lbuf))
+		    goto oom;
+		if ((ldif = strdup(lbuf.buf)) == NULL)
+		    goto oom;
+		if ((dn = ldap_cache_record_dn(ldif)) == NULL) {
+		    /* Skip invalid record. */
+		    free(ldif);
+		} else {
+		    /* Not seen until found in the directory. */
+		    if (!ldap_cache_insert(cache, dn, ldif, false))
+			goto oom;
+		}
+		lbuf.len = 0;
+	    }
+	    if (len == -1)
+		break;
+	    continue;
+	}
+	sudo_lbuf_append(&lbuf, "%s", line);
+    }
+    sudo_lbuf_destroy(&lbuf);
+    free(line);
+    fclose(fp);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO, "read %u entries from LDAP cache %s",
+	cache->count, path);
+    debug_return_ptr(cache);
+oom:
+    sudo_lbuf_destroy(&lbuf);
+    free(line);
+    fclose(fp);
+    ldap_cache_free(cache);
+    debug_return_ptr(NULL);
+}
+
+struct ldap_cache_write_closure {
+    FILE *fp;
+    unsigned int count;
+};
+
+static int
+ldap_cache_write_entry(void *v, void *cookie)
+{
+    struct ldap_cache_entry *entry = v;
+    struct ldap_cache_write_closure *closure = cookie;
+
+    /* Skip entries no longer present in the directory. */
+    if (entry->seen) {
+	fputs(entry->ldif, closure->fp);
+	putc('\n', closure->fp);
+	closure->count++;
+    }
+    return 0;
+}
+
+/*
+ * Write the cache entries that have been added or marked as seen
+ * to path.  The file is written to a temporary file and renamed
+ * so readers always see a complete cache.
+ * Returns true on success, else false.
+ */
+bool
+ldap_cache_write(struct ldap_cache *cache, const char *path,
+    const char *source)
+{
+    struct ldap_cache_write_closure closure;
+    char *tmpfile = NULL;
+    int fd = -1;
+    bool ret = false;
+    debug_decl(ldap_cache_write, SUDOERS_DEBUG_LDAP);
+
+    if (!sudo_secure_root_cache_dir(path))
+	debug_return_bool(false);
+    if (asprintf(&tmpfile, "%s.XXXXXX", path) == -1)
+	debug_return_bool(false);
+    if ((fd = mkstemps(tmpfile, 0)) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to create %s", tmpfile);
+	free(tmpfile);
+	debug_return_bool(false);
+    }
+    if ((closure.fp = fdopen(fd, "w")) == NULL) {
+	close(fd);
+	goto done;
+    }
+    closure.count = 0;
+
+    fprintf(closure.fp, "%s\n%s%s\n%s%s\n\n", LDAP_CACHE_MAGIC,
+	LDAP_CACHE_SOURCE, source, LDAP_CACHE_TIMESTAMP,
+	cache->timestamp ? cache->timestamp : "");
+    rbapply(cache->entries, ldap_cache_write_entry, &closure, inorder);
+    if (fflush(closure.fp) != 0 || ferror(closure.fp) ||
+	    fsync(fileno(closure.fp)) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write %s", tmpfile);
+	fclose(closure.fp);
+	goto done;
+    }
+    if (fclose(closure.fp) != 0)
+	goto done;
+    if (rename(tmpfile, path) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to rename %s to %s", tmpfile, path);
+	goto done;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO, "wrote %u entries to LDAP cache %s",
+	closure.count, path);
+    ret = true;
+
+done:
+    if (!ret)
+	unlink(tmpfile);
+    free(tmpfile);
+    debug_return_bool(ret);
+}
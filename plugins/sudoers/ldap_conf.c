@@ -73,6 +73,9 @@ extern int ldapssl_set_strength(LDAP *ldap, int strength);
 /* Default netgroup search filter. */
 #define DEFAULT_NETGROUP_SEARCH_FILTER	"(objectClass=nisNetgroup)"
 
+/* Default number of seconds the local sudoRole cache may be used for. */
+#define DEFAULT_CACHE_TIMEOUT	300
+
 /* LDAP configuration structure */
 struct ldap_config ldap_conf;
 
@@ -136,8 +139,11 @@ static struct ldap_config_table ldap_conf_global[] = {
     { "sudoers_base", CONF_LIST_STR, -1, &ldap_conf.base },
     { "sudoers_timed", CONF_BOOL, -1, &ldap_conf.timed },
     { "sudoers_search_filter", CONF_STR, -1, &ldap_conf.search_filter },
+    { "sudoers_resolve_groups", CONF_BOOL, -1, &ldap_conf.resolve_groups },
     { "netgroup_base", CONF_LIST_STR, -1, &ldap_conf.netgroup_base },
     { "netgroup_search_filter", CONF_STR, -1, &ldap_conf.netgroup_search_filter },
+    { "sudoers_cache", CONF_STR, -1, &ldap_conf.cache_file },
+    { "sudoers_cache_timeout", CONF_INT, -1, &ldap_conf.cache_timeout },
 #ifdef HAVE_LDAP_SASL_INTERACTIVE_BIND_S
     { "use_sasl", CONF_BOOL, -1, &ldap_conf.use_sasl },
     { "sasl_mech", CONF_STR, -1, &ldap_conf.sasl_mech },
@@ -543,6 +549,7 @@ sudo_ldap_read_config(void)
     ldap_conf.use_sasl = -1;
     ldap_conf.rootuse_sasl = -1;
     ldap_conf.deref = -1;
+    ldap_conf.cache_timeout = DEFAULT_CACHE_TIMEOUT;
     ldap_conf.search_filter = strdup(DEFAULT_SEARCH_FILTER);
     ldap_conf.netgroup_search_filter = strdup(DEFAULT_NETGROUP_SEARCH_FILTER);
     STAILQ_INIT(&ldap_conf.uri);
@@ -611,6 +618,9 @@ sudo_ldap_read_config(void)
     if (ldap_conf.search_filter) {
 	DPRINTF1("search_filter    %s", ldap_conf.search_filter);
     }
+    if (ldap_conf.resolve_groups) {
+	DPRINTF1("sudoers_resolve_groups yes");
+    }
     if (!STAILQ_EMPTY(&ldap_conf.netgroup_base)) {
 	STAILQ_FOREACH(conf_str, &ldap_conf.netgroup_base, entries) {
 	    DPRINTF1("netgroup_base    %s", conf_str->val);
@@ -621,6 +631,10 @@ sudo_ldap_read_config(void)
     if (ldap_conf.netgroup_search_filter) {
         DPRINTF1("netgroup_search_filter %s", ldap_conf.netgroup_search_filter);
     }
+    if (ldap_conf.cache_file != NULL) {
+	DPRINTF1("sudoers_cache    %s", ldap_conf.cache_file);
+	DPRINTF1("sudoers_cache_timeout %d", ldap_conf.cache_timeout);
+    }
     DPRINTF1("binddn           %s",
 	ldap_conf.binddn ? ldap_conf.binddn : "(anonymous)");
     DPRINTF1("bindpw           %s",
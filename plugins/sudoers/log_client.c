@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -66,6 +67,9 @@
 /* Server callback may redirect to client callback for TLS. */
 static void client_msg_cb(int fd, int what, void *v);
 static void server_msg_cb(int fd, int what, void *v);
+static void async_connect_cb(int sock, int what, void *v);
+static void async_connect_failed(struct client_closure *closure);
+static void async_connect_free(struct client_closure *closure);
 
 static void
 connect_cb(int sock, int what, void *v)
@@ -401,6 +405,149 @@ done:
 }
 #endif /* HAVE_OPENSSL */
 
+/*
+ * Create a socket for the specified address with the O_NONBLOCK and
+ * close-on-exec flags set.
+ * Returns open socket or -1 on error, setting *cause.
+ */
+static int
+client_socket(const struct addrinfo *res, bool keepalive, const char **cause)
+{
+    int flags, save_errno, sock;
+    debug_decl(client_socket, SUDOERS_DEBUG_UTIL);
+
+    sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock == -1) {
+	*cause = "socket";
+	debug_return_int(-1);
+    }
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+	*cause = "fcntl(O_NONBLOCK)";
+	goto bad;
+    }
+    if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
+	*cause = "fcntl(FD_CLOEXEC)";
+	goto bad;
+    }
+    /* Keepalive is not meaningful for a local socket. */
+    if (keepalive && res->ai_family != AF_UNIX) {
+	flags = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &flags,
+		sizeof(flags)) == -1) {
+	    *cause = "setsockopt(SO_KEEPALIVE)";
+	    goto bad;
+	}
+    }
+    debug_return_int(sock);
+
+bad:
+    save_errno = errno;
+    close(sock);
+    errno = save_errno;
+    debug_return_int(-1);
+}
+
+/*
+ * Store the name and IP address of the server we are connecting to,
+ * they are used when verifying the server's certificate.
+ * Returns true on success, else false, setting *cause.
+ */
+static bool
+set_server_address(struct client_closure *closure, const char *host,
+    const struct addrinfo *res, const char **cause)
+{
+    const char *addr;
+    debug_decl(set_server_address, SUDOERS_DEBUG_UTIL);
+
+    switch (res->ai_family) {
+    case AF_INET:
+	addr = (char *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
+	break;
+    case AF_INET6:
+	addr = (char *)&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
+	break;
+    case AF_UNIX:
+	addr = NULL;
+	break;
+    default:
+	*cause = "ai_family";
+	errno = EAFNOSUPPORT;
+	debug_return_bool(false);
+    }
+    if (addr == NULL) {
+	/* Local socket, no IP address. */
+	closure->server_ip[0] = '\0';
+    } else if (inet_ntop(res->ai_family, addr, closure->server_ip,
+	    sizeof(closure->server_ip)) == NULL) {
+	*cause = "inet_ntop";
+	debug_return_bool(false);
+    }
+    free(closure->server_name);
+    if ((closure->server_name = strdup(host)) == NULL) {
+	*cause = "strdup";
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Look up the addresses of a log server.
+ * A host that starts with a slash is the path to a local socket,
+ * such as the one sudo_logmuxd listens on.
+ * Returns 0 on success or an EAI_* error code.
+ */
+static int
+server_getaddrinfo(const char *host, const char *port, struct addrinfo **resp)
+{
+    struct local_addrinfo {
+	struct addrinfo ai;
+	struct sockaddr_un sun;
+    } *lai;
+    struct addrinfo hints;
+    debug_decl(server_getaddrinfo, SUDOERS_DEBUG_UTIL);
+
+    if (*host == '/') {
+	if ((lai = calloc(1, sizeof(*lai))) == NULL)
+	    debug_return_int(EAI_MEMORY);
+	if (strlcpy(lai->sun.sun_path, host, sizeof(lai->sun.sun_path)) >=
+		sizeof(lai->sun.sun_path)) {
+	    free(lai);
+	    debug_return_int(EAI_NONAME);
+	}
+	lai->sun.sun_family = AF_UNIX;
+	lai->ai.ai_family = AF_UNIX;
+	lai->ai.ai_socktype = SOCK_STREAM;
+	lai->ai.ai_addr = (struct sockaddr *)&lai->sun;
+	lai->ai.ai_addrlen = sizeof(lai->sun);
+	*resp = &lai->ai;
+	debug_return_int(0);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    debug_return_int(getaddrinfo(host, port, &hints, resp));
+}
+
+/*
+ * Free addresses returned by server_getaddrinfo().
+ */
+static void
+server_freeaddrinfo(struct addrinfo *res)
+{
+    debug_decl(server_freeaddrinfo, SUDOERS_DEBUG_UTIL);
+
+    if (res != NULL) {
+	if (res->ai_family == AF_UNIX)
+	    free(res);
+	else
+	    freeaddrinfo(res);
+    }
+
+    debug_return;
+}
+
 /*
  * Connect to specified host:port
  * If host has multiple addresses, the first one that connects is used.
@@ -411,23 +558,22 @@ connect_server(const char *host, const char *port, bool tls,
     struct client_closure *closure, const char **reason)
 {
     const struct timespec *timo = &closure->log_details->server_timeout;
-    struct addrinfo hints, *res, *res0;
-    const char *addr, *cause = NULL;
+    struct addrinfo *res, *res0;
+    const char *cause = NULL;
     int error, sock = -1;
     debug_decl(connect_server, SUDOERS_DEBUG_UTIL);
 
-#if !defined(HAVE_OPENSSL)
+#if defined(HAVE_OPENSSL)
+    if (tls && *host == '/') {
+#else
     if (tls) {
+#endif
         errno = EPROTONOSUPPORT;
         sudo_warn("%s:%s(tls)", host, port);
         debug_return_int(-1);
     }
-#endif
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    error = getaddrinfo(host, port, &hints, &res0);
+    error = server_getaddrinfo(host, port, &res0);
     if (error != 0) {
 	sudo_warnx(U_("unable to look up %s:%s: %s"), host, port,
 	    gai_strerror(error));
@@ -435,77 +581,14 @@ connect_server(const char *host, const char *port, bool tls,
     }
 
     for (res = res0; res; res = res->ai_next) {
-	int flags, save_errno;
+	int save_errno;
 
-	sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-	if (sock == -1) {
-	    cause = "socket";
-	    continue;
-	}
-	flags = fcntl(sock, F_GETFL, 0);
-	if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
-	    cause = "fcntl(O_NONBLOCK)";
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
-	}
-        if (fcntl(sock, F_SETFD, FD_CLOEXEC) == -1) {
-	    cause = "fcntl(FD_CLOEXEC)";
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
-        }
-        if (closure->log_details->keepalive) {
-            flags = 1;
-            if (setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &flags,
-                    sizeof(flags)) == -1) {
-                cause = "setsockopt(SO_KEEPALIVE)";
-                save_errno = errno;
-                close(sock);
-                errno = save_errno;
-                sock = -1;
-                continue;
-            }
-        }
-	if (timed_connect(sock, res->ai_addr, res->ai_addrlen, timo) == -1) {
-	    /* No need to set cause, caller's error message is sufficient. */
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
-	}
-	switch (res->ai_family) {
-	case AF_INET:
-	    addr = (char *)&((struct sockaddr_in *)res->ai_addr)->sin_addr;
-	    break;
-	case AF_INET6:
-	    addr = (char *)&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr;
-	    break;
-	default:
-            cause = "ai_family";
-	    save_errno = EAFNOSUPPORT;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
-	    continue;
-	}
-        if (inet_ntop(res->ai_family, addr, closure->server_ip,
-                sizeof(closure->server_ip)) == NULL) {
-            cause = "inet_ntop";
-	    save_errno = errno;
-	    close(sock);
-	    errno = save_errno;
-	    sock = -1;
+	sock = client_socket(res, closure->log_details->keepalive, &cause);
+	if (sock == -1)
 	    continue;
-        }
-	free(closure->server_name);
-	if ((closure->server_name = strdup(host)) == NULL) {
-	    cause = "strdup";
+	/* No need to set cause if connect fails, caller's error is sufficient. */
+	if (timed_connect(sock, res->ai_addr, res->ai_addrlen, timo) == -1 ||
+		!set_server_address(closure, host, res, &cause)) {
 	    save_errno = errno;
 	    close(sock);
 	    errno = save_errno;
@@ -542,7 +625,7 @@ connect_server(const char *host, const char *port, bool tls,
 #endif /* HAVE_OPENSSL */
 	break;	/* success */
     }
-    freeaddrinfo(res0);
+    server_freeaddrinfo(res0);
 
     if (sock == -1)
 	*reason = cause;
@@ -550,6 +633,190 @@ connect_server(const char *host, const char *port, bool tls,
     debug_return_int(sock);
 }
 
+/*
+ * Returns true if the log server was found to be unreachable within the
+ * last SPOOL_RETRY_INTERVAL seconds.  In that case we write to the spool
+ * directly instead of waiting for another connection attempt to time out.
+ */
+static bool
+log_server_offline(struct client_closure *closure)
+{
+    const char *spool_dir = closure->log_details->spool_dir;
+    char path[PATH_MAX];
+    struct stat sb;
+    time_t now;
+    int len;
+    debug_decl(log_server_offline, SUDOERS_DEBUG_UTIL);
+
+    if (spool_dir == NULL)
+	debug_return_bool(false);
+
+    len = snprintf(path, sizeof(path), "%s/.offline", spool_dir);
+    if (len < 0 || len >= ssizeof(path))
+	debug_return_bool(false);
+    if (lstat(path, &sb) == -1 || !S_ISREG(sb.st_mode))
+	debug_return_bool(false);
+    time(&now);
+    if (now < sb.st_mtime || now - sb.st_mtime >= SPOOL_RETRY_INTERVAL)
+	debug_return_bool(false);
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"log server unreachable %lld seconds ago, not retrying",
+	(long long)(now - sb.st_mtime));
+    debug_return_bool(true);
+}
+
+/*
+ * Create or remove the marker file that records when we last failed
+ * to reach a log server.
+ */
+static void
+log_server_set_offline(struct client_closure *closure, bool offline)
+{
+    const char *spool_dir = closure->log_details->spool_dir;
+    char path[PATH_MAX];
+    int fd, len;
+    debug_decl(log_server_set_offline, SUDOERS_DEBUG_UTIL);
+
+    if (spool_dir == NULL)
+	debug_return;
+
+    len = snprintf(path, sizeof(path), "%s/.offline", spool_dir);
+    if (len < 0 || len >= ssizeof(path))
+	debug_return;
+    if (offline) {
+	/* Opening with O_TRUNC updates the modification time. */
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW, S_IRUSR|S_IWUSR);
+	if (fd != -1)
+	    close(fd);
+    } else {
+	if (unlink(path) == -1 && errno != ENOENT) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_ERRNO,
+		"unable to unlink %s", path);
+	}
+    }
+
+    debug_return;
+}
+
+/*
+ * Open a new spool file to store the messages that would have been
+ * sent to the log server; sudo_sendlog forwards them later.
+ * The spool file consists of ClientMessages in wire format (a 32-bit
+ * length in network byte order followed by the packed message),
+ * starting with the message that follows the ClientHello.
+ * It is created under a temporary name, locked and then renamed so
+ * the forwarder never sees a new, unlocked file.  The lock is held
+ * until the spool file is closed.
+ * Returns true on success, else false.
+ */
+static bool
+log_server_spool_open(struct client_closure *closure)
+{
+    char *spool_dir = closure->log_details->spool_dir;
+    char tmpl[PATH_MAX], path[PATH_MAX];
+    int fd, len;
+    debug_decl(log_server_spool_open, SUDOERS_DEBUG_UTIL);
+
+    /* Create the spool directory and its parents as needed. */
+    if (!sudo_mkdir_parents(spool_dir, ROOT_UID, ROOT_GID,
+	    S_IRWXU|S_IXGRP|S_IXOTH, false))
+	debug_return_bool(false);
+    if (mkdir(spool_dir, S_IRWXU) == -1 && errno != EEXIST) {
+	sudo_warn(U_("unable to mkdir %s"), spool_dir);
+	debug_return_bool(false);
+    }
+
+    len = snprintf(tmpl, sizeof(tmpl), "%s/.spool.XXXXXX", spool_dir);
+    if (len < 0 || len >= ssizeof(tmpl)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s/.spool.XXXXXX", spool_dir);
+	debug_return_bool(false);
+    }
+    /* Spool files sort in the order they were created. */
+    len = snprintf(path, sizeof(path), "%s/spool.%010lld.%s", spool_dir,
+	(long long)time(NULL), tmpl + len - 6);
+    if (len < 0 || len >= ssizeof(path)) {
+	errno = ENAMETOOLONG;
+	sudo_warn("%s/spool", spool_dir);
+	debug_return_bool(false);
+    }
+
+    if ((fd = mkstemp(tmpl)) == -1) {
+	sudo_warn(U_("unable to open %s"), tmpl);
+	debug_return_bool(false);
+    }
+    if (!sudo_lock_file(fd, SUDO_LOCK)) {
+	sudo_warn(U_("unable to lock %s"), tmpl);
+	goto bad;
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    /* The random suffix is the last six characters of both names. */
+    memcpy(path + len - 6, tmpl + strlen(tmpl) - 6, 6);
+    if (rename(tmpl, path) == -1) {
+	sudo_warn(U_("unable to rename %s to %s"), tmpl, path);
+	goto bad;
+    }
+
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"spooling log server messages to %s", path);
+    closure->spool_fd = fd;
+    debug_return_bool(true);
+bad:
+    unlink(tmpl);
+    close(fd);
+    debug_return_bool(false);
+}
+
+/*
+ * Write a wire-format message to the spool file.
+ * Returns true on success, else false.
+ */
+static bool
+log_server_spool_write(struct client_closure *closure, const uint8_t *data,
+    size_t len)
+{
+    ssize_t nwritten;
+    debug_decl(log_server_spool_write, SUDOERS_DEBUG_UTIL);
+
+    while (len > 0) {
+	nwritten = write(closure->spool_fd, data, len);
+	if (nwritten == -1) {
+	    if (errno == EINTR)
+		continue;
+	    sudo_warn("%s", U_("unable to write to spool file"));
+	    debug_return_bool(false);
+	}
+	data += nwritten;
+	len -= nwritten;
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Write the messages in the write queue to the spool file.
+ * Returns true on success, else false.
+ */
+static bool
+log_server_spool_queue(struct client_closure *closure)
+{
+    struct connection_buffer *buf;
+    bool ret = true;
+    debug_decl(log_server_spool_queue, SUDOERS_DEBUG_UTIL);
+
+    while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	if (ret) {
+	    ret = log_server_spool_write(closure, buf->data + buf->off,
+		buf->len - buf->off);
+	}
+	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+	buf->off = 0;
+	buf->len = 0;
+	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+    }
+    debug_return_bool(ret);
+}
+
 /*
  * Connect to the first server in the list.
  * Stores socket in closure with O_NONBLOCK and close-on-exec flags set.
@@ -630,6 +897,9 @@ client_closure_free(struct client_closure *closure)
 
     if (closure->sock != -1)
 	close(closure->sock);
+    async_connect_free(closure);
+    if (closure->spool_fd != -1)
+	close(closure->spool_fd);
     free(closure->server_name);
     while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
 	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
@@ -709,6 +979,13 @@ fmt_client_message(struct client_closure *closure, ClientMessage *msg)
 
     memcpy(buf->data, &msg_len, sizeof(msg_len));
     client_message__pack(msg, buf->data + sizeof(msg_len));
+    if (closure->spool_fd != -1) {
+	/* Spooled messages are written immediately. */
+	ret = log_server_spool_write(closure, buf->data, len);
+	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+	buf = NULL;
+	goto done;
+    }
     buf->len = len;
     TAILQ_INSERT_TAIL(&closure->write_bufs, buf, entries);
     buf = NULL;
@@ -1098,7 +1375,7 @@ fmt_initial_message(struct client_closure *closure)
     switch (closure->state) {
     case SEND_ACCEPT:
 	/* Format and schedule AcceptMessage. */
-	if ((ret = fmt_accept_message(closure))) {
+	if ((ret = fmt_accept_message(closure)) && closure->spool_fd == -1) {
 	    /*
 	     * Move read/write events back to main sudo event loop.
 	     * Server messages may occur at any time, so no timeout.
@@ -1446,6 +1723,410 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Add an event for the socket, replacing any existing event.
+ * When log_server_async is set, the connection is completed in the
+ * sudo event loop, or in the private one used by log_server_close().
+ * Returns true on success, else false.
+ */
+static bool
+async_event_add(struct client_closure *closure, struct sudo_plugin_event *ev,
+    int events, sudo_ev_callback_t callback)
+{
+    debug_decl(async_event_add, SUDOERS_DEBUG_UTIL);
+
+    /* An event must not be reinitialized while it is active. */
+    ev->del(ev);
+    if (ev->set(ev, closure->sock, events, callback, closure) == -1) {
+	sudo_warnx("%s", U_("unable to set event"));
+	debug_return_bool(false);
+    }
+    ev->setbase(ev, closure->evbase);
+    if (ev->add(ev, &closure->log_details->server_timeout) == -1) {
+	sudo_warn("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Free the address list used by the asynchronous connection.
+ */
+static void
+async_connect_free(struct client_closure *closure)
+{
+    debug_decl(async_connect_free, SUDOERS_DEBUG_UTIL);
+
+    if (closure->res0 != NULL) {
+	server_freeaddrinfo(closure->res0);
+	closure->res0 = NULL;
+    }
+    closure->res = NULL;
+    free(closure->server_copy);
+    closure->server_copy = NULL;
+    closure->host = NULL;
+    closure->port = NULL;
+
+    debug_return;
+}
+
+/*
+ * The connection to the server has been established.
+ * Queue the ClientHello ahead of any messages that were formatted
+ * while we were connecting and start the exchange with the server.
+ * Returns true on success, else false.
+ */
+static bool
+async_connect_done(struct client_closure *closure)
+{
+    struct connection_buffer *buf;
+    debug_decl(async_connect_done, SUDOERS_DEBUG_UTIL);
+
+    closure->connecting = false;
+    async_connect_free(closure);
+
+    if (!fmt_client_hello(closure))
+	debug_return_bool(false);
+    buf = TAILQ_LAST(&closure->write_bufs, connection_buffer_list);
+    TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+    TAILQ_INSERT_HEAD(&closure->write_bufs, buf, entries);
+    closure->hello_queued = true;
+
+    /* The read event has no timeout once ServerHello is received. */
+    if (!async_event_add(closure, closure->read_ev,
+	    SUDO_PLUGIN_EV_READ|SUDO_PLUGIN_EV_PERSIST, server_msg_cb))
+	debug_return_bool(false);
+    if (!async_event_add(closure, closure->write_ev,
+	    SUDO_PLUGIN_EV_WRITE|SUDO_PLUGIN_EV_PERSIST, client_msg_cb))
+	debug_return_bool(false);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Start a non-blocking connect to the next server address to try.
+ * Servers are looked up in order as the addresses of the previous
+ * server are exhausted.
+ * Returns true if a connection is in progress, false if there are
+ * no more addresses to try.
+ */
+static bool
+async_connect_next(struct client_closure *closure)
+{
+    struct sudoers_string *server;
+    struct addrinfo *res;
+    const char *cause = NULL;
+    int error, sock;
+    debug_decl(async_connect_next, SUDOERS_DEBUG_UTIL);
+
+    for (;;) {
+	while (closure->res == NULL) {
+	    async_connect_free(closure);
+	    if ((server = closure->next_server) == NULL)
+		debug_return_bool(false);
+	    closure->next_server = STAILQ_NEXT(server, entries);
+
+	    if ((closure->server_copy = strdup(server->str)) == NULL) {
+		sudo_warnx(U_("%s: %s"), __func__,
+		    U_("unable to allocate memory"));
+		debug_return_bool(false);
+	    }
+	    if (!iolog_parse_host_port(closure->server_copy, &closure->host,
+		    &closure->port, &closure->tls, DEFAULT_PORT,
+		    DEFAULT_PORT_TLS)) {
+		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		    "unable to parse %s", closure->server_copy);
+		continue;
+	    }
+#if defined(HAVE_OPENSSL)
+	    if (closure->tls && *closure->host == '/') {
+#else
+	    if (closure->tls) {
+#endif
+		errno = EPROTONOSUPPORT;
+		sudo_warn("%s:%s(tls)", closure->host, closure->port);
+		continue;
+	    }
+	    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		"connecting to %s port %s%s (async)", closure->host,
+		closure->port, closure->tls ? " (tls)" : "");
+
+	    /* XXX - the name lookup itself is synchronous */
+	    error = server_getaddrinfo(closure->host, closure->port,
+		&closure->res0);
+	    if (error != 0) {
+		sudo_warnx(U_("unable to look up %s:%s: %s"), closure->host,
+		    closure->port, gai_strerror(error));
+		closure->res0 = NULL;
+		continue;
+	    }
+	    closure->res = closure->res0;
+	}
+
+	res = closure->res;
+	closure->res = res->ai_next;
+	sock = client_socket(res, closure->log_details->keepalive, &cause);
+	if (sock == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+		"%s: %s", closure->host, cause);
+	    continue;
+	}
+	if (!set_server_address(closure, closure->host, res, &cause) ||
+		(connect(sock, res->ai_addr, res->ai_addrlen) == -1 &&
+		errno != EINPROGRESS)) {
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+		"unable to connect to %s port %s", closure->host, closure->port);
+	    close(sock);
+	    continue;
+	}
+	closure->sock = sock;
+
+	/* The socket becomes writable when the connection completes. */
+	if (!async_event_add(closure, closure->write_ev, SUDO_PLUGIN_EV_WRITE,
+		async_connect_cb))
+	    debug_return_bool(false);
+	debug_return_bool(true);
+    }
+}
+
+/*
+ * Close the socket of a failed connection attempt and try the next
+ * server address.
+ */
+static void
+async_connect_retry(struct client_closure *closure)
+{
+    debug_decl(async_connect_retry, SUDOERS_DEBUG_UTIL);
+
+    closure->read_ev->del(closure->read_ev);
+    closure->write_ev->del(closure->write_ev);
+    close(closure->sock);
+    closure->sock = -1;
+    if (!async_connect_next(closure))
+	async_connect_failed(closure);
+
+    debug_return;
+}
+
+#if defined(HAVE_OPENSSL)
+/*
+ * Perform the next step of the TLS handshake (read or write callback).
+ */
+static void
+async_tls_connect_cb(int sock, int what, void *v)
+{
+    struct client_closure *closure = v;
+    const char *errstr;
+    int tls_con;
+    debug_decl(async_tls_connect_cb, SUDOERS_DEBUG_UTIL);
+
+    if (what == SUDO_PLUGIN_EV_TIMEOUT) {
+	sudo_warnx("%s", U_("TLS handshake timeout occurred"));
+	goto bad;
+    }
+
+    tls_con = SSL_connect(closure->ssl);
+    if (tls_con == 1) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "TLS version: %s, negotiated cipher suite: %s",
+	    SSL_get_version(closure->ssl), SSL_get_cipher(closure->ssl));
+	if (!async_connect_done(closure))
+	    async_connect_failed(closure);
+	debug_return;
+    }
+
+    /* The handshake is not finished, wait for the socket to be ready. */
+    switch (SSL_get_error(closure->ssl, tls_con)) {
+    case SSL_ERROR_WANT_READ:
+	sudo_debug_printf(SUDO_DEBUG_NOTICE|SUDO_DEBUG_LINENO,
+	    "SSL_connect returns SSL_ERROR_WANT_READ");
+	closure->write_ev->del(closure->write_ev);
+	if (!async_event_add(closure, closure->read_ev, SUDO_PLUGIN_EV_READ,
+		async_tls_connect_cb))
+	    goto bad;
+	break;
+    case SSL_ERROR_WANT_WRITE:
+	sudo_debug_printf(SUDO_DEBUG_NOTICE|SUDO_DEBUG_LINENO,
+	    "SSL_connect returns SSL_ERROR_WANT_WRITE");
+	closure->read_ev->del(closure->read_ev);
+	if (!async_event_add(closure, closure->write_ev, SUDO_PLUGIN_EV_WRITE,
+		async_tls_connect_cb))
+	    goto bad;
+	break;
+    case SSL_ERROR_SYSCALL:
+	sudo_warnx(U_("TLS connection to %s:%s failed: %s"),
+	    closure->host, closure->port, strerror(errno));
+	goto bad;
+    default:
+	errstr = ERR_reason_error_string(ERR_get_error());
+	sudo_warnx(U_("TLS connection to %s:%s failed: %s"),
+	    closure->host, closure->port, errstr);
+	goto bad;
+    }
+    debug_return;
+
+bad:
+    async_connect_retry(closure);
+    debug_return;
+}
+#endif /* HAVE_OPENSSL */
+
+/*
+ * Check the result of a non-blocking connect (write callback).
+ */
+static void
+async_connect_cb(int sock, int what, void *v)
+{
+    struct client_closure *closure = v;
+    socklen_t optlen = sizeof(int);
+    int errnum = 0;
+    debug_decl(async_connect_cb, SUDOERS_DEBUG_UTIL);
+
+    if (what == SUDO_PLUGIN_EV_TIMEOUT) {
+	errnum = ETIMEDOUT;
+    } else if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &errnum, &optlen) == -1) {
+	errnum = errno;
+    }
+    if (errnum != 0) {
+	errno = errnum;
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO,
+	    "unable to connect to %s port %s", closure->host, closure->port);
+	async_connect_retry(closure);
+	debug_return;
+    }
+
+#if defined(HAVE_OPENSSL)
+    if (closure->tls) {
+	if (!tls_init(closure) || !SSL_set_fd(closure->ssl, sock)) {
+	    sudo_warnx("%s", U_("TLS initialization was unsuccessful"));
+	    async_connect_retry(closure);
+	    debug_return;
+	}
+	/* Perform TLS handshake. */
+	async_tls_connect_cb(sock, SUDO_PLUGIN_EV_WRITE, closure);
+	debug_return;
+    }
+
+    /* No TLS for this connection, make sure it is not initialized. */
+    SSL_free(closure->ssl);
+    closure->ssl = NULL;
+    SSL_CTX_free(closure->ssl_ctx);
+    closure->ssl_ctx = NULL;
+#endif /* HAVE_OPENSSL */
+
+    if (!async_connect_done(closure))
+	async_connect_failed(closure);
+    debug_return;
+}
+
+/*
+ * The connection to the log server failed before the ServerHello was
+ * received.  Store the queued messages in the spool if possible,
+ * otherwise disable the plugin or break out of the event loop and kill
+ * the command, as we would for a server that disappears later.
+ */
+static void
+async_connect_failed(struct client_closure *closure)
+{
+    struct connection_buffer *buf;
+    debug_decl(async_connect_failed, SUDOERS_DEBUG_UTIL);
+
+    closure->connecting = false;
+    closure->hello_pending = false;
+    async_connect_free(closure);
+    closure->read_ev->del(closure->read_ev);
+    closure->write_ev->del(closure->write_ev);
+#if defined(HAVE_OPENSSL)
+    if (closure->ssl != NULL) {
+	SSL_free(closure->ssl);
+	closure->ssl = NULL;
+    }
+#endif
+    if (closure->sock != -1) {
+	close(closure->sock);
+	closure->sock = -1;
+    }
+
+    if (closure->log_details->spool_dir != NULL) {
+	/* The ClientHello is not stored in the spool. */
+	if (closure->hello_queued) {
+	    buf = TAILQ_FIRST(&closure->write_bufs);
+	    TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+	    buf->off = 0;
+	    buf->len = 0;
+	    TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+	    closure->hello_queued = false;
+	}
+	if (log_server_spool_open(closure)) {
+	    log_server_set_offline(closure, true);
+	    if (log_server_spool_queue(closure))
+		debug_return;
+	    close(closure->spool_fd);
+	    closure->spool_fd = -1;
+	}
+    }
+
+    sudo_warnx("%s", U_("unable to connect to log server"));
+    if (closure->log_details->ignore_log_errors) {
+	/* Disable plugin, the command continues. */
+	closure->disabled = true;
+    } else {
+	/* Break out of sudo event loop and kill the command. */
+	closure->read_ev->loopbreak(closure->read_ev);
+    }
+    debug_return;
+}
+
+/*
+ * Start connecting to the log server without waiting for the connection
+ * to complete (log_server_async).  Messages formatted in the meantime
+ * are queued until the ServerHello has been received.
+ * Returns true if a connection is in progress, else false.
+ */
+static bool
+log_server_connect_async(struct client_closure *closure)
+{
+    debug_decl(log_server_connect_async, SUDOERS_DEBUG_UTIL);
+
+    closure->next_server = STAILQ_FIRST(closure->log_details->log_servers);
+    if (!async_connect_next(closure)) {
+	async_connect_free(closure);
+	if (closure->sock != -1) {
+	    close(closure->sock);
+	    closure->sock = -1;
+	}
+	debug_return_bool(false);
+    }
+    closure->connecting = true;
+    closure->hello_pending = true;
+
+    debug_return_bool(true);
+}
+
+/*
+ * Enable the write event to send queued messages to the server.
+ * Messages are only sent after the ServerHello has been received,
+ * there is nothing to do for messages written to the spool.
+ * Returns true on success, else false.
+ */
+bool
+log_server_schedule_write(struct client_closure *closure)
+{
+    debug_decl(log_server_schedule_write, SUDOERS_DEBUG_UTIL);
+
+    if (closure->spool_fd != -1 || TAILQ_EMPTY(&closure->write_bufs))
+	debug_return_bool(true);
+    if (closure->hello_pending && !closure->hello_queued)
+	debug_return_bool(true);
+
+    if (closure->write_ev->add(closure->write_ev,
+	    &closure->log_details->server_timeout) == -1) {
+	sudo_warn("%s", U_("unable to add event to queue"));
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
 /*
  * Respond to a ServerHello message from the server.
  * Returns true on success, false on error.
@@ -1456,7 +2137,7 @@ handle_server_hello(ServerHello *msg, struct client_closure *closure)
     size_t n;
     debug_decl(handle_server_hello, SUDOERS_DEBUG_UTIL);
 
-    if (closure->state != RECV_HELLO) {
+    if (closure->state != RECV_HELLO && !closure->hello_pending) {
 	sudo_warnx(U_("%s: unexpected state %d"), __func__, closure->state);
 	debug_return_bool(false);
     }
@@ -1576,7 +2257,21 @@ handle_server_message(uint8_t *buf, size_t len,
     switch (msg->type_case) {
     case SERVER_MESSAGE__TYPE_HELLO:
 	if (handle_server_hello(msg->u.hello, closure)) {
-	    if ((ret = fmt_initial_message(closure))) {
+	    if (closure->hello_pending) {
+		/* Asynchronous connection, the messages are already queued. */
+		closure->hello_pending = false;
+		log_server_set_offline(closure, false);
+		ret = true;
+		if (closure->state < SEND_EXIT) {
+		    /* Server messages may occur at any time, so no timeout. */
+		    if (closure->read_ev->add(closure->read_ev, NULL) == -1) {
+			sudo_warn("%s", U_("unable to add event to queue"));
+			ret = false;
+		    }
+		}
+		if (ret)
+		    ret = log_server_schedule_write(closure);
+	    } else if ((ret = fmt_initial_message(closure))) {
 		if (closure->write_ev->add(closure->write_ev,
 			&closure->log_details->server_timeout) == -1) {
 		    sudo_warn("%s", U_("unable to add event to queue"));
@@ -1711,7 +2406,7 @@ server_msg_cb(int fd, int what, void *v)
                      * message and hope that no actual internal error occurs.
                      */
                     err = ERR_get_error();
-                    if (closure->state == RECV_HELLO &&
+                    if ((closure->state == RECV_HELLO || closure->hello_pending) &&
                         ERR_GET_REASON(err) == SSL_R_TLSV1_ALERT_INTERNAL_ERROR) {
                         errstr = "host name does not match certificate";
                     } else {
@@ -1781,7 +2476,10 @@ server_msg_cb(int fd, int what, void *v)
     buf->off = 0;
     debug_return;
 bad:
-    if (closure->log_details->ignore_log_errors) {
+    if (closure->hello_pending) {
+	/* Server failed before ServerHello, spool the queued messages. */
+	async_connect_failed(closure);
+    } else if (closure->log_details->ignore_log_errors) {
 	/* Disable plugin, the command continues. */
 	closure->disabled = true;
 	closure->read_ev->del(closure->read_ev);
@@ -1884,17 +2582,24 @@ client_msg_cb(int fd, int what, void *v)
 	buf->len = 0;
 	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
 	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+	closure->hello_queued = false;
 	if (TAILQ_EMPTY(&closure->write_bufs)) {
 	    /* Write queue empty, check for state change. */
 	    closure->write_ev->del(closure->write_ev);
 	    if (!client_message_completion(closure))
 		goto bad;
+	} else if (closure->hello_pending) {
+	    /* Don't send queued messages until we receive ServerHello. */
+	    closure->write_ev->del(closure->write_ev);
 	}
     }
     debug_return;
 
 bad:
-    if (closure->log_details->ignore_log_errors) {
+    if (closure->hello_pending) {
+	/* Server failed before ServerHello, spool the queued messages. */
+	async_connect_failed(closure);
+    } else if (closure->log_details->ignore_log_errors) {
 	/* Disable plugin, the command continues. */
 	closure->disabled = true;
 	closure->write_ev->del(closure->read_ev);
@@ -1921,6 +2626,7 @@ client_closure_alloc(struct log_details *details, struct timespec *now,
         goto oom;
 
     closure->sock = -1;
+    closure->spool_fd = -1;
     closure->log_io = log_io;
     closure->reason = reason;
     closure->state = RECV_HELLO;
@@ -1959,6 +2665,8 @@ log_server_open(struct log_details *details, struct timespec *now,
     struct sudo_plugin_event * (*event_alloc)(void))
 {
     struct client_closure *closure;
+    struct connection_buffer *buf;
+    bool offline = false;
     debug_decl(log_server_open, SUDOERS_DEBUG_UTIL);
 
     closure = client_closure_alloc(details, now, log_io, initial_state,
@@ -1966,16 +2674,78 @@ log_server_open(struct log_details *details, struct timespec *now,
     if (closure == NULL)
 	goto bad;
 
+    /* Skip the connection attempt if the server was recently unreachable. */
+    if (log_server_offline(closure))
+	goto spool;
+
+    if (details->async_connect && log_io && initial_state == SEND_ACCEPT) {
+	/* Don't wait for the server, the command runs in the meantime. */
+	if (log_server_connect_async(closure)) {
+	    closure->state = SEND_ACCEPT;
+	    if (!fmt_accept_message(closure))
+		goto bad;
+	    /* I/O log messages follow the queued AcceptMessage. */
+	    closure->state = SEND_IO;
+	    debug_return_ptr(closure);
+	}
+	if (details->spool_dir != NULL) {
+	    offline = true;
+	    goto spool;
+	}
+	sudo_warnx("%s", U_("unable to connect to log server"));
+	goto bad;
+    }
+
     /* Connect to log first available log server. */
     if (!log_server_connect(closure)) {
-	/* TODO: support offline logs if server unreachable */
+	if (details->spool_dir != NULL) {
+	    offline = true;
+	    goto spool;
+	}
 	sudo_warn("%s", U_("unable to connect to log server"));
 	goto bad;
     }
 
     /* Read ServerHello synchronously or fail. */
-    if (read_server_hello(closure))
+    if (read_server_hello(closure)) {
+	log_server_set_offline(closure, false);
 	debug_return_ptr(closure);
+    }
+    if (details->spool_dir == NULL)
+	goto bad;
+
+    /*
+     * Server stopped responding, discard any queued messages and
+     * fall back to the spool.  An initial message that was already
+     * (partially) sent may be logged twice.
+     */
+    offline = true;
+    closure->read_ev->del(closure->read_ev);
+    closure->write_ev->del(closure->write_ev);
+    while ((buf = TAILQ_FIRST(&closure->write_bufs)) != NULL) {
+	TAILQ_REMOVE(&closure->write_bufs, buf, entries);
+	buf->off = 0;
+	buf->len = 0;
+	TAILQ_INSERT_TAIL(&closure->free_bufs, buf, entries);
+    }
+#if defined(HAVE_OPENSSL)
+    if (closure->ssl != NULL) {
+	SSL_free(closure->ssl);
+	closure->ssl = NULL;
+    }
+#endif
+    close(closure->sock);
+    closure->sock = -1;
+
+spool:
+    /* Store messages locally to be forwarded by sudo_sendlog later. */
+    if (log_server_spool_open(closure)) {
+	/* Remember that the server is down so others don't wait for it. */
+	if (offline)
+	    log_server_set_offline(closure, true);
+	if (fmt_initial_message(closure))
+	    debug_return_ptr(closure);
+    }
 
 bad:
     client_closure_free(closure);
@@ -1989,16 +2759,27 @@ bool
 log_server_close(struct client_closure *closure, int exit_status, int error)
 {
     struct sudo_event_base *evbase = NULL;
+    int read_pending = 0, write_pending = 0;
     bool ret = false;
     debug_decl(log_server_close, SUDOERS_DEBUG_UTIL);
 
     if (closure->disabled)
 	goto done;
 
+    /* An asynchronous connection failed and could not be spooled. */
+    if (closure->sock == -1 && closure->spool_fd == -1)
+	goto done;
+
     /* Format and append an ExitMessage to the write queue. */
     if (!fmt_exit_message(closure, exit_status, error))
 	goto done;
 
+    /* When spooling, the ExitMessage has already been written. */
+    if (closure->spool_fd != -1) {
+	ret = true;
+	goto done;
+    }
+
     /*
      * Create private event base and reparent the read/write events.
      * We cannot use the main sudo event loop as it has already exited.
@@ -2007,21 +2788,39 @@ log_server_close(struct client_closure *closure, int exit_status, int error)
 	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
 	goto done;
     }
+    closure->evbase = evbase;
+
+    if (closure->connecting) {
+	/* Still connecting to the server, finish that first. */
+	read_pending = closure->read_ev->pending(closure->read_ev,
+	    SUDO_PLUGIN_EV_READ, NULL);
+	write_pending = closure->write_ev->pending(closure->write_ev,
+	    SUDO_PLUGIN_EV_WRITE, NULL);
+    }
 
     /* Enable read event to receive server messages. */
     closure->read_ev->setbase(closure->read_ev, evbase);
-    if (closure->read_ev->add(closure->read_ev,
-	    &closure->log_details->server_timeout) == -1) {
-	sudo_warn("%s", U_("unable to add event to queue"));
-	goto done;
+    if (!closure->connecting || read_pending) {
+	if (closure->read_ev->add(closure->read_ev,
+		&closure->log_details->server_timeout) == -1) {
+	    sudo_warn("%s", U_("unable to add event to queue"));
+	    goto done;
+	}
     }
 
     /* Enable the write event to write the ExitMessage. */
     closure->write_ev->setbase(closure->write_ev, evbase);
-    if (closure->write_ev->add(closure->write_ev,
-	    &closure->log_details->server_timeout) == -1) {
-	sudo_warn("%s", U_("unable to add event to queue"));
-	goto done;
+    if (closure->connecting) {
+	if (write_pending) {
+	    if (closure->write_ev->add(closure->write_ev,
+		    &closure->log_details->server_timeout) == -1) {
+		sudo_warn("%s", U_("unable to add event to queue"));
+		goto done;
+	    }
+	}
+    } else {
+	if (!log_server_schedule_write(closure))
+	    goto done;
     }
 
     /* Loop until queues are flushed and final commit point received. */
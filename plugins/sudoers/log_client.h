@@ -38,6 +38,9 @@
 /* Maximum message size (2Mb) */
 #define MESSAGE_SIZE_MAX	(2 * 1024 * 1024)
 
+/* Don't retry an unreachable log server for this many seconds when spooling */
+#define SPOOL_RETRY_INTERVAL	60
+
 /* TODO - share with logsrvd/sendlog */
 struct connection_buffer {
     TAILQ_ENTRY(connection_buffer) entries;
@@ -52,11 +55,13 @@ struct log_details {
     struct eventlog *evlog;
     struct sudoers_str_list *log_servers;
     struct timespec server_timeout;
+    char *spool_dir;
 #if defined(HAVE_OPENSSL)
     char *ca_bundle;
     char *cert_file;
     char *key_file;
 #endif /* HAVE_OPENSSL */
+    bool async_connect;
     bool keepalive;
     bool verify_server;
     bool ignore_log_errors;
@@ -78,6 +83,7 @@ enum client_state {
 /* Remote connection closure, non-zero fields must come first. */
 struct client_closure {
     int sock;
+    int spool_fd;
     bool read_instead_of_write;
     bool write_instead_of_read;
     bool temporary_write_event;
@@ -107,6 +113,18 @@ struct client_closure {
     struct timespec committed;
     char *iolog_id;
     const char *reason;
+    /* State for log_server_async, see log_server_connect_async(). */
+    bool connecting;		/* connect or TLS handshake in progress */
+    bool hello_pending;		/* ServerHello not yet received */
+    bool hello_queued;		/* ClientHello not yet sent */
+    bool tls;
+    char *server_copy;		/* host and port point into server_copy */
+    char *host;
+    char *port;
+    struct sudoers_string *next_server;
+    struct addrinfo *res0;
+    struct addrinfo *res;
+    struct sudo_event_base *evbase; /* NULL for the main sudo event loop */
 };
 
 /* iolog_client.c */
@@ -118,6 +136,7 @@ bool fmt_io_buf(struct client_closure *closure, int type, const char *buf, unsig
 bool fmt_suspend(struct client_closure *closure, const char *signame, struct timespec *delay);
 bool fmt_winsize(struct client_closure *closure, unsigned int lines, unsigned int cols, struct timespec *delay);
 bool log_server_connect(struct client_closure *closure);
+bool log_server_schedule_write(struct client_closure *closure);
 void client_closure_free(struct client_closure *closure);
 bool read_server_hello(struct client_closure *closure);
 
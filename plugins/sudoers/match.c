@@ -61,51 +61,115 @@
 static struct member_list empty = TAILQ_HEAD_INITIALIZER(empty);
 
 /*
- * Check whether user described by pw matches member.
+ * Depth of alias evaluation that does not use the alias index.
+ * When aliases are matched recursively, a loop is broken at the alias
+ * already in use, so a nested alias may match differently than it
+ * would on its own.  Memoized results and flattened members are only
+ * used for aliases that are not nested inside such an evaluation.
+ */
+static unsigned int alias_nesting;
+
+static int user_matches_int(struct sudoers_parse_tree *parse_tree, const struct passwd *pw, const struct member *m, bool negated, bool literal);
+static int host_matches_int(struct sudoers_parse_tree *parse_tree, const struct passwd *pw, const char *lhost, const char *shost, const struct member *m, bool negated, bool literal);
+static int cmnd_matches_int(struct sudoers_parse_tree *parse_tree, const struct member *m, bool negated, const char *runchroot, struct cmnd_info *info);
+static int runaslist_matches_int(struct sudoers_parse_tree *parse_tree, const struct member_list *user_list, const struct member_list *group_list, struct member **matching_user, struct member **matching_group);
+
+/*
+ * Check whether user described by pw matches the members of a User_Alias.
+ * Returns ALLOW, DENY or UNSPEC, not accounting for negation of the alias.
+ */
+static int
+useralias_matches(struct sudoers_parse_tree *parse_tree,
+    const struct passwd *pw, struct alias *a)
+{
+    const char *lhost = parse_tree->lhost ? parse_tree->lhost : user_runhost;
+    const char *shost = parse_tree->shost ? parse_tree->shost : user_srunhost;
+    const struct alias_member *am;
+    int matched = UNSPEC;
+    size_t n;
+    debug_decl(useralias_matches, SUDOERS_DEBUG_MATCH);
+
+    if (alias_nesting == 0) {
+	if (alias_memo_lookup(parse_tree, a, 0, pw, lhost, shost, &matched,
+		NULL))
+	    debug_return_int(matched);
+	if ((am = alias_index_members(parse_tree, a, &n)) != NULL) {
+	    while (n--) {
+		matched = user_matches_int(parse_tree, pw, am[n].m,
+		    am[n].negated, am[n].literal);
+		if (matched != UNSPEC)
+		    break;
+	    }
+	    alias_memo_store(parse_tree, a, 0, pw, lhost, shost, matched, NULL);
+	    debug_return_int(matched);
+	}
+    }
+    alias_nesting++;
+    matched = userlist_matches(parse_tree, pw, &a->members);
+    alias_nesting--;
+    if (alias_nesting == 0)
+	alias_memo_store(parse_tree, a, 0, pw, lhost, shost, matched, NULL);
+    debug_return_int(matched);
+}
+
+/*
+ * Check whether user described by pw matches member m with the specified
+ * negation.  If literal is set, an alias is matched by name.
  * Returns ALLOW, DENY or UNSPEC.
  */
-int
-user_matches(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
-    const struct member *m)
+static int
+user_matches_int(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
+    const struct member *m, bool negated, bool literal)
 {
     const char *lhost = parse_tree->lhost ? parse_tree->lhost : user_runhost;
     const char *shost = parse_tree->shost ? parse_tree->shost : user_srunhost;
     int matched = UNSPEC;
     struct alias *a;
-    debug_decl(user_matches, SUDOERS_DEBUG_MATCH);
+    debug_decl(user_matches_int, SUDOERS_DEBUG_MATCH);
 
     switch (m->type) {
 	case ALL:
-	    matched = !m->negated;
+	    matched = !negated;
 	    break;
 	case NETGROUP:
 	    if (netgr_matches(m->name,
 		def_netgroup_tuple ? lhost : NULL,
 		def_netgroup_tuple ? shost : NULL, pw->pw_name))
-		matched = !m->negated;
+		matched = !negated;
 	    break;
 	case USERGROUP:
 	    if (usergr_matches(m->name, pw->pw_name, pw))
-		matched = !m->negated;
+		matched = !negated;
 	    break;
 	case ALIAS:
-	    if ((a = alias_get(parse_tree, m->name, USERALIAS)) != NULL) {
-		/* XXX */
-		int rc = userlist_matches(parse_tree, pw, &a->members);
+	    if (!literal &&
+		    (a = alias_get(parse_tree, m->name, USERALIAS)) != NULL) {
+		int rc = useralias_matches(parse_tree, pw, a);
 		if (rc != UNSPEC)
-		    matched = m->negated ? !rc : rc;
+		    matched = negated ? !rc : rc;
 		alias_put(a);
 		break;
 	    }
 	    FALLTHROUGH;
 	case WORD:
 	    if (userpw_matches(m->name, pw->pw_name, pw))
-		matched = !m->negated;
+		matched = !negated;
 	    break;
     }
     debug_return_int(matched);
 }
 
+/*
+ * Check whether user described by pw matches member.
+ * Returns ALLOW, DENY or UNSPEC.
+ */
+int
+user_matches(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
+    const struct member *m)
+{
+    return user_matches_int(parse_tree, pw, m, m->negated, false);
+}
+
 /*
  * Check for user described by pw in a list of members.
  * Returns ALLOW, DENY or UNSPEC.
@@ -114,14 +178,25 @@ int
 userlist_matches(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
     const struct member_list *list)
 {
+    const char *lhost = parse_tree->lhost ? parse_tree->lhost : user_runhost;
+    const char *shost = parse_tree->shost ? parse_tree->shost : user_srunhost;
     struct member *m;
     int matched = UNSPEC;
     debug_decl(userlist_matches, SUDOERS_DEBUG_MATCH);
 
+    if (alias_nesting == 0 && match_memo_lookup(MATCH_MEMO_USER, list, NULL,
+	    pw, lhost, shost, &matched, NULL, NULL))
+	debug_return_int(matched);
+
     TAILQ_FOREACH_REVERSE(m, list, member_list, entries) {
 	if ((matched = user_matches(parse_tree, pw, m)) != UNSPEC)
 	    break;
     }
+
+    if (alias_nesting == 0) {
+	match_memo_store(MATCH_MEMO_USER, list, NULL, pw, lhost, shost,
+	    matched, NULL, NULL);
+    }
     debug_return_int(matched);
 }
 
@@ -141,13 +216,52 @@ runas_getgroups(void)
     debug_return_ptr(sudo_get_gidlist(pw, ENTRY_TYPE_QUERIED));
 }
 
+/*
+ * Check the runas user (if group is false) or runas group (if group
+ * is true) against the members of a Runas_Alias.  The matching member,
+ * if any, is stored in matching.
+ * Returns ALLOW, DENY or UNSPEC, not accounting for negation of the alias.
+ */
+static int
+runasalias_matches(struct sudoers_parse_tree *parse_tree, struct alias *a,
+    bool group, struct member **matching)
+{
+    const char *lhost = parse_tree->lhost ? parse_tree->lhost : user_runhost;
+    struct member *matched_member = NULL;
+    const int slot = group ? 1 : 0;
+    int matched;
+    debug_decl(runasalias_matches, SUDOERS_DEBUG_MATCH);
+
+    if (alias_nesting == 0 && alias_memo_lookup(parse_tree, a, slot,
+	    runas_pw, runas_gr, lhost, &matched, &matched_member))
+	goto done;
+
+    alias_nesting++;
+    if (group) {
+	matched = runaslist_matches_int(parse_tree, &empty, &a->members,
+	    NULL, &matched_member);
+    } else {
+	matched = runaslist_matches_int(parse_tree, &a->members, &empty,
+	    &matched_member, NULL);
+    }
+    alias_nesting--;
+    if (alias_nesting == 0) {
+	alias_memo_store(parse_tree, a, slot, runas_pw, runas_gr, lhost,
+	    matched, matched_member);
+    }
+done:
+    if (matching != NULL && matched_member != NULL)
+	*matching = matched_member;
+    debug_return_int(matched);
+}
+
 /*
  * Check for user described by pw in a list of members.
  * If both lists are empty compare against def_runas_default.
  * Returns ALLOW, DENY or UNSPEC.
  */
-int
-runaslist_matches(struct sudoers_parse_tree *parse_tree,
+static int
+runaslist_matches_int(struct sudoers_parse_tree *parse_tree,
     const struct member_list *user_list, const struct member_list *group_list,
     struct member **matching_user, struct member **matching_group)
 {
@@ -158,7 +272,7 @@ runaslist_matches(struct sudoers_parse_tree *parse_tree,
     struct member *m;
     struct alias *a;
     int rc;
-    debug_decl(runaslist_matches, SUDOERS_DEBUG_MATCH);
+    debug_decl(runaslist_matches_int, SUDOERS_DEBUG_MATCH);
 
     if (ISSET(sudo_user.flags, RUNAS_USER_SPECIFIED) || !ISSET(sudo_user.flags, RUNAS_GROUP_SPECIFIED)) {
 	/* If no runas user or runas group listed in sudoers, use default. */
@@ -187,8 +301,8 @@ runaslist_matches(struct sudoers_parse_tree *parse_tree,
 		    case ALIAS:
 			a = alias_get(parse_tree, m->name, RUNASALIAS);
 			if (a != NULL) {
-			    rc = runaslist_matches(parse_tree, &a->members,
-				&empty, matching_user, NULL);
+			    rc = runasalias_matches(parse_tree, a, false,
+				matching_user);
 			    if (rc != UNSPEC)
 				user_matched = m->negated ? !rc : rc;
 			    alias_put(a);
@@ -231,8 +345,8 @@ runaslist_matches(struct sudoers_parse_tree *parse_tree,
 		    case ALIAS:
 			a = alias_get(parse_tree, m->name, RUNASALIAS);
 			if (a != NULL) {
-			    rc = runaslist_matches(parse_tree, &empty,
-				&a->members, NULL, matching_group);
+			    rc = runasalias_matches(parse_tree, a, true,
+				matching_group);
 			    if (rc != UNSPEC)
 				group_matched = m->negated ? !rc : rc;
 			    alias_put(a);
@@ -280,6 +394,42 @@ runaslist_matches(struct sudoers_parse_tree *parse_tree,
     debug_return_int(UNSPEC);
 }
 
+/*
+ * Check for runas user and group in a list of members.
+ * Consecutive cmndspecs often share the same runas lists, so the
+ * result is memoized while a policy check is in progress.
+ * Returns ALLOW, DENY or UNSPEC.
+ */
+int
+runaslist_matches(struct sudoers_parse_tree *parse_tree,
+    const struct member_list *user_list, const struct member_list *group_list,
+    struct member **matching_user, struct member **matching_group)
+{
+    const char *lhost = parse_tree->lhost ? parse_tree->lhost : user_runhost;
+    struct member *matched_user = NULL, *matched_group = NULL;
+    int matched;
+    debug_decl(runaslist_matches, SUDOERS_DEBUG_MATCH);
+
+    if (alias_nesting != 0) {
+	debug_return_int(runaslist_matches_int(parse_tree, user_list,
+	    group_list, matching_user, matching_group));
+    }
+
+    if (!match_memo_lookup(MATCH_MEMO_RUNAS, user_list, group_list,
+	    runas_pw, runas_gr, lhost, &matched, &matched_user,
+	    &matched_group)) {
+	matched = runaslist_matches_int(parse_tree, user_list, group_list,
+	    &matched_user, &matched_group);
+	match_memo_store(MATCH_MEMO_RUNAS, user_list, group_list,
+	    runas_pw, runas_gr, lhost, matched, matched_user, matched_group);
+    }
+    if (matching_user != NULL && matched_user != NULL)
+	*matching_user = matched_user;
+    if (matching_group != NULL && matched_group != NULL)
+	*matching_group = matched_group;
+    debug_return_int(matched);
+}
+
 /*
  * Check for lhost and shost in a list of members.
  * Returns ALLOW, DENY or UNSPEC.
@@ -311,55 +461,112 @@ hostlist_matches(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
 {
     const char *lhost = parse_tree->lhost ? parse_tree->lhost : user_runhost;
     const char *shost = parse_tree->shost ? parse_tree->shost : user_srunhost;
+    int matched;
+    debug_decl(hostlist_matches, SUDOERS_DEBUG_MATCH);
 
-    return hostlist_matches_int(parse_tree, pw, lhost, shost, list);
+    if (match_memo_lookup(MATCH_MEMO_HOST, list, NULL, pw, lhost, shost,
+	    &matched, NULL, NULL))
+	debug_return_int(matched);
+    matched = hostlist_matches_int(parse_tree, pw, lhost, shost, list);
+    match_memo_store(MATCH_MEMO_HOST, list, NULL, pw, lhost, shost, matched,
+	NULL, NULL);
+    debug_return_int(matched);
 }
 
 /*
- * Check whether host or shost matches member.
+ * Check whether host or shost matches the members of a Host_Alias.
+ * Returns ALLOW, DENY or UNSPEC, not accounting for negation of the alias.
+ */
+static int
+hostalias_matches(struct sudoers_parse_tree *parse_tree,
+    const struct passwd *pw, const char *lhost, const char *shost,
+    struct alias *a)
+{
+    const struct alias_member *am;
+    int matched = UNSPEC;
+    size_t n;
+    debug_decl(hostalias_matches, SUDOERS_DEBUG_MATCH);
+
+    if (alias_nesting == 0) {
+	if (alias_memo_lookup(parse_tree, a, 0, pw, lhost, shost, &matched,
+		NULL))
+	    debug_return_int(matched);
+	if ((am = alias_index_members(parse_tree, a, &n)) != NULL) {
+	    while (n--) {
+		matched = host_matches_int(parse_tree, pw, lhost, shost,
+		    am[n].m, am[n].negated, am[n].literal);
+		if (matched != UNSPEC)
+		    break;
+	    }
+	    alias_memo_store(parse_tree, a, 0, pw, lhost, shost, matched, NULL);
+	    debug_return_int(matched);
+	}
+    }
+    alias_nesting++;
+    matched = hostlist_matches_int(parse_tree, pw, lhost, shost, &a->members);
+    alias_nesting--;
+    if (alias_nesting == 0)
+	alias_memo_store(parse_tree, a, 0, pw, lhost, shost, matched, NULL);
+    debug_return_int(matched);
+}
+
+/*
+ * Check whether host or shost matches member m with the specified
+ * negation.  If literal is set, an alias is matched by name.
  * Returns ALLOW, DENY or UNSPEC.
  */
-int
-host_matches(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
-    const char *lhost, const char *shost, const struct member *m)
+static int
+host_matches_int(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
+    const char *lhost, const char *shost, const struct member *m,
+    bool negated, bool literal)
 {
     struct alias *a;
     int matched = UNSPEC;
-    debug_decl(host_matches, SUDOERS_DEBUG_MATCH);
+    debug_decl(host_matches_int, SUDOERS_DEBUG_MATCH);
 
     switch (m->type) {
 	case ALL:
-	    matched = !m->negated;
+	    matched = !negated;
 	    break;
 	case NETGROUP:
 	    if (netgr_matches(m->name, lhost, shost,
 		def_netgroup_tuple ? pw->pw_name : NULL))
-		matched = !m->negated;
+		matched = !negated;
 	    break;
 	case NTWKADDR:
 	    if (addr_matches(m->name))
-		matched = !m->negated;
+		matched = !negated;
 	    break;
 	case ALIAS:
-	    a = alias_get(parse_tree, m->name, HOSTALIAS);
-	    if (a != NULL) {
-		/* XXX */
-		int rc = hostlist_matches_int(parse_tree, pw, lhost, shost,
-		    &a->members);
+	    if (!literal &&
+		    (a = alias_get(parse_tree, m->name, HOSTALIAS)) != NULL) {
+		int rc = hostalias_matches(parse_tree, pw, lhost, shost, a);
 		if (rc != UNSPEC)
-		    matched = m->negated ? !rc : rc;
+		    matched = negated ? !rc : rc;
 		alias_put(a);
 		break;
 	    }
 	    FALLTHROUGH;
 	case WORD:
 	    if (hostname_matches(shost, lhost, m->name))
-		matched = !m->negated;
+		matched = !negated;
 	    break;
     }
     debug_return_int(matched);
 }
 
+/*
+ * Check whether host or shost matches member.
+ * Returns ALLOW, DENY or UNSPEC.
+ */
+int
+host_matches(struct sudoers_parse_tree *parse_tree, const struct passwd *pw,
+    const char *lhost, const char *shost, const struct member *m)
+{
+    return host_matches_int(parse_tree, pw, lhost, shost, m, m->negated,
+	false);
+}
+
 /*
  * Check for cmnd and args in a list of members.
  * Returns ALLOW, DENY or UNSPEC.
@@ -382,36 +589,74 @@ cmndlist_matches(struct sudoers_parse_tree *parse_tree,
 }
 
 /*
- * Check cmnd and args.
- * Returns ALLOW, DENY or UNSPEC.
+ * Check cmnd and args against the members of a Cmnd_Alias.
+ * Only a result of UNSPEC is memoized since a match also sets
+ * safe_cmnd and the command info.  A rule-specific runchroot
+ * changes the command being matched so it is not memoized either.
+ * Returns ALLOW, DENY or UNSPEC, not accounting for negation of the alias.
  */
-int
-cmnd_matches(struct sudoers_parse_tree *parse_tree, const struct member *m,
+static int
+cmndalias_matches(struct sudoers_parse_tree *parse_tree, struct alias *a,
     const char *runchroot, struct cmnd_info *info)
+{
+    const bool memoize = alias_nesting == 0 && runchroot == NULL;
+    const struct alias_member *am;
+    int matched = UNSPEC;
+    size_t n;
+    debug_decl(cmndalias_matches, SUDOERS_DEBUG_MATCH);
+
+    if (memoize && alias_memo_lookup(parse_tree, a, 0, NULL, NULL, NULL,
+	    &matched, NULL))
+	debug_return_int(matched);
+    if (alias_nesting == 0 &&
+	    (am = alias_index_members(parse_tree, a, &n)) != NULL) {
+	while (n--) {
+	    matched = cmnd_matches_int(parse_tree, am[n].m, am[n].negated,
+		runchroot, info);
+	    if (matched != UNSPEC)
+		break;
+	}
+    } else {
+	alias_nesting++;
+	matched = cmndlist_matches(parse_tree, &a->members, runchroot, info);
+	alias_nesting--;
+    }
+    if (memoize && matched == UNSPEC)
+	alias_memo_store(parse_tree, a, 0, NULL, NULL, NULL, matched, NULL);
+    debug_return_int(matched);
+}
+
+/*
+ * Check cmnd and args against member m with the specified negation.
+ * Returns ALLOW, DENY or UNSPEC.
+ */
+static int
+cmnd_matches_int(struct sudoers_parse_tree *parse_tree, const struct member *m,
+    bool negated, const char *runchroot, struct cmnd_info *info)
 {
     struct alias *a;
     struct sudo_command *c;
     int rc, matched = UNSPEC;
-    debug_decl(cmnd_matches, SUDOERS_DEBUG_MATCH);
+    debug_decl(cmnd_matches_int, SUDOERS_DEBUG_MATCH);
 
     switch (m->type) {
 	case ALL:
 	    if (m->name == NULL) {
-		matched = !m->negated;
+		matched = !negated;
 		break;
 	    }
 	    FALLTHROUGH;
 	case COMMAND:
 	    c = (struct sudo_command *)m->name;
 	    if (command_matches(c->cmnd, c->args, runchroot, info, &c->digests))
-		matched = !m->negated;
+		matched = !negated;
 	    break;
 	case ALIAS:
 	    a = alias_get(parse_tree, m->name, CMNDALIAS);
 	    if (a != NULL) {
-		rc = cmndlist_matches(parse_tree, &a->members, runchroot, info);
+		rc = cmndalias_matches(parse_tree, a, runchroot, info);
 		if (rc != UNSPEC)
-		    matched = m->negated ? !rc : rc;
+		    matched = negated ? !rc : rc;
 		alias_put(a);
 	    }
 	    break;
@@ -419,6 +664,17 @@ cmnd_matches(struct sudoers_parse_tree *parse_tree, const struct member *m,
     debug_return_int(matched);
 }
 
+/*
+ * Check cmnd and args.
+ * Returns ALLOW, DENY or UNSPEC.
+ */
+int
+cmnd_matches(struct sudoers_parse_tree *parse_tree, const struct member *m,
+    const char *runchroot, struct cmnd_info *info)
+{
+    return cmnd_matches_int(parse_tree, m, m->negated, runchroot, info);
+}
+
 /*
  * Returns true if the hostname matches the pattern, else false
  */
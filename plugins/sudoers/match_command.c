@@ -33,12 +33,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#ifdef HAVE_GLOB
-# include <glob.h>
-#else
-# include "compat/glob.h"
-#endif /* HAVE_GLOB */
-#include <dirent.h>
 #include <fcntl.h>
 #include <errno.h>
 #ifdef HAVE_FNMATCH
@@ -210,21 +204,18 @@ set_cmnd_fd(int fd)
  * Return true if user_cmnd names one of the inodes in dir, else false.
  */
 static bool
-command_matches_dir(const char *sudoers_dir, size_t dlen, const char *runchroot,
+command_matches_dir(const char *sudoers_dir, const char *runchroot,
     const struct command_digest_list *digests)
 {
     char buf[PATH_MAX], sdbuf[PATH_MAX];
     struct stat sudoers_stat;
-    struct dirent *dent;
     size_t chrootlen = 0;
-    int fd = -1;
-    DIR *dirp;
+    int len, fd = -1;
     debug_decl(command_matches_dir, SUDOERS_DEBUG_MATCH);
 
     /* Make sudoers_dir relative to the new root, if any. */
     if (runchroot != NULL) {
-	const int len =
-	    snprintf(sdbuf, sizeof(sdbuf), "%s%s", runchroot, sudoers_dir);
+	len = snprintf(sdbuf, sizeof(sdbuf), "%s%s", runchroot, sudoers_dir);
 	if (len >= ssizeof(sdbuf)) {
 	    errno = ENAMETOOLONG;
 	    debug_return_bool(false);
@@ -234,58 +225,38 @@ command_matches_dir(const char *sudoers_dir, size_t dlen, const char *runchroot,
     }
 
     /*
-     * Grot through directory entries, looking for user_base.
+     * Look for user_base in the directory entries, which are cached
+     * since the same directory may be listed in many privileges.
      */
-    dirp = opendir(sudoers_dir);
-    if (dirp == NULL)
+    if (glob_cache_dir_contains(sudoers_dir, user_base) != true)
 	debug_return_bool(false);
 
-    if (strlcpy(buf, sudoers_dir, sizeof(buf)) >= sizeof(buf)) {
-	closedir(dirp);
+    /* ignore paths > PATH_MAX (XXX - log) */
+    len = snprintf(buf, sizeof(buf), "%s%s", sudoers_dir, user_base);
+    if (len < 0 || len >= ssizeof(buf))
 	debug_return_bool(false);
-    }
-    while ((dent = readdir(dirp)) != NULL) {
-	if (fd != -1) {
-	    close(fd);
-	    fd = -1;
-	}
 
-	/* ignore paths > PATH_MAX (XXX - log) */
-	buf[dlen] = '\0';
-	if (strlcat(buf, dent->d_name, sizeof(buf)) >= sizeof(buf))
-	    continue;
-
-	/* only stat if basenames are the same */
-	if (strcmp(user_base, dent->d_name) != 0)
-	    continue;
-
-	/* Open the file for fdexec or for digest matching. */
-	if (!open_cmnd(buf, NULL, digests, &fd))
-	    continue;
-	if (!do_stat(fd, buf, NULL, &sudoers_stat))
-	    continue;
-
-	if (user_stat == NULL ||
-	    (user_stat->st_dev == sudoers_stat.st_dev &&
-	    user_stat->st_ino == sudoers_stat.st_ino)) {
-	    /* buf is already relative to runchroot */
-	    if (!digest_matches(fd, buf, NULL, digests))
-		continue;
-	    free(safe_cmnd);
-	    if ((safe_cmnd = strdup(buf + chrootlen)) == NULL) {
-		sudo_warnx(U_("%s: %s"), __func__,
-		    U_("unable to allocate memory"));
-		dent = NULL;
-	    }
-	    break;
-	}
-    }
-    closedir(dirp);
+    /* Open the file for fdexec or for digest matching. */
+    if (!open_cmnd(buf, NULL, digests, &fd))
+	goto bad;
+    if (!do_stat(fd, buf, NULL, &sudoers_stat))
+	goto bad;
+    if (user_stat != NULL &&
+	(user_stat->st_dev != sudoers_stat.st_dev ||
+	user_stat->st_ino != sudoers_stat.st_ino))
+	goto bad;
 
-    if (dent != NULL) {
-	set_cmnd_fd(fd);
-	debug_return_bool(true);
+    /* buf is already relative to runchroot */
+    if (!digest_matches(fd, buf, NULL, digests))
+	goto bad;
+    free(safe_cmnd);
+    if ((safe_cmnd = strdup(buf + chrootlen)) == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto bad;
     }
+    set_cmnd_fd(fd);
+    debug_return_bool(true);
+bad:
     if (fd != -1)
 	close(fd);
     debug_return_bool(false);
@@ -370,11 +341,11 @@ command_matches_glob(const char *sudoers_cmnd, const char *sudoers_args,
 {
     struct stat sudoers_stat;
     bool bad_digest = false;
-    char **ap, *base, *cp;
+    char * const *ap, * const *paths;
+    char *base, *cp;
     char pathbuf[PATH_MAX];
     int fd = -1;
-    size_t dlen, chrootlen = 0;
-    glob_t gl;
+    size_t dlen, npaths, chrootlen = 0;
     debug_decl(command_matches_glob, SUDOERS_DEBUG_MATCH);
 
     /*
@@ -409,14 +380,15 @@ command_matches_glob(const char *sudoers_cmnd, const char *sudoers_args,
      *  b) there are no args on command line and none required by sudoers OR
      *  c) there are args in sudoers and on command line and they match
      * else return false.
+     * The glob(3) results are cached since the same pattern may be
+     * listed in many privileges.
      */
-    if (glob(sudoers_cmnd, GLOB_NOSORT, NULL, &gl) != 0 || gl.gl_pathc == 0) {
-	globfree(&gl);
+    paths = glob_cache_glob(sudoers_cmnd, &npaths);
+    if (paths == NULL || npaths == 0)
 	debug_return_bool(false);
-    }
     /* If user_cmnd is fully-qualified, check for an exact match. */
     if (user_cmnd[0] == '/') {
-	for (ap = gl.gl_pathv; (cp = *ap) != NULL; ap++) {
+	for (ap = paths; (cp = *ap) != NULL; ap++) {
 	    if (fd != -1) {
 		close(fd);
 		fd = -1;
@@ -454,7 +426,7 @@ command_matches_glob(const char *sudoers_cmnd, const char *sudoers_args,
     }
     /* No exact match, compare basename, st_dev and st_ino. */
     if (!bad_digest) {
-	for (ap = gl.gl_pathv; (cp = *ap) != NULL; ap++) {
+	for (ap = paths; (cp = *ap) != NULL; ap++) {
 	    if (fd != -1) {
 		close(fd);
 		fd = -1;
@@ -466,7 +438,7 @@ command_matches_glob(const char *sudoers_cmnd, const char *sudoers_args,
 	    /* If it ends in '/' it is a directory spec. */
 	    dlen = strlen(cp);
 	    if (cp[dlen - 1] == '/') {
-		if (command_matches_dir(cp, dlen, runchroot, digests))
+		if (command_matches_dir(cp, runchroot, digests))
 		    debug_return_bool(true);
 		continue;
 	    }
@@ -500,7 +472,6 @@ command_matches_glob(const char *sudoers_cmnd, const char *sudoers_args,
 	}
     }
 done:
-    globfree(&gl);
     if (cp != NULL) {
 	if (command_args_match(sudoers_cmnd, sudoers_args)) {
 	    /* safe_cmnd was set above. */
@@ -526,8 +497,7 @@ command_matches_normal(const char *sudoers_cmnd, const char *sudoers_args,
     /* If it ends in '/' it is a directory spec. */
     dlen = strlen(sudoers_cmnd);
     if (sudoers_cmnd[dlen - 1] == '/') {
-	debug_return_bool(command_matches_dir(sudoers_cmnd, dlen, runchroot,
-	    digests));
+	debug_return_bool(command_matches_dir(sudoers_cmnd, runchroot, digests));
     }
 
     /* Only proceed if user_base and basename(sudoers_cmnd) match */
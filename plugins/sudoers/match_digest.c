@@ -28,6 +28,7 @@
 
 #include <config.h>
 
+#include <sys/stat.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -49,6 +50,8 @@ digest_matches(int fd, const char *path, const char *runchroot,
     size_t digest_len = (size_t)-1;
     char pathbuf[PATH_MAX];
     bool matched = false;
+    bool have_sb;
+    struct stat sb;
     debug_decl(digest_matches, SUDOERS_DEBUG_MATCH);
 
     if (TAILQ_EMPTY(digests)) {
@@ -71,12 +74,26 @@ digest_matches(int fd, const char *path, const char *runchroot,
 	path = pathbuf;
     }
 
+    /* Stat before computing the digest for the digest cache. */
+    have_sb = fstat(fd, &sb) == 0;
+
     TAILQ_FOREACH(digest, digests, entries) {
-	/* Compute file digest if needed. */
+	/* Compute file digest if needed and not cached. */
 	if (digest->digest_type != digest_type) {
 	    free(file_digest);
-	    file_digest = sudo_filedigest(fd, path, digest->digest_type,
-		&digest_len);
+	    file_digest = NULL;
+	    if (have_sb) {
+		file_digest = digest_cache_lookup(&sb, digest->digest_type,
+		    &digest_len);
+	    }
+	    if (file_digest == NULL) {
+		file_digest = sudo_filedigest(fd, path, digest->digest_type,
+		    &digest_len);
+		if (file_digest != NULL && have_sb) {
+		    digest_cache_store(&sb, digest->digest_type, file_digest,
+			digest_len);
+		}
+	    }
 	    if (lseek(fd, (off_t)0, SEEK_SET) == -1) {
 		sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
 		    "unable to rewind digest fd");
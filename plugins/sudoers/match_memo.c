@@ -0,0 +1,263 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Memoized results of matching user, host and runas member lists.
+ *
+ * The same member list is often checked many times while looking up
+ * a command: the users list of a userspec in each pass, a privilege's
+ * host list and the runas lists that are shared by consecutive cmndspecs.
+ * Between match_memo_begin() and match_memo_end() the result for each
+ * list is stored in a hash table keyed by the list's address along with
+ * the request data it depends on, so each list is only matched once.
+ * The member lists and request data must not change in the meantime.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sudoers.h"
+
+struct match_memo_entry {
+    unsigned int generation;	/* valid if it matches match_memo_generation */
+    int kind;			/* MATCH_MEMO_{USER,HOST,RUNAS} */
+    const void *list1, *list2;	/* member lists matched */
+    const void *key[3];		/* request data the result depends on */
+    int result;
+    struct member *matching_user;
+    struct member *matching_group;
+};
+
+static struct match_memo_entry *match_memo;
+static unsigned int match_memo_size;	/* a power of 2 */
+static unsigned int match_memo_count;
+static unsigned int match_memo_generation;
+static bool match_memo_active;
+static unsigned int match_memo_hits, match_memo_misses;
+
+static unsigned int
+match_memo_hash(int kind, const void *list1, const void *list2)
+{
+    unsigned long h;
+
+    /* Member lists are at least pointer-aligned, discard the low bits. */
+    h = ((unsigned long)list1 >> 3) * 0x9e3779b1UL;
+    h ^= ((unsigned long)list2 >> 3) + 0x7f4a7c15UL + (h << 6) + (h >> 2);
+    h ^= (unsigned long)kind;
+    return (unsigned int)(h ^ (h >> 16));
+}
+
+/*
+ * Find the entry for the given key, or the empty slot where it belongs.
+ */
+static struct match_memo_entry *
+match_memo_find(int kind, const void *list1, const void *list2,
+    const void *key0, const void *key1, const void *key2)
+{
+    struct match_memo_entry *entry;
+    unsigned int h;
+
+    h = match_memo_hash(kind, list1, list2) & (match_memo_size - 1);
+    for (;;) {
+	entry = &match_memo[h];
+	if (entry->generation != match_memo_generation)
+	    return entry;
+	if (entry->kind == kind && entry->list1 == list1 &&
+		entry->list2 == list2 && entry->key[0] == key0 &&
+		entry->key[1] == key1 && entry->key[2] == key2)
+	    return entry;
+	h = (h + 1) & (match_memo_size - 1);
+    }
+}
+
+/*
+ * Double the size of the hash table, keeping the current entries.
+ * Returns true on success, else false.
+ */
+static bool
+match_memo_grow(void)
+{
+    struct match_memo_entry *old = match_memo, *entry;
+    unsigned int i, old_size = match_memo_size;
+    debug_decl(match_memo_grow, SUDOERS_DEBUG_MATCH);
+
+    match_memo = calloc(old_size * 2, sizeof(*match_memo));
+    if (match_memo == NULL) {
+	match_memo = old;
+	debug_return_bool(false);
+    }
+    match_memo_size = old_size * 2;
+    for (i = 0; i < old_size; i++) {
+	if (old[i].generation != match_memo_generation)
+	    continue;
+	entry = match_memo_find(old[i].kind, old[i].list1, old[i].list2,
+	    old[i].key[0], old[i].key[1], old[i].key[2]);
+	*entry = old[i];
+    }
+    free(old);
+
+    debug_return_bool(true);
+}
+
+/*
+ * Start a policy check; list and alias match results are memoized
+ * until match_memo_end() is called.
+ */
+void
+match_memo_begin(struct sudoers_parse_tree *parse_tree)
+{
+    debug_decl(match_memo_begin, SUDOERS_DEBUG_MATCH);
+
+    alias_memo_begin(parse_tree);
+
+    if (match_memo == NULL) {
+	match_memo = calloc(64, sizeof(*match_memo));
+	if (match_memo == NULL) {
+	    /* Not fatal, list results are simply not memoized. */
+	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+		"unable to allocate memory");
+	    debug_return;
+	}
+	match_memo_size = 64;
+    }
+
+    /* Invalidate old entries by bumping the generation. */
+    if (++match_memo_generation == 0) {
+	memset(match_memo, 0, match_memo_size * sizeof(*match_memo));
+	match_memo_generation = 1;
+    }
+    match_memo_count = 0;
+    match_memo_hits = 0;
+    match_memo_misses = 0;
+    match_memo_active = true;
+
+    debug_return;
+}
+
+/*
+ * End a policy check started by match_memo_begin().
+ */
+void
+match_memo_end(struct sudoers_parse_tree *parse_tree)
+{
+    debug_decl(match_memo_end, SUDOERS_DEBUG_MATCH);
+
+    if (match_memo_active) {
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "member list memo: %u hits, %u misses, %u entries",
+	    match_memo_hits, match_memo_misses, match_memo_count);
+	match_memo_active = false;
+    }
+    alias_memo_end(parse_tree);
+
+    debug_return;
+}
+
+/*
+ * Look up the memoized result of matching list1 and list2.
+ * For MATCH_MEMO_RUNAS, the matching user and group members, if any,
+ * are stored in matching_user and matching_group when not NULL.
+ * Returns true if found, else false.
+ */
+bool
+match_memo_lookup(int kind, const void *list1, const void *list2,
+    const void *key0, const void *key1, const void *key2, int *result,
+    struct member **matching_user, struct member **matching_group)
+{
+    struct match_memo_entry *entry;
+    debug_decl(match_memo_lookup, SUDOERS_DEBUG_MATCH);
+
+    if (!match_memo_active)
+	debug_return_bool(false);
+
+    entry = match_memo_find(kind, list1, list2, key0, key1, key2);
+    if (entry->generation != match_memo_generation) {
+	match_memo_misses++;
+	debug_return_bool(false);
+    }
+    match_memo_hits++;
+    *result = entry->result;
+    if (matching_user != NULL && entry->matching_user != NULL)
+	*matching_user = entry->matching_user;
+    if (matching_group != NULL && entry->matching_group != NULL)
+	*matching_group = entry->matching_group;
+    debug_return_bool(true);
+}
+
+/*
+ * Memoize the result of matching list1 and list2.
+ */
+void
+match_memo_store(int kind, const void *list1, const void *list2,
+    const void *key0, const void *key1, const void *key2, int result,
+    struct member *matching_user, struct member *matching_group)
+{
+    struct match_memo_entry *entry;
+    debug_decl(match_memo_store, SUDOERS_DEBUG_MATCH);
+
+    if (!match_memo_active)
+	debug_return;
+
+    /* Keep the load factor at or below 1/2. */
+    if ((match_memo_count + 1) * 2 > match_memo_size) {
+	if (!match_memo_grow())
+	    debug_return;
+    }
+
+    entry = match_memo_find(kind, list1, list2, key0, key1, key2);
+    if (entry->generation != match_memo_generation) {
+	entry->generation = match_memo_generation;
+	entry->kind = kind;
+	entry->list1 = list1;
+	entry->list2 = list2;
+	entry->key[0] = key0;
+	entry->key[1] = key1;
+	entry->key[2] = key2;
+	match_memo_count++;
+    }
+    entry->result = result;
+    entry->matching_user = matching_user;
+    entry->matching_group = matching_group;
+
+    debug_return;
+}
+
+/*
+ * Free the memo table.
+ */
+void
+match_memo_free(void)
+{
+    debug_decl(match_memo_free, SUDOERS_DEBUG_MATCH);
+
+    free(match_memo);
+    match_memo = NULL;
+    match_memo_size = 0;
+    match_memo_count = 0;
+    match_memo_active = false;
+
+    debug_return;
+}
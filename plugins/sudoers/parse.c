@@ -47,8 +47,9 @@ sudoers_lookup_pseudo(struct sudo_nss_list *snl, struct passwd *pw,
     struct sudo_nss *nss;
     struct cmndspec *cs;
     struct privilege *priv;
-    struct userspec *us;
+    struct userspec *us, **specs;
     struct defaults *def;
+    size_t i, nspecs;
     int nopass;
     enum def_tuple pwcheck;
     debug_decl(sudoers_lookup_pseudo, SUDOERS_DEBUG_PARSER);
@@ -67,7 +68,14 @@ sudoers_lookup_pseudo(struct sudo_nss_list *snl, struct passwd *pw,
 	    SET(validated, VALIDATE_ERROR);
 	    break;
 	}
-	TAILQ_FOREACH(us, &nss->parse_tree->userspecs, entries) {
+	specs = userspec_index_lookup(nss->parse_tree, pw, &nspecs);
+	if (specs == NULL) {
+	    SET(validated, VALIDATE_ERROR);
+	    break;
+	}
+	match_memo_begin(nss->parse_tree);
+	for (i = 0; i < nspecs; i++) {
+	    us = specs[i];
 	    if (userlist_matches(nss->parse_tree, pw, &us->users) != ALLOW)
 		continue;
 	    TAILQ_FOREACH(priv, &us->privileges, entries) {
@@ -98,6 +106,8 @@ sudoers_lookup_pseudo(struct sudo_nss_list *snl, struct passwd *pw,
 		}
 	    }
 	}
+	match_memo_end(nss->parse_tree);
+	free(specs);
     }
     if (match == ALLOW || user_uid == 0) {
 	/* User has an entry for this host. */
@@ -116,66 +126,106 @@ sudoers_lookup_check(struct sudo_nss *nss, struct passwd *pw,
     int *validated, struct cmnd_info *info, struct cmndspec **matching_cs,
     struct defaults_list **defs, time_t now)
 {
-    int host_match, runas_match, cmnd_match;
+    int host_match = UNSPEC, user_match = UNSPEC, runas_match, cmnd_match;
+    struct userspec *us, *prev_us = NULL, **specs;
+    struct privilege *priv, *prev_priv = NULL;
+    struct cmndspec_ref *refs;
     struct cmndspec *cs;
-    struct privilege *priv;
-    struct userspec *us;
     struct member *matching_user;
+    bool host_found = false;
+    size_t nspecs, nrefs;
     debug_decl(sudoers_lookup_check, SUDOERS_DEBUG_PARSER);
 
     memset(info, 0, sizeof(*info));
 
-    TAILQ_FOREACH_REVERSE(us, &nss->parse_tree->userspecs, userspec_list, entries) {
+    /* Check whether pw may run anything on this host. */
+    specs = userspec_index_lookup(nss->parse_tree, pw, &nspecs);
+    if (specs == NULL) {
+	SET(*validated, VALIDATE_ERROR);
+	debug_return_int(UNSPEC);
+    }
+    while (nspecs-- && !host_found) {
+	us = specs[nspecs];
 	if (userlist_matches(nss->parse_tree, pw, &us->users) != ALLOW)
 	    continue;
 	CLR(*validated, FLAG_NO_USER);
 	TAILQ_FOREACH_REVERSE(priv, &us->privileges, privilege_list, entries) {
-	    host_match = hostlist_matches(nss->parse_tree, pw, &priv->hostlist);
-	    if (host_match == ALLOW)
+	    if (hostlist_matches(nss->parse_tree, pw, &priv->hostlist) == ALLOW) {
 		CLR(*validated, FLAG_NO_HOST);
-	    else
+		host_found = true;
+		break;
+	    }
+	}
+    }
+    free(specs);
+    if (!host_found)
+	debug_return_int(UNSPEC);
+
+    /* Only check the cmndspecs that can match user_cmnd, last match wins. */
+    refs = cmnd_index_lookup(nss->parse_tree, user_base, &nrefs);
+    if (refs == NULL) {
+	SET(*validated, VALIDATE_ERROR);
+	debug_return_int(UNSPEC);
+    }
+    while (nrefs--) {
+	us = refs[nrefs].us;
+	priv = refs[nrefs].priv;
+	cs = refs[nrefs].cs;
+
+	/* Consecutive cmndspecs often share a userspec and privilege. */
+	if (us != prev_us) {
+	    user_match = userlist_matches(nss->parse_tree, pw, &us->users);
+	    prev_us = us;
+	    prev_priv = NULL;
+	}
+	if (user_match != ALLOW)
+	    continue;
+	if (priv != prev_priv) {
+	    host_match = hostlist_matches(nss->parse_tree, pw, &priv->hostlist);
+	    prev_priv = priv;
+	}
+	if (host_match != ALLOW)
+	    continue;
+
+	if (cs->notbefore != UNSPEC) {
+	    if (now < cs->notbefore)
 		continue;
-	    TAILQ_FOREACH_REVERSE(cs, &priv->cmndlist, cmndspec_list, entries) {
-		if (cs->notbefore != UNSPEC) {
-		    if (now < cs->notbefore)
-			continue;
-		}
-		if (cs->notafter != UNSPEC) {
-		    if (now > cs->notafter)
-			continue;
-		}
-		matching_user = NULL;
-		runas_match = runaslist_matches(nss->parse_tree,
-		    cs->runasuserlist, cs->runasgrouplist, &matching_user,
-		    NULL);
-		if (runas_match == ALLOW) {
-		    cmnd_match = cmnd_matches(nss->parse_tree, cs->cmnd,
-			cs->runchroot, info);
-		    if (cmnd_match != UNSPEC) {
-			/*
-			 * If user is running command as himself,
-			 * set runas_pw = sudo_user.pw.
-			 * XXX - hack, want more general solution
-			 */
-			if (matching_user && matching_user->type == MYSELF) {
-			    sudo_pw_delref(runas_pw);
-			    sudo_pw_addref(sudo_user.pw);
-			    runas_pw = sudo_user.pw;
-			}
-			*matching_cs = cs;
-			*defs = &priv->defaults;
-			sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
-			    "userspec matched @ %s:%d:%d: %s",
-			    us->file ? us->file : "???", us->line, us->column,
-			    cmnd_match ? "allowed" : "denied");
-			debug_return_int(cmnd_match);
-		    }
-		    free(info->cmnd_path);
-		    memset(info, 0, sizeof(*info));
+	}
+	if (cs->notafter != UNSPEC) {
+	    if (now > cs->notafter)
+		continue;
+	}
+	matching_user = NULL;
+	runas_match = runaslist_matches(nss->parse_tree, cs->runasuserlist,
+	    cs->runasgrouplist, &matching_user, NULL);
+	if (runas_match == ALLOW) {
+	    cmnd_match = cmnd_matches(nss->parse_tree, cs->cmnd,
+		cs->runchroot, info);
+	    if (cmnd_match != UNSPEC) {
+		/*
+		 * If user is running command as himself,
+		 * set runas_pw = sudo_user.pw.
+		 * XXX - hack, want more general solution
+		 */
+		if (matching_user && matching_user->type == MYSELF) {
+		    sudo_pw_delref(runas_pw);
+		    sudo_pw_addref(sudo_user.pw);
+		    runas_pw = sudo_user.pw;
 		}
+		*matching_cs = cs;
+		*defs = &priv->defaults;
+		sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+		    "userspec matched @ %s:%d:%d: %s",
+		    us->file ? us->file : "???", us->line, us->column,
+		    cmnd_match ? "allowed" : "denied");
+		free(refs);
+		debug_return_int(cmnd_match);
 	    }
+	    free(info->cmnd_path);
+	    memset(info, 0, sizeof(*info));
 	}
     }
+    free(refs);
     debug_return_int(UNSPEC);
 }
 
@@ -364,7 +414,9 @@ sudoers_lookup(struct sudo_nss_list *snl, struct passwd *pw, int *cmnd_status,
 	    break;
 	}
 
+	match_memo_begin(nss->parse_tree);
 	m = sudoers_lookup_check(nss, pw, &validated, &info, &cs, &defs, now);
+	match_memo_end(nss->parse_tree);
 	if (m != UNSPEC) {
 	    match = m;
 	    parse_tree = nss->parse_tree;
@@ -616,11 +668,16 @@ static int
 sudo_display_userspecs(struct sudoers_parse_tree *parse_tree, struct passwd *pw,
     struct sudo_lbuf *lbuf, bool verbose)
 {
-    struct userspec *us;
+    struct userspec *us, **specs;
+    size_t i, nspecs;
     int nfound = 0;
     debug_decl(sudo_display_userspecs, SUDOERS_DEBUG_PARSER);
 
-    TAILQ_FOREACH(us, &parse_tree->userspecs, entries) {
+    specs = userspec_index_lookup(parse_tree, pw, &nspecs);
+    if (specs == NULL)
+	debug_return_int(-1);
+    for (i = 0; i < nspecs; i++) {
+	us = specs[i];
 	if (userlist_matches(parse_tree, pw, &us->users) != ALLOW)
 	    continue;
 
@@ -629,6 +686,7 @@ sudo_display_userspecs(struct sudoers_parse_tree *parse_tree, struct passwd *pw,
 	else
 	    nfound += display_priv_short(parse_tree, pw, us, lbuf);
     }
+    free(specs);
     if (sudo_lbuf_error(lbuf))
 	debug_return_int(-1);
     debug_return_int(nfound);
@@ -831,7 +889,9 @@ display_privs(struct sudo_nss_list *snl, struct passwd *pw, bool verbose)
     count = 0;
     TAILQ_FOREACH(nss, snl, entries) {
 	if (nss->query(nss, pw) != -1) {
+	    match_memo_begin(nss->parse_tree);
 	    n = sudo_display_userspecs(nss->parse_tree, pw, &priv_buf, verbose);
+	    match_memo_end(nss->parse_tree);
 	    if (n == -1)
 		goto bad;
 	    count += n;
@@ -863,39 +923,48 @@ bad:
 
 static int
 display_cmnd_check(struct sudoers_parse_tree *parse_tree, struct passwd *pw,
-    time_t now)
+    struct cmndspec_ref *refs, size_t nrefs, time_t now)
 {
-    int host_match, runas_match, cmnd_match;
+    int host_match = UNSPEC, user_match = UNSPEC, runas_match, cmnd_match;
+    struct userspec *us, *prev_us = NULL;
+    struct privilege *priv, *prev_priv = NULL;
     struct cmndspec *cs;
-    struct privilege *priv;
-    struct userspec *us;
     debug_decl(display_cmnd_check, SUDOERS_DEBUG_PARSER);
 
-    TAILQ_FOREACH_REVERSE(us, &parse_tree->userspecs, userspec_list, entries) {
-	if (userlist_matches(parse_tree, pw, &us->users) != ALLOW)
+    while (nrefs--) {
+	us = refs[nrefs].us;
+	priv = refs[nrefs].priv;
+	cs = refs[nrefs].cs;
+
+	if (us != prev_us) {
+	    user_match = userlist_matches(parse_tree, pw, &us->users);
+	    prev_us = us;
+	    prev_priv = NULL;
+	}
+	if (user_match != ALLOW)
 	    continue;
-	TAILQ_FOREACH_REVERSE(priv, &us->privileges, privilege_list, entries) {
+	if (priv != prev_priv) {
 	    host_match = hostlist_matches(parse_tree, pw, &priv->hostlist);
-	    if (host_match != ALLOW)
+	    prev_priv = priv;
+	}
+	if (host_match != ALLOW)
+	    continue;
+
+	if (cs->notbefore != UNSPEC) {
+	    if (now < cs->notbefore)
 		continue;
-	    TAILQ_FOREACH_REVERSE(cs, &priv->cmndlist, cmndspec_list, entries) {
-		if (cs->notbefore != UNSPEC) {
-		    if (now < cs->notbefore)
-			continue;
-		}
-		if (cs->notafter != UNSPEC) {
-		    if (now > cs->notafter)
-			continue;
-		}
-		runas_match = runaslist_matches(parse_tree, cs->runasuserlist,
-		    cs->runasgrouplist, NULL, NULL);
-		if (runas_match == ALLOW) {
-		    cmnd_match = cmnd_matches(parse_tree, cs->cmnd,
-			cs->runchroot, NULL);
-		    if (cmnd_match != UNSPEC)
-			debug_return_int(cmnd_match);
-		}
-	    }
+	}
+	if (cs->notafter != UNSPEC) {
+	    if (now > cs->notafter)
+		continue;
+	}
+	runas_match = runaslist_matches(parse_tree, cs->runasuserlist,
+	    cs->runasgrouplist, NULL, NULL);
+	if (runas_match == ALLOW) {
+	    cmnd_match = cmnd_matches(parse_tree, cs->cmnd,
+		cs->runchroot, NULL);
+	    if (cmnd_match != UNSPEC)
+		debug_return_int(cmnd_match);
 	}
     }
     debug_return_int(UNSPEC);
@@ -909,7 +978,9 @@ display_cmnd_check(struct sudoers_parse_tree *parse_tree, struct passwd *pw,
 int
 display_cmnd(struct sudo_nss_list *snl, struct passwd *pw)
 {
+    struct cmndspec_ref *refs;
     struct sudo_nss *nss;
+    size_t nrefs;
     int m, match = UNSPEC;
     int ret = false;
     time_t now;
@@ -923,7 +994,14 @@ display_cmnd(struct sudo_nss_list *snl, struct passwd *pw)
 	    debug_return_int(-1);
 	}
 
-	m = display_cmnd_check(nss->parse_tree, pw, now);
+	/* Only check the cmndspecs that can match user_cmnd. */
+	refs = cmnd_index_lookup(nss->parse_tree, user_base, &nrefs);
+	if (refs == NULL)
+	    debug_return_int(-1);
+	match_memo_begin(nss->parse_tree);
+	m = display_cmnd_check(nss->parse_tree, pw, refs, nrefs, now);
+	match_memo_end(nss->parse_tree);
+	free(refs);
 	if (m != UNSPEC)
 	    match = m;
 
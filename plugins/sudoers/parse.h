@@ -253,6 +253,7 @@ struct alias {
     char *name;				/* alias name */
     unsigned short type;		/* {USER,HOST,RUNAS,CMND}ALIAS */
     short used;				/* "used" flag for cycle detection */
+    unsigned int id;			/* id in the alias index */
     int line;				/* line number of alias entry */
     int column;				/* column number of alias entry */
     char *file;				/* file the alias entry was in */
@@ -282,9 +283,32 @@ struct sudoers_parse_tree {
     struct userspec_list userspecs;
     struct defaults_list defaults;
     struct rbtree *aliases;
+    struct userspec_index *uindex;
+    struct cmnd_index *cindex;
+    struct alias_index *aindex;
     const char *shost, *lhost;
 };
 
+/*
+ * A member of a flattened alias, see alias_index.c.
+ * The negated flag includes the negation of any enclosing alias references.
+ * If literal is set, m is an alias reference that is matched as a name.
+ */
+struct alias_member {
+    struct member *m;
+    bool negated;
+    bool literal;
+};
+
+/*
+ * A cmndspec along with the privilege and userspec it belongs to.
+ */
+struct cmndspec_ref {
+    struct userspec *us;
+    struct privilege *priv;
+    struct cmndspec *cs;
+};
+
 /*
  * Info about the command being resolved.
  */
@@ -307,6 +331,36 @@ void alias_apply(struct sudoers_parse_tree *parse_tree, int (*func)(struct sudoe
 void alias_free(void *a);
 void alias_put(struct alias *a);
 
+/* alias_index.c */
+bool alias_index_build(struct sudoers_parse_tree *parse_tree);
+void alias_index_free(struct alias_index *aidx);
+struct alias *alias_index_lookup(struct sudoers_parse_tree *parse_tree, const char *name, int type);
+const struct alias_member *alias_index_members(struct sudoers_parse_tree *parse_tree, const struct alias *a, size_t *nmembers);
+void alias_memo_begin(struct sudoers_parse_tree *parse_tree);
+void alias_memo_end(struct sudoers_parse_tree *parse_tree);
+bool alias_memo_lookup(struct sudoers_parse_tree *parse_tree, const struct alias *a, int slot, const void *key0, const void *key1, const void *key2, int *result, struct member **matched);
+void alias_memo_store(struct sudoers_parse_tree *parse_tree, const struct alias *a, int slot, const void *key0, const void *key1, const void *key2, int result, struct member *matched);
+
+/* cmnd_index.c */
+bool cmnd_index_build(struct sudoers_parse_tree *parse_tree);
+void cmnd_index_free(struct cmnd_index *cidx);
+struct cmndspec_ref *cmnd_index_lookup(struct sudoers_parse_tree *parse_tree, const char *base, size_t *nrefs);
+
+/* match_memo.c */
+#define MATCH_MEMO_USER		1
+#define MATCH_MEMO_HOST		2
+#define MATCH_MEMO_RUNAS	3
+void match_memo_begin(struct sudoers_parse_tree *parse_tree);
+void match_memo_end(struct sudoers_parse_tree *parse_tree);
+bool match_memo_lookup(int kind, const void *list1, const void *list2, const void *key0, const void *key1, const void *key2, int *result, struct member **matching_user, struct member **matching_group);
+void match_memo_store(int kind, const void *list1, const void *list2, const void *key0, const void *key1, const void *key2, int result, struct member *matching_user, struct member *matching_group);
+void match_memo_free(void);
+
+/* glob_cache.c */
+char * const *glob_cache_glob(const char *pattern, size_t *npaths);
+int glob_cache_dir_contains(const char *dir, const char *name);
+void glob_cache_free(void);
+
 /* gram.c */
 extern struct sudoers_parse_tree parsed_policy;
 bool init_parser(const char *path, bool quiet, bool strict);
@@ -322,6 +376,20 @@ void init_parse_tree(struct sudoers_parse_tree *parse_tree, const char *lhost, c
 void free_parse_tree(struct sudoers_parse_tree *parse_tree);
 void reparent_parse_tree(struct sudoers_parse_tree *new_tree);
 
+/* image.c */
+#define SUDOERS_IMAGE_SUFFIX	".img"
+void sudoers_image_reset(void);
+bool sudoers_image_add_source(const char *path, const struct stat *sb);
+bool sudoers_image_set_host(const char *shost);
+char *sudoers_image_path(const char *sudoers_path);
+bool sudoers_image_write(struct sudoers_parse_tree *parse_tree, const char *path, uid_t uid, gid_t gid, mode_t mode);
+bool sudoers_image_read(int fd, const char *sudoers_path, struct sudoers_parse_tree *parse_tree);
+
+/* userspec_index.c */
+bool userspec_index_build(struct sudoers_parse_tree *parse_tree);
+void userspec_index_free(struct userspec_index *uidx);
+struct userspec **userspec_index_lookup(struct sudoers_parse_tree *parse_tree, const struct passwd *pw, size_t *nspecs);
+
 /* match_addr.c */
 bool addr_matches(char *n);
 
@@ -374,6 +442,10 @@ unsigned char *sudo_filedigest(int fd, const char *file, int digest_type, size_t
 /* digestname.c */
 const char *digest_type_to_name(int digest_type);
 
+/* digest_cache.c */
+unsigned char *digest_cache_lookup(const struct stat *sb, int digest_type, size_t *digest_len);
+void digest_cache_store(const struct stat *sb, int digest_type, const unsigned char *digest, size_t digest_len);
+
 /* parse.c */
 struct sudo_nss_list;
 int sudoers_lookup(struct sudo_nss_list *snl, struct passwd *pw, int *cmnd_status, int pwflag);
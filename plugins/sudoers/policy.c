@@ -54,6 +54,9 @@ sudo_conv_t sudo_conv;
 sudo_printf_t sudo_printf;
 const char *path_ldap_conf = _PATH_LDAP_CONF;
 const char *path_ldap_secret = _PATH_LDAP_SECRET;
+const char *sssd_cache_file;
+unsigned int sssd_cache_timeout = 300;
+unsigned int sssd_negative_timeout = 60;
 static bool session_opened;
 
 extern sudo_dso_public struct policy_plugin sudoers_policy;
@@ -128,6 +131,43 @@ sudoers_policy_deserialize_info(void *v)
 		}
 		continue;
 	    }
+	    if (MATCHES(*cur, "pwcache_file=")) {
+		CHECK(*cur, "pwcache_file=");
+		pwcache_file = *cur + sizeof("pwcache_file=") - 1;
+		continue;
+	    }
+	    if (MATCHES(*cur, "pwcache_timeout=")) {
+		p = *cur + sizeof("pwcache_timeout=") - 1;
+		pwcache_timeout = sudo_strtonum(p, 0, INT_MAX, &errstr);
+		if (errstr != NULL) {
+		    sudo_warnx(U_("%s: %s"), *cur, U_(errstr));
+		    goto bad;
+		}
+		continue;
+	    }
+	    if (MATCHES(*cur, "sssd_cache_file=")) {
+		CHECK(*cur, "sssd_cache_file=");
+		sssd_cache_file = *cur + sizeof("sssd_cache_file=") - 1;
+		continue;
+	    }
+	    if (MATCHES(*cur, "sssd_cache_timeout=")) {
+		p = *cur + sizeof("sssd_cache_timeout=") - 1;
+		sssd_cache_timeout = sudo_strtonum(p, 0, INT_MAX, &errstr);
+		if (errstr != NULL) {
+		    sudo_warnx(U_("%s: %s"), *cur, U_(errstr));
+		    goto bad;
+		}
+		continue;
+	    }
+	    if (MATCHES(*cur, "sssd_negative_timeout=")) {
+		p = *cur + sizeof("sssd_negative_timeout=") - 1;
+		sssd_negative_timeout = sudo_strtonum(p, 0, INT_MAX, &errstr);
+		if (errstr != NULL) {
+		    sudo_warnx(U_("%s: %s"), *cur, U_(errstr));
+		    goto bad;
+		}
+		continue;
+	    }
 	    if (MATCHES(*cur, "sudoers_file=")) {
 		CHECK(*cur, "sudoers_file=");
 		sudoers_file = *cur + sizeof("sudoers_file=") - 1;
@@ -597,7 +637,7 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
 	debug_return_bool(true);	/* nothing to do */
 
     /* Increase the length of command_info as needed, it is *not* checked. */
-    command_info = calloc(55, sizeof(char *));
+    command_info = calloc(58, sizeof(char *));
     if (command_info == NULL)
 	goto oom;
 
@@ -626,6 +666,11 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
 	if (def_compress_io) {
 	    if ((command_info[info_len++] = strdup("iolog_compress=true")) == NULL)
 		goto oom;
+	    if (def_iolog_codec != NULL) {
+		if (asprintf(&command_info[info_len++], "iolog_codec=%s",
+			def_iolog_codec) == -1)
+		    goto oom;
+	    }
 	}
 	if (def_iolog_flush) {
 	    if ((command_info[info_len++] = strdup("iolog_flush=true")) == NULL)
@@ -787,6 +832,15 @@ sudoers_policy_store_result(bool accepted, char *argv[], char *envp[],
 
 	if (asprintf(&command_info[info_len++], "log_server_timeout=%u", def_log_server_timeout) == -1)
 	    goto oom;
+
+	if (def_log_server_spool != NULL) {
+	    if ((command_info[info_len++] = sudo_new_key_val("log_server_spool", def_log_server_spool)) == NULL)
+		goto oom;
+	}
+	if (def_log_server_async) {
+	    if ((command_info[info_len++] = strdup("log_server_async=true")) == NULL)
+		goto oom;
+	}
     }
 
     if ((command_info[info_len++] = sudo_new_key_val("log_server_keepalive",
@@ -0,0 +1,506 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Persistent cache of passwd and group lookups, enabled by the
+ * "pwcache_file" sudoers plugin argument.  When the name service is
+ * remote (LDAP, SSSD, NIS) each sudo invocation looks up the same user
+ * and group entries over the network.  The cache file lets one sudo
+ * run reuse the entries looked up by an earlier one.
+ *
+ * This is a slot cache (see root_cache.c) where each slot holds one
+ * serialized passwd entry, group entry or group ID list, keyed by the
+ * lookup type and key.  Entries older than pwcache_timeout seconds are
+ * ignored and failed lookups are never cached, so a new user or group
+ * is always seen.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pwd.h>
+#include <grp.h>
+
+#include "sudoers.h"
+
+#define PWCACHE_MAGIC		0x43575053	/* "SPWC" little endian */
+#define PWCACHE_VERSION		1
+#define PWCACHE_SLOTS		1024
+#define PWCACHE_SLOT_SIZE	2048
+#define PWCACHE_NAME_MAX	64
+#define PWCACHE_MAX_GROUP_MEMBERS 256
+
+/* Lookup types, also used as the slot type. */
+#define PWCACHE_PW_BYUID	1
+#define PWCACHE_PW_BYNAME	2
+#define PWCACHE_GR_BYGID	3
+#define PWCACHE_GR_BYNAME	4
+#define PWCACHE_GIDLIST		5
+
+struct pwcache_slot_header {
+    uint32_t type;
+    uint32_t id;
+    int64_t stored;
+    uint32_t datalen;
+    uint32_t pad;
+    char name[PWCACHE_NAME_MAX];
+};
+
+#define PWCACHE_DATA_MAX \
+    (PWCACHE_SLOT_SIZE - sizeof(struct pwcache_slot_header))
+
+struct pwcache_slot {
+    struct pwcache_slot_header hdr;
+    unsigned char data[PWCACHE_DATA_MAX];
+};
+
+/* Set via the pwcache_file and pwcache_timeout plugin arguments. */
+const char *pwcache_file;
+unsigned int pwcache_timeout = 300;
+
+/* Storage for the entries returned by the lookup functions. */
+static struct pwcache_slot pwcache_slot;
+static char *pwcache_gr_mem[PWCACHE_MAX_GROUP_MEMBERS + 1];
+
+/*
+ * Fill in the key fields of slot.  Returns false if the name is too
+ * long to be cached.
+ */
+static bool
+pwcache_fill_key(struct pwcache_slot *slot, int type, unsigned int id,
+    const char *name)
+{
+    memset(&slot->hdr, 0, sizeof(slot->hdr));
+    slot->hdr.type = type;
+    slot->hdr.id = id;
+    if (name != NULL) {
+	if (strlcpy(slot->hdr.name, name, sizeof(slot->hdr.name)) >=
+		sizeof(slot->hdr.name))
+	    return false;
+    }
+    return true;
+}
+
+/*
+ * Return the offset of the slot for the given key.
+ */
+static off_t
+pwcache_slot_offset(const struct pwcache_slot *key)
+{
+    const unsigned char *cp;
+    uint32_t h = 2166136261U;	/* FNV-1a */
+
+    h = (h ^ key->hdr.type) * 16777619U;
+    h = (h ^ key->hdr.id) * 16777619U;
+    for (cp = (const unsigned char *)key->hdr.name; *cp != '\0'; cp++)
+	h = (h ^ *cp) * 16777619U;
+    return SLOT_CACHE_HDR_LEN +
+	(off_t)(h % PWCACHE_SLOTS) * PWCACHE_SLOT_SIZE;
+}
+
+/*
+ * Open and lock the cache file, creating or resetting it as needed.
+ * Returns the file descriptor, or -1 if the cache is disabled or
+ * cannot be used securely.
+ */
+static int
+pwcache_open(void)
+{
+    debug_decl(pwcache_open, SUDOERS_DEBUG_NSS);
+
+    if (pwcache_file == NULL || pwcache_timeout == 0)
+	debug_return_int(-1);
+    debug_return_int(sudo_open_slot_cache(pwcache_file, PWCACHE_MAGIC,
+	PWCACHE_VERSION, PWCACHE_SLOTS, PWCACHE_SLOT_SIZE));
+}
+
+/*
+ * Read the unexpired slot for the given key into pwcache_slot.
+ * Returns true if found, else false.
+ */
+static bool
+pwcache_read(int type, unsigned int id, const char *name)
+{
+    struct pwcache_slot key;
+    time_t now;
+    bool ret = false;
+    int fd;
+    debug_decl(pwcache_read, SUDOERS_DEBUG_NSS);
+
+    if (!pwcache_fill_key(&key, type, id, name))
+	debug_return_bool(false);
+    if ((fd = pwcache_open()) == -1)
+	debug_return_bool(false);
+
+    if (pread(fd, &pwcache_slot, sizeof(pwcache_slot),
+	    pwcache_slot_offset(&key)) != sizeof(pwcache_slot))
+	goto done;
+    if (pwcache_slot.hdr.type != key.hdr.type ||
+	    pwcache_slot.hdr.id != key.hdr.id ||
+	    strncmp(pwcache_slot.hdr.name, key.hdr.name,
+	    sizeof(key.hdr.name)) != 0 ||
+	    pwcache_slot.hdr.datalen > PWCACHE_DATA_MAX)
+	goto done;
+
+    /* Ignore expired entries and those stored in the future. */
+    now = time(NULL);
+    if (pwcache_slot.hdr.stored > now ||
+	    now - pwcache_slot.hdr.stored >= (time_t)pwcache_timeout) {
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "expired passwd cache entry type %d, id %u, name %s",
+	    type, id, name ? name : "");
+	goto done;
+    }
+    ret = true;
+
+done:
+    close(fd);
+    debug_return_bool(ret);
+}
+
+/*
+ * Write slot to the cache, timestamped with the current time.
+ */
+static void
+pwcache_write(struct pwcache_slot *slot, size_t datalen)
+{
+    int fd;
+    debug_decl(pwcache_write, SUDOERS_DEBUG_NSS);
+
+    if ((fd = pwcache_open()) == -1)
+	debug_return;
+    slot->hdr.stored = time(NULL);
+    slot->hdr.datalen = datalen;
+    if (pwrite(fd, slot, sizeof(slot->hdr) + datalen,
+	    pwcache_slot_offset(slot)) != (ssize_t)(sizeof(slot->hdr) + datalen)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write to %s", pwcache_file);
+    }
+    close(fd);
+
+    debug_return;
+}
+
+/*
+ * Append a 32-bit value to the slot data.
+ * Returns false if there is not enough space.
+ */
+static bool
+pwcache_put_int(struct pwcache_slot *slot, size_t *len, uint32_t val)
+{
+    if (PWCACHE_DATA_MAX - *len < sizeof(val))
+	return false;
+    memcpy(slot->data + *len, &val, sizeof(val));
+    *len += sizeof(val);
+    return true;
+}
+
+/*
+ * Append a NUL-terminated string to the slot data, NULL is stored
+ * as the empty string.  Returns false if there is not enough space.
+ */
+static bool
+pwcache_put_str(struct pwcache_slot *slot, size_t *len, const char *str)
+{
+    size_t size = str ? strlen(str) + 1 : 1;
+
+    if (PWCACHE_DATA_MAX - *len < size)
+	return false;
+    if (str != NULL)
+	memcpy(slot->data + *len, str, size);
+    else
+	slot->data[*len] = '\0';
+    *len += size;
+    return true;
+}
+
+/*
+ * Read a 32-bit value from the slot data.
+ */
+static bool
+pwcache_get_int(size_t *off, uint32_t *val)
+{
+    if (pwcache_slot.hdr.datalen - *off < sizeof(*val))
+	return false;
+    memcpy(val, pwcache_slot.data + *off, sizeof(*val));
+    *off += sizeof(*val);
+    return true;
+}
+
+/*
+ * Return a pointer to a NUL-terminated string in the slot data.
+ */
+static char *
+pwcache_get_str(size_t *off)
+{
+    char *str = (char *)pwcache_slot.data + *off;
+    size_t len;
+
+    if (*off >= pwcache_slot.hdr.datalen)
+	return NULL;
+    len = strnlen(str, pwcache_slot.hdr.datalen - *off);
+    if (len == pwcache_slot.hdr.datalen - *off)
+	return NULL;
+    *off += len + 1;
+    return str;
+}
+
+/*
+ * Look up a passwd entry by name, or by uid if name is NULL.
+ * Returns a pointer to static storage that is overwritten by the
+ * next lookup, or NULL if not found.
+ */
+struct passwd *
+pwcache_getpw(uid_t uid, const char *name)
+{
+    static struct passwd pw;
+    size_t off = 0;
+    uint32_t val;
+    debug_decl(pwcache_getpw, SUDOERS_DEBUG_NSS);
+
+    if (!pwcache_read(name ? PWCACHE_PW_BYNAME : PWCACHE_PW_BYUID,
+	    name ? 0 : (unsigned int)uid, name))
+	debug_return_ptr(NULL);
+
+    memset(&pw, 0, sizeof(pw));
+    if (!pwcache_get_int(&off, &val))
+	goto bad;
+    pw.pw_uid = (uid_t)val;
+    if (!pwcache_get_int(&off, &val))
+	goto bad;
+    pw.pw_gid = (gid_t)val;
+    if ((pw.pw_name = pwcache_get_str(&off)) == NULL ||
+	    (pw.pw_passwd = pwcache_get_str(&off)) == NULL ||
+	    (pw.pw_gecos = pwcache_get_str(&off)) == NULL ||
+	    (pw.pw_dir = pwcache_get_str(&off)) == NULL ||
+	    (pw.pw_shell = pwcache_get_str(&off)) == NULL)
+	goto bad;
+#ifdef HAVE_LOGIN_CAP_H
+    if ((pw.pw_class = pwcache_get_str(&off)) == NULL)
+	goto bad;
+#endif
+    sudo_debug_printf(SUDO_DEBUG_INFO, "found passwd entry for %s in cache",
+	pw.pw_name);
+    debug_return_ptr(&pw);
+bad:
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"corrupt passwd cache entry");
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Store a passwd entry that was looked up by name, or by uid if
+ * name is NULL.
+ */
+void
+pwcache_putpw(uid_t uid, const char *name, const struct passwd *pw)
+{
+    struct pwcache_slot slot;
+    size_t len = 0;
+    debug_decl(pwcache_putpw, SUDOERS_DEBUG_NSS);
+
+    if (pwcache_file == NULL)
+	debug_return;
+    if (!pwcache_fill_key(&slot, name ? PWCACHE_PW_BYNAME : PWCACHE_PW_BYUID,
+	    name ? 0 : (unsigned int)uid, name))
+	debug_return;
+    if (!pwcache_put_int(&slot, &len, (uint32_t)pw->pw_uid) ||
+	    !pwcache_put_int(&slot, &len, (uint32_t)pw->pw_gid) ||
+	    !pwcache_put_str(&slot, &len, pw->pw_name) ||
+	    !pwcache_put_str(&slot, &len, pw->pw_passwd) ||
+	    !pwcache_put_str(&slot, &len, pw->pw_gecos) ||
+	    !pwcache_put_str(&slot, &len, pw->pw_dir) ||
+	    !pwcache_put_str(&slot, &len, pw->pw_shell))
+	debug_return;
+#ifdef HAVE_LOGIN_CAP_H
+    if (!pwcache_put_str(&slot, &len, pw->pw_class))
+	debug_return;
+#endif
+    pwcache_write(&slot, len);
+
+    debug_return;
+}
+
+/*
+ * Look up a group entry by name, or by gid if name is NULL.
+ * Returns a pointer to static storage that is overwritten by the
+ * next lookup, or NULL if not found.
+ */
+struct group *
+pwcache_getgr(gid_t gid, const char *name)
+{
+    static struct group gr;
+    size_t off = 0;
+    uint32_t i, val;
+    debug_decl(pwcache_getgr, SUDOERS_DEBUG_NSS);
+
+    if (!pwcache_read(name ? PWCACHE_GR_BYNAME : PWCACHE_GR_BYGID,
+	    name ? 0 : (unsigned int)gid, name))
+	debug_return_ptr(NULL);
+
+    memset(&gr, 0, sizeof(gr));
+    if (!pwcache_get_int(&off, &val))
+	goto bad;
+    gr.gr_gid = (gid_t)val;
+    if ((gr.gr_name = pwcache_get_str(&off)) == NULL ||
+	    (gr.gr_passwd = pwcache_get_str(&off)) == NULL)
+	goto bad;
+    if (!pwcache_get_int(&off, &val) || val > PWCACHE_MAX_GROUP_MEMBERS)
+	goto bad;
+    for (i = 0; i < val; i++) {
+	if ((pwcache_gr_mem[i] = pwcache_get_str(&off)) == NULL)
+	    goto bad;
+    }
+    pwcache_gr_mem[i] = NULL;
+    gr.gr_mem = pwcache_gr_mem;
+    sudo_debug_printf(SUDO_DEBUG_INFO, "found group entry for %s in cache",
+	gr.gr_name);
+    debug_return_ptr(&gr);
+bad:
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"corrupt group cache entry");
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Store a group entry that was looked up by name, or by gid if
+ * name is NULL.  Groups with too many members are not stored.
+ */
+void
+pwcache_putgr(gid_t gid, const char *name, const struct group *gr)
+{
+    struct pwcache_slot slot;
+    size_t len = 0, nmem_off;
+    uint32_t nmem = 0;
+    debug_decl(pwcache_putgr, SUDOERS_DEBUG_NSS);
+
+    if (pwcache_file == NULL)
+	debug_return;
+    if (!pwcache_fill_key(&slot, name ? PWCACHE_GR_BYNAME : PWCACHE_GR_BYGID,
+	    name ? 0 : (unsigned int)gid, name))
+	debug_return;
+    if (!pwcache_put_int(&slot, &len, (uint32_t)gr->gr_gid) ||
+	    !pwcache_put_str(&slot, &len, gr->gr_name) ||
+	    !pwcache_put_str(&slot, &len, gr->gr_passwd))
+	debug_return;
+
+    /* The member count is filled in after the members. */
+    nmem_off = len;
+    if (!pwcache_put_int(&slot, &len, 0))
+	debug_return;
+    if (gr->gr_mem != NULL) {
+	for (; gr->gr_mem[nmem] != NULL; nmem++) {
+	    if (nmem == PWCACHE_MAX_GROUP_MEMBERS ||
+		    !pwcache_put_str(&slot, &len, gr->gr_mem[nmem]))
+		debug_return;
+	}
+    }
+    memcpy(slot.data + nmem_off, &nmem, sizeof(nmem));
+    pwcache_write(&slot, len);
+
+    debug_return;
+}
+
+/*
+ * Look up the group IDs for the named user with the given primary gid.
+ * On success, the gids are stored in a newly-allocated array that
+ * the caller must free and true is returned.
+ */
+bool
+pwcache_getgids(const char *name, gid_t basegid, GETGROUPS_T **gidsp,
+    int *ngidsp)
+{
+    GETGROUPS_T *gids;
+    size_t off = 0;
+    uint32_t i, val, ngids;
+    debug_decl(pwcache_getgids, SUDOERS_DEBUG_NSS);
+
+    if (!pwcache_read(PWCACHE_GIDLIST, (unsigned int)basegid, name))
+	debug_return_bool(false);
+
+    if (!pwcache_get_int(&off, &ngids) || ngids == 0 ||
+	    ngids > (pwcache_slot.hdr.datalen - off) / sizeof(val)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "corrupt group ID list cache entry");
+	debug_return_bool(false);
+    }
+    if ((gids = reallocarray(NULL, ngids, sizeof(GETGROUPS_T))) == NULL) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_LINENO,
+	    "unable to allocate memory");
+	debug_return_bool(false);
+    }
+    for (i = 0; i < ngids; i++) {
+	if (!pwcache_get_int(&off, &val)) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+		"corrupt group ID list cache entry");
+	    free(gids);
+	    debug_return_bool(false);
+	}
+	gids[i] = (GETGROUPS_T)val;
+    }
+    *gidsp = gids;
+    *ngidsp = (int)ngids;
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"found %u group IDs for %s in cache", ngids, name);
+    debug_return_bool(true);
+}
+
+/*
+ * Store the group IDs for the named user with the given primary gid.
+ * Lists too large for a cache slot are not stored.
+ */
+void
+pwcache_putgids(const char *name, gid_t basegid, const GETGROUPS_T *gids,
+    int ngids)
+{
+    struct pwcache_slot slot;
+    size_t len = 0;
+    int i;
+    debug_decl(pwcache_putgids, SUDOERS_DEBUG_NSS);
+
+    if (pwcache_file == NULL || ngids <= 0)
+	debug_return;
+    if (!pwcache_fill_key(&slot, PWCACHE_GIDLIST, (unsigned int)basegid, name))
+	debug_return;
+    if (!pwcache_put_int(&slot, &len, (uint32_t)ngids))
+	debug_return;
+    for (i = 0; i < ngids; i++) {
+	if (!pwcache_put_int(&slot, &len, (uint32_t)gids[i]))
+	    debug_return;
+    }
+    pwcache_write(&slot, len);
+
+    debug_return;
+}
@@ -88,11 +88,14 @@ sudo_make_pwitem(uid_t uid, const char *name)
     struct passwd *pw, *newpw;
     debug_decl(sudo_make_pwitem, SUDOERS_DEBUG_NSS);
 
-    /* Look up by name or uid. */
-    pw = name ? getpwnam(name) : getpwuid(uid);
-    if (pw == NULL) {
-	errno = ENOENT;
-	debug_return_ptr(NULL);
+    /* Look up by name or uid, trying the persistent cache first. */
+    if ((pw = pwcache_getpw(uid, name)) == NULL) {
+	pw = name ? getpwnam(name) : getpwuid(uid);
+	if (pw == NULL) {
+	    errno = ENOENT;
+	    debug_return_ptr(NULL);
+	}
+	pwcache_putpw(uid, name, pw);
     }
 
     /* If shell field is empty, expand to _PATH_BSHELL. */
@@ -169,11 +172,14 @@ sudo_make_gritem(gid_t gid, const char *name)
     struct group *gr, *newgr;
     debug_decl(sudo_make_gritem, SUDOERS_DEBUG_NSS);
 
-    /* Look up by name or gid. */
-    gr = name ? getgrnam(name) : getgrgid(gid);
-    if (gr == NULL) {
-	errno = ENOENT;
-	debug_return_ptr(NULL);
+    /* Look up by name or gid, trying the persistent cache first. */
+    if ((gr = pwcache_getgr(gid, name)) == NULL) {
+	gr = name ? getgrnam(name) : getgrgid(gid);
+	if (gr == NULL) {
+	    errno = ENOENT;
+	    debug_return_ptr(NULL);
+	}
+	pwcache_putgr(gid, name, gr);
     }
 
     /* Allocate in one big chunk for easy freeing. */
@@ -253,6 +259,9 @@ sudo_make_gidlist_item(const struct passwd *pw, char * const *unused1,
 	user_gids = NULL;
 	user_ngids = 0;
 	type = ENTRY_TYPE_FRONTEND;
+    } else if (sudo_user.max_groups <= 0 &&
+	    pwcache_getgids(pw->pw_name, pw->pw_gid, &gids, &ngids)) {
+	type = ENTRY_TYPE_QUERIED;
     } else {
 	type = ENTRY_TYPE_QUERIED;
 	if (sudo_user.max_groups > 0) {
@@ -271,6 +280,7 @@ sudo_make_gidlist_item(const struct passwd *pw, char * const *unused1,
 		    "unable to allocate memory");
 		debug_return_ptr(NULL);
 	    }
+	    pwcache_putgids(pw->pw_name, pw->pw_gid, gids, ngids);
 	}
     }
     if (ngids <= 0) {
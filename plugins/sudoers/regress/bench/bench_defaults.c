@@ -0,0 +1,207 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for applying Defaults settings.
+ * A sudoers file with many Defaults lines is generated and parsed,
+ * then applied with update_defaults() as sudo does for each command.
+ * For comparison, the cost of looking up each Defaults name with a
+ * linear scan of sudo_defs_table, as find_default() used to, is also
+ * measured.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+#include <gram.h>
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Required by the sudoers parser and matching code. */
+struct sudo_user sudo_user;
+struct passwd *list_pw;
+
+/* The generated sudoers file has no include directives. */
+FILE *
+open_sudoers(const char *file, bool doedit, bool *keepopen)
+{
+    return NULL;
+}
+
+/*
+ * Defaults lines to generate, %u is replaced by the line number.
+ * Names are spread across sudo_defs_table.
+ */
+static const char *defaults_lines[] = {
+    "Defaults !lecture",
+    "Defaults passwd_tries=%u",
+    "Defaults timestamp_timeout=%u",
+    "Defaults env_keep = \"VAR%u\"",
+    "Defaults mailsub=\"subject %u\"",
+    "Defaults@localhost !mail_badpass",
+    "Defaults syslog=authpriv",
+    "Defaults umask=0%o",
+    "Defaults iolog_dir=/var/log/sudo-io/%u",
+    "Defaults !fqdn",
+    "Defaults log_server_timeout=%u",
+    "Defaults runas_check_shell",
+    "Defaults !pam_rhost",
+    "Defaults passprompt=\"password %u: \"",
+    "Defaults@localhost use_pty",
+    "Defaults !syslog_pid"
+};
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-d defaults] [-n iterations]\n",
+	getprogname());
+    exit(EXIT_FAILURE);
+}
+
+static FILE *
+generate_sudoers(unsigned int ndefaults)
+{
+    unsigned int i;
+    FILE *fp;
+
+    if ((fp = tmpfile()) == NULL)
+	sudo_fatal("tmpfile");
+
+    for (i = 0; i < ndefaults; i++) {
+	fprintf(fp, defaults_lines[i % nitems(defaults_lines)], i % 64);
+	putc('\n', fp);
+    }
+    fputs("ALL ALL = ALL\n", fp);
+    rewind(fp);
+
+    return fp;
+}
+
+static double
+cpu_time(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+	sudo_fatal("getrusage");
+    return (double)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+/*
+ * Look up name with a linear scan of sudo_defs_table.
+ */
+static int
+find_linear(const char *name)
+{
+    int i;
+
+    for (i = 0; sudo_defs_table[i].name != NULL; i++) {
+	if (strcmp(name, sudo_defs_table[i].name) == 0)
+	    return i;
+    }
+    return -1;
+}
+
+static void
+report(const char *name, unsigned long long count, double elapsed)
+{
+    if (elapsed <= 0)
+	elapsed = 0.000001;
+    printf("%-16s %10llu lines %8.3fs cpu %12.0f lines/sec\n", name,
+	count, elapsed, (double)count / elapsed);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int i, ndefaults = 500, iterations = 2000;
+    unsigned long long count = 0;
+    struct defaults *d;
+    const char *errstr;
+    double start;
+    long sum = 0;
+    int ch;
+
+    initprogname(argc > 0 ? argv[0] : "bench_defaults");
+
+    while ((ch = getopt(argc, argv, "d:n:")) != -1) {
+	switch (ch) {
+	case 'd':
+	    ndefaults = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("defaults %s: %s", optarg, errstr);
+	    break;
+	case 'n':
+	    iterations = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("iterations %s: %s", optarg, errstr);
+	    break;
+	default:
+	    usage();
+	}
+    }
+
+    if (!init_defaults())
+	sudo_fatalx("unable to initialize sudoers default values");
+    user_host = user_shost = user_runhost = user_srunhost = "localhost";
+
+    init_parser("sudoers", true, false);
+    sudoersin = generate_sudoers(ndefaults);
+    if (sudoersparse() != 0 || parse_error)
+	sudo_fatalx("unable to parse generated sudoers");
+    printf("parsed sudoers with %u Defaults lines\n", ndefaults);
+
+    /* Apply the global and host-specific Defaults, as sudo does. */
+    start = cpu_time();
+    for (i = 0; i < iterations; i++) {
+	if (!update_defaults(&parsed_policy, NULL,
+		SETDEF_GENERIC|SETDEF_HOST, false))
+	    sudo_fatalx("unable to apply Defaults");
+    }
+    report("update_defaults", (unsigned long long)ndefaults * iterations,
+	cpu_time() - start);
+
+    /* Only the name lookups, as done before the perfect hash. */
+    start = cpu_time();
+    for (i = 0; i < iterations; i++) {
+	TAILQ_FOREACH(d, &parsed_policy.defaults, entries) {
+	    sum += find_linear(d->var);
+	    count++;
+	}
+    }
+    report("linear lookups", count, cpu_time() - start);
+    if (sum < 0)
+	sudo_fatalx("unknown Defaults name");
+
+    free_parse_tree(&parsed_policy);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,270 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmark for finding the userspecs that match a user.
+ * A large sudoers file is generated and parsed, then the matching
+ * userspecs are found for a number of users, as "sudo -l" does,
+ * once by walking every userspec and once using the userspec index.
+ * Both methods must find the same entries.
+ */
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+#include <gram.h>
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Required by the sudoers parser and matching code. */
+struct sudo_user sudo_user;
+struct passwd *list_pw;
+
+/* Users are assigned a unique primary group-ID starting from here. */
+#define BENCH_UID_BASE	100000
+#define BENCH_GID_BASE	200000
+
+/* The generated sudoers file has no include directives. */
+FILE *
+open_sudoers(const char *file, bool doedit, bool *keepopen)
+{
+    return NULL;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-l lookups] [-n iterations] [-u users]\n",
+	getprogname());
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Generate a sudoers file with nusers individual user rules plus
+ * rules for groups, group-IDs, aliases and ALL that some users share.
+ */
+static FILE *
+generate_sudoers(unsigned int nusers)
+{
+    unsigned int i;
+    FILE *fp;
+
+    if ((fp = tmpfile()) == NULL)
+	sudo_fatal("tmpfile");
+
+    fputs("Defaults !lecture\n", fp);
+    fputs("User_Alias OPERATORS =", fp);
+    for (i = 0; i < nusers; i += nusers / 16 + 1)
+	fprintf(fp, "%s user%u", i ? "," : "", i);
+    fputs("\n\n", fp);
+    fputs("ALL ALL = /usr/bin/id\n", fp);
+    fputs("OPERATORS ALL = /sbin/reboot\n", fp);
+    for (i = 0; i < nusers; i++) {
+	fprintf(fp, "user%u ALL = (root) /usr/local/bin/cmd%u\n", i, i);
+	if (i % 16 == 0) {
+	    fprintf(fp, "%%#%u ALL = /usr/local/bin/gid%u\n",
+		BENCH_GID_BASE + i, i);
+	}
+	if (i % 64 == 0) {
+	    fprintf(fp, "ALL, !user%u ALL = /usr/bin/uptime\n", i);
+	}
+    }
+    rewind(fp);
+
+    return fp;
+}
+
+/*
+ * Find the userspecs that match pw by checking all of them.
+ * Returns a checksum of the matching line numbers.
+ */
+static unsigned long
+find_linear(struct sudoers_parse_tree *parse_tree, struct passwd *pw)
+{
+    struct userspec *us;
+    unsigned long sum = 0;
+
+    TAILQ_FOREACH(us, &parse_tree->userspecs, entries) {
+	if (userlist_matches(parse_tree, pw, &us->users) == ALLOW)
+	    sum = sum * 31 + us->line;
+    }
+    return sum;
+}
+
+/*
+ * Find the userspecs that match pw using the userspec index.
+ * Returns a checksum of the matching line numbers.
+ */
+static unsigned long
+find_indexed(struct sudoers_parse_tree *parse_tree, struct passwd *pw)
+{
+    struct userspec *us, **specs;
+    unsigned long sum = 0;
+    size_t i, nspecs;
+
+    specs = userspec_index_lookup(parse_tree, pw, &nspecs);
+    if (specs == NULL)
+	sudo_fatalx("unable to allocate memory");
+    for (i = 0; i < nspecs; i++) {
+	us = specs[i];
+	if (userlist_matches(parse_tree, pw, &us->users) == ALLOW)
+	    sum = sum * 31 + us->line;
+    }
+    free(specs);
+    return sum;
+}
+
+static double
+cpu_time(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+	sudo_fatal("getrusage");
+    return (double)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+}
+
+typedef unsigned long (*find_fn)(struct sudoers_parse_tree *,
+    struct passwd *);
+
+static void
+run(const char *name, find_fn find, struct passwd *pws, unsigned int npws,
+    unsigned long *results, unsigned int iterations)
+{
+    double start, elapsed;
+    unsigned long sum;
+    unsigned int i, j;
+
+    start = cpu_time();
+    for (i = 0; i < iterations; i++) {
+	for (j = 0; j < npws; j++) {
+	    sum = find(&parsed_policy, &pws[j]);
+	    if (results[j] == 0) {
+		results[j] = sum;
+	    } else if (results[j] != sum) {
+		sudo_fatalx("%s: different userspecs matched for %s",
+		    name, pws[j].pw_name);
+	    }
+	}
+    }
+    elapsed = cpu_time() - start;
+    if (elapsed <= 0)
+	elapsed = 0.000001;
+
+    printf("%-8s %10llu lookups %8.3fs cpu %12.0f lookups/sec\n", name,
+	(unsigned long long)npws * iterations, elapsed,
+	(double)npws * iterations / elapsed);
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int i, nusers = 20000, npws = 200, iterations = 2;
+    unsigned long *results;
+    struct passwd *pws;
+    const char *errstr;
+    double start;
+    int ch;
+
+    initprogname(argc > 0 ? argv[0] : "bench_userspec");
+
+    while ((ch = getopt(argc, argv, "l:n:u:")) != -1) {
+	switch (ch) {
+	case 'l':
+	    npws = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("lookups %s: %s", optarg, errstr);
+	    break;
+	case 'n':
+	    iterations = sudo_strtonum(optarg, 1, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("iterations %s: %s", optarg, errstr);
+	    break;
+	case 'u':
+	    nusers = sudo_strtonum(optarg, 1, INT_MAX / 2, &errstr);
+	    if (errstr != NULL)
+		sudo_fatalx("users %s: %s", optarg, errstr);
+	    break;
+	default:
+	    usage();
+	}
+    }
+
+    if (!init_defaults())
+	sudo_fatalx("unable to initialize sudoers default values");
+    user_host = user_shost = user_runhost = user_srunhost = "localhost";
+
+    /* Parse the generated policy and build the index. */
+    start = cpu_time();
+    init_parser("sudoers", true, false);
+    sudoersin = generate_sudoers(nusers);
+    if (sudoersparse() != 0 || parse_error)
+	sudo_fatalx("unable to parse generated sudoers");
+    printf("parsed sudoers with %u users in %.3fs cpu\n", nusers,
+	cpu_time() - start);
+    start = cpu_time();
+    if (!userspec_index_build(&parsed_policy))
+	sudo_fatalx("unable to build userspec index");
+    printf("built userspec index in %.3fs cpu\n", cpu_time() - start);
+
+    /*
+     * Users spread across the file, plus some that are not in sudoers.
+     * The password entries are not in the passwd database, so group
+     * lookups only see the primary group-ID.
+     */
+    pws = calloc(npws, sizeof(*pws));
+    results = calloc(npws, sizeof(*results));
+    if (pws == NULL || results == NULL)
+	sudo_fatalx("unable to allocate memory");
+    for (i = 0; i < npws; i++) {
+	const unsigned int n = (i * (nusers / npws + 1) + i % 16) +
+	    (i % 10 == 9 ? nusers : 0);
+	if (asprintf(&pws[i].pw_name, "user%u", n) == -1)
+	    sudo_fatalx("unable to allocate memory");
+	pws[i].pw_uid = BENCH_UID_BASE + n;
+	pws[i].pw_gid = BENCH_GID_BASE + n;
+	pws[i].pw_dir = "/";
+	pws[i].pw_shell = "/bin/sh";
+    }
+
+    /* Warm the group cache so it is not charged to either method. */
+    for (i = 0; i < npws; i++)
+	(void)find_indexed(&parsed_policy, &pws[i]);
+
+    run("linear", find_linear, pws, npws, results, iterations);
+    run("indexed", find_indexed, pws, npws, results, iterations);
+
+    for (i = 0; i < npws; i++)
+	free(pws[i].pw_name);
+    free(pws);
+    free(results);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Test round-tripping sudoers through a compiled sudoers image.
+#
+
+: ${CVTSUDOERS=cvtsudoers}
+
+TESTDIR=`cd "$TESTDIR" && pwd`
+IMAGE=`mktemp ${TMPDIR:-/tmp}/cvtsudoers.XXXXXXXX` || exit 1
+trap 'rm -f "$IMAGE" "$IMAGE".out "$IMAGE".img.out' 0 1 2 15
+
+$CVTSUDOERS -c "" -f image -o "$IMAGE" $TESTDIR/sudoers || exit 1
+
+for fmt in json sudoers; do
+    $CVTSUDOERS -c "" -f $fmt $TESTDIR/sudoers > "$IMAGE".out
+    $CVTSUDOERS -c "" -i image -f $fmt "$IMAGE" > "$IMAGE".img.out
+    if cmp "$IMAGE".out "$IMAGE".img.out >/dev/null; then
+	echo "$fmt: OK"
+    else
+	echo "$fmt: FAIL"
+    fi
+done
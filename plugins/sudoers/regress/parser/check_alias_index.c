@@ -0,0 +1,217 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pwd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+#include <gram.h>
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Required by the sudoers parser and matching code. */
+struct sudo_user sudo_user;
+struct passwd *list_pw;
+
+/* The test sudoers file has no include directives. */
+FILE *
+open_sudoers(const char *file, bool doedit, bool *keepopen)
+{
+    return NULL;
+}
+
+/*
+ * Each userspec has a User_Alias, Host_Alias and Cmnd_Alias to test.
+ */
+static const char sudoers_data[] =
+    "User_Alias ADMINS = alice, bob, OPS\n"
+    "User_Alias OPS = carol, !bob\n"
+    "User_Alias NOTOPS = ALL, !OPS\n"
+    "User_Alias LOOP1 = dave, LOOP2\n"
+    "User_Alias LOOP2 = erin, !LOOP1\n"
+    "User_Alias WIDE = MISSING, frank, !NOTOPS\n"
+    "Host_Alias SERVERS = web1, db1, !web2\n"
+    "Host_Alias ALLSRV = SERVERS, web2\n"
+    "Host_Alias HLOOP = HLOOP, web3, !NOSUCH\n"
+    "Host_Alias NOTSRV = ALL, !ALLSRV\n"
+    "Cmnd_Alias ANY = ALL\n"
+    "Cmnd_Alias NONE = !ANY\n"
+    "Cmnd_Alias CLOOP = CLOOP, !NONE\n"
+    "ADMINS SERVERS = ANY\n"
+    "NOTOPS ALLSRV = NONE\n"
+    "LOOP1 HLOOP = CLOOP\n"
+    "LOOP2 NOTSRV = MISSING\n"
+    "WIDE HLOOP = NONE\n";
+
+static const char *users[] = {
+    "alice", "bob", "carol", "dave", "erin", "frank", "zed",
+    "LOOP1", "LOOP2", "MISSING"
+};
+
+static const char *hosts[] = {
+    "web1", "web2", "web3", "db1", "HLOOP", "NOSUCH", "other"
+};
+
+/*
+ * Expected results for the users, hosts and commands above,
+ * one string per userspec: A for ALLOW, D for DENY or U for UNSPEC.
+ */
+static const char *expected_users[] = {
+    "ADAUUUUUUU",	/* ADMINS */
+    "AADAAAAAAA",	/* NOTOPS */
+    "UUUAAUUDUU",	/* LOOP1 */
+    "UUUDAUUUDU",	/* LOOP2 */
+    "DDADDDDDDD"	/* WIDE */
+};
+static const char *expected_hosts[] = {
+    "ADUAUUU",		/* SERVERS */
+    "AAUAUUU",		/* ALLSRV */
+    "UUAUADU",		/* HLOOP */
+    "DDADAAA",		/* NOTSRV */
+    "UUAUADU"		/* HLOOP */
+};
+static const char expected_cmnds[] = "ADAUD";
+
+static int
+result_char(int rc)
+{
+    return rc == ALLOW ? 'A' : rc == DENY ? 'D' : 'U';
+}
+
+/*
+ * Match each userspec against the test users, hosts and commands and
+ * compare with the expected results.  Returns the number of errors.
+ */
+static int
+check_matches(const char *mode, struct passwd *pwds, int *ntests)
+{
+    struct userspec *us;
+    struct privilege *priv;
+    struct cmndspec *cs;
+    char result[64];
+    int errors = 0;
+    size_t i, n = 0;
+
+    match_memo_begin(&parsed_policy);
+    TAILQ_FOREACH(us, &parsed_policy.userspecs, entries) {
+	priv = TAILQ_FIRST(&us->privileges);
+	cs = TAILQ_FIRST(&priv->cmndlist);
+
+	for (i = 0; i < nitems(users); i++) {
+	    result[i] = result_char(userlist_matches(&parsed_policy,
+		&pwds[i], &us->users));
+	}
+	result[i] = '\0';
+	(*ntests)++;
+	if (strcmp(result, expected_users[n]) != 0) {
+	    fprintf(stderr, "check_alias_index: %s: userspec %zu: "
+		"users expected %s, got %s\n", mode, n, expected_users[n],
+		result);
+	    errors++;
+	}
+
+	for (i = 0; i < nitems(hosts); i++) {
+	    parsed_policy.lhost = parsed_policy.shost = hosts[i];
+	    result[i] = result_char(hostlist_matches(&parsed_policy,
+		&pwds[0], &priv->hostlist));
+	}
+	result[i] = '\0';
+	(*ntests)++;
+	if (strcmp(result, expected_hosts[n]) != 0) {
+	    fprintf(stderr, "check_alias_index: %s: userspec %zu: "
+		"hosts expected %s, got %s\n", mode, n, expected_hosts[n],
+		result);
+	    errors++;
+	}
+
+	(*ntests)++;
+	result[0] = result_char(cmnd_matches(&parsed_policy, cs->cmnd,
+	    NULL, NULL));
+	if (result[0] != expected_cmnds[n]) {
+	    fprintf(stderr, "check_alias_index: %s: userspec %zu: "
+		"command expected %c, got %c\n", mode, n, expected_cmnds[n],
+		result[0]);
+	    errors++;
+	}
+	n++;
+    }
+    match_memo_end(&parsed_policy);
+
+    return errors;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct passwd pwds[nitems(users)];
+    int ntests = 0, errors = 0;
+    size_t i;
+
+    initprogname(argc > 0 ? argv[0] : "check_alias_index");
+
+    if (!init_defaults())
+	sudo_fatalx("unable to initialize sudoers default values");
+
+    memset(pwds, 0, sizeof(pwds));
+    for (i = 0; i < nitems(users); i++) {
+	pwds[i].pw_name = (char *)users[i];
+	pwds[i].pw_uid = 1000 + i;
+	pwds[i].pw_gid = 1000 + i;
+    }
+
+    init_parser("sudoers", true, false);
+    sudoersin = tmpfile();
+    if (sudoersin == NULL)
+	sudo_fatal("tmpfile");
+    fputs(sudoers_data, sudoersin);
+    rewind(sudoersin);
+    if (sudoersparse() != 0 || parse_error)
+	sudo_fatalx("unable to parse sudoers");
+
+    /* Recursive matching without an index. */
+    errors += check_matches("no index", pwds, &ntests);
+
+    /*
+     * Flattened aliases, HLOOP is used twice so its memoized results are
+     * reused.  The second pass checks that nothing is kept between checks.
+     */
+    if (!alias_index_build(&parsed_policy) || parsed_policy.aindex == NULL)
+	sudo_fatalx("unable to build alias index");
+    errors += check_matches("index", pwds, &ntests);
+    errors += check_matches("index", pwds, &ntests);
+
+    /* Looking up an alias by name and type. */
+    ntests++;
+    if (alias_index_lookup(&parsed_policy, "OPS", USERALIAS) == NULL ||
+	    alias_index_lookup(&parsed_policy, "OPS", HOSTALIAS) != NULL ||
+	    alias_index_lookup(&parsed_policy, "NOSUCH", HOSTALIAS) != NULL) {
+	fprintf(stderr, "check_alias_index: alias lookup failed\n");
+	errors++;
+    }
+
+    free_parse_tree(&parsed_policy);
+    printf("check_alias_index: %d tests run, %d errors, %d%% success rate\n",
+	ntests, errors, (ntests - errors) * 100 / ntests);
+    exit(errors);
+}
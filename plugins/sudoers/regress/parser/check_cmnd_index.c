@@ -0,0 +1,144 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pwd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+#include <gram.h>
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Required by the sudoers parser and matching code. */
+struct sudo_user sudo_user;
+struct passwd *list_pw;
+
+/* The test sudoers file has no include directives. */
+FILE *
+open_sudoers(const char *file, bool doedit, bool *keepopen)
+{
+    return NULL;
+}
+
+static const char sudoers_data[] =
+    "Cmnd_Alias SHELLS = /bin/sh, /usr/bin/bash\n"
+    "Cmnd_Alias NESTED = SHELLS, !/usr/bin/passwd\n"
+    "user1 ALL = /usr/bin/ls\n"
+    "user2 ALL = /bin/ls, /usr/bin/cat\n"
+    "user3 ALL = /usr/bin/\n"
+    "user4 ALL = /usr/bin/l*\n"
+    "user5 ALL = /usr/*/cat\n"
+    "user6 ALL = ALL\n"
+    "user7 ALL = sudoedit /etc/motd\n"
+    "user8 ALL = NESTED\n"
+    "user9 ALL = !/usr/bin/passwd, /usr/bin/ls -l\n"
+    "user10 ALL = MISSING\n";
+
+/*
+ * Expected candidates for each command base name, as the number of
+ * the user in the userspec, one per cmndspec.
+ */
+static struct cmnd_index_test {
+    const char *base;
+    const char *users;
+} test_data[] = {
+    { "ls", "1 2 3 4 6 9" },
+    { "cat", "2 3 4 5 6" },
+    { "passwd", "3 4 6 8 9" },
+    { "bash", "3 4 6 8" },
+    { "sudoedit", "3 4 6 7" },
+    { "LS", "3 4 6" },
+    { "nonexistent", "3 4 6" },
+    { NULL, "3 4 6" }
+};
+
+static char *
+lookup(const char *base)
+{
+    static char buf[1024];
+    struct cmndspec_ref *refs;
+    size_t i, nrefs, len = 0;
+
+    buf[0] = '\0';
+    refs = cmnd_index_lookup(&parsed_policy, base, &nrefs);
+    if (refs == NULL)
+	sudo_fatalx("unable to allocate memory");
+    for (i = 0; i < nrefs && len < sizeof(buf); i++) {
+	struct member *m = TAILQ_FIRST(&refs[i].us->users);
+	len += snprintf(buf + len, sizeof(buf) - len, "%s%s",
+	    i ? " " : "", m->name + sizeof("user") - 1);
+    }
+    free(refs);
+    return buf;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int ntests = 0, errors = 0;
+    const char *result;
+    size_t i;
+
+    initprogname(argc > 0 ? argv[0] : "check_cmnd_index");
+
+    if (!init_defaults())
+	sudo_fatalx("unable to initialize sudoers default values");
+
+    init_parser("sudoers", true, false);
+    sudoersin = tmpfile();
+    if (sudoersin == NULL)
+	sudo_fatal("tmpfile");
+    fputs(sudoers_data, sudoersin);
+    rewind(sudoersin);
+    if (sudoersparse() != 0 || parse_error)
+	sudo_fatalx("unable to parse sudoers");
+    if (!cmnd_index_build(&parsed_policy))
+	sudo_fatalx("unable to build command index");
+
+    for (i = 0; i < nitems(test_data); i++) {
+	ntests++;
+	result = lookup(test_data[i].base);
+	if (strcmp(result, test_data[i].users) != 0) {
+	    fprintf(stderr, "check_cmnd_index: %s: expected \"%s\", got \"%s\"\n",
+		test_data[i].base ? test_data[i].base : "(null)",
+		test_data[i].users, result);
+	    errors++;
+	}
+    }
+
+    /* Without an index, all cmndspecs are candidates. */
+    cmnd_index_free(parsed_policy.cindex);
+    parsed_policy.cindex = NULL;
+    ntests++;
+    result = lookup("ls");
+    if (strcmp(result, "1 2 2 3 4 5 6 7 8 9 9 10") != 0) {
+	fprintf(stderr, "check_cmnd_index: no index: got \"%s\"\n", result);
+	errors++;
+    }
+
+    free_parse_tree(&parsed_policy);
+    printf("check_cmnd_index: %d tests run, %d errors, %d%% success rate\n",
+	ntests, errors, (ntests - errors) * 100 / ntests);
+    exit(errors);
+}
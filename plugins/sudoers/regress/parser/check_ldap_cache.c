@@ -0,0 +1,374 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pwd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+#include "sudo_lbuf.h"
+#include "sudo_ldap.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Required by the sudoers parser and matching code. */
+struct sudo_user sudo_user;
+struct passwd *list_pw;
+
+FILE *
+open_sudoers(const char *file, bool doedit, bool *keepopen)
+{
+    return NULL;
+}
+
+/*
+ * Stubs of the root_cache.c helpers that skip the ownership checks
+ * so the test can be run by an unprivileged user.
+ */
+bool
+sudo_secure_root_cache_dir(const char *path)
+{
+    return true;
+}
+
+int
+sudo_open_root_cache(const char *path, int flags, mode_t badmodes,
+    struct stat *sb)
+{
+    int fd;
+
+    fd = open(path, flags|O_NOFOLLOW, S_IRUSR|S_IWUSR);
+    if (fd != -1 && sb != NULL && fstat(fd, sb) == -1) {
+	close(fd);
+	fd = -1;
+    }
+    return fd;
+}
+
+int
+sudo_open_slot_cache(const char *path, unsigned int magic,
+    unsigned int version, unsigned int nslots, size_t slot_size)
+{
+    return -1;
+}
+
+#define CACHE_SOURCE	"uri=ldap://ldap.example.com base=ou=SUDOers,dc=example,dc=com binddn= filter= timed=no"
+#define OTHER_SOURCE	"uri=ldap://other.example.com base=ou=SUDOers,dc=example,dc=com binddn= filter= timed=no"
+
+/*
+ * The sudoRole entries to cache; the second one has a user name that
+ * must be base64-encoded.  The attributes are name, value pairs.
+ */
+static struct test_role {
+    const char *dn;
+    const char *timestamp;
+    const char *attrs[12];
+} test_roles[] = {
+    { "cn=defaults,ou=SUDOers,dc=example,dc=com", "20210101000000Z", {
+	"objectClass", "sudoRole",
+	"cn", "defaults",
+	"sudoOption", "!lecture",
+	NULL } },
+    { "cn=j\xc3\xb6rg,ou=SUDOers,dc=example,dc=com", "20210301120000Z", {
+	"objectClass", "sudoRole",
+	"cn", "j\xc3\xb6rg",
+	"sudoUser", "j\xc3\xb6rg",
+	"sudoHost", "ALL",
+	"sudoCommand", "/usr/bin/id",
+	NULL } },
+    { "cn=alice,ou=SUDOers,dc=example,dc=com", "20210201000000Z", {
+	"objectClass", "sudoRole",
+	"cn", "alice",
+	"sudoUser", "alice",
+	"sudoHost", "ALL",
+	"sudoCommand", "ALL",
+	NULL } }
+};
+
+/*
+ * Convert a test role to an LDIF record like sudo_ldap_cache_record().
+ */
+static char *
+role_to_ldif(const struct test_role *role)
+{
+    struct sudo_lbuf lbuf;
+    char *ldif = NULL;
+    int i;
+
+    sudo_lbuf_init(&lbuf, NULL, 0, NULL, 0);
+    if (!ldap_cache_append_attr(&lbuf, "dn", role->dn, strlen(role->dn)))
+	goto done;
+    for (i = 0; role->attrs[i] != NULL; i += 2) {
+	if (!ldap_cache_append_attr(&lbuf, role->attrs[i], role->attrs[i + 1],
+		strlen(role->attrs[i + 1])))
+	    goto done;
+    }
+    ldif = strdup(lbuf.buf);
+done:
+    sudo_lbuf_destroy(&lbuf);
+    if (ldif == NULL)
+	sudo_fatalx("unable to allocate memory");
+    return ldif;
+}
+
+/*
+ * Read the contents of path into a NUL-terminated string.
+ */
+static char *
+slurp(const char *path)
+{
+    struct stat sb;
+    char *buf;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+	sudo_fatal("%s", path);
+    if (fstat(fileno(fp), &sb) == -1)
+	sudo_fatal("%s", path);
+    if ((buf = malloc(sb.st_size + 1)) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    if (fread(buf, 1, sb.st_size, fp) != (size_t)sb.st_size)
+	sudo_fatal("%s", path);
+    buf[sb.st_size] = '\0';
+    fclose(fp);
+    return buf;
+}
+
+/*
+ * Return the number of records in the cache file at path.
+ */
+static int
+count_records(const char *path)
+{
+    char *buf, *cp;
+    int count = 0;
+
+    buf = slurp(path);
+    for (cp = buf; (cp = strstr(cp, "\ndn:")) != NULL; cp++)
+	count++;
+    free(buf);
+    return count;
+}
+
+/*
+ * Write the test roles to the cache at path.
+ */
+static int
+check_write(const char *path)
+{
+    struct ldap_cache *cache;
+    const char *timestamp;
+    int errors = 0;
+    size_t i;
+
+    if ((cache = ldap_cache_alloc()) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    for (i = 0; i < nitems(test_roles); i++) {
+	char *dn = strdup(test_roles[i].dn);
+	if (dn == NULL)
+	    sudo_fatalx("unable to allocate memory");
+	if (!ldap_cache_add(cache, dn, role_to_ldif(&test_roles[i]),
+		test_roles[i].timestamp))
+	    sudo_fatalx("unable to allocate memory");
+    }
+
+    /* The cache records the newest modifyTimestamp. */
+    timestamp = ldap_cache_timestamp(cache);
+    if (timestamp == NULL || strcmp(timestamp, "20210301120000Z") != 0) {
+	sudo_warnx("wrong cache timestamp %s", timestamp ? timestamp : "NULL");
+	errors++;
+    }
+
+    if (!ldap_cache_write(cache, path, CACHE_SOURCE)) {
+	sudo_warnx("unable to write cache %s", path);
+	errors++;
+    } else if (count_records(path) != (int)nitems(test_roles)) {
+	sudo_warnx("expected %zu records in %s, found %d",
+	    nitems(test_roles), path, count_records(path));
+	errors++;
+    }
+    ldap_cache_free(cache);
+
+    return errors;
+}
+
+/*
+ * Parse the cache at path with sudoers_parse_ldif() as the LDAP
+ * backend does and check the resulting rules and defaults.
+ */
+static int
+check_parse(const char *path)
+{
+    struct sudoers_parse_tree parse_tree;
+    struct userspec *us;
+    struct member *m;
+    struct defaults *d;
+    bool found_alice = false, found_jorg = false, found_lecture = false;
+    int nuserspecs = 0, errors = 0;
+    FILE *fp;
+
+    /* A cache for a different configuration or past its timeout. */
+    if ((fp = ldap_cache_open_fresh(path, OTHER_SOURCE, 60)) != NULL) {
+	sudo_warnx("cache for a different source was used");
+	fclose(fp);
+	errors++;
+    }
+    if ((fp = ldap_cache_open_fresh(path, CACHE_SOURCE, 0)) != NULL) {
+	sudo_warnx("cache with a zero timeout was used");
+	fclose(fp);
+	errors++;
+    }
+
+    if ((fp = ldap_cache_open_fresh(path, CACHE_SOURCE, 60)) == NULL) {
+	sudo_warnx("unable to open cache %s", path);
+	return errors + 1;
+    }
+    init_parse_tree(&parse_tree, NULL, NULL);
+    if (!sudoers_parse_ldif(&parse_tree, fp, NULL, true)) {
+	sudo_warnx("unable to parse cache %s", path);
+	errors++;
+    }
+    TAILQ_FOREACH(us, &parse_tree.userspecs, entries) {
+	nuserspecs++;
+	TAILQ_FOREACH(m, &us->users, entries) {
+	    if (strcmp(m->name, "alice") == 0)
+		found_alice = true;
+	    else if (strcmp(m->name, "j\xc3\xb6rg") == 0)
+		found_jorg = true;
+	}
+    }
+    TAILQ_FOREACH(d, &parse_tree.defaults, entries) {
+	if (strcmp(d->var, "lecture") == 0 && d->op == false)
+	    found_lecture = true;
+    }
+    if (nuserspecs != 2 || !found_alice || !found_jorg) {
+	sudo_warnx("expected rules for alice and j\xc3\xb6rg, found %d rules",
+	    nuserspecs);
+	errors++;
+    }
+    if (!found_lecture) {
+	sudo_warnx("missing !lecture in cached defaults");
+	errors++;
+    }
+    free_parse_tree(&parse_tree);
+
+    return errors;
+}
+
+/*
+ * Read the cache back as for an incremental refresh and write it to
+ * path2.  Entries that are not marked as still present are dropped,
+ * the others must be written unchanged.
+ */
+static int
+check_round_trip(const char *path, const char *path2)
+{
+    struct ldap_cache *cache;
+    const char *timestamp;
+    char *buf, *buf2;
+    int errors = 0;
+    size_t i;
+
+    /* A cache for a different configuration is ignored. */
+    if ((cache = ldap_cache_read(path, OTHER_SOURCE)) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    if (ldap_cache_timestamp(cache) != NULL) {
+	sudo_warnx("cache for a different source was read");
+	errors++;
+    }
+    ldap_cache_free(cache);
+
+    if ((cache = ldap_cache_read(path, CACHE_SOURCE)) == NULL)
+	sudo_fatalx("unable to allocate memory");
+    timestamp = ldap_cache_timestamp(cache);
+    if (timestamp == NULL || strcmp(timestamp, "20210301120000Z") != 0) {
+	sudo_warnx("wrong timestamp %s read from cache",
+	    timestamp ? timestamp : "NULL");
+	errors++;
+    }
+
+    /* Only alice is still in the directory; dn matching ignores case. */
+    ldap_cache_mark(cache, "CN=ALICE,OU=SUDOers,DC=example,DC=com");
+    if (!ldap_cache_write(cache, path2, CACHE_SOURCE)) {
+	sudo_warnx("unable to write cache %s", path2);
+	errors++;
+    } else if (count_records(path2) != 1) {
+	sudo_warnx("expected 1 record in %s, found %d", path2,
+	    count_records(path2));
+	errors++;
+    }
+
+    /* With all entries present, the cache is written unchanged. */
+    for (i = 0; i < nitems(test_roles); i++)
+	ldap_cache_mark(cache, test_roles[i].dn);
+    if (!ldap_cache_write(cache, path2, CACHE_SOURCE)) {
+	sudo_warnx("unable to write cache %s", path2);
+	errors++;
+    } else {
+	buf = slurp(path);
+	buf2 = slurp(path2);
+	if (strcmp(buf, buf2) != 0) {
+	    sudo_warnx("cache changed after a round trip:\n%s\n%s", buf, buf2);
+	    errors++;
+	}
+	free(buf);
+	free(buf2);
+    }
+    ldap_cache_free(cache);
+
+    return errors;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/check_ldap_cache.XXXXXXXX";
+    char path[PATH_MAX], path2[PATH_MAX];
+    int ntests = 3, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_ldap_cache");
+
+    if (!init_defaults())
+	sudo_fatalx("unable to initialize sudoers default values");
+
+    if (mkdtemp(dir) == NULL)
+	sudo_fatal("mkdtemp");
+    (void)snprintf(path, sizeof(path), "%s/ldap_cache", dir);
+    (void)snprintf(path2, sizeof(path2), "%s/ldap_cache2", dir);
+
+    errors += check_write(path) != 0;
+    errors += check_parse(path) != 0;
+    errors += check_round_trip(path, path2) != 0;
+
+    unlink(path);
+    unlink(path2);
+    rmdir(dir);
+
+    printf("%s: %d tests run, %d errors, %d%% success rate\n", getprogname(),
+	ntests, errors, (ntests - errors) * 100 / ntests);
+
+    exit(errors);
+}
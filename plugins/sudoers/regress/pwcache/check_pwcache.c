@@ -0,0 +1,242 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+
+/* Must match the layout in pwutil_cache.c. */
+#define SLOT_SIZE	2048
+#define SLOT_NSLOTS	1024
+#define SLOT_NAME_OFF	24
+#define SLOT_DATA_OFF	88
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/*
+ * Stub of the root_cache.c helper that skips the ownership checks
+ * so the test can be run by an unprivileged user.
+ */
+int
+sudo_open_slot_cache(const char *path, unsigned int magic,
+    unsigned int version, unsigned int nslots, size_t slot_size)
+{
+    int fd;
+
+    fd = open(path, O_RDWR|O_CREAT|O_NOFOLLOW, S_IRUSR|S_IWUSR);
+    if (fd != -1 &&
+	    ftruncate(fd, SLOT_CACHE_HDR_LEN + (off_t)nslots * slot_size) == -1) {
+	close(fd);
+	fd = -1;
+    }
+    return fd;
+}
+
+/*
+ * Overwrite the data of the cache slot holding name with len bytes
+ * of buf.  Returns true if the slot was found.
+ */
+static bool
+corrupt_slot(const char *name, const void *buf, size_t len)
+{
+    char slotname[SLOT_DATA_OFF - SLOT_NAME_OFF];
+    bool ret = false;
+    off_t off;
+    int fd, i;
+
+    if ((fd = open(pwcache_file, O_RDWR)) == -1)
+	sudo_fatal("%s", pwcache_file);
+    for (i = 0; i < SLOT_NSLOTS; i++) {
+	off = SLOT_CACHE_HDR_LEN + (off_t)i * SLOT_SIZE;
+	if (pread(fd, slotname, sizeof(slotname), off + SLOT_NAME_OFF) !=
+		sizeof(slotname))
+	    break;
+	if (strncmp(slotname, name, sizeof(slotname)) == 0) {
+	    if (pwrite(fd, buf, len, off + SLOT_DATA_OFF) != (ssize_t)len)
+		sudo_fatal("%s", pwcache_file);
+	    ret = true;
+	    break;
+	}
+    }
+    close(fd);
+    return ret;
+}
+
+static int
+check_hit(void)
+{
+    struct passwd pw, *pw2;
+    GETGROUPS_T gids[] = { 20, 1000, 1001 }, *gids2;
+    int errors = 0, ngids2;
+
+    memset(&pw, 0, sizeof(pw));
+    pw.pw_name = "millert";
+    pw.pw_passwd = "*";
+    pw.pw_uid = 8036;
+    pw.pw_gid = 20;
+    pw.pw_gecos = "Todd Miller";
+    pw.pw_dir = "/home/millert";
+    pw.pw_shell = "/bin/tcsh";
+    pwcache_putpw(pw.pw_uid, pw.pw_name, &pw);
+    pw2 = pwcache_getpw(pw.pw_uid, pw.pw_name);
+    if (pw2 == NULL) {
+	sudo_warnx("passwd entry for %s not found in cache", pw.pw_name);
+	errors++;
+    } else if (pw2->pw_uid != pw.pw_uid || pw2->pw_gid != pw.pw_gid ||
+	    strcmp(pw2->pw_name, pw.pw_name) != 0 ||
+	    strcmp(pw2->pw_dir, pw.pw_dir) != 0 ||
+	    strcmp(pw2->pw_shell, pw.pw_shell) != 0) {
+	sudo_warnx("passwd entry for %s does not match", pw.pw_name);
+	errors++;
+    }
+    if (pwcache_getpw(0, "nobody-here") != NULL) {
+	sudo_warnx("unexpected passwd cache hit for nobody-here");
+	errors++;
+    }
+
+    pwcache_putgids(pw.pw_name, pw.pw_gid, gids, nitems(gids));
+    if (!pwcache_getgids(pw.pw_name, pw.pw_gid, &gids2, &ngids2)) {
+	sudo_warnx("group IDs for %s not found in cache", pw.pw_name);
+	errors++;
+    } else {
+	if (ngids2 != nitems(gids) ||
+		memcmp(gids, gids2, sizeof(gids)) != 0) {
+	    sudo_warnx("group IDs for %s do not match", pw.pw_name);
+	    errors++;
+	}
+	free(gids2);
+    }
+
+    return errors;
+}
+
+static int
+check_expiry(void)
+{
+    struct group gr;
+    char *mem[] = { "root", NULL };
+    int errors = 0;
+
+    memset(&gr, 0, sizeof(gr));
+    gr.gr_name = "wheel";
+    gr.gr_passwd = "*";
+    gr.gr_gid = 0;
+    gr.gr_mem = mem;
+
+    pwcache_timeout = 1;
+    pwcache_putgr(gr.gr_gid, gr.gr_name, &gr);
+    if (pwcache_getgr(gr.gr_gid, gr.gr_name) == NULL) {
+	sudo_warnx("group entry for %s not found in cache", gr.gr_name);
+	errors++;
+    }
+    sleep(2);
+    if (pwcache_getgr(gr.gr_gid, gr.gr_name) != NULL) {
+	sudo_warnx("expired group entry for %s found in cache", gr.gr_name);
+	errors++;
+    }
+    pwcache_timeout = 300;
+
+    return errors;
+}
+
+static int
+check_corrupt(void)
+{
+    struct passwd pw;
+    GETGROUPS_T gids[] = { 20, 1000 }, *gids2;
+    unsigned char junk[64];
+    uint32_t ngids = 0xffffffff;
+    int errors = 0, ngids2;
+
+    memset(&pw, 0, sizeof(pw));
+    pw.pw_name = "corrupt";
+    pw.pw_passwd = "*";
+    pw.pw_uid = 1234;
+    pw.pw_gid = 20;
+    pw.pw_gecos = "";
+    pw.pw_dir = "/";
+    pw.pw_shell = "/bin/sh";
+    pwcache_putpw(pw.pw_uid, pw.pw_name, &pw);
+
+    /* Strings that are not NUL-terminated within the entry. */
+    memset(junk, 'A', sizeof(junk));
+    if (!corrupt_slot(pw.pw_name, junk, sizeof(junk))) {
+	sudo_warnx("unable to find cache slot for %s", pw.pw_name);
+	errors++;
+    } else if (pwcache_getpw(pw.pw_uid, pw.pw_name) != NULL) {
+	sudo_warnx("corrupt passwd entry for %s found in cache", pw.pw_name);
+	errors++;
+    }
+
+    /* A group ID count larger than the entry. */
+    pwcache_putgids("gidlist", pw.pw_gid, gids, nitems(gids));
+    if (!corrupt_slot("gidlist", &ngids, sizeof(ngids))) {
+	sudo_warnx("unable to find cache slot for %s", "gidlist");
+	errors++;
+    } else if (pwcache_getgids("gidlist", pw.pw_gid, &gids2, &ngids2)) {
+	sudo_warnx("corrupt group IDs for %s found in cache", "gidlist");
+	free(gids2);
+	errors++;
+    }
+
+    return errors;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/check_pwcache.XXXXXXXX";
+    char path[PATH_MAX];
+    int ntests = 3, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_pwcache");
+
+    if (mkdtemp(dir) == NULL)
+	sudo_fatal("mkdtemp");
+    (void)snprintf(path, sizeof(path), "%s/pwcache", dir);
+    pwcache_file = path;
+    pwcache_timeout = 300;
+
+    errors += check_hit() != 0;
+    errors += check_expiry() != 0;
+    errors += check_corrupt() != 0;
+
+    unlink(path);
+    rmdir(dir);
+
+    printf("%s: %d tests run, %d errors, %d%% success rate\n", getprogname(),
+	ntests, errors, (ntests - errors) * 100 / ntests);
+
+    exit(errors);
+}
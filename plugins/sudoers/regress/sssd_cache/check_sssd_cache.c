@@ -0,0 +1,430 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+#include "sudo_sss.h"
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* Normally set by the sudoers plugin arguments in policy.c. */
+const char *sssd_cache_file;
+unsigned int sssd_cache_timeout = 300;
+unsigned int sssd_negative_timeout = 60;
+
+#define USER_KEY	"8036:bWlsbGVydA=="
+#define OTHER_KEY	"1000:bm9ib2R5"
+
+/*
+ * Stubs of the root_cache.c helpers that skip the ownership checks
+ * so the test can be run by an unprivileged user.
+ */
+bool
+sudo_secure_root_cache_dir(const char *path)
+{
+    return true;
+}
+
+int
+sudo_open_root_cache(const char *path, int flags, mode_t badmodes,
+    struct stat *sb)
+{
+    int fd;
+
+    fd = open(path, flags|O_NOFOLLOW, S_IRUSR|S_IWUSR);
+    if (fd != -1 && sb != NULL && fstat(fd, sb) == -1) {
+	close(fd);
+	fd = -1;
+    }
+    return fd;
+}
+
+int
+sudo_open_slot_cache(const char *path, unsigned int magic,
+    unsigned int version, unsigned int nslots, size_t slot_size)
+{
+    return -1;
+}
+
+/*
+ * Replace the cache file with the contents of buf.
+ */
+static void
+write_cache(const char *buf)
+{
+    FILE *fp;
+
+    if ((fp = fopen(sssd_cache_file, "w")) == NULL)
+	sudo_fatal("%s", sssd_cache_file);
+    if (fputs(buf, fp) == EOF || fclose(fp) != 0)
+	sudo_fatal("%s", sssd_cache_file);
+}
+
+/*
+ * Returns true if the two results hold the same rules.
+ */
+static bool
+result_equal(struct sss_sudo_result *a, struct sss_sudo_result *b)
+{
+    unsigned int i, j, k;
+
+    if (a->num_rules != b->num_rules)
+	return false;
+    for (i = 0; i < a->num_rules; i++) {
+	struct sss_sudo_rule *ra = &a->rules[i], *rb = &b->rules[i];
+
+	if (ra->num_attrs != rb->num_attrs)
+	    return false;
+	for (j = 0; j < ra->num_attrs; j++) {
+	    struct sss_sudo_attr *aa = &ra->attrs[j], *ab = &rb->attrs[j];
+
+	    if (strcmp(aa->name, ab->name) != 0 ||
+		    aa->num_values != ab->num_values)
+		return false;
+	    for (k = 0; k < aa->num_values; k++) {
+		if (strcmp(aa->values[k], ab->values[k]) != 0)
+		    return false;
+	    }
+	}
+    }
+    return true;
+}
+
+static int
+check_hit(void)
+{
+    char *cn[] = { "millert-rule" }, *hosts[] = { "ALL" };
+    char *cmnds[] = { "/usr/bin/id -u", "", "!/bin/sh" };
+    char *opts[] = { "!authenticate" };
+    struct sss_sudo_attr attrs1[] = {
+	{ "cn", cn, nitems(cn) },
+	{ "sudoHost", hosts, nitems(hosts) },
+	{ "sudoCommand", cmnds, nitems(cmnds) },
+	{ "sudoRunAsUser", NULL, 0 }
+    };
+    struct sss_sudo_attr attrs2[] = {
+	{ "sudoOption", opts, nitems(opts) }
+    };
+    struct sss_sudo_rule rules[] = {
+	{ nitems(attrs1), attrs1 },
+	{ nitems(attrs2), attrs2 },
+	{ 0, NULL }
+    };
+    struct sss_sudo_result result = { nitems(rules), rules };
+    struct sss_sudo_result defaults = { 1, &rules[1] };
+    struct sss_sudo_result *result2;
+    char *domain;
+    int errors = 0;
+
+    sudo_sss_cache_store("U", USER_KEY, "example.com", &result);
+    sudo_sss_cache_store("D", "-", NULL, &defaults);
+
+    /* The defaults record must not have replaced the user record. */
+    result2 = NULL;
+    domain = NULL;
+    if (!sudo_sss_cache_lookup("U", USER_KEY, &result2, &domain)) {
+	sudo_warnx("user record %s not found in cache", USER_KEY);
+	errors++;
+    } else {
+	if (result2 == NULL || !result_equal(&result, result2)) {
+	    sudo_warnx("user record %s does not match", USER_KEY);
+	    errors++;
+	}
+	if (domain == NULL || strcmp(domain, "example.com") != 0) {
+	    sudo_warnx("user record %s: wrong domain %s", USER_KEY,
+		domain ? domain : "(none)");
+	    errors++;
+	}
+	sudo_sss_cache_free_result(result2);
+	free(domain);
+    }
+
+    result2 = NULL;
+    domain = NULL;
+    if (!sudo_sss_cache_lookup("D", "-", &result2, &domain)) {
+	sudo_warnx("defaults record not found in cache");
+	errors++;
+    } else {
+	if (result2 == NULL || !result_equal(&defaults, result2)) {
+	    sudo_warnx("defaults record does not match");
+	    errors++;
+	}
+	if (domain != NULL) {
+	    sudo_warnx("defaults record: unexpected domain %s", domain);
+	    errors++;
+	}
+	sudo_sss_cache_free_result(result2);
+	free(domain);
+    }
+
+    /* Same key, different type. */
+    if (sudo_sss_cache_lookup("D", USER_KEY, &result2, NULL)) {
+	sudo_warnx("unexpected defaults record %s in cache", USER_KEY);
+	sudo_sss_cache_free_result(result2);
+	errors++;
+    }
+    if (sudo_sss_cache_lookup("U", OTHER_KEY, &result2, NULL)) {
+	sudo_warnx("unexpected user record %s in cache", OTHER_KEY);
+	sudo_sss_cache_free_result(result2);
+	errors++;
+    }
+
+    return errors;
+}
+
+static int
+check_expiry(void)
+{
+    char *cn[] = { "expiry" };
+    struct sss_sudo_attr attrs[] = { { "cn", cn, nitems(cn) } };
+    struct sss_sudo_rule rules[] = { { nitems(attrs), attrs } };
+    struct sss_sudo_result result = { nitems(rules), rules };
+    struct sss_sudo_result *result2;
+    char buf[1024];
+    int errors = 0;
+
+    sssd_cache_timeout = 1;
+    sudo_sss_cache_store("U", OTHER_KEY, NULL, &result);
+    if (!sudo_sss_cache_lookup("U", OTHER_KEY, &result2, NULL)) {
+	sudo_warnx("user record %s not found in cache", OTHER_KEY);
+	errors++;
+    } else {
+	sudo_sss_cache_free_result(result2);
+    }
+    sleep(2);
+    if (sudo_sss_cache_lookup("U", OTHER_KEY, &result2, NULL)) {
+	sudo_warnx("expired user record %s found in cache", OTHER_KEY);
+	sudo_sss_cache_free_result(result2);
+	errors++;
+    }
+    sssd_cache_timeout = 300;
+
+    /* Records stored in the future are ignored. */
+    (void)snprintf(buf, sizeof(buf),
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR 1\nA 1 Y24=\nV ZnV0dXJl\n",
+	OTHER_KEY, (long long)time(NULL) + 3600);
+    write_cache(buf);
+    if (sudo_sss_cache_lookup("U", OTHER_KEY, &result2, NULL)) {
+	sudo_warnx("user record %s from the future found in cache",
+	    OTHER_KEY);
+	sudo_sss_cache_free_result(result2);
+	errors++;
+    }
+
+    return errors;
+}
+
+static int
+check_negative(void)
+{
+    struct sss_sudo_result *result2;
+    time_t now = time(NULL);
+    char buf[1024];
+    int errors = 0;
+
+    /* A user with no rules is cached too. */
+    sudo_sss_cache_store("U", OTHER_KEY, NULL, NULL);
+    result2 = NULL;
+    if (!sudo_sss_cache_lookup("U", OTHER_KEY, &result2, NULL)) {
+	sudo_warnx("negative user record %s not found in cache", OTHER_KEY);
+	errors++;
+    } else if (result2 != NULL) {
+	sudo_warnx("negative user record %s has rules", OTHER_KEY);
+	sudo_sss_cache_free_result(result2);
+	errors++;
+    }
+
+    /* Negative records expire after sssd_negative_timeout seconds. */
+    (void)snprintf(buf, sizeof(buf),
+	"# sudoers SSSD cache v1\n"
+	"U %s %lld 0\n"
+	"U %s %lld 1\nR 1\nA 1 Y24=\nV b2xk\n"
+	"D - %lld 0\n",
+	OTHER_KEY, (long long)now - 61,
+	USER_KEY, (long long)now - 61,
+	(long long)now - 59);
+    write_cache(buf);
+    if (sudo_sss_cache_lookup("U", OTHER_KEY, &result2, NULL)) {
+	sudo_warnx("expired negative user record %s found in cache",
+	    OTHER_KEY);
+	sudo_sss_cache_free_result(result2);
+	errors++;
+    }
+    if (!sudo_sss_cache_lookup("D", "-", &result2, NULL)) {
+	sudo_warnx("negative defaults record not found in cache");
+	errors++;
+    } else {
+	sudo_sss_cache_free_result(result2);
+    }
+    /* Records with rules use sssd_cache_timeout instead. */
+    if (!sudo_sss_cache_lookup("U", USER_KEY, &result2, NULL)) {
+	sudo_warnx("user record %s not found in cache", USER_KEY);
+	errors++;
+    } else {
+	sudo_sss_cache_free_result(result2);
+    }
+
+    return errors;
+}
+
+static int
+check_corrupt(void)
+{
+    const char *records[] = {
+	/* Wrong magic number. */
+	"# sudoers SSSD cache v2\nU %s %lld 0\n",
+	/* Missing rules. */
+	"# sudoers SSSD cache v1\nU %s %lld 2\nR 1\nA 1 Y24=\nV YWxs\n",
+	/* Missing attributes. */
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR 2\nA 1 Y24=\nV YWxs\n",
+	/* Missing values. */
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR 1\nA 2 Y24=\nV YWxs\n",
+	/* Truncated in the middle of a value. */
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR 1\nA 1 Y24=\n",
+	/* Value where an attribute should be. */
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR 1\nV YWxs\n",
+	/* Invalid base64 attribute name. */
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR 1\nA 1 !!!!\nV YWxs\n",
+	/* Value with an embedded NUL. */
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR 1\nA 1 Y24=\nV YQBi\n",
+	/* Invalid base64 domain. */
+	"# sudoers SSSD cache v1\nU %s %lld 0 !!!!\n",
+	/* Invalid attribute count. */
+	"# sudoers SSSD cache v1\nU %s %lld 1\nR -1\n",
+	/* Extra fields. */
+	"# sudoers SSSD cache v1\nU %s %lld 0 ZG9t extra\n",
+	NULL
+    };
+    struct sss_sudo_result *result2;
+    char buf[1024], *domain;
+    int errors = 0, i;
+
+    for (i = 0; records[i] != NULL; i++) {
+	(void)snprintf(buf, sizeof(buf), records[i], USER_KEY,
+	    (long long)time(NULL));
+	write_cache(buf);
+	if (sudo_sss_cache_lookup("U", USER_KEY, &result2, &domain)) {
+	    sudo_warnx("corrupt record #%d found in cache", i + 1);
+	    sudo_sss_cache_free_result(result2);
+	    free(domain);
+	    errors++;
+	}
+    }
+
+    /* A damaged cache file can still be updated. */
+    (void)snprintf(buf, sizeof(buf),
+	"# sudoers SSSD cache v1\nZ junk\nU %s %lld 1\nR 1\nA 1 Y24=\n",
+	USER_KEY, (long long)time(NULL));
+    write_cache(buf);
+    sudo_sss_cache_store("U", OTHER_KEY, NULL, NULL);
+    if (!sudo_sss_cache_lookup("U", OTHER_KEY, &result2, NULL)) {
+	sudo_warnx("user record %s not found in cache", OTHER_KEY);
+	errors++;
+    }
+    if (sudo_sss_cache_lookup("U", USER_KEY, &result2, NULL)) {
+	sudo_warnx("truncated user record %s found in cache", USER_KEY);
+	sudo_sss_cache_free_result(result2);
+	errors++;
+    }
+
+    return errors;
+}
+
+static int
+check_concurrent(void)
+{
+    struct sss_sudo_result *result2;
+    char key[64];
+    int errors = 0, i, j, status;
+    pid_t pid;
+
+    /* Each process stores its own keys, none may be lost. */
+    for (i = 0; i < 8; i++) {
+	switch (fork()) {
+	case -1:
+	    sudo_fatal("fork");
+	case 0:
+	    for (j = 0; j < 16; j++) {
+		(void)snprintf(key, sizeof(key), "%d:%d", i, j);
+		sudo_sss_cache_store("U", key, NULL, NULL);
+	    }
+	    _exit(0);
+	}
+    }
+    while ((pid = wait(&status)) != -1) {
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    sudo_warnx("child %d failed", (int)pid);
+	    errors++;
+	}
+    }
+
+    for (i = 0; i < 8; i++) {
+	for (j = 0; j < 16; j++) {
+	    (void)snprintf(key, sizeof(key), "%d:%d", i, j);
+	    if (!sudo_sss_cache_lookup("U", key, &result2, NULL)) {
+		sudo_warnx("user record %s not found in cache", key);
+		errors++;
+	    }
+	}
+    }
+
+    return errors;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/check_sssd_cache.XXXXXXXX";
+    char path[PATH_MAX], lockpath[PATH_MAX];
+    int ntests = 5, errors = 0;
+
+    initprogname(argc > 0 ? argv[0] : "check_sssd_cache");
+
+    if (mkdtemp(dir) == NULL)
+	sudo_fatal("mkdtemp");
+    (void)snprintf(path, sizeof(path), "%s/sssd_cache", dir);
+    (void)snprintf(lockpath, sizeof(lockpath), "%s/sssd_cache.lock", dir);
+    sssd_cache_file = path;
+
+    errors += check_hit() != 0;
+    errors += check_expiry() != 0;
+    errors += check_negative() != 0;
+    errors += check_corrupt() != 0;
+    errors += check_concurrent() != 0;
+
+    unlink(path);
+    unlink(lockpath);
+    rmdir(dir);
+
+    printf("%s: %d tests run, %d errors, %d%% success rate\n", getprogname(),
+	ntests, errors, (ntests - errors) * 100 / ntests);
+
+    exit(errors);
+}
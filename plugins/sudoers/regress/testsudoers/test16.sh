@@ -0,0 +1,31 @@
+#!/bin/sh
+#
+# Test user matching via the userspec index: uids, groups, gids,
+# negated aliases and case differences.
+#
+
+: ${TESTSUDOERS=testsudoers}
+
+exec 2>&1
+$TESTSUDOERS -P ${TESTDIR}/group root id <<EOF
+User_Alias NOTROOT = !root
+User_Alias STAFF = %staff
+User_Alias NOTSTAFF = !STAFF, millert
+
+millert ALL = /usr/bin/cmd1
+%bin ALL = /usr/bin/cmd2
+%Staff ALL = /usr/bin/cmd3
+NOTROOT ALL = /usr/bin/cmd4
+!STAFF ALL = /usr/bin/cmd5
+NOTSTAFF ALL = /usr/bin/cmd6
+#1 ALL = /usr/bin/cmd7
+#0 ALL = /usr/bin/cmd8
+%#0 ALL = /usr/bin/cmd9
+%wheel ALL = /usr/bin/cmd10
+STAFF ALL = /usr/bin/cmd11
+!NOTROOT ALL = /usr/bin/cmd12
+!NOTSTAFF ALL = /usr/bin/cmd13
+ALL, !millert ALL = /usr/bin/cmd14
+EOF
+
+exit 0
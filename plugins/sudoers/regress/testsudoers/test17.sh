@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# Test wildcard and directory commands that are listed more than once,
+# with and without a chroot, which are matched via the glob cache.
+#
+
+: ${TESTSUDOERS=testsudoers}
+
+TESTROOT=`mktemp -d "${TMPDIR:-/tmp}/testsudoers.XXXXXXXX"` || exit 1
+trap "rm -rf $TESTROOT" 0 1 2 3 15
+mkdir $TESTROOT/bin
+for f in cat less ls; do
+    echo "#!/bin/sh" > $TESTROOT/bin/$f
+    chmod 755 $TESTROOT/bin/$f
+done
+
+exec 2>&1
+for cmnd in $TESTROOT/bin/less $TESTROOT/bin/cat $TESTROOT/bin/sh /bin/cat; do
+    $TESTSUDOERS root $cmnd <<EOF | sed "s,$TESTROOT,@TESTROOT@,g"
+root ALL = CHROOT=$TESTROOT /bin/l*
+root ALL = $TESTROOT/bin/l*, $TESTROOT/bin/c*
+root ALL = $TESTROOT/bin/
+root ALL = (operator) $TESTROOT/bin/, $TESTROOT/bin/l*
+root ALL = CHROOT=$TESTROOT /bin/
+EOF
+    echo ""
+done
+
+exit 0
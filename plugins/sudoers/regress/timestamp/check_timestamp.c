@@ -0,0 +1,171 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pwd.h>
+
+#define SUDO_ERROR_WRAP 0
+
+#include "sudoers.h"
+#include "check.h"
+
+#include <def_data.c>
+
+/* More records than fit in the hash table of a new file. */
+#define NRECORDS	200
+
+/* Must match TS_MAX_PROBES in timestamp.c. */
+#define MAX_OVERFLOW	8
+
+struct sudo_user sudo_user;
+uid_t timestamp_uid;
+gid_t timestamp_gid;
+
+sudo_dso_public int main(int argc, char *argv[]);
+
+/* STUB */
+bool
+set_perms(int perm)
+{
+    return true;
+}
+
+/* STUB */
+bool
+restore_perms(void)
+{
+    return true;
+}
+
+/* STUB */
+bool
+get_boottime(struct timespec *ts)
+{
+    return false;
+}
+
+/* STUB */
+bool
+log_warning(int flags, const char *fmt, ...)
+{
+    return true;
+}
+
+/* STUB */
+bool
+log_warningx(int flags, const char *fmt, ...)
+{
+    return true;
+}
+
+/*
+ * Lock the time stamp record for the user with the given uid and
+ * return its status, enabling the record if update is set.
+ */
+static int
+check_record(uid_t uid, bool update)
+{
+    struct passwd pw;
+    void *cookie;
+    int status;
+
+    memset(&pw, 0, sizeof(pw));
+    pw.pw_name = "test";
+    pw.pw_uid = uid;
+    if ((cookie = timestamp_open(pw.pw_name, user_sid)) == NULL)
+	sudo_fatalx("unable to open time stamp file");
+    if (!timestamp_lock(cookie, &pw))
+	sudo_fatalx("unable to lock time stamp record for uid %u",
+	    (unsigned int)uid);
+    status = timestamp_status(cookie, &pw);
+    if (update && !timestamp_update(cookie, &pw))
+	sudo_fatalx("unable to update time stamp record for uid %u",
+	    (unsigned int)uid);
+    timestamp_close(cookie);
+    return status;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/check_timestamp.XXXXXXXX";
+    char path[PATH_MAX];
+    struct timestamp_header hdr;
+    struct stat sb;
+    int fd, ntests = 0, errors = 0;
+    uid_t uid;
+
+    initprogname(argc > 0 ? argv[0] : "check_timestamp");
+
+    if (mkdtemp(dir) == NULL)
+	sudo_fatal("mkdtemp");
+    (void)snprintf(path, sizeof(path), "%s/test", dir);
+    timestamp_uid = geteuid();
+    timestamp_gid = getegid();
+    user_sid = getsid(0);
+    def_timestampdir = dir;
+    def_timestamp_type = ppid;
+    def_timestamp_timeout.tv_sec = 3600;
+
+    /* Store a record for each uid, none should be current yet. */
+    for (uid = 1; uid <= NRECORDS; uid++) {
+	ntests++;
+	if (check_record(uid, true) == TS_CURRENT) {
+	    sudo_warnx("uid %u: new record is current", (unsigned int)uid);
+	    errors++;
+	}
+    }
+
+    /* Every record must still be found. */
+    for (uid = 1; uid <= NRECORDS; uid++) {
+	ntests++;
+	if (check_record(uid, false) != TS_CURRENT) {
+	    sudo_warnx("uid %u: record not found", (unsigned int)uid);
+	    errors++;
+	}
+    }
+
+    /* The hash table must have grown to hold the records. */
+    ntests++;
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &sb) == -1 ||
+	    pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+	sudo_fatal("%s", path);
+    close(fd);
+    if (hdr.nslots < NRECORDS ||
+	    sb.st_size > (off_t)(hdr.nslots + 1 + MAX_OVERFLOW) *
+	    (off_t)sizeof(struct timestamp_entry)) {
+	sudo_warnx("%u slots, %lld bytes: hash table did not grow",
+	    hdr.nslots, (long long)sb.st_size);
+	errors++;
+    }
+
+    unlink(path);
+    rmdir(dir);
+
+    printf("%s: %d tests run, %d errors, %d%% success rate\n", getprogname(),
+	ntests, errors, (ntests - errors) * 100 / ntests);
+
+    exit(errors);
+}
@@ -0,0 +1,169 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Common code for the cache files sudoers maintains on behalf of all
+ * users.  Since every user must be able to trust a cache, it is only
+ * used when running as root, and neither the file nor the directory
+ * it lives in may be writable by anyone but root.  Caches that hold
+ * passwd data or sudo rules must not be readable by other users either.
+ *
+ * A slot cache is a header followed by a fixed number of fixed-size
+ * slots.  Each entry has a single slot chosen by hashing its key; a
+ * newer entry simply replaces an older one.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(HAVE_STDINT_H)
+# include <stdint.h>
+#elif defined(HAVE_INTTYPES_H)
+# include <inttypes.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+
+#include "sudoers.h"
+
+struct slot_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nslots;
+    uint32_t slot_size;
+};
+
+/*
+ * Returns true if we are running as root and the directory that
+ * path lives in is owned by root and not writable by other users.
+ */
+bool
+sudo_secure_root_cache_dir(const char *path)
+{
+    char dir[PATH_MAX], *cp;
+    debug_decl(sudo_secure_root_cache_dir, SUDOERS_DEBUG_UTIL);
+
+    if (geteuid() != ROOT_UID)
+	debug_return_bool(false);
+
+    if (strlcpy(dir, path, sizeof(dir)) >= sizeof(dir))
+	debug_return_bool(false);
+    if ((cp = strrchr(dir, '/')) == NULL)
+	debug_return_bool(false);
+    cp[cp == dir] = '\0';
+    if (sudo_secure_dir(dir, ROOT_UID, -1, NULL) != SUDO_PATH_SECURE) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "%s: insecure or missing directory for cache %s", dir, path);
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Open the cache file path with the specified open(2) flags after
+ * checking its directory with sudo_secure_root_cache_dir().  A new
+ * file is only accessible by root.  The file must be a regular file
+ * owned by root with a single link and none of the mode bits in
+ * badmodes set.  If sb is not NULL, the file's status is stored there.
+ * Returns a close-on-exec file descriptor, or -1 if the cache cannot
+ * be used.  A missing file is not logged.
+ */
+int
+sudo_open_root_cache(const char *path, int flags, mode_t badmodes,
+    struct stat *sb)
+{
+    struct stat sbuf;
+    int fd;
+    debug_decl(sudo_open_root_cache, SUDOERS_DEBUG_UTIL);
+
+    if (!sudo_secure_root_cache_dir(path))
+	debug_return_int(-1);
+
+    if (sb == NULL)
+	sb = &sbuf;
+    fd = open(path, flags|O_NOFOLLOW|O_NONBLOCK, S_IRUSR|S_IWUSR);
+    if (fd == -1) {
+	if (errno != ENOENT) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to open %s", path);
+	}
+	debug_return_int(-1);
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    if (fstat(fd, sb) == -1 || !S_ISREG(sb->st_mode) ||
+	    sb->st_uid != ROOT_UID || sb->st_nlink != 1 ||
+	    ISSET(sb->st_mode, badmodes)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	    "%s: insecure cache file", path);
+	close(fd);
+	debug_return_int(-1);
+    }
+    debug_return_int(fd);
+}
+
+/*
+ * Open and lock the slot cache at path, which is only accessible by
+ * root.  A new file, or one with a different magic number, version
+ * or layout, is reset to nslots empty slots of slot_size bytes each.
+ * Slots start SLOT_CACHE_HDR_LEN bytes into the file.
+ * Returns the file descriptor, or -1 if the cache cannot be used.
+ */
+int
+sudo_open_slot_cache(const char *path, unsigned int magic,
+    unsigned int version, unsigned int nslots, size_t slot_size)
+{
+    struct slot_cache_header hdr;
+    int fd;
+    debug_decl(sudo_open_slot_cache, SUDOERS_DEBUG_UTIL);
+
+    fd = sudo_open_root_cache(path, O_RDWR|O_CREAT, S_IRWXG|S_IRWXO, NULL);
+    if (fd == -1)
+	debug_return_int(-1);
+    if (!sudo_lock_file(fd, SUDO_LOCK))
+	goto bad;
+
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    hdr.magic != magic || hdr.version != version ||
+	    hdr.nslots != nslots || hdr.slot_size != slot_size) {
+	hdr.magic = magic;
+	hdr.version = version;
+	hdr.nslots = nslots;
+	hdr.slot_size = slot_size;
+	if (ftruncate(fd, 0) == -1 ||
+		pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+		ftruncate(fd, SLOT_CACHE_HDR_LEN + (off_t)nslots * slot_size) == -1) {
+	    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+		"unable to initialize %s", path);
+	    goto bad;
+	}
+	sudo_debug_printf(SUDO_DEBUG_INFO, "initialized cache %s", path);
+    }
+    debug_return_int(fd);
+bad:
+    close(fd);
+    debug_return_int(-1);
+}
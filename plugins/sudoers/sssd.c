@@ -28,6 +28,7 @@
 
 #ifdef HAVE_SSSD
 
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -35,32 +36,20 @@
 #ifdef HAVE_STRINGS_H
 # include <strings.h>
 #endif /* HAVE_STRINGS_H */
+#include <unistd.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
 #include <pwd.h>
 
 #include "sudoers.h"
 #include "sudo_lbuf.h"
 #include "sudo_ldap.h"
+#include "sudo_sss.h"
 #include "sudo_dso.h"
 
-/* SSSD <--> SUDO interface - do not change */
-struct sss_sudo_attr {
-    char *name;
-    char **values;
-    unsigned int num_values;
-};
-
-struct sss_sudo_rule {
-    unsigned int num_attrs;
-    struct sss_sudo_attr *attrs;
-};
-
-struct sss_sudo_result {
-    unsigned int num_rules;
-    struct sss_sudo_rule *rules;
-};
-
 typedef int  (*sss_sudo_send_recv_t)(uid_t, const char*, const char*,
                                      uint32_t*, struct sss_sudo_result**);
 
@@ -475,18 +464,118 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Wrapper for sudo_sss_cache_lookup() that runs as root, the query
+ * may be performed as the runas user.
+ */
+static bool
+sudo_sss_cache_get(const char *type, const char *key,
+    struct sss_sudo_result **resultp, char **domainp)
+{
+    struct sss_sudo_result *result = NULL;
+    char *domain = NULL;
+    bool ret;
+    debug_decl(sudo_sss_cache_get, SUDOERS_DEBUG_SSSD);
+
+    if (sssd_cache_file == NULL || sssd_cache_timeout == 0)
+	debug_return_bool(false);
+    if (!set_perms(PERM_ROOT))
+	debug_return_bool(false);
+    ret = sudo_sss_cache_lookup(type, key, &result,
+	domainp ? &domain : NULL);
+    if (!restore_perms()) {
+	/* Unable to restore permissions, should not happen. */
+	if (ret) {
+	    sudo_sss_cache_free_result(result);
+	    free(domain);
+	    ret = false;
+	}
+    }
+    if (ret) {
+	*resultp = result;
+	if (domainp != NULL)
+	    *domainp = domain;
+    }
+    debug_return_bool(ret);
+}
+
+/*
+ * Wrapper for sudo_sss_cache_store() that runs as root.
+ */
+static void
+sudo_sss_cache_put(const char *type, const char *key, const char *domain,
+    struct sss_sudo_result *result)
+{
+    debug_decl(sudo_sss_cache_put, SUDOERS_DEBUG_SSSD);
+
+    if (sssd_cache_file == NULL || sssd_cache_timeout == 0)
+	debug_return;
+    if (result == NULL || result->num_rules == 0) {
+	if (sssd_negative_timeout == 0)
+	    debug_return;
+    }
+    if (!set_perms(PERM_ROOT))
+	debug_return;
+    sudo_sss_cache_store(type, key, domain, result);
+    (void)restore_perms();
+    debug_return;
+}
+
+/*
+ * Return the cache key for the user's rules, uid:name with the
+ * name base64-encoded.  Returns NULL on error.
+ */
+static char *
+sudo_sss_cache_user_key(struct passwd *pw)
+{
+    char *encoded, *key = NULL;
+    debug_decl(sudo_sss_cache_user_key, SUDOERS_DEBUG_SSSD);
+
+    if ((encoded = sudo_sss_cache_encode(pw->pw_name)) != NULL) {
+	if (asprintf(&key, "%u:%s", (unsigned int)pw->pw_uid, encoded) == -1)
+	    key = NULL;
+	free(encoded);
+    }
+    debug_return_str(key);
+}
+
+/*
+ * Free a result from libsss_sudo or the cache file.
+ */
+static void
+sudo_sss_free_result(struct sudo_sss_handle *handle,
+    struct sss_sudo_result *sss_result, bool cached)
+{
+    if (cached)
+	sudo_sss_cache_free_result(sss_result);
+    else
+	handle->fn_free_result(sss_result);
+}
+
+/*
+ * Fetch the rules for pw, from the cache file if possible.
+ * Sets cached to true if the result came from the cache file.
+ */
 static struct sss_sudo_result *
-sudo_sss_result_get(struct sudo_nss *nss, struct passwd *pw)
+sudo_sss_result_get(struct sudo_nss *nss, struct passwd *pw, bool *cached)
 {
     struct sudo_sss_handle *handle = nss->handle;
     struct sss_sudo_result *sss_result = NULL;
     uint32_t sss_error = 0, rc;
+    char *key;
     debug_decl(sudo_sss_result_get, SUDOERS_DEBUG_SSSD);
 
     sudo_debug_printf(SUDO_DEBUG_DIAG, "  username=%s", pw->pw_name);
     sudo_debug_printf(SUDO_DEBUG_DIAG, "domainname=%s",
 	handle->domainname ? handle->domainname : "NULL");
 
+    *cached = false;
+    key = sudo_sss_cache_user_key(pw);
+    if (key != NULL && sudo_sss_cache_get("U", key, &sss_result, NULL)) {
+	*cached = true;
+	goto done;
+    }
+
     rc = handle->fn_send_recv(pw->pw_uid, pw->pw_name,
 	handle->domainname, &sss_error, &sss_result);
     switch (rc) {
@@ -499,15 +588,17 @@ sudo_sss_result_get(struct sudo_nss *nss, struct passwd *pw)
 	    } else {
 		sudo_debug_printf(SUDO_DEBUG_ERROR,
 		    "Internal error: sss_result == NULL && sss_error == 0");
-		debug_return_ptr(NULL);
+		goto bad;
 	    }
 	    break;
 	case ENOENT:
 	    sudo_debug_printf(SUDO_DEBUG_INFO, "The user was not found in SSSD.");
-	    debug_return_ptr(NULL);
+	    handle->fn_free_result(sss_result);
+	    sss_result = NULL;
+	    break;
 	default:
 	    sudo_debug_printf(SUDO_DEBUG_ERROR, "sss_error=%u\n", sss_error);
-	    debug_return_ptr(NULL);
+	    goto bad;
 	}
 	break;
     case ENOMEM:
@@ -515,10 +606,20 @@ sudo_sss_result_get(struct sudo_nss *nss, struct passwd *pw)
 	FALLTHROUGH;
     default:
 	sudo_debug_printf(SUDO_DEBUG_ERROR, "handle->fn_send_recv: rc=%d", rc);
-	debug_return_ptr(NULL);
+	goto bad;
     }
 
+    /* A user with no rules is cached too. */
+    if (key != NULL)
+	sudo_sss_cache_put("U", key, NULL, sss_result);
+
+done:
+    free(key);
     debug_return_ptr(sss_result);
+bad:
+    handle->fn_free_result(sss_result);
+    free(key);
+    debug_return_ptr(NULL);
 }
 
 /* sudo_nss implementation */
@@ -647,6 +748,7 @@ sudo_sss_query(struct sudo_nss *nss, struct passwd *pw)
 {
     struct sudo_sss_handle *handle = nss->handle;
     struct sss_sudo_result *sss_result = NULL;
+    bool cached = false;
     int ret = 0;
     debug_decl(sudo_sss_query, SUDOERS_DEBUG_SSSD);
 
@@ -668,7 +770,7 @@ sudo_sss_query(struct sudo_nss *nss, struct passwd *pw)
     free_userspecs(&handle->parse_tree.userspecs);
 
     /* Fetch list of sudoRole entries that match user and host. */
-    sss_result = sudo_sss_result_get(nss, pw);
+    sss_result = sudo_sss_result_get(nss, pw, &cached);
 
     sudo_debug_printf(SUDO_DEBUG_DIAG,
 	"searching SSSD/LDAP for sudoers entries for user %s, host %s",
@@ -688,7 +790,7 @@ sudo_sss_query(struct sudo_nss *nss, struct passwd *pw)
 
 done:
     /* Cleanup */
-    handle->fn_free_result(sss_result);
+    sudo_sss_free_result(handle, sss_result, cached);
     if (ret == -1) {
 	free_userspecs(&handle->parse_tree.userspecs);
 	if (handle->pw != NULL) {
@@ -727,6 +829,7 @@ sudo_sss_getdefs(struct sudo_nss *nss)
     struct sudo_sss_handle *handle = nss->handle;
     struct sss_sudo_result *sss_result = NULL;
     static bool cached;
+    bool from_cache = false;
     uint32_t sss_error;
     unsigned int i;
     int rc;
@@ -744,19 +847,30 @@ sudo_sss_getdefs(struct sudo_nss *nss)
 
     sudo_debug_printf(SUDO_DEBUG_DIAG, "Looking for cn=defaults");
 
-    /* NOTE: these are global defaults, user-ID and name are not used. */
-    rc = handle->fn_send_recv_defaults(sudo_user.pw->pw_uid,
-	sudo_user.pw->pw_name, &sss_error, &handle->domainname, &sss_result);
-    switch (rc) {
-    case 0:
-	break;
-    case ENOMEM:
-	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
-	FALLTHROUGH;
-    default:
-	sudo_debug_printf(SUDO_DEBUG_ERROR,
-	    "handle->fn_send_recv_defaults: rc=%d, sss_error=%u", rc, sss_error);
-	debug_return_int(-1);
+    if (sudo_sss_cache_get("D", "-", &sss_result, &handle->domainname)) {
+	from_cache = true;
+	sss_error = sss_result ? 0 : ENOENT;
+    } else {
+	/* NOTE: these are global defaults, user-ID and name are not used. */
+	rc = handle->fn_send_recv_defaults(sudo_user.pw->pw_uid,
+	    sudo_user.pw->pw_name, &sss_error, &handle->domainname,
+	    &sss_result);
+	switch (rc) {
+	case 0:
+	    break;
+	case ENOMEM:
+	    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	    FALLTHROUGH;
+	default:
+	    sudo_debug_printf(SUDO_DEBUG_ERROR,
+		"handle->fn_send_recv_defaults: rc=%d, sss_error=%u",
+		rc, sss_error);
+	    debug_return_int(-1);
+	}
+	if (sss_error == 0 || sss_error == ENOENT) {
+	    sudo_sss_cache_put("D", "-", handle->domainname,
+		sss_error ? NULL : sss_result);
+	}
     }
 
     switch (sss_error) {
@@ -779,12 +893,12 @@ sudo_sss_getdefs(struct sudo_nss *nss)
 	sudo_debug_printf(SUDO_DEBUG_ERROR, "sss_error=%u\n", sss_error);
 	goto bad;
     }
-    handle->fn_free_result(sss_result);
+    sudo_sss_free_result(handle, sss_result, from_cache);
     cached = true;
     debug_return_int(0);
 
 bad:
-    handle->fn_free_result(sss_result);
+    sudo_sss_free_result(handle, sss_result, from_cache);
     debug_return_int(-1);
 }
 
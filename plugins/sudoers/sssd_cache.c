@@ -0,0 +1,542 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Persistent cache of SSSD rules, enabled by the "sssd_cache_file"
+ * sudoers plugin argument.  Without it, every sudo invocation asks
+ * the SSSD responder for the user's rules (and the global defaults).
+ * The cache lets later invocations reuse the rules fetched by an
+ * earlier one, including the fact that a user has no rules at all.
+ *
+ * The cache is a text file with one record per user plus one for the
+ * defaults, each followed by its rules.  A record header looks like:
+ *	<type> <key> <stored> <nrules> [<domain>]
+ * where type is "U" (key is uid:name) or "D" (key is "-").  Each rule
+ * is an "R <nattrs>" line followed by "A <nvalues> <name>" and
+ * "V <value>" lines.  Names and values are base64-encoded.
+ *
+ * libsss_sudo does not tell us when a user's rules last changed, so
+ * a record is only used for sssd_cache_timeout seconds, or for
+ * sssd_negative_timeout seconds if it has no rules.  The file is
+ * opened via sudo_open_root_cache() and replaced atomically when written.
+ * Writers serialize on a lock file named after the cache with ".lock"
+ * appended; readers do not need it.
+ *
+ * This file only deals with storing the rules, fetching them from
+ * SSSD is done in sssd.c.
+ */
+
+#include <config.h>
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#include "sudoers.h"
+#include "sudo_sss.h"
+
+#define SSS_CACHE_MAGIC		"# sudoers SSSD cache v1"
+
+struct sss_cache_record {
+    char *type;
+    char *key;
+    char *domain;
+    time_t stored;
+    unsigned int nrules;
+};
+
+/*
+ * Returns true if the cache file may be used.
+ */
+static bool
+sudo_sss_cache_enabled(void)
+{
+    debug_decl(sudo_sss_cache_enabled, SUDOERS_DEBUG_SSSD);
+
+    if (sssd_cache_file == NULL || sssd_cache_timeout == 0)
+	debug_return_bool(false);
+    debug_return_bool(sudo_secure_root_cache_dir(sssd_cache_file));
+}
+
+/*
+ * Open the cache file for reading and check its header.
+ * Returns a FILE pointer positioned after the header, else NULL.
+ */
+static FILE *
+sudo_sss_cache_fopen(void)
+{
+    char magic[sizeof(SSS_CACHE_MAGIC) + 1];
+    FILE *fp;
+    int fd;
+    debug_decl(sudo_sss_cache_fopen, SUDOERS_DEBUG_SSSD);
+
+    /* The cache holds sudo rules, it must not be readable by others. */
+    fd = sudo_open_root_cache(sssd_cache_file, O_RDONLY, S_IRWXG|S_IRWXO,
+	NULL);
+    if (fd == -1)
+	debug_return_ptr(NULL);
+    if ((fp = fdopen(fd, "r")) == NULL) {
+	close(fd);
+	debug_return_ptr(NULL);
+    }
+
+    if (fgets(magic, sizeof(magic), fp) == NULL ||
+	    strcmp(magic, SSS_CACHE_MAGIC "\n") != 0) {
+	sudo_debug_printf(SUDO_DEBUG_INFO, "%s: not an SSSD cache file",
+	    sssd_cache_file);
+	fclose(fp);
+	debug_return_ptr(NULL);
+    }
+    debug_return_ptr(fp);
+}
+
+/*
+ * Split line into at most nfields space-separated fields.
+ * Returns the number of fields, or -1 if there are too many.
+ */
+static int
+sudo_sss_cache_split(char *line, char **fields, int nfields)
+{
+    char *cp, *last;
+    int n = 0;
+
+    for (cp = strtok_r(line, " \n", &last); cp != NULL;
+	    cp = strtok_r(NULL, " \n", &last)) {
+	if (n == nfields)
+	    return -1;
+	fields[n++] = cp;
+    }
+    return n;
+}
+
+/*
+ * Parse a record header line, the fields point into line.
+ * Returns true on success, else false.
+ */
+static bool
+sudo_sss_cache_parse_header(char *line, struct sss_cache_record *rec)
+{
+    const char *errstr;
+    char *fields[5];
+    int n;
+
+    n = sudo_sss_cache_split(line, fields, nitems(fields));
+    if (n < 4)
+	return false;
+    if (strcmp(fields[0], "U") != 0 && strcmp(fields[0], "D") != 0)
+	return false;
+    rec->type = fields[0];
+    rec->key = fields[1];
+    rec->stored = sudo_strtonum(fields[2], 0, LLONG_MAX, &errstr);
+    if (errstr != NULL)
+	return false;
+    rec->nrules = sudo_strtonum(fields[3], 0, INT_MAX, &errstr);
+    if (errstr != NULL)
+	return false;
+    rec->domain = n == 5 ? fields[4] : NULL;
+    return true;
+}
+
+/*
+ * Returns true if the record has not yet expired.
+ */
+static bool
+sudo_sss_cache_fresh(struct sss_cache_record *rec, time_t now)
+{
+    time_t timeout = rec->nrules ? sssd_cache_timeout : sssd_negative_timeout;
+
+    /* Ignore records stored in the future. */
+    return rec->stored <= now && now - rec->stored < timeout;
+}
+
+/*
+ * Base64-encode str, the empty string is stored as "=".
+ * Returns a newly allocated string or NULL on error.
+ */
+char *
+sudo_sss_cache_encode(const char *str)
+{
+    size_t len = strlen(str);
+    size_t elen = ((len + 2) / 3) * 4 + 1;
+    char *encoded;
+
+    if (len == 0)
+	return strdup("=");
+    if ((encoded = malloc(elen)) == NULL)
+	return NULL;
+    if (base64_encode((const unsigned char *)str, len, encoded, elen) ==
+	    (size_t)-1) {
+	free(encoded);
+	return NULL;
+    }
+    return encoded;
+}
+
+/*
+ * Decode a base64-encoded string.
+ * Returns a newly allocated string or NULL on error.
+ */
+static char *
+sudo_sss_cache_decode(const char *str)
+{
+    size_t len, dlen = (strlen(str) / 4 + 1) * 3 + 1;
+    char *decoded;
+
+    if ((decoded = malloc(dlen)) == NULL)
+	return NULL;
+    len = base64_decode(str, (unsigned char *)decoded, dlen - 1);
+    if (len == (size_t)-1 || memchr(decoded, '\0', len) != NULL) {
+	free(decoded);
+	return NULL;
+    }
+    decoded[len] = '\0';
+    return decoded;
+}
+
+/*
+ * Free a result read from the cache file.
+ */
+void
+sudo_sss_cache_free_result(struct sss_sudo_result *result)
+{
+    unsigned int i, j, k;
+    debug_decl(sudo_sss_cache_free_result, SUDOERS_DEBUG_SSSD);
+
+    if (result == NULL)
+	debug_return;
+    for (i = 0; i < result->num_rules; i++) {
+	struct sss_sudo_rule *rule = &result->rules[i];
+	for (j = 0; j < rule->num_attrs; j++) {
+	    struct sss_sudo_attr *attr = &rule->attrs[j];
+	    if (attr->values != NULL) {
+		for (k = 0; k < attr->num_values; k++)
+		    free(attr->values[k]);
+		free(attr->values);
+	    }
+	    free(attr->name);
+	}
+	free(rule->attrs);
+    }
+    free(result->rules);
+    free(result);
+    debug_return;
+}
+
+/*
+ * Read the next line and split it into fields, the first of which
+ * must be tag.  Returns the number of fields, or -1 on error.
+ */
+static int
+sudo_sss_cache_getline(FILE *fp, char **linep, size_t *sizep,
+    const char *tag, char **fields, int nfields)
+{
+    int n;
+
+    if (getline(linep, sizep, fp) == -1)
+	return -1;
+    n = sudo_sss_cache_split(*linep, fields, nfields);
+    if (n < 1 || strcmp(fields[0], tag) != 0)
+	return -1;
+    return n;
+}
+
+/*
+ * Read nrules rules from the cache file into a newly allocated result
+ * in the format used by libsss_sudo.  Returns the result, or NULL on error.
+ */
+static struct sss_sudo_result *
+sudo_sss_cache_read_rules(FILE *fp, unsigned int nrules)
+{
+    struct sss_sudo_result *result;
+    char *fields[3], *line = NULL;
+    const char *errstr;
+    size_t linesize = 0;
+    unsigned int i, j, k;
+    debug_decl(sudo_sss_cache_read_rules, SUDOERS_DEBUG_SSSD);
+
+    if ((result = calloc(1, sizeof(*result))) == NULL)
+	goto bad;
+    if ((result->rules = calloc(nrules, sizeof(*result->rules))) == NULL)
+	goto bad;
+    result->num_rules = nrules;
+
+    for (i = 0; i < nrules; i++) {
+	struct sss_sudo_rule *rule = &result->rules[i];
+
+	if (sudo_sss_cache_getline(fp, &line, &linesize, "R", fields, 2) != 2)
+	    goto bad;
+	rule->num_attrs = sudo_strtonum(fields[1], 0, INT_MAX, &errstr);
+	if (errstr != NULL)
+	    goto bad;
+	if (rule->num_attrs != 0) {
+	    rule->attrs = calloc(rule->num_attrs, sizeof(*rule->attrs));
+	    if (rule->attrs == NULL) {
+		rule->num_attrs = 0;
+		goto bad;
+	    }
+	}
+	for (j = 0; j < rule->num_attrs; j++) {
+	    struct sss_sudo_attr *attr = &rule->attrs[j];
+
+	    if (sudo_sss_cache_getline(fp, &line, &linesize, "A", fields, 3) != 3)
+		goto bad;
+	    attr->num_values = sudo_strtonum(fields[1], 0, INT_MAX, &errstr);
+	    if (errstr != NULL)
+		goto bad;
+	    attr->values = calloc(attr->num_values + 1, sizeof(char *));
+	    if (attr->values == NULL)
+		goto bad;
+	    if ((attr->name = sudo_sss_cache_decode(fields[2])) == NULL)
+		goto bad;
+	    for (k = 0; k < attr->num_values; k++) {
+		if (sudo_sss_cache_getline(fp, &line, &linesize, "V", fields, 2) != 2)
+		    goto bad;
+		attr->values[k] = sudo_sss_cache_decode(fields[1]);
+		if (attr->values[k] == NULL)
+		    goto bad;
+	    }
+	}
+    }
+    free(line);
+    debug_return_ptr(result);
+
+bad:
+    sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO,
+	"%s: invalid or truncated SSSD cache record", sssd_cache_file);
+    sudo_sss_cache_free_result(result);
+    free(line);
+    debug_return_ptr(NULL);
+}
+
+/*
+ * Look up the unexpired record for type and key in the cache file.
+ * On success, the rules are stored in resultp (NULL if there are none)
+ * and, if domainp is not NULL, the decoded domain in domainp.
+ * Returns true if a record was found, else false.
+ */
+bool
+sudo_sss_cache_lookup(const char *type, const char *key,
+    struct sss_sudo_result **resultp, char **domainp)
+{
+    struct sss_cache_record rec;
+    struct sss_sudo_result *result = NULL;
+    char *domain = NULL, *line = NULL;
+    size_t linesize = 0;
+    bool ret = false;
+    time_t now;
+    FILE *fp;
+    debug_decl(sudo_sss_cache_lookup, SUDOERS_DEBUG_SSSD);
+
+    if (!sudo_sss_cache_enabled())
+	debug_return_bool(false);
+    if ((fp = sudo_sss_cache_fopen()) == NULL)
+	debug_return_bool(false);
+
+    now = time(NULL);
+    while (getline(&line, &linesize, fp) != -1) {
+	/* Skip over the rules of other records. */
+	if (!sudo_sss_cache_parse_header(line, &rec))
+	    continue;
+	if (strcmp(rec.type, type) != 0 || strcmp(rec.key, key) != 0)
+	    continue;
+	if (!sudo_sss_cache_fresh(&rec, now)) {
+	    sudo_debug_printf(SUDO_DEBUG_INFO,
+		"expired SSSD cache record %s %s", type, key);
+	    break;
+	}
+	if (domainp != NULL && rec.domain != NULL) {
+	    if ((domain = sudo_sss_cache_decode(rec.domain)) == NULL)
+		break;
+	}
+	if (rec.nrules != 0) {
+	    if ((result = sudo_sss_cache_read_rules(fp, rec.nrules)) == NULL) {
+		free(domain);
+		break;
+	    }
+	}
+	sudo_debug_printf(SUDO_DEBUG_INFO,
+	    "using %u rule(s) from SSSD cache record %s %s", rec.nrules,
+	    type, key);
+	*resultp = result;
+	if (domainp != NULL)
+	    *domainp = domain;
+	ret = true;
+	break;
+    }
+    free(line);
+    fclose(fp);
+
+    debug_return_bool(ret);
+}
+
+/*
+ * Write the rules in result to the cache file.
+ * Returns true on success, else false.
+ */
+static bool
+sudo_sss_cache_write_rules(FILE *fp, struct sss_sudo_result *result)
+{
+    unsigned int i, j, k;
+    char *encoded;
+    debug_decl(sudo_sss_cache_write_rules, SUDOERS_DEBUG_SSSD);
+
+    for (i = 0; i < result->num_rules; i++) {
+	struct sss_sudo_rule *rule = &result->rules[i];
+
+	fprintf(fp, "R %u\n", rule->num_attrs);
+	for (j = 0; j < rule->num_attrs; j++) {
+	    struct sss_sudo_attr *attr = &rule->attrs[j];
+
+	    if ((encoded = sudo_sss_cache_encode(attr->name)) == NULL)
+		debug_return_bool(false);
+	    fprintf(fp, "A %u %s\n", attr->num_values, encoded);
+	    free(encoded);
+	    for (k = 0; k < attr->num_values; k++) {
+		if ((encoded = sudo_sss_cache_encode(attr->values[k])) == NULL)
+		    debug_return_bool(false);
+		fprintf(fp, "V %s\n", encoded);
+		free(encoded);
+	    }
+	}
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Store the rules in result (which may be NULL if there are none)
+ * as the record for type and key.  Unexpired records for other keys
+ * are copied from the old cache file, if any.  The cache file is
+ * replaced by rename(2), so the copy is done while holding a lock on
+ * a separate lock file to avoid losing records stored concurrently
+ * by another sudo process.
+ */
+void
+sudo_sss_cache_store(const char *type, const char *key, const char *domain,
+    struct sss_sudo_result *result)
+{
+    unsigned int nrules = result ? result->num_rules : 0;
+    char *encoded = NULL, *line = NULL, *tmpfile = NULL, *lockfile = NULL;
+    struct sss_cache_record rec;
+    FILE *ifp, *ofp = NULL;
+    size_t linesize = 0;
+    bool keep = false, ret = false;
+    int fd = -1, lockfd = -1;
+    time_t now;
+    debug_decl(sudo_sss_cache_store, SUDOERS_DEBUG_SSSD);
+
+    if (!sudo_sss_cache_enabled())
+	debug_return;
+    if (domain != NULL && (encoded = sudo_sss_cache_encode(domain)) == NULL)
+	debug_return;
+    if (asprintf(&lockfile, "%s.lock", sssd_cache_file) == -1) {
+	lockfile = NULL;
+	goto done;
+    }
+    lockfd = sudo_open_root_cache(lockfile, O_RDWR|O_CREAT, S_IRWXG|S_IRWXO,
+	NULL);
+    if (lockfd == -1)
+	goto done;
+    if (!sudo_lock_file(lockfd, SUDO_LOCK)) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to lock %s", lockfile);
+	goto done;
+    }
+    if (asprintf(&tmpfile, "%s.XXXXXX", sssd_cache_file) == -1) {
+	tmpfile = NULL;
+	goto done;
+    }
+    if ((fd = mkstemps(tmpfile, 0)) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to create %s", tmpfile);
+	goto done;
+    }
+    if ((ofp = fdopen(fd, "w")) == NULL) {
+	close(fd);
+	goto done;
+    }
+    fputs(SSS_CACHE_MAGIC "\n", ofp);
+
+    /* Copy unexpired records for other keys. */
+    now = time(NULL);
+    if ((ifp = sudo_sss_cache_fopen()) != NULL) {
+	while (getline(&line, &linesize, ifp) != -1) {
+	    if (line[0] == 'R' || line[0] == 'A' || line[0] == 'V') {
+		if (keep)
+		    fputs(line, ofp);
+		continue;
+	    }
+	    keep = sudo_sss_cache_parse_header(line, &rec) &&
+		sudo_sss_cache_fresh(&rec, now) &&
+		(strcmp(rec.type, type) != 0 || strcmp(rec.key, key) != 0);
+	    if (keep) {
+		fprintf(ofp, "%s %s %lld %u%s%s\n", rec.type, rec.key,
+		    (long long)rec.stored, rec.nrules, rec.domain ? " " : "",
+		    rec.domain ? rec.domain : "");
+	    }
+	}
+	free(line);
+	fclose(ifp);
+    }
+
+    /* Add the new record. */
+    fprintf(ofp, "%s %s %lld %u%s%s\n", type, key, (long long)now, nrules,
+	encoded ? " " : "", encoded ? encoded : "");
+    if (result != NULL && !sudo_sss_cache_write_rules(ofp, result))
+	goto done;
+
+    if (fflush(ofp) != 0 || ferror(ofp) || fsync(fileno(ofp)) != 0) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to write %s", tmpfile);
+	goto done;
+    }
+    if (fclose(ofp) != 0) {
+	ofp = NULL;
+	goto done;
+    }
+    ofp = NULL;
+    if (rename(tmpfile, sssd_cache_file) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_WARN|SUDO_DEBUG_LINENO|SUDO_DEBUG_ERRNO,
+	    "unable to rename %s to %s", tmpfile, sssd_cache_file);
+	goto done;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"stored %u rule(s) in SSSD cache record %s %s", nrules, type, key);
+    ret = true;
+
+done:
+    if (ofp != NULL)
+	fclose(ofp);
+    if (!ret && fd != -1)
+	unlink(tmpfile);
+    if (lockfd != -1)
+	close(lockfd);
+    free(lockfile);
+    free(tmpfile);
+    free(encoded);
+    debug_return;
+}
@@ -22,6 +22,20 @@
 /* Iterators used by sudo_ldap_role_to_priv() to handle bervar ** or char ** */
 typedef char * (*sudo_ldap_iter_t)(void **);
 
+struct ldap_cache;
+struct sudo_lbuf;
+
+/* ldap_cache.c */
+FILE *ldap_cache_open_fresh(const char *path, const char *source, int timeout);
+struct ldap_cache *ldap_cache_alloc(void);
+void ldap_cache_free(struct ldap_cache *cache);
+struct ldap_cache *ldap_cache_read(const char *path, const char *source);
+bool ldap_cache_write(struct ldap_cache *cache, const char *path, const char *source);
+bool ldap_cache_add(struct ldap_cache *cache, char *dn, char *ldif, const char *timestamp);
+void ldap_cache_mark(struct ldap_cache *cache, const char *dn);
+const char *ldap_cache_timestamp(struct ldap_cache *cache);
+bool ldap_cache_append_attr(struct sudo_lbuf *lbuf, const char *name, const char *value, size_t len);
+
 /* ldap_util.c */
 bool sudo_ldap_is_negated(char **valp);
 bool sudo_ldap_add_default(const char *var, const char *val, int op, char *source, struct defaults_list *defs);
@@ -104,6 +104,8 @@ struct ldap_config {
     int ssl_mode;
     int timed;
     int deref;
+    int cache_timeout;
+    int resolve_groups;
     char *host;
     struct ldap_config_str_list uri;
     char *binddn;
@@ -113,6 +115,7 @@ struct ldap_config {
     struct ldap_config_str_list netgroup_base;
     char *search_filter;
     char *netgroup_search_filter;
+    char *cache_file;
     char *ssl;
     char *tls_cacertfile;
     char *tls_cacertdir;
@@ -769,9 +769,11 @@ done:
 
     restore_nproc();
 
-    /* Destroy the password and group caches and free the contents. */
+    /* Destroy the password, group, glob and match caches. */
     sudo_freepwcache();
     sudo_freegrcache();
+    glob_cache_free();
+    match_memo_free();
 
     sudo_warn_set_locale_func(NULL);
 
@@ -1617,6 +1619,8 @@ sudoers_cleanup(void)
 	group_plugin_unload();
     sudo_freepwcache();
     sudo_freegrcache();
+    glob_cache_free();
+    match_memo_free();
 
     debug_return;
 }
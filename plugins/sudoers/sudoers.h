@@ -360,6 +360,22 @@ int  sudo_set_grlist(struct passwd *pw, char * const *groups);
 void sudo_pwutil_set_backend(sudo_make_pwitem_t, sudo_make_gritem_t, sudo_make_gidlist_item_t, sudo_make_grlist_item_t);
 void sudo_setspent(void);
 
+/* pwutil_cache.c */
+extern const char *pwcache_file;
+extern unsigned int pwcache_timeout;
+struct passwd *pwcache_getpw(uid_t uid, const char *name);
+void pwcache_putpw(uid_t uid, const char *name, const struct passwd *pw);
+struct group *pwcache_getgr(gid_t gid, const char *name);
+void pwcache_putgr(gid_t gid, const char *name, const struct group *gr);
+bool pwcache_getgids(const char *name, gid_t basegid, GETGROUPS_T **gidsp, int *ngidsp);
+void pwcache_putgids(const char *name, gid_t basegid, const GETGROUPS_T *gids, int ngids);
+
+/* root_cache.c */
+bool sudo_secure_root_cache_dir(const char *path);
+int sudo_open_root_cache(const char *path, int flags, mode_t badmodes, struct stat *sb);
+int sudo_open_slot_cache(const char *path, unsigned int magic, unsigned int version, unsigned int nslots, size_t slot_size);
+#define SLOT_CACHE_HDR_LEN	16
+
 /* timestr.c */
 char *get_timestr(time_t, int);
 
@@ -423,6 +439,9 @@ int sudoers_policy_deserialize_info(void *v);
 bool sudoers_policy_store_result(bool accepted, char *argv[], char *envp[], mode_t cmnd_umask, char *iolog_path, void *v);
 extern const char *path_ldap_conf;
 extern const char *path_ldap_secret;
+extern const char *sssd_cache_file;
+extern unsigned int sssd_cache_timeout;
+extern unsigned int sssd_negative_timeout;
 
 /* group_plugin.c */
 int group_plugin_load(char *plugin_info);
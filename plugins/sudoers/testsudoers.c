@@ -107,8 +107,9 @@ main(int argc, char *argv[])
     enum sudoers_formats input_format = format_sudoers;
     struct cmndspec *cs;
     struct privilege *priv;
-    struct userspec *us;
+    struct userspec *us, **specs;
     char *p, *grfile, *pwfile;
+    size_t nspecs;
     const char *errstr;
     int match, host_match, runas_match, cmnd_match;
     int ch, dflag, exitcode = EXIT_FAILURE;
@@ -320,7 +321,15 @@ main(int argc, char *argv[])
     /* This loop must match the one in sudo_file_lookup() */
     printf("\nEntries for user %s:\n", user_name);
     match = UNSPEC;
-    TAILQ_FOREACH_REVERSE(us, &parsed_policy.userspecs, userspec_list, entries) {
+    if (!userspec_index_build(&parsed_policy) ||
+	    !alias_index_build(&parsed_policy))
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    specs = userspec_index_lookup(&parsed_policy, sudo_user.pw, &nspecs);
+    if (specs == NULL)
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    match_memo_begin(&parsed_policy);
+    while (nspecs--) {
+	us = specs[nspecs];
 	if (userlist_matches(&parsed_policy, sudo_user.pw, &us->users) != ALLOW)
 	    continue;
 	TAILQ_FOREACH_REVERSE(priv, &us->privileges, privilege_list, entries) {
@@ -348,6 +357,8 @@ main(int argc, char *argv[])
 		puts(U_("\thost  unmatched"));
 	}
     }
+    match_memo_end(&parsed_policy);
+    free(specs);
     puts(match == ALLOW ? U_("\nCommand allowed") :
 	match == DENY ?  U_("\nCommand denied") :  U_("\nCommand unmatched"));
 
@@ -509,6 +520,9 @@ init_eventlog_config(void)
 int
 set_cmnd_path(const char *runchroot)
 {
+    /* The caller frees user_cmnd and restores the old value. */
+    if ((user_cmnd = strdup(user_cmnd)) == NULL)
+	return NOT_FOUND_ERROR;
     return FOUND;
 }
 
@@ -55,14 +55,34 @@
  * access to create new records.  This is a short-term lock and sudo
  * should not sleep while holding it (or the user will not be able to sudo).
  * The TS_LOCKEXCL entry must be unlocked before locking the actual record.
+ *
+ * In a version 3 file, the TS_LOCKEXCL record is a header that stores
+ * the size of the hash table of records that follows it.  A record is
+ * stored in the slot its type, uid and tty or parent pid hash to, or
+ * one of the next few slots, so it can be found with a few reads no
+ * matter how large the file is.  A slot holding a stale record may be
+ * reused.  If all those slots hold current records, the record is
+ * appended after the table.  Once more than TS_MAX_PROBES records have
+ * been appended, the file is rewritten with a hash table twice the
+ * size, so a lookup reads at most 2 * TS_MAX_PROBES records until the
+ * table reaches TS_MAX_SLOTS slots.
  */
 
+#define TS_NSLOTS		64	/* hash table slots in a new file */
+#define TS_MAX_SLOTS		65536	/* upper bound for the hash table */
+#define TS_MAX_PROBES		8	/* slots to check before appending */
+
+/* Offset of hash table slot n, the header takes the place of slot -1. */
+#define TS_SLOT_OFFSET(n) \
+    ((off_t)((n) + 1) * (off_t)sizeof(struct timestamp_entry))
+
 struct ts_cookie {
     char *fname;
     int fd;
     pid_t sid;
     bool locked;
     off_t pos;
+    unsigned int nslots;
     struct timestamp_entry key;
 };
 
@@ -178,6 +198,79 @@ ts_find_record(int fd, struct timestamp_entry *key, struct timestamp_entry *entr
     debug_return_bool(false);
 }
 
+/*
+ * Mix the low 64 bits of val into the FNV-1a hash h.
+ */
+static uint32_t
+ts_hash_value(uint32_t h, unsigned long long val)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+	h = (h ^ (val & 0xff)) * 16777619U;
+	val >>= 8;
+    }
+    return h;
+}
+
+/*
+ * Hash the fields that identify a record: type, uid and tty or ppid.
+ * The start time is not included so a stale record for the same tty
+ * or parent pid is found in the same place and can be reused.
+ */
+static unsigned int
+ts_hash_key(struct timestamp_entry *key)
+{
+    uint32_t h = 2166136261U;	/* FNV-1a */
+
+    h = ts_hash_value(h, key->type);
+    h = ts_hash_value(h, (unsigned int)key->auth_uid);
+    switch (key->type) {
+    case TS_TTY:
+	h = ts_hash_value(h, (unsigned long long)key->u.ttydev);
+	break;
+    case TS_PPID:
+	h = ts_hash_value(h, (unsigned int)key->u.ppid);
+	break;
+    }
+    return h;
+}
+
+/*
+ * Returns true if a record in the hash table that does not match key
+ * may be replaced.  That is the case if it is disabled, has expired or
+ * is for the same tty or parent pid as key but a session leader or
+ * parent process that no longer exists.  Global records are shared
+ * by all ttys and are never replaced.
+ */
+static bool
+ts_stale_record(struct timestamp_entry *key, struct timestamp_entry *entry,
+    struct timespec *now)
+{
+    struct timespec diff;
+    debug_decl(ts_stale_record, SUDOERS_DEBUG_AUTH);
+
+    if (entry->version != TS_VERSION || entry->size != sizeof(*entry))
+	debug_return_bool(true);
+    if (entry->type == TS_GLOBAL)
+	debug_return_bool(false);
+    if (ISSET(entry->flags, TS_DISABLED))
+	debug_return_bool(true);
+    if (entry->type == key->type && entry->auth_uid == key->auth_uid) {
+	if (entry->type == TS_TTY && entry->u.ttydev == key->u.ttydev)
+	    debug_return_bool(true);
+	if (entry->type == TS_PPID && entry->u.ppid == key->u.ppid)
+	    debug_return_bool(true);
+    }
+
+    /* Negative timeouts only expire manually (sudo -k). */
+    sudo_timespecclear(&diff);
+    if (now == NULL || sudo_timespeccmp(&def_timestamp_timeout, &diff, <))
+	debug_return_bool(false);
+    sudo_timespecsub(now, &entry->ts, &diff);
+    debug_return_bool(sudo_timespeccmp(&diff, &def_timestamp_timeout, >=));
+}
+
 /*
  * Create a directory and any missing parent directories with the
  * specified mode.
@@ -295,6 +388,38 @@ ts_open(const char *path, int flags)
     debug_return_int(fd);
 }
 
+/*
+ * Create a unique temporary file from the template in path, owned by
+ * the time stamp user, and set the close on exec flag.
+ * Returns open file descriptor on success.
+ * Returns TIMESTAMP_OPEN_ERROR or TIMESTAMP_PERM_ERROR on error.
+ */
+static int
+ts_mkstemp(char *path)
+{
+    bool uid_changed = false;
+    int fd;
+    debug_decl(ts_mkstemp, SUDOERS_DEBUG_AUTH);
+
+    if (timestamp_uid != 0)
+	uid_changed = set_perms(PERM_TIMESTAMP);
+    fd = mkstemps(path, 0);
+    if (uid_changed && !restore_perms()) {
+	/* Unable to restore permissions, should not happen. */
+	if (fd != -1) {
+	    int serrno = errno;
+	    close(fd);
+	    unlink(path);
+	    errno = serrno;
+	    fd = TIMESTAMP_PERM_ERROR;
+	}
+    }
+    if (fd >= 0)
+	(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    debug_return_int(fd);
+}
+
 static ssize_t
 ts_write(int fd, const char *fname, struct timestamp_entry *entry, off_t offset)
 {
@@ -587,24 +712,382 @@ done:
 }
 
 /*
- * Write a TS_LOCKEXCL record at the beginning of the time stamp file.
+ * Lock a record in the time stamp file without waiting.
+ * Returns true if the lock was taken, else false.
  */
-bool
-timestamp_lock_write(struct ts_cookie *cookie)
+static bool
+timestamp_trylock_record(int fd, off_t pos, off_t len)
 {
-    struct timestamp_entry entry;
-    bool ret = true;
-    debug_decl(timestamp_lock_write, SUDOERS_DEBUG_AUTH);
-
-    memset(&entry, 0, sizeof(entry));
-    entry.version = TS_VERSION;
-    entry.size = sizeof(entry);
-    entry.type = TS_LOCKEXCL;
-    if (ts_write(cookie->fd, cookie->fname, &entry, -1) == -1)
-	ret = false;
+    debug_decl(timestamp_trylock_record, SUDOERS_DEBUG_AUTH);
+
+    if (lseek(fd, pos, SEEK_SET) == -1) {
+	sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
+	    "unable to seek to %lld", (long long)pos);
+	debug_return_bool(false);
+    }
+    debug_return_bool(sudo_lock_region(fd, SUDO_TLOCK, len));
+}
+
+/*
+ * Add entry to the in-memory hash table of nslots slots used by
+ * ts_convert_file(), appending it after the table if there is no
+ * free slot.
+ * Returns true on success, else false.
+ */
+static bool
+ts_convert_insert(struct timestamp_entry **tablep, size_t *nrecordsp,
+    unsigned int nslots, struct timestamp_entry *entry)
+{
+    struct timestamp_entry *table = *tablep;
+    unsigned int i, slot;
+    debug_decl(ts_convert_insert, SUDOERS_DEBUG_AUTH);
+
+    slot = ts_hash_key(entry) % nslots;
+    for (i = 0; i < MIN(nslots, TS_MAX_PROBES); i++) {
+	/* Slot n is table[n + 1], the header is table[0]. */
+	if (table[slot + 1].type == TS_UNUSED) {
+	    table[slot + 1] = *entry;
+	    debug_return_bool(true);
+	}
+	slot = (slot + 1) % nslots;
+    }
+    table = reallocarray(table, *nrecordsp + 1, sizeof(*table));
+    if (table == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    table[(*nrecordsp)++] = *entry;
+    *tablep = table;
+    debug_return_bool(true);
+}
+
+/*
+ * Rewrite a time stamp file in the version 3 format with a hash table
+ * of nslots slots.  Enabled records from a version 2 file and all the
+ * records from a version 3 file are carried over.  A new or corrupt
+ * file is replaced by an empty one.
+ * The new file is written next to the old one and renamed into place,
+ * so another sudo holding a record lock or position in the old file
+ * never sees it change underneath it.
+ * Called with the header record locked.
+ * Returns true on success, else false.
+ */
+static bool
+ts_convert_file(int fd, const char *fname, unsigned int nslots)
+{
+    struct timestamp_entry *table, entry;
+    struct timestamp_header hdr;
+    size_t i, nrecords = nslots + 1;
+    unsigned short version;
+    char *tmpfile = NULL;
+    ssize_t nwritten;
+    bool ret = false;
+    int tfd = -1;
+    off_t pos;
+    debug_decl(ts_convert_file, SUDOERS_DEBUG_AUTH);
+
+    table = calloc(nrecords, sizeof(*table));
+    if (table == NULL) {
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	debug_return_bool(false);
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.version = TS_VERSION;
+    hdr.size = sizeof(struct timestamp_entry);
+    hdr.type = TS_LOCKEXCL;
+    hdr.nslots = nslots;
+    memcpy(&table[0], &hdr, sizeof(hdr));
+    for (i = 1; i < nrecords; i++) {
+	table[i].version = TS_VERSION;
+	table[i].size = sizeof(struct timestamp_entry);
+	table[i].type = TS_UNUSED;
+    }
+
+    /*
+     * Carry over enabled records from a version 2 file, or all records
+     * from a version 3 file whose hash table is being resized.
+     */
+    if (pread(fd, &entry, sizeof(entry), 0) == sizeof(entry) &&
+	    (entry.version == 2 || entry.version == TS_VERSION) &&
+	    entry.type == TS_LOCKEXCL && entry.size == sizeof(entry)) {
+	version = entry.version;
+	for (pos = sizeof(entry); pread(fd, &entry, sizeof(entry), pos) ==
+		sizeof(entry) && entry.size == sizeof(entry);
+		pos += sizeof(entry)) {
+	    if (entry.version != version)
+		continue;
+	    if (version == 2 && ISSET(entry.flags, TS_DISABLED))
+		continue;
+	    if (entry.type != TS_GLOBAL && entry.type != TS_TTY &&
+		    entry.type != TS_PPID)
+		continue;
+	    entry.version = TS_VERSION;
+	    if (!ts_convert_insert(&table, &nrecords, nslots, &entry))
+		goto done;
+	}
+    }
+
+    /* Write the new time stamp file and rename it over the old one. */
+    if (asprintf(&tmpfile, "%s.XXXXXX", fname) == -1) {
+	tmpfile = NULL;
+	sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+	goto done;
+    }
+    tfd = ts_mkstemp(tmpfile);
+    switch (tfd) {
+    case TIMESTAMP_OPEN_ERROR:
+	log_warning(SLOG_SEND_MAIL, N_("unable to open %s"), tmpfile);
+	goto done;
+    case TIMESTAMP_PERM_ERROR:
+	/* Already logged set_perms/restore_perms error. */
+	goto done;
+    }
+    nwritten = write(tfd, table, nrecords * sizeof(*table));
+    if ((size_t)nwritten != nrecords * sizeof(*table)) {
+	if (nwritten == -1) {
+	    log_warning(SLOG_SEND_MAIL, N_("unable to write to %s"), tmpfile);
+	} else {
+	    log_warningx(SLOG_SEND_MAIL, N_("unable to write to %s"), tmpfile);
+	}
+	goto done;
+    }
+    if (rename(tmpfile, fname) == -1) {
+	log_warning(SLOG_SEND_MAIL, N_("unable to rename %s to %s"),
+	    tmpfile, fname);
+	goto done;
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"initialized time stamp file with %u slots, %zu records after table",
+	nslots, nrecords - nslots - 1);
+    ret = true;
+
+done:
+    if (tfd >= 0) {
+	close(tfd);
+	if (!ret)
+	    unlink(tmpfile);
+    }
+    free(tmpfile);
+    free(table);
     debug_return_bool(ret);
 }
 
+/*
+ * Returns true if fd no longer refers to the file fname, because it
+ * has been replaced or removed, else false.  The size of the file
+ * is stored in sizep.
+ */
+static bool
+ts_file_replaced(int fd, const char *fname, off_t *sizep)
+{
+    struct stat fd_sb, path_sb;
+    debug_decl(ts_file_replaced, SUDOERS_DEBUG_AUTH);
+
+    if (fstat(fd, &fd_sb) == 0 && stat(fname, &path_sb) == 0 &&
+	    fd_sb.st_dev == path_sb.st_dev && fd_sb.st_ino == path_sb.st_ino) {
+	if (sizep != NULL)
+	    *sizep = fd_sb.st_size;
+	debug_return_bool(false);
+    }
+    debug_return_bool(true);
+}
+
+/*
+ * Rewrite the time stamp file with a hash table of nslots slots.
+ * This is skipped if another sudo has one of the records locked,
+ * since it would go on using the old file.
+ * Called with the header record locked.
+ * Returns true if the file was replaced, else false.
+ */
+static bool
+ts_resize_file(int fd, const char *fname, unsigned int nslots)
+{
+    bool ret;
+    debug_decl(ts_resize_file, SUDOERS_DEBUG_AUTH);
+
+    /* Lock all the records, a length of zero extends to end of file. */
+    if (!timestamp_trylock_record(fd, TS_SLOT_OFFSET(0), 0)) {
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "time stamp records in use, not resizing to %u slots", nslots);
+	debug_return_bool(false);
+    }
+    sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	"resizing time stamp file to %u slots", nslots);
+    ret = ts_convert_file(fd, fname, nslots);
+    timestamp_unlock_record(fd, TS_SLOT_OFFSET(0), 0);
+    debug_return_bool(ret);
+}
+
+/*
+ * Lock the header record of the time stamp file, converting the file
+ * to the version 3 format if needed.  The hash table is doubled in
+ * size if more than TS_MAX_PROBES records have been appended to it.
+ * If the file has been replaced or removed since it was opened, fname
+ * is reopened with the given open(2) flags and *fdp is updated (or set
+ * to -1 on error).
+ * Fills in nslotsp (if not NULL) with the number of hash table slots.
+ * Returns true on success, else false.
+ */
+static bool
+ts_lock_header(int *fdp, const char *fname, int flags, unsigned int *nslotsp)
+{
+    struct timestamp_header hdr;
+    int fd = *fdp;
+    off_t size;
+    debug_decl(ts_lock_header, SUDOERS_DEBUG_AUTH);
+
+    for (;;) {
+	if (!timestamp_lock_record(fd, 0, sizeof(struct timestamp_entry)))
+	    debug_return_bool(false);
+
+	if (!ts_file_replaced(fd, fname, &size)) {
+	    if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+		    hdr.version == TS_VERSION && hdr.type == TS_LOCKEXCL &&
+		    hdr.size == sizeof(struct timestamp_entry) &&
+		    hdr.nslots != 0 && hdr.nslots <= TS_MAX_SLOTS) {
+		off_t noverflow = (size - TS_SLOT_OFFSET(hdr.nslots)) /
+		    (off_t)sizeof(struct timestamp_entry);
+
+		if (noverflow <= TS_MAX_PROBES || hdr.nslots > TS_MAX_SLOTS / 2 ||
+			!ts_resize_file(fd, fname, hdr.nslots * 2)) {
+		    if (nslotsp != NULL)
+			*nslotsp = hdr.nslots;
+		    debug_return_bool(true);
+		}
+	    } else {
+		sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+		    "new, old or corrupt time stamp file, rewriting");
+		if (!ts_convert_file(fd, fname, TS_NSLOTS))
+		    debug_return_bool(false);
+	    }
+	}
+
+	/* The file was replaced, reopen it (this drops the old lock). */
+	sudo_debug_printf(SUDO_DEBUG_INFO|SUDO_DEBUG_LINENO,
+	    "time stamp file %s replaced, reopening", fname);
+	close(fd);
+	fd = *fdp = ts_open(fname, flags);
+	switch (fd) {
+	case TIMESTAMP_OPEN_ERROR:
+	    if (errno != ENOENT)
+		log_warning(SLOG_SEND_MAIL, N_("unable to open %s"), fname);
+	    *fdp = -1;
+	    debug_return_bool(false);
+	case TIMESTAMP_PERM_ERROR:
+	    /* Already logged set_perms/restore_perms error. */
+	    *fdp = -1;
+	    debug_return_bool(false);
+	}
+    }
+}
+
+/*
+ * Find the record matching key in the hash table or after it, storing
+ * key in a free or stale slot (or at the end of the file) if there is
+ * none.  The position of the record is stored in posp.  If lockedp
+ * is not NULL, the record is locked if that can be done without
+ * waiting and lockedp is set to true.
+ * Called with the header record locked.
+ * Returns true on success, else false.
+ */
+static bool
+ts_find_slot(struct ts_cookie *cookie, struct timestamp_entry *key,
+    off_t *posp, bool *lockedp)
+{
+    struct timestamp_entry entry;
+    struct timespec now, *nowp = &now;
+    off_t pos = -1, stale_pos = -1;
+    unsigned int i, slot;
+    bool found = false, locked = false;
+    debug_decl(ts_find_slot, SUDOERS_DEBUG_AUTH);
+
+    if (sudo_gettime_mono(&now) == -1)
+	nowp = NULL;
+
+    slot = ts_hash_key(key) % cookie->nslots;
+    for (i = 0; i < MIN(cookie->nslots, TS_MAX_PROBES); i++) {
+	off_t slot_pos = TS_SLOT_OFFSET(slot);
+
+	if (pread(cookie->fd, &entry, sizeof(entry), slot_pos) !=
+		sizeof(entry) || (entry.version == TS_VERSION &&
+		entry.type == TS_UNUSED)) {
+	    /* Slots are never emptied, so key is not stored past here. */
+	    pos = slot_pos;
+	    break;
+	}
+	if (ts_match_record(key, &entry, slot)) {
+	    sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+		"found existing time stamp record in slot %u", slot);
+	    pos = slot_pos;
+	    found = true;
+	    break;
+	}
+	/* A stale record may be replaced unless another sudo has it locked. */
+	if (stale_pos == -1 && ts_stale_record(key, &entry, nowp) &&
+		timestamp_trylock_record(cookie->fd, slot_pos, sizeof(entry)))
+	    stale_pos = slot_pos;
+	slot = (slot + 1) % cookie->nslots;
+    }
+
+    if (pos == -1) {
+	/*
+	 * No free slot, the record may have been appended to the file.
+	 * Stale records there may be replaced too.
+	 */
+	off_t cur_pos = TS_SLOT_OFFSET(cookie->nslots);
+	ssize_t nread;
+
+	while ((nread = pread(cookie->fd, &entry, sizeof(entry), cur_pos)) ==
+		sizeof(entry)) {
+	    if (ts_match_record(key, &entry, 0)) {
+		sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+		    "found existing time stamp record at %lld",
+		    (long long)cur_pos);
+		pos = cur_pos;
+		found = true;
+		break;
+	    }
+	    if (stale_pos == -1 && ts_stale_record(key, &entry, nowp) &&
+		    timestamp_trylock_record(cookie->fd, cur_pos, sizeof(entry)))
+		stale_pos = cur_pos;
+	    cur_pos += sizeof(entry);
+	}
+	if (pos == -1) {
+	    if (stale_pos != -1) {
+		/* Replace the stale record, it is already locked. */
+		pos = stale_pos;
+		stale_pos = -1;
+		locked = true;
+	    } else {
+		/* Append, overwriting any partial record at the end. */
+		pos = cur_pos;
+	    }
+	}
+    }
+
+    if (!found) {
+	sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+	    "storing new time stamp record at %lld", (long long)pos);
+	if (ts_write(cookie->fd, cookie->fname, key, pos) == -1) {
+	    pos = -1;
+	    goto done;
+	}
+    }
+
+done:
+    if (stale_pos != -1)
+	timestamp_unlock_record(cookie->fd, stale_pos, sizeof(entry));
+    if (lockedp != NULL) {
+	if (pos != -1 && !locked)
+	    locked = timestamp_trylock_record(cookie->fd, pos, sizeof(entry));
+	*lockedp = locked;
+    } else if (locked) {
+	timestamp_unlock_record(cookie->fd, pos, sizeof(entry));
+    }
+    *posp = pos;
+    debug_return_bool(pos != -1);
+}
+
 /*
  * Lock a record in the time stamp file for exclusive access.
  * If the record does not exist, it is created (as disabled).
@@ -613,10 +1096,9 @@ bool
 timestamp_lock(void *vcookie, struct passwd *pw)
 {
     struct ts_cookie *cookie = vcookie;
-    struct timestamp_entry entry;
-    bool overwrite = false;
+    struct timestamp_entry key;
+    bool locked = false;
     off_t lock_pos;
-    ssize_t nread;
     debug_decl(timestamp_lock, SUDOERS_DEBUG_AUTH);
 
     if (cookie == NULL) {
@@ -626,99 +1108,46 @@ timestamp_lock(void *vcookie, struct passwd *pw)
     }
 
     /*
-     * Take a lock on the "write" record (the first record in the file).
-     * This will let us seek for the record or extend as needed
-     * without colliding with anyone else.
+     * Take a lock on the "write" record (the header at the start of
+     * the file).  This will let us search for the record or add one
+     * as needed without colliding with anyone else.  It also makes
+     * sure the file has a version 3 header and hash table.
      */
-    if (!timestamp_lock_record(cookie->fd, 0, sizeof(struct timestamp_entry)))
+again:
+    if (!ts_lock_header(&cookie->fd, cookie->fname, O_RDWR|O_CREAT,
+	    &cookie->nslots))
 	debug_return_bool(false);
 
-    /* Make sure the first record is of type TS_LOCKEXCL. */
-    memset(&entry, 0, sizeof(entry));
-    nread = read(cookie->fd, &entry, sizeof(entry));
-    if (nread < ssizeof(struct timestamp_entry_v1)) {
-	/* New or invalid time stamp file. */
-	overwrite = true;
-    } else if (entry.type != TS_LOCKEXCL) {
-	if (entry.size == sizeof(struct timestamp_entry_v1)) {
-	    /* Old sudo record, convert it to TS_LOCKEXCL. */
-	    entry.type = TS_LOCKEXCL;
-	    memset((char *)&entry + offsetof(struct timestamp_entry, flags), 0,
-		nread - offsetof(struct timestamp_entry, flags));
-	    if (ts_write(cookie->fd, cookie->fname, &entry, 0) == -1)
-		debug_return_bool(false);
-	} else {
-	    /* Corrupted time stamp file?  Just overwrite it. */
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
-		"corrupt initial record, type: %hu, size: %hu (expected %zu)",
-		entry.type, entry.size, sizeof(struct timestamp_entry_v1));
-	    overwrite = true;
-	}
-    }
-    if (overwrite) {
-	/* Rewrite existing time stamp file or create new one. */
-	if (ftruncate(cookie->fd, 0) != 0) {
-	    sudo_warn(U_("unable to truncate time stamp file to %lld bytes"),
-		0LL);
-	    debug_return_bool(false);
-	}
-	if (!timestamp_lock_write(cookie))
-	    debug_return_bool(false);
-    } else if (entry.size != sizeof(entry)) {
-	/* Reset position if the lock record has an unexpected size. */
-	if (lseek(cookie->fd, entry.size, SEEK_SET) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
-		"unable to seek to %hu", entry.size);
+    ts_init_key_nonglobal(&cookie->key, pw, TS_DISABLED);
+    if (def_timestamp_type == global) {
+	/*
+	 * For global tickets we use a separate record lock that we
+	 * cannot hold long-term since it is shared between all ttys.
+	 * It is looked up first, while we hold no record locks, since
+	 * our own tty record would otherwise look stale (it can be
+	 * locked without waiting).
+	 */
+	key = cookie->key;
+	key.type = TS_GLOBAL;	/* find a global record */
+	sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+	    "searching for global time stamp record");
+	if (!ts_find_slot(cookie, &key, &cookie->pos, NULL))
 	    debug_return_bool(false);
-	}
     }
 
-    /* Search for a tty/ppid-based record or append a new one. */
+    /* Search for a tty/ppid-based record or add a new one. */
     sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
 	"searching for %s time stamp record",
 	def_timestamp_type == ppid ? "ppid" : "tty");
-    ts_init_key_nonglobal(&cookie->key, pw, TS_DISABLED);
-    if (ts_find_record(cookie->fd, &cookie->key, &entry)) {
-	sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
-	    "found existing %s time stamp record",
-	    def_timestamp_type == ppid ? "ppid" : "tty");
-	lock_pos = lseek(cookie->fd, 0, SEEK_CUR) - (off_t)entry.size;
-    } else {
-	sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
-	    "appending new %s time stamp record",
-	    def_timestamp_type == ppid ? "ppid" : "tty");
-	lock_pos = lseek(cookie->fd, 0, SEEK_CUR);
-	if (ts_write(cookie->fd, cookie->fname, &cookie->key, -1) == -1)
-	    debug_return_bool(false);
-    }
+    if (!ts_find_slot(cookie, &cookie->key, &lock_pos, &locked))
+	debug_return_bool(false);
     sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
 	"%s time stamp position is %lld",
 	def_timestamp_type == ppid ? "ppid" : "tty", (long long)lock_pos);
 
     if (def_timestamp_type == global) {
-	/*
-	 * For global tickets we use a separate record lock that we
-	 * cannot hold long-term since it is shared between all ttys.
-	 */
 	cookie->locked = false;
-	cookie->key.type = TS_GLOBAL;	/* find a global record */
-
-	if (lseek(cookie->fd, 0, SEEK_SET) == -1) {
-	    sudo_debug_printf(SUDO_DEBUG_ERROR|SUDO_DEBUG_ERRNO|SUDO_DEBUG_LINENO,
-		"unable to rewind fd");
-	    debug_return_bool(false);
-	}
-	if (ts_find_record(cookie->fd, &cookie->key, &entry)) {
-	    sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
-		"found existing global record");
-	    cookie->pos = lseek(cookie->fd, 0, SEEK_CUR) - (off_t)entry.size;
-	} else {
-	    sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
-		"appending new global record");
-	    cookie->pos = lseek(cookie->fd, 0, SEEK_CUR);
-	    if (ts_write(cookie->fd, cookie->fname, &cookie->key, -1) == -1)
-		debug_return_bool(false);
-	}
+	cookie->key.type = TS_GLOBAL;
     } else {
 	/* For tty/ppid tickets the tty lock is the same as the record lock. */
 	cookie->pos = lock_pos;
@@ -728,9 +1157,19 @@ timestamp_lock(void *vcookie, struct passwd *pw)
     /* Unlock the TS_LOCKEXCL record. */
     timestamp_unlock_record(cookie->fd, 0, sizeof(struct timestamp_entry));
 
-    /* Lock the per-tty record (may sleep). */
-    if (!timestamp_lock_record(cookie->fd, lock_pos, sizeof(struct timestamp_entry)))
-	debug_return_bool(false);
+    /* Lock the per-tty record (may sleep) if not already locked. */
+    if (!locked) {
+	if (!timestamp_lock_record(cookie->fd, lock_pos, sizeof(struct timestamp_entry)))
+	    debug_return_bool(false);
+
+	/* The file may have been resized while we were waiting. */
+	if (ts_file_replaced(cookie->fd, cookie->fname, NULL)) {
+	    timestamp_unlock_record(cookie->fd, lock_pos,
+		sizeof(struct timestamp_entry));
+	    locked = false;
+	    goto again;
+	}
+    }
 
     debug_return_bool(true);
 }
@@ -808,6 +1247,14 @@ timestamp_status(void *vcookie, struct passwd *pw)
 	goto done;
     }
 
+    /* The slot may have been reused for a different record. */
+    if (!ts_match_record(&cookie->key, &entry, 0)) {
+	sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
+	    "time stamp record does not match key");
+	status = TS_OLD;
+	goto done;
+    }
+
     if (ISSET(entry.flags, TS_DISABLED)) {
 	sudo_debug_printf(SUDO_DEBUG_DEBUG|SUDO_DEBUG_LINENO,
 	    "time stamp record disabled");
@@ -987,10 +1434,14 @@ timestamp_remove(bool unlink_it)
 	ret = -1;
 	goto done;
     }
-    /* Lock first record to gain exclusive access. */
-    if (!timestamp_lock_record(fd, -1, sizeof(struct timestamp_entry))) {
-	sudo_warn(U_("unable to lock time stamp file %s"), fname);
-	ret = -1;
+    /*
+     * Lock first record to gain exclusive access, converting an older
+     * file so its records are not carried over later.
+     */
+    if (!ts_lock_header(&fd, fname, O_RDWR, NULL)) {
+	/* The file may have been removed while we waited for the lock. */
+	if (fd != -1 || errno != ENOENT)
+	    ret = false;
 	goto done;
     }
 
@@ -5183,6 +5183,7 @@ init_lexer(void)
     continued = false;
     digest_type = -1;
     prev_state = INITIAL;
+    sudoers_image_reset();
 
     debug_return;
 }
@@ -5236,6 +5237,9 @@ expand_include(const char *opath, size_t olen)
 	pp += dirlen;
     }
     if (subst) {
+	/* A compiled image of this policy is only valid on this host. */
+	(void)sudoers_image_set_host(user_shost);
+
 	/* substitute for %h */
 	cp = opath;
 	while (cp < ep) {
@@ -5256,6 +5260,24 @@ expand_include(const char *opath, size_t olen)
     debug_return_str(path);
 }
 
+/*
+ * Record an included sudoers file for the compiled policy image.
+ */
+static void
+add_image_source(const char *path, FILE *fp)
+{
+    struct stat sb;
+    debug_decl(add_image_source, SUDOERS_DEBUG_PARSER);
+
+    /* A file we cannot stat is recorded as missing, invalidating the image. */
+    if (fstat(fileno(fp), &sb) == 0)
+	(void)sudoers_image_add_source(path, &sb);
+    else
+	(void)sudoers_image_add_source(path, NULL);
+
+    debug_return;
+}
+
 /*
  * Open an include file (or file from a directory), push the old
  * sudoers file buffer and switch to the new one.
@@ -5298,6 +5320,8 @@ push_include(const char *opath, bool isdir)
 	int count, status;
 
 	status = sudo_secure_dir(path, sudoers_uid, sudoers_gid, &sb);
+	(void)sudoers_image_add_source(path,
+	    status == SUDO_PATH_MISSING ? NULL : &sb);
 	if (status != SUDO_PATH_SECURE) {
 	    if (sudoers_warnings) {
 		switch (status) {
@@ -5352,6 +5376,8 @@ push_include(const char *opath, bool isdir)
 	    debug_return_bool(false);
 	}
     }
+    add_image_source(path, fp);
+
     /* Push the old (current) file and open the new one. */
     istack[idepth].path = sudoers; /* push old path (and its ref) */
     istack[idepth].line = sudolinebuf;
@@ -5390,6 +5416,7 @@ pop_include(void)
 	SLIST_REMOVE_HEAD(&istack[idepth - 1].more, entries);
 	fp = open_sudoers(pl->path, false, &keepopen);
 	if (fp != NULL) {
+	    add_image_source(pl->path, fp);
 	    sudolinebuf.len = sudolinebuf.off = 0;
 	    sudolinebuf.toke_start = sudolinebuf.toke_end = 0;
 	    rcstr_delref(sudoers);
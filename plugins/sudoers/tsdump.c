@@ -46,14 +46,16 @@ union timestamp_entry_storage {
     struct timestamp_entry_common common;
     struct timestamp_entry_v1 v1;
     struct timestamp_entry v2;
+    struct timestamp_header header;
 };
 
 sudo_dso_public int main(int argc, char *argv[]);
 
 static void usage(void) __attribute__((__noreturn__));
-static void dump_entry(struct timestamp_entry *entry, off_t pos);
+static void dump_entry(struct timestamp_entry *entry, off_t pos, long slot);
 static bool valid_entry(union timestamp_entry_storage *u, off_t pos);
 static bool convert_entry(union timestamp_entry_storage *record, struct timespec *off);
+static char *type2string(int type);
 
 /*
  * tsdump: a simple utility to dump the contents of a time stamp file.
@@ -68,6 +70,8 @@ main(int argc, char *argv[])
     char *fname = NULL;
     union timestamp_entry_storage cur;
     struct timespec now, timediff;
+    unsigned int nslots = 0;
+    long slot, nrecords = 0;
     debug_decl(main, SUDOERS_DEBUG_MAIN);
 
 #if defined(SUDO_DEVEL) && defined(__OpenBSD__)
@@ -143,11 +147,27 @@ main(int argc, char *argv[])
 	    if (lseek(fd, offset, SEEK_CUR) == -1)
 		sudo_fatal("unable to seek %d bytes", (int)offset);
 	}
+	if (valid && pos == 0 && cur.common.version == TS_VERSION &&
+		cur.common.type == TS_LOCKEXCL) {
+	    /* Version 3 header, the hash table slots follow it. */
+	    nslots = cur.header.nslots;
+	    printf("position: 0\n");
+	    printf("version: %hu\n", cur.header.version);
+	    printf("type: %s\n", type2string(cur.header.type));
+	    printf("hash table slots: %u\n\n", nslots);
+	    continue;
+	}
+	/* Records after the hash table (if any) have no slot. */
+	slot = nrecords < (long)nslots ? nrecords : -1;
+	nrecords++;
 	if (valid) {
+	    /* Empty hash table slots are not shown. */
+	    if (slot != -1 && cur.common.type == TS_UNUSED)
+		continue;
 	    /* Convert entry to latest version as needed. */
 	    if (!convert_entry(&cur, &timediff))
 		continue;
-	    dump_entry(&cur.v2, pos);
+	    dump_entry(&cur.v2, pos, slot);
 	}
     }
 
@@ -169,9 +189,11 @@ valid_entry(union timestamp_entry_storage *u, off_t pos)
 	}
 	break;
     case 2:
+    case 3:
 	if (entry->size != sizeof(struct timestamp_entry)) {
-	    printf("wrong sized v2 record @ %lld, got %hu, expected %zu\n",
-		(long long)pos, entry->size, sizeof(struct timestamp_entry));
+	    printf("wrong sized v%hu record @ %lld, got %hu, expected %zu\n",
+		entry->version, (long long)pos, entry->size,
+		sizeof(struct timestamp_entry));
 	    debug_return_bool(false);
 	}
 	break;
@@ -239,7 +261,8 @@ convert_entry(union timestamp_entry_storage *record, struct timespec *off)
     union timestamp_entry_storage orig;
     debug_decl(convert_entry, SUDOERS_DEBUG_UTIL);
 
-    if (record->common.version != TS_VERSION) {
+    /* Version 2 and 3 records have the same layout. */
+    if (record->common.version != TS_VERSION && record->common.version != 2) {
 	if (record->common.version != 1) {
 	    sudo_warnx("unexpected record version %hu", record->common.version);
 	    debug_return_bool(false);
@@ -273,11 +296,13 @@ convert_entry(union timestamp_entry_storage *record, struct timespec *off)
 }
 
 static void
-dump_entry(struct timestamp_entry *entry, off_t pos)
+dump_entry(struct timestamp_entry *entry, off_t pos, long slot)
 {
     debug_decl(dump_entry, SUDOERS_DEBUG_UTIL);
 
     printf("position: %lld\n", (long long)pos);
+    if (slot != -1)
+	printf("hash table slot: %ld\n", slot);
     printf("version: %hu\n", entry->version);
     printf("size: %hu\n", entry->size);
     printf("type: %s\n", type2string(entry->type));
@@ -0,0 +1,565 @@
+/*
+ * SPDX-License-Identifier: ISC
+ *
+ * Copyright (c) 2021 Todd C. Miller <Todd.Miller@sudo.ws>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * This is an open source non-commercial project. Dear PVS-Studio, please check it.
+ * PVS-Studio Static Code Analyzer for C, C++ and C#: http://www.viva64.com
+ */
+
+/*
+ * Index of the userspecs in a parse tree by the users they can match.
+ *
+ * A userspec can only match a user if one of the members in its user
+ * list that would result in ALLOW matches.  For each userspec we
+ * collect those members, following aliases and keeping track of
+ * negation, and file the userspec under the user name, uid, group,
+ * gid or netgroup they refer to.  Userspecs that contain ALL are
+ * candidates for every user.
+ *
+ * A lookup returns a superset of the matching userspecs, in sudoers
+ * order.  The caller must still call userlist_matches() for each one,
+ * which preserves the existing semantics (including last match wins)
+ * while only evaluating a small number of entries.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pwd.h>
+#include <grp.h>
+
+#include "sudoers.h"
+#include "redblack.h"
+#include <gram.h>
+
+struct userspec_index_entry {
+    char *key;			/* user, #uid, group, #gid or netgroup */
+    unsigned int *specs;	/* userspec numbers, in ascending order */
+    unsigned int nspecs;
+    unsigned int specs_size;
+    bool mixed_case;		/* key added with different case */
+};
+
+struct userspec_index {
+    struct userspec **specs;	/* userspecs in sudoers order */
+    unsigned int nspecs;
+    struct rbtree *users;	/* user name or #uid */
+    struct rbtree *groups;	/* Unix group name or #gid, no leading '%' */
+    struct rbtree *nonunix_groups; /* %:group, evaluated by group plugin */
+    struct rbtree *netgroups;	/* +netgroup, evaluated individually */
+    struct userspec_index_entry always; /* userspecs that include ALL */
+};
+
+struct userspec_index_lookup {
+    struct sudoers_parse_tree *parse_tree;
+    struct userspec_index *uidx;
+    const struct passwd *pw;
+    unsigned int *bitmap;
+    size_t count;
+};
+
+#define USIDX_NBITS	(sizeof(unsigned int) * 8)
+
+/*
+ * Keys are compared case-insensitively so a single lookup finds the
+ * entries for both case_insensitive_user and case_insensitive_group.
+ */
+static int
+userspec_index_compare(const void *v1, const void *v2)
+{
+    const struct userspec_index_entry *e1 = v1;
+    const struct userspec_index_entry *e2 = v2;
+
+    return strcasecmp(e1->key, e2->key);
+}
+
+static void
+userspec_index_entry_free(void *v)
+{
+    struct userspec_index_entry *entry = v;
+
+    free(entry->key);
+    free(entry->specs);
+    free(entry);
+}
+
+/*
+ * Append userspec number n to entry, ignoring duplicates.
+ */
+static bool
+userspec_index_entry_add(struct userspec_index_entry *entry, unsigned int n)
+{
+    debug_decl(userspec_index_entry_add, SUDOERS_DEBUG_PARSER);
+
+    if (entry->nspecs != 0 && entry->specs[entry->nspecs - 1] == n)
+	debug_return_bool(true);
+    if (entry->nspecs == entry->specs_size) {
+	unsigned int new_size = entry->specs_size ? entry->specs_size * 2 : 4;
+	unsigned int *specs;
+
+	specs = reallocarray(entry->specs, new_size, sizeof(*specs));
+	if (specs == NULL)
+	    debug_return_bool(false);
+	entry->specs = specs;
+	entry->specs_size = new_size;
+    }
+    entry->specs[entry->nspecs++] = n;
+    debug_return_bool(true);
+}
+
+/*
+ * File userspec number n under key in tree, creating the entry as needed.
+ */
+static bool
+userspec_index_add(struct rbtree *tree, const char *key, unsigned int n)
+{
+    struct userspec_index_entry *entry, ekey;
+    struct rbnode *node;
+    debug_decl(userspec_index_add, SUDOERS_DEBUG_PARSER);
+
+    ekey.key = (char *)key;
+    if ((node = rbfind(tree, &ekey)) != NULL) {
+	entry = node->data;
+	if (strcmp(entry->key, key) != 0)
+	    entry->mixed_case = true;
+    } else {
+	if ((entry = calloc(1, sizeof(*entry))) == NULL)
+	    debug_return_bool(false);
+	if ((entry->key = strdup(key)) == NULL) {
+	    free(entry);
+	    debug_return_bool(false);
+	}
+	if (rbinsert(tree, entry, NULL) != 0) {
+	    userspec_index_entry_free(entry);
+	    debug_return_bool(false);
+	}
+    }
+    debug_return_bool(userspec_index_entry_add(entry, n));
+}
+
+/*
+ * File userspec number n under a sudo-style "#id" key.  Numeric IDs are
+ * stored in canonical form so that "#0" and "#00" share an entry.
+ */
+static bool
+userspec_index_add_id(struct rbtree *tree, const char *key, unsigned int n)
+{
+    const char *errstr;
+    char idbuf[MAX_UID_T_LEN + 2];
+    id_t id;
+    debug_decl(userspec_index_add_id, SUDOERS_DEBUG_PARSER);
+
+    id = sudo_strtoid(key + 1, &errstr);
+    if (errstr == NULL) {
+	(void)snprintf(idbuf, sizeof(idbuf), "#%u", (unsigned int)id);
+	if (strcmp(idbuf, key) != 0) {
+	    if (!userspec_index_add(tree, idbuf, n))
+		debug_return_bool(false);
+	}
+    }
+    debug_return_bool(userspec_index_add(tree, key, n));
+}
+
+/*
+ * Add the members of list that can cause a match for userspec number n.
+ * The negated flag is true if list is referenced via an odd number of
+ * negated aliases, in which case negated members can cause a match.
+ */
+static bool
+userspec_index_add_members(struct sudoers_parse_tree *parse_tree,
+    struct userspec_index *uidx, struct member_list *list, bool negated,
+    unsigned int n)
+{
+    struct member *m;
+    struct alias *a;
+    bool ret = true;
+    debug_decl(userspec_index_add_members, SUDOERS_DEBUG_PARSER);
+
+    TAILQ_FOREACH(m, list, entries) {
+	const bool positive = m->negated == negated;
+
+	/* Alias members are followed with the combined negation. */
+	if (m->type == ALIAS) {
+	    a = alias_get(parse_tree, m->name, USERALIAS);
+	    if (a != NULL) {
+		ret = userspec_index_add_members(parse_tree, uidx,
+		    &a->members, m->negated != negated, n);
+		alias_put(a);
+		if (!ret)
+		    break;
+		continue;
+	    }
+	    /* Missing aliases are matched as a user name, see user_matches() */
+	}
+	if (!positive)
+	    continue;
+
+	switch (m->type) {
+	    case ALL:
+		ret = userspec_index_entry_add(&uidx->always, n);
+		break;
+	    case NETGROUP:
+		ret = userspec_index_add(uidx->netgroups, m->name, n);
+		break;
+	    case USERGROUP:
+		if (m->name[1] == ':') {
+		    ret = userspec_index_add(uidx->nonunix_groups, m->name, n);
+		} else if (m->name[1] == '#') {
+		    ret = userspec_index_add_id(uidx->groups, m->name + 1, n);
+		} else {
+		    ret = userspec_index_add(uidx->groups, m->name + 1, n);
+		}
+		break;
+	    case ALIAS:
+	    case WORD:
+		if (m->name[0] == '#') {
+		    ret = userspec_index_add_id(uidx->users, m->name, n);
+		} else {
+		    ret = userspec_index_add(uidx->users, m->name, n);
+		}
+		break;
+	    default:
+		/* Not a valid user list member, always check it. */
+		ret = userspec_index_entry_add(&uidx->always, n);
+		break;
+	}
+	if (!ret)
+	    break;
+    }
+    debug_return_bool(ret);
+}
+
+/*
+ * Free a userspec index.
+ */
+void
+userspec_index_free(struct userspec_index *uidx)
+{
+    debug_decl(userspec_index_free, SUDOERS_DEBUG_PARSER);
+
+    if (uidx != NULL) {
+	if (uidx->users != NULL)
+	    rbdestroy(uidx->users, userspec_index_entry_free);
+	if (uidx->groups != NULL)
+	    rbdestroy(uidx->groups, userspec_index_entry_free);
+	if (uidx->nonunix_groups != NULL)
+	    rbdestroy(uidx->nonunix_groups, userspec_index_entry_free);
+	if (uidx->netgroups != NULL)
+	    rbdestroy(uidx->netgroups, userspec_index_entry_free);
+	free(uidx->always.specs);
+	free(uidx->specs);
+	free(uidx);
+    }
+
+    debug_return;
+}
+
+/*
+ * Build an index of the userspecs in parse_tree, replacing any existing one.
+ * The parse tree must not be modified while the index is in use.
+ * Returns true on success, else false.
+ */
+bool
+userspec_index_build(struct sudoers_parse_tree *parse_tree)
+{
+    struct userspec_index *uidx;
+    struct userspec *us;
+    unsigned int n = 0;
+    debug_decl(userspec_index_build, SUDOERS_DEBUG_PARSER);
+
+    userspec_index_free(parse_tree->uindex);
+    parse_tree->uindex = NULL;
+
+    if ((uidx = calloc(1, sizeof(*uidx))) == NULL)
+	goto oom;
+    uidx->users = rbcreate(userspec_index_compare);
+    uidx->groups = rbcreate(userspec_index_compare);
+    uidx->nonunix_groups = rbcreate(userspec_index_compare);
+    uidx->netgroups = rbcreate(userspec_index_compare);
+    if (uidx->users == NULL || uidx->groups == NULL ||
+	    uidx->nonunix_groups == NULL || uidx->netgroups == NULL)
+	goto oom;
+
+    TAILQ_FOREACH(us, &parse_tree->userspecs, entries)
+	uidx->nspecs++;
+    uidx->specs = reallocarray(NULL, uidx->nspecs ? uidx->nspecs : 1,
+	sizeof(struct userspec *));
+    if (uidx->specs == NULL)
+	goto oom;
+
+    TAILQ_FOREACH(us, &parse_tree->userspecs, entries) {
+	uidx->specs[n] = us;
+	if (!userspec_index_add_members(parse_tree, uidx, &us->users, false, n))
+	    goto oom;
+	n++;
+    }
+    parse_tree->uindex = uidx;
+
+    sudo_debug_printf(SUDO_DEBUG_INFO,
+	"indexed %u userspecs, %u match all users", uidx->nspecs,
+	uidx->always.nspecs);
+    debug_return_bool(true);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    userspec_index_free(uidx);
+    debug_return_bool(false);
+}
+
+/*
+ * Mark the userspecs in entry as candidates.
+ */
+static void
+userspec_index_mark(struct userspec_index_lookup *lookup,
+    struct userspec_index_entry *entry)
+{
+    unsigned int i;
+
+    for (i = 0; i < entry->nspecs; i++) {
+	const unsigned int n = entry->specs[i];
+	const unsigned int bit = 1U << (n % USIDX_NBITS);
+
+	if (!ISSET(lookup->bitmap[n / USIDX_NBITS], bit)) {
+	    SET(lookup->bitmap[n / USIDX_NBITS], bit);
+	    lookup->count++;
+	}
+    }
+}
+
+/*
+ * Mark the userspecs filed under key in tree, if any.
+ */
+static void
+userspec_index_find(struct userspec_index_lookup *lookup, struct rbtree *tree,
+    const char *key)
+{
+    struct userspec_index_entry ekey;
+    struct rbnode *node;
+
+    ekey.key = (char *)key;
+    if ((node = rbfind(tree, &ekey)) != NULL)
+	userspec_index_mark(lookup, node->data);
+}
+
+/*
+ * Mark the userspecs filed under "#id" in tree, if any.
+ */
+static void
+userspec_index_find_id(struct userspec_index_lookup *lookup,
+    struct rbtree *tree, id_t id)
+{
+    char idbuf[MAX_UID_T_LEN + 2];
+
+    (void)snprintf(idbuf, sizeof(idbuf), "#%u", (unsigned int)id);
+    userspec_index_find(lookup, tree, idbuf);
+}
+
+/*
+ * rbapply() callback for user groups that must be checked one at a time.
+ * Entries that were added with different case are always candidates.
+ */
+static int
+userspec_index_check_group(void *v, void *cookie)
+{
+    struct userspec_index_entry *entry = v;
+    struct userspec_index_lookup *lookup = cookie;
+
+    if (entry->mixed_case ||
+	    usergr_matches(entry->key, lookup->pw->pw_name, lookup->pw))
+	userspec_index_mark(lookup, entry);
+    return 0;
+}
+
+/*
+ * rbapply() callback for Unix groups when group lookups cannot be
+ * done via the user's group list.  Keys lack the leading '%'.
+ */
+static int
+userspec_index_check_unix_group(void *v, void *cookie)
+{
+    struct userspec_index_entry *entry = v;
+    struct userspec_index_lookup *lookup = cookie;
+    bool matched = entry->mixed_case;
+
+    if (!matched) {
+	const size_t len = strlen(entry->key) + 2;
+	char *group = malloc(len);
+
+	/* On allocation failure, just treat it as a candidate. */
+	if (group != NULL) {
+	    (void)snprintf(group, len, "%%%s", entry->key);
+	    matched = usergr_matches(group, lookup->pw->pw_name, lookup->pw);
+	    free(group);
+	} else {
+	    matched = true;
+	}
+    }
+    if (matched)
+	userspec_index_mark(lookup, entry);
+    return 0;
+}
+
+/*
+ * rbapply() callback for netgroups, which cannot be enumerated by user.
+ */
+static int
+userspec_index_check_netgroup(void *v, void *cookie)
+{
+    struct userspec_index_entry *entry = v;
+    struct userspec_index_lookup *lookup = cookie;
+    struct sudoers_parse_tree *parse_tree = lookup->parse_tree;
+    const char *lhost = parse_tree->lhost ? parse_tree->lhost : user_runhost;
+    const char *shost = parse_tree->shost ? parse_tree->shost : user_srunhost;
+
+    if (entry->mixed_case || netgr_matches(entry->key,
+	    def_netgroup_tuple ? lhost : NULL,
+	    def_netgroup_tuple ? shost : NULL, lookup->pw->pw_name))
+	userspec_index_mark(lookup, entry);
+    return 0;
+}
+
+/*
+ * Mark the userspecs that refer to groups pw is a member of.
+ */
+static void
+userspec_index_find_groups(struct userspec_index_lookup *lookup)
+{
+    struct userspec_index *uidx = lookup->uidx;
+    const struct passwd *pw = lookup->pw;
+    struct group_list *grlist;
+    struct gid_list *gidlist;
+    struct group *grp;
+    int i;
+    debug_decl(userspec_index_find_groups, SUDOERS_DEBUG_PARSER);
+
+    if (!rbisempty(uidx->nonunix_groups)) {
+	rbapply(uidx->nonunix_groups, userspec_index_check_group, lookup,
+	    inorder);
+    }
+
+    if (rbisempty(uidx->groups))
+	debug_return;
+
+    /*
+     * When matching by group-ID or querying the group plugin for Unix
+     * groups, each group in sudoers must be resolved individually.
+     */
+    if (def_match_group_by_gid ||
+	    (def_group_plugin && def_always_query_group_plugin)) {
+	rbapply(uidx->groups, userspec_index_check_unix_group, lookup,
+	    inorder);
+	debug_return;
+    }
+
+    /* Otherwise, look up the user's groups, see user_in_group(). */
+    userspec_index_find_id(lookup, uidx->groups, pw->pw_gid);
+    if ((gidlist = sudo_get_gidlist(pw, ENTRY_TYPE_ANY)) != NULL) {
+	for (i = 0; i < gidlist->ngids; i++)
+	    userspec_index_find_id(lookup, uidx->groups, gidlist->gids[i]);
+	sudo_gidlist_delref(gidlist);
+    }
+    if ((grlist = sudo_get_grlist(pw)) != NULL) {
+	for (i = 0; i < grlist->ngroups; i++)
+	    userspec_index_find(lookup, uidx->groups, grlist->groups[i]);
+	sudo_grlist_delref(grlist);
+    }
+    if ((grp = sudo_getgrgid(pw->pw_gid)) != NULL) {
+	userspec_index_find(lookup, uidx->groups, grp->gr_name);
+	sudo_gr_delref(grp);
+    }
+
+    debug_return;
+}
+
+/*
+ * Return the userspecs in parse_tree that may match the user described
+ * by pw, in sudoers order.  If there is no index, all userspecs are
+ * returned.  The number of entries is stored in nspecs.
+ * Returns an array the caller must free, or NULL on allocation failure.
+ */
+struct userspec **
+userspec_index_lookup(struct sudoers_parse_tree *parse_tree,
+    const struct passwd *pw, size_t *nspecs)
+{
+    struct userspec_index *uidx = parse_tree->uindex;
+    struct userspec_index_lookup lookup;
+    struct userspec **specs = NULL;
+    struct userspec *us;
+    unsigned int i, j;
+    size_t n = 0;
+    debug_decl(userspec_index_lookup, SUDOERS_DEBUG_PARSER);
+
+    if (uidx == NULL) {
+	TAILQ_FOREACH(us, &parse_tree->userspecs, entries)
+	    n++;
+	specs = reallocarray(NULL, n ? n : 1, sizeof(*specs));
+	if (specs == NULL)
+	    goto oom;
+	n = 0;
+	TAILQ_FOREACH(us, &parse_tree->userspecs, entries)
+	    specs[n++] = us;
+	*nspecs = n;
+	debug_return_ptr(specs);
+    }
+
+    memset(&lookup, 0, sizeof(lookup));
+    lookup.parse_tree = parse_tree;
+    lookup.uidx = uidx;
+    lookup.pw = pw;
+    lookup.bitmap = calloc(uidx->nspecs / USIDX_NBITS + 1,
+	sizeof(unsigned int));
+    if (lookup.bitmap == NULL)
+	goto oom;
+
+    userspec_index_mark(&lookup, &uidx->always);
+    userspec_index_find(&lookup, uidx->users, pw->pw_name);
+    userspec_index_find_id(&lookup, uidx->users, pw->pw_uid);
+    userspec_index_find_groups(&lookup);
+    if (def_use_netgroups && !rbisempty(uidx->netgroups)) {
+	rbapply(uidx->netgroups, userspec_index_check_netgroup, &lookup,
+	    inorder);
+    }
+
+    specs = reallocarray(NULL, lookup.count ? lookup.count : 1, sizeof(*specs));
+    if (specs == NULL) {
+	free(lookup.bitmap);
+	goto oom;
+    }
+    for (i = 0; n < lookup.count; i++) {
+	const unsigned int word = lookup.bitmap[i];
+
+	if (word == 0)
+	    continue;
+	for (j = 0; j < USIDX_NBITS; j++) {
+	    if (ISSET(word, 1U << j))
+		specs[n++] = uidx->specs[i * USIDX_NBITS + j];
+	}
+    }
+    free(lookup.bitmap);
+
+    sudo_debug_printf(SUDO_DEBUG_DEBUG,
+	"%zu of %u userspecs are candidates for user %s", n, uidx->nspecs,
+	pw->pw_name);
+    *nspecs = n;
+    debug_return_ptr(specs);
+oom:
+    sudo_warnx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    debug_return_ptr(NULL);
+}
@@ -95,6 +95,7 @@ static bool reparse_sudoers(char *, int, char **, bool, bool);
 static int run_command(char *, char **);
 static void parse_sudoers_options(void);
 static void setup_signals(void);
+static void update_image(bool);
 static void help(void) __attribute__((__noreturn__));
 static void usage(int);
 static void visudo_cleanup(void);
@@ -109,6 +110,7 @@ struct sudo_user sudo_user;
 struct passwd *list_pw;
 static struct sudoersfile_list sudoerslist = TAILQ_HEAD_INITIALIZER(sudoerslist);
 static bool checkonly;
+static bool compiling;
 static const char short_opts[] =  "cf:hqsVx:";
 static struct option long_opts[] = {
     { "check",		no_argument,		NULL,	'c' },
@@ -291,6 +293,7 @@ main(int argc, char *argv[])
 	TAILQ_FOREACH(sp, &sudoerslist, entries) {
 	    (void) install_sudoers(sp, fflag);
 	}
+	update_image(fflag);
     }
     free(editor);
 
@@ -791,6 +794,59 @@ done:
     debug_return_bool(ret);
 }
 
+/*
+ * Recompile the sudoers policy image from the installed sudoers file(s).
+ * The image is only kept up to date if it already exists.
+ */
+static void
+update_image(bool oldperms)
+{
+    uid_t uid = sudoers_uid;
+    gid_t gid = sudoers_gid;
+    mode_t mode = sudoers_mode;
+    char *image_path;
+    struct stat sb;
+    int oldlocale;
+    FILE *fp;
+    debug_decl(update_image, SUDOERS_DEBUG_UTIL);
+
+    if ((image_path = sudoers_image_path(sudoers_file)) == NULL)
+	sudo_fatalx(U_("%s: %s"), __func__, U_("unable to allocate memory"));
+    if (lstat(image_path, &sb) == -1)
+	goto done;
+    if (oldperms) {
+	/* Use perms of the existing image. */
+	uid = sb.st_uid;
+	gid = sb.st_gid;
+	mode = sb.st_mode & ACCESSPERMS;
+    }
+    if ((fp = fopen(sudoers_file, "r")) == NULL) {
+	sudo_warn(U_("unable to open %s"), sudoers_file);
+	goto done;
+    }
+
+    /* Parse the installed files, not the temporary copies. */
+    compiling = true;
+    init_parser(sudoers_file, true, false);
+    if (fstat(fileno(fp), &sb) == 0)
+	(void)sudoers_image_add_source(sudoers_file, &sb);
+    sudoersrestart(fp);
+    sudoers_setlocale(SUDOERS_LOCALE_SUDOERS, &oldlocale);
+    if (sudoersparse() || parse_error) {
+	sudo_warnx(U_("unable to parse %s, %s not updated"), sudoers_file,
+	    image_path);
+    } else {
+	(void)sudoers_image_write(&parsed_policy, image_path, uid, gid, mode);
+    }
+    sudoers_setlocale(oldlocale, NULL);
+    fclose(fp);
+    compiling = false;
+
+done:
+    free(image_path);
+    debug_return;
+}
+
 /*
  * Assuming a parse error occurred, prompt the user for what they want
  * to do now.  Returns the first letter of their choice.
@@ -1039,6 +1095,15 @@ open_sudoers(const char *path, bool doedit, bool *keepopen)
     FILE *fp;
     debug_decl(open_sudoers, SUDOERS_DEBUG_UTIL);
 
+    /* Installed files are read directly when compiling the policy image. */
+    if (compiling) {
+	if ((fp = fopen(path, "r")) == NULL)
+	    sudo_warn("%s", path);
+	if (keepopen != NULL)
+	    *keepopen = false;
+	debug_return_ptr(fp);
+    }
+
     /* Check for existing entry */
     TAILQ_FOREACH(entry, &sudoerslist, entries) {
 	if (strcmp(path, entry->path) == 0)